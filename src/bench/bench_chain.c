@@ -0,0 +1,122 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * hammer2_base_find(), the blockref array search under every chain lookup
+ * and iteration.  It is static, so the kernel source is compiled into this
+ * file.  The linker then never pulls hammer2_chain.o out of libhammer2k,
+ * all of its symbols being defined here already.
+ */
+
+#include <fs/hammer2/hammer2_chain.c>
+
+#include "hammer2bench.h"
+
+#define BENCH_KEYS		4096
+
+typedef struct bench_find {
+	hammer2_chain_t		chain;		/* parent, never locked */
+	hammer2_blockref_t	*base;
+	int			count;
+	hammer2_key_t		keys[BENCH_KEYS];
+} bench_find_t;
+
+static uint64_t
+do_base_find(void *arg, uint64_t iters)
+{
+	bench_find_t *bf = arg;
+	hammer2_key_t key_next;
+	uint64_t i, n = 0;
+
+	for (i = 0; i < iters; ++i) {
+		key_next = HAMMER2_KEY_MAX;
+		n += hammer2_base_find(&bf->chain, bf->base, bf->count,
+		    &key_next, bf->keys[i % BENCH_KEYS], HAMMER2_KEY_MAX);
+	}
+
+	return (n);
+}
+
+/*
+ * A full indirect block (512 blockrefs) and an inode's embedded array
+ * (4), each blockref covering 64KB of a file.  The sequential variant
+ * looks up every data block in turn as a large read(2) does and runs off
+ * cache_index, the random ones search from wherever the last lookup left
+ * off.
+ */
+static void
+bench_base_find_one(const char *name, int count, int random)
+{
+	bench_find_t *bf;
+	uint64_t state = bench_opts.seed;
+	int i;
+
+	bf = malloc(sizeof(*bf), M_TEMP, M_WAITOK | M_ZERO);
+	bf->base = malloc(count * sizeof(*bf->base), M_TEMP,
+	    M_WAITOK | M_ZERO);
+	bf->count = count;
+	for (i = 0; i < count; ++i) {
+		bf->base[i].type = HAMMER2_BREF_TYPE_DATA;
+		bf->base[i].keybits = HAMMER2_PBUFRADIX;
+		bf->base[i].key = (hammer2_key_t)i << HAMMER2_PBUFRADIX;
+	}
+	bf->chain.flags = HAMMER2_CHAIN_COUNTEDBREFS;
+	bf->chain.core.live_zero = count;
+
+	for (i = 0; i < BENCH_KEYS; ++i) {
+		if (random)
+			bf->keys[i] = bench_random(&state) %
+			    ((hammer2_key_t)count << HAMMER2_PBUFRADIX);
+		else
+			bf->keys[i] = (hammer2_key_t)(i % count) <<
+			    HAMMER2_PBUFRADIX;
+	}
+	bench_micro(name, 0, do_base_find, bf);
+
+	free(bf->base, M_TEMP, count * sizeof(*bf->base));
+	free(bf, M_TEMP, sizeof(*bf));
+}
+
+void
+bench_base_find(void)
+{
+	bench_kern_enter();
+	bench_base_find_one("base_find/seq/512", 512, 0);
+	bench_base_find_one("base_find/random/512", 512, 1);
+	bench_base_find_one("base_find/random/4", HAMMER2_SET_COUNT, 1);
+	bench_kern_exit();
+}
@@ -0,0 +1,120 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * hammer2_bmap_alloc(), the bitmap search at the bottom of every block
+ * allocation.  Static like hammer2_base_find(), see bench_chain.c.
+ */
+
+#include <fs/hammer2/hammer2_freemap.c>
+
+#include "hammer2bench.h"
+
+#define BENCH_ZONE_BASE		((hammer2_off_t)1 << 30)
+#define BENCH_ZONES		256	/* 1GB of 4MB zones */
+
+typedef struct bench_bmap {
+	hammer2_dev_t		*hmp;
+	hammer2_bmap_data_t	bmap;
+	hammer2_off_t		zone;
+	int			radix;
+	uint32_t		sub_key;
+} bench_bmap_t;
+
+static void
+bmap_reset(bench_bmap_t *bb)
+{
+	bzero(&bb->bmap, sizeof(bb->bmap));
+	bb->bmap.avail = HAMMER2_SEGSIZE;
+	bb->zone = (bb->zone + 1) % BENCH_ZONES;
+}
+
+/*
+ * File data allocations in key order, a zone being refilled from scratch
+ * once it is full.  Sub-64KB allocations include the hammer2_io_newnz()
+ * of each fresh device buffer, as they do in the kernel.
+ */
+static uint64_t
+do_bmap_alloc(void *arg, uint64_t iters)
+{
+	bench_bmap_t *bb = arg;
+	hammer2_key_t base;
+	uint16_t class;
+	uint64_t i, n = 0;
+
+	class = (HAMMER2_BREF_TYPE_DATA << 8) | HAMMER2_PBUFRADIX;
+	for (i = 0; i < iters; ++i) {
+		for (;;) {
+			base = BENCH_ZONE_BASE + bb->zone * HAMMER2_SEGSIZE;
+			if (hammer2_bmap_alloc(bb->hmp, &bb->bmap, class, 0,
+			    bb->sub_key, bb->radix, &base) == 0)
+				break;
+			bmap_reset(bb);
+		}
+		bb->sub_key += 1U << bb->radix;
+		n += base;
+	}
+
+	return (n);
+}
+
+void
+bench_bmap_alloc(void)
+{
+	static const int radixes[] = { 10, 14, 16 };	/* 1KB, 16KB, 64KB */
+	bench_bmap_t bb;
+	char name[64];
+	size_t k;
+
+	bench_kern_enter();
+	bzero(&bb, sizeof(bb));
+	bb.hmp = bench_dev_alloc();
+	/* Keep hammer2_voldata_modify() away from the global counters. */
+	bb.hmp->vchain.flags |= HAMMER2_CHAIN_MODIFIED;
+	bb.hmp->voldata.allocator_free = bb.hmp->total_size;
+
+	for (k = 0; k < nitems(radixes); ++k) {
+		bb.radix = radixes[k];
+		bb.sub_key = 0;
+		bmap_reset(&bb);
+		snprintf(name, sizeof(name), "bmap_alloc/%d", 1 << bb.radix);
+		bench_micro(name, 0, do_bmap_alloc, &bb);
+	}
+
+	bench_dev_free(bb.hmp);
+	bench_kern_exit();
+}
@@ -0,0 +1,500 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Micro benchmarks of the exported kernel routines: the hashes and check
+ * codes, the compressors as used by the strategy code, and the DIO hash.
+ */
+
+#include <fs/hammer2/hammer2.h>
+#include <fs/hammer2/hammer2_lz4.h>
+#include <fs/hammer2/hammer2_xxhash.h>
+
+#include <lib/libz/zlib.h>
+
+#include <err.h>
+
+#include "hammer2bench.h"
+
+#define BENCH_NAMES		1024
+#define BENCH_DIOS		1024	/* 64MB of device buffers */
+#define BENCH_DEV_SIZE		((hammer2_off_t)1 << 40)
+
+void
+bench_kern_enter(void)
+{
+	hammer2k_proc_enter();
+	hammer2k_giant_enter();
+}
+
+void
+bench_kern_exit(void)
+{
+	hammer2k_bufdaemon();
+	hammer2k_giant_exit();
+}
+
+typedef struct bench_buf {
+	const char	*data;
+	size_t		size;		/* per operation */
+	size_t		total;
+} bench_buf_t;
+
+static const char *
+buf_next(bench_buf_t *bb, uint64_t i)
+{
+	return (bb->data + (i * bb->size) % bb->total);
+}
+
+/*
+ * Directory entry names, as random as they get in a file name.
+ */
+typedef struct bench_names {
+	char		*names[BENCH_NAMES];
+	size_t		len;
+} bench_names_t;
+
+static uint64_t
+do_dirhash(void *arg, uint64_t iters)
+{
+	bench_names_t *bn = arg;
+	uint64_t i, h = 0;
+
+	for (i = 0; i < iters; ++i)
+		h ^= hammer2_dirhash(bn->names[i % BENCH_NAMES], bn->len);
+
+	return (h);
+}
+
+static uint64_t
+do_icrc32(void *arg, uint64_t iters)
+{
+	bench_buf_t *bb = arg;
+	uint64_t i, h = 0;
+
+	for (i = 0; i < iters; ++i)
+		h ^= hammer2_icrc32(buf_next(bb, i), bb->size);
+
+	return (h);
+}
+
+static uint64_t
+do_xxh64(void *arg, uint64_t iters)
+{
+	bench_buf_t *bb = arg;
+	uint64_t i, h = 0;
+
+	for (i = 0; i < iters; ++i)
+		h ^= XXH64(buf_next(bb, i), bb->size, XXH_HAMMER2_SEED);
+
+	return (h);
+}
+
+void
+bench_hash(void)
+{
+	static const size_t lens[] = { 8, 32, 255 };
+	static const size_t sizes[] = { 512, 16384, 65536 };
+	static const char chars[] =
+	    "abcdefghijklmnopqrstuvwxyz0123456789._-";
+	bench_names_t bn;
+	bench_buf_t bb;
+	uint64_t state = bench_opts.seed;
+	char name[64];
+	size_t i, j, k;
+
+	bench_kern_enter();
+	for (k = 0; k < nitems(lens); ++k) {
+		bn.len = lens[k];
+		for (i = 0; i < BENCH_NAMES; ++i) {
+			bn.names[i] = malloc(bn.len, M_TEMP, M_WAITOK);
+			for (j = 0; j < bn.len; ++j)
+				bn.names[i][j] = chars[bench_random(&state) %
+				    (sizeof(chars) - 1)];
+		}
+		snprintf(name, sizeof(name), "dirhash/%zu", bn.len);
+		bench_micro(name, 0, do_dirhash, &bn);
+		for (i = 0; i < BENCH_NAMES; ++i)
+			free(bn.names[i], M_TEMP, bn.len);
+	}
+
+	bb.data = bench_corpus(BENCH_CORPUS_BINARY);
+	bb.total = (size_t)BENCH_CORPUS_BLOCKS * BENCH_BLOCK_SIZE;
+	for (k = 0; k < nitems(sizes); ++k) {
+		bb.size = sizes[k];
+		snprintf(name, sizeof(name), "icrc32/%zu", bb.size);
+		bench_micro(name, bb.size, do_icrc32, &bb);
+	}
+	for (k = 0; k < nitems(sizes); ++k) {
+		bb.size = sizes[k];
+		snprintf(name, sizeof(name), "xxh64/%zu", bb.size);
+		bench_micro(name, bb.size, do_xxh64, &bb);
+	}
+	bench_kern_exit();
+}
+
+/*
+ * The compressors are called the way hammer2_compress_and_write() and
+ * the decompression callbacks call them, one 64KB block at a time with
+ * the output limited to half of the block.
+ */
+typedef struct bench_comp {
+	const char	*data;
+	char		*cdata[BENCH_CORPUS_BLOCKS];
+	int		csize[BENCH_CORPUS_BLOCKS];	/* 0 if stored */
+	int		comp[BENCH_CORPUS_BLOCKS];	/* compressed ones */
+	int		ncomp;
+	char		*out;
+} bench_comp_t;
+
+static int
+lz4_compress_block(const char *data, char *out)
+{
+	int size;
+
+	size = LZ4_compress_limitedOutput(__DECONST(char *, data),
+	    &out[sizeof(int)], HAMMER2_PBUFSIZE,
+	    HAMMER2_PBUFSIZE / 2 - sizeof(int64_t));
+	*(int *)out = size;
+
+	return (size ? size + sizeof(int) : 0);
+}
+
+static int
+zlib_compress_block(const char *data, char *out)
+{
+	z_stream strm;
+	int size;
+
+	bzero(&strm, sizeof(strm));
+	if (deflateInit(&strm, 6) != Z_OK)
+		errx(1, "deflateInit failed");
+	strm.next_in = __DECONST(char *, data);
+	strm.avail_in = HAMMER2_PBUFSIZE;
+	strm.next_out = out;
+	strm.avail_out = HAMMER2_PBUFSIZE / 2;
+	if (deflate(&strm, Z_FINISH) == Z_STREAM_END)
+		size = HAMMER2_PBUFSIZE / 2 - strm.avail_out;
+	else
+		size = 0;
+	deflateEnd(&strm);
+
+	return (size);
+}
+
+static uint64_t
+do_lz4_compress(void *arg, uint64_t iters)
+{
+	bench_comp_t *bc = arg;
+	uint64_t i, n = 0;
+
+	for (i = 0; i < iters; ++i)
+		n += lz4_compress_block(bc->data +
+		    (i % BENCH_CORPUS_BLOCKS) * HAMMER2_PBUFSIZE, bc->out);
+
+	return (n);
+}
+
+static uint64_t
+do_lz4_decompress(void *arg, uint64_t iters)
+{
+	bench_comp_t *bc = arg;
+	uint64_t i, n = 0;
+	int b;
+
+	for (i = 0; i < iters; ++i) {
+		b = bc->comp[i % bc->ncomp];
+		n += LZ4_decompress_safe(&bc->cdata[b][sizeof(int)], bc->out,
+		    *(int *)bc->cdata[b], HAMMER2_PBUFSIZE);
+	}
+
+	return (n);
+}
+
+static uint64_t
+do_zlib_compress(void *arg, uint64_t iters)
+{
+	bench_comp_t *bc = arg;
+	uint64_t i, n = 0;
+
+	for (i = 0; i < iters; ++i)
+		n += zlib_compress_block(bc->data +
+		    (i % BENCH_CORPUS_BLOCKS) * HAMMER2_PBUFSIZE, bc->out);
+
+	return (n);
+}
+
+static uint64_t
+do_zlib_decompress(void *arg, uint64_t iters)
+{
+	bench_comp_t *bc = arg;
+	z_stream strm;
+	uint64_t i, n = 0;
+	int b;
+
+	for (i = 0; i < iters; ++i) {
+		b = bc->comp[i % bc->ncomp];
+		bzero(&strm, sizeof(strm));
+		if (inflateInit(&strm) != Z_OK)
+			errx(1, "inflateInit failed");
+		strm.next_in = bc->cdata[b];
+		strm.avail_in = bc->csize[b];
+		strm.next_out = bc->out;
+		strm.avail_out = HAMMER2_PBUFSIZE;
+		if (inflate(&strm, Z_FINISH) != Z_STREAM_END)
+			errx(1, "inflate failed");
+		n += HAMMER2_PBUFSIZE - strm.avail_out;
+		inflateEnd(&strm);
+	}
+
+	return (n);
+}
+
+static void
+bench_compress_algo(const char *algo, int (*compress)(const char *, char *),
+    bench_func_t do_compress, bench_func_t do_decompress)
+{
+	bench_comp_t bc;
+	uint64_t stored;
+	char name[64];
+	int c, i;
+
+	for (c = 0; c < BENCH_CORPUS_COUNT; ++c) {
+		bc.data = bench_corpus(c);
+		bc.out = malloc(HAMMER2_PBUFSIZE, M_TEMP, M_WAITOK);
+
+		/*
+		 * Physical size as written by hammer2, incompressible
+		 * blocks being stored as is.
+		 */
+		stored = 0;
+		bc.ncomp = 0;
+		for (i = 0; i < BENCH_CORPUS_BLOCKS; ++i) {
+			bc.cdata[i] = malloc(HAMMER2_PBUFSIZE / 2, M_TEMP,
+			    M_WAITOK);
+			bc.csize[i] = compress(bc.data + i * HAMMER2_PBUFSIZE,
+			    bc.cdata[i]);
+			if (bc.csize[i]) {
+				stored += bc.csize[i];
+				bc.comp[bc.ncomp++] = i;
+			} else {
+				stored += HAMMER2_PBUFSIZE;
+			}
+		}
+
+		snprintf(name, sizeof(name), "%s_compress/%s", algo,
+		    bench_corpus_names[c]);
+		bench_micro(name, HAMMER2_PBUFSIZE, do_compress, &bc);
+		bench_extra("ratio", (double)BENCH_CORPUS_BLOCKS *
+		    HAMMER2_PBUFSIZE / stored);
+
+		/* Only blocks hammer2 would store compressed are read so. */
+		if (bc.ncomp > 0) {
+			snprintf(name, sizeof(name), "%s_decompress/%s", algo,
+			    bench_corpus_names[c]);
+			bench_micro(name, HAMMER2_PBUFSIZE, do_decompress,
+			    &bc);
+		}
+
+		for (i = 0; i < BENCH_CORPUS_BLOCKS; ++i)
+			free(bc.cdata[i], M_TEMP, HAMMER2_PBUFSIZE / 2);
+		free(bc.out, M_TEMP, HAMMER2_PBUFSIZE);
+	}
+}
+
+void
+bench_compress(void)
+{
+	bench_kern_enter();
+	bench_compress_algo("lz4", lz4_compress_block, do_lz4_compress,
+	    do_lz4_decompress);
+	bench_compress_algo("zlib", zlib_compress_block, do_zlib_compress,
+	    do_zlib_decompress);
+	bench_kern_exit();
+}
+
+/*
+ * A device for code which needs a hammer2_dev_t but no filesystem: a
+ * single volume backed by an unlinked sparse file, which reads back as
+ * zeros.
+ */
+hammer2_dev_t *
+bench_dev_alloc(void)
+{
+	struct nameidata nd;
+	hammer2_devvp_t *e;
+	hammer2_dev_t *hmp;
+	char path[] = "/tmp/hammer2bench.XXXXXX";
+	int fd, error;
+
+	if ((fd = mkstemp(path)) == -1)
+		err(1, "mkstemp");
+	close(fd);
+
+	bzero(&nd, sizeof(nd));
+	nd.ni_dirp = path;
+	if ((error = namei(&nd)) != 0) {
+		errno = error;
+		err(1, "%s", path);
+	}
+	error = VOP_OPEN(nd.ni_vp, FREAD | FWRITE, FSCRED, curproc);
+	unlink(path);
+	if (error) {
+		errno = error;
+		err(1, "%s", path);
+	}
+
+	e = hmalloc(sizeof(*e), M_HAMMER2, M_WAITOK | M_ZERO);
+	e->devvp = nd.ni_vp;
+	e->path = hstrdup(path);
+	e->open = 1;
+
+	hmp = hmalloc(sizeof(*hmp), M_HAMMER2, M_WAITOK | M_ZERO);
+	TAILQ_INIT(&hmp->devvp_list);
+	TAILQ_INSERT_TAIL(&hmp->devvp_list, e, entry);
+	hammer2_io_hash_init(hmp);
+	hammer2_mtx_init(&hmp->iohash_lock, "h2bench_ioh");
+	hammer2_lk_init(&hmp->vollk, "h2bench_vol");
+	hmp->volumes[0].dev = e;
+	hmp->volumes[0].id = HAMMER2_ROOT_VOLUME;
+	hmp->volumes[0].offset = 0;
+	hmp->volumes[0].size = BENCH_DEV_SIZE;
+	hmp->nvolumes = 1;
+	hmp->total_size = BENCH_DEV_SIZE;
+
+	return (hmp);
+}
+
+void
+bench_dev_free(hammer2_dev_t *hmp)
+{
+	hammer2_devvp_t *e;
+
+	hammer2_mtx_ex(&hmp->iohash_lock);
+	hammer2_io_hash_cleanup_all(hmp);
+	hammer2_mtx_unlock(&hmp->iohash_lock);
+	hammer2_io_hash_destroy(hmp);
+	hammer2_mtx_destroy(&hmp->iohash_lock);
+	hammer2_lk_destroy(&hmp->vollk);
+
+	while ((e = TAILQ_FIRST(&hmp->devvp_list)) != NULL) {
+		TAILQ_REMOVE(&hmp->devvp_list, e, entry);
+		VOP_CLOSE(e->devvp, FREAD | FWRITE, FSCRED, curproc);
+		vrele(e->devvp);
+		hstrfree(e->path);
+		hfree(e, M_HAMMER2, sizeof(*e));
+	}
+	hfree(hmp, M_HAMMER2, sizeof(*hmp));
+}
+
+typedef struct bench_dio {
+	hammer2_dev_t	*hmp;
+	hammer2_off_t	off[BENCH_DIOS];	/* data_off incl. radix */
+} bench_dio_t;
+
+static uint64_t
+do_dio_getquick(void *arg, uint64_t iters)
+{
+	bench_dio_t *bd = arg;
+	hammer2_io_t *dio;
+	uint64_t i, n = 0;
+
+	for (i = 0; i < iters; ++i) {
+		dio = hammer2_io_getquick(bd->hmp, bd->off[i % BENCH_DIOS],
+		    HAMMER2_PBUFSIZE);
+		if (dio) {
+			n += dio->refs;
+			hammer2_io_putblk(&dio);
+		}
+	}
+
+	return (n);
+}
+
+/*
+ * hammer2_io_getquick() on buffers held by someone else (a hash lookup
+ * plus the dio lock), on unheld ones (the lookup plus the device buffer
+ * cache), and on offsets not in the hash.
+ */
+void
+bench_dio(void)
+{
+	hammer2_io_t *dios[BENCH_DIOS];
+	bench_dio_t bd;
+	hammer2_off_t off;
+	uint64_t state = bench_opts.seed;
+	int i, j, held, cached, miss;
+
+	/* Skip the device setup unless needed, and in list mode. */
+	held = bench_selected("dio_getquick/held");
+	cached = bench_selected("dio_getquick/cached");
+	miss = bench_selected("dio_getquick/miss");
+	if (!held && !cached && !miss)
+		return;
+
+	bench_kern_enter();
+	bd.hmp = bench_dev_alloc();
+	for (i = 0; i < BENCH_DIOS; ++i)
+		bd.off[i] = ((hammer2_off_t)(i + 1) * HAMMER2_PBUFSIZE) |
+		    HAMMER2_PBUFRADIX;
+	for (i = BENCH_DIOS - 1; i > 0; --i) {
+		j = bench_random(&state) % (i + 1);
+		off = bd.off[i];
+		bd.off[i] = bd.off[j];
+		bd.off[j] = off;
+	}
+
+	for (i = 0; i < BENCH_DIOS; ++i)
+		if (hammer2_io_bread(bd.hmp, HAMMER2_BREF_TYPE_DATA,
+		    bd.off[i], HAMMER2_PBUFSIZE, &dios[i]))
+			errx(1, "hammer2_io_bread failed");
+	if (held)
+		bench_micro("dio_getquick/held", 0, do_dio_getquick, &bd);
+
+	for (i = 0; i < BENCH_DIOS; ++i)
+		hammer2_io_putblk(&dios[i]);
+	if (cached)
+		bench_micro("dio_getquick/cached", 0, do_dio_getquick, &bd);
+
+	for (i = 0; i < BENCH_DIOS; ++i)
+		bd.off[i] += (hammer2_off_t)BENCH_DIOS * 2 * HAMMER2_PBUFSIZE;
+	if (miss)
+		bench_micro("dio_getquick/miss", 0, do_dio_getquick, &bd);
+
+	bench_dev_free(bd.hmp);
+	bench_kern_exit();
+}
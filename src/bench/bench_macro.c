@@ -0,0 +1,707 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Macro benchmarks, whole workloads run through the libhammer2k entry
+ * points against a scratch image given with -d, which is modified.
+ *
+ * The namespace storms run one thread per -j in a directory of its own.
+ * Only the operations themselves are timed, the image is synced between
+ * phases outside of the timed region, and the read phases follow a
+ * remount so that they start with a cold cache.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hammer2bench.h"
+#include "libhammer2k.h"
+
+#define BENCH_CHUNK		65536	/* sequential I/O size */
+#define BENCH_RANDOM_IO		4096
+#define BENCH_SNAPSHOTS		5
+#define BENCH_SNAPSHOT_GAP	200000	/* usecs of writes before each */
+#define BENCH_STATWRITE_TIME	1.0	/* seconds */
+#define BENCH_APPEND_IO		4096	/* log record size */
+#define BENCH_APPEND_SYNC	(1024 * 1024)	/* bytes per syncer pass */
+#define BENCH_SPARSE_STRIDE	16	/* blocks per block written */
+
+static const char *macro_names[] = {
+	"create", "stat", "readdir", "unlink",
+	"seqwrite", "seqread", "randwrite", "randread",
+	"statwrite", "append/strict", "append/lazytime", "snapshot",
+	"punch", "bulkfree",
+};
+
+static hammer2k_mount_t *hm;
+static char topdir[64];
+
+typedef struct bench_thread bench_thread_t;
+typedef void (*bench_storm_t)(bench_thread_t *bt);
+
+struct bench_thread {
+	pthread_t	td;
+	bench_storm_t	func;
+	int		id;
+	int		error;
+	uint64_t	ops;
+};
+
+static void
+check(int error, const char *what, const char *path)
+{
+	if (error) {
+		errno = error;
+		err(1, "%s %s", what, path);
+	}
+}
+
+static void
+file_path(char *buf, size_t size, int tid, int i)
+{
+	snprintf(buf, size, "%s/t%d/f%08d", topdir, tid, i);
+}
+
+static void
+storm_create(bench_thread_t *bt)
+{
+	hammer2k_file_t *fp;
+	char path[128];
+	int i;
+
+	for (i = bt->id; i < bench_opts.nfiles; i += bench_opts.nthreads) {
+		file_path(path, sizeof(path), bt->id, i);
+		bt->error = hammer2k_open(hm, path,
+		    O_WRONLY | O_CREAT | O_EXCL, 0644, &fp);
+		if (bt->error)
+			return;
+		hammer2k_close(fp);
+		++bt->ops;
+	}
+}
+
+static void
+storm_stat(bench_thread_t *bt)
+{
+	struct stat st;
+	char path[128];
+	int i;
+
+	for (i = bt->id; i < bench_opts.nfiles; i += bench_opts.nthreads) {
+		file_path(path, sizeof(path), bt->id, i);
+		if ((bt->error = hammer2k_stat(hm, path, &st)) != 0)
+			return;
+		++bt->ops;
+	}
+}
+
+static int
+readdir_cb(const char *name, uint64_t inum, int type, void *arg)
+{
+	bench_thread_t *bt = arg;
+
+	++bt->ops;
+
+	return (0);
+}
+
+static void
+storm_readdir(bench_thread_t *bt)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s/t%d", topdir, bt->id);
+	bt->error = hammer2k_readdir(hm, path, readdir_cb, bt);
+}
+
+static void
+storm_unlink(bench_thread_t *bt)
+{
+	char path[128];
+	int i;
+
+	for (i = bt->id; i < bench_opts.nfiles; i += bench_opts.nthreads) {
+		file_path(path, sizeof(path), bt->id, i);
+		if ((bt->error = hammer2k_unlink(hm, path)) != 0)
+			return;
+		++bt->ops;
+	}
+}
+
+static void *
+storm_thread(void *arg)
+{
+	bench_thread_t *bt = arg;
+
+	bt->func(bt);
+
+	return (NULL);
+}
+
+/*
+ * Run func in every thread and report the aggregate rate if selected.
+ */
+static void
+storm(const char *name, bench_storm_t func, int report)
+{
+	bench_thread_t *tds;
+	uint64_t ops = 0;
+	double t;
+	int i, error;
+
+	tds = calloc(bench_opts.nthreads, sizeof(*tds));
+	if (tds == NULL)
+		err(1, "calloc");
+	t = bench_now();
+	for (i = 0; i < bench_opts.nthreads; ++i) {
+		tds[i].func = func;
+		tds[i].id = i;
+		error = pthread_create(&tds[i].td, NULL, storm_thread, &tds[i]);
+		if (error) {
+			errno = error;
+			err(1, "pthread_create");
+		}
+	}
+	for (i = 0; i < bench_opts.nthreads; ++i) {
+		pthread_join(tds[i].td, NULL);
+		check(tds[i].error, name, topdir);
+		ops += tds[i].ops;
+	}
+	t = bench_now() - t;
+	if (report) {
+		bench_macro(name, ops, 0, t);
+		bench_extra("threads", bench_opts.nthreads);
+	}
+	free(tds);
+
+	check(hammer2k_sync(hm), "sync", bench_opts.image);
+}
+
+static void
+remount(int flags)
+{
+	check(hammer2k_unmount(hm, 0), "unmount", bench_opts.image);
+	check(hammer2k_mount(bench_opts.image, flags, &hm), "mount",
+	    bench_opts.image);
+}
+
+static void
+seq_io(const char *name, const char *path, int write, char *buf, int report)
+{
+	hammer2k_file_t *fp;
+	uint64_t off, ops = 0;
+	ssize_t n;
+	double t;
+
+	check(hammer2k_open(hm, path, write ? O_WRONLY | O_CREAT : O_RDONLY,
+	    0644, &fp), "open", path);
+	t = bench_now();
+	for (off = 0; off < bench_opts.seqsize; off += BENCH_CHUNK) {
+		if (write) {
+			memcpy(buf, bench_corpus(BENCH_CORPUS_RANDOM) +
+			    (ops % BENCH_CORPUS_BLOCKS) * BENCH_BLOCK_SIZE,
+			    BENCH_CHUNK);
+			n = hammer2k_pwrite(fp, buf, BENCH_CHUNK, off);
+		} else {
+			n = hammer2k_pread(fp, buf, BENCH_CHUNK, off);
+		}
+		if (n != BENCH_CHUNK)
+			err(1, "%s %s", name, path);
+		++ops;
+	}
+	if (write)
+		check(hammer2k_fsync(fp), "fsync", path);
+	t = bench_now() - t;
+	check(hammer2k_close(fp), "close", path);
+	if (report)
+		bench_macro(name, ops, bench_opts.seqsize, t);
+}
+
+static void
+random_io(const char *name, const char *path, int write, char *buf)
+{
+	hammer2k_file_t *fp;
+	uint64_t state = bench_opts.seed, off, ops;
+	ssize_t n;
+	double t;
+
+	check(hammer2k_open(hm, path, write ? O_WRONLY : O_RDONLY, 0, &fp),
+	    "open", path);
+	t = bench_now();
+	for (ops = 0; ops < (uint64_t)bench_opts.nrandom; ++ops) {
+		off = bench_random(&state) %
+		    (bench_opts.seqsize / BENCH_RANDOM_IO) * BENCH_RANDOM_IO;
+		if (write)
+			n = hammer2k_pwrite(fp, buf, BENCH_RANDOM_IO, off);
+		else
+			n = hammer2k_pread(fp, buf, BENCH_RANDOM_IO, off);
+		if (n != BENCH_RANDOM_IO)
+			err(1, "%s %s", name, path);
+	}
+	if (write)
+		check(hammer2k_fsync(fp), "fsync", path);
+	t = bench_now() - t;
+	check(hammer2k_close(fp), "close", path);
+	bench_macro(name, ops, ops * BENCH_RANDOM_IO, t);
+}
+
+/*
+ * Sequential I/O over a seqsize file, then random 4KB I/O within it.
+ * The file is written whenever any of these is selected, and both read
+ * phases start after a remount.
+ */
+static void
+data_io(void)
+{
+	char path[128], *buf;
+	int seqwrite, seqread, randwrite, randread;
+
+	seqwrite = bench_selected("seqwrite");
+	seqread = bench_selected("seqread");
+	randwrite = bench_selected("randwrite");
+	randread = bench_selected("randread");
+	if (!seqwrite && !seqread && !randwrite && !randread)
+		return;
+
+	if ((buf = malloc(BENCH_CHUNK)) == NULL)
+		err(1, "malloc");
+	snprintf(path, sizeof(path), "%s/seq", topdir);
+
+	seq_io("seqwrite", path, 1, buf, seqwrite);
+	if (seqread) {
+		remount(0);
+		seq_io("seqread", path, 0, buf, 1);
+	}
+	if (randwrite) {
+		memcpy(buf, bench_corpus(BENCH_CORPUS_BINARY), BENCH_CHUNK);
+		random_io("randwrite", path, 1, buf);
+	}
+	if (randread) {
+		remount(0);
+		random_io("randread", path, 0, buf);
+	}
+
+	check(hammer2k_unlink(hm, path), "unlink", path);
+	free(buf);
+}
+
+typedef struct bench_writer {
+	pthread_t	td;
+	volatile int	stop;
+	uint64_t	bytes;
+	double		max_latency;	/* seconds, of one write */
+} bench_writer_t;
+
+typedef struct bench_statter {
+	pthread_t	td;
+	hammer2k_file_t	*fp;
+	double		until;
+	int		error;
+	uint64_t	ops;
+} bench_statter_t;
+
+/*
+ * Keep overwriting a file of seqsize bytes with BENCH_CHUNK writes.
+ */
+static void *
+writer_thread(void *arg)
+{
+	bench_writer_t *bw = arg;
+	hammer2k_file_t *fp;
+	char path[128];
+	uint64_t off = 0;
+	double t;
+
+	snprintf(path, sizeof(path), "%s/writer", topdir);
+	check(hammer2k_open(hm, path, O_WRONLY | O_CREAT, 0644, &fp),
+	    "open", path);
+	while (!bw->stop) {
+		t = bench_now();
+		if (hammer2k_pwrite(fp, bench_corpus(BENCH_CORPUS_RANDOM) +
+		    (off / BENCH_CHUNK % BENCH_CORPUS_BLOCKS) * BENCH_BLOCK_SIZE,
+		    BENCH_CHUNK, off) != BENCH_CHUNK)
+			err(1, "write %s", path);
+		t = bench_now() - t;
+		if (bw->max_latency < t)
+			bw->max_latency = t;
+		bw->bytes += BENCH_CHUNK;
+		off = (off + BENCH_CHUNK) % bench_opts.seqsize;
+	}
+	check(hammer2k_close(fp), "close", path);
+	check(hammer2k_unlink(hm, path), "unlink", path);
+
+	return (NULL);
+}
+
+static void *
+stat_thread(void *arg)
+{
+	bench_statter_t *bs = arg;
+	struct stat st;
+
+	while (bench_now() < bs->until) {
+		if ((bs->error = hammer2k_fstat(bs->fp, &st)) != 0)
+			break;
+		++bs->ops;
+	}
+
+	return (NULL);
+}
+
+/*
+ * fstat() the file another thread keeps writing to from -j threads for
+ * BENCH_STATWRITE_TIME, so that every getattr races the size and mtime
+ * updates of the writes.
+ */
+static void
+statwrite(void)
+{
+	bench_statter_t *bss;
+	bench_writer_t bw;
+	hammer2k_file_t *fp;
+	char path[128];
+	uint64_t ops = 0;
+	double t;
+	int i, error;
+
+	if (!bench_selected("statwrite"))
+		return;
+
+	snprintf(path, sizeof(path), "%s/writer", topdir);
+	check(hammer2k_open(hm, path, O_RDONLY | O_CREAT, 0644, &fp),
+	    "open", path);
+	bss = calloc(bench_opts.nthreads, sizeof(*bss));
+	if (bss == NULL)
+		err(1, "calloc");
+
+	bzero(&bw, sizeof(bw));
+	error = pthread_create(&bw.td, NULL, writer_thread, &bw);
+	if (error) {
+		errno = error;
+		err(1, "pthread_create");
+	}
+	t = bench_now();
+	for (i = 0; i < bench_opts.nthreads; ++i) {
+		bss[i].fp = fp;
+		bss[i].until = t + BENCH_STATWRITE_TIME;
+		error = pthread_create(&bss[i].td, NULL, stat_thread, &bss[i]);
+		if (error) {
+			errno = error;
+			err(1, "pthread_create");
+		}
+	}
+	for (i = 0; i < bench_opts.nthreads; ++i) {
+		pthread_join(bss[i].td, NULL);
+		check(bss[i].error, "fstat", path);
+		ops += bss[i].ops;
+	}
+	t = bench_now() - t;
+	bw.stop = 1;
+	pthread_join(bw.td, NULL);
+
+	bench_macro("statwrite", ops, 0, t);
+	bench_extra("threads", bench_opts.nthreads);
+	bench_extra("write_mb", bw.bytes / 1e6);
+	bench_extra("write_max_ms", bw.max_latency * 1e3);
+
+	free(bss);
+	check(hammer2k_close(fp), "close", path);
+	check(hammer2k_sync(hm), "sync", bench_opts.image);
+}
+
+/*
+ * Append seqsize bytes to a log file in BENCH_APPEND_IO records, reading
+ * each record back as a tailing reader would, with a syncer pass every
+ * BENCH_APPEND_SYNC bytes.  Both variants mount with relatime, lazytime
+ * additionally defers the timestamp updates.  Reports the bytes written
+ * to the device beyond the appended data per GB appended, including the
+ * final close and unmount.
+ */
+static void
+append(const char *name, int flags)
+{
+	hammer2k_iostat_t ios0, ios1;
+	hammer2k_file_t *fp;
+	char path[128], buf[BENCH_APPEND_IO];
+	uint64_t off, meta;
+	double t;
+
+	if (!bench_selected(name))
+		return;
+
+	remount(HAMMER2K_RELATIME | flags);
+	snprintf(path, sizeof(path), "%s/append", topdir);
+	hammer2k_iostat(&ios0);
+	check(hammer2k_open(hm, path, O_RDWR | O_CREAT | O_TRUNC, 0644, &fp),
+	    "open", path);
+	t = bench_now();
+	for (off = 0; off < bench_opts.seqsize; off += BENCH_APPEND_IO) {
+		/* Stamp the records so that the corpus does not dedup. */
+		memcpy(buf, bench_corpus(BENCH_CORPUS_RANDOM) +
+		    off % (BENCH_CORPUS_BLOCKS * BENCH_BLOCK_SIZE),
+		    BENCH_APPEND_IO);
+		memcpy(buf, &off, sizeof(off));
+		if (hammer2k_pwrite(fp, buf, BENCH_APPEND_IO, off) !=
+		    BENCH_APPEND_IO)
+			err(1, "write %s", path);
+		if (hammer2k_pread(fp, buf, BENCH_APPEND_IO, off) !=
+		    BENCH_APPEND_IO)
+			err(1, "read %s", path);
+		if ((off + BENCH_APPEND_IO) % BENCH_APPEND_SYNC == 0)
+			check(hammer2k_syncer(hm), "sync", bench_opts.image);
+	}
+	t = bench_now() - t;
+	check(hammer2k_close(fp), "close", path);
+	/* Unmounting writes out the device buffers still cached. */
+	remount(0);
+	hammer2k_iostat(&ios1);
+
+	meta = ios1.write_bytes - ios0.write_bytes;
+	meta = meta > bench_opts.seqsize ? meta - bench_opts.seqsize : 0;
+	bench_macro(name, bench_opts.seqsize / BENCH_APPEND_IO,
+	    bench_opts.seqsize, t);
+	bench_extra("meta_mb_per_gb", meta / 1e6 / (bench_opts.seqsize / 1e9));
+	bench_extra("dev_writes", ios1.writes - ios0.writes);
+
+	check(hammer2k_unlink(hm, path), "unlink", path);
+}
+
+/*
+ * Snapshot the PFS while another thread keeps writing to it, reporting
+ * the snapshot latency, the time the PFS root was held, and the longest
+ * a single write took over the whole run.
+ */
+static void
+snapshots(void)
+{
+	hammer2k_snapshot_t snap;
+	bench_writer_t bw;
+	char label[128];
+	uint64_t stall = 0;
+	double t, total = 0;
+	int i, error;
+
+	if (!bench_selected("snapshot"))
+		return;
+
+	bzero(&bw, sizeof(bw));
+	error = pthread_create(&bw.td, NULL, writer_thread, &bw);
+	if (error) {
+		errno = error;
+		err(1, "pthread_create");
+	}
+	for (i = 0; i < BENCH_SNAPSHOTS; ++i) {
+		usleep(BENCH_SNAPSHOT_GAP);
+		snprintf(label, sizeof(label), "%s.%d", topdir + 1, i);
+		t = bench_now();
+		check(hammer2k_snapshot(hm, label, &snap), "snapshot", label);
+		total += bench_now() - t;
+		stall += snap.stall_usecs;
+	}
+	bw.stop = 1;
+	pthread_join(bw.td, NULL);
+
+	bench_macro("snapshot", BENCH_SNAPSHOTS, 0, total);
+	bench_extra("root_held_us", (double)stall / BENCH_SNAPSHOTS);
+	bench_extra("write_max_ms", bw.max_latency * 1e3);
+	bench_extra("write_mb", bw.bytes / 1e6);
+
+	for (i = 0; i < BENCH_SNAPSHOTS; ++i) {
+		snprintf(label, sizeof(label), "%s.%d", topdir + 1, i);
+		check(hammer2k_pfs_delete(hm, label), "delete", label);
+	}
+	check(hammer2k_sync(hm), "sync", bench_opts.image);
+}
+
+/*
+ * Write seqsize bytes as one BENCH_CHUNK block every BENCH_SPARSE_STRIDE
+ * blocks, giving a sparse file of BENCH_SPARSE_STRIDE times seqsize, then
+ * punch the whole file after a remount.  Reports the punch itself, the
+ * sync committing it, the device reads it took, and the space reclaimed
+ * by the two bulkfree passes that follow (the first one only stages the
+ * blocks, the second one frees them).
+ */
+static void
+punch(void)
+{
+	hammer2k_iostat_t ios0, ios1;
+	hammer2k_bulkfree_t bfi;
+	hammer2k_file_t *fp;
+	char path[128], *buf;
+	uint64_t off, size, freed = 0;
+	double t, tsync, tfree;
+	int i;
+
+	if (!bench_selected("punch"))
+		return;
+
+	snprintf(path, sizeof(path), "%s/sparse", topdir);
+	size = bench_opts.seqsize * BENCH_SPARSE_STRIDE;
+	buf = malloc(BENCH_CHUNK);
+	if (buf == NULL)
+		err(1, "malloc");
+	check(hammer2k_open(hm, path, O_WRONLY | O_CREAT | O_TRUNC, 0644,
+	    &fp), "open", path);
+	for (off = 0; off < size; off += BENCH_CHUNK * BENCH_SPARSE_STRIDE) {
+		/* Stamp the blocks so that the corpus does not dedup. */
+		memcpy(buf, bench_corpus(BENCH_CORPUS_RANDOM) +
+		    (off / BENCH_CHUNK % BENCH_CORPUS_BLOCKS) * BENCH_BLOCK_SIZE,
+		    BENCH_CHUNK);
+		memcpy(buf, &off, sizeof(off));
+		if (hammer2k_pwrite(fp, buf, BENCH_CHUNK, off) != BENCH_CHUNK)
+			err(1, "write %s", path);
+	}
+	check(hammer2k_ftruncate(fp, size), "truncate", path);
+	check(hammer2k_close(fp), "close", path);
+	free(buf);
+
+	/* Leave only the punched blocks for the bulkfree to find. */
+	check(hammer2k_sync(hm), "sync", bench_opts.image);
+	for (i = 0; i < 2; ++i)
+		check(hammer2k_bulkfree(hm, 0, NULL), "bulkfree",
+		    bench_opts.image);
+	remount(0);
+
+	check(hammer2k_open(hm, path, O_RDWR, 0, &fp), "open", path);
+	hammer2k_iostat(&ios0);
+	t = bench_now();
+	check(hammer2k_punch(fp, 0, size), "punch", path);
+	t = bench_now() - t;
+	tsync = bench_now();
+	check(hammer2k_sync(hm), "sync", bench_opts.image);
+	tsync = bench_now() - tsync;
+	hammer2k_iostat(&ios1);
+	check(hammer2k_close(fp), "close", path);
+	tfree = bench_now();
+	for (i = 0; i < 2; ++i) {
+		check(hammer2k_bulkfree(hm, 0, &bfi), "bulkfree",
+		    bench_opts.image);
+		freed += bfi.count_freed;
+	}
+	tfree = bench_now() - tfree;
+
+	bench_macro("punch", bench_opts.seqsize / BENCH_CHUNK,
+	    bench_opts.seqsize, t);
+	bench_extra("sparse_mb", size / 1e6);
+	bench_extra("sync_ms", tsync * 1e3);
+	bench_extra("dev_reads", ios1.reads - ios0.reads);
+	bench_extra("bulkfree_ms", tfree * 1e3);
+	bench_extra("freed_mb", freed / 1e6);
+
+	check(hammer2k_unlink(hm, path), "unlink", path);
+}
+
+static void
+bulkfree(void)
+{
+	hammer2k_bulkfree_t bfi;
+	double t;
+
+	if (!bench_selected("bulkfree"))
+		return;
+
+	check(hammer2k_sync(hm), "sync", bench_opts.image);
+	t = bench_now();
+	check(hammer2k_bulkfree(hm, 0, &bfi), "bulkfree", bench_opts.image);
+	t = bench_now() - t;
+	bench_macro("bulkfree", 1, bfi.total_scanned, t);
+	bench_extra("count_freed", bfi.count_freed);
+}
+
+void
+bench_macros(void)
+{
+	char path[128];
+	size_t k;
+	int i, create, stats, readdirs, unlinks;
+
+	if (bench_opts.list) {
+		for (k = 0; k < sizeof(macro_names) / sizeof(macro_names[0]);
+		    ++k)
+			bench_selected(macro_names[k]);
+		return;
+	}
+	if (bench_opts.image == NULL)
+		return;
+
+	check(hammer2k_mount(bench_opts.image, 0, &hm), "mount",
+	    bench_opts.image);
+	snprintf(topdir, sizeof(topdir), "/hammer2bench.%d", (int)getpid());
+	check(hammer2k_mkdir(hm, topdir, 0755), "mkdir", topdir);
+	for (i = 0; i < bench_opts.nthreads; ++i) {
+		snprintf(path, sizeof(path), "%s/t%d", topdir, i);
+		check(hammer2k_mkdir(hm, path, 0755), "mkdir", path);
+	}
+	check(hammer2k_sync(hm), "sync", bench_opts.image);
+
+	/* The later storms work on the files create leaves behind. */
+	create = bench_selected("create");
+	stats = bench_selected("stat");
+	readdirs = bench_selected("readdir");
+	unlinks = bench_selected("unlink");
+	if (create || stats || readdirs || unlinks) {
+		storm("create", storm_create, create);
+		if (stats)
+			storm("stat", storm_stat, 1);
+		if (readdirs)
+			storm("readdir", storm_readdir, 1);
+		storm("unlink", storm_unlink, unlinks);
+	}
+	data_io();
+	statwrite();
+	append("append/strict", 0);
+	append("append/lazytime", HAMMER2K_LAZYTIME);
+	snapshots();
+	punch();
+	bulkfree();
+
+	for (i = 0; i < bench_opts.nthreads; ++i) {
+		snprintf(path, sizeof(path), "%s/t%d", topdir, i);
+		check(hammer2k_rmdir(hm, path), "rmdir", path);
+	}
+	check(hammer2k_rmdir(hm, topdir), "rmdir", topdir);
+	check(hammer2k_unmount(hm, 0), "unmount", bench_opts.image);
+}
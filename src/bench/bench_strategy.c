@@ -0,0 +1,85 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * test_block_zeros(), run over every block written with zero detection
+ * or compression enabled.  Static like hammer2_base_find(), see
+ * bench_chain.c.
+ */
+
+#include <fs/hammer2/hammer2_strategy.c>
+
+#include "hammer2bench.h"
+
+typedef struct bench_zeros {
+	char		*buf;
+	size_t		size;
+} bench_zeros_t;
+
+static uint64_t
+do_block_zeros(void *arg, uint64_t iters)
+{
+	bench_zeros_t *bz = arg;
+	uint64_t i, n = 0;
+
+	for (i = 0; i < iters; ++i)
+		n += test_block_zeros(bz->buf, bz->size);
+
+	return (n);
+}
+
+/*
+ * All zero blocks, the worst case since the whole block is scanned.
+ */
+void
+bench_block_zeros(void)
+{
+	static const size_t sizes[] = { 16384, 65536 };
+	bench_zeros_t bz;
+	char name[64];
+	size_t k;
+
+	bench_kern_enter();
+	for (k = 0; k < nitems(sizes); ++k) {
+		bz.size = sizes[k];
+		bz.buf = malloc(bz.size, M_TEMP, M_WAITOK | M_ZERO);
+		snprintf(name, sizeof(name), "block_zeros/%zu", bz.size);
+		bench_micro(name, bz.size, do_block_zeros, &bz);
+		free(bz.buf, M_TEMP, bz.size);
+	}
+	bench_kern_exit();
+}
@@ -0,0 +1,591 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * hammer2bench - benchmarks of the hammer2 kernel code run in userland
+ * through libhammer2k.
+ *
+ * Results are written as JSON, one object per line: a "config" record
+ * describing the run followed by one "result" record per benchmark, so
+ * that runs can be stored and compared line by line.  All input data is
+ * derived from the seed and micro benchmarks report the median of
+ * several repetitions, so that runs on the same machine are comparable.
+ */
+
+#include <sys/types.h>
+#include <sys/utsname.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hammer2bench.h"
+#include "libhammer2k.h"
+
+#define BENCH_CALIBRATE_TIME	0.01	/* seconds */
+#define BENCH_MAX_PATTERNS	32
+
+bench_options_t bench_opts = {
+	.seed = 1,
+	.min_time = 0.2,
+	.repeat = 5,
+	.nthreads = 1,
+	.nfiles = 10000,
+	.seqsize = 256 * 1024 * 1024,
+	.nrandom = 20000,
+};
+
+const char *bench_corpus_names[BENCH_CORPUS_COUNT] = {
+	"text", "binary", "random",
+};
+
+static const char *patterns[BENCH_MAX_PATTERNS];
+static int npatterns;
+static FILE *out;
+static char *corpora[BENCH_CORPUS_COUNT];
+static int result_open;
+static volatile uint64_t sink;
+
+static void
+json_string(const char *s)
+{
+	const unsigned char *p;
+
+	fputc('"', out);
+	for (p = (const unsigned char *)s; *p; ++p) {
+		if (*p == '"' || *p == '\\')
+			fprintf(out, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf(out, "\\u%04x", *p);
+		else
+			fputc(*p, out);
+	}
+	fputc('"', out);
+}
+
+static void
+json_key(const char *key)
+{
+	fputc(',', out);
+	json_string(key);
+	fputc(':', out);
+}
+
+static void
+json_begin(const char *record)
+{
+	fputs("{\"record\":", out);
+	json_string(record);
+}
+
+static void
+json_end(void)
+{
+	fputs("}\n", out);
+	fflush(out);
+}
+
+static void
+result_end(void)
+{
+	if (result_open) {
+		json_end();
+		result_open = 0;
+	}
+}
+
+double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * xorshift64*, good enough for benchmark input and fully determined by
+ * the seed.
+ */
+uint64_t
+bench_random(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return (x * 0x2545F4914F6CDD1DULL);
+}
+
+/*
+ * Returns non-zero if name was selected with -b, or always if -b was
+ * not given.  In list mode the name is printed instead and zero is
+ * returned so that nothing is run.
+ */
+int
+bench_selected(const char *name)
+{
+	int i, selected;
+
+	selected = (npatterns == 0);
+	for (i = 0; i < npatterns && !selected; ++i)
+		if (fnmatch(patterns[i], name, 0) == 0)
+			selected = 1;
+	if (selected && bench_opts.list) {
+		printf("%s\n", name);
+		return (0);
+	}
+
+	return (selected);
+}
+
+static double
+micro_run(bench_func_t func, void *arg, uint64_t iters)
+{
+	double t;
+
+	t = bench_now();
+	sink += func(arg, iters);
+
+	return (bench_now() - t);
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Run a micro benchmark.  The iteration count is first scaled up until a
+ * run takes BENCH_CALIBRATE_TIME, then set so that each of the timed
+ * repetitions takes about min_time.
+ */
+void
+bench_micro(const char *name, size_t bytes, bench_func_t func, void *arg)
+{
+	double *ns, t;
+	uint64_t iters;
+	int i;
+
+	/* No extras for a benchmark which did not run. */
+	if (!bench_selected(name)) {
+		result_end();
+		return;
+	}
+
+	iters = 1;
+	while ((t = micro_run(func, arg, iters)) < BENCH_CALIBRATE_TIME)
+		iters *= (t < BENCH_CALIBRATE_TIME / 10) ? 10 : 2;
+	iters = (uint64_t)(iters * bench_opts.min_time / t) + 1;
+
+	ns = calloc(bench_opts.repeat, sizeof(*ns));
+	if (ns == NULL)
+		err(1, "calloc");
+	for (i = 0; i < bench_opts.repeat; ++i)
+		ns[i] = micro_run(func, arg, iters) * 1e9 / iters;
+	qsort(ns, bench_opts.repeat, sizeof(*ns), cmp_double);
+
+	result_end();
+	json_begin("result");
+	json_key("name");
+	json_string(name);
+	json_key("type");
+	json_string("micro");
+	json_key("iters");
+	fprintf(out, "%ju", (uintmax_t)iters);
+	json_key("ns_per_op");
+	fprintf(out, "%.3f", ns[bench_opts.repeat / 2]);
+	json_key("ns_per_op_min");
+	fprintf(out, "%.3f", ns[0]);
+	json_key("ns_per_op_max");
+	fprintf(out, "%.3f", ns[bench_opts.repeat - 1]);
+	if (bytes) {
+		json_key("bytes_per_op");
+		fprintf(out, "%zu", bytes);
+		json_key("mb_per_s");
+		fprintf(out, "%.3f",
+		    bytes * 1e3 / ns[bench_opts.repeat / 2]);
+	}
+	result_open = 1;
+	free(ns);
+}
+
+/*
+ * Record a macro benchmark.  The caller has already checked
+ * bench_selected() and run the workload.
+ */
+void
+bench_macro(const char *name, uint64_t ops, uint64_t bytes, double seconds)
+{
+	result_end();
+	json_begin("result");
+	json_key("name");
+	json_string(name);
+	json_key("type");
+	json_string("macro");
+	json_key("ops");
+	fprintf(out, "%ju", (uintmax_t)ops);
+	json_key("seconds");
+	fprintf(out, "%.6f", seconds);
+	json_key("ops_per_s");
+	fprintf(out, "%.3f", seconds > 0 ? ops / seconds : 0);
+	if (bytes) {
+		json_key("bytes");
+		fprintf(out, "%ju", (uintmax_t)bytes);
+		json_key("mb_per_s");
+		fprintf(out, "%.3f", seconds > 0 ? bytes / seconds / 1e6 : 0);
+	}
+	result_open = 1;
+}
+
+/*
+ * Add a benchmark specific value to the last result.
+ */
+void
+bench_extra(const char *key, double value)
+{
+	if (!result_open)
+		return;
+	json_key(key);
+	fprintf(out, "%.6f", value);
+}
+
+/*
+ * Text made of words drawn with a skewed distribution from a small
+ * vocabulary, roughly the redundancy of source code and logs.
+ */
+static void
+gen_text(char *buf, size_t size, uint64_t *state)
+{
+	static const char *words[] = {
+		"the", "of", "and", "to", "in", "is", "for", "that", "with",
+		"chain", "inode", "block", "flush", "freemap", "return",
+		"error", "struct", "if", "else", "int", "hammer2", "data",
+		"const", "static", "void", "modify", "parent", "lock",
+		"unlock", "key", "bref", "offset", "size", "transaction",
+		"volume", "buffer", "radix", "allocation", "directory",
+		"(", ")", "{", "}", ";", "->", "=", "==", "0", "1",
+	};
+	size_t nwords = sizeof(words) / sizeof(words[0]);
+	size_t i, len, n;
+	uint64_t r;
+
+	for (i = 0; i < size; ) {
+		r = bench_random(state);
+		/* min of two draws skews towards the common words */
+		n = r % nwords;
+		if ((r >> 32) % nwords < n)
+			n = (r >> 32) % nwords;
+		len = strlen(words[n]);
+		if (len > size - i)
+			len = size - i;
+		memcpy(buf + i, words[n], len);
+		i += len;
+		if (i < size)
+			buf[i++] = ((r >> 16) & 15) == 0 ? '\n' : ' ';
+	}
+}
+
+/*
+ * Fixed size records with counters, timestamps and small integers, as
+ * found in databases and binary logs.
+ */
+static void
+gen_binary(char *buf, size_t size, uint64_t *state)
+{
+	struct {
+		uint64_t	id;
+		uint64_t	time;
+		uint32_t	type;
+		uint32_t	flags;
+		uint64_t	value;
+		char		pad[32];
+	} rec;
+	static uint64_t id, now = 1700000000000000ULL;
+	size_t i, n;
+	uint64_t r;
+
+	for (i = 0; i < size; i += n) {
+		r = bench_random(state);
+		memset(&rec, 0, sizeof(rec));
+		rec.id = ++id;
+		rec.time = (now += r % 1000);
+		rec.type = (r >> 10) % 8;
+		rec.flags = (r >> 13) & 0x11;
+		rec.value = (r >> 20) % 100000;
+		if ((r >> 40) % 4 == 0)
+			memcpy(rec.pad, &r, sizeof(r));
+		n = sizeof(rec) < size - i ? sizeof(rec) : size - i;
+		memcpy(buf + i, &rec, n);
+	}
+}
+
+static void
+gen_random(char *buf, size_t size, uint64_t *state)
+{
+	uint64_t r;
+	size_t i;
+
+	for (i = 0; i < size; i += sizeof(r)) {
+		r = bench_random(state);
+		memcpy(buf + i, &r, sizeof(r));
+	}
+}
+
+/*
+ * Returns BENCH_CORPUS_BLOCKS blocks of BENCH_BLOCK_SIZE bytes of the
+ * given kind.
+ */
+const char *
+bench_corpus(int which)
+{
+	size_t size = (size_t)BENCH_CORPUS_BLOCKS * BENCH_BLOCK_SIZE;
+	uint64_t state;
+
+	if (corpora[which] != NULL)
+		return (corpora[which]);
+
+	if ((corpora[which] = malloc(size)) == NULL)
+		err(1, "malloc");
+	state = bench_opts.seed * 2654435761U + which + 1;
+	switch (which) {
+	case BENCH_CORPUS_TEXT:
+		gen_text(corpora[which], size, &state);
+		break;
+	case BENCH_CORPUS_BINARY:
+		gen_binary(corpora[which], size, &state);
+		break;
+	case BENCH_CORPUS_RANDOM:
+		gen_random(corpora[which], size, &state);
+		break;
+	}
+
+	return (corpora[which]);
+}
+
+static void
+print_config(void)
+{
+	struct utsname uts;
+
+	json_begin("config");
+	json_key("program");
+	json_string("hammer2bench");
+	json_key("version");
+	fprintf(out, "1");
+	if (uname(&uts) == 0) {
+		json_key("sysname");
+		json_string(uts.sysname);
+		json_key("release");
+		json_string(uts.release);
+		json_key("machine");
+		json_string(uts.machine);
+	}
+	json_key("ncpu");
+	fprintf(out, "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef __VERSION__
+	json_key("compiler");
+	json_string(__VERSION__);
+#endif
+	json_key("seed");
+	fprintf(out, "%ju", (uintmax_t)bench_opts.seed);
+	json_key("repeat");
+	fprintf(out, "%d", bench_opts.repeat);
+	json_key("min_time");
+	fprintf(out, "%.3f", bench_opts.min_time);
+	json_key("image");
+	if (bench_opts.image)
+		json_string(bench_opts.image);
+	else
+		fputs("null", out);
+	json_key("nthreads");
+	fprintf(out, "%d", bench_opts.nthreads);
+	json_key("nfiles");
+	fprintf(out, "%d", bench_opts.nfiles);
+	json_key("seqsize");
+	fprintf(out, "%ju", (uintmax_t)bench_opts.seqsize);
+	json_key("nrandom");
+	fprintf(out, "%d", bench_opts.nrandom);
+	json_end();
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "hammer2bench [-l] [-b pattern] [-B bufspace] "
+	    "[-d image] [-j nthreads] [-n nfiles] [-N nrandom] "
+	    "[-o file] [-r repeat] [-s seed] [-S seqsize] [-t min_time]\n");
+	exit(1);
+}
+
+static long long
+getnum(const char *s, const char *what, long long min, long long max)
+{
+	long long n;
+	char *p;
+
+	n = strtoll(s, &p, 0);
+	switch (*p) {
+	case 'g':
+	case 'G':
+		n *= 1024;
+		/* fall through */
+	case 'm':
+	case 'M':
+		n *= 1024;
+		/* fall through */
+	case 'k':
+	case 'K':
+		n *= 1024;
+		++p;
+		break;
+	}
+	if (*p != '\0' || n < min || n > max)
+		errx(1, "Invalid %s %s", what, s);
+
+	return (n);
+}
+
+int
+main(int ac, char **av)
+{
+	const char *outfile = NULL;
+	size_t bufspace = 0;
+	char *p;
+	int ch, error;
+
+	while ((ch = getopt(ac, av, "b:B:d:j:ln:N:o:r:s:S:t:")) != -1) {
+		switch (ch) {
+		case 'b':
+			if (npatterns == BENCH_MAX_PATTERNS)
+				errx(1, "Too many patterns");
+			patterns[npatterns++] = optarg;
+			break;
+		case 'B':
+			bufspace = getnum(optarg, "buffer cache size",
+			    1024 * 1024, (long long)1 << 40);
+			break;
+		case 'd':
+			bench_opts.image = optarg;
+			break;
+		case 'j':
+			bench_opts.nthreads = getnum(optarg, "thread count",
+			    1, 256);
+			break;
+		case 'l':
+			bench_opts.list = 1;
+			break;
+		case 'n':
+			bench_opts.nfiles = getnum(optarg, "file count",
+			    1, 100000000);
+			break;
+		case 'N':
+			bench_opts.nrandom = getnum(optarg, "operation count",
+			    1, 1000000000);
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'r':
+			bench_opts.repeat = getnum(optarg, "repeat count",
+			    1, 1000);
+			break;
+		case 's':
+			bench_opts.seed = getnum(optarg, "seed", 1,
+			    0x7fffffffffffffffLL);
+			break;
+		case 'S':
+			bench_opts.seqsize = getnum(optarg, "file size",
+			    BENCH_BLOCK_SIZE, 0x7fffffffffffffffLL);
+			bench_opts.seqsize &= ~(uint64_t)(BENCH_BLOCK_SIZE - 1);
+			break;
+		case 't':
+			bench_opts.min_time = strtod(optarg, &p);
+			if (*p != '\0' || bench_opts.min_time <= 0)
+				errx(1, "Invalid time %s", optarg);
+			break;
+		default:
+			usage();
+			/* not reached */
+			break;
+		}
+	}
+	ac -= optind;
+	av += optind;
+	if (ac != 0)
+		usage();
+
+	if (outfile == NULL || bench_opts.list) {
+		out = stdout;
+	} else if ((out = fopen(outfile, "w")) == NULL) {
+		err(1, "%s", outfile);
+	}
+
+	if ((error = hammer2k_init(bufspace)) != 0) {
+		errno = error;
+		err(1, "hammer2k_init");
+	}
+	if (!bench_opts.list)
+		print_config();
+
+	bench_hash();
+	bench_compress();
+	bench_block_zeros();
+	bench_base_find();
+	bench_bmap_alloc();
+	bench_dio();
+	bench_macros();
+	result_end();
+
+	if (out != stdout && fclose(out) != 0)
+		err(1, "%s", outfile);
+
+	return (0);
+}
@@ -0,0 +1,113 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HAMMER2_BENCH_H_
+#define HAMMER2_BENCH_H_
+
+/*
+ * hammer2bench(1) internals.
+ *
+ * Micro benchmarks time a function doing iters operations and report
+ * nanoseconds per operation, macro benchmarks time a complete workload
+ * against a mounted image and report operations and bytes per second.
+ * Benchmark names are "group/variant", e.g. "lz4_compress/text".
+ *
+ * Only bench_kern.c and the bench_<file>.c wrappers around the kernel
+ * sources see the kernel headers, everything else is plain userland.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+
+#define BENCH_BLOCK_SIZE	65536		/* HAMMER2_PBUFSIZE */
+#define BENCH_CORPUS_BLOCKS	64		/* 4MB per corpus */
+
+/*
+ * Corpora of BENCH_CORPUS_BLOCKS blocks each, generated from the seed.
+ */
+#define BENCH_CORPUS_TEXT	0
+#define BENCH_CORPUS_BINARY	1
+#define BENCH_CORPUS_RANDOM	2
+#define BENCH_CORPUS_COUNT	3
+
+typedef uint64_t (*bench_func_t)(void *arg, uint64_t iters);
+
+typedef struct bench_options {
+	const char	*image;		/* macro benchmarks, NULL to skip */
+	uint64_t	seed;
+	double		min_time;	/* seconds per micro repetition */
+	int		repeat;		/* micro repetitions */
+	int		nthreads;	/* namespace storms */
+	int		nfiles;
+	uint64_t	seqsize;	/* sequential I/O file size */
+	int		nrandom;	/* random I/O operations */
+	int		list;		/* list names only */
+} bench_options_t;
+
+extern bench_options_t bench_opts;
+extern const char *bench_corpus_names[BENCH_CORPUS_COUNT];
+
+/* hammer2bench.c */
+int bench_selected(const char *name);
+void bench_micro(const char *name, size_t bytes, bench_func_t func,
+			void *arg);
+void bench_macro(const char *name, uint64_t ops, uint64_t bytes,
+			double seconds);
+void bench_extra(const char *key, double value);
+double bench_now(void);
+uint64_t bench_random(uint64_t *state);
+const char *bench_corpus(int which);
+
+/* bench_kern.c */
+struct hammer2_dev *bench_dev_alloc(void);
+void bench_dev_free(struct hammer2_dev *hmp);
+void bench_kern_enter(void);
+void bench_kern_exit(void);
+void bench_hash(void);
+void bench_compress(void);
+void bench_dio(void);
+
+/* bench_chain.c, bench_freemap.c, bench_strategy.c */
+void bench_base_find(void);
+void bench_bmap_alloc(void);
+void bench_block_zeros(void);
+
+/* bench_macro.c */
+void bench_macros(void);
+
+#endif /* !HAMMER2_BENCH_H_ */
@@ -0,0 +1,860 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel services for hammer2k: Giant, sleep queues, rwlock(9),
+ * malloc(9), pool(9) and the assorted libkern helpers.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "hammer2k_kern.h"
+
+/* This file implements malloc(9) and free(9) on top of libc's. */
+#undef malloc
+#undef free
+
+#define RWLOCK_MASK		0x07UL
+#define RW_PROC(p)		(((unsigned long)(p)) & ~RWLOCK_MASK)
+
+#define SLPQUE_SIZE		128
+#define SLPQUE_LOOKUP(id)	\
+	(&slpque[((uintptr_t)(id) >> 8) & (SLPQUE_SIZE - 1)])
+
+struct sleeper {
+	TAILQ_ENTRY(sleeper)	entry;
+	const volatile void	*ident;
+	int			woken;
+};
+
+struct slpque {
+	TAILQ_HEAD(, sleeper)	list;
+	pthread_cond_t		cv;
+};
+
+int hz = 100;
+volatile int ticks;
+struct pool namei_pool;
+
+static pthread_mutex_t giant = PTHREAD_MUTEX_INITIALIZER;
+static __thread int giant_depth;	/* recursion count of this thread */
+static __thread struct proc *curp;
+static __thread struct proc proc0;
+static struct timespec boottime;
+static struct slpque slpque[SLPQUE_SIZE];
+static pid_t nexttid = 100000;
+
+void
+hammer2k_kern_init(void)
+{
+	pthread_condattr_t attr;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &boottime);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	for (i = 0; i < SLPQUE_SIZE; i++) {
+		TAILQ_INIT(&slpque[i].list);
+		pthread_cond_init(&slpque[i].cv, &attr);
+	}
+	pthread_condattr_destroy(&attr);
+
+	pool_init(&namei_pool, MAXPATHLEN, 0, IPL_NONE, PR_WAITOK, "namei",
+	    NULL);
+}
+
+/*
+ * Giant.  The kernel sources run with it held, so most state in this
+ * library needs no further locking.
+ */
+void
+hammer2k_giant_enter(void)
+{
+	if (giant_depth++ == 0) {
+		pthread_mutex_lock(&giant);
+		hammer2k_update_ticks();
+	}
+}
+
+void
+hammer2k_giant_exit(void)
+{
+	KASSERT(giant_depth > 0);
+	if (--giant_depth == 0)
+		pthread_mutex_unlock(&giant);
+}
+
+int
+hammer2k_giant_owned(void)
+{
+	return (giant_depth > 0);
+}
+
+/*
+ * Fully release Giant, e.g. around device I/O, returning the recursion
+ * count to be handed to hammer2k_giant_pickup().
+ */
+int
+hammer2k_giant_drop(void)
+{
+	int depth;
+
+	depth = giant_depth;
+	KASSERT(depth > 0);
+	giant_depth = 0;
+	pthread_mutex_unlock(&giant);
+
+	return (depth);
+}
+
+void
+hammer2k_giant_pickup(int depth)
+{
+	KASSERT(giant_depth == 0);
+	pthread_mutex_lock(&giant);
+	giant_depth = depth;
+	hammer2k_update_ticks();
+}
+
+void
+hammer2k_busy_cycle(void)
+{
+	int depth;
+
+	/* Let whoever we spin on run. */
+	if (giant_depth > 0) {
+		depth = hammer2k_giant_drop();
+		sched_yield();
+		hammer2k_giant_pickup(depth);
+	} else {
+		sched_yield();
+	}
+}
+
+/*
+ * Each thread calling into the library gets a proc of its own, holding
+ * root credentials.
+ */
+void
+hammer2k_proc_enter(void)
+{
+	struct proc *p = &proc0;
+
+	if (curp)
+		return;
+	p->p_p = &p->p_process;
+	strlcpy(p->p_p->ps_comm, "hammer2k", sizeof(p->p_p->ps_comm));
+	p->p_ucred = &p->p_cred;
+	p->p_cred.cr_ref = 1;
+	p->p_tid = __atomic_add_fetch(&nexttid, 1, __ATOMIC_SEQ_CST);
+	curp = p;
+}
+
+struct proc *
+hammer2k_curproc(void)
+{
+	return (curp);
+}
+
+/*
+ * Time.  ticks is brought up to date whenever a thread (re)acquires Giant,
+ * which is the only time kernel code can look at it.
+ */
+void
+hammer2k_update_ticks(void)
+{
+	struct timespec ts;
+	long long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ms = (long long)(ts.tv_sec - boottime.tv_sec) * 1000 +
+	    (ts.tv_nsec - boottime.tv_nsec) / 1000000;
+	ticks = (int)(ms * hz / 1000);
+}
+
+time_t
+gettime(void)
+{
+	return (time(NULL));
+}
+
+void
+getnanotime(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+}
+
+uint64_t
+getnsecuptime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)(ts.tv_sec - boottime.tv_sec) * 1000000000 +
+	    ts.tv_nsec - boottime.tv_nsec);
+}
+
+/*
+ * Sleep queues.  Sleepers wait on the condition variable of their hash
+ * bucket, Giant being the associated mutex.
+ */
+static void
+sleep_setup(struct sleeper *s, const volatile void *ident)
+{
+	struct slpque *qp = SLPQUE_LOOKUP(ident);
+
+	KASSERT(hammer2k_giant_owned());
+	s->ident = ident;
+	s->woken = 0;
+	TAILQ_INSERT_TAIL(&qp->list, s, entry);
+}
+
+static int
+sleep_finish(struct sleeper *s, int timo)
+{
+	struct slpque *qp = SLPQUE_LOOKUP(s->ident);
+	struct timespec ts;
+	int error = 0;
+
+	if (timo > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += timo / hz;
+		ts.tv_nsec += (long)(timo % hz) * (1000000000L / hz);
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+	}
+	while (s->woken == 0) {
+		if (timo > 0) {
+			if (pthread_cond_timedwait(&qp->cv, &giant, &ts) ==
+			    ETIMEDOUT && s->woken == 0) {
+				error = EWOULDBLOCK;
+				break;
+			}
+		} else {
+			pthread_cond_wait(&qp->cv, &giant);
+		}
+	}
+	TAILQ_REMOVE(&qp->list, s, entry);
+	hammer2k_update_ticks();
+
+	return (error);
+}
+
+int
+tsleep(const volatile void *ident, int priority, const char *wmesg, int timo)
+{
+	struct sleeper s;
+
+	sleep_setup(&s, ident);
+	return (sleep_finish(&s, timo));
+}
+
+int
+rwsleep(const volatile void *ident, struct rwlock *rwl, int priority,
+    const char *wmesg, int timo)
+{
+	struct sleeper s;
+	int error, status;
+
+	sleep_setup(&s, ident);
+	status = rw_status(rwl);
+	KASSERT(status == RW_WRITE || status == RW_READ);
+	rw_exit(rwl);
+	error = sleep_finish(&s, timo);
+	if ((priority & PNORELOCK) == 0)
+		rw_enter(rwl, status);
+
+	return (error);
+}
+
+void
+wakeup(const volatile void *ident)
+{
+	struct slpque *qp = SLPQUE_LOOKUP(ident);
+	struct sleeper *s;
+	int found = 0;
+
+	KASSERT(hammer2k_giant_owned());
+	TAILQ_FOREACH(s, &qp->list, entry) {
+		if (s->ident == ident) {
+			s->woken = 1;
+			found = 1;
+		}
+	}
+	if (found)
+		pthread_cond_broadcast(&qp->cv);
+}
+
+/*
+ * rwlock(9) and rrwlock(9).  Lock state is protected by Giant.  Unlike
+ * OpenBSD, readers are not held off by waiting writers.
+ */
+void
+rw_init_flags(struct rwlock *rwl, const char *name, int flags)
+{
+	rwl->rwl_owner = 0;
+	rwl->rwl_name = name;
+	rwl->rwl_waiters = 0;
+}
+
+int
+rw_enter(struct rwlock *rwl, int flags)
+{
+	unsigned long o;
+	struct sleeper s;
+	int op = flags & RW_OPMASK;
+
+	KASSERT(op == RW_WRITE || op == RW_READ);
+	for (;;) {
+		o = rwl->rwl_owner;
+		if (op == RW_WRITE && o == 0) {
+			rwl->rwl_owner = RW_PROC(curproc) | RWLOCK_WRLOCK;
+			return (0);
+		}
+		if (op == RW_READ && (o & RWLOCK_WRLOCK) == 0) {
+			rwl->rwl_owner = o + RWLOCK_READ_INCR;
+			return (0);
+		}
+		if ((o & RWLOCK_WRLOCK) && RW_PROC(o) == RW_PROC(curproc)) {
+			if (flags & RW_RECURSEFAIL)
+				return (EDEADLK);
+			panic("rw_enter: %s locking against myself",
+			    rwl->rwl_name);
+		}
+		if (flags & RW_NOSLEEP)
+			return (EBUSY);
+
+		rwl->rwl_waiters++;
+		sleep_setup(&s, rwl);
+		sleep_finish(&s, 0);
+		rwl->rwl_waiters--;
+		if (flags & RW_SLEEPFAIL)
+			return (EAGAIN);
+	}
+}
+
+void
+rw_exit(struct rwlock *rwl)
+{
+	unsigned long o = rwl->rwl_owner;
+
+	if (o & RWLOCK_WRLOCK) {
+		if (RW_PROC(o) != RW_PROC(curproc))
+			panic("rw_exit: %s not held by me", rwl->rwl_name);
+		rwl->rwl_owner = 0;
+	} else {
+		if (o == 0)
+			panic("rw_exit: %s not held", rwl->rwl_name);
+		rwl->rwl_owner = o - RWLOCK_READ_INCR;
+	}
+	if (rwl->rwl_waiters)
+		wakeup(rwl);
+}
+
+void
+rw_enter_read(struct rwlock *rwl)
+{
+	rw_enter(rwl, RW_READ);
+}
+
+void
+rw_enter_write(struct rwlock *rwl)
+{
+	rw_enter(rwl, RW_WRITE);
+}
+
+void
+rw_exit_read(struct rwlock *rwl)
+{
+	KASSERT(rw_status(rwl) == RW_READ);
+	rw_exit(rwl);
+}
+
+void
+rw_exit_write(struct rwlock *rwl)
+{
+	KASSERT(rw_status(rwl) == RW_WRITE);
+	rw_exit(rwl);
+}
+
+int
+rw_status(struct rwlock *rwl)
+{
+	unsigned long o = rwl->rwl_owner;
+
+	if (o & RWLOCK_WRLOCK) {
+		if (RW_PROC(o) == RW_PROC(curproc))
+			return (RW_WRITE);
+		return (RW_WRITE_OTHER);
+	}
+	if (o)
+		return (RW_READ);
+
+	return (0);
+}
+
+void
+rw_assert_wrlock(struct rwlock *rwl)
+{
+	if (rw_status(rwl) != RW_WRITE)
+		panic("%s: lock not held by me", rwl->rwl_name);
+}
+
+void
+rw_assert_rdlock(struct rwlock *rwl)
+{
+	if (rw_status(rwl) != RW_READ)
+		panic("%s: lock not shared", rwl->rwl_name);
+}
+
+void
+rw_assert_anylock(struct rwlock *rwl)
+{
+	switch (rw_status(rwl)) {
+	case RW_WRITE_OTHER:
+		panic("%s: lock held by different proc", rwl->rwl_name);
+	case 0:
+		panic("%s: lock not held", rwl->rwl_name);
+	}
+}
+
+void
+rw_assert_unlocked(struct rwlock *rwl)
+{
+	if (rw_status(rwl) == RW_WRITE)
+		panic("%s: lock held", rwl->rwl_name);
+}
+
+void
+rrw_init_flags(struct rrwlock *rrwl, const char *name, int flags)
+{
+	memset(rrwl, 0, sizeof(*rrwl));
+	rw_init_flags(&rrwl->rrwl_lock, name, flags);
+}
+
+int
+rrw_enter(struct rrwlock *rrwl, int flags)
+{
+	int rv;
+
+	if (rw_status(&rrwl->rrwl_lock) == RW_WRITE) {
+		if (flags & RW_RECURSEFAIL)
+			return (EDEADLK);
+		rrwl->rrwl_wcnt++;
+		return (0);
+	}
+
+	rv = rw_enter(&rrwl->rrwl_lock, flags);
+	if (rv == 0 && rw_status(&rrwl->rrwl_lock) == RW_WRITE)
+		rrwl->rrwl_wcnt = 1;
+
+	return (rv);
+}
+
+void
+rrw_exit(struct rrwlock *rrwl)
+{
+	if (rw_status(&rrwl->rrwl_lock) == RW_WRITE) {
+		KASSERT(rrwl->rrwl_wcnt > 0);
+		if (--rrwl->rrwl_wcnt != 0)
+			return;
+	}
+	rw_exit(&rrwl->rrwl_lock);
+}
+
+int
+rrw_status(struct rrwlock *rrwl)
+{
+	return (rw_status(&rrwl->rrwl_lock));
+}
+
+/*
+ * malloc(9), pool(9), hashinit(9).
+ */
+void *
+hammer2k_malloc(size_t size, int type, int flags)
+{
+	void *p;
+
+	if (flags & M_ZERO)
+		p = calloc(1, size);
+	else
+		p = malloc(size);
+	if (p == NULL && (flags & (M_NOWAIT | M_CANFAIL)) == 0)
+		panic("malloc: out of space, size %zu type %d", size, type);
+
+	return (p);
+}
+
+void
+hammer2k_free(void *addr, int type, size_t size)
+{
+	free(addr);
+}
+
+size_t
+kmem_lim_size(void)
+{
+	long pages, pagesize;
+
+	/* In megabytes, a quarter of physical memory. */
+	pages = sysconf(_SC_PHYS_PAGES);
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pages <= 0 || pagesize <= 0)
+		return (256);
+
+	return ((size_t)pages / 4 / (1024 * 1024 / pagesize));
+}
+
+void
+pool_init(struct pool *pp, size_t size, u_int align, int ipl, int flags,
+    const char *wchan, void *palloc)
+{
+	memset(pp, 0, sizeof(*pp));
+	pp->pr_wchan = wchan;
+	pp->pr_size = size;
+}
+
+void
+pool_destroy(struct pool *pp)
+{
+	if (pp->pr_nout)
+		printf("pool_destroy: %s has %u items out\n", pp->pr_wchan,
+		    pp->pr_nout);
+}
+
+void *
+pool_get(struct pool *pp, int flags)
+{
+	void *v;
+	int mflags = 0;
+
+	if (flags & PR_ZERO)
+		mflags |= M_ZERO;
+	if (flags & PR_NOWAIT)
+		mflags |= M_NOWAIT;
+	v = hammer2k_malloc(pp->pr_size, M_TEMP, mflags);
+	if (v) {
+		__atomic_add_fetch(&pp->pr_nout, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&pp->pr_nget, 1, __ATOMIC_RELAXED);
+	}
+
+	return (v);
+}
+
+void
+pool_put(struct pool *pp, void *v)
+{
+	KASSERT(v != NULL);
+	__atomic_sub_fetch(&pp->pr_nout, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pp->pr_nput, 1, __ATOMIC_RELAXED);
+	free(v);
+}
+
+void *
+hashinit(int elements, int type, int flags, u_long *hashmask)
+{
+	LIST_HEAD(generic, generic) *hashtbl;
+	u_long hashsize, i;
+
+	if (elements <= 0)
+		panic("hashinit: bad cnt");
+	for (hashsize = 1; hashsize < (u_long)elements; hashsize <<= 1)
+		continue;
+	hashtbl = hammer2k_malloc(hashsize * sizeof(*hashtbl), type, flags);
+	if (hashtbl == NULL)
+		return (NULL);
+	for (i = 0; i < hashsize; i++)
+		LIST_INIT(&hashtbl[i]);
+	*hashmask = hashsize - 1;
+
+	return (hashtbl);
+}
+
+void
+hashfree(void *hash, int elements, int type)
+{
+	free(hash);
+}
+
+/*
+ * Credentials.
+ */
+int
+suser_ucred(struct ucred *cred)
+{
+	if (cred->cr_uid == 0)
+		return (0);
+
+	return (EPERM);
+}
+
+int
+groupmember(gid_t gid, struct ucred *cred)
+{
+	int i;
+
+	if (cred->cr_gid == gid)
+		return (1);
+	for (i = 0; i < cred->cr_ngroups; i++)
+		if (cred->cr_groups[i] == gid)
+			return (1);
+
+	return (0);
+}
+
+int
+vaccess(enum vtype type, mode_t file_mode, uid_t uid, gid_t gid,
+    mode_t acc_mode, struct ucred *cred)
+{
+	mode_t mask;
+
+	/* User id 0 always gets read/write access. */
+	if (cred->cr_uid == 0) {
+		/* For VEXEC, at least one of the execute bits must be set. */
+		if ((acc_mode & VEXEC) && type != VDIR &&
+		    (file_mode & (S_IXUSR|S_IXGRP|S_IXOTH)) == 0)
+			return (EACCES);
+		return (0);
+	}
+
+	mask = 0;
+
+	/* Otherwise, check the owner. */
+	if (cred->cr_uid == uid) {
+		if (acc_mode & VEXEC)
+			mask |= S_IXUSR;
+		if (acc_mode & VREAD)
+			mask |= S_IRUSR;
+		if (acc_mode & VWRITE)
+			mask |= S_IWUSR;
+		return ((file_mode & mask) == mask ? 0 : EACCES);
+	}
+
+	/* Otherwise, check the groups. */
+	if (groupmember(gid, cred)) {
+		if (acc_mode & VEXEC)
+			mask |= S_IXGRP;
+		if (acc_mode & VREAD)
+			mask |= S_IRGRP;
+		if (acc_mode & VWRITE)
+			mask |= S_IWGRP;
+		return ((file_mode & mask) == mask ? 0 : EACCES);
+	}
+
+	/* Otherwise, check everyone else. */
+	if (acc_mode & VEXEC)
+		mask |= S_IXOTH;
+	if (acc_mode & VREAD)
+		mask |= S_IROTH;
+	if (acc_mode & VWRITE)
+		mask |= S_IWOTH;
+
+	return ((file_mode & mask) == mask ? 0 : EACCES);
+}
+
+int
+cursig(struct proc *p, struct sigctx *ctx, int deep)
+{
+	return (0);
+}
+
+/*
+ * Copy routines.  There is a single address space so UIO_USERSPACE and
+ * UIO_SYSSPACE are treated alike.
+ */
+int
+uiomove(void *cp, size_t n, struct uio *uio)
+{
+	struct iovec *iov;
+	size_t cnt;
+
+	if (uio->uio_rw != UIO_READ && uio->uio_rw != UIO_WRITE)
+		panic("uiomove: mode");
+
+	while (n > 0 && uio->uio_resid) {
+		iov = uio->uio_iov;
+		cnt = iov->iov_len;
+		if (cnt == 0) {
+			KASSERT(uio->uio_iovcnt > 0);
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+		if (cnt > n)
+			cnt = n;
+		if (uio->uio_rw == UIO_READ)
+			memcpy(iov->iov_base, cp, cnt);
+		else
+			memcpy(cp, iov->iov_base, cnt);
+		iov->iov_base = (char *)iov->iov_base + cnt;
+		iov->iov_len -= cnt;
+		uio->uio_resid -= cnt;
+		uio->uio_offset += cnt;
+		cp = (char *)cp + cnt;
+		n -= cnt;
+	}
+
+	return (0);
+}
+
+int
+copyout(const void *kaddr, void *udaddr, size_t len)
+{
+	memcpy(udaddr, kaddr, len);
+
+	return (0);
+}
+
+int
+copyinstr(const void *uaddr, void *kaddr, size_t len, size_t *done)
+{
+	size_t n;
+
+	n = strnlen(uaddr, len);
+	if (n == len) {
+		if (done)
+			*done = len;
+		return (ENAMETOOLONG);
+	}
+	memcpy(kaddr, uaddr, n + 1);
+	if (done)
+		*done = n + 1;
+
+	return (0);
+}
+
+/*
+ * libkern.
+ */
+size_t
+hammer2k_strlcpy(char *dst, const char *src, size_t dsize)
+{
+	const char *osrc = src;
+	size_t nleft = dsize;
+
+	/* Copy as many bytes as will fit. */
+	if (nleft != 0) {
+		while (--nleft != 0) {
+			if ((*dst++ = *src++) == '\0')
+				break;
+		}
+	}
+
+	/* Not enough room in dst, add NUL and traverse rest of src. */
+	if (nleft == 0) {
+		if (dsize != 0)
+			*dst = '\0';		/* NUL-terminate dst */
+		while (*src++)
+			;
+	}
+
+	return (src - osrc - 1);	/* count does not include NUL */
+}
+
+size_t
+hammer2k_strlcat(char *dst, const char *src, size_t dsize)
+{
+	const char *odst = dst;
+	const char *osrc = src;
+	size_t n = dsize;
+	size_t dlen;
+
+	/* Find the end of dst and adjust bytes left but don't go past end. */
+	while (n-- != 0 && *dst != '\0')
+		dst++;
+	dlen = dst - odst;
+	n = dsize - dlen;
+
+	if (n-- == 0)
+		return (dlen + strlen(src));
+	while (*src != '\0') {
+		if (n != 0) {
+			*dst++ = *src;
+			n--;
+		}
+		src++;
+	}
+	*dst = '\0';
+
+	return (dlen + (src - osrc));	/* count does not include NUL */
+}
+
+__dead void
+panic(const char *fmt, ...)
+{
+	va_list ap;
+
+	fflush(stdout);
+	fprintf(stderr, "panic: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+int
+splbio(void)
+{
+	return (0);
+}
+
+void
+splx(int s)
+{
+}
+
+int
+eopnotsupp(void *v)
+{
+	return (EOPNOTSUPP);
+}
+
+int
+sysctl_bounded_arr(const struct sysctl_bounded_args *valpp, u_int valplen,
+    int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
+    size_t newlen)
+{
+	return (EOPNOTSUPP);
+}
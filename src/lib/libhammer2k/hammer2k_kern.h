@@ -0,0 +1,1397 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HAMMER2K_KERN_H_
+#define _HAMMER2K_KERN_H_
+
+/*
+ * The subset of the OpenBSD kernel API used by sys/fs/hammer2, implemented
+ * on top of libc and pthreads so that the unmodified kernel sources can be
+ * compiled into a userland library.  Every <sys/...> header the kernel
+ * sources include and userland lacks (or defines differently) is shadowed
+ * by a stub under include/ which pulls in this file.
+ *
+ * Concurrency follows the big kernel lock model the OpenBSD VFS still runs
+ * under.  A single mutex (Giant) is held while kernel code runs and is
+ * released only where the kernel would give up the CPU: when sleeping on
+ * a wait channel or a sleeping lock, while waiting for device I/O, and in
+ * CPU_BUSY_CYCLE() spin loops.
+ */
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sysmacros.h>	/* major(), minor() */
+#include <endian.h>
+#define daddr_t		int64_t	/* glibc's daddr_t is an int */
+#define betoh16(x)	be16toh(x)
+#else
+#include <sys/endian.h>
+#endif
+
+/*
+ * <sys/cdefs.h>
+ */
+#ifndef __unused
+#define __unused	__attribute__((__unused__))
+#endif
+#ifndef __packed
+#define __packed	__attribute__((__packed__))
+#endif
+#ifndef __aligned
+#define __aligned(x)	__attribute__((__aligned__(x)))
+#endif
+#ifndef __dead
+#define __dead		__attribute__((__noreturn__))
+#endif
+#ifndef __predict_true
+#define __predict_true(e)	__builtin_expect(((e) != 0), 1)
+#define __predict_false(e)	__builtin_expect(((e) != 0), 0)
+#endif
+
+typedef uintptr_t	__uintptr_t;
+typedef uint64_t	u_quad_t;
+typedef int64_t		quad_t;
+
+/*
+ * <sys/param.h>
+ */
+#ifndef DEV_BSIZE
+#define DEV_BSIZE	512
+#endif
+#undef MAXBSIZE
+#define MAXBSIZE	(64 * 1024)
+#undef MAXPHYS
+#define MAXPHYS		(64 * 1024)
+#ifndef PAGE_SIZE
+#define PAGE_SIZE	4096
+#endif
+#ifndef MNAMELEN
+#define MNAMELEN	90
+#endif
+#ifndef MAXPATHLEN
+#define MAXPATHLEN	PATH_MAX
+#endif
+#ifndef NODEV
+#define NODEV		(dev_t)(-1)
+#endif
+#ifndef howmany
+#define howmany(x, y)	(((x) + ((y) - 1)) / (y))
+#endif
+#ifndef roundup
+#define roundup(x, y)	((((x) + ((y) - 1)) / (y)) * (y))
+#endif
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+#ifndef MIN
+#define MIN(a, b)	(((a) < (b)) ? (a) : (b))
+#define MAX(a, b)	(((a) > (b)) ? (a) : (b))
+#endif
+
+#define PINOD		8
+#define PRIBIO		16
+#define PCATCH		0x100
+#define PNORELOCK	0x200
+
+#define INFSLP		UINT64_MAX
+
+#ifndef EFTYPE
+#define EFTYPE		79
+#endif
+#define EJUSTRETURN	(-2)
+
+#ifndef S_ISTXT
+#define S_ISTXT		S_ISVTX
+#endif
+#ifndef ALLPERMS
+#define ALLPERMS	(S_ISUID|S_ISGID|S_ISTXT|S_IRWXU|S_IRWXG|S_IRWXO)
+#endif
+#ifndef UF_NODUMP
+#define UF_NODUMP	0x00000001
+#define UF_IMMUTABLE	0x00000002
+#define UF_APPEND	0x00000004
+#define SF_ARCHIVED	0x00010000
+#define SF_IMMUTABLE	0x00020000
+#define SF_APPEND	0x00040000
+#endif
+#define IMMUTABLE	(UF_IMMUTABLE | SF_IMMUTABLE)
+#define APPEND		(UF_APPEND | SF_APPEND)
+
+#ifndef FREAD
+#define FREAD		0x0001
+#define FWRITE		0x0002
+#endif
+
+/*
+ * The kernel's libkern string functions.  Renamed so they cannot clash
+ * with (or depend on) a libc which may or may not provide them.
+ */
+#define strlcpy		hammer2k_strlcpy
+#define strlcat		hammer2k_strlcat
+size_t hammer2k_strlcpy(char *, const char *, size_t);
+size_t hammer2k_strlcat(char *, const char *, size_t);
+
+/*
+ * <sys/atomic.h>, <machine/cpufunc.h>
+ */
+#define atomic_add_int(p, v)	__atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_sub_int(p, v)	__atomic_sub_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_inc_int(p)	atomic_add_int((p), 1)
+#define atomic_dec_int(p)	atomic_sub_int((p), 1)
+#define atomic_add_long(p, v)	__atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_setbits_int(p, v) \
+	((void)__atomic_or_fetch((p), (v), __ATOMIC_SEQ_CST))
+#define atomic_clearbits_int(p, v) \
+	((void)__atomic_and_fetch((p), ~(v), __ATOMIC_SEQ_CST))
+
+static __inline unsigned int
+atomic_cas_uint(volatile unsigned int *p, unsigned int o, unsigned int n)
+{
+	__atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_SEQ_CST,
+	    __ATOMIC_SEQ_CST);
+	return (o);
+}
+
+#define membar_enter()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define membar_exit()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define membar_producer()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define membar_consumer()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define membar_sync()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+void hammer2k_busy_cycle(void);
+#define CPU_BUSY_CYCLE()	hammer2k_busy_cycle()
+
+/*
+ * Giant, see above.  hammer2k_giant_enter() is recursive so API entry
+ * points may nest.
+ */
+void hammer2k_giant_enter(void);
+void hammer2k_giant_exit(void);
+int hammer2k_giant_owned(void);
+int hammer2k_giant_drop(void);
+void hammer2k_giant_pickup(int);
+
+#define KERNEL_LOCK()		hammer2k_giant_enter()
+#define KERNEL_UNLOCK()		hammer2k_giant_exit()
+#define KERNEL_ASSERT_LOCKED()	KASSERT(hammer2k_giant_owned())
+
+/*
+ * <sys/systm.h>
+ */
+__dead void panic(const char *, ...)
+	__attribute__((__format__(__printf__, 1, 2)));
+
+#ifdef DIAGNOSTIC
+#define KASSERT(e) \
+	((e) ? (void)0 : panic("kernel %sassertion \"%s\" failed: " \
+	    "file \"%s\", line %d", "diagnostic ", #e, __FILE__, __LINE__))
+#define KASSERTMSG(e, msg, ...) \
+	((e) ? (void)0 : panic("kernel %sassertion \"%s\" failed: " \
+	    "file \"%s\", line %d: " msg, "diagnostic ", #e, __FILE__, \
+	    __LINE__, ## __VA_ARGS__))
+#else
+#define KASSERT(e)		((void)0)
+#define KASSERTMSG(e, msg, ...)	((void)0)
+#endif
+
+#define CTASSERT(x)	extern char _ctassert[(x) ? 1 : -1] \
+			    __attribute__((__unused__))
+
+struct rwlock;
+
+extern int hz;
+extern volatile int ticks;	/* advanced hz times a second */
+time_t gettime(void);
+void getnanotime(struct timespec *);
+uint64_t getnsecuptime(void);
+
+int tsleep(const volatile void *, int, const char *, int);
+int rwsleep(const volatile void *, struct rwlock *, int, const char *, int);
+void wakeup(const volatile void *);
+
+int copyout(const void *, void *, size_t);
+int copyinstr(const void *, void *, size_t, size_t *);
+
+int splbio(void);
+void splx(int);
+
+int eopnotsupp(void *);
+
+/*
+ * <sys/proc.h>, <sys/ucred.h>
+ */
+struct ucred {
+	int	cr_ref;
+	uid_t	cr_uid;
+	uid_t	cr_ruid;
+	gid_t	cr_gid;
+	gid_t	cr_rgid;
+	short	cr_ngroups;
+	gid_t	cr_groups[16];
+};
+
+#define NOCRED		((struct ucred *)-1)
+#define FSCRED		((struct ucred *)-2)
+
+struct process {
+	char	ps_comm[24];
+};
+
+struct proc {
+	struct process	*p_p;
+	struct ucred	*p_ucred;
+	pid_t		p_tid;
+	struct process	p_process;	/* storage for p_p */
+	struct ucred	p_cred;		/* storage for p_ucred */
+};
+
+struct proc *hammer2k_curproc(void);
+#define curproc		hammer2k_curproc()
+
+int suser_ucred(struct ucred *);
+int groupmember(gid_t, struct ucred *);
+
+/*
+ * <sys/signalvar.h>
+ */
+struct sigctx {
+	int	sig_dummy;
+};
+
+int cursig(struct proc *, struct sigctx *, int);
+
+/*
+ * <sys/malloc.h>, <sys/pool.h>
+ *
+ * malloc(9) and free(9) are macros so that the kernel's three argument
+ * forms do not collide with libc; <stdlib.h> has been included above.
+ */
+#define M_TEMP		127
+#define M_HAMMER2	155
+#define M_HAMMER2_RBUF	156
+#define M_HAMMER2_WBUF	157
+#define M_HAMMER2_LZ4	158
+
+#define M_WAITOK	0x0001
+#define M_NOWAIT	0x0002
+#define M_CANFAIL	0x0004
+#define M_ZERO		0x0008
+
+void *hammer2k_malloc(size_t, int, int);
+void hammer2k_free(void *, int, size_t);
+#define malloc(size, type, flags)	hammer2k_malloc((size), (type), (flags))
+#define free(addr, type, size)		hammer2k_free((addr), (type), (size))
+#define mallocarray(n, size, type, flags) \
+	hammer2k_malloc((n) * (size), (type), (flags))
+
+void *hashinit(int, int, int, unsigned long *);
+void hashfree(void *, int, int);
+
+size_t kmem_lim_size(void);
+extern long bufhighpages;
+
+#define IPL_NONE	0
+#define IPL_BIO		6
+
+#define PR_WAITOK	0x0001
+#define PR_NOWAIT	0x0002
+#define PR_LIMITFAIL	0x0004
+#define PR_ZERO		0x0008
+
+struct pool {
+	const char	*pr_wchan;
+	size_t		pr_size;
+	unsigned int	pr_nout;	/* items handed out */
+	unsigned int	pr_nget;
+	unsigned int	pr_nput;
+};
+
+void pool_init(struct pool *, size_t, u_int, int, int, const char *, void *);
+void pool_destroy(struct pool *);
+void *pool_get(struct pool *, int);
+void pool_put(struct pool *, void *);
+
+/*
+ * <sys/rwlock.h>
+ */
+struct rwlock {
+	volatile unsigned long	rwl_owner;	/* struct proc * or readers */
+	const char		*rwl_name;
+	int			rwl_waiters;
+};
+
+#define RWLOCK_WRLOCK		0x04UL
+#define RWLOCK_READ_INCR	0x08UL
+
+#define RW_WRITE		0x0001UL
+#define RW_READ			0x0002UL
+#define RW_DOWNGRADE		0x0004UL
+#define RW_OPMASK		0x0007UL
+#define RW_INTR			0x0010UL
+#define RW_SLEEPFAIL		0x0020UL
+#define RW_NOSLEEP		0x0040UL
+#define RW_RECURSEFAIL		0x0080UL
+#define RW_DUPOK		0x0100UL
+#define RW_WRITE_OTHER		0x0100UL	/* rw_status() only */
+
+#define RWL_DUPOK		0x01
+#define RWL_NOWITNESS		0x02
+#define RWL_IS_VNODE		0x04
+
+void rw_init_flags(struct rwlock *, const char *, int);
+#define rw_init(rwl, name)	rw_init_flags((rwl), (name), 0)
+void rw_enter_read(struct rwlock *);
+void rw_enter_write(struct rwlock *);
+void rw_exit_read(struct rwlock *);
+void rw_exit_write(struct rwlock *);
+int rw_enter(struct rwlock *, int);
+void rw_exit(struct rwlock *);
+int rw_status(struct rwlock *);
+void rw_assert_wrlock(struct rwlock *);
+void rw_assert_rdlock(struct rwlock *);
+void rw_assert_anylock(struct rwlock *);
+void rw_assert_unlocked(struct rwlock *);
+
+struct rrwlock {
+	struct rwlock		rrwl_lock;
+	uint32_t		rrwl_wcnt;	/* # writers */
+};
+
+void rrw_init_flags(struct rrwlock *, const char *, int);
+#define rrw_init(rrwl, name)	rrw_init_flags((rrwl), (name), 0)
+int rrw_enter(struct rrwlock *, int);
+void rrw_exit(struct rrwlock *);
+int rrw_status(struct rrwlock *);
+
+/*
+ * <sys/lock.h>
+ */
+#define LK_SHARED	RW_READ
+#define LK_EXCLUSIVE	RW_WRITE
+#define LK_TYPE_MASK	(LK_SHARED | LK_EXCLUSIVE)
+#define LK_DRAIN	0x1000UL
+#define LK_RETRY	0x2000UL
+#define LK_NOWAIT	0x0040UL
+#define LK_RECURSEFAIL	0x0080UL
+#define LK_RWFLAGS	(LK_SHARED | LK_EXCLUSIVE | LK_NOWAIT | LK_RECURSEFAIL)
+
+/*
+ * <sys/uio.h>
+ */
+#ifdef __OpenBSD__
+#include <sys/uio.h>	/* struct iovec, enum uio_rw, enum uio_seg */
+#else
+#include <sys/uio.h>	/* struct iovec */
+enum uio_rw {
+	UIO_READ,
+	UIO_WRITE
+};
+
+enum uio_seg {
+	UIO_USERSPACE,
+	UIO_SYSSPACE
+};
+#endif
+
+struct uio {
+	struct iovec	*uio_iov;
+	int		uio_iovcnt;
+	off_t		uio_offset;
+	size_t		uio_resid;
+	enum uio_seg	uio_segflg;
+	enum uio_rw	uio_rw;
+	struct proc	*uio_procp;
+};
+
+#define UIO_NOCOPY	(UIO_SYSSPACE + 1)	/* never set by hammer2k */
+
+int uiomove(void *, size_t, struct uio *);
+
+/*
+ * <sys/dirent.h>
+ */
+#define MAXNAMLEN	255
+
+struct dirent {
+	ino_t		d_fileno;
+	off_t		d_off;
+	uint16_t	d_reclen;
+	uint8_t		d_type;
+	uint8_t		d_namlen;
+	uint8_t		__d_padding[4];
+	char		d_name[MAXNAMLEN + 1];
+};
+
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN	0
+#define DT_FIFO		1
+#define DT_CHR		2
+#define DT_DIR		4
+#define DT_BLK		6
+#define DT_REG		8
+#define DT_LNK		10
+#define DT_SOCK		12
+#endif
+
+#define DIRENT_RECSIZE(namlen) \
+	((offsetof(struct dirent, d_name) + (namlen) + 1 + 7) &~ 7)
+#define DIRENT_SIZE(dp)		DIRENT_RECSIZE((dp)->d_namlen)
+
+/*
+ * <sys/uuid.h>
+ */
+#define _UUID_NODE_LEN	6
+
+struct uuid {
+	uint32_t	time_low;
+	uint16_t	time_mid;
+	uint16_t	time_hi_and_version;
+	uint8_t		clock_seq_hi_and_reserved;
+	uint8_t		clock_seq_low;
+	uint8_t		node[_UUID_NODE_LEN];
+};
+
+int uuid_snprintf(char *, size_t, const struct uuid *);	/* hammer2_ondisk.c */
+
+/*
+ * <sys/ioccom.h>
+ */
+#undef IOCPARM_MASK
+#undef IOC_VOID
+#undef IOC_OUT
+#undef IOC_IN
+#undef IOC_INOUT
+#undef _IOC
+#undef _IO
+#undef _IOR
+#undef _IOW
+#undef _IOWR
+#define IOCPARM_MASK	0x1fff
+#define IOC_VOID	0x20000000UL
+#define IOC_OUT		0x40000000UL
+#define IOC_IN		0x80000000UL
+#define IOC_INOUT	(IOC_IN|IOC_OUT)
+#define _IOC(inout, group, num, len) ((inout) | \
+	(((len) & IOCPARM_MASK) << 16) | ((group) << 8) | (num))
+#define _IO(g, n)	_IOC(IOC_VOID, (g), (n), 0)
+#define _IOR(g, n, t)	_IOC(IOC_OUT, (g), (n), sizeof(t))
+#define _IOW(g, n, t)	_IOC(IOC_IN, (g), (n), sizeof(t))
+#define _IOWR(g, n, t)	_IOC(IOC_INOUT, (g), (n), sizeof(t))
+
+/*
+ * <sys/sysctl.h>
+ */
+#define CTLTYPE_NODE	1
+#define CTLTYPE_INT	2
+#define CTLTYPE_STRING	3
+
+struct sysctl_bounded_args {
+	int		mib;
+	int		*var;
+	int		minimum;
+	int		maximum;
+};
+
+#define SYSCTL_INT_READONLY	1, 0
+
+int sysctl_bounded_arr(const struct sysctl_bounded_args *, u_int,
+	    int *, u_int, void *, size_t *, void *, size_t);
+
+/*
+ * <sys/event.h>
+ */
+#define EVFILT_READ	(-1)
+#define EVFILT_WRITE	(-2)
+#define EVFILT_VNODE	(-4)
+
+#define EV_ONESHOT	0x0010
+#define EV_EOF		0x8000
+#define __EV_POLL	0x1000
+#define __EV_SELECT	0x0800
+
+#define NOTE_EOF	0x0002
+#define NOTE_DELETE	0x0001
+#define NOTE_WRITE	0x0002
+#define NOTE_EXTEND	0x0004
+#define NOTE_ATTRIB	0x0008
+#define NOTE_LINK	0x0010
+#define NOTE_RENAME	0x0020
+#define NOTE_REVOKE	0x0040
+
+#define FILTEROP_ISFD	0x00000001
+
+struct knote;
+struct file {
+	off_t	f_offset;
+};
+
+struct filterops {
+	int	f_flags;
+	int	(*f_attach)(struct knote *);
+	void	(*f_detach)(struct knote *);
+	int	(*f_event)(struct knote *, long);
+};
+
+struct knote {
+	struct knote		*kn_next;
+	short			kn_filter;
+	unsigned short		kn_flags;
+	unsigned int		kn_fflags;
+	unsigned int		kn_sfflags;
+	int64_t			kn_data;
+	const struct filterops	*kn_fop;
+	struct file		*kn_fp;
+	void			*kn_hook;
+};
+
+struct klist {
+	struct knote	*kl_list;
+};
+
+void klist_insert_locked(struct klist *, struct knote *);
+void klist_remove_locked(struct klist *, struct knote *);
+off_t foffset(struct file *);
+
+#define VN_KNOTE(vp, hint)	((void)(vp), (void)(hint))
+
+/*
+ * <sys/mount.h>
+ */
+#define fsid_t		hammer2k_fsid_t	/* glibc has its own */
+
+typedef struct fsid {
+	int32_t	val[2];
+} fsid_t;
+
+struct fid {
+	u_short	fid_len;
+	u_short	fid_reserved;
+	char	fid_data[16];
+};
+
+struct export_args {
+	int	ex_flags;
+	uid_t	ex_root;
+	void	*ex_anon;	/* struct xucred in the kernel */
+	void	*ex_addr;
+	int	ex_addrlen;
+	void	*ex_mask;
+	int	ex_masklen;
+};
+
+struct netcred {
+	int		netc_exflags;
+	struct ucred	netc_anon;
+};
+
+struct netexport {
+	struct netcred	ne_defexported;
+};
+
+struct hammer2_args {
+	char			*fspec;
+	struct export_args	export_info;
+	int			hflags;
+};
+
+union mount_info {
+	struct hammer2_args	hammer2_args;
+	char			__align[160];
+};
+
+struct statfs {
+	uint32_t	f_flags;
+	uint32_t	f_bsize;
+	uint32_t	f_iosize;
+	uint64_t	f_blocks;
+	uint64_t	f_bfree;
+	int64_t		f_bavail;
+	uint64_t	f_files;
+	uint64_t	f_ffree;
+	int64_t		f_favail;
+	uint64_t	f_syncwrites;
+	uint64_t	f_syncreads;
+	uint64_t	f_asyncwrites;
+	uint64_t	f_asyncreads;
+	fsid_t		f_fsid;
+	uint32_t	f_namemax;
+	uid_t		f_owner;
+	uint64_t	f_ctime;
+	char		f_fstypename[16];
+	char		f_mntonname[MNAMELEN];
+	char		f_mntfromname[MNAMELEN];
+	char		f_mntfromspec[MNAMELEN];
+	union mount_info mount_info;
+};
+
+struct vfsconf {
+	const struct vfsops	*vfc_vfsops;
+	char			vfc_name[16];
+	int			vfc_typenum;
+	u_int			vfc_refcount;
+	int			vfc_flags;
+	size_t			vfc_datasize;
+};
+
+struct vnode;
+struct mbuf;
+struct nameidata;
+
+struct mount {
+	const struct vfsops	*mnt_op;
+	struct vfsconf		*mnt_vfc;
+	struct vnode		*mnt_vnodecovered;
+	struct vnode		*mnt_syncer;
+	TAILQ_HEAD(, vnode)	mnt_vnodelist;	/* hammer2k */
+	struct rwlock		mnt_lock;
+	int			mnt_flag;
+	struct statfs		mnt_stat;
+	void			*mnt_data;
+	unsigned int		mnt_maxsymlinklen;
+};
+
+#define MNT_RDONLY	0x00000001
+#define MNT_SYNCHRONOUS	0x00000002
+#define MNT_NOEXEC	0x00000004
+#define MNT_NOSUID	0x00000008
+#define MNT_NODEV	0x00000010
+#define MNT_ASYNC	0x00000040
+#define MNT_LOCAL	0x00001000
+#define MNT_ROOTFS	0x00004000
+#define MNT_NOATIME	0x00008000
+#define MNT_UPDATE	0x00010000
+#define MNT_DELEXPORT	0x00020000
+#define MNT_RELOAD	0x00040000
+#define MNT_FORCE	0x00080000
+#define MNT_WANTRDWR	0x02000000
+#define MNT_SOFTDEP	0x04000000
+
+#define MNT_WAIT	1
+#define MNT_NOWAIT	2
+#define MNT_LAZY	3
+
+struct vfsops {
+	int	(*vfs_mount)(struct mount *, const char *, void *,
+		    struct nameidata *, struct proc *);
+	int	(*vfs_start)(struct mount *, int, struct proc *);
+	int	(*vfs_unmount)(struct mount *, int, struct proc *);
+	int	(*vfs_root)(struct mount *, struct vnode **);
+	int	(*vfs_quotactl)(struct mount *, int, uid_t, caddr_t,
+		    struct proc *);
+	int	(*vfs_statfs)(struct mount *, struct statfs *,
+		    struct proc *);
+	int	(*vfs_sync)(struct mount *, int, int, struct ucred *,
+		    struct proc *);
+	int	(*vfs_vget)(struct mount *, ino_t, struct vnode **);
+	int	(*vfs_fhtovp)(struct mount *, struct fid *,
+		    struct vnode **);
+	int	(*vfs_vptofh)(struct vnode *, struct fid *);
+	int	(*vfs_init)(struct vfsconf *);
+	int	(*vfs_sysctl)(int *, u_int, void *, size_t *, void *,
+		    size_t, struct proc *);
+	int	(*vfs_checkexp)(struct mount *, struct mbuf *, int *,
+		    struct ucred **);
+};
+
+#define VFS_ROOT(mp, vpp)	(*(mp)->mnt_op->vfs_root)((mp), (vpp))
+#define VFS_STATFS(mp, sbp, p)	(*(mp)->mnt_op->vfs_statfs)((mp), (sbp), (p))
+#define VFS_SYNC(mp, w, s, c, p) \
+	(*(mp)->mnt_op->vfs_sync)((mp), (w), (s), (c), (p))
+#define VFS_VGET(mp, ino, vpp)	(*(mp)->mnt_op->vfs_vget)((mp), (ino), (vpp))
+
+int vfs_export(struct mount *, struct netexport *, struct export_args *);
+struct netcred *vfs_export_lookup(struct mount *, struct netexport *,
+	    struct mbuf *);
+int vfs_mountedon(struct vnode *);
+void copy_statfs_info(struct statfs *, const struct mount *);
+int vflush(struct mount *, struct vnode *, int);
+int vfs_mount_foreach_vnode(struct mount *,
+	    int (*)(struct vnode *, void *), void *);
+
+#define SKIPSYSTEM	0x0001
+#define FORCECLOSE	0x0002
+#define WRITECLOSE	0x0004
+#define IGNORECLEAN	0x0010
+
+/*
+ * <sys/vnode.h>
+ */
+enum vtype {
+	VNON, VREG, VDIR, VBLK, VCHR, VLNK, VSOCK, VFIFO, VBAD
+};
+
+enum vtagtype {
+	VT_NON, VT_UFS, VT_NFS, VT_MFS, VT_MSDOSFS, VT_PORTAL, VT_PROCFS,
+	VT_AFS, VT_ISOFS, VT_ADOSFS, VT_EXT2FS, VT_VFS, VT_NTFS, VT_UDF,
+	VT_FUSEFS, VT_TMPFS, VT_HAMMER2
+};
+
+struct buf;
+
+TAILQ_HEAD(hammer2k_buflists, buf);
+
+struct vnode {
+	const struct vops	*v_op;
+	enum vtype		v_type;
+	enum vtagtype		v_tag;
+	unsigned int		v_flag;
+	unsigned int		v_usecount;
+	unsigned int		v_writecount;
+	struct mount		*v_mount;
+	struct mount		*v_specmountpoint;
+	dev_t			v_rdev;
+	void			*v_data;
+	struct klist		v_klist;
+
+	/* hammer2k */
+	TAILQ_ENTRY(vnode)	v_mntvnodes;
+	TAILQ_ENTRY(vnode)	v_freelist;
+	struct hammer2k_buflists v_bufs;	/* cached buffers */
+	int			v_ndirty;	/* B_DELWRI buffers */
+	int			v_numoutput;	/* writes in progress */
+	int			v_onfree;
+	int			v_fd;		/* device vnodes */
+	int			v_devopen;	/* device vnodes */
+	char			*v_devpath;	/* device vnodes */
+	off_t			v_mediasize;	/* device vnodes */
+};
+
+#define VROOT		0x0001
+#define VTEXT		0x0002
+#define VSYSTEM		0x0004
+#define VISTTY		0x0008
+#define VXLOCK		0x0100
+#define VXWANT		0x0200
+#define VCLONED		0x0400
+#define VALIASED	0x0800
+#define VLARVAL		0x1000
+#define VLOCKSWORK	0x4000
+#define VCLONE		0x8000
+
+#define NULLVP		((struct vnode *)NULL)
+#define VNOVAL		(-1)
+
+#define VEXEC		00100
+#define VWRITE		00200
+#define VREAD		00400
+
+#define IO_UNIT		0x01
+#define IO_APPEND	0x02
+#define IO_SYNC		0x04
+#define IO_NODELOCKED	0x08
+#define IO_NDELAY	0x10
+#define IO_NOLIMIT	0x20
+#define IO_NOCACHE	0x40
+
+#define V_SAVE		0x0001
+
+#define VA_UTIMES_NULL		0x01
+#define VA_EXCLUSIVE		0x02
+#define VA_UID_UUID_VALID	0x04	/* unused on OpenBSD */
+#define VA_GID_UUID_VALID	0x08	/* unused on OpenBSD */
+
+struct vattr {
+	enum vtype	va_type;
+	mode_t		va_mode;
+	nlink_t		va_nlink;
+	uid_t		va_uid;
+	gid_t		va_gid;
+	dev_t		va_fsid;
+	ino_t		va_fileid;
+	u_quad_t	va_size;
+	long		va_blocksize;
+	struct timespec	va_atime;
+	struct timespec	va_mtime;
+	struct timespec	va_ctime;
+	struct timespec	va_birthtime;
+	u_long		va_gen;
+	u_long		va_flags;
+	dev_t		va_rdev;
+	u_quad_t	va_bytes;
+	u_quad_t	va_filerev;
+	u_int		va_vaflags;
+	struct uuid	va_uid_uuid;	/* unused on OpenBSD */
+	struct uuid	va_gid_uuid;	/* unused on OpenBSD */
+};
+
+void vattr_null(struct vattr *);
+#define VATTR_NULL(vap)	vattr_null(vap)
+
+struct componentname;
+
+struct vops {
+	int	(*vop_lock)(void *);
+	int	(*vop_unlock)(void *);
+	int	(*vop_islocked)(void *);
+	int	(*vop_abortop)(void *);
+	int	(*vop_access)(void *);
+	int	(*vop_advlock)(void *);
+	int	(*vop_bmap)(void *);
+	int	(*vop_bwrite)(void *);
+	int	(*vop_close)(void *);
+	int	(*vop_create)(void *);
+	int	(*vop_fsync)(void *);
+	int	(*vop_getattr)(void *);
+	int	(*vop_inactive)(void *);
+	int	(*vop_ioctl)(void *);
+	int	(*vop_link)(void *);
+	int	(*vop_lookup)(void *);
+	int	(*vop_mknod)(void *);
+	int	(*vop_open)(void *);
+	int	(*vop_pathconf)(void *);
+	int	(*vop_print)(void *);
+	int	(*vop_read)(void *);
+	int	(*vop_readdir)(void *);
+	int	(*vop_readlink)(void *);
+	int	(*vop_reclaim)(void *);
+	int	(*vop_remove)(void *);
+	int	(*vop_rename)(void *);
+	int	(*vop_revoke)(void *);
+	int	(*vop_mkdir)(void *);
+	int	(*vop_rmdir)(void *);
+	int	(*vop_setattr)(void *);
+	int	(*vop_symlink)(void *);
+	int	(*vop_write)(void *);
+	int	(*vop_kqfilter)(void *);
+	int	(*vop_strategy)(void *);
+};
+
+struct vop_generic_args {
+	void	*a_garbage;
+};
+
+struct vop_islocked_args {
+	struct vnode	*a_vp;
+};
+
+struct vop_lookup_args {
+	struct vnode		*a_dvp;
+	struct vnode		**a_vpp;
+	struct componentname	*a_cnp;
+};
+
+struct vop_create_args {
+	struct vnode		*a_dvp;
+	struct vnode		**a_vpp;
+	struct componentname	*a_cnp;
+	struct vattr		*a_vap;
+};
+
+struct vop_mknod_args {
+	struct vnode		*a_dvp;
+	struct vnode		**a_vpp;
+	struct componentname	*a_cnp;
+	struct vattr		*a_vap;
+};
+
+struct vop_open_args {
+	struct vnode	*a_vp;
+	int		a_mode;
+	struct ucred	*a_cred;
+	struct proc	*a_p;
+};
+
+struct vop_close_args {
+	struct vnode	*a_vp;
+	int		a_fflag;
+	struct ucred	*a_cred;
+	struct proc	*a_p;
+};
+
+struct vop_access_args {
+	struct vnode	*a_vp;
+	int		a_mode;
+	struct ucred	*a_cred;
+	struct proc	*a_p;
+};
+
+struct vop_getattr_args {
+	struct vnode	*a_vp;
+	struct vattr	*a_vap;
+	struct ucred	*a_cred;
+	struct proc	*a_p;
+};
+
+struct vop_setattr_args {
+	struct vnode	*a_vp;
+	struct vattr	*a_vap;
+	struct ucred	*a_cred;
+	struct proc	*a_p;
+};
+
+struct vop_read_args {
+	struct vnode	*a_vp;
+	struct uio	*a_uio;
+	int		a_ioflag;
+	struct ucred	*a_cred;
+};
+
+struct vop_write_args {
+	struct vnode	*a_vp;
+	struct uio	*a_uio;
+	int		a_ioflag;
+	struct ucred	*a_cred;
+};
+
+struct vop_ioctl_args {
+	struct vnode	*a_vp;
+	u_long		a_command;
+	void		*a_data;
+	int		a_fflag;
+	struct ucred	*a_cred;
+	struct proc	*a_p;
+};
+
+struct vop_kqfilter_args {
+	struct vnode	*a_vp;
+	int		a_fflag;
+	struct knote	*a_kn;
+};
+
+struct vop_revoke_args {
+	struct vnode	*a_vp;
+	int		a_flags;
+};
+
+struct vop_fsync_args {
+	struct vnode	*a_vp;
+	struct ucred	*a_cred;
+	int		a_waitfor;
+	struct proc	*a_p;
+};
+
+struct vop_remove_args {
+	struct vnode		*a_dvp;
+	struct vnode		*a_vp;
+	struct componentname	*a_cnp;
+};
+
+struct vop_link_args {
+	struct vnode		*a_dvp;
+	struct vnode		*a_vp;
+	struct componentname	*a_cnp;
+};
+
+struct vop_rename_args {
+	struct vnode		*a_fdvp;
+	struct vnode		*a_fvp;
+	struct componentname	*a_fcnp;
+	struct vnode		*a_tdvp;
+	struct vnode		*a_tvp;
+	struct componentname	*a_tcnp;
+};
+
+struct vop_mkdir_args {
+	struct vnode		*a_dvp;
+	struct vnode		**a_vpp;
+	struct componentname	*a_cnp;
+	struct vattr		*a_vap;
+};
+
+struct vop_rmdir_args {
+	struct vnode		*a_dvp;
+	struct vnode		*a_vp;
+	struct componentname	*a_cnp;
+};
+
+struct vop_symlink_args {
+	struct vnode		*a_dvp;
+	struct vnode		**a_vpp;
+	struct componentname	*a_cnp;
+	struct vattr		*a_vap;
+	char			*a_target;
+};
+
+struct vop_readdir_args {
+	struct vnode	*a_vp;
+	struct uio	*a_uio;
+	struct ucred	*a_cred;
+	int		*a_eofflag;
+};
+
+struct vop_readlink_args {
+	struct vnode	*a_vp;
+	struct uio	*a_uio;
+	struct ucred	*a_cred;
+};
+
+struct vop_abortop_args {
+	struct vnode		*a_dvp;
+	struct componentname	*a_cnp;
+};
+
+struct vop_inactive_args {
+	struct vnode	*a_vp;
+	struct proc	*a_p;
+};
+
+struct vop_reclaim_args {
+	struct vnode	*a_vp;
+	struct proc	*a_p;
+};
+
+struct vop_lock_args {
+	struct vnode	*a_vp;
+	int		a_flags;
+};
+
+struct vop_unlock_args {
+	struct vnode	*a_vp;
+};
+
+struct vop_bmap_args {
+	struct vnode	*a_vp;
+	daddr_t		a_bn;
+	struct vnode	**a_vpp;
+	daddr_t		*a_bnp;
+	int		*a_runp;
+};
+
+struct vop_print_args {
+	struct vnode	*a_vp;
+};
+
+struct vop_pathconf_args {
+	struct vnode	*a_vp;
+	int		a_name;
+	register_t	*a_retval;
+};
+
+struct vop_advlock_args {
+	struct vnode	*a_vp;
+	void		*a_id;
+	int		a_op;
+	struct flock	*a_fl;
+	int		a_flags;
+};
+
+struct vop_strategy_args {
+	struct vnode	*a_vp;
+	struct buf	*a_bp;
+};
+
+struct vop_bwrite_args {
+	struct buf	*a_bp;
+};
+
+int VOP_ISLOCKED(struct vnode *);
+int VOP_LOOKUP(struct vnode *, struct vnode **, struct componentname *);
+int VOP_CREATE(struct vnode *, struct vnode **, struct componentname *,
+	    struct vattr *);
+int VOP_MKNOD(struct vnode *, struct vnode **, struct componentname *,
+	    struct vattr *);
+int VOP_OPEN(struct vnode *, int, struct ucred *, struct proc *);
+int VOP_CLOSE(struct vnode *, int, struct ucred *, struct proc *);
+int VOP_ACCESS(struct vnode *, int, struct ucred *, struct proc *);
+int VOP_GETATTR(struct vnode *, struct vattr *, struct ucred *,
+	    struct proc *);
+int VOP_SETATTR(struct vnode *, struct vattr *, struct ucred *,
+	    struct proc *);
+int VOP_READ(struct vnode *, struct uio *, int, struct ucred *);
+int VOP_WRITE(struct vnode *, struct uio *, int, struct ucred *);
+int VOP_IOCTL(struct vnode *, u_long, void *, int, struct ucred *,
+	    struct proc *);
+int VOP_FSYNC(struct vnode *, struct ucred *, int, struct proc *);
+int VOP_REMOVE(struct vnode *, struct vnode *, struct componentname *);
+int VOP_LINK(struct vnode *, struct vnode *, struct componentname *);
+int VOP_RENAME(struct vnode *, struct vnode *, struct componentname *,
+	    struct vnode *, struct vnode *, struct componentname *);
+int VOP_MKDIR(struct vnode *, struct vnode **, struct componentname *,
+	    struct vattr *);
+int VOP_RMDIR(struct vnode *, struct vnode *, struct componentname *);
+int VOP_SYMLINK(struct vnode *, struct vnode **, struct componentname *,
+	    struct vattr *, char *);
+int VOP_READDIR(struct vnode *, struct uio *, struct ucred *, int *);
+int VOP_READLINK(struct vnode *, struct uio *, struct ucred *);
+int VOP_ABORTOP(struct vnode *, struct componentname *);
+int VOP_INACTIVE(struct vnode *, struct proc *);
+int VOP_RECLAIM(struct vnode *, struct proc *);
+int VOP_LOCK(struct vnode *, int);
+int VOP_UNLOCK(struct vnode *);
+int VOP_BMAP(struct vnode *, daddr_t, struct vnode **, daddr_t *, int *);
+int VOP_PRINT(struct vnode *);
+int VOP_PATHCONF(struct vnode *, int, register_t *);
+int VOP_STRATEGY(struct vnode *, struct buf *);
+int VOP_BWRITE(struct buf *);
+
+int vop_generic_abortop(void *);
+int vop_generic_badop(void *);
+int vop_generic_bmap(void *);
+int vop_generic_bwrite(void *);
+int vop_generic_lookup(void *);
+int vop_generic_revoke(void *);
+
+int getnewvnode(enum vtagtype, struct mount *, const struct vops *,
+	    struct vnode **);
+int vget(struct vnode *, int);
+void vref(struct vnode *);
+int vrele(struct vnode *);
+void vput(struct vnode *);
+void vgone(struct vnode *);
+int vrecycle(struct vnode *, struct proc *);
+int vn_lock(struct vnode *, int);
+void vprint(const char *, struct vnode *);
+int vaccess(enum vtype, mode_t, uid_t, gid_t, mode_t, struct ucred *);
+int vn_fsizechk(struct vnode *, struct uio *, int, ssize_t *);
+int vinvalbuf(struct vnode *, int, struct ucred *, struct proc *, int,
+	    uint64_t);
+void vflushbuf(struct vnode *, int);
+void uvm_vnp_setsize(struct vnode *, off_t);
+void uvm_vnp_uncache(struct vnode *);
+
+extern int prtactive;
+extern int maxvnodes;
+
+/*
+ * <sys/namei.h>
+ */
+struct componentname {
+	u_long		cn_nameiop;
+	u_long		cn_flags;
+	struct proc	*cn_proc;
+	struct ucred	*cn_cred;
+	char		*cn_pnbuf;
+	char		*cn_nameptr;
+	long		cn_namelen;
+	long		cn_consume;
+};
+
+struct nameidata {
+	const char		*ni_dirp;
+	enum uio_seg		ni_segflg;
+	struct vnode		*ni_startdir;
+	struct vnode		*ni_rootdir;
+	struct vnode		*ni_vp;
+	struct vnode		*ni_dvp;
+	struct componentname	ni_cnd;
+};
+
+#define LOOKUP		0
+#define CREATE		1
+#define DELETE		2
+#define RENAME		3
+#define OPMASK		3
+
+#define LOCKLEAF	0x0004
+#define LOCKPARENT	0x0008
+#define WANTPARENT	0x0010
+#define NOCACHE		0x0020
+#define FOLLOW		0x0040
+#define NOFOLLOW	0x0000
+#define MODMASK		0x00fc
+
+#define NOCROSSMOUNT	0x000100
+#define RDONLY		0x000200
+#define HASBUF		0x000400
+#define SAVENAME	0x000800
+#define SAVESTART	0x001000
+#define ISDOTDOT	0x002000
+#define MAKEENTRY	0x004000
+#define ISLASTCN	0x008000
+#define ISSYMLINK	0x010000
+#define REQUIREDIR	0x080000
+#define STRIPSLASHES	0x100000
+#define PDIRUNLOCK	0x200000
+
+#define NDINIT(ndp, op, flags, segflg, namep, p) do {			\
+	memset((ndp), 0, sizeof(*(ndp)));				\
+	(ndp)->ni_cnd.cn_nameiop = (op);				\
+	(ndp)->ni_cnd.cn_flags = (flags);				\
+	(ndp)->ni_segflg = (segflg);					\
+	(ndp)->ni_dirp = (namep);					\
+	(ndp)->ni_cnd.cn_proc = (p);					\
+} while (0)
+
+int namei(struct nameidata *);
+extern struct pool namei_pool;
+
+int cache_lookup(struct vnode *, struct vnode **, struct componentname *);
+void cache_enter(struct vnode *, struct vnode *, struct componentname *);
+void cache_purge(struct vnode *);
+
+/*
+ * <sys/buf.h>
+ */
+struct buf {
+	LIST_ENTRY(buf)		b_hash;
+	TAILQ_ENTRY(buf)	b_vnbufs;	/* vp->v_bufs */
+	TAILQ_ENTRY(buf)	b_freelist;	/* LRU of idle buffers */
+	volatile long		b_flags;
+	int			b_error;
+	long			b_bufsize;
+	long			b_bcount;
+	size_t			b_resid;
+	dev_t			b_dev;
+	caddr_t			b_data;
+	daddr_t			b_lblkno;
+	daddr_t			b_blkno;
+	void			(*b_iodone)(struct buf *);
+	struct vnode		*b_vp;
+	struct proc		*b_proc;
+};
+
+#define B_AGE		0x00000001
+#define B_NEEDCOMMIT	0x00000002
+#define B_ASYNC		0x00000004
+#define B_BAD		0x00000008
+#define B_BUSY		0x00000010
+#define B_CACHE		0x00000020
+#define B_CALL		0x00000040
+#define B_DELWRI	0x00000080
+#define B_DONE		0x00000100
+#define B_EINTR		0x00000200
+#define B_ERROR		0x00000400
+#define B_INVAL		0x00000800
+#define B_NOCACHE	0x00001000
+#define B_PHYS		0x00002000
+#define B_RAW		0x00004000
+#define B_READ		0x00008000
+#define B_WANTED	0x00010000
+#define B_WRITEINPROG	0x00020000
+#define B_XXX		0x00040000
+#define B_DEFERRED	0x00080000
+#define B_SCANNED	0x00100000
+#define B_PDAEMON	0x00200000
+#define B_RELEASED	0x00400000
+#define B_WARM		0x00800000
+#define B_COLD		0x01000000
+#define B_BC		0x02000000
+#define B_DMA		0x04000000
+#define B_WRITE		0x00000000
+
+#define BUF_KERNPROC(bp)	((void)(bp))
+
+struct bcachestats {
+	int64_t numreads;		/* total reads started */
+	int64_t pendingreads;		/* reads in progress */
+};
+extern struct bcachestats bcstats;
+
+struct buf *incore(struct vnode *, daddr_t);
+struct buf *getblk(struct vnode *, daddr_t, int, int, uint64_t);
+int bread(struct vnode *, daddr_t, int, struct buf **);
+int bwrite(struct buf *);
+void bawrite(struct buf *);
+void bdwrite(struct buf *);
+void brelse(struct buf *);
+void biodone(struct buf *);
+int biowait(struct buf *);
+void clrbuf(struct buf *);
+
+/*
+ * <sys/disklabel.h>, <sys/dkio.h>, <sys/disk.h>, <sys/specdev.h>
+ */
+struct partition {
+	uint32_t	p_size;
+	uint32_t	p_offset;
+	uint16_t	p_offseth;
+	uint16_t	p_sizeh;
+	uint8_t		p_fstype;
+	uint8_t		p_fragblock;
+	uint16_t	p_cpg;
+};
+
+struct disklabel {
+	uint32_t	d_magic;
+	uint32_t	d_secsize;
+	uint64_t	d_secperunit;
+	uint16_t	d_npartitions;
+	struct partition d_partitions[16];
+};
+
+#define DIOCGDINFO	_IOR('d', 101, struct disklabel)
+#define DIOCCACHESYNC	_IOW('d', 120, int)
+
+#define DM_OPENPART	0x1
+#define DM_OPENBLCK	0x2
+
+int disk_map(const char *, char *, int, int);
+
+extern int nblkdev;
+extern const struct vops spec_vops;
+
+struct vnode *checkalias(struct vnode *, dev_t, struct mount *);
+int spec_open(void *);
+int spec_close(void *);
+int spec_read(void *);
+int spec_write(void *);
+int spec_ioctl(void *);
+int spec_kqfilter(void *);
+int spec_strategy(void *);
+int spec_pathconf(void *);
+int spec_advlock(void *);
+
+/*
+ * hammer2k internals shared by hammer2k_kern.c, hammer2k_vfs.c and
+ * libhammer2k.c.
+ */
+extern struct vfsconf hammer2k_vfsconf;
+extern long hammer2k_bufspace_limit;
+
+/* Device I/O done by hammer2k_dev_strategy(), protected by Giant. */
+struct hammer2k_devstat {
+	uint64_t	reads;
+	uint64_t	read_bytes;
+	uint64_t	writes;
+	uint64_t	write_bytes;
+};
+extern struct hammer2k_devstat hammer2k_devstat;
+
+void hammer2k_kern_init(void);
+void hammer2k_update_ticks(void);
+void hammer2k_vfs_init(void);
+void hammer2k_proc_enter(void);
+void hammer2k_bufdaemon(void);
+
+#endif /* !_HAMMER2K_KERN_H_ */
@@ -0,0 +1,1543 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VFS services for hammer2k: vnode life cycle, the buffer cache, device
+ * vnodes backed by image files, and the VOP_* entry points.
+ *
+ * Vnodes follow the OpenBSD rules.  Unreferenced vnodes are kept on a free
+ * list and recycled once maxvnodes are in use, VOP_INACTIVE runs when the
+ * last reference goes away and VOP_RECLAIM when the vnode is recycled.
+ *
+ * Buffers are hashed by vnode and logical block number.  Idle buffers are
+ * kept on an LRU queue, clean ones are freed and dirty device buffers are
+ * written out when the cache grows beyond hammer2k_bufspace_limit.  Dirty
+ * file buffers are written by hammer2k_bufdaemon(), which the library
+ * runs between operations so that their VOP_STRATEGY never happens with
+ * filesystem locks held by the caller.
+ */
+
+#include <pthread.h>
+
+#include "hammer2k_kern.h"
+
+#define BUFHASH_SIZE		65536
+#define BUFHASH(vp, lblkno)	\
+	(&bufhashtbl[(((uintptr_t)(vp) >> 6) + (uintptr_t)(lblkno)) & \
+	    (BUFHASH_SIZE - 1)])
+
+int maxvnodes = 8192;
+int prtactive = 0;
+int nblkdev = 1;
+long bufhighpages;
+long hammer2k_bufspace_limit = 256L * 1024 * 1024;
+struct hammer2k_devstat hammer2k_devstat;
+struct bcachestats bcstats;
+
+static int numvnodes;
+static dev_t nextdev;
+static TAILQ_HEAD(, vnode) vnode_free_list =
+    TAILQ_HEAD_INITIALIZER(vnode_free_list);
+
+extern const struct vfsops hammer2_vfsops;
+
+struct vfsconf hammer2k_vfsconf = {
+	.vfc_vfsops	= &hammer2_vfsops,
+	.vfc_name	= "hammer2",
+	.vfc_typenum	= 1,
+};
+
+static LIST_HEAD(, buf) bufhashtbl[BUFHASH_SIZE];
+static TAILQ_HEAD(, buf) bufqueue = TAILQ_HEAD_INITIALIZER(bufqueue);
+static long bufspace;		/* bytes of buffer data */
+static long bufdirtyspace;	/* bytes of B_DELWRI file buffers */
+
+static const struct vops dead_vops;
+static const struct vops hammer2k_devvops;
+
+static void vgonel(struct vnode *);
+static void buf_free(struct buf *);
+
+void
+hammer2k_vfs_init(void)
+{
+	int i;
+
+	for (i = 0; i < BUFHASH_SIZE; i++)
+		LIST_INIT(&bufhashtbl[i]);
+	bufhighpages = hammer2k_bufspace_limit / PAGE_SIZE;
+}
+
+/*
+ * Vnodes.
+ */
+static void
+vputonfreelist(struct vnode *vp)
+{
+	KASSERT(vp->v_usecount == 0);
+	KASSERT(vp->v_onfree == 0);
+	if (vp->v_type == VBAD)
+		TAILQ_INSERT_HEAD(&vnode_free_list, vp, v_freelist);
+	else
+		TAILQ_INSERT_TAIL(&vnode_free_list, vp, v_freelist);
+	vp->v_onfree = 1;
+}
+
+static void
+vremfree(struct vnode *vp)
+{
+	KASSERT(vp->v_onfree);
+	TAILQ_REMOVE(&vnode_free_list, vp, v_freelist);
+	vp->v_onfree = 0;
+}
+
+static void
+insmntque(struct vnode *vp, struct mount *mp)
+{
+	if (vp->v_mount != NULL)
+		TAILQ_REMOVE(&vp->v_mount->mnt_vnodelist, vp, v_mntvnodes);
+	vp->v_mount = mp;
+	if (mp != NULL)
+		TAILQ_INSERT_TAIL(&mp->mnt_vnodelist, vp, v_mntvnodes);
+}
+
+int
+getnewvnode(enum vtagtype tag, struct mount *mp, const struct vops *vops,
+    struct vnode **vpp)
+{
+	struct vnode *vp = NULL;
+
+	/*
+	 * Recycle the oldest free vnode once the limit has been reached,
+	 * skipping those whose dirty buffers the reclaim would have to
+	 * write out (or wait for) from under the caller's locks.
+	 */
+	if (numvnodes >= maxvnodes) {
+		TAILQ_FOREACH(vp, &vnode_free_list, v_freelist)
+			if (vp->v_ndirty == 0 && vp->v_numoutput == 0)
+				break;
+	}
+	if (vp == NULL) {
+		vp = hammer2k_malloc(sizeof(*vp), M_TEMP, M_WAITOK | M_ZERO);
+		TAILQ_INIT(&vp->v_bufs);
+		vp->v_fd = -1;
+		numvnodes++;
+	} else {
+		vremfree(vp);
+		if (vp->v_type != VBAD)
+			vgonel(vp);
+		KASSERT(vp->v_usecount == 0);
+		KASSERT(TAILQ_EMPTY(&vp->v_bufs));
+		KASSERT(vp->v_data == NULL);
+		insmntque(vp, NULL);
+		vp->v_flag = 0;
+		vp->v_rdev = 0;
+		vp->v_specmountpoint = NULL;
+		memset(&vp->v_klist, 0, sizeof(vp->v_klist));
+	}
+	vp->v_op = vops;
+	vp->v_type = VNON;
+	vp->v_tag = tag;
+	vp->v_usecount = 1;
+	insmntque(vp, mp);
+	*vpp = vp;
+
+	return (0);
+}
+
+int
+vget(struct vnode *vp, int flags)
+{
+	int error = 0;
+
+	if (vp->v_flag & VXLOCK) {
+		if (flags & LK_NOWAIT)
+			return (EBUSY);
+		vp->v_flag |= VXWANT;
+		tsleep(vp, PINOD, "vget", 0);
+		return (ENOENT);
+	}
+
+	if (vp->v_usecount == 0 && vp->v_onfree)
+		vremfree(vp);
+	vp->v_usecount++;
+	if (flags & LK_TYPE_MASK) {
+		if ((error = vn_lock(vp, flags)) != 0) {
+			vp->v_usecount--;
+			if (vp->v_usecount == 0)
+				vputonfreelist(vp);
+		}
+	}
+
+	return (error);
+}
+
+void
+vref(struct vnode *vp)
+{
+	if (vp->v_usecount == 0 && vp->v_onfree)
+		vremfree(vp);
+	vp->v_usecount++;
+}
+
+void
+vput(struct vnode *vp)
+{
+	if (vp->v_usecount == 0)
+		panic("vput: bad ref count");
+	vp->v_usecount--;
+	if (vp->v_usecount > 0) {
+		VOP_UNLOCK(vp);
+		return;
+	}
+
+	VOP_INACTIVE(vp, curproc);
+	if (vp->v_usecount == 0 && vp->v_onfree == 0)
+		vputonfreelist(vp);
+}
+
+int
+vrele(struct vnode *vp)
+{
+	if (vp->v_usecount == 0)
+		panic("vrele: bad ref count");
+	vp->v_usecount--;
+	if (vp->v_usecount > 0)
+		return (0);
+
+	if (vn_lock(vp, LK_EXCLUSIVE)) {
+		vprint("vrele: cannot lock", vp);
+		return (1);
+	}
+	VOP_INACTIVE(vp, curproc);
+	if (vp->v_usecount == 0 && vp->v_onfree == 0)
+		vputonfreelist(vp);
+
+	return (1);
+}
+
+int
+vn_lock(struct vnode *vp, int flags)
+{
+	int error;
+
+	do {
+		if (vp->v_flag & VXLOCK) {
+			vp->v_flag |= VXWANT;
+			tsleep(vp, PINOD, "vn_lock", 0);
+			error = ENOENT;
+		} else {
+			error = VOP_LOCK(vp, flags);
+			if (error == 0)
+				return (0);
+		}
+	} while (flags & LK_RETRY);
+
+	return (error);
+}
+
+/*
+ * Disassociate the underlying filesystem from a vnode.
+ */
+static void
+vclean(struct vnode *vp)
+{
+	int active;
+
+	if ((active = vp->v_usecount) != 0)
+		vp->v_usecount++;
+
+	vp->v_flag |= VXLOCK;
+	VOP_LOCK(vp, LK_EXCLUSIVE | LK_DRAIN);
+	vinvalbuf(vp, V_SAVE, NOCRED, curproc, 0, INFSLP);
+	if (active)
+		VOP_INACTIVE(vp, curproc);
+	else
+		VOP_UNLOCK(vp);
+
+	if (VOP_RECLAIM(vp, curproc))
+		panic("vclean: cannot reclaim");
+	if (active) {
+		vp->v_usecount--;
+		if (vp->v_usecount == 0 && vp->v_onfree == 0)
+			vputonfreelist(vp);
+	}
+	cache_purge(vp);
+
+	vp->v_op = &dead_vops;
+	VN_KNOTE(vp, NOTE_REVOKE);
+	vp->v_tag = VT_NON;
+	vp->v_flag &= ~VXLOCK;
+	if (vp->v_flag & VXWANT) {
+		vp->v_flag &= ~VXWANT;
+		wakeup(vp);
+	}
+}
+
+static void
+vgonel(struct vnode *vp)
+{
+	if (vp->v_flag & VXLOCK) {
+		vp->v_flag |= VXWANT;
+		tsleep(vp, PINOD, "vgone", 0);
+		return;
+	}
+
+	vclean(vp);
+	insmntque(vp, NULL);
+	vp->v_type = VBAD;
+
+	/* Move onto the head of the free list if necessary. */
+	if (vp->v_usecount == 0 && vp->v_onfree) {
+		vremfree(vp);
+		vputonfreelist(vp);
+	}
+}
+
+void
+vgone(struct vnode *vp)
+{
+	vgonel(vp);
+}
+
+int
+vrecycle(struct vnode *vp, struct proc *p)
+{
+	if (vp->v_usecount == 0) {
+		vgonel(vp);
+		return (1);
+	}
+
+	return (0);
+}
+
+int
+vflush(struct mount *mp, struct vnode *skipvp, int flags)
+{
+	struct vnode *vp, *nvp;
+	int busy = 0;
+
+	TAILQ_FOREACH_SAFE(vp, &mp->mnt_vnodelist, v_mntvnodes, nvp) {
+		if (vp == skipvp)
+			continue;
+		if ((flags & SKIPSYSTEM) && (vp->v_flag & VSYSTEM))
+			continue;
+		if (vp->v_usecount == 0 || (flags & FORCECLOSE)) {
+			vgonel(vp);
+			continue;
+		}
+		if (prtactive)
+			vprint("vflush: busy vnode", vp);
+		busy++;
+	}
+	if (busy)
+		return (EBUSY);
+
+	return (0);
+}
+
+int
+vfs_mount_foreach_vnode(struct mount *mp,
+    int (*func)(struct vnode *, void *), void *arg)
+{
+	struct vnode *vp, *nvp;
+	int error = 0;
+
+loop:
+	TAILQ_FOREACH_SAFE(vp, &mp->mnt_vnodelist, v_mntvnodes, nvp) {
+		if (vp->v_mount != mp)
+			goto loop;
+		error = func(vp, arg);
+		if (error != 0)
+			break;
+	}
+
+	return (error);
+}
+
+void
+vprint(const char *label, struct vnode *vp)
+{
+	if (label != NULL)
+		printf("%s: ", label);
+	printf("%p, type %d, use %u, flags 0x%x, ndirty %d\n", vp,
+	    vp->v_type, vp->v_usecount, vp->v_flag, vp->v_ndirty);
+	VOP_PRINT(vp);
+}
+
+void
+vattr_null(struct vattr *vap)
+{
+	memset(vap, 0, sizeof(*vap));
+	vap->va_type = VNON;
+	vap->va_mode = VNOVAL;
+	vap->va_nlink = VNOVAL;
+	vap->va_uid = VNOVAL;
+	vap->va_gid = VNOVAL;
+	vap->va_fsid = VNOVAL;
+	vap->va_fileid = VNOVAL;
+	vap->va_size = VNOVAL;
+	vap->va_blocksize = VNOVAL;
+	vap->va_atime.tv_sec = VNOVAL;
+	vap->va_atime.tv_nsec = VNOVAL;
+	vap->va_mtime.tv_sec = VNOVAL;
+	vap->va_mtime.tv_nsec = VNOVAL;
+	vap->va_ctime.tv_sec = VNOVAL;
+	vap->va_ctime.tv_nsec = VNOVAL;
+	vap->va_gen = VNOVAL;
+	vap->va_flags = VNOVAL;
+	vap->va_rdev = VNOVAL;
+	vap->va_bytes = VNOVAL;
+}
+
+/*
+ * Buffers.
+ */
+struct buf *
+incore(struct vnode *vp, daddr_t lblkno)
+{
+	struct buf *bp;
+
+	LIST_FOREACH(bp, BUFHASH(vp, lblkno), b_hash)
+		if (bp->b_vp == vp && bp->b_lblkno == lblkno &&
+		    (bp->b_flags & B_INVAL) == 0)
+			return (bp);
+
+	return (NULL);
+}
+
+static void
+buf_undirty(struct buf *bp)
+{
+	if (bp->b_flags & B_DELWRI) {
+		bp->b_flags &= ~B_DELWRI;
+		bp->b_vp->v_ndirty--;
+		if (bp->b_vp->v_type != VBLK)
+			bufdirtyspace -= bp->b_bufsize;
+	}
+}
+
+static void
+buf_free(struct buf *bp)
+{
+	buf_undirty(bp);
+	LIST_REMOVE(bp, b_hash);
+	TAILQ_REMOVE(&bp->b_vp->v_bufs, bp, b_vnbufs);
+	bufspace -= bp->b_bufsize;
+	if (bp->b_flags & B_WANTED)
+		wakeup(bp);
+	hammer2k_free(bp->b_data, M_TEMP, bp->b_bufsize);
+	hammer2k_free(bp, M_TEMP, sizeof(*bp));
+}
+
+static void
+buf_acquire(struct buf *bp)
+{
+	KASSERT((bp->b_flags & B_BUSY) == 0);
+	TAILQ_REMOVE(&bufqueue, bp, b_freelist);
+	bp->b_flags |= B_BUSY;
+}
+
+/*
+ * Make room for another buffer.  Clean buffers are freed in LRU order,
+ * dirty device buffers are written out first.  Dirty file buffers are
+ * left to hammer2k_bufdaemon().
+ */
+static void
+buf_reclaim(long size)
+{
+	struct buf *bp;
+
+	while (bufspace + size > hammer2k_bufspace_limit) {
+		TAILQ_FOREACH(bp, &bufqueue, b_freelist) {
+			if ((bp->b_flags & B_DELWRI) == 0 ||
+			    bp->b_vp->v_type == VBLK)
+				break;
+		}
+		if (bp == NULL)
+			break;
+		buf_acquire(bp);
+		if (bp->b_flags & B_DELWRI) {
+			bawrite(bp);
+			continue;
+		}
+		buf_free(bp);
+	}
+}
+
+struct buf *
+getblk(struct vnode *vp, daddr_t blkno, int size, int slpflag,
+    uint64_t slptimeo)
+{
+	struct buf *bp;
+	caddr_t data;
+
+loop:
+	bp = incore(vp, blkno);
+	if (bp != NULL) {
+		if (bp->b_flags & B_BUSY) {
+			bp->b_flags |= B_WANTED;
+			tsleep(bp, PRIBIO, "getblk", 0);
+			goto loop;
+		}
+		buf_acquire(bp);
+		bp->b_flags |= B_CACHE;
+		if (bp->b_bufsize != size) {
+			data = hammer2k_malloc(size, M_TEMP, M_WAITOK | M_ZERO);
+			memcpy(data, bp->b_data, MIN(size, bp->b_bufsize));
+			hammer2k_free(bp->b_data, M_TEMP, bp->b_bufsize);
+			bufspace += size - bp->b_bufsize;
+			if ((bp->b_flags & B_DELWRI) && vp->v_type != VBLK)
+				bufdirtyspace += size - bp->b_bufsize;
+			bp->b_data = data;
+			bp->b_bufsize = size;
+		}
+		bp->b_bcount = size;
+		return (bp);
+	}
+
+	buf_reclaim(size);
+	if (incore(vp, blkno) != NULL)
+		goto loop;	/* raced while writing out a buffer */
+
+	bp = hammer2k_malloc(sizeof(*bp), M_TEMP, M_WAITOK | M_ZERO);
+	bp->b_data = hammer2k_malloc(size, M_TEMP, M_WAITOK);
+	bp->b_bufsize = size;
+	bp->b_bcount = size;
+	bp->b_flags = B_BUSY;
+	bp->b_vp = vp;
+	bp->b_dev = vp->v_rdev;
+	bp->b_lblkno = blkno;
+	bp->b_blkno = blkno;
+	LIST_INSERT_HEAD(BUFHASH(vp, blkno), bp, b_hash);
+	TAILQ_INSERT_TAIL(&vp->v_bufs, bp, b_vnbufs);
+	bufspace += size;
+
+	return (bp);
+}
+
+int
+bread(struct vnode *vp, daddr_t blkno, int size, struct buf **bpp)
+{
+	struct buf *bp;
+	int error;
+
+	bp = *bpp = getblk(vp, blkno, size, 0, INFSLP);
+	if (bp->b_flags & (B_DONE | B_DELWRI))
+		return (0);
+
+	bp->b_flags |= B_READ;
+	bp->b_flags &= ~(B_DONE | B_ERROR | B_INVAL);
+	bp->b_error = 0;
+	bp->b_resid = bp->b_bcount;
+	bcstats.pendingreads++;
+	bcstats.numreads++;
+	VOP_STRATEGY(vp, bp);
+	error = biowait(bp);
+	bp->b_flags &= ~B_READ;
+
+	return (error);
+}
+
+int
+bwrite(struct buf *bp)
+{
+	int async, error;
+
+	KASSERT(bp->b_flags & B_BUSY);
+	async = bp->b_flags & B_ASYNC;
+	buf_undirty(bp);
+	bp->b_flags &= ~(B_READ | B_DONE | B_ERROR);
+	bp->b_error = 0;
+	bp->b_resid = bp->b_bcount;
+	bp->b_vp->v_numoutput++;
+	VOP_STRATEGY(bp->b_vp, bp);
+	if (async)
+		return (0);
+
+	error = biowait(bp);
+	brelse(bp);
+
+	return (error);
+}
+
+void
+bawrite(struct buf *bp)
+{
+	bp->b_flags |= B_ASYNC;
+	VOP_BWRITE(bp);
+}
+
+void
+bdwrite(struct buf *bp)
+{
+	KASSERT(bp->b_flags & B_BUSY);
+	if ((bp->b_flags & B_DELWRI) == 0) {
+		bp->b_flags |= B_DELWRI;
+		bp->b_vp->v_ndirty++;
+		if (bp->b_vp->v_type != VBLK)
+			bufdirtyspace += bp->b_bufsize;
+	}
+	bp->b_flags |= B_DONE;
+	brelse(bp);
+}
+
+void
+brelse(struct buf *bp)
+{
+	KASSERT(bp->b_flags & B_BUSY);
+	if (bp->b_flags & B_ERROR)
+		bp->b_flags |= B_INVAL;
+	if ((bp->b_flags & B_INVAL) ||
+	    (bp->b_flags & (B_DONE | B_DELWRI)) == 0 ||
+	    (bp->b_flags & (B_NOCACHE | B_DELWRI)) == B_NOCACHE) {
+		buf_free(bp);
+		return;
+	}
+
+	TAILQ_INSERT_TAIL(&bufqueue, bp, b_freelist);
+	bp->b_flags &= ~(B_BUSY | B_ASYNC | B_NOCACHE | B_CACHE | B_AGE);
+	if (bp->b_flags & B_WANTED) {
+		bp->b_flags &= ~B_WANTED;
+		wakeup(bp);
+	}
+}
+
+void
+biodone(struct buf *bp)
+{
+	if (bp->b_flags & B_DONE)
+		panic("biodone already");
+	bp->b_flags |= B_DONE;
+	if (bp->b_flags & B_READ)
+		bcstats.pendingreads--;
+	else if (--bp->b_vp->v_numoutput == 0)
+		wakeup(&bp->b_vp->v_numoutput);
+
+	if (bp->b_flags & B_CALL) {
+		bp->b_flags &= ~B_CALL;
+		(*bp->b_iodone)(bp);
+	} else if (bp->b_flags & B_ASYNC) {
+		brelse(bp);
+	} else {
+		wakeup(bp);
+	}
+}
+
+int
+biowait(struct buf *bp)
+{
+	while ((bp->b_flags & B_DONE) == 0)
+		tsleep(bp, PRIBIO, "biowait", 0);
+
+	if (bp->b_flags & B_ERROR)
+		return (bp->b_error ? bp->b_error : EIO);
+
+	return (0);
+}
+
+void
+clrbuf(struct buf *bp)
+{
+	memset(bp->b_data, 0, bp->b_bcount);
+	bp->b_resid = 0;
+}
+
+/*
+ * Write out the dirty buffers of vp.  If sync is set, wait for all of
+ * them including writes already in progress, since the strategy of a
+ * logical buffer may still have to modify chains.
+ */
+void
+vflushbuf(struct vnode *vp, int sync)
+{
+	struct buf *bp;
+
+loop:
+	TAILQ_FOREACH(bp, &vp->v_bufs, b_vnbufs) {
+		if ((bp->b_flags & B_DELWRI) == 0)
+			continue;
+		if (bp->b_flags & B_BUSY) {
+			if (sync == 0)
+				continue;
+			bp->b_flags |= B_WANTED;
+			tsleep(bp, PRIBIO, "vflushbuf", 0);
+			goto loop;
+		}
+		buf_acquire(bp);
+		if (sync)
+			bwrite(bp);
+		else
+			bawrite(bp);
+		goto loop;
+	}
+	if (sync == 0)
+		return;
+	while (vp->v_numoutput > 0)
+		tsleep(&vp->v_numoutput, PRIBIO, "vflushbuf", 0);
+	if (vp->v_ndirty > 0)
+		goto loop;
+}
+
+int
+vinvalbuf(struct vnode *vp, int flags, struct ucred *cred, struct proc *p,
+    int slpflag, uint64_t slptimeo)
+{
+	struct buf *bp;
+
+	if (flags & V_SAVE)
+		vflushbuf(vp, 1);
+loop:
+	TAILQ_FOREACH(bp, &vp->v_bufs, b_vnbufs) {
+		if (bp->b_flags & B_BUSY) {
+			bp->b_flags |= B_WANTED;
+			tsleep(bp, PRIBIO, "vinvalbuf", 0);
+			goto loop;
+		}
+		buf_acquire(bp);
+		bp->b_flags |= B_INVAL;
+		brelse(bp);
+		goto loop;
+	}
+
+	return (0);
+}
+
+/*
+ * The buffer daemon.  Writes out the oldest dirty file buffers once they
+ * take up more than half of the buffer cache.
+ */
+void
+hammer2k_bufdaemon(void)
+{
+	struct buf *bp;
+
+	while (bufdirtyspace > hammer2k_bufspace_limit / 2) {
+		TAILQ_FOREACH(bp, &bufqueue, b_freelist)
+			if ((bp->b_flags & B_DELWRI) &&
+			    bp->b_vp->v_type != VBLK)
+				break;
+		if (bp == NULL)
+			break;
+		buf_acquire(bp);
+		bawrite(bp);
+	}
+}
+
+/*
+ * Device vnodes.  namei(9) only ever looks up the devices to mount, so
+ * it is implemented as a lookup of an image file (or block device) in
+ * the host filesystem.
+ */
+int
+namei(struct nameidata *ndp)
+{
+	struct vnode *vp;
+	struct stat st;
+
+	if (stat(ndp->ni_dirp, &st) == -1)
+		return (errno);
+	if (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+		return (ENOTBLK);
+
+	getnewvnode(VT_NON, NULL, &hammer2k_devvops, &vp);
+	vp->v_type = VBLK;
+	vp->v_rdev = makedev(0, nextdev++);
+	vp->v_devpath = strdup(ndp->ni_dirp);
+	if (vp->v_devpath == NULL)
+		panic("namei: out of memory");
+	ndp->ni_vp = vp;
+
+	return (0);
+}
+
+static int
+hammer2k_dev_open(void *v)
+{
+	struct vop_open_args *ap = v;
+	struct vnode *vp = ap->a_vp;
+	int fd;
+
+	if (vp->v_devopen++ > 0)
+		return (0);
+
+	fd = open(vp->v_devpath, (ap->a_mode & FWRITE) ? O_RDWR : O_RDONLY);
+	if (fd == -1) {
+		vp->v_devopen--;
+		return (errno);
+	}
+	vp->v_fd = fd;
+
+	return (0);
+}
+
+static int
+hammer2k_dev_close(void *v)
+{
+	struct vop_close_args *ap = v;
+	struct vnode *vp = ap->a_vp;
+
+	KASSERT(vp->v_devopen > 0);
+	if (--vp->v_devopen > 0)
+		return (0);
+
+	/* Like spec_close(), flush and invalidate on last close. */
+	vinvalbuf(vp, V_SAVE, ap->a_cred, ap->a_p, 0, INFSLP);
+	close(vp->v_fd);
+	vp->v_fd = -1;
+
+	return (0);
+}
+
+static int
+hammer2k_dev_ioctl(void *v)
+{
+	struct vop_ioctl_args *ap = v;
+	struct vnode *vp = ap->a_vp;
+	struct disklabel *dl;
+	off_t size;
+	int depth, error = 0;
+
+	if (vp->v_fd == -1)
+		return (ENXIO);
+
+	switch (ap->a_command) {
+	case DIOCGDINFO:
+		size = lseek(vp->v_fd, 0, SEEK_END);
+		if (size == -1)
+			return (errno);
+		dl = ap->a_data;
+		memset(dl, 0, sizeof(*dl));
+		dl->d_secsize = DEV_BSIZE;
+		dl->d_secperunit = size / DEV_BSIZE;
+		break;
+	case DIOCCACHESYNC:
+		depth = hammer2k_giant_drop();
+		if (fsync(vp->v_fd) == -1)
+			error = errno;
+		hammer2k_giant_pickup(depth);
+		break;
+	default:
+		error = ENOTTY;
+		break;
+	}
+
+	return (error);
+}
+
+static int
+hammer2k_dev_fsync(void *v)
+{
+	struct vop_fsync_args *ap = v;
+
+	vflushbuf(ap->a_vp, ap->a_waitfor == MNT_WAIT);
+
+	return (0);
+}
+
+static int
+hammer2k_dev_strategy(void *v)
+{
+	struct vop_strategy_args *ap = v;
+	struct buf *bp = ap->a_bp;
+	struct vnode *vp = ap->a_vp;
+	off_t off = (off_t)bp->b_blkno * DEV_BSIZE;
+	ssize_t n;
+	int depth, error = 0;
+
+	/* The buffer is B_BUSY, nobody else touches it while unlocked. */
+	depth = hammer2k_giant_drop();
+	if (bp->b_flags & B_READ) {
+		n = pread(vp->v_fd, bp->b_data, bp->b_bcount, off);
+		if (n == -1) {
+			error = errno;
+		} else {
+			/* Reading beyond EOF is not an error, see bread(9). */
+			if (n < bp->b_bcount)
+				memset(bp->b_data + n, 0, bp->b_bcount - n);
+			bp->b_resid = 0;
+		}
+	} else {
+		n = pwrite(vp->v_fd, bp->b_data, bp->b_bcount, off);
+		if (n == -1)
+			error = errno;
+		else if (n < bp->b_bcount)
+			error = EIO;
+		else
+			bp->b_resid = 0;
+	}
+	hammer2k_giant_pickup(depth);
+
+	if (error) {
+		bp->b_error = error;
+		bp->b_flags |= B_ERROR;
+	} else if (bp->b_flags & B_READ) {
+		hammer2k_devstat.reads++;
+		hammer2k_devstat.read_bytes += bp->b_bcount;
+	} else {
+		hammer2k_devstat.writes++;
+		hammer2k_devstat.write_bytes += bp->b_bcount;
+	}
+	biodone(bp);
+
+	return (0);
+}
+
+static int
+hammer2k_dev_nullop(void *v)
+{
+	return (0);
+}
+
+static int
+hammer2k_dev_inactive(void *v)
+{
+	struct vop_inactive_args *ap = v;
+
+	VOP_UNLOCK(ap->a_vp);
+
+	return (0);
+}
+
+static int
+hammer2k_dev_reclaim(void *v)
+{
+	struct vop_reclaim_args *ap = v;
+	struct vnode *vp = ap->a_vp;
+
+	if (vp->v_fd != -1) {
+		close(vp->v_fd);
+		vp->v_fd = -1;
+	}
+	free(vp->v_devpath, M_TEMP, 0);
+	vp->v_devpath = NULL;
+	vp->v_devopen = 0;
+
+	return (0);
+}
+
+static int
+hammer2k_dev_print(void *v)
+{
+	struct vop_print_args *ap = v;
+
+	printf("\tdevice %s, fd %d\n", ap->a_vp->v_devpath, ap->a_vp->v_fd);
+
+	return (0);
+}
+
+static const struct vops hammer2k_devvops = {
+	.vop_open	= hammer2k_dev_open,
+	.vop_close	= hammer2k_dev_close,
+	.vop_ioctl	= hammer2k_dev_ioctl,
+	.vop_fsync	= hammer2k_dev_fsync,
+	.vop_strategy	= hammer2k_dev_strategy,
+	.vop_bwrite	= vop_generic_bwrite,
+	.vop_bmap	= vop_generic_bmap,
+	.vop_lock	= hammer2k_dev_nullop,
+	.vop_unlock	= hammer2k_dev_nullop,
+	.vop_islocked	= hammer2k_dev_nullop,
+	.vop_inactive	= hammer2k_dev_inactive,
+	.vop_reclaim	= hammer2k_dev_reclaim,
+	.vop_print	= hammer2k_dev_print,
+};
+
+/*
+ * Reclaimed vnodes.
+ */
+static int
+dead_badop(void *v)
+{
+	return (EBADF);
+}
+
+static const struct vops dead_vops = {
+	.vop_lookup	= dead_badop,
+	.vop_create	= dead_badop,
+	.vop_mknod	= dead_badop,
+	.vop_open	= dead_badop,
+	.vop_close	= hammer2k_dev_nullop,
+	.vop_access	= dead_badop,
+	.vop_getattr	= dead_badop,
+	.vop_setattr	= dead_badop,
+	.vop_read	= dead_badop,
+	.vop_write	= dead_badop,
+	.vop_ioctl	= dead_badop,
+	.vop_fsync	= hammer2k_dev_nullop,
+	.vop_remove	= dead_badop,
+	.vop_link	= dead_badop,
+	.vop_rename	= dead_badop,
+	.vop_mkdir	= dead_badop,
+	.vop_rmdir	= dead_badop,
+	.vop_symlink	= dead_badop,
+	.vop_readdir	= dead_badop,
+	.vop_readlink	= dead_badop,
+	.vop_abortop	= vop_generic_abortop,
+	.vop_inactive	= hammer2k_dev_inactive,
+	.vop_reclaim	= hammer2k_dev_nullop,
+	.vop_lock	= hammer2k_dev_nullop,
+	.vop_unlock	= hammer2k_dev_nullop,
+	.vop_islocked	= hammer2k_dev_nullop,
+	.vop_bmap	= dead_badop,
+	.vop_strategy	= dead_badop,
+	.vop_print	= hammer2k_dev_nullop,
+	.vop_bwrite	= vop_generic_bwrite,
+};
+
+/*
+ * Special files within hammer2 have no driver behind them.
+ */
+const struct vops spec_vops = {
+	.vop_lock	= hammer2k_dev_nullop,
+	.vop_unlock	= hammer2k_dev_nullop,
+	.vop_islocked	= hammer2k_dev_nullop,
+	.vop_inactive	= hammer2k_dev_inactive,
+	.vop_reclaim	= hammer2k_dev_nullop,
+	.vop_print	= hammer2k_dev_nullop,
+};
+
+int
+spec_open(void *v)
+{
+	return (ENXIO);
+}
+
+int
+spec_close(void *v)
+{
+	return (0);
+}
+
+int
+spec_read(void *v)
+{
+	return (ENXIO);
+}
+
+int
+spec_write(void *v)
+{
+	return (ENXIO);
+}
+
+int
+spec_ioctl(void *v)
+{
+	return (ENOTTY);
+}
+
+int
+spec_kqfilter(void *v)
+{
+	return (EOPNOTSUPP);
+}
+
+int
+spec_strategy(void *v)
+{
+	struct vop_strategy_args *ap = v;
+
+	ap->a_bp->b_error = ENXIO;
+	ap->a_bp->b_flags |= B_ERROR;
+	biodone(ap->a_bp);
+
+	return (0);
+}
+
+int
+spec_pathconf(void *v)
+{
+	return (EINVAL);
+}
+
+int
+spec_advlock(void *v)
+{
+	return (EOPNOTSUPP);
+}
+
+struct vnode *
+checkalias(struct vnode *nvp, dev_t nvp_rdev, struct mount *mp)
+{
+	nvp->v_rdev = nvp_rdev;
+
+	return (NULL);
+}
+
+int
+disk_map(const char *path, char *mappath, int size, int flags)
+{
+	return (-1);	/* no DUIDs */
+}
+
+/*
+ * Generic vnode operations.
+ */
+int
+vop_generic_abortop(void *v)
+{
+	struct vop_abortop_args *ap = v;
+
+	if ((ap->a_cnp->cn_flags & (HASBUF | SAVESTART)) == HASBUF)
+		pool_put(&namei_pool, ap->a_cnp->cn_pnbuf);
+
+	return (0);
+}
+
+int
+vop_generic_badop(void *v)
+{
+	panic("vop_generic_badop");
+}
+
+int
+vop_generic_bmap(void *v)
+{
+	struct vop_bmap_args *ap = v;
+
+	if (ap->a_vpp)
+		*ap->a_vpp = ap->a_vp;
+	if (ap->a_bnp)
+		*ap->a_bnp = ap->a_bn;
+	if (ap->a_runp)
+		*ap->a_runp = 0;
+
+	return (0);
+}
+
+int
+vop_generic_bwrite(void *v)
+{
+	struct vop_bwrite_args *ap = v;
+
+	return (bwrite(ap->a_bp));
+}
+
+int
+vop_generic_lookup(void *v)
+{
+	return (ENOTDIR);
+}
+
+int
+vop_generic_revoke(void *v)
+{
+	struct vop_revoke_args *ap = v;
+
+	vgone(ap->a_vp);
+
+	return (0);
+}
+
+/*
+ * Name cache, UVM and kqueue hooks.  There is no name cache or page
+ * cache, every lookup goes to the filesystem.
+ */
+int
+cache_lookup(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp)
+{
+	return (-1);
+}
+
+void
+cache_enter(struct vnode *dvp, struct vnode *vp, struct componentname *cnp)
+{
+}
+
+void
+cache_purge(struct vnode *vp)
+{
+}
+
+void
+uvm_vnp_setsize(struct vnode *vp, off_t newsize)
+{
+}
+
+void
+uvm_vnp_uncache(struct vnode *vp)
+{
+}
+
+int
+vn_fsizechk(struct vnode *vp, struct uio *uio, int ioflag, ssize_t *overrun)
+{
+	*overrun = 0;
+
+	return (0);
+}
+
+void
+klist_insert_locked(struct klist *klist, struct knote *kn)
+{
+	kn->kn_next = klist->kl_list;
+	klist->kl_list = kn;
+}
+
+void
+klist_remove_locked(struct klist *klist, struct knote *kn)
+{
+	struct knote **knp;
+
+	for (knp = &klist->kl_list; *knp != NULL; knp = &(*knp)->kn_next) {
+		if (*knp == kn) {
+			*knp = kn->kn_next;
+			break;
+		}
+	}
+}
+
+off_t
+foffset(struct file *fp)
+{
+	return (fp->f_offset);
+}
+
+/*
+ * Mount helpers.  NFS export is not supported.
+ */
+int
+vfs_export(struct mount *mp, struct netexport *nep, struct export_args *argp)
+{
+	return (EOPNOTSUPP);
+}
+
+struct netcred *
+vfs_export_lookup(struct mount *mp, struct netexport *nep, struct mbuf *nam)
+{
+	return (NULL);
+}
+
+int
+vfs_mountedon(struct vnode *vp)
+{
+	return (vp->v_specmountpoint != NULL ? EBUSY : 0);
+}
+
+void
+copy_statfs_info(struct statfs *sbp, const struct mount *mp)
+{
+	const struct statfs *mbp = &mp->mnt_stat;
+
+	if (sbp == mbp)
+		return;
+	sbp->f_flags = mbp->f_flags;
+	sbp->f_fsid = mbp->f_fsid;
+	sbp->f_owner = mbp->f_owner;
+	sbp->f_namemax = mbp->f_namemax;
+	memcpy(sbp->f_fstypename, mbp->f_fstypename, sizeof(sbp->f_fstypename));
+	memcpy(sbp->f_mntonname, mbp->f_mntonname, sizeof(sbp->f_mntonname));
+	memcpy(sbp->f_mntfromname, mbp->f_mntfromname,
+	    sizeof(sbp->f_mntfromname));
+	memcpy(sbp->f_mntfromspec, mbp->f_mntfromspec,
+	    sizeof(sbp->f_mntfromspec));
+	memcpy(&sbp->mount_info, &mbp->mount_info, sizeof(sbp->mount_info));
+}
+
+/*
+ * VOP_* entry points.
+ */
+#define VOP_CALL(vp, op, ap)						\
+	((vp)->v_op->op == NULL ? EOPNOTSUPP : ((vp)->v_op->op)(ap))
+
+int
+VOP_ISLOCKED(struct vnode *vp)
+{
+	struct vop_islocked_args a = { vp };
+
+	return (VOP_CALL(vp, vop_islocked, &a));
+}
+
+int
+VOP_LOOKUP(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp)
+{
+	struct vop_lookup_args a = { dvp, vpp, cnp };
+
+	return (VOP_CALL(dvp, vop_lookup, &a));
+}
+
+int
+VOP_CREATE(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp,
+    struct vattr *vap)
+{
+	struct vop_create_args a = { dvp, vpp, cnp, vap };
+
+	return (VOP_CALL(dvp, vop_create, &a));
+}
+
+int
+VOP_MKNOD(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp,
+    struct vattr *vap)
+{
+	struct vop_mknod_args a = { dvp, vpp, cnp, vap };
+
+	return (VOP_CALL(dvp, vop_mknod, &a));
+}
+
+int
+VOP_OPEN(struct vnode *vp, int mode, struct ucred *cred, struct proc *p)
+{
+	struct vop_open_args a = { vp, mode, cred, p };
+
+	return (VOP_CALL(vp, vop_open, &a));
+}
+
+int
+VOP_CLOSE(struct vnode *vp, int fflag, struct ucred *cred, struct proc *p)
+{
+	struct vop_close_args a = { vp, fflag, cred, p };
+
+	return (VOP_CALL(vp, vop_close, &a));
+}
+
+int
+VOP_ACCESS(struct vnode *vp, int mode, struct ucred *cred, struct proc *p)
+{
+	struct vop_access_args a = { vp, mode, cred, p };
+
+	return (VOP_CALL(vp, vop_access, &a));
+}
+
+int
+VOP_GETATTR(struct vnode *vp, struct vattr *vap, struct ucred *cred,
+    struct proc *p)
+{
+	struct vop_getattr_args a = { vp, vap, cred, p };
+
+	return (VOP_CALL(vp, vop_getattr, &a));
+}
+
+int
+VOP_SETATTR(struct vnode *vp, struct vattr *vap, struct ucred *cred,
+    struct proc *p)
+{
+	struct vop_setattr_args a = { vp, vap, cred, p };
+
+	return (VOP_CALL(vp, vop_setattr, &a));
+}
+
+int
+VOP_READ(struct vnode *vp, struct uio *uio, int ioflag, struct ucred *cred)
+{
+	struct vop_read_args a = { vp, uio, ioflag, cred };
+
+	return (VOP_CALL(vp, vop_read, &a));
+}
+
+int
+VOP_WRITE(struct vnode *vp, struct uio *uio, int ioflag, struct ucred *cred)
+{
+	struct vop_write_args a = { vp, uio, ioflag, cred };
+
+	return (VOP_CALL(vp, vop_write, &a));
+}
+
+int
+VOP_IOCTL(struct vnode *vp, u_long command, void *data, int fflag,
+    struct ucred *cred, struct proc *p)
+{
+	struct vop_ioctl_args a = { vp, command, data, fflag, cred, p };
+
+	return (VOP_CALL(vp, vop_ioctl, &a));
+}
+
+int
+VOP_FSYNC(struct vnode *vp, struct ucred *cred, int waitfor, struct proc *p)
+{
+	struct vop_fsync_args a = { vp, cred, waitfor, p };
+
+	return (VOP_CALL(vp, vop_fsync, &a));
+}
+
+/* As in OpenBSD, the references to vp and dvp are released here. */
+int
+VOP_REMOVE(struct vnode *dvp, struct vnode *vp, struct componentname *cnp)
+{
+	struct vop_remove_args a = { dvp, vp, cnp };
+	int error;
+
+	error = VOP_CALL(dvp, vop_remove, &a);
+	if (dvp == vp)
+		vrele(vp);
+	else
+		vput(vp);
+	vput(dvp);
+
+	return (error);
+}
+
+int
+VOP_LINK(struct vnode *dvp, struct vnode *vp, struct componentname *cnp)
+{
+	struct vop_link_args a = { dvp, vp, cnp };
+
+	return (VOP_CALL(dvp, vop_link, &a));
+}
+
+int
+VOP_RENAME(struct vnode *fdvp, struct vnode *fvp,
+    struct componentname *fcnp, struct vnode *tdvp, struct vnode *tvp,
+    struct componentname *tcnp)
+{
+	struct vop_rename_args a = { fdvp, fvp, fcnp, tdvp, tvp, tcnp };
+
+	return (VOP_CALL(fdvp, vop_rename, &a));
+}
+
+int
+VOP_MKDIR(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp,
+    struct vattr *vap)
+{
+	struct vop_mkdir_args a = { dvp, vpp, cnp, vap };
+
+	return (VOP_CALL(dvp, vop_mkdir, &a));
+}
+
+int
+VOP_RMDIR(struct vnode *dvp, struct vnode *vp, struct componentname *cnp)
+{
+	struct vop_rmdir_args a = { dvp, vp, cnp };
+
+	return (VOP_CALL(dvp, vop_rmdir, &a));
+}
+
+int
+VOP_SYMLINK(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp,
+    struct vattr *vap, char *target)
+{
+	struct vop_symlink_args a = { dvp, vpp, cnp, vap, target };
+
+	return (VOP_CALL(dvp, vop_symlink, &a));
+}
+
+int
+VOP_READDIR(struct vnode *vp, struct uio *uio, struct ucred *cred,
+    int *eofflag)
+{
+	struct vop_readdir_args a = { vp, uio, cred, eofflag };
+
+	return (VOP_CALL(vp, vop_readdir, &a));
+}
+
+int
+VOP_READLINK(struct vnode *vp, struct uio *uio, struct ucred *cred)
+{
+	struct vop_readlink_args a = { vp, uio, cred };
+
+	return (VOP_CALL(vp, vop_readlink, &a));
+}
+
+int
+VOP_ABORTOP(struct vnode *dvp, struct componentname *cnp)
+{
+	struct vop_abortop_args a = { dvp, cnp };
+
+	return (VOP_CALL(dvp, vop_abortop, &a));
+}
+
+int
+VOP_INACTIVE(struct vnode *vp, struct proc *p)
+{
+	struct vop_inactive_args a = { vp, p };
+
+	return (VOP_CALL(vp, vop_inactive, &a));
+}
+
+int
+VOP_RECLAIM(struct vnode *vp, struct proc *p)
+{
+	struct vop_reclaim_args a = { vp, p };
+
+	return (VOP_CALL(vp, vop_reclaim, &a));
+}
+
+int
+VOP_LOCK(struct vnode *vp, int flags)
+{
+	struct vop_lock_args a = { vp, flags };
+
+	return (VOP_CALL(vp, vop_lock, &a));
+}
+
+int
+VOP_UNLOCK(struct vnode *vp)
+{
+	struct vop_unlock_args a = { vp };
+
+	return (VOP_CALL(vp, vop_unlock, &a));
+}
+
+int
+VOP_BMAP(struct vnode *vp, daddr_t bn, struct vnode **vpp, daddr_t *bnp,
+    int *runp)
+{
+	struct vop_bmap_args a = { vp, bn, vpp, bnp, runp };
+
+	return (VOP_CALL(vp, vop_bmap, &a));
+}
+
+int
+VOP_PRINT(struct vnode *vp)
+{
+	struct vop_print_args a = { vp };
+
+	return (VOP_CALL(vp, vop_print, &a));
+}
+
+int
+VOP_PATHCONF(struct vnode *vp, int name, register_t *retval)
+{
+	struct vop_pathconf_args a = { vp, name, retval };
+
+	return (VOP_CALL(vp, vop_pathconf, &a));
+}
+
+int
+VOP_STRATEGY(struct vnode *vp, struct buf *bp)
+{
+	struct vop_strategy_args a = { vp, bp };
+
+	return (VOP_CALL(vp, vop_strategy, &a));
+}
+
+int
+VOP_BWRITE(struct buf *bp)
+{
+	struct vop_bwrite_args a = { bp };
+
+	return (VOP_CALL(bp->b_vp, vop_bwrite, &a));
+}
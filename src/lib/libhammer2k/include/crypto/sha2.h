@@ -0,0 +1,11 @@
+/* Public domain. */
+
+/*
+ * sha2(9) on top of OpenSSL, the same implementation hammer2(8) uses.
+ */
+#include <openssl/sha.h>
+
+#define SHA2_CTX		SHA256_CTX
+#define SHA256Init(ctx)		SHA256_Init(ctx)
+#define SHA256Update(ctx, p, n)	SHA256_Update((ctx), (p), (n))
+#define SHA256Final(d, ctx)	SHA256_Final((d), (ctx))
@@ -0,0 +1,3 @@
+/* Public domain. */
+
+#include <zlib.h>
@@ -0,0 +1 @@
+/* Public domain. */
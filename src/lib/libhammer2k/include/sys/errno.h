@@ -0,0 +1,3 @@
+/* Public domain. */
+
+#include <errno.h>
@@ -0,0 +1,3 @@
+/* Public domain. */
+
+#include <hammer2k_kern.h>
@@ -0,0 +1,4 @@
+/* Public domain. */
+
+#include_next <sys/uio.h>
+#include <hammer2k_kern.h>
@@ -0,0 +1,3 @@
+/* Public domain. */
+
+#include <unistd.h>
@@ -0,0 +1,1045 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * libhammer2k entry points.  These play the part of the system call
+ * layer, i.e. vfs_syscalls.c and vfs_vnops.c, translating paths into
+ * VOP_LOOKUP() calls one component at a time and driving the vnode and
+ * VFS operations of the hammer2 kernel sources with the same locking
+ * protocol OpenBSD uses.
+ */
+
+#include <fs/hammer2/hammer2.h>
+#include <fs/hammer2/hammer2_ioctl.h>
+#include <fs/hammer2/hammer2_mount.h>
+
+#include "libhammer2k.h"
+
+extern const struct vfsops hammer2_vfsops;
+
+struct hammer2k_mount {
+	struct mount	*mp;
+	int		nfiles;		/* open hammer2k_file_t */
+};
+
+struct hammer2k_file {
+	hammer2k_mount_t *hm;
+	struct vnode	*vp;		/* referenced, not locked */
+	int		fflags;		/* FREAD|FWRITE */
+};
+
+static int hammer2k_inited;
+
+/*
+ * Enter and leave the kernel.
+ */
+static struct proc *
+hammer2k_enter(void)
+{
+	hammer2k_proc_enter();
+	hammer2k_giant_enter();
+
+	return (curproc);
+}
+
+static void
+hammer2k_leave(void)
+{
+	hammer2k_bufdaemon();
+	hammer2k_giant_exit();
+}
+
+int
+hammer2k_init(size_t bufspace)
+{
+	int error;
+
+	if (hammer2k_inited)
+		return (EBUSY);
+
+	if (bufspace == 0)
+		bufspace = HAMMER2K_BUFSPACE_DEFAULT;
+	hammer2k_bufspace_limit = bufspace;
+	hammer2k_kern_init();
+	hammer2k_vfs_init();
+
+	hammer2k_enter();
+	error = (*hammer2_vfsops.vfs_init)(&hammer2k_vfsconf);
+	hammer2k_leave();
+	if (error == 0)
+		hammer2k_inited = 1;
+
+	return (error);
+}
+
+void
+hammer2k_iostat(hammer2k_iostat_t *ios)
+{
+	hammer2k_enter();
+	ios->reads = hammer2k_devstat.reads;
+	ios->read_bytes = hammer2k_devstat.read_bytes;
+	ios->writes = hammer2k_devstat.writes;
+	ios->write_bytes = hammer2k_devstat.write_bytes;
+	hammer2k_leave();
+}
+
+/*
+ * Look up path from the root of hm.  This is a simplified namei(9):
+ * symbolic links are not followed and the caller supplies the name
+ * buffer flags in cnp->cn_flags.
+ *
+ * On success *vpp is the locked and referenced vnode, or NULL if a
+ * CREATE or RENAME lookup did not find the last component.  If
+ * LOCKPARENT or WANTPARENT is set *dvpp is the referenced parent, locked
+ * only with LOCKPARENT, and cn_pnbuf is left for the VOP to free.
+ * Otherwise the name buffer has been freed.
+ */
+static int
+hammer2k_lookup(hammer2k_mount_t *hm, const char *path,
+    struct componentname *cnp, struct vnode **dvpp, struct vnode **vpp)
+{
+	struct proc *p = curproc;
+	struct vnode *dvp, *vp;
+	char *cp, *next;
+	int error, wantparent;
+
+	wantparent = cnp->cn_flags & (LOCKPARENT | WANTPARENT);
+	if (dvpp)
+		*dvpp = NULL;
+	*vpp = NULL;
+
+	cnp->cn_proc = p;
+	cnp->cn_cred = p->p_ucred;
+	cnp->cn_pnbuf = pool_get(&namei_pool, PR_WAITOK);
+	cnp->cn_flags |= HASBUF;
+	if (strlcpy(cnp->cn_pnbuf, path, MAXPATHLEN) >= MAXPATHLEN) {
+		error = ENAMETOOLONG;
+		goto fail;
+	}
+
+	error = VFS_ROOT(hm->mp, &dvp);
+	if (error)
+		goto fail;
+
+	cp = cnp->cn_pnbuf;
+	while (*cp == '/')
+		cp++;
+	if (*cp == '\0') {
+		/* The root itself has no parent to lock. */
+		if (wantparent) {
+			vput(dvp);
+			error = EINVAL;
+			goto fail;
+		}
+		pool_put(&namei_pool, cnp->cn_pnbuf);
+		*vpp = dvp;
+		return (0);
+	}
+
+	for (;;) {
+		next = cp + strcspn(cp, "/");
+		cnp->cn_nameptr = cp;
+		cnp->cn_namelen = next - cp;
+		cnp->cn_flags &= ~(ISLASTCN | ISDOTDOT | PDIRUNLOCK);
+		while (*next == '/')
+			next++;
+		if (*next == '\0')
+			cnp->cn_flags |= ISLASTCN;
+		if (cnp->cn_namelen > NAME_MAX) {
+			vput(dvp);
+			error = ENAMETOOLONG;
+			goto fail;
+		}
+		if (cnp->cn_namelen == 2 && cp[0] == '.' && cp[1] == '.') {
+			if (dvp->v_flag & VROOT) {
+				/* Do not leave the mount. */
+				cnp->cn_nameptr = ".";
+				cnp->cn_namelen = 1;
+			} else {
+				cnp->cn_flags |= ISDOTDOT;
+			}
+		}
+
+		error = VOP_LOOKUP(dvp, &vp, cnp);
+		if (cnp->cn_flags & ISLASTCN)
+			break;
+		if (error == 0 && vp->v_type != VDIR) {
+			vput(vp);
+			error = ENOTDIR;
+		}
+		if (error == 0 && vp == dvp)
+			vrele(dvp);
+		else if (cnp->cn_flags & PDIRUNLOCK)
+			vrele(dvp);
+		else
+			vput(dvp);
+		if (error) {
+			if (error == EJUSTRETURN)
+				error = ENOENT;
+			goto fail;
+		}
+		dvp = vp;
+		cp = next;
+	}
+
+	if (error == EJUSTRETURN) {
+		KASSERT(wantparent);
+		*dvpp = dvp;
+		return (0);
+	}
+	if (error) {
+		if (cnp->cn_flags & PDIRUNLOCK)
+			vrele(dvp);
+		else
+			vput(dvp);
+		goto fail;
+	}
+
+	*vpp = vp;
+	if (wantparent) {
+		*dvpp = dvp;
+		return (0);
+	}
+	if (vp == dvp || (cnp->cn_flags & PDIRUNLOCK))
+		vrele(dvp);
+	else
+		vput(dvp);
+	pool_put(&namei_pool, cnp->cn_pnbuf);
+
+	return (0);
+fail:
+	pool_put(&namei_pool, cnp->cn_pnbuf);
+	cnp->cn_flags &= ~HASBUF;
+
+	return (error);
+}
+
+/*
+ * Release the result of a LOCKPARENT lookup which is not going to be
+ * handed to a VOP, see vfs_syscalls.c.
+ */
+static void
+hammer2k_lookup_abort(struct componentname *cnp, struct vnode *dvp,
+    struct vnode *vp)
+{
+	VOP_ABORTOP(dvp, cnp);
+	if (dvp == vp)
+		vrele(dvp);
+	else
+		vput(dvp);
+	if (vp)
+		vput(vp);
+}
+
+int
+hammer2k_mount(const char *special, int flags, hammer2k_mount_t **hmp)
+{
+	struct hammer2_mount_info args;
+	struct nameidata nd;
+	struct mount *mp;
+	struct proc *p;
+	hammer2k_mount_t *hm;
+	int error;
+
+	*hmp = NULL;
+	if (hammer2k_inited == 0)
+		return (ENXIO);
+
+	p = hammer2k_enter();
+	mp = hammer2k_malloc(sizeof(*mp), M_TEMP, M_WAITOK | M_ZERO);
+	TAILQ_INIT(&mp->mnt_vnodelist);
+	rw_init_flags(&mp->mnt_lock, "vfslock", RWL_IS_VNODE);
+	mp->mnt_op = &hammer2_vfsops;
+	mp->mnt_vfc = &hammer2k_vfsconf;
+	if (flags & HAMMER2K_RDONLY)
+		mp->mnt_flag |= MNT_RDONLY;
+	strlcpy(mp->mnt_stat.f_fstypename, hammer2k_vfsconf.vfc_name,
+	    sizeof(mp->mnt_stat.f_fstypename));
+	mp->mnt_stat.f_owner = p->p_ucred->cr_uid;
+
+	bzero(&args, sizeof(args));
+	args.fspec = (char *)special;
+	if (flags & HAMMER2K_EMERG)
+		args.hflags |= HMNT2_EMERG;
+	if (flags & HAMMER2K_LAZYTIME)
+		args.hflags |= HMNT2_LAZYTIME;
+	if (flags & HAMMER2K_RELATIME)
+		args.hflags |= HMNT2_RELATIME;
+
+	error = (*mp->mnt_op->vfs_mount)(mp, "/", &args, &nd, p);
+	if (error) {
+		hammer2k_free(mp, M_TEMP, sizeof(*mp));
+	} else {
+		hammer2k_vfsconf.vfc_refcount++;
+		hm = hammer2k_malloc(sizeof(*hm), M_TEMP, M_WAITOK | M_ZERO);
+		hm->mp = mp;
+		*hmp = hm;
+	}
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_unmount(hammer2k_mount_t *hm, int flags)
+{
+	struct mount *mp = hm->mp;
+	struct proc *p;
+	int error = 0, mntflags = 0;
+
+	if (flags & HAMMER2K_FORCE)
+		mntflags |= MNT_FORCE;
+	else if (hm->nfiles)
+		return (EBUSY);
+
+	p = hammer2k_enter();
+	/* As in dounmount(). */
+	if ((mp->mnt_flag & MNT_RDONLY) == 0)
+		error = VFS_SYNC(mp, MNT_WAIT, 0, p->p_ucred, p);
+	if (error == 0 || (mntflags & MNT_FORCE))
+		error = (*mp->mnt_op->vfs_unmount)(mp, mntflags, p);
+	if (error == 0) {
+		KASSERT(TAILQ_EMPTY(&mp->mnt_vnodelist));
+		hammer2k_vfsconf.vfc_refcount--;
+		hammer2k_free(mp, M_TEMP, sizeof(*mp));
+		hammer2k_free(hm, M_TEMP, sizeof(*hm));
+	}
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_sync(hammer2k_mount_t *hm)
+{
+	struct mount *mp = hm->mp;
+	struct proc *p;
+	int error = 0;
+
+	p = hammer2k_enter();
+	if ((mp->mnt_flag & MNT_RDONLY) == 0)
+		error = VFS_SYNC(mp, MNT_WAIT, 0, p->p_ucred, p);
+	hammer2k_leave();
+
+	return (error);
+}
+
+/*
+ * One pass of the filesystem syncer, unlike hammer2k_sync() which plays
+ * the part of sync(2).
+ */
+int
+hammer2k_syncer(hammer2k_mount_t *hm)
+{
+	struct mount *mp = hm->mp;
+	struct proc *p;
+	int error = 0;
+
+	p = hammer2k_enter();
+	if ((mp->mnt_flag & MNT_RDONLY) == 0)
+		error = VFS_SYNC(mp, MNT_LAZY, 0, p->p_ucred, p);
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_statfs(hammer2k_mount_t *hm, hammer2k_statfs_t *sfs)
+{
+	struct statfs sb;
+	struct proc *p;
+	int error;
+
+	p = hammer2k_enter();
+	error = VFS_STATFS(hm->mp, &sb, p);
+	hammer2k_leave();
+	if (error == 0) {
+		sfs->bsize = sb.f_bsize;
+		sfs->blocks = sb.f_blocks;
+		sfs->bfree = sb.f_bfree;
+		sfs->files = sb.f_files;
+	}
+
+	return (error);
+}
+
+int
+hammer2k_bulkfree(hammer2k_mount_t *hm, size_t size, hammer2k_bulkfree_t *bfi)
+{
+	struct hammer2_ioc_bulkfree bfree;
+	struct vnode *vp;
+	struct proc *p;
+	int error;
+
+	bzero(&bfree, sizeof(bfree));
+	/* Same lower bound as hammer2(8). */
+	bfree.size = size;
+	if (bfree.size < 8192 * 1024)
+		bfree.size = 8192 * 1024;
+
+	p = hammer2k_enter();
+	error = VFS_ROOT(hm->mp, &vp);
+	if (error == 0) {
+		VOP_UNLOCK(vp);
+		error = VOP_IOCTL(vp, HAMMER2IOC_BULKFREE_SCAN, &bfree, FWRITE,
+		    p->p_ucred, p);
+		vrele(vp);
+	}
+	hammer2k_leave();
+	if (error == 0 && bfi) {
+		bfi->count_allocated = bfree.count_allocated;
+		bfi->count_freed = bfree.count_freed;
+		bfi->total_fragmented = bfree.total_fragmented;
+		bfi->total_allocated = bfree.total_allocated;
+		bfi->total_scanned = bfree.total_scanned;
+	}
+
+	return (error);
+}
+
+/*
+ * PFS ioctls, issued on the root like hammer2(8) does on the mount point.
+ */
+static int
+hammer2k_pfs_ioctl(hammer2k_mount_t *hm, u_long cmd, const char *label,
+    struct hammer2_ioc_pfs *pfs)
+{
+	struct vnode *vp;
+	struct proc *p;
+	int error;
+
+	bzero(pfs, sizeof(*pfs));
+	if (strlcpy(pfs->name, label, sizeof(pfs->name)) >= sizeof(pfs->name))
+		return (ENAMETOOLONG);
+
+	p = hammer2k_enter();
+	error = VFS_ROOT(hm->mp, &vp);
+	if (error == 0) {
+		VOP_UNLOCK(vp);
+		error = VOP_IOCTL(vp, cmd, pfs, FWRITE, p->p_ucred, p);
+		vrele(vp);
+	}
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_snapshot(hammer2k_mount_t *hm, const char *label,
+    hammer2k_snapshot_t *snap)
+{
+	struct hammer2_ioc_pfs pfs;
+	int error;
+
+	error = hammer2k_pfs_ioctl(hm, HAMMER2IOC_PFS_SNAPSHOT, label, &pfs);
+	if (error == 0 && snap) {
+		snap->usecs = pfs.snap_usecs;
+		snap->stall_usecs = pfs.snap_stall_usecs;
+	}
+
+	return (error);
+}
+
+int
+hammer2k_pfs_delete(hammer2k_mount_t *hm, const char *label)
+{
+	struct hammer2_ioc_pfs pfs;
+
+	return (hammer2k_pfs_ioctl(hm, HAMMER2IOC_PFS_DELETE, label, &pfs));
+}
+
+/*
+ * Files.
+ */
+static int
+hammer2k_truncate(struct vnode *vp, off_t length, struct proc *p)
+{
+	struct vattr va;
+
+	VATTR_NULL(&va);
+	va.va_size = length;
+
+	return (VOP_SETATTR(vp, &va, p->p_ucred, p));
+}
+
+int
+hammer2k_open(hammer2k_mount_t *hm, const char *path, int flags, mode_t mode,
+    hammer2k_file_t **fpp)
+{
+	struct componentname cn;
+	struct vattr va;
+	struct vnode *dvp, *vp;
+	struct proc *p;
+	hammer2k_file_t *fp;
+	int error, fflags;
+
+	*fpp = NULL;
+	switch (flags & O_ACCMODE) {
+	case O_RDONLY:
+		fflags = FREAD;
+		break;
+	case O_WRONLY:
+		fflags = FWRITE;
+		break;
+	case O_RDWR:
+		fflags = FREAD | FWRITE;
+		break;
+	default:
+		return (EINVAL);
+	}
+	if ((flags & O_TRUNC) && (fflags & FWRITE) == 0)
+		return (EINVAL);
+
+	p = hammer2k_enter();
+	bzero(&cn, sizeof(cn));
+	if (flags & O_CREAT) {
+		/* As in vn_open(). */
+		cn.cn_nameiop = CREATE;
+		cn.cn_flags = LOCKPARENT;
+		error = hammer2k_lookup(hm, path, &cn, &dvp, &vp);
+		if (error)
+			goto done;
+		if (vp == NULL) {
+			VATTR_NULL(&va);
+			va.va_type = VREG;
+			va.va_mode = mode & ALLPERMS;
+			error = VOP_CREATE(dvp, &vp, &cn, &va);
+			vput(dvp);
+			if (error)
+				goto done;
+			flags &= ~O_TRUNC;
+		} else {
+			hammer2k_lookup_abort(&cn, dvp, NULL);
+			if (flags & O_EXCL) {
+				error = EEXIST;
+				goto bad;
+			}
+		}
+	} else {
+		cn.cn_nameiop = LOOKUP;
+		error = hammer2k_lookup(hm, path, &cn, NULL, &vp);
+		if (error)
+			goto done;
+	}
+
+	if (vp->v_type == VDIR && (fflags & FWRITE)) {
+		error = EISDIR;
+		goto bad;
+	}
+	if (vp->v_type != VREG && vp->v_type != VDIR) {
+		error = EOPNOTSUPP;
+		goto bad;
+	}
+	if ((error = VOP_OPEN(vp, fflags, p->p_ucred, p)) != 0)
+		goto bad;
+	if ((flags & O_TRUNC) &&
+	    (error = hammer2k_truncate(vp, 0, p)) != 0) {
+		VOP_CLOSE(vp, fflags, p->p_ucred, p);
+		goto bad;
+	}
+	VOP_UNLOCK(vp);
+
+	fp = hammer2k_malloc(sizeof(*fp), M_TEMP, M_WAITOK | M_ZERO);
+	fp->hm = hm;
+	fp->vp = vp;
+	fp->fflags = fflags;
+	hm->nfiles++;
+	*fpp = fp;
+	goto done;
+bad:
+	vput(vp);
+done:
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_close(hammer2k_file_t *fp)
+{
+	struct vnode *vp = fp->vp;
+	struct proc *p;
+	int error;
+
+	p = hammer2k_enter();
+	vn_lock(vp, LK_EXCLUSIVE | LK_RETRY);
+	error = VOP_CLOSE(vp, fp->fflags, p->p_ucred, p);
+	vput(vp);
+	fp->hm->nfiles--;
+	hammer2k_free(fp, M_TEMP, sizeof(*fp));
+	hammer2k_leave();
+
+	return (error);
+}
+
+static ssize_t
+hammer2k_rdwr(hammer2k_file_t *fp, void *buf, size_t bytes, off_t offset,
+    enum uio_rw rw)
+{
+	struct vnode *vp = fp->vp;
+	struct iovec iov;
+	struct uio uio;
+	struct proc *p;
+	int error;
+
+	if (offset < 0 || bytes > SSIZE_MAX) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if ((fp->fflags & (rw == UIO_READ ? FREAD : FWRITE)) == 0) {
+		errno = EBADF;
+		return (-1);
+	}
+
+	iov.iov_base = buf;
+	iov.iov_len = bytes;
+	uio.uio_iov = &iov;
+	uio.uio_iovcnt = 1;
+	uio.uio_offset = offset;
+	uio.uio_resid = bytes;
+	uio.uio_segflg = UIO_SYSSPACE;
+	uio.uio_rw = rw;
+
+	p = hammer2k_enter();
+	uio.uio_procp = p;
+	if (rw == UIO_READ) {
+		vn_lock(vp, LK_SHARED | LK_RETRY);
+		error = VOP_READ(vp, &uio, 0, p->p_ucred);
+	} else {
+		vn_lock(vp, LK_EXCLUSIVE | LK_RETRY);
+		error = VOP_WRITE(vp, &uio, 0, p->p_ucred);
+	}
+	VOP_UNLOCK(vp);
+	hammer2k_leave();
+
+	/* A partial transfer is not an error, as in dofilewritev(). */
+	if (error && uio.uio_resid != bytes &&
+	    (error == EINTR || error == EWOULDBLOCK))
+		error = 0;
+	if (error) {
+		errno = error;
+		return (-1);
+	}
+
+	return (bytes - uio.uio_resid);
+}
+
+ssize_t
+hammer2k_pread(hammer2k_file_t *fp, void *buf, size_t bytes, off_t offset)
+{
+	return (hammer2k_rdwr(fp, buf, bytes, offset, UIO_READ));
+}
+
+ssize_t
+hammer2k_pwrite(hammer2k_file_t *fp, const void *buf, size_t bytes,
+    off_t offset)
+{
+	return (hammer2k_rdwr(fp, (void *)buf, bytes, offset, UIO_WRITE));
+}
+
+int
+hammer2k_fsync(hammer2k_file_t *fp)
+{
+	struct vnode *vp = fp->vp;
+	struct proc *p;
+	int error;
+
+	p = hammer2k_enter();
+	vn_lock(vp, LK_EXCLUSIVE | LK_RETRY);
+	error = VOP_FSYNC(vp, p->p_ucred, MNT_WAIT, p);
+	VOP_UNLOCK(vp);
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_ftruncate(hammer2k_file_t *fp, off_t length)
+{
+	struct vnode *vp = fp->vp;
+	struct proc *p;
+	int error;
+
+	if (length < 0)
+		return (EINVAL);
+	if ((fp->fflags & FWRITE) == 0)
+		return (EBADF);
+
+	p = hammer2k_enter();
+	vn_lock(vp, LK_EXCLUSIVE | LK_RETRY);
+	if (vp->v_type == VDIR)
+		error = EISDIR;
+	else
+		error = hammer2k_truncate(vp, length, p);
+	VOP_UNLOCK(vp);
+	hammer2k_leave();
+
+	return (error);
+}
+
+/*
+ * Deallocate [offset, offset + length) without changing the file size,
+ * like fallocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE).  The ioctl
+ * locks the vnode itself.
+ */
+int
+hammer2k_punch(hammer2k_file_t *fp, off_t offset, off_t length)
+{
+	struct hammer2_ioc_punch punch;
+	struct proc *p;
+	int error;
+
+	if (offset < 0 || length < 0)
+		return (EINVAL);
+
+	punch.offset = offset;
+	punch.length = length;
+
+	p = hammer2k_enter();
+	error = VOP_IOCTL(fp->vp, HAMMER2IOC_PUNCH, &punch, fp->fflags,
+	    p->p_ucred, p);
+	hammer2k_leave();
+
+	return (error);
+}
+
+/*
+ * vn_stat() on a locked vnode.
+ */
+static int
+hammer2k_getattr(struct vnode *vp, struct stat *st, struct proc *p)
+{
+	struct vattr va;
+	int error;
+
+	error = VOP_GETATTR(vp, &va, p->p_ucred, p);
+	if (error)
+		return (error);
+
+	bzero(st, sizeof(*st));
+	st->st_dev = va.va_fsid;
+	st->st_ino = va.va_fileid;
+	st->st_mode = va.va_mode;
+	switch (vp->v_type) {
+	case VREG:
+		st->st_mode |= S_IFREG;
+		break;
+	case VDIR:
+		st->st_mode |= S_IFDIR;
+		break;
+	case VBLK:
+		st->st_mode |= S_IFBLK;
+		break;
+	case VCHR:
+		st->st_mode |= S_IFCHR;
+		break;
+	case VLNK:
+		st->st_mode |= S_IFLNK;
+		break;
+	case VSOCK:
+		st->st_mode |= S_IFSOCK;
+		break;
+	case VFIFO:
+		st->st_mode |= S_IFIFO;
+		break;
+	default:
+		return (EBADF);
+	}
+	st->st_nlink = va.va_nlink;
+	st->st_uid = va.va_uid;
+	st->st_gid = va.va_gid;
+	st->st_rdev = va.va_rdev;
+	st->st_size = va.va_size;
+	st->st_atim = va.va_atime;
+	st->st_mtim = va.va_mtime;
+	st->st_ctim = va.va_ctime;
+	st->st_blksize = va.va_blocksize;
+	st->st_blocks = va.va_bytes / S_BLKSIZE;
+
+	return (0);
+}
+
+int
+hammer2k_fstat(hammer2k_file_t *fp, struct stat *st)
+{
+	struct vnode *vp = fp->vp;
+	struct proc *p;
+	int error;
+
+	p = hammer2k_enter();
+	vn_lock(vp, LK_SHARED | LK_RETRY);
+	error = hammer2k_getattr(vp, st, p);
+	VOP_UNLOCK(vp);
+	hammer2k_leave();
+
+	return (error);
+}
+
+/*
+ * Namespace operations.
+ */
+int
+hammer2k_stat(hammer2k_mount_t *hm, const char *path, struct stat *st)
+{
+	struct componentname cn;
+	struct vnode *vp;
+	struct proc *p;
+	int error;
+
+	p = hammer2k_enter();
+	bzero(&cn, sizeof(cn));
+	cn.cn_nameiop = LOOKUP;
+	error = hammer2k_lookup(hm, path, &cn, NULL, &vp);
+	if (error == 0) {
+		error = hammer2k_getattr(vp, st, p);
+		vput(vp);
+	}
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_mkdir(hammer2k_mount_t *hm, const char *path, mode_t mode)
+{
+	struct componentname cn;
+	struct vattr va;
+	struct vnode *dvp, *vp;
+	int error;
+
+	hammer2k_enter();
+	bzero(&cn, sizeof(cn));
+	cn.cn_nameiop = CREATE;
+	cn.cn_flags = LOCKPARENT;
+	error = hammer2k_lookup(hm, path, &cn, &dvp, &vp);
+	if (error)
+		goto done;
+	if (vp != NULL) {
+		hammer2k_lookup_abort(&cn, dvp, vp);
+		error = EEXIST;
+		goto done;
+	}
+
+	VATTR_NULL(&va);
+	va.va_type = VDIR;
+	va.va_mode = mode & ACCESSPERMS;
+	error = VOP_MKDIR(dvp, &vp, &cn, &va);
+	if (error == 0)
+		vput(vp);
+done:
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_rmdir(hammer2k_mount_t *hm, const char *path)
+{
+	struct componentname cn;
+	struct vnode *dvp, *vp;
+	int error;
+
+	hammer2k_enter();
+	bzero(&cn, sizeof(cn));
+	cn.cn_nameiop = DELETE;
+	cn.cn_flags = LOCKPARENT;
+	error = hammer2k_lookup(hm, path, &cn, &dvp, &vp);
+	if (error)
+		goto done;
+
+	/* As in dounlinkat(). */
+	if (vp->v_type != VDIR)
+		error = ENOTDIR;
+	else if (dvp == vp)
+		error = EINVAL;
+	else if (vp->v_flag & VROOT)
+		error = EBUSY;
+	if (error)
+		hammer2k_lookup_abort(&cn, dvp, vp);
+	else
+		error = VOP_RMDIR(dvp, vp, &cn);
+done:
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_unlink(hammer2k_mount_t *hm, const char *path)
+{
+	struct componentname cn;
+	struct vnode *dvp, *vp;
+	int error;
+
+	hammer2k_enter();
+	bzero(&cn, sizeof(cn));
+	cn.cn_nameiop = DELETE;
+	cn.cn_flags = LOCKPARENT;
+	error = hammer2k_lookup(hm, path, &cn, &dvp, &vp);
+	if (error)
+		goto done;
+
+	if (vp->v_type == VDIR) {
+		hammer2k_lookup_abort(&cn, dvp, vp);
+		error = EPERM;
+	} else {
+		error = VOP_REMOVE(dvp, vp, &cn);
+	}
+done:
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_rename(hammer2k_mount_t *hm, const char *from, const char *to)
+{
+	struct componentname fcn, tcn;
+	struct vnode *fdvp, *fvp, *tdvp, *tvp;
+	int error;
+
+	hammer2k_enter();
+	/* As in dorenameat(), both names are freed here. */
+	bzero(&fcn, sizeof(fcn));
+	fcn.cn_nameiop = DELETE;
+	fcn.cn_flags = WANTPARENT | SAVESTART;
+	error = hammer2k_lookup(hm, from, &fcn, &fdvp, &fvp);
+	if (error)
+		goto done;
+	if (fvp == fdvp) {
+		vput(fvp);
+		vrele(fdvp);
+		pool_put(&namei_pool, fcn.cn_pnbuf);
+		error = EINVAL;
+		goto done;
+	}
+	VOP_UNLOCK(fvp);
+
+	bzero(&tcn, sizeof(tcn));
+	tcn.cn_nameiop = RENAME;
+	tcn.cn_flags = LOCKPARENT | NOCACHE | SAVESTART;
+	error = hammer2k_lookup(hm, to, &tcn, &tdvp, &tvp);
+	if (error) {
+		VOP_ABORTOP(fdvp, &fcn);
+		vrele(fdvp);
+		vrele(fvp);
+		pool_put(&namei_pool, fcn.cn_pnbuf);
+		goto done;
+	}
+
+	if (tvp != NULL) {
+		if (fvp->v_type == VDIR && tvp->v_type != VDIR)
+			error = ENOTDIR;
+		else if (fvp->v_type != VDIR && tvp->v_type == VDIR)
+			error = EISDIR;
+	}
+	if (fvp == tdvp)
+		error = EINVAL;
+	if (error) {
+		hammer2k_lookup_abort(&tcn, tdvp, tvp);
+		VOP_ABORTOP(fdvp, &fcn);
+		vrele(fdvp);
+		vrele(fvp);
+	} else {
+		error = VOP_RENAME(fdvp, fvp, &fcn, tdvp, tvp, &tcn);
+	}
+	pool_put(&namei_pool, tcn.cn_pnbuf);
+	pool_put(&namei_pool, fcn.cn_pnbuf);
+done:
+	hammer2k_leave();
+
+	return (error);
+}
+
+int
+hammer2k_readdir(hammer2k_mount_t *hm, const char *path,
+    hammer2k_readdir_t func, void *arg)
+{
+	struct componentname cn;
+	struct dirent *dp;
+	struct vnode *vp;
+	struct iovec iov;
+	struct uio uio;
+	struct proc *p;
+	char *buf, *cp;
+	size_t len;
+	int error, eofflag = 0;
+
+	p = hammer2k_enter();
+	bzero(&cn, sizeof(cn));
+	cn.cn_nameiop = LOOKUP;
+	error = hammer2k_lookup(hm, path, &cn, NULL, &vp);
+	if (error)
+		goto done;
+	VOP_UNLOCK(vp);
+
+	buf = hammer2k_malloc(HAMMER2_PBUFSIZE, M_TEMP, M_WAITOK);
+	bzero(&uio, sizeof(uio));
+	while (error == 0 && eofflag == 0) {
+		iov.iov_base = buf;
+		iov.iov_len = HAMMER2_PBUFSIZE;
+		uio.uio_iov = &iov;
+		uio.uio_iovcnt = 1;
+		uio.uio_resid = HAMMER2_PBUFSIZE;
+		uio.uio_segflg = UIO_SYSSPACE;
+		uio.uio_rw = UIO_READ;
+		uio.uio_procp = p;
+
+		vn_lock(vp, LK_SHARED | LK_RETRY);
+		error = VOP_READDIR(vp, &uio, p->p_ucred, &eofflag);
+		VOP_UNLOCK(vp);
+		len = HAMMER2_PBUFSIZE - uio.uio_resid;
+		if (error || len == 0)
+			break;
+
+		/* Run the callback without Giant, it may call back in. */
+		hammer2k_giant_exit();
+		for (cp = buf; cp < buf + len; cp += dp->d_reclen) {
+			dp = (struct dirent *)cp;
+			error = func(dp->d_name, dp->d_fileno, dp->d_type, arg);
+			if (error)
+				break;
+		}
+		hammer2k_giant_enter();
+	}
+	hammer2k_free(buf, M_TEMP, HAMMER2_PBUFSIZE);
+	vrele(vp);
+done:
+	hammer2k_leave();
+
+	return (error);
+}
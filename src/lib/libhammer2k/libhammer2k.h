@@ -0,0 +1,146 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HAMMER2_LIBHAMMER2K_H_
+#define HAMMER2_LIBHAMMER2K_H_
+
+/*
+ * The hammer2 kernel filesystem in userland (libhammer2k).
+ *
+ * The sources under sys/fs/hammer2 are compiled unmodified against a
+ * small emulation of the kernel interfaces they use, so that the chain,
+ * freemap, flush and I/O code can be run against image files under
+ * perf(1), the sanitizers or a debugger, and benchmarked without an
+ * OpenBSD kernel.  Devices are given the same way as to mount_hammer2(8),
+ * image files or block devices being opened with open(2).
+ *
+ * The library may be called from any number of threads.  Kernel code
+ * runs under a single big lock which is released whenever it sleeps or
+ * performs device I/O, much like the kernel lock on a uniprocessor.
+ * Every caller is root.
+ *
+ * Functions returning int return 0 or an errno value, pread and pwrite
+ * return -1 and set errno on failure.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+
+#define HAMMER2K_BUFSPACE_DEFAULT	(256 * 1024 * 1024)
+
+/* hammer2k_mount() flags */
+#define HAMMER2K_RDONLY		0x0001
+#define HAMMER2K_EMERG		0x0002	/* mount -o emergency */
+#define HAMMER2K_LAZYTIME	0x0004	/* mount -o lazytime */
+#define HAMMER2K_RELATIME	0x0008	/* mount -o relatime */
+
+/* hammer2k_unmount() flags */
+#define HAMMER2K_FORCE		0x0001
+
+typedef struct hammer2k_mount hammer2k_mount_t;
+typedef struct hammer2k_file hammer2k_file_t;
+
+typedef struct hammer2k_statfs {
+	uint64_t	bsize;
+	uint64_t	blocks;
+	uint64_t	bfree;
+	uint64_t	files;
+} hammer2k_statfs_t;
+
+typedef struct hammer2k_iostat {
+	uint64_t	reads;			/* device I/O since init */
+	uint64_t	read_bytes;
+	uint64_t	writes;
+	uint64_t	write_bytes;
+} hammer2k_iostat_t;
+
+typedef struct hammer2k_bulkfree {
+	uint64_t	count_allocated;	/* alloc fixups */
+	uint64_t	count_freed;		/* bytes freed */
+	uint64_t	total_fragmented;
+	uint64_t	total_allocated;
+	uint64_t	total_scanned;		/* bytes of storage */
+} hammer2k_bulkfree_t;
+
+typedef struct hammer2k_snapshot {
+	uint32_t	usecs;			/* total */
+	uint32_t	stall_usecs;		/* PFS root held */
+} hammer2k_snapshot_t;
+
+/*
+ * Return non-zero from the readdir callback to stop the scan, the value
+ * is then returned by hammer2k_readdir().  type is a DT_* value.
+ */
+typedef int (*hammer2k_readdir_t)(const char *name, uint64_t inum, int type,
+			void *arg);
+
+int hammer2k_init(size_t bufspace);
+void hammer2k_iostat(hammer2k_iostat_t *ios);
+int hammer2k_mount(const char *special, int flags, hammer2k_mount_t **hmp);
+int hammer2k_unmount(hammer2k_mount_t *hm, int flags);
+int hammer2k_sync(hammer2k_mount_t *hm);
+int hammer2k_syncer(hammer2k_mount_t *hm);
+int hammer2k_statfs(hammer2k_mount_t *hm, hammer2k_statfs_t *sfs);
+int hammer2k_bulkfree(hammer2k_mount_t *hm, size_t size,
+			hammer2k_bulkfree_t *bfi);
+int hammer2k_snapshot(hammer2k_mount_t *hm, const char *label,
+			hammer2k_snapshot_t *snap);
+int hammer2k_pfs_delete(hammer2k_mount_t *hm, const char *label);
+
+int hammer2k_open(hammer2k_mount_t *hm, const char *path, int flags,
+			mode_t mode, hammer2k_file_t **fpp);
+int hammer2k_close(hammer2k_file_t *fp);
+ssize_t hammer2k_pread(hammer2k_file_t *fp, void *buf, size_t bytes,
+			off_t offset);
+ssize_t hammer2k_pwrite(hammer2k_file_t *fp, const void *buf, size_t bytes,
+			off_t offset);
+int hammer2k_fsync(hammer2k_file_t *fp);
+int hammer2k_ftruncate(hammer2k_file_t *fp, off_t length);
+int hammer2k_punch(hammer2k_file_t *fp, off_t offset, off_t length);
+int hammer2k_fstat(hammer2k_file_t *fp, struct stat *st);
+
+int hammer2k_stat(hammer2k_mount_t *hm, const char *path, struct stat *st);
+int hammer2k_mkdir(hammer2k_mount_t *hm, const char *path, mode_t mode);
+int hammer2k_rmdir(hammer2k_mount_t *hm, const char *path);
+int hammer2k_unlink(hammer2k_mount_t *hm, const char *path);
+int hammer2k_rename(hammer2k_mount_t *hm, const char *from, const char *to);
+int hammer2k_readdir(hammer2k_mount_t *hm, const char *path,
+			hammer2k_readdir_t func, void *arg);
+
+#endif /* !HAMMER2_LIBHAMMER2K_H_ */
@@ -0,0 +1,262 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Check an image made by newfs_hammer2 -D against its source directory
+ * by mounting it with libhammer2k, so that the layout is read back by
+ * the same code as the kernel.  Every object must be found by lookup
+ * with the type and size of the source, file contents must match, and
+ * every directory must list as many entries as the source.  The largest
+ * file is then removed, and bulkfree must give its space back.
+ *
+ *	populate special@label srcdir
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libhammer2k.h"
+
+#define POP_CHUNK	65536
+
+static hammer2k_mount_t *hm;
+static int nerrors;
+static char bigpath[PATH_MAX];	/* largest file */
+static off_t bigsize;
+
+static void check_dir(const char *src, const char *path);
+
+static int
+count_entry(const char *name, uint64_t inum, int type, void *arg)
+{
+	if (strcmp(name, ".") && strcmp(name, ".."))
+		++*(int *)arg;
+	return (0);
+}
+
+static void
+check_file(const char *src, const char *path)
+{
+	static char sbuf[POP_CHUNK], ibuf[POP_CHUNK];
+	hammer2k_file_t *fp;
+	ssize_t n, m;
+	off_t off;
+	int fd, error;
+
+	if ((fd = open(src, O_RDONLY)) == -1)
+		err(1, "%s", src);
+	error = hammer2k_open(hm, path, O_RDONLY, 0, &fp);
+	if (error) {
+		warnx("%s: open: %s", path, strerror(error));
+		nerrors++;
+		close(fd);
+		return;
+	}
+	for (off = 0;; off += n) {
+		if ((n = pread(fd, sbuf, sizeof(sbuf), off)) == -1)
+			err(1, "%s", src);
+		m = hammer2k_pread(fp, ibuf, sizeof(ibuf), off);
+		if (m != n || memcmp(sbuf, ibuf, n)) {
+			warnx("%s: data differs at offset %lld", path,
+			    (long long)off);
+			nerrors++;
+			break;
+		}
+		if (n == 0)
+			break;
+	}
+	hammer2k_close(fp);
+	close(fd);
+}
+
+static void
+check_object(const char *src, const char *path)
+{
+	struct stat sst, ist;
+	int error;
+
+	if (lstat(src, &sst) == -1)
+		err(1, "%s", src);
+	error = hammer2k_stat(hm, path, &ist);
+	if (error) {
+		warnx("%s: stat: %s", path, strerror(error));
+		nerrors++;
+		return;
+	}
+	if ((sst.st_mode & S_IFMT) != (ist.st_mode & S_IFMT)) {
+		warnx("%s: type %o, expected %o", path,
+		    ist.st_mode & S_IFMT, sst.st_mode & S_IFMT);
+		nerrors++;
+		return;
+	}
+	if ((S_ISREG(sst.st_mode) || S_ISLNK(sst.st_mode)) &&
+	    sst.st_size != ist.st_size) {
+		warnx("%s: size %lld, expected %lld", path,
+		    (long long)ist.st_size, (long long)sst.st_size);
+		nerrors++;
+		return;
+	}
+	if (S_ISREG(sst.st_mode) && sst.st_nlink == 1 &&
+	    sst.st_size > bigsize) {
+		snprintf(bigpath, sizeof(bigpath), "%s", path);
+		bigsize = sst.st_size;
+	}
+	if (S_ISREG(sst.st_mode))
+		check_file(src, path);
+	else if (S_ISDIR(sst.st_mode))
+		check_dir(src, path);
+}
+
+static void
+check_dir(const char *src, const char *path)
+{
+	char spath[PATH_MAX], ipath[PATH_MAX];
+	struct dirent *dp;
+	DIR *dirp;
+	int count = 0, icount = 0, error;
+
+	if ((dirp = opendir(src)) == NULL)
+		err(1, "%s", src);
+	while ((dp = readdir(dirp)) != NULL) {
+		if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+			continue;
+		count++;
+		snprintf(spath, sizeof(spath), "%s/%s", src, dp->d_name);
+		snprintf(ipath, sizeof(ipath), "%s/%s",
+		    strcmp(path, "/") ? path : "", dp->d_name);
+		check_object(spath, ipath);
+	}
+	closedir(dirp);
+
+	error = hammer2k_readdir(hm, path, count_entry, &icount);
+	if (error) {
+		warnx("%s: readdir: %s", path, strerror(error));
+		nerrors++;
+	} else if (icount != count) {
+		warnx("%s: %d entries, expected %d", path, icount, count);
+		nerrors++;
+	}
+}
+
+static uint64_t
+bytes_free(void)
+{
+	hammer2k_statfs_t sfs;
+	int error;
+
+	error = hammer2k_statfs(hm, &sfs);
+	if (error)
+		errx(1, "statfs: %s", strerror(error));
+	return (sfs.bfree * sfs.bsize);
+}
+
+/*
+ * Populated data must be reclaimable, it takes two bulkfree passes to
+ * free a block.
+ */
+static void
+check_bulkfree(void)
+{
+	hammer2k_bulkfree_t bfi;
+	uint64_t before, after;
+	int error, i;
+
+	before = bytes_free();
+	error = hammer2k_unlink(hm, bigpath);
+	if (error)
+		errx(1, "%s: unlink: %s", bigpath, strerror(error));
+	for (i = 0; i < 2; i++) {
+		error = hammer2k_sync(hm);
+		if (error == 0)
+			error = hammer2k_bulkfree(hm, 0, &bfi);
+		if (error)
+			errx(1, "bulkfree: %s", strerror(error));
+	}
+	after = bytes_free();
+	if (after <= before) {
+		warnx("%s: %lld bytes removed, free space %llu -> %llu",
+		    bigpath, (long long)bigsize, (unsigned long long)before,
+		    (unsigned long long)after);
+		nerrors++;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int error;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: populate special@label srcdir\n");
+		exit(1);
+	}
+
+	error = hammer2k_init(HAMMER2K_BUFSPACE_DEFAULT);
+	if (error)
+		errx(1, "hammer2k_init: %s", strerror(error));
+	error = hammer2k_mount(argv[1], HAMMER2K_RDONLY, &hm);
+	if (error)
+		errx(1, "%s: %s", argv[1], strerror(error));
+
+	check_dir(argv[2], "/");
+
+	error = hammer2k_unmount(hm, 0);
+	if (error)
+		errx(1, "unmount: %s", strerror(error));
+	if (nerrors == 0 && bigsize) {
+		error = hammer2k_mount(argv[1], 0, &hm);
+		if (error)
+			errx(1, "%s: %s", argv[1], strerror(error));
+		check_bulkfree();
+		error = hammer2k_unmount(hm, 0);
+		if (error)
+			errx(1, "unmount: %s", strerror(error));
+	}
+	if (nerrors)
+		errx(1, "%d errors", nerrors);
+
+	return (0);
+}
@@ -39,6 +39,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
@@ -55,7 +56,14 @@ int ScanPFS;
 int PrintPFS;
 int NumPFSNames;
 char **PFSNames;
-long BlockrefCacheCount = -1;
+long BlockrefCacheCount = 2;
+int NumThreads = 1;
+long MediaCacheSize = 64; /* MB */
+long MemoSize = 32; /* MB */
+int FreemapCheck;
+int ReportFormat = REPORT_NONE;
+uint64_t SinceTid;
+uint64_t VerifiedTid;
 
 static void
 init_pfs_names(const char *names)
@@ -99,20 +107,97 @@ cleanup_pfs_names(void)
 	free(PFSNames);
 }
 
+/*
+ * The tid file has a line of "tid device" for each device whose last check
+ * was clean.
+ */
+static int
+parse_tid_line(char *line, uint64_t *tid, char **dev)
+{
+	char *p;
+
+	line[strcspn(line, "\n")] = 0;
+	*tid = strtoull(line, &p, 16);
+	if (p == line || *p != ' ')
+		return -1;
+	*dev = p + 1;
+
+	return 0;
+}
+
+static uint64_t
+load_since_tid(const char *path, const char *devpath)
+{
+	FILE *fp;
+	char line[PATH_MAX + 32], *dev;
+	uint64_t tid = 0, t;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT) {
+			perror(path);
+			exit(1);
+		}
+		return 0; /* first run, check everything */
+	}
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (parse_tid_line(line, &t, &dev) == 0 &&
+		    !strcmp(dev, devpath))
+			tid = t;
+	fclose(fp);
+
+	return tid;
+}
+
+static void
+save_since_tid(const char *path, const char *devpath, uint64_t tid)
+{
+	FILE *fp, *tfp;
+	char line[PATH_MAX + 32], tmp[PATH_MAX + 32], tpath[PATH_MAX], *dev;
+	uint64_t t;
+
+	snprintf(tpath, sizeof(tpath), "%s.tmp", path);
+	tfp = fopen(tpath, "w");
+	if (tfp == NULL) {
+		perror(tpath);
+		exit(1);
+	}
+	fp = fopen(path, "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			strlcpy(tmp, line, sizeof(tmp));
+			if (parse_tid_line(tmp, &t, &dev) == 0 &&
+			    !strcmp(dev, devpath))
+				continue;
+			fputs(line, tfp);
+		}
+		fclose(fp);
+	}
+	fprintf(tfp, "%016jx %s\n", (uintmax_t)tid, devpath);
+	if (fclose(tfp) == EOF || rename(tpath, path) == -1) {
+		perror(tpath);
+		exit(1);
+	}
+}
+
 static void
 usage(void)
 {
-	fprintf(stderr, "fsck_hammer2 [-f] [-v] [-q] [-e] [-b] [-p] [-P] "
-	    "[-l pfs_names] [-c cache_count] special\n");
+	fprintf(stderr, "fsck_hammer2 [-f] [-v] [-q] [-e] [-b] [-p] [-P] [-x] "
+	    "[-l pfs_names] [-c cache_count] [-j nthreads] "
+	    "[-m cache_size] [-M memo_size] [-o json|kv] [-t tid] "
+	    "[-T tid_file] special\n");
 	exit(1);
 }
 
 int
 main(int ac, char **av)
 {
+	const char *tid_file = NULL;
+	char *p;
 	int i, ch;
 
-	while ((ch = getopt(ac, av, "dfvqebpPl:c:")) != -1) {
+	while ((ch = getopt(ac, av, "dfvqebpPxl:c:j:m:M:o:t:T:")) != -1) {
 		switch(ch) {
 		case 'd':
 			DebugOpt++;
@@ -144,6 +229,9 @@ main(int ac, char **av)
 		case 'P':
 			PrintPFS = 1;
 			break;
+		case 'x':
+			FreemapCheck = 1;
+			break;
 		case 'l':
 			init_pfs_names(optarg);
 			break;
@@ -157,6 +245,48 @@ main(int ac, char **av)
 				exit(1);
 			}
 			break;
+		case 'j':
+			NumThreads = strtol(optarg, NULL, 10);
+			if (NumThreads < 1 || NumThreads > 256) {
+				fprintf(stderr, "Invalid thread count %s\n",
+				    optarg);
+				exit(1);
+			}
+			break;
+		case 'm':
+			MediaCacheSize = strtol(optarg, NULL, 10);
+			if (MediaCacheSize < 0) {
+				fprintf(stderr, "Invalid cache size %s\n",
+				    optarg);
+				exit(1);
+			}
+			break;
+		case 'M':
+			MemoSize = strtol(optarg, NULL, 10);
+			if (MemoSize < 0) {
+				fprintf(stderr, "Invalid memo size %s\n",
+				    optarg);
+				exit(1);
+			}
+			break;
+		case 'o':
+			if (!strcmp(optarg, "json"))
+				ReportFormat = REPORT_JSON;
+			else if (!strcmp(optarg, "kv"))
+				ReportFormat = REPORT_KV;
+			else
+				usage();
+			break;
+		case 't':
+			SinceTid = strtoull(optarg, &p, 0);
+			if (*p != 0 || SinceTid == 0) {
+				fprintf(stderr, "Invalid tid %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'T':
+			tid_file = optarg;
+			break;
 		default:
 			usage();
 			/* not reached */
@@ -171,11 +301,31 @@ main(int ac, char **av)
 		/* not reached */
 	}
 
+	/*
+	 * The report takes over stdout, the regular output goes to stderr.
+	 */
+	if (ReportFormat != REPORT_NONE) {
+		ReportFp = fdopen(dup(STDOUT_FILENO), "w");
+		if (ReportFp == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+			perror("dup");
+			exit(1);
+		}
+	}
+
 	for (i = 0; i < ac; i++) {
+		uint64_t since_tid = SinceTid;
+
 		if (ac != 1)
 			printf("%s\n", av[i]);
+		if (tid_file && since_tid == 0)
+			SinceTid = load_since_tid(tid_file, av[i]);
+		if (SinceTid)
+			printf("since tid 0x%016jx\n", (uintmax_t)SinceTid);
 		if (test_hammer2(av[i]) == -1)
 			exit(1);
+		if (tid_file && VerifiedTid)
+			save_since_tid(tid_file, av[i], VerifiedTid);
+		SinceTid = since_tid;
 		if (i != ac - 1)
 			printf("----------------------------------------"
 			       "----------------------------------------\n");
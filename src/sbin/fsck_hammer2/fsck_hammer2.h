@@ -50,7 +50,26 @@ extern int PrintPFS;
 extern int NumPFSNames;
 extern char **PFSNames;
 extern long BlockrefCacheCount;
+extern int NumThreads;
+extern long MediaCacheSize;
+extern long MemoSize;
+extern int FreemapCheck;
+extern int ReportFormat;
+extern uint64_t SinceTid;
+extern uint64_t VerifiedTid;
+extern FILE *ReportFp;
+
+#define REPORT_NONE	0
+#define REPORT_JSON	1
+#define REPORT_KV	2
 
 int test_hammer2(const char *);
 
+void report_set_device(const char *);
+void report_begin(const char *);
+void report_string(const char *, const char *);
+void report_uint(const char *, uint64_t);
+void report_double(const char *, double);
+void report_end(void);
+
 #endif /* !FSCK_HAMMER2_H_ */
@@ -0,0 +1,158 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2019 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2019 The DragonFly Project
+ * All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Machine-readable report.  Each record is written as one line, either a
+ * JSON object or space separated key=value pairs, so that the output of
+ * several devices can be concatenated and parsed line by line.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fsck_hammer2.h"
+
+FILE *ReportFp;
+
+static const char *report_device = "";
+static bool report_first;
+
+void
+report_set_device(const char *devpath)
+{
+	report_device = devpath;
+}
+
+static void
+report_key(const char *key)
+{
+	switch (ReportFormat) {
+	case REPORT_JSON:
+		fprintf(ReportFp, "%s\"%s\":", report_first ? "" : ",", key);
+		break;
+	case REPORT_KV:
+		fprintf(ReportFp, "%s%s=", report_first ? "" : " ", key);
+		break;
+	}
+	report_first = false;
+}
+
+void
+report_string(const char *key, const char *val)
+{
+	const unsigned char *p;
+
+	if (ReportFp == NULL)
+		return;
+	report_key(key);
+
+	switch (ReportFormat) {
+	case REPORT_JSON:
+		fputc('"', ReportFp);
+		for (p = (const unsigned char *)val; *p; ++p) {
+			if (*p == '"' || *p == '\\')
+				fprintf(ReportFp, "\\%c", *p);
+			else if (*p < 0x20)
+				fprintf(ReportFp, "\\u%04x", *p);
+			else
+				fputc(*p, ReportFp);
+		}
+		fputc('"', ReportFp);
+		break;
+	case REPORT_KV:
+		/* quote values which would break the line up */
+		if (val[0] == '\0' || strpbrk(val, " \t\n\"=\\")) {
+			fputc('"', ReportFp);
+			for (p = (const unsigned char *)val; *p; ++p) {
+				if (*p == '"' || *p == '\\')
+					fputc('\\', ReportFp);
+				if (*p == '\n')
+					fputs("\\n", ReportFp);
+				else
+					fputc(*p, ReportFp);
+			}
+			fputc('"', ReportFp);
+		} else {
+			fputs(val, ReportFp);
+		}
+		break;
+	}
+}
+
+void
+report_uint(const char *key, uint64_t val)
+{
+	if (ReportFp == NULL)
+		return;
+	report_key(key);
+	fprintf(ReportFp, "%ju", (uintmax_t)val);
+}
+
+void
+report_double(const char *key, double val)
+{
+	if (ReportFp == NULL)
+		return;
+	report_key(key);
+	fprintf(ReportFp, "%.6f", val);
+}
+
+void
+report_begin(const char *record)
+{
+	if (ReportFp == NULL)
+		return;
+	if (ReportFormat == REPORT_JSON)
+		fputc('{', ReportFp);
+	report_first = true;
+	report_string("record", record);
+	report_string("device", report_device);
+}
+
+void
+report_end(void)
+{
+	if (ReportFp == NULL)
+		return;
+	if (ReportFormat == REPORT_JSON)
+		fputc('}', ReportFp);
+	fputc('\n', ReportFp);
+	fflush(ReportFp);
+}
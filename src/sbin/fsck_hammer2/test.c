@@ -43,6 +43,7 @@
 #include <sys/ttycom.h>
 #include <sys/disk.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -52,6 +53,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <openssl/sha.h>
 
@@ -89,11 +92,16 @@ RB_HEAD(blockref_tree, blockref_entry);
 RB_PROTOTYPE(blockref_tree, blockref_entry, entry, blockref_cmp);
 RB_GENERATE(blockref_tree, blockref_entry, entry, blockref_cmp);
 
+#define STATS_NTYPES	(HAMMER2_BREF_TYPE_INVALID + 1)
+#define STATS_NCOMP	(HAMMER2_COMP_ZLIB + 1)
+#define STATS_NCHECK	(HAMMER2_CHECK_FREEMAP + 1)
+
 typedef struct {
 	struct blockref_tree root;
 	uint8_t type; /* HAMMER2_BREF_TYPE_VOLUME or FREEMAP */
 	uint64_t total_blockref;
 	uint64_t total_empty;
+	uint64_t total_pruned;
 	uint64_t total_bytes;
 	union {
 		/* use volume or freemap depending on type value */
@@ -108,11 +116,15 @@ typedef struct {
 			uint64_t total_freemap_leaf;
 		} freemap;
 	};
+	uint64_t type_bytes[STATS_NTYPES];
+	uint64_t comp_bytes[STATS_NCOMP];
+	uint64_t check_failures[STATS_NCHECK];
 } blockref_stats_t;
 
 typedef struct {
 	uint64_t total_blockref;
 	uint64_t total_empty;
+	uint64_t total_pruned;
 	uint64_t total_bytes;
 	struct {
 		uint64_t total_inode;
@@ -124,20 +136,102 @@ typedef struct {
 		uint64_t total_freemap_node;
 		uint64_t total_freemap_leaf;
 	} freemap;
+	uint64_t type_bytes[STATS_NTYPES];
+	uint64_t comp_bytes[STATS_NCOMP];
 	long count;
 } delta_stats_t;
 
+/*
+ * A subtree handed to the verifier thread pool.  Each task accumulates
+ * into its own blockref_stats_t/delta_stats_t, which the submitter merges
+ * in index order once the task has completed, so that the result and the
+ * error report do not depend on thread scheduling.
+ */
+typedef struct verify_task {
+	TAILQ_ENTRY(verify_task) entry;
+	struct verify_task *last;	/* cancelled up to here on failure */
+	hammer2_blockref_t bref;
+	blockref_stats_t bstats;
+	delta_stats_t dstats;
+	bool norecurse;
+	int depth;
+	int index;
+	int state;
+	int error;
+} verify_task_t;
+
+#define VERIFY_TASK_INIT	0
+#define VERIFY_TASK_QUEUED	1
+#define VERIFY_TASK_RUNNING	2
+#define VERIFY_TASK_DONE	3
+
+#define VERIFY_THREAD_STACK	(8 * 1024 * 1024)
+
+TAILQ_HEAD(verify_task_list, verify_task);
+
+typedef struct media_buf {
+	TAILQ_ENTRY(media_buf) entry;
+	struct media_buf *next;
+	hammer2_off_t off;	/* physical 64KB block, or MEDIA_OFF_INVALID */
+	size_t len;
+	int refs;
+	char data[HAMMER2_PBUFSIZE];
+} media_buf_t;
+
+TAILQ_HEAD(media_buf_list, media_buf);
+
+#define MEDIA_OFF_INVALID	((hammer2_off_t)-1)
+#define MEDIA_HASH_SIZE		65536
+#define MEDIA_HASH(off)		(((off) >> HAMMER2_PBUFRADIX) & \
+				    (MEDIA_HASH_SIZE - 1))
+#define MEDIA_READAHEAD_MAX	32	/* 2MB */
+
+/*
+ * Memo of verified subtrees.  A subtree is identified by the physical block
+ * and the check code the parent expects it to have, so that the same subtree
+ * reached from another volume header zone or another PFS (e.g. a snapshot)
+ * only replays its delta_stats_t instead of being verified again.
+ */
+#define MEMO_CHECK_SIZE	sizeof(((hammer2_blockref_t *)0)->check)
+
+typedef struct {
+	hammer2_off_t data_off;
+	uint8_t type;
+	uint8_t methods;
+	uint8_t referenced;	/* CLOCK reference bit */
+	int32_t next;		/* hash chain, -1 terminated */
+	char check[MEMO_CHECK_SIZE];
+	delta_stats_t dstats;
+} memo_entry_t;
+
 static void print_blockref_entry(struct blockref_tree *);
 static void init_blockref_stats(blockref_stats_t *, uint8_t);
 static void cleanup_blockref_stats(blockref_stats_t *);
-static void init_delta_root(struct blockref_tree *);
-static void cleanup_delta_root(struct blockref_tree *);
+static void init_memo(void);
+static void cleanup_memo(void);
+static void print_memo_stats(void);
 static void print_blockref_stats(const blockref_stats_t *, bool);
 static int verify_volume_header(const hammer2_volume_data_t *);
 static int read_media(const hammer2_blockref_t *, hammer2_media_data_t *,
     size_t *);
 static int verify_blockref(const hammer2_blockref_t *, bool, blockref_stats_t *,
-    struct blockref_tree *, delta_stats_t *, int, int);
+    delta_stats_t *, int, int);
+static void init_media_cache(void);
+static void cleanup_media_cache(void);
+static void print_media_stats(void);
+static void readahead_media(const hammer2_blockref_t *, int);
+static void merge_blockref_stats(blockref_stats_t *, blockref_stats_t *);
+static void init_verify_pool(void);
+static void cleanup_verify_pool(void);
+static bool want_verify_tasks(const hammer2_blockref_t *, int);
+static int verify_children(const hammer2_blockref_t *, int, bool,
+    blockref_stats_t *, delta_stats_t *, int);
+static void init_verify_task(verify_task_t *, const hammer2_blockref_t *,
+    uint8_t, bool, int, int);
+static void run_verify_tasks(verify_task_t *, int, bool);
+static int test_freemap_consistency(void);
+static void report_blockref_stats(uint8_t, int, const char *,
+    const blockref_stats_t *, int);
 static void print_pfs(const hammer2_inode_data_t *);
 static char *get_inode_filename(const hammer2_inode_data_t *);
 static int init_pfs_blockref(const hammer2_blockref_t *,
@@ -148,6 +242,41 @@ static void print_media(FILE *, int, const hammer2_blockref_t *,
 
 static int best_zone = -1;
 
+static pthread_t *verify_threads;
+static struct verify_task_list verify_queue =
+    TAILQ_HEAD_INITIALIZER(verify_queue);
+static pthread_mutex_t verify_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t verify_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t verify_done_cond = PTHREAD_COND_INITIALIZER;
+static int verify_queued;
+static bool verify_exit;
+
+static media_buf_t **media_hash;
+static struct media_buf_list media_lru = TAILQ_HEAD_INITIALIZER(media_lru);
+static pthread_mutex_t media_lock = PTHREAD_MUTEX_INITIALIZER;
+static long media_nbufs;
+static long media_maxbufs;
+static struct {
+	uint64_t syscalls;
+	uint64_t bytes;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t readahead;
+} media_stats;
+
+static memo_entry_t *memo_table;
+static int32_t *memo_hash;
+static int32_t memo_size;	/* entries, power of 2 */
+static int32_t memo_count;
+static int32_t memo_hand;
+static pthread_mutex_t memo_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t inserts;
+	uint64_t evictions;
+} memo_stats;
+
 #define TAB 8
 
 static void
@@ -188,21 +317,33 @@ tprintf_zone(int tab, int i, const hammer2_blockref_t *bref)
 	    (!ScanBest && i == best_zone) ? " (best)" : "");
 }
 
-static int
+static void
 init_root_blockref(int i, uint8_t type, hammer2_blockref_t *bref)
 {
-	hammer2_off_t off;
-
 	assert(type == HAMMER2_BREF_TYPE_EMPTY ||
 		type == HAMMER2_BREF_TYPE_VOLUME ||
 		type == HAMMER2_BREF_TYPE_FREEMAP);
 	memset(bref, 0, sizeof(*bref));
 	bref->type = type;
 	bref->data_off = (i * HAMMER2_ZONE_BYTES64) | HAMMER2_PBUFRADIX;
-	off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
+}
 
-	return lseek(hammer2_get_root_volume_fd(),
-	    off - hammer2_get_root_volume_offset(), SEEK_SET);
+static ssize_t
+read_volume_header(int i, hammer2_volume_data_t *voldata)
+{
+	ssize_t ret;
+
+	ret = pread(hammer2_get_root_volume_fd(), voldata,
+	    HAMMER2_VOLUME_BYTES,
+	    i * HAMMER2_ZONE_BYTES64 - hammer2_get_root_volume_offset());
+
+	pthread_mutex_lock(&media_lock);
+	media_stats.syscalls++;
+	if (ret > 0)
+		media_stats.bytes += ret;
+	pthread_mutex_unlock(&media_lock);
+
+	return ret;
 }
 
 static int
@@ -222,8 +363,7 @@ find_best_zone(void)
 		    hammer2_get_root_volume_size())
 			break;
 		init_root_blockref(i, HAMMER2_BREF_TYPE_EMPTY, &broot);
-		ret = read(hammer2_get_root_volume_fd(), &voldata,
-		    HAMMER2_VOLUME_BYTES);
+		ret = read_volume_header(i, &voldata);
 		if (ret == HAMMER2_VOLUME_BYTES) {
 			if ((voldata.magic != HAMMER2_VOLUME_ID_HBO) &&
 			    (voldata.magic != HAMMER2_VOLUME_ID_ABO))
@@ -234,7 +374,7 @@ find_best_zone(void)
 				best = broot;
 			}
 		} else if (ret == -1) {
-			perror("read");
+			perror("pread");
 			return -1;
 		} else {
 			tfprintf(stderr, 1, "Failed to read volume header\n");
@@ -245,6 +385,22 @@ find_best_zone(void)
 	return best_i;
 }
 
+/*
+ * The highest tid of the best zone, later checks with -T only need to
+ * verify blocks modified after this.
+ */
+static uint64_t
+get_verified_tid(int i)
+{
+	hammer2_volume_data_t voldata;
+
+	if (read_volume_header(i, &voldata) != HAMMER2_VOLUME_BYTES)
+		return 0;
+	if (voldata.freemap_tid > voldata.mirror_tid)
+		return voldata.freemap_tid;
+	return voldata.mirror_tid;
+}
+
 static int
 test_volume_header(void)
 {
@@ -264,14 +420,13 @@ test_volume_header(void)
 			break;
 		}
 		init_root_blockref(i, HAMMER2_BREF_TYPE_EMPTY, &broot);
-		ret = read(hammer2_get_root_volume_fd(), &voldata,
-		    HAMMER2_VOLUME_BYTES);
+		ret = read_volume_header(i, &voldata);
 		if (ret == HAMMER2_VOLUME_BYTES) {
 			tprintf_zone(0, i, &broot);
 			if (verify_volume_header(&voldata) == -1)
 				failed = true;
 		} else if (ret == -1) {
-			perror("read");
+			perror("pread");
 			return -1;
 		} else {
 			tfprintf(stderr, 1, "Failed to read volume header\n");
@@ -285,14 +440,30 @@ test_volume_header(void)
 static int
 test_blockref(uint8_t type)
 {
-	struct blockref_tree droot;
+	verify_task_t *tasks;
 	bool failed = false;
-	int i;
+	int i, n = 0;
 
-	init_delta_root(&droot);
+	tasks = calloc(HAMMER2_NUM_VOLHDRS, sizeof(*tasks));
+	assert(tasks);
 	for (i = 0; i < HAMMER2_NUM_VOLHDRS; ++i) {
 		hammer2_blockref_t broot;
 
+		if (ScanBest && i != best_zone)
+			continue;
+		if (i * HAMMER2_ZONE_BYTES64 >=
+		    hammer2_get_root_volume_size())
+			break;
+		init_root_blockref(i, type, &broot);
+		init_verify_task(&tasks[n++], &broot, type, false, 0, i);
+	}
+
+	/* zones are verified concurrently, but reported in order */
+	if (NumThreads > 1)
+		run_verify_tasks(tasks, n, false);
+	for (i = 0, n = 0; i < HAMMER2_NUM_VOLHDRS; ++i) {
+		verify_task_t *t;
+
 		if (ScanBest && i != best_zone)
 			continue;
 		if (i * HAMMER2_ZONE_BYTES64 >=
@@ -300,37 +471,36 @@ test_blockref(uint8_t type)
 			tfprintf(stderr, 0, "zone.%d exceeds volume size\n", i);
 			break;
 		}
-		init_root_blockref(i, type, &broot);
-		blockref_stats_t bstats;
-		init_blockref_stats(&bstats, type);
-		delta_stats_t ds;
-		memset(&ds, 0, sizeof(ds));
-		tprintf_zone(0, i, &broot);
-		if (verify_blockref(&broot, false, &bstats, &droot, &ds, 0, 0)
-		    == -1)
+		t = &tasks[n++];
+		tprintf_zone(0, t->index, &t->bref);
+		if (NumThreads <= 1)
+			run_verify_tasks(t, 1, false);
+		if (t->error == -1)
 			failed = true;
-		print_blockref_stats(&bstats, true);
-		print_blockref_entry(&bstats.root);
-		cleanup_blockref_stats(&bstats);
+		print_blockref_stats(&t->bstats, true);
+		report_blockref_stats(type, t->index, NULL, &t->bstats,
+		    t->error);
+		print_blockref_entry(&t->bstats.root);
+		cleanup_blockref_stats(&t->bstats);
 	}
-	cleanup_delta_root(&droot);
+	free(tasks);
 	return failed ? -1 : 0;
 }
 
 static int
 test_pfs_blockref(void)
 {
-	struct blockref_tree droot;
 	uint8_t type = HAMMER2_BREF_TYPE_VOLUME;
 	bool failed = false;
 	int i;
 
-	init_delta_root(&droot);
 	for (i = 0; i < HAMMER2_NUM_VOLHDRS; ++i) {
 		hammer2_blockref_t broot;
 		struct blockref_list blist;
 		struct blockref_msg *p;
-		int count = 0;
+		verify_task_t *tasks;
+		char **names;
+		int j, n, ntasks, count = 0;
 
 		if (ScanBest && i != best_zone)
 			continue;
@@ -352,8 +522,14 @@ test_pfs_blockref(void)
 			failed = true;
 			continue;
 		}
+		ntasks = 0;
+		TAILQ_FOREACH(p, &blist, entry)
+			ntasks++;
+		tasks = calloc(ntasks, sizeof(*tasks));
+		names = calloc(ntasks, sizeof(*names));
+		assert(tasks && names);
+		n = 0;
 		TAILQ_FOREACH(p, &blist, entry) {
-			blockref_stats_t bstats;
 			bool found = false;
 			char *f = get_inode_filename(p->msg);
 			if (NumPFSNames) {
@@ -373,25 +549,37 @@ test_pfs_blockref(void)
 				free(f);
 				continue;
 			}
-			tfprintf(stdout, 1, "%s\n", f);
-			free(f);
-			init_blockref_stats(&bstats, type);
-			delta_stats_t ds;
-			memset(&ds, 0, sizeof(ds));
-			if (verify_blockref(&p->bref, false, &bstats, &droot,
-			    &ds, 0, 0) == -1)
+			names[n] = f;
+			init_verify_task(&tasks[n++], &p->bref, type, false,
+			    0, 0);
+		}
+
+		/* PFSs are verified concurrently, but reported in order */
+		if (NumThreads > 1)
+			run_verify_tasks(tasks, n, false);
+		for (j = 0; j < n; ++j) {
+			verify_task_t *t = &tasks[j];
+
+			tfprintf(stdout, 1, "%s\n", names[j]);
+			if (NumThreads <= 1)
+				run_verify_tasks(t, 1, false);
+			if (t->error == -1)
 				failed = true;
-			print_blockref_stats(&bstats, true);
-			print_blockref_entry(&bstats.root);
-			cleanup_blockref_stats(&bstats);
+			print_blockref_stats(&t->bstats, true);
+			report_blockref_stats(type, i, names[j], &t->bstats,
+			    t->error);
+			free(names[j]);
+			print_blockref_entry(&t->bstats.root);
+			cleanup_blockref_stats(&t->bstats);
 		}
+		free(names);
+		free(tasks);
 		cleanup_pfs_blockref(&blist);
 		if (NumPFSNames && !count) {
 			tfprintf(stderr, 1, "PFS not found\n");
 			failed = true;
 		}
 	}
-	cleanup_delta_root(&droot);
 	return failed ? -1 : 0;
 }
 
@@ -558,15 +746,140 @@ cleanup_blockref_stats(blockref_stats_t *bstats)
 }
 
 static void
-init_delta_root(struct blockref_tree *droot)
+init_memo(void)
 {
-	RB_INIT(droot);
+	int32_t i;
+
+	memset(&memo_stats, 0, sizeof(memo_stats));
+	memo_count = 0;
+	memo_hand = 0;
+	if (BlockrefCacheCount <= 0 || MemoSize <= 0) {
+		memo_size = 0;
+		return;
+	}
+
+	memo_size = 1;
+	while ((long)memo_size * 2 * (sizeof(*memo_table) + sizeof(*memo_hash))
+	    <= MemoSize * 1024 * 1024 && memo_size < (1 << 30))
+		memo_size <<= 1;
+	memo_table = calloc(memo_size, sizeof(*memo_table));
+	memo_hash = calloc(memo_size, sizeof(*memo_hash));
+	assert(memo_table && memo_hash);
+	for (i = 0; i < memo_size; ++i)
+		memo_hash[i] = -1;
 }
 
 static void
-cleanup_delta_root(struct blockref_tree *droot)
+cleanup_memo(void)
 {
-	cleanup_blockref_entry(droot);
+	free(memo_table);
+	free(memo_hash);
+	memo_table = NULL;
+	memo_hash = NULL;
+	memo_size = 0;
+}
+
+static void
+print_memo_stats(void)
+{
+	printf("subtree memo: %d/%d entries, %ju/%ju hits, %ju inserts, "
+	    "%ju evictions\n",
+	    memo_count, memo_size,
+	    (uintmax_t)memo_stats.hits,
+	    (uintmax_t)(memo_stats.hits + memo_stats.misses),
+	    (uintmax_t)memo_stats.inserts,
+	    (uintmax_t)memo_stats.evictions);
+}
+
+static int32_t
+memo_hashval(hammer2_off_t data_off, const void *check)
+{
+	uint64_t h;
+
+	h = XXH64(check, MEMO_CHECK_SIZE, data_off);
+	return (int32_t)(h & (memo_size - 1));
+}
+
+static bool
+memo_match(const memo_entry_t *me, const hammer2_blockref_t *bref)
+{
+	return me->data_off == bref->data_off &&
+	    me->type == bref->type &&
+	    me->methods == bref->methods &&
+	    !memcmp(me->check, &bref->check, MEMO_CHECK_SIZE);
+}
+
+/*
+ * Look up a verified subtree and add its delta to dstats.  Called with
+ * memo_lock held.
+ */
+static bool
+memo_lookup(const hammer2_blockref_t *bref, delta_stats_t *dstats)
+{
+	memo_entry_t *me;
+	int32_t i;
+
+	i = memo_hash[memo_hashval(bref->data_off, &bref->check)];
+	for (; i != -1; i = me->next) {
+		me = &memo_table[i];
+		if (memo_match(me, bref)) {
+			me->referenced = 1;
+			*dstats = me->dstats;
+			memo_stats.hits++;
+			return true;
+		}
+	}
+	memo_stats.misses++;
+
+	return false;
+}
+
+/*
+ * Enter a verified subtree, evicting the first entry the CLOCK hand finds
+ * without its reference bit set once the table is full.  Called with
+ * memo_lock held.
+ */
+static void
+memo_enter(const hammer2_blockref_t *bref, const delta_stats_t *dstats)
+{
+	memo_entry_t *me;
+	int32_t i, *ip, h;
+
+	h = memo_hashval(bref->data_off, &bref->check);
+	for (i = memo_hash[h]; i != -1; i = memo_table[i].next)
+		if (memo_match(&memo_table[i], bref))
+			return; /* entered by another thread */
+
+	if (memo_count < memo_size) {
+		i = memo_count++;
+	} else {
+		for (;;) {
+			me = &memo_table[memo_hand];
+			if (me->referenced == 0)
+				break;
+			me->referenced = 0;
+			memo_hand = (memo_hand + 1) & (memo_size - 1);
+		}
+		i = memo_hand;
+		memo_hand = (memo_hand + 1) & (memo_size - 1);
+
+		ip = &memo_hash[memo_hashval(me->data_off, me->check)];
+		while (*ip != i)
+			ip = &memo_table[*ip].next;
+		*ip = me->next;
+		memo_stats.evictions++;
+	}
+
+	me = &memo_table[i];
+	me->data_off = bref->data_off;
+	me->type = bref->type;
+	me->methods = bref->methods;
+	me->referenced = 0;
+	memcpy(me->check, &bref->check, MEMO_CHECK_SIZE);
+	me->dstats = *dstats;
+	me->next = memo_hash[h];
+	memo_hash[h] = i;
+	memo_stats.inserts++;
 }
 
 static void
@@ -583,6 +896,10 @@ print_blockref_stats(const blockref_stats_t *bstats, bool newline)
 		    (uintmax_t)bstats->total_empty);
 	else
 		strlcpy(emptybuf, "", sizeof(emptybuf));
+	if (SinceTid)
+		snprintf(emptybuf + strlen(emptybuf),
+		    sizeof(emptybuf) - strlen(emptybuf), ", %ju pruned",
+		    (uintmax_t)bstats->total_pruned);
 
 	switch (bstats->type) {
 	case HAMMER2_BREF_TYPE_VOLUME:
@@ -661,13 +978,292 @@ verify_volume_header(const hammer2_volume_data_t *voldata)
 	return 0;
 }
 
+/*
+ * Media cache.  Physical 64KB blocks are cached in LRU order so that
+ * small blockrefs sharing a physical block are read from the media once,
+ * and children of a node are read ahead in data_off order.
+ */
+static media_buf_t *
+lookup_media_buf(hammer2_off_t off)
+{
+	media_buf_t *mb;
+
+	for (mb = media_hash[MEDIA_HASH(off)]; mb; mb = mb->next)
+		if (mb->off == off)
+			return mb;
+	return NULL;
+}
+
+static void
+unhash_media_buf(media_buf_t *mb)
+{
+	media_buf_t **mbp;
+
+	mbp = &media_hash[MEDIA_HASH(mb->off)];
+	while (*mbp != mb)
+		mbp = &(*mbp)->next;
+	*mbp = mb->next;
+	mb->next = NULL;
+	mb->off = MEDIA_OFF_INVALID;
+}
+
+/*
+ * Get an unreferenced buffer, either newly allocated or the least recently
+ * used one.  The buffer is removed from the LRU and returned referenced.
+ */
+static media_buf_t *
+alloc_media_buf(void)
+{
+	media_buf_t *mb;
+
+	if (media_nbufs < media_maxbufs) {
+		mb = calloc(1, sizeof(*mb));
+		assert(mb);
+		mb->off = MEDIA_OFF_INVALID;
+		media_nbufs++;
+	} else {
+		TAILQ_FOREACH_REVERSE(mb, &media_lru, media_buf_list, entry)
+			if (mb->refs == 0)
+				break;
+		assert(mb); /* at most one buffer per thread is referenced */
+		TAILQ_REMOVE(&media_lru, mb, entry);
+		if (mb->off != MEDIA_OFF_INVALID)
+			unhash_media_buf(mb);
+	}
+	mb->refs = 1;
+
+	return mb;
+}
+
+/*
+ * Return a buffer from alloc_media_buf() which could not be filled.
+ */
+static void
+release_media_buf(media_buf_t *mb)
+{
+	assert(mb->refs == 1 && mb->off == MEDIA_OFF_INVALID);
+	mb->refs = 0;
+	TAILQ_INSERT_TAIL(&media_lru, mb, entry);
+}
+
+/*
+ * Enter a buffer filled by the caller, or release it in favor of one
+ * another thread entered for the same offset meanwhile.
+ */
+static media_buf_t *
+enter_media_buf(media_buf_t *mb, hammer2_off_t off, size_t len)
+{
+	media_buf_t *mb2;
+
+	if ((mb2 = lookup_media_buf(off)) != NULL) {
+		release_media_buf(mb);
+		mb2->refs++;
+		TAILQ_REMOVE(&media_lru, mb2, entry);
+		TAILQ_INSERT_HEAD(&media_lru, mb2, entry);
+		return mb2;
+	}
+	mb->off = off;
+	mb->len = len;
+	mb->next = media_hash[MEDIA_HASH(off)];
+	media_hash[MEDIA_HASH(off)] = mb;
+	TAILQ_INSERT_HEAD(&media_lru, mb, entry);
+
+	return mb;
+}
+
+static void
+init_media_cache(void)
+{
+	media_maxbufs = MediaCacheSize * 1024 * 1024 / HAMMER2_PBUFSIZE;
+	if (media_maxbufs < NumThreads * 2 + MEDIA_READAHEAD_MAX)
+		media_maxbufs = NumThreads * 2 + MEDIA_READAHEAD_MAX;
+	media_nbufs = 0;
+	media_hash = calloc(MEDIA_HASH_SIZE, sizeof(*media_hash));
+	assert(media_hash);
+	TAILQ_INIT(&media_lru);
+	memset(&media_stats, 0, sizeof(media_stats));
+}
+
+static void
+cleanup_media_cache(void)
+{
+	media_buf_t *mb;
+
+	while ((mb = TAILQ_FIRST(&media_lru)) != NULL) {
+		TAILQ_REMOVE(&media_lru, mb, entry);
+		free(mb);
+	}
+	free(media_hash);
+	media_hash = NULL;
+}
+
+static void
+print_media_stats(void)
+{
+	uint64_t lookups = media_stats.hits + media_stats.misses;
+
+	printf("media cache: %ju syscalls, %s read, %ju/%ju hits (%.1f%%), "
+	    "%ju readahead\n",
+	    (uintmax_t)media_stats.syscalls,
+	    sizetostr(media_stats.bytes),
+	    (uintmax_t)media_stats.hits,
+	    (uintmax_t)lookups,
+	    lookups ? (double)media_stats.hits * 100 / lookups : 0.0,
+	    (uintmax_t)media_stats.readahead);
+}
+
+/*
+ * Return the referenced buffer for the physical 64KB block at off, reading
+ * it from the media if it isn't cached.  len is the number of valid bytes,
+ * which is less than 64KB only at the end of a volume.
+ */
+static media_buf_t *
+get_media_buf(hammer2_off_t off)
+{
+	media_buf_t *mb;
+	ssize_t ret;
+	int fd;
+
+	pthread_mutex_lock(&media_lock);
+	if ((mb = lookup_media_buf(off)) != NULL) {
+		mb->refs++;
+		TAILQ_REMOVE(&media_lru, mb, entry);
+		TAILQ_INSERT_HEAD(&media_lru, mb, entry);
+		media_stats.hits++;
+		pthread_mutex_unlock(&media_lock);
+		return mb;
+	}
+	media_stats.misses++;
+	mb = alloc_media_buf();
+	pthread_mutex_unlock(&media_lock);
+
+	fd = hammer2_get_volume_fd(off);
+	ret = pread(fd, mb->data, HAMMER2_PBUFSIZE,
+	    off - hammer2_get_volume_offset(off));
+
+	pthread_mutex_lock(&media_lock);
+	media_stats.syscalls++;
+	if (ret <= 0) {
+		release_media_buf(mb);
+		mb = NULL;
+	} else {
+		media_stats.bytes += ret;
+		mb = enter_media_buf(mb, off, ret);
+	}
+	pthread_mutex_unlock(&media_lock);
+
+	return mb;
+}
+
+static void
+put_media_buf(media_buf_t *mb)
+{
+	pthread_mutex_lock(&media_lock);
+	assert(mb->refs > 0);
+	mb->refs--;
+	pthread_mutex_unlock(&media_lock);
+}
+
+static int
+cmp_off(const void *a, const void *b)
+{
+	hammer2_off_t off1 = *(const hammer2_off_t *)a;
+	hammer2_off_t off2 = *(const hammer2_off_t *)b;
+
+	if (off1 < off2)
+		return -1;
+	if (off1 > off2)
+		return 1;
+	return 0;
+}
+
+/*
+ * Read ahead the physical blocks of the children of a node before they
+ * are verified.  Blocks are sorted by data_off and contiguous runs which
+ * aren't cached yet are read with a single preadv(2) into cache buffers.
+ */
+static void
+readahead_media(const hammer2_blockref_t *bscan, int bcount)
+{
+	hammer2_off_t offs[HAMMER2_IND_COUNT_MAX];
+	media_buf_t *mbs[MEDIA_READAHEAD_MAX];
+	struct iovec iov[MEDIA_READAHEAD_MAX];
+	hammer2_off_t off, voff;
+	ssize_t ret;
+	int i, j, k, m, n = 0;
+
+	assert(bcount <= HAMMER2_IND_COUNT_MAX);
+	for (i = 0; i < bcount; ++i) {
+		if (bscan[i].type == HAMMER2_BREF_TYPE_EMPTY ||
+		    (bscan[i].data_off & HAMMER2_OFF_MASK_RADIX) == 0)
+			continue;
+		off = bscan[i].data_off & ~HAMMER2_OFF_MASK_RADIX;
+		offs[n++] = off & ~HAMMER2_PBUFMASK64;
+	}
+	if (n < 2)
+		return;
+	qsort(offs, n, sizeof(*offs), cmp_off);
+
+	for (i = 0; i < n; i = j) {
+		/* collect the contiguous run of uncached blocks at offs[i] */
+		pthread_mutex_lock(&media_lock);
+		voff = hammer2_get_volume_offset(offs[i]);
+		j = i;
+		k = 0;
+		while (j < n && k < MEDIA_READAHEAD_MAX) {
+			off = offs[i] + k * HAMMER2_PBUFSIZE64;
+			if (offs[j] != off ||
+			    hammer2_get_volume_offset(off) != voff ||
+			    lookup_media_buf(off))
+				break;
+			mbs[k++] = alloc_media_buf();
+			while (j < n && offs[j] == off)
+				++j;
+		}
+		pthread_mutex_unlock(&media_lock);
+
+		if (k == 0) {
+			/* already cached */
+			for (j = i + 1; j < n && offs[j] == offs[i]; ++j)
+				;
+			continue;
+		}
+
+		assert(k > 0 && k <= MEDIA_READAHEAD_MAX);
+		for (m = 0; m < k; ++m) {
+			iov[m].iov_base = mbs[m]->data;
+			iov[m].iov_len = HAMMER2_PBUFSIZE;
+		}
+		ret = preadv(hammer2_get_volume_fd(offs[i]), iov, k,
+		    offs[i] - voff);
+
+		/* a short read leaves the rest to read_media() */
+		pthread_mutex_lock(&media_lock);
+		media_stats.syscalls++;
+		if (ret > 0)
+			media_stats.bytes += ret;
+		for (m = 0; m < k; ++m) {
+			if (ret >= (ssize_t)(m + 1) * HAMMER2_PBUFSIZE) {
+				off = offs[i] + m * HAMMER2_PBUFSIZE64;
+				mbs[m] = enter_media_buf(mbs[m], off,
+				    HAMMER2_PBUFSIZE);
+				mbs[m]->refs--;
+				media_stats.readahead++;
+			} else {
+				release_media_buf(mbs[m]);
+			}
+		}
+		pthread_mutex_unlock(&media_lock);
+	}
+}
+
 static int
 read_media(const hammer2_blockref_t *bref, hammer2_media_data_t *media,
     size_t *media_bytes)
 {
 	hammer2_off_t io_off, io_base;
-	size_t bytes, io_bytes, boff;
-	int fd;
+	size_t bytes, boff;
+	media_buf_t *mb;
 
 	bytes = (bref->data_off & HAMMER2_OFF_MASK_RADIX);
 	if (bytes)
@@ -679,23 +1275,19 @@ read_media(const hammer2_blockref_t *bref, hammer2_media_data_t *media,
 		return 0;
 
 	io_off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
-	io_base = io_off & ~(hammer2_off_t)(HAMMER2_LBUFSIZE - 1);
+	io_base = io_off & ~HAMMER2_PBUFMASK64;
 	boff = io_off - io_base;
 
-	io_bytes = HAMMER2_LBUFSIZE;
-	while (io_bytes + boff < bytes)
-		io_bytes <<= 1;
-
-	if (io_bytes > sizeof(*media))
+	if (boff + bytes > sizeof(*media))
 		return -1;
-	fd = hammer2_get_volume_fd(io_off);
-	if (lseek(fd, io_base - hammer2_get_volume_offset(io_base), SEEK_SET)
-	    == -1)
+	if ((mb = get_media_buf(io_base)) == NULL)
 		return -2;
-	if (read(fd, media, io_bytes) != (ssize_t)io_bytes)
+	if (boff + bytes > mb->len) {
+		put_media_buf(mb);
 		return -2;
-	if (boff)
-		memmove(media, (char *)media + boff, bytes);
+	}
+	memcpy(media, mb->data + boff, bytes);
+	put_media_buf(mb);
 
 	return 0;
 }
@@ -703,9 +1295,16 @@ read_media(const hammer2_blockref_t *bref, hammer2_media_data_t *media,
 static void
 load_delta_stats(blockref_stats_t *bstats, const delta_stats_t *dstats)
 {
+	int i;
+
 	bstats->total_blockref += dstats->total_blockref;
 	bstats->total_empty += dstats->total_empty;
+	bstats->total_pruned += dstats->total_pruned;
 	bstats->total_bytes += dstats->total_bytes;
+	for (i = 0; i < STATS_NTYPES; ++i)
+		bstats->type_bytes[i] += dstats->type_bytes[i];
+	for (i = 0; i < STATS_NCOMP; ++i)
+		bstats->comp_bytes[i] += dstats->comp_bytes[i];
 
 	switch (bstats->type) {
 	case HAMMER2_BREF_TYPE_VOLUME:
@@ -729,9 +1328,16 @@ load_delta_stats(blockref_stats_t *bstats, const delta_stats_t *dstats)
 static void
 accumulate_delta_stats(delta_stats_t *dst, const delta_stats_t *src)
 {
+	int i;
+
 	dst->total_blockref += src->total_blockref;
 	dst->total_empty += src->total_empty;
+	dst->total_pruned += src->total_pruned;
 	dst->total_bytes += src->total_bytes;
+	for (i = 0; i < STATS_NTYPES; ++i)
+		dst->type_bytes[i] += src->type_bytes[i];
+	for (i = 0; i < STATS_NCOMP; ++i)
+		dst->comp_bytes[i] += src->comp_bytes[i];
 
 	dst->volume.total_inode += src->volume.total_inode;
 	dst->volume.total_indirect += src->volume.total_indirect;
@@ -746,8 +1352,7 @@ accumulate_delta_stats(delta_stats_t *dst, const delta_stats_t *src)
 
 static int
 verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
-    blockref_stats_t *bstats, struct blockref_tree *droot,
-    delta_stats_t *dstats, int depth, int index)
+    blockref_stats_t *bstats, delta_stats_t *dstats, int depth, int index)
 {
 	hammer2_media_data_t media;
 	hammer2_blockref_t *bscan;
@@ -767,27 +1372,37 @@ verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
 	if (DebugOpt > 1)
 		print_blockref_debug(stdout, depth, index, bref, NULL);
 
-	if (bref->data_off) {
-		struct blockref_entry *e, bref_find;
-		memset(&bref_find, 0, sizeof(bref_find));
-		bref_find.data_off = bref->data_off;
-		e = RB_FIND(blockref_tree, droot, &bref_find);
-		if (e) {
-			struct blockref_msg *m;
-			TAILQ_FOREACH(m, &e->head, entry) {
-				delta_stats_t *ds = m->msg;
-				if (!memcmp(&m->bref, bref, sizeof(*bref))) {
-					/* delta contains cached delta */
-					accumulate_delta_stats(dstats, ds);
-					load_delta_stats(bstats, ds);
-					print_blockref_debug(stdout, depth,
-					    index, &m->bref, "cache-hit");
-					return 0;
-				}
-			}
+	if (bref->data_off && memo_size) {
+		delta_stats_t ds;
+		bool found;
+
+		pthread_mutex_lock(&memo_lock);
+		found = memo_lookup(bref, &ds);
+		pthread_mutex_unlock(&memo_lock);
+		if (found) {
+			/* delta contains cached delta */
+			accumulate_delta_stats(dstats, &ds);
+			load_delta_stats(bstats, &ds);
+			print_blockref_debug(stdout, depth, index, bref,
+			    "cache-hit");
+			return 0;
 		}
 	}
 
+	/*
+	 * mirror_tid is the highest tid in the subtree, so nothing below
+	 * has changed since SinceTid either.
+	 */
+	if (SinceTid && bref->type != HAMMER2_BREF_TYPE_EMPTY &&
+	    bref->type != HAMMER2_BREF_TYPE_VOLUME &&
+	    bref->type != HAMMER2_BREF_TYPE_FREEMAP &&
+	    bref->mirror_tid <= SinceTid) {
+		bstats->total_pruned++;
+		dstats->total_pruned++;
+		print_blockref_debug(stdout, depth, index, bref, "pruned");
+		return 0;
+	}
+
 	bstats->total_blockref++;
 	dstats->total_blockref++;
 
@@ -861,6 +1476,16 @@ verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
 	    bref->type != HAMMER2_BREF_TYPE_FREEMAP) {
 		bstats->total_bytes += bytes;
 		dstats->total_bytes += bytes;
+		if (bref->type < STATS_NTYPES) {
+			bstats->type_bytes[bref->type] += bytes;
+			dstats->type_bytes[bref->type] += bytes;
+		}
+		if (HAMMER2_DEC_COMP(bref->methods) < STATS_NCOMP) {
+			bstats->comp_bytes[HAMMER2_DEC_COMP(bref->methods)] +=
+			    bytes;
+			dstats->comp_bytes[HAMMER2_DEC_COMP(bref->methods)] +=
+			    bytes;
+		}
 	}
 
 	if (!CountEmpty && bref->type == HAMMER2_BREF_TYPE_EMPTY) {
@@ -869,7 +1494,9 @@ verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
 		dstats->total_bytes -= bytes;
 	}
 
-	if (!DebugOpt && QuietOpt <= 0 && (bstats->total_blockref % 100) == 0)
+	/* per-task counters are meaningless as progress with -j */
+	if (!DebugOpt && QuietOpt <= 0 && NumThreads <= 1 &&
+	    (bstats->total_blockref % 100) == 0)
 		print_blockref_stats(bstats, false);
 
 	if (!bytes)
@@ -880,6 +1507,7 @@ verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
 		cv = hammer2_icrc32(&media, bytes);
 		if (bref->check.iscsi32.value != cv) {
 			strlcpy(msg, "Bad HAMMER2_CHECK_ISCSI32", sizeof(msg));
+			bstats->check_failures[HAMMER2_CHECK_ISCSI32]++;
 			add_blockref_entry(&bstats->root, bref, msg,
 			    strlen(msg) + 1);
 			print_blockref_debug(stdout, depth, index, bref, msg);
@@ -890,6 +1518,7 @@ verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
 		cv64 = XXH64(&media, bytes, XXH_HAMMER2_SEED);
 		if (bref->check.xxhash64.value != cv64) {
 			strlcpy(msg, "Bad HAMMER2_CHECK_XXHASH64", sizeof(msg));
+			bstats->check_failures[HAMMER2_CHECK_XXHASH64]++;
 			add_blockref_entry(&bstats->root, bref, msg,
 			    strlen(msg) + 1);
 			print_blockref_debug(stdout, depth, index, bref, msg);
@@ -904,6 +1533,7 @@ verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
 		if (memcmp(u.digest, bref->check.sha192.data,
 		    sizeof(bref->check.sha192.data))) {
 			strlcpy(msg, "Bad HAMMER2_CHECK_SHA192", sizeof(msg));
+			bstats->check_failures[HAMMER2_CHECK_SHA192]++;
 			add_blockref_entry(&bstats->root, bref, msg,
 			    strlen(msg) + 1);
 			print_blockref_debug(stdout, depth, index, bref, msg);
@@ -914,6 +1544,7 @@ verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
 		cv = hammer2_icrc32(&media, bytes);
 		if (bref->check.freemap.icrc32 != cv) {
 			strlcpy(msg, "Bad HAMMER2_CHECK_FREEMAP", sizeof(msg));
+			bstats->check_failures[HAMMER2_CHECK_FREEMAP]++;
 			add_blockref_entry(&bstats->root, bref, msg,
 			    strlen(msg) + 1);
 			print_blockref_debug(stdout, depth, index, bref, msg);
@@ -960,10 +1591,18 @@ verify_blockref(const hammer2_blockref_t *bref, bool norecurse,
 	 * If failed, no recurse, but still verify its direct children.
 	 * Beyond that is probably garbage.
 	 */
+	if (norecurse == false && bcount)
+		readahead_media(bscan, bcount);
+	if (norecurse == false && want_verify_tasks(bscan, bcount)) {
+		if (verify_children(bscan, bcount, failed, bstats, dstats,
+		    depth + 1) == -1)
+			return -1;
+		bcount = 0;
+	}
 	for (i = 0; norecurse == false && i < bcount; ++i) {
 		delta_stats_t ds;
 		memset(&ds, 0, sizeof(ds));
-		if (verify_blockref(&bscan[i], failed, bstats, droot, &ds,
+		if (verify_blockref(&bscan[i], failed, bstats, &ds,
 		    depth + 1, i) == -1)
 			return -1;
 		if (!failed)
@@ -974,16 +1613,690 @@ end:
 		return -1;
 
 	dstats->count++;
-	if (bref->data_off && BlockrefCacheCount > 0 &&
+	/* a subtree which wasn't recursed into has an incomplete delta */
+	if (bref->data_off && memo_size && norecurse == false &&
 	    dstats->count >= BlockrefCacheCount) {
 		assert(bytes);
-		add_blockref_entry(droot, bref, dstats, sizeof(*dstats));
+		pthread_mutex_lock(&memo_lock);
+		memo_enter(bref, dstats);
+		pthread_mutex_unlock(&memo_lock);
 		print_blockref_debug(stdout, depth, index, bref, "cache-add");
 	}
 
 	return 0;
 }
 
+static void
+merge_blockref_stats(blockref_stats_t *dst, blockref_stats_t *src)
+{
+	struct blockref_entry *e, *e2;
+	int i;
+
+	dst->total_blockref += src->total_blockref;
+	dst->total_empty += src->total_empty;
+	dst->total_pruned += src->total_pruned;
+	dst->total_bytes += src->total_bytes;
+	for (i = 0; i < STATS_NTYPES; ++i)
+		dst->type_bytes[i] += src->type_bytes[i];
+	for (i = 0; i < STATS_NCOMP; ++i)
+		dst->comp_bytes[i] += src->comp_bytes[i];
+	for (i = 0; i < STATS_NCHECK; ++i)
+		dst->check_failures[i] += src->check_failures[i];
+
+	switch (dst->type) {
+	case HAMMER2_BREF_TYPE_VOLUME:
+		dst->volume.total_inode += src->volume.total_inode;
+		dst->volume.total_indirect += src->volume.total_indirect;
+		dst->volume.total_data += src->volume.total_data;
+		dst->volume.total_dirent += src->volume.total_dirent;
+		break;
+	case HAMMER2_BREF_TYPE_FREEMAP:
+		dst->freemap.total_freemap_node +=
+		    src->freemap.total_freemap_node;
+		dst->freemap.total_freemap_leaf +=
+		    src->freemap.total_freemap_leaf;
+		break;
+	default:
+		assert(0);
+		break;
+	}
+
+	/* messages for the same data_off are kept in submission order */
+	while ((e = RB_MIN(blockref_tree, &src->root)) != NULL) {
+		RB_REMOVE(blockref_tree, &src->root, e);
+		e2 = RB_INSERT(blockref_tree, &dst->root, e);
+		if (e2) {
+			TAILQ_CONCAT(&e2->head, &e->head, entry);
+			free(e);
+		}
+	}
+}
+
+static void
+init_verify_task(verify_task_t *t, const hammer2_blockref_t *bref,
+    uint8_t type, bool norecurse, int depth, int index)
+{
+	memset(t, 0, sizeof(*t));
+	t->bref = *bref;
+	init_blockref_stats(&t->bstats, type);
+	t->norecurse = norecurse;
+	t->depth = depth;
+	t->index = index;
+	t->state = VERIFY_TASK_INIT;
+}
+
+static void
+run_verify_task(verify_task_t *t)
+{
+	t->error = verify_blockref(&t->bref, t->norecurse, &t->bstats,
+	    &t->dstats, t->depth, t->index);
+}
+
+/*
+ * Mark a task done, called with verify_lock held.  If it failed, the
+ * siblings after it which are still queued are dropped, since their
+ * result is never merged.
+ */
+static void
+finish_verify_task(verify_task_t *t)
+{
+	verify_task_t *s;
+
+	t->state = VERIFY_TASK_DONE;
+	if (t->error != -1 || t->last == NULL)
+		return;
+	for (s = t + 1; s <= t->last; ++s) {
+		if (s->state != VERIFY_TASK_QUEUED)
+			continue;
+		TAILQ_REMOVE(&verify_queue, s, entry);
+		verify_queued--;
+		s->state = VERIFY_TASK_DONE;
+	}
+}
+
+static void *
+verify_thread(void *arg __unused)
+{
+	verify_task_t *t;
+
+	pthread_mutex_lock(&verify_lock);
+	for (;;) {
+		while ((t = TAILQ_FIRST(&verify_queue)) == NULL &&
+		    !verify_exit)
+			pthread_cond_wait(&verify_cond, &verify_lock);
+		if (t == NULL)
+			break;
+		TAILQ_REMOVE(&verify_queue, t, entry);
+		verify_queued--;
+		t->state = VERIFY_TASK_RUNNING;
+		pthread_mutex_unlock(&verify_lock);
+
+		run_verify_task(t);
+
+		pthread_mutex_lock(&verify_lock);
+		finish_verify_task(t);
+		pthread_cond_broadcast(&verify_done_cond);
+	}
+	pthread_mutex_unlock(&verify_lock);
+
+	return NULL;
+}
+
+static void
+init_verify_pool(void)
+{
+	pthread_attr_t attr;
+	int i;
+
+	if (NumThreads <= 1)
+		return;
+
+	/* each level of recursion keeps a hammer2_media_data_t on stack */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, VERIFY_THREAD_STACK);
+
+	verify_exit = false;
+	verify_threads = calloc(NumThreads - 1, sizeof(*verify_threads));
+	assert(verify_threads);
+	for (i = 0; i < NumThreads - 1; ++i) {
+		if (pthread_create(&verify_threads[i], &attr, verify_thread,
+		    NULL)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	pthread_attr_destroy(&attr);
+}
+
+static void
+cleanup_verify_pool(void)
+{
+	int i;
+
+	if (verify_threads == NULL)
+		return;
+
+	pthread_mutex_lock(&verify_lock);
+	verify_exit = true;
+	pthread_cond_broadcast(&verify_cond);
+	pthread_mutex_unlock(&verify_lock);
+
+	for (i = 0; i < NumThreads - 1; ++i)
+		pthread_join(verify_threads[i], NULL);
+	free(verify_threads);
+	verify_threads = NULL;
+}
+
+/*
+ * Run an array of tasks and wait for all of them to complete.  The tasks
+ * are queued for the verifier threads, and whatever has not been picked up
+ * yet is run by the caller instead of sleeping.  The caller only takes its
+ * own tasks, so the stack depth stays bounded by the depth of the topology.
+ * With stop, the tasks after the first one which failed are not started.
+ */
+static void
+run_verify_tasks(verify_task_t *tasks, int n, bool stop)
+{
+	verify_task_t *t;
+	int i;
+
+	if (NumThreads <= 1) {
+		for (i = 0; i < n; ++i) {
+			run_verify_task(&tasks[i]);
+			if (stop && tasks[i].error == -1)
+				break;
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&verify_lock);
+	for (i = 0; i < n; ++i) {
+		t = &tasks[i];
+		t->last = stop ? &tasks[n - 1] : NULL;
+		t->state = VERIFY_TASK_QUEUED;
+		TAILQ_INSERT_TAIL(&verify_queue, t, entry);
+		verify_queued++;
+	}
+	pthread_cond_broadcast(&verify_cond);
+
+	/* threads take from the head, so work from the tail */
+	for (i = n - 1; i >= 0; --i) {
+		t = &tasks[i];
+		if (t->state != VERIFY_TASK_QUEUED)
+			continue;
+		TAILQ_REMOVE(&verify_queue, t, entry);
+		verify_queued--;
+		t->state = VERIFY_TASK_RUNNING;
+		pthread_mutex_unlock(&verify_lock);
+
+		run_verify_task(t);
+
+		pthread_mutex_lock(&verify_lock);
+		finish_verify_task(t);
+	}
+	for (i = 0; i < n; ++i)
+		while (tasks[i].state != VERIFY_TASK_DONE)
+			pthread_cond_wait(&verify_done_cond, &verify_lock);
+	pthread_mutex_unlock(&verify_lock);
+}
+
+/*
+ * Split the children off into tasks only if there is more than one of them
+ * and the verifier threads are running short of work, otherwise recursing
+ * on the current thread is cheaper.
+ */
+static bool
+want_verify_tasks(const hammer2_blockref_t *bscan, int bcount)
+{
+	int i, n = 0;
+	bool ret;
+
+	if (NumThreads <= 1)
+		return false;
+
+	for (i = 0; i < bcount && n < 2; ++i)
+		if (bscan[i].type != HAMMER2_BREF_TYPE_EMPTY)
+			n++;
+	if (n < 2)
+		return false;
+
+	pthread_mutex_lock(&verify_lock);
+	ret = verify_queued < NumThreads;
+	pthread_mutex_unlock(&verify_lock);
+
+	return ret;
+}
+
+/*
+ * Verify children in parallel.  The result is merged in index order and
+ * stops at the first child which returned -1, exactly like the sequential
+ * loop in verify_blockref(), so the output does not depend on -j.  The
+ * children after a failed one are not started, as in that loop, though
+ * those already running are left to complete.
+ */
+static int
+verify_children(const hammer2_blockref_t *bscan, int bcount, bool norecurse,
+    blockref_stats_t *bstats, delta_stats_t *dstats, int depth)
+{
+	verify_task_t *tasks;
+	int i, ret = 0;
+
+	tasks = calloc(bcount, sizeof(*tasks));
+	assert(tasks);
+	for (i = 0; i < bcount; ++i)
+		init_verify_task(&tasks[i], &bscan[i], bstats->type,
+		    norecurse, depth, i);
+	run_verify_tasks(tasks, bcount, true);
+
+	for (i = 0; i < bcount; ++i) {
+		verify_task_t *t = &tasks[i];
+
+		if (ret == 0) {
+			merge_blockref_stats(bstats, &t->bstats);
+			if (t->error == -1)
+				ret = -1;
+			else if (!norecurse)
+				accumulate_delta_stats(dstats, &t->dstats);
+		}
+		cleanup_blockref_stats(&t->bstats);
+	}
+	free(tasks);
+
+	return ret;
+}
+
+/*
+ * Freemap cross-check.
+ *
+ * Like bulkfree, the volume is processed in windows whose in-memory
+ * hammer2_bmap_data_t array is initialized the way hammer2_freemap_init()
+ * initializes a new leaf, and then has every 16KB granule referenced by
+ * the topology marked allocated.  The result is then compared against the
+ * freemap leaves on media, with a missing leaf standing for a leaf in its
+ * initial state.  Each window costs a topology scan, but memory use does
+ * not depend on the volume size.
+ */
+#define FMCHECK_WINDOW	(HAMMER2_FREEMAP_LEVEL1_SIZE * 1024)	/* 1TB */
+#define FMCHECK_LOBITS	((hammer2_bitmap_t)0x5555555555555555ULL)
+
+typedef struct {
+	hammer2_volume_data_t voldata;
+	hammer2_off_t total_size;
+	hammer2_off_t sbase;		/* window */
+	hammer2_off_t sstop;
+	hammer2_bmap_data_t *bmap;	/* one per 4MB in window */
+	char *leaf_seen;		/* one per 1GB in window */
+	hammer2_off_t *visited;		/* open addressing set of nodes */
+	size_t visited_size;
+	size_t visited_count;
+	hammer2_off_t run_beg;		/* pending referenced-but-free run */
+	hammer2_off_t run_end;
+	uint64_t scanned_bytes;
+	uint64_t unreadable;
+	uint64_t corrupt_bytes;
+	uint64_t corrupt_runs;
+	uint64_t leaked_bytes;
+} fmcheck_t;
+
+static void
+fmcheck_bmap_init(const fmcheck_t *fc, hammer2_bmap_data_t *bmap,
+    hammer2_off_t key, int count)
+{
+	hammer2_off_t lokey, hikey;
+
+	lokey = (fc->voldata.allocator_beg + HAMMER2_SEGMASK64) &
+	    ~HAMMER2_SEGMASK64;
+	hikey = fc->total_size & ~HAMMER2_SEGMASK64;
+
+	while (count--) {
+		memset(bmap, 0, sizeof(*bmap));
+		if (lokey < H2FMZONEBASE(key))
+			lokey = H2FMZONEBASE(key);
+		if (lokey < H2FMZONEBASE(key) + HAMMER2_ZONE_SEG64)
+			lokey = H2FMZONEBASE(key) + HAMMER2_ZONE_SEG64;
+		if (key < lokey || key >= hikey) {
+			memset(bmap->bitmapq, -1, sizeof(bmap->bitmapq));
+			bmap->linear = HAMMER2_SEGSIZE;
+		} else {
+			bmap->avail = HAMMER2_FREEMAP_LEVEL0_SIZE;
+		}
+		key += HAMMER2_FREEMAP_LEVEL0_SIZE;
+		++bmap;
+	}
+}
+
+/*
+ * Returns true if the node was already scanned in this window.
+ */
+static bool
+fmcheck_visit(fmcheck_t *fc, hammer2_off_t data_off)
+{
+	hammer2_off_t *old;
+	size_t i, n, mask;
+
+	if (fc->visited_count * 2 >= fc->visited_size) {
+		old = fc->visited;
+		n = fc->visited_size;
+		fc->visited_size = n ? n * 2 : 4096;
+		fc->visited = calloc(fc->visited_size, sizeof(*fc->visited));
+		assert(fc->visited);
+		fc->visited_count = 0;
+		for (i = 0; i < n; ++i)
+			if (old[i])
+				fmcheck_visit(fc, old[i]);
+		free(old);
+	}
+
+	mask = fc->visited_size - 1;
+	i = (size_t)XXH64(&data_off, sizeof(data_off), 0) & mask;
+	while (fc->visited[i]) {
+		if (fc->visited[i] == data_off)
+			return true;
+		i = (i + 1) & mask;
+	}
+	fc->visited[i] = data_off;
+	fc->visited_count++;
+
+	return false;
+}
+
+static void
+fmcheck_mark(fmcheck_t *fc, hammer2_off_t data_off, size_t bytes)
+{
+	hammer2_off_t off, end;
+	hammer2_bmap_data_t *bmap;
+	int g;
+
+	off = data_off & ~(hammer2_off_t)(HAMMER2_FREEMAP_BLOCK_SIZE - 1);
+	end = data_off + bytes;
+	if (end <= fc->sbase || off >= fc->sstop)
+		return;
+	if (off < fc->sbase)
+		off = fc->sbase;
+	if (end > fc->sstop)
+		end = fc->sstop;
+
+	for (; off < end; off += HAMMER2_FREEMAP_BLOCK_SIZE) {
+		bmap = &fc->bmap[(off - fc->sbase) >>
+		    HAMMER2_FREEMAP_LEVEL0_RADIX];
+		g = (off & HAMMER2_SEGMASK64) >> HAMMER2_FREEMAP_BLOCK_RADIX;
+		bmap->bitmapq[g / HAMMER2_BMAP_BLOCKS_PER_ELEMENT] |=
+		    (hammer2_bitmap_t)3 <<
+		    ((g % HAMMER2_BMAP_BLOCKS_PER_ELEMENT) * 2);
+	}
+}
+
+static void
+fmcheck_scan(fmcheck_t *fc, const hammer2_blockref_t *bref)
+{
+	hammer2_media_data_t media;
+	hammer2_blockref_t *bscan;
+	size_t bytes;
+	int i, bcount;
+
+	if (bref->type == HAMMER2_BREF_TYPE_EMPTY)
+		return;
+	bytes = bref->data_off & HAMMER2_OFF_MASK_RADIX;
+	if (bytes)
+		bytes = (size_t)1 << bytes;
+	if (bref->type != HAMMER2_BREF_TYPE_VOLUME)
+		fmcheck_mark(fc, bref->data_off & ~HAMMER2_OFF_MASK_RADIX,
+		    bytes);
+
+	switch (bref->type) {
+	case HAMMER2_BREF_TYPE_VOLUME:
+	case HAMMER2_BREF_TYPE_INODE:
+	case HAMMER2_BREF_TYPE_INDIRECT:
+		break;
+	default:
+		return;
+	}
+	if (!bytes || fmcheck_visit(fc, bref->data_off))
+		return;
+	if (read_media(bref, &media, &bytes)) {
+		fc->unreadable++;
+		return;
+	}
+	fc->scanned_bytes += bytes;
+
+	switch (bref->type) {
+	case HAMMER2_BREF_TYPE_VOLUME:
+		bscan = &media.voldata.sroot_blockset.blockref[0];
+		bcount = HAMMER2_SET_COUNT;
+		break;
+	case HAMMER2_BREF_TYPE_INODE:
+		if (media.ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA)
+			return;
+		bscan = &media.ipdata.u.blockset.blockref[0];
+		bcount = HAMMER2_SET_COUNT;
+		break;
+	default:
+		bscan = &media.npdata[0];
+		bcount = bytes / sizeof(hammer2_blockref_t);
+		break;
+	}
+
+	if (bref->type != HAMMER2_BREF_TYPE_VOLUME)
+		readahead_media(bscan, bcount);
+	for (i = 0; i < bcount; ++i)
+		fmcheck_scan(fc, &bscan[i]);
+}
+
+static void
+fmcheck_flush_run(fmcheck_t *fc)
+{
+	if (fc->run_end == fc->run_beg)
+		return;
+	tfprintf(stderr, 1, "%016jx-%016jx referenced but free\n",
+	    (uintmax_t)fc->run_beg, (uintmax_t)fc->run_end - 1);
+	fc->corrupt_runs++;
+	fc->run_beg = fc->run_end = 0;
+}
+
+/*
+ * Compare the expected state of the 4MB at data_off against the live
+ * bmap.  Both 10 (possibly free) and 11 count as allocated on media.
+ */
+static void
+fmcheck_compare(fmcheck_t *fc, hammer2_off_t data_off,
+    const hammer2_bmap_data_t *bmap, const hammer2_bmap_data_t *live)
+{
+	hammer2_bitmap_t exp, cur, bad, leak;
+	hammer2_off_t off;
+	int i, j;
+
+	if (data_off < fc->voldata.allocator_beg ||
+	    data_off >= fc->total_size)
+		return;
+
+	for (i = 0; i < HAMMER2_BMAP_ELEMENTS; ++i) {
+		exp = (bmap->bitmapq[i] | bmap->bitmapq[i] >> 1) &
+		    FMCHECK_LOBITS;
+		cur = (live->bitmapq[i] | live->bitmapq[i] >> 1) &
+		    FMCHECK_LOBITS;
+		bad = exp & ~cur;
+		leak = cur & ~exp;
+		fc->leaked_bytes += (uint64_t)__builtin_popcountll(leak) *
+		    HAMMER2_FREEMAP_BLOCK_SIZE;
+		if (bad == 0)
+			continue;
+		fc->corrupt_bytes += (uint64_t)__builtin_popcountll(bad) *
+		    HAMMER2_FREEMAP_BLOCK_SIZE;
+		for (j = 0; j < HAMMER2_BMAP_BLOCKS_PER_ELEMENT; ++j) {
+			if ((bad & ((hammer2_bitmap_t)1 << (j * 2))) == 0)
+				continue;
+			off = data_off + (hammer2_off_t)(i *
+			    HAMMER2_BMAP_BLOCKS_PER_ELEMENT + j) *
+			    HAMMER2_FREEMAP_BLOCK_SIZE;
+			if (off != fc->run_end)
+				fmcheck_flush_run(fc);
+			if (fc->run_end == 0)
+				fc->run_beg = off;
+			fc->run_end = off + HAMMER2_FREEMAP_BLOCK_SIZE;
+		}
+	}
+}
+
+static void
+fmcheck_leaf(fmcheck_t *fc, const hammer2_blockref_t *bref)
+{
+	hammer2_media_data_t media;
+	hammer2_blockref_t *bscan;
+	hammer2_off_t key, data_off;
+	size_t bytes;
+	int i, bcount;
+
+	if (bref->type == HAMMER2_BREF_TYPE_EMPTY)
+		return;
+	/* skip subtrees outside of the window */
+	if (bref->type != HAMMER2_BREF_TYPE_FREEMAP && bref->keybits < 64) {
+		key = bref->key & ~(((hammer2_off_t)1 << bref->keybits) - 1);
+		if (key >= fc->sstop ||
+		    key + ((hammer2_off_t)1 << bref->keybits) <= fc->sbase)
+			return;
+	}
+	if (read_media(bref, &media, &bytes) || !bytes) {
+		fc->unreadable++;
+		return;
+	}
+	fc->scanned_bytes += bytes;
+
+	switch (bref->type) {
+	case HAMMER2_BREF_TYPE_FREEMAP:
+		bscan = &media.voldata.freemap_blockset.blockref[0];
+		bcount = HAMMER2_SET_COUNT;
+		break;
+	case HAMMER2_BREF_TYPE_FREEMAP_NODE:
+		bscan = &media.npdata[0];
+		bcount = bytes / sizeof(hammer2_blockref_t);
+		break;
+	case HAMMER2_BREF_TYPE_FREEMAP_LEAF:
+		if (bref->key < fc->sbase || bref->key >= fc->sstop)
+			return;
+		fc->leaf_seen[(bref->key - fc->sbase) >>
+		    HAMMER2_FREEMAP_LEVEL1_RADIX] = 1;
+		data_off = bref->key;
+		for (i = 0; i < HAMMER2_FREEMAP_COUNT; ++i) {
+			fmcheck_compare(fc, data_off,
+			    &fc->bmap[(data_off - fc->sbase) >>
+			    HAMMER2_FREEMAP_LEVEL0_RADIX],
+			    &media.bmdata[i]);
+			data_off += HAMMER2_FREEMAP_LEVEL0_SIZE;
+		}
+		return;
+	default:
+		return;
+	}
+
+	for (i = 0; i < bcount; ++i)
+		fmcheck_leaf(fc, &bscan[i]);
+}
+
+static int
+test_freemap_consistency(void)
+{
+	hammer2_blockref_t broot;
+	hammer2_bmap_data_t init[HAMMER2_FREEMAP_COUNT];
+	struct timespec ts1, ts2;
+	fmcheck_t fc;
+	hammer2_off_t window, data_off;
+	double elapsed;
+	size_t nbmap, nleaf;
+	int i, j, passes = 0;
+
+	if (best_zone == -1)
+		return -1;
+	memset(&fc, 0, sizeof(fc));
+	if (read_volume_header(best_zone, &fc.voldata) !=
+	    HAMMER2_VOLUME_BYTES) {
+		tfprintf(stderr, 1, "Failed to read volume header\n");
+		return -1;
+	}
+	fc.total_size = hammer2_get_total_size();
+
+	window = FMCHECK_WINDOW;
+	if (window > fc.total_size)
+		window = (fc.total_size + HAMMER2_FREEMAP_LEVEL1_MASK) &
+		    ~HAMMER2_FREEMAP_LEVEL1_MASK;
+	nbmap = window >> HAMMER2_FREEMAP_LEVEL0_RADIX;
+	nleaf = window >> HAMMER2_FREEMAP_LEVEL1_RADIX;
+	fc.bmap = calloc(nbmap, sizeof(*fc.bmap));
+	fc.leaf_seen = calloc(nleaf, sizeof(*fc.leaf_seen));
+	assert(fc.bmap && fc.leaf_seen);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (fc.sbase = 0; fc.sbase < fc.total_size; fc.sbase += window) {
+		fc.sstop = fc.sbase + window;
+		passes++;
+
+		/* expected state */
+		fmcheck_bmap_init(&fc, fc.bmap, fc.sbase, nbmap);
+		memset(fc.visited, 0, fc.visited_size * sizeof(*fc.visited));
+		fc.visited_count = 0;
+		init_root_blockref(best_zone, HAMMER2_BREF_TYPE_VOLUME, &broot);
+		fmcheck_scan(&fc, &broot);
+
+		/* compare against live leaves, or their initial state */
+		memset(fc.leaf_seen, 0, nleaf);
+		init_root_blockref(best_zone, HAMMER2_BREF_TYPE_FREEMAP, &broot);
+		fmcheck_leaf(&fc, &broot);
+		for (i = 0; i < (int)nleaf; ++i) {
+			if (fc.leaf_seen[i])
+				continue;
+			data_off = fc.sbase + ((hammer2_off_t)i <<
+			    HAMMER2_FREEMAP_LEVEL1_RADIX);
+			if (data_off >= fc.total_size)
+				break;
+			fmcheck_bmap_init(&fc, init, data_off,
+			    HAMMER2_FREEMAP_COUNT);
+			for (j = 0; j < HAMMER2_FREEMAP_COUNT; ++j)
+				fmcheck_compare(&fc, data_off +
+				    j * HAMMER2_FREEMAP_LEVEL0_SIZE,
+				    &fc.bmap[(data_off - fc.sbase) /
+				    HAMMER2_FREEMAP_LEVEL0_SIZE + j],
+				    &init[j]);
+		}
+		fmcheck_flush_run(&fc);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	elapsed = (ts2.tv_sec - ts1.tv_sec) +
+	    (ts2.tv_nsec - ts1.tv_nsec) * 1e-9;
+
+	tfprintf(stdout, 1, "%s referenced but free in %ju ranges\n",
+	    sizetostr(fc.corrupt_bytes), (uintmax_t)fc.corrupt_runs);
+	tfprintf(stdout, 1, "%s allocated but unreferenced\n",
+	    sizetostr(fc.leaked_bytes));
+	if (fc.unreadable)
+		tfprintf(stdout, 1, "%ju blockrefs could not be read\n",
+		    (uintmax_t)fc.unreadable);
+	/* sizetostr() returns a static buffer */
+	tfprintf(stdout, 1, "%s in %d pass%s, ", sizetostr(fc.total_size),
+	    passes, passes > 1 ? "es" : "");
+	printf("%s scanned in %.3f sec", sizetostr(fc.scanned_bytes), elapsed);
+	if (elapsed > 0)
+		printf(" (%s/s)", sizetostr(fc.scanned_bytes / elapsed));
+	printf("\n");
+
+	if (ReportFormat != REPORT_NONE) {
+		report_begin("freemap");
+		report_uint("zone", best_zone);
+		report_uint("corrupt_bytes", fc.corrupt_bytes);
+		report_uint("corrupt_ranges", fc.corrupt_runs);
+		report_uint("leaked_bytes", fc.leaked_bytes);
+		report_uint("unreadable", fc.unreadable);
+		report_uint("passes", passes);
+		report_uint("scanned_bytes", fc.scanned_bytes);
+		report_double("wall_sec", elapsed);
+		report_end();
+	}
+
+	free(fc.bmap);
+	free(fc.leaf_seen);
+	free(fc.visited);
+
+	return fc.corrupt_bytes ? -1 : 0;
+}
+
 static void
 print_pfs(const hammer2_inode_data_t *ipdata)
 {
@@ -1266,17 +2579,153 @@ print_media(FILE *fp, int tab, const hammer2_blockref_t *bref,
 		free(str);
 }
 
+static const char *comp_names[STATS_NCOMP] = {
+	"none", "autozero", "lz4", "zlib",
+};
+
+static const char *check_names[STATS_NCHECK] = {
+	"none", "disabled", "iscsi32", "xxhash64", "sha192", "freemap",
+};
+
+static void
+report_blockref_stats(uint8_t type, int zone, const char *pfs,
+    const blockref_stats_t *bstats, int error)
+{
+	struct blockref_entry *e;
+	struct blockref_msg *m;
+	uint64_t nerrors = 0;
+	char key[64];
+	int i;
+
+	if (ReportFormat == REPORT_NONE)
+		return;
+
+	RB_FOREACH(e, blockref_tree, (struct blockref_tree *)&bstats->root)
+		TAILQ_FOREACH(m, &e->head, entry)
+			nerrors++;
+
+	report_begin("zone");
+	report_string("phase", hammer2_breftype_to_str(type));
+	report_uint("zone", zone);
+	if (pfs)
+		report_string("pfs", pfs);
+	report_string("status", error == -1 ? "failed" : "ok");
+	report_uint("errors", nerrors);
+	report_uint("blockrefs", bstats->total_blockref);
+	if (CountEmpty)
+		report_uint("empty", bstats->total_empty);
+	if (SinceTid)
+		report_uint("pruned", bstats->total_pruned);
+	report_uint("bytes", bstats->total_bytes);
+	switch (type) {
+	case HAMMER2_BREF_TYPE_VOLUME:
+		report_uint("inode", bstats->volume.total_inode);
+		report_uint("indirect", bstats->volume.total_indirect);
+		report_uint("data", bstats->volume.total_data);
+		report_uint("dirent", bstats->volume.total_dirent);
+		break;
+	case HAMMER2_BREF_TYPE_FREEMAP:
+		report_uint("freemap_node",
+		    bstats->freemap.total_freemap_node);
+		report_uint("freemap_leaf",
+		    bstats->freemap.total_freemap_leaf);
+		break;
+	}
+	for (i = HAMMER2_BREF_TYPE_INODE; i < STATS_NTYPES; ++i) {
+		if (bstats->type_bytes[i] == 0)
+			continue;
+		snprintf(key, sizeof(key), "bytes_%s",
+		    hammer2_breftype_to_str(i));
+		report_uint(key, bstats->type_bytes[i]);
+	}
+	for (i = 0; i < STATS_NCOMP; ++i) {
+		snprintf(key, sizeof(key), "bytes_comp_%s", comp_names[i]);
+		report_uint(key, bstats->comp_bytes[i]);
+	}
+	for (i = HAMMER2_CHECK_ISCSI32; i < STATS_NCHECK; ++i) {
+		snprintf(key, sizeof(key), "check_failures_%s",
+		    check_names[i]);
+		report_uint(key, bstats->check_failures[i]);
+	}
+	report_end();
+}
+
+typedef struct {
+	const char *name;
+	struct timespec wall;
+	struct timespec cpu;
+	uint64_t syscalls;
+	uint64_t bytes;
+} phase_t;
+
+static double
+timespec_diff(const struct timespec *t1, const struct timespec *t2)
+{
+	return (t2->tv_sec - t1->tv_sec) + (t2->tv_nsec - t1->tv_nsec) * 1e-9;
+}
+
+static void
+begin_phase(phase_t *ph, const char *name)
+{
+	ph->name = name;
+	clock_gettime(CLOCK_MONOTONIC, &ph->wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ph->cpu);
+	pthread_mutex_lock(&media_lock);
+	ph->syscalls = media_stats.syscalls;
+	ph->bytes = media_stats.bytes;
+	pthread_mutex_unlock(&media_lock);
+}
+
+static void
+end_phase(const phase_t *ph, const char *record, int error)
+{
+	struct timespec wall, cpu;
+	uint64_t syscalls, bytes;
+
+	if (ReportFormat == REPORT_NONE)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	pthread_mutex_lock(&media_lock);
+	syscalls = media_stats.syscalls - ph->syscalls;
+	bytes = media_stats.bytes - ph->bytes;
+	pthread_mutex_unlock(&media_lock);
+
+	report_begin(record);
+	if (ph->name)
+		report_string("phase", ph->name);
+	report_string("status", error == -1 ? "failed" : "ok");
+	report_double("wall_sec", timespec_diff(&ph->wall, &wall));
+	report_double("cpu_sec", timespec_diff(&ph->cpu, &cpu));
+	report_uint("io_syscalls", syscalls);
+	report_uint("io_bytes", bytes);
+	report_end();
+}
+
 int
 test_hammer2(const char *devpath)
 {
+	phase_t total, ph;
 	bool failed = false;
+	int ret;
 
+	report_set_device(devpath);
+	begin_phase(&total, NULL);
 	hammer2_init_volumes(devpath, 1);
+	init_media_cache();
+	init_memo();
+	init_verify_pool();
 
 	best_zone = find_best_zone();
 	if (best_zone == -1)
 		fprintf(stderr, "Failed to find best zone\n");
 
+	/* only a check of everything can be recorded */
+	VerifiedTid = 0;
+	if (best_zone != -1 && !PrintPFS && !ScanBest && !NumPFSNames)
+		VerifiedTid = get_verified_tid(best_zone);
+
 	if (PrintPFS) {
 		if (test_pfs_blockref() == -1)
 			failed = true;
@@ -1284,33 +2733,53 @@ test_hammer2(const char *devpath)
 	}
 
 	printf("volume header\n");
-	if (test_volume_header() == -1) {
+	begin_phase(&ph, "volume_header");
+	ret = test_volume_header();
+	end_phase(&ph, "phase", ret);
+	if (ret == -1) {
 		failed = true;
 		if (!ForceOpt)
 			goto end;
 	}
 
 	printf("freemap\n");
-	if (test_blockref(HAMMER2_BREF_TYPE_FREEMAP) == -1) {
+	begin_phase(&ph, "freemap");
+	ret = test_blockref(HAMMER2_BREF_TYPE_FREEMAP);
+	end_phase(&ph, "phase", ret);
+	if (ret == -1) {
 		failed = true;
 		if (!ForceOpt)
 			goto end;
 	}
 	printf("volume\n");
-	if (!ScanPFS) {
-		if (test_blockref(HAMMER2_BREF_TYPE_VOLUME) == -1) {
-			failed = true;
-			if (!ForceOpt)
-				goto end;
-		}
-	} else {
-		if (test_pfs_blockref() == -1) {
+	begin_phase(&ph, "volume");
+	if (!ScanPFS)
+		ret = test_blockref(HAMMER2_BREF_TYPE_VOLUME);
+	else
+		ret = test_pfs_blockref();
+	end_phase(&ph, "phase", ret);
+	if (ret == -1) {
+		failed = true;
+		if (!ForceOpt)
+			goto end;
+	}
+	if (FreemapCheck) {
+		printf("freemap consistency\n");
+		begin_phase(&ph, "freemap_check");
+		ret = test_freemap_consistency();
+		end_phase(&ph, "phase", ret);
+		if (ret == -1)
 			failed = true;
-			if (!ForceOpt)
-				goto end;
-		}
 	}
 end:
+	cleanup_verify_pool();
+	if (VerboseOpt > 0) {
+		print_media_stats();
+		print_memo_stats();
+	}
+	end_phase(&total, "summary", failed ? -1 : 0);
+	cleanup_media_cache();
+	cleanup_memo();
 	hammer2_cleanup_volumes();
 
 	return failed ? -1 : 0;
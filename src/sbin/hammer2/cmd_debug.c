@@ -39,14 +39,103 @@
 #include "hammer2.h"
 
 #include <openssl/sha.h>
+#include <err.h>
+#include <pthread.h>
 
 #define GIG	(1024LL*1024*1024)
 
+#define SHOW_FORMAT_TEXT	0
+#define SHOW_FORMAT_JSON	1
+#define SHOW_FORMAT_BINARY	2
+
+#define SHOW_WINDOW		16	/* blocks read ahead per level */
+
+/*
+ * What the blockrefs of a block table index.  Indirect blocks inherit
+ * the space of their parent.
+ */
+#define SHOW_SPACE_NONE		0	/* volume header, freemap */
+#define SHOW_SPACE_SROOT	1	/* the super-root inode */
+#define SHOW_SPACE_PFS		2	/* PFS roots, keyed by name */
+#define SHOW_SPACE_INODES	3	/* inodes and root dirents of a PFS */
+#define SHOW_SPACE_FILE		4	/* file data or dirents */
+
+typedef struct show_ctx {
+	int		depth;
+	int		space;
+	int		selected;	/* within the inode given by -i */
+	hammer2_key_t	inum;		/* inode owning the block table */
+	char		pfs[HAMMER2_INODE_MAXNAME + 1];
+} show_ctx_t;
+
+/*
+ * Binary output record, the blockref being in its media layout.
+ */
+typedef struct show_rec {
+	uint32_t	magic;		/* SHOW_REC_MAGIC */
+	uint16_t	depth;
+	uint16_t	index;		/* in the parent block table */
+	uint32_t	flags;		/* SHOW_REC_* */
+	uint32_t	reserved;
+	uint64_t	inum;		/* inode owning the blockref or 0 */
+	hammer2_blockref_t bref;
+} show_rec_t;
+
+#define SHOW_REC_MAGIC		0x48325342	/* "H2SB" */
+#define SHOW_REC_CHECKED	0x0001	/* block read and check code tested */
+#define SHOW_REC_FAILED		0x0002	/* check code mismatch */
+
+/*
+ * Read ahead request.  With -j the blocks of each block table being
+ * walked are read by a pool of threads up to SHOW_WINDOW entries ahead
+ * of the printer.  The walk is depth first, so requests are served most
+ * recently queued first.
+ */
+typedef struct show_io {
+	struct show_io	*next;		/* queue or free list */
+	int		fd;
+	off_t		offset;
+	size_t		io_bytes;
+	ssize_t		result;
+	int		state;
+	hammer2_media_data_t *buf;
+} show_io_t;
+
+#define SHOW_IO_QUEUED		0
+#define SHOW_IO_READING		1
+#define SHOW_IO_DONE		2
+
 static int show_all_volume_headers = 0;
 static int show_tab = 2;
 static int show_depth = -1;
 static hammer2_tid_t show_min_mirror_tid = 0;
 static hammer2_tid_t show_min_modify_tid = 0;
+static hammer2_tid_t show_max_mirror_tid = HAMMER2_TID_MAX;
+static hammer2_tid_t show_max_modify_tid = HAMMER2_TID_MAX;
+static int show_type = -1;
+static int show_format = SHOW_FORMAT_TEXT;
+static int show_inum_set = 0;
+static hammer2_key_t show_inum;
+static int show_key_set = 0;
+static hammer2_key_t show_key_beg = 0;
+static hammer2_key_t show_key_end = HAMMER2_KEY_MAX;
+static const char *show_label = NULL;
+static hammer2_key_t show_label_key;
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		/* read queued or stopping */
+	pthread_cond_t	done_cond;	/* read done */
+	show_io_t	*qhead;
+	show_io_t	*freeq;
+	pthread_t	*threads;
+	int		nthreads;
+	int		stopping;
+} ShowPool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
 
 static void count_blocks(hammer2_bmap_data_t *bmap, int value,
 		hammer2_off_t *accum16, hammer2_off_t *accum64);
@@ -57,7 +146,10 @@ static void count_blocks(hammer2_bmap_data_t *bmap, int value,
 
 static void show_volhdr(hammer2_volume_data_t *voldata, int bi);
 static void show_bref(hammer2_volume_data_t *voldata, int tab,
-			int bi, hammer2_blockref_t *bref, int norecurse);
+			int bi, hammer2_blockref_t *bref, int norecurse,
+			const show_ctx_t *ctx, show_io_t *io);
+static void show_start_pool(void);
+static void show_stop_pool(void);
 static void tabprintf(int tab, const char *ctl, ...);
 
 static hammer2_off_t TotalAccum16[4]; /* includes TotalAccum64 */
@@ -82,6 +174,115 @@ get_next_volume(hammer2_volume_data_t *voldata, hammer2_off_t volu_loff)
 	return ret;
 }
 
+/*
+ * Parse a tid or key range, lo[:hi].  A missing bound is left alone.
+ */
+static int
+show_parse_range(const char *arg, uint64_t *lop, uint64_t *hip)
+{
+	char *ptr;
+
+	errno = 0;
+	if (*arg != ':') {
+		*lop = strtoull(arg, &ptr, 16);
+		if (errno || ptr == arg)
+			return -1;
+		arg = ptr;
+	}
+	if (*arg == 0)
+		return 0;
+	if (*arg++ != ':')
+		return -1;
+	if (*arg == 0)
+		return 0;
+	*hip = strtoull(arg, &ptr, 16);
+	if (errno || *ptr)
+		return -1;
+	return 0;
+}
+
+/*
+ * Options of the show directive, see hammer2(8).
+ */
+int
+cmd_show_option(int ch, const char *arg)
+{
+	char *ptr;
+	int i;
+
+	switch(ch) {
+	case 'd':
+		show_depth = (int)strtol(arg, &ptr, 0);
+		if (*ptr || show_depth < 0) {
+			fprintf(stderr, "show: bad depth %s\n", arg);
+			return -1;
+		}
+		break;
+	case 'f':
+		if (strcmp(arg, "text") == 0) {
+			show_format = SHOW_FORMAT_TEXT;
+		} else if (strcmp(arg, "json") == 0) {
+			show_format = SHOW_FORMAT_JSON;
+		} else if (strcmp(arg, "binary") == 0) {
+			show_format = SHOW_FORMAT_BINARY;
+		} else {
+			fprintf(stderr, "show: unknown format %s\n", arg);
+			return -1;
+		}
+		break;
+	case 'i':
+		errno = 0;
+		show_inum = strtoull(arg, &ptr, 0);
+		if (errno || *ptr || ptr == arg) {
+			fprintf(stderr, "show: bad inode number %s\n", arg);
+			return -1;
+		}
+		show_inum_set = 1;
+		break;
+	case 'k':
+		if (show_parse_range(arg, &show_key_beg, &show_key_end) < 0 ||
+		    show_key_beg > show_key_end) {
+			fprintf(stderr, "show: bad key range %s\n", arg);
+			return -1;
+		}
+		show_key_set = 1;
+		break;
+	case 'l':
+		show_label = arg;
+		show_label_key = dirhash(arg, strlen(arg));
+		break;
+	case 'M':
+		if (show_parse_range(arg, &show_min_modify_tid,
+				     &show_max_modify_tid) < 0) {
+			fprintf(stderr, "show: bad modify_tid range %s\n", arg);
+			return -1;
+		}
+		break;
+	case 'T':
+		if (show_parse_range(arg, &show_min_mirror_tid,
+				     &show_max_mirror_tid) < 0) {
+			fprintf(stderr, "show: bad mirror_tid range %s\n", arg);
+			return -1;
+		}
+		break;
+	case 't':
+		for (i = 0; i < 256; ++i) {
+			if (strcmp(arg, hammer2_breftype_to_str(i)) == 0)
+				break;
+		}
+		if (i == 256 || strcmp(arg, "unknown") == 0) {
+			fprintf(stderr, "show: unknown blockref type %s\n",
+				arg);
+			return -1;
+		}
+		show_type = i;
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
 int
 cmd_show(const char *devpath, int which)
 {
@@ -89,7 +290,9 @@ cmd_show(const char *devpath, int which)
 	hammer2_media_data_t media;
 	hammer2_off_t off, volu_loff, next_volu_loff = 0;
 	hammer2_tid_t best_mirror_tid = 0;
+	show_ctx_t ctx;
 	int bests[HAMMER2_MAX_VOLUMES];
+	int text;
 	int fd;
 	int i, j;
 	char *env;
@@ -113,30 +316,45 @@ cmd_show(const char *devpath, int which)
 			show_tab = 2;
 		errno = 0;
 	}
+	/*
+	 * The environment is only looked at for what was not given on the
+	 * command line.
+	 */
 	env = getenv("HAMMER2_SHOW_DEPTH");
-	if (env != NULL) {
+	if (env != NULL && show_depth == -1) {
 		show_depth = (int)strtol(env, NULL, 0);
 		if (errno || show_depth < 0)
 			show_depth = -1;
 		errno = 0;
 	}
 	env = getenv("HAMMER2_SHOW_MIN_MIRROR_TID");
-	if (env != NULL) {
+	if (env != NULL && show_min_mirror_tid == 0) {
 		show_min_mirror_tid = (hammer2_tid_t)strtoull(env, NULL, 16);
 		if (errno)
 			show_min_mirror_tid = 0;
 		errno = 0;
 	}
 	env = getenv("HAMMER2_SHOW_MIN_MODIFY_TID");
-	if (env != NULL) {
+	if (env != NULL && show_min_modify_tid == 0) {
 		show_min_modify_tid = (hammer2_tid_t)strtoull(env, NULL, 16);
 		if (errno)
 			show_min_modify_tid = 0;
 		errno = 0;
 	}
 
+	/*
+	 * JSON and binary output is only available for the topology.
+	 */
+	if (which != 0)
+		show_format = SHOW_FORMAT_TEXT;
+	text = (show_format == SHOW_FORMAT_TEXT);
+	if (show_format == SHOW_FORMAT_BINARY && isatty(STDOUT_FILENO))
+		errx(1, "show: refusing to write binary output to a terminal");
+
 	hammer2_init_volumes(devpath, 1);
 	int all_volume_headers = VerboseOpt >= 3 || show_all_volume_headers;
+	bzero(&ctx, sizeof(ctx));
+	show_start_pool();
 
 	/*
 	 * Get best volume header for all volumes first.
@@ -165,7 +383,8 @@ cmd_show(const char *devpath, int which)
 	 */
 	for (i = 0; i < HAMMER2_MAX_VOLUMES; ++i) {
 		volu_loff = next_volu_loff;
-		printf("%s\n", hammer2_get_volume_path(volu_loff));
+		if (text)
+			printf("%s\n", hammer2_get_volume_path(volu_loff));
 		for (j = 0; j < HAMMER2_NUM_VOLHDRS; ++j) {
 			bzero(&broot, sizeof(broot));
 			broot.data_off = (j * HAMMER2_ZONE_BYTES64) |
@@ -176,21 +395,23 @@ cmd_show(const char *devpath, int which)
 			if (read(fd, &media, HAMMER2_PBUFSIZE) ==
 			    (ssize_t)HAMMER2_PBUFSIZE) {
 				broot.mirror_tid = media.voldata.mirror_tid;
-				printf("Volume %d header %d: mirror_tid=%016jx\n",
-				       media.voldata.volu_id, j,
-				       (intmax_t)broot.mirror_tid);
+				if (text)
+					printf("Volume %d header %d: "
+					       "mirror_tid=%016jx\n",
+					       media.voldata.volu_id, j,
+					       (intmax_t)broot.mirror_tid);
 				if (all_volume_headers || bests[i] == j) {
 					switch(which) {
 					case 0:
 						broot.type = HAMMER2_BREF_TYPE_VOLUME;
 						show_bref(&media.voldata, 0, j,
-							  &broot, 0);
+							  &broot, 0, &ctx, NULL);
 						next_volu_loff = -1;
 						break;
 					case 1:
 						broot.type = HAMMER2_BREF_TYPE_FREEMAP;
 						show_bref(&media.voldata, 0, j,
-							  &broot, 0);
+							  &broot, 0, &ctx, NULL);
 						next_volu_loff = -1;
 						break;
 					default:
@@ -199,14 +420,15 @@ cmd_show(const char *devpath, int which)
 						    &media.voldata, volu_loff);
 						break;
 					}
-				if (all_volume_headers && j != HAMMER2_NUM_VOLHDRS - 1)
+				if (all_volume_headers && text &&
+				    j != HAMMER2_NUM_VOLHDRS - 1)
 					printf("\n");
 				}
 			}
 		}
 		if (next_volu_loff == (hammer2_off_t)-1)
 			break;
-		if (i != HAMMER2_MAX_VOLUMES - 1)
+		if (i != HAMMER2_MAX_VOLUMES - 1 && text)
 			printf("---------------------------------------------\n");
 	}
 
@@ -225,6 +447,9 @@ cmd_show(const char *devpath, int which)
 		printf("Total freemap storage:       %6.3fGB\n",
 		       (double)TotalFreemap / GIG);
 	}
+	show_stop_pool();
+	if (fflush(stdout) != 0)
+		err(1, "show");
 	hammer2_cleanup_volumes();
 
 	return 0;
@@ -233,12 +458,15 @@ cmd_show(const char *devpath, int which)
 static void
 show_volhdr(hammer2_volume_data_t *voldata, int bi)
 {
+	show_ctx_t ctx;
 	uint32_t i;
 	char *str;
 	const char *name;
 	char *buf;
 	uuid_t uuid;
 
+	bzero(&ctx, sizeof(ctx));
+
 	printf("\nVolume %d header %d {\n", voldata->volu_id, bi);
 	printf("    magic          0x%016jx\n", (intmax_t)voldata->magic);
 	printf("    boot_beg       0x%016jx\n", (intmax_t)voldata->boot_beg);
@@ -374,14 +602,15 @@ show_volhdr(hammer2_volume_data_t *voldata, int bi)
 	printf("    sroot_blockset {\n");
 	for (i = 0; i < HAMMER2_SET_COUNT; ++i) {
 		show_bref(voldata, 16, i,
-			  &voldata->sroot_blockset.blockref[i], 2);
+			  &voldata->sroot_blockset.blockref[i], 2, &ctx, NULL);
 	}
 	printf("    }\n");
 
 	printf("    freemap_blockset {\n");
 	for (i = 0; i < HAMMER2_SET_COUNT; ++i) {
 		show_bref(voldata, 16, i,
-			  &voldata->freemap_blockset.blockref[i], 2);
+			  &voldata->freemap_blockset.blockref[i], 2, &ctx,
+			  NULL);
 	}
 	printf("    }\n");
 
@@ -399,117 +628,494 @@ show_volhdr(hammer2_volume_data_t *voldata, int bi)
 	printf("}\n");
 }
 
-static void
-show_bref(hammer2_volume_data_t *voldata, int tab, int bi,
-	  hammer2_blockref_t *bref, int norecurse)
+/*
+ * Whether any key covered by the blockref lies within [beg, end].
+ */
+static int
+show_key_overlaps(const hammer2_blockref_t *bref, hammer2_key_t beg,
+		  hammer2_key_t end)
 {
-	hammer2_media_data_t media;
-	hammer2_blockref_t *bscan;
-	hammer2_off_t tmp;
-	int i, bcount, namelen, failed, obrace, fd;
-	int type_pad;
-	size_t bytes;
-	const char *type_str;
-	char *str = NULL;
-	char check_str[32], comp_str[32];
-	uint8_t check_algo, comp_algo;
-	uint32_t cv;
-	uint64_t cv64;
-	static int init_tab = -1;
-	uuid_t uuid;
+	hammer2_key_t last;
 
-	SHA256_CTX hash_ctx;
-	union {
-		uint8_t digest[SHA256_DIGEST_LENGTH];
-		uint64_t digest64[SHA256_DIGEST_LENGTH/8];
-	} u;
+	if (bref->keybits >= 64)
+		last = HAMMER2_KEY_MAX;
+	else
+		last = bref->key | (((hammer2_key_t)1 << bref->keybits) - 1);
+	return (bref->key <= end && last >= beg);
+}
 
+/*
+ * Return non-zero if a blockref and everything below it is not shown.
+ * The key range of indirect blocks is used to prune the walk.
+ */
+static int
+show_skip(const hammer2_blockref_t *bref, const show_ctx_t *ctx)
+{
 	/* omit if smaller than mininum mirror_tid threshold */
 	if (bref->mirror_tid < show_min_mirror_tid)
-		return;
+		return 1;
 	/* omit if smaller than mininum modify_tid threshold */
 	if (bref->modify_tid < show_min_modify_tid) {
 		if (bref->modify_tid)
-			return;
+			return 1;
 		else if (bref->type == HAMMER2_BREF_TYPE_INODE && !bref->leaf_count)
-			return;
+			return 1;
 	}
 
-	if (init_tab == -1)
-		init_tab = tab;
+	switch(ctx->space) {
+	case SHOW_SPACE_PFS:
+		/*
+		 * The PFS name may have been bumped within the collision
+		 * space, the name comparison picks the right one.
+		 */
+		if (show_label &&
+		    !show_key_overlaps(bref, show_label_key,
+		    show_label_key | HAMMER2_DIRHASH_LOMASK))
+			return 1;
+		break;
+	case SHOW_SPACE_INODES:
+		if (show_inum_set) {
+			if (!show_key_overlaps(bref, show_inum, show_inum))
+				return 1;
+		} else if (show_key_set) {
+			if (!show_key_overlaps(bref, show_key_beg, show_key_end))
+				return 1;
+		}
+		break;
+	case SHOW_SPACE_FILE:
+		if (ctx->selected && show_key_set &&
+		    !show_key_overlaps(bref, show_key_beg, show_key_end))
+			return 1;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Return non-zero if a blockref which is walked is also printed.  Blocks
+ * of other types or newer than the maximum tids are only walked through.
+ */
+static int
+show_printable(const hammer2_blockref_t *bref)
+{
+	if (show_type >= 0 && bref->type != show_type)
+		return 0;
+	if (bref->mirror_tid > show_max_mirror_tid)
+		return 0;
+	if (bref->modify_tid > show_max_modify_tid)
+		return 0;
+	return 1;
+}
+
+/*
+ * Return the size of the block of a blockref, or 0, along with the read
+ * needed to get it.  Reads are done in multiples of the logical buffer
+ * size, the block starting boff bytes into the read.
+ */
+static size_t
+show_block_io(const hammer2_blockref_t *bref, int *fdp, off_t *offsetp,
+	      size_t *io_bytesp, size_t *boffp)
+{
+	hammer2_off_t io_off;
+	hammer2_off_t io_base;
+	size_t bytes;
+	size_t io_bytes;
 
 	bytes = (bref->data_off & HAMMER2_OFF_MASK_RADIX);
-	if (bytes)
-		bytes = (size_t)1 << bytes;
-	if (bytes) {
-		hammer2_off_t io_off;
-		hammer2_off_t io_base;
-		size_t io_bytes;
-		size_t boff;
+	if (bytes == 0)
+		return 0;
+	bytes = (size_t)1 << bytes;
+
+	io_off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
+	io_base = io_off & ~(hammer2_off_t)(HAMMER2_LBUFSIZE - 1);
+	*boffp = io_off - io_base;
+
+	io_bytes = HAMMER2_LBUFSIZE;
+	while (io_bytes + *boffp < bytes)
+		io_bytes <<= 1;
+	*io_bytesp = io_bytes;
+	*fdp = hammer2_get_volume_fd(io_off);
+	*offsetp = io_base - hammer2_get_volume_offset(io_base);
+
+	return bytes;
+}
 
-		io_off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
-		io_base = io_off & ~(hammer2_off_t)(HAMMER2_LBUFSIZE - 1);
-		boff = io_off - io_base;
+static void *
+show_thread(void *arg __unused)
+{
+	show_io_t *io;
+	ssize_t n;
+
+	pthread_mutex_lock(&ShowPool.lock);
+	for (;;) {
+		while (ShowPool.qhead == NULL && ShowPool.stopping == 0)
+			pthread_cond_wait(&ShowPool.cond, &ShowPool.lock);
+		if ((io = ShowPool.qhead) == NULL)
+			break;
+		ShowPool.qhead = io->next;
+		io->state = SHOW_IO_READING;
+		pthread_mutex_unlock(&ShowPool.lock);
 
-		io_bytes = HAMMER2_LBUFSIZE;
-		while (io_bytes + boff < bytes)
-			io_bytes <<= 1;
+		n = pread(io->fd, io->buf, io->io_bytes, io->offset);
 
-		if (io_bytes > sizeof(media)) {
-			printf("(bad block size %zu)\n", bytes);
-			return;
-		}
-		if (bref->type != HAMMER2_BREF_TYPE_DATA || VerboseOpt >= 1) {
-			fd = hammer2_get_volume_fd(io_off);
-			lseek(fd, io_base - hammer2_get_volume_offset(io_base),
-			      SEEK_SET);
-			if (read(fd, &media, io_bytes) != (ssize_t)io_bytes) {
-				printf("(media read failed)\n");
-				return;
-			}
-			if (boff)
-				bcopy((char *)&media + boff, &media, bytes);
-		}
+		pthread_mutex_lock(&ShowPool.lock);
+		io->result = n;
+		io->state = SHOW_IO_DONE;
+		pthread_cond_broadcast(&ShowPool.done_cond);
 	}
+	pthread_mutex_unlock(&ShowPool.lock);
 
-	bscan = NULL;
-	bcount = 0;
-	namelen = 0;
-	failed = 0;
-	obrace = 1;
+	return NULL;
+}
 
-	type_str = hammer2_breftype_to_str(bref->type);
-	type_pad = 8 - strlen(type_str);
-	if (type_pad < 0)
-		type_pad = 0;
+static void
+show_start_pool(void)
+{
+	int i;
 
-	switch(bref->type) {
-	case HAMMER2_BREF_TYPE_INODE:
-		assert(bytes);
-		if (!(media.ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA)) {
-			bscan = &media.ipdata.u.blockset.blockref[0];
-			bcount = HAMMER2_SET_COUNT;
+	if (NThreadsOpt <= 1)
+		return;
+	ShowPool.threads = calloc(NThreadsOpt, sizeof(pthread_t));
+	if (ShowPool.threads == NULL)
+		err(1, "calloc");
+	for (i = 0; i < NThreadsOpt; ++i) {
+		if (pthread_create(&ShowPool.threads[i], NULL,
+				   show_thread, NULL) != 0)
+			errx(1, "pthread_create failed");
+	}
+	ShowPool.nthreads = NThreadsOpt;
+}
+
+static void
+show_stop_pool(void)
+{
+	show_io_t *io;
+	int i;
+
+	if (ShowPool.nthreads) {
+		pthread_mutex_lock(&ShowPool.lock);
+		ShowPool.stopping = 1;
+		pthread_cond_broadcast(&ShowPool.cond);
+		pthread_mutex_unlock(&ShowPool.lock);
+		for (i = 0; i < ShowPool.nthreads; ++i)
+			pthread_join(ShowPool.threads[i], NULL);
+		free(ShowPool.threads);
+		ShowPool.threads = NULL;
+		ShowPool.nthreads = 0;
+	}
+	while ((io = ShowPool.freeq) != NULL) {
+		ShowPool.freeq = io->next;
+		free(io->buf);
+		free(io);
+	}
+}
+
+/*
+ * Queue the read of the block of a blockref which is about to be shown.
+ * Returns NULL if the block is not read or is skipped, otherwise the
+ * request must be passed to show_bref().  The free list is only used by
+ * the printer.
+ */
+static show_io_t *
+show_io_queue(const hammer2_blockref_t *bref, const show_ctx_t *ctx)
+{
+	show_io_t *io;
+	size_t bytes;
+	size_t io_bytes;
+	size_t boff;
+	off_t offset;
+	int fd;
+
+	if (bref->type == HAMMER2_BREF_TYPE_EMPTY || show_skip(bref, ctx))
+		return NULL;
+	if (bref->type == HAMMER2_BREF_TYPE_DATA && VerboseOpt < 1)
+		return NULL;
+	bytes = show_block_io(bref, &fd, &offset, &io_bytes, &boff);
+	if (bytes == 0 || io_bytes > sizeof(hammer2_media_data_t))
+		return NULL;
+
+	if ((io = ShowPool.freeq) != NULL) {
+		ShowPool.freeq = io->next;
+	} else {
+		io = calloc(1, sizeof(*io));
+		if (io == NULL || (io->buf = malloc(sizeof(*io->buf))) == NULL)
+			err(1, "malloc");
+	}
+	io->fd = fd;
+	io->offset = offset;
+	io->io_bytes = io_bytes;
+	io->result = -1;
+	io->state = SHOW_IO_QUEUED;
+
+	pthread_mutex_lock(&ShowPool.lock);
+	io->next = ShowPool.qhead;
+	ShowPool.qhead = io;
+	pthread_cond_signal(&ShowPool.cond);
+	pthread_mutex_unlock(&ShowPool.lock);
+
+	return io;
+}
+
+/*
+ * Wait for a queued read, doing it here if no thread has started it.
+ * Returns the number of bytes read or -1.
+ */
+static ssize_t
+show_io_wait(show_io_t *io)
+{
+	show_io_t **iop;
+	ssize_t n;
+
+	pthread_mutex_lock(&ShowPool.lock);
+	if (io->state == SHOW_IO_QUEUED) {
+		for (iop = &ShowPool.qhead; *iop != io; iop = &(*iop)->next)
+			;
+		*iop = io->next;
+		io->state = SHOW_IO_READING;
+		pthread_mutex_unlock(&ShowPool.lock);
+
+		n = pread(io->fd, io->buf, io->io_bytes, io->offset);
+
+		pthread_mutex_lock(&ShowPool.lock);
+		io->result = n;
+		io->state = SHOW_IO_DONE;
+	}
+	while (io->state != SHOW_IO_DONE)
+		pthread_cond_wait(&ShowPool.done_cond, &ShowPool.lock);
+	pthread_mutex_unlock(&ShowPool.lock);
+
+	return io->result;
+}
+
+static void
+show_io_free(show_io_t *io)
+{
+	io->next = ShowPool.freeq;
+	ShowPool.freeq = io;
+}
+
+/*
+ * Verify the check code of a block, describing the result in buf.
+ * Returns non-zero on mismatch.
+ */
+static int
+show_check(const hammer2_blockref_t *bref, const hammer2_media_data_t *media,
+	   size_t bytes, char *buf, size_t len)
+{
+	char check_str[32], comp_str[32];
+	uint8_t check_algo, comp_algo;
+	uint32_t cv;
+	uint64_t cv64;
+	int failed = 0;
+
+	SHA256_CTX hash_ctx;
+	union {
+		uint8_t digest[SHA256_DIGEST_LENGTH];
+		uint64_t digest64[SHA256_DIGEST_LENGTH/8];
+	} u;
+
+	check_algo = HAMMER2_DEC_CHECK(bref->methods);
+	strlcpy(check_str, hammer2_checkmode_to_str(check_algo),
+		sizeof(check_str));
+	comp_algo = HAMMER2_DEC_COMP(bref->methods);
+	strlcpy(comp_str, hammer2_compmode_to_str(comp_algo),
+		sizeof(comp_str));
+
+	buf[0] = 0;
+	switch(check_algo) {
+	case HAMMER2_CHECK_NONE:
+		snprintf(buf, len, "meth=%s|%s ", check_str, comp_str);
+		break;
+	case HAMMER2_CHECK_DISABLED:
+		snprintf(buf, len, "meth=%s|%s ", check_str, comp_str);
+		break;
+	case HAMMER2_CHECK_ISCSI32:
+		cv = hammer2_icrc32(media, bytes);
+		if (bref->check.iscsi32.value != cv) {
+			snprintf(buf, len, "(icrc %s|%s %08x/%08x failed) ",
+				 check_str, comp_str,
+				 bref->check.iscsi32.value,
+				 cv);
+			failed = 1;
+		} else {
+			snprintf(buf, len, "meth=%s|%s iscsi32=%08x ",
+				 check_str, comp_str, cv);
 		}
 		break;
-	case HAMMER2_BREF_TYPE_INDIRECT:
-		assert(bytes);
-		bscan = &media.npdata[0];
-		bcount = bytes / sizeof(hammer2_blockref_t);
+	case HAMMER2_CHECK_XXHASH64:
+		cv64 = XXH64(media, bytes, XXH_HAMMER2_SEED);
+		if (bref->check.xxhash64.value != cv64) {
+			snprintf(buf, len,
+				 "(xxhash64 %s|%s %016jx/%016jx failed) ",
+				 check_str, comp_str,
+				 bref->check.xxhash64.value,
+				 cv64);
+			failed = 1;
+		} else {
+			snprintf(buf, len, "meth=%s|%s xxh=%016jx ",
+				 check_str, comp_str, cv64);
+		}
 		break;
-	case HAMMER2_BREF_TYPE_VOLUME:
-		bscan = &media.voldata.sroot_blockset.blockref[0];
-		bcount = HAMMER2_SET_COUNT;
+	case HAMMER2_CHECK_SHA192:
+		SHA256_Init(&hash_ctx);
+		SHA256_Update(&hash_ctx, (const uint8_t*)media->buf, bytes);
+		SHA256_Final(u.digest, &hash_ctx);
+		u.digest64[2] ^= u.digest64[3];
+		if (memcmp(u.digest, bref->check.sha192.data,
+		    sizeof(bref->check.sha192.data))) {
+			snprintf(buf, len, "(sha192 %s:%s failed) ",
+				 check_str, comp_str);
+			failed = 1;
+		} else {
+			snprintf(buf, len, "meth=%s|%s ", check_str, comp_str);
+		}
 		break;
-	case HAMMER2_BREF_TYPE_FREEMAP:
-		bscan = &media.voldata.freemap_blockset.blockref[0];
-		bcount = HAMMER2_SET_COUNT;
+	case HAMMER2_CHECK_FREEMAP:
+		cv = hammer2_icrc32(media, bytes);
+		if (bref->check.freemap.icrc32 != cv) {
+			snprintf(buf, len, "(fcrc %s|%s %08x/%08x failed) ",
+				 check_str, comp_str,
+				 bref->check.freemap.icrc32,
+				 cv);
+			failed = 1;
+		} else {
+			snprintf(buf, len, "meth=%s|%s fcrc=%08x ",
+				 check_str, comp_str, cv);
+		}
 		break;
-	case HAMMER2_BREF_TYPE_FREEMAP_NODE:
-		assert(bytes);
-		bscan = &media.npdata[0];
-		bcount = bytes / sizeof(hammer2_blockref_t);
+	}
+	return failed;
+}
+
+static void
+show_json_string(const char *str, size_t len)
+{
+	size_t i;
+	int c;
+
+	putchar('"');
+	for (i = 0; i < len && str[i]; ++i) {
+		c = (unsigned char)str[i];
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20 || c >= 0x7f)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+/*
+ * One JSON object per line.  64 bit values are given as hex strings.
+ */
+static void
+show_json(const hammer2_blockref_t *bref, int bi, const show_ctx_t *ctx,
+	  const hammer2_media_data_t *media, int checked, int failed)
+{
+	const hammer2_inode_meta_t *meta;
+	const char *name;
+	size_t namelen;
+
+	printf("{\"depth\":%d,\"index\":%d,\"type\":\"%s\"",
+	       ctx->depth, bi, hammer2_breftype_to_str(bref->type));
+	printf(",\"data_off\":\"0x%016jx\",\"key\":\"0x%016jx\","
+	       "\"keybits\":%d,\"vol\":%d",
+	       (uintmax_t)bref->data_off, (uintmax_t)bref->key,
+	       bref->keybits, hammer2_get_volume_id(bref->data_off));
+	printf(",\"mirror_tid\":\"0x%016jx\",\"modify_tid\":\"0x%016jx\"",
+	       (uintmax_t)bref->mirror_tid, (uintmax_t)bref->modify_tid);
+	printf(",\"leaf_count\":%d,\"flags\":%d,\"check\":\"%s\","
+	       "\"comp\":\"%s\",\"verified\":%s",
+	       bref->leaf_count, bref->flags,
+	       hammer2_checkmode_to_str(HAMMER2_DEC_CHECK(bref->methods)),
+	       hammer2_compmode_to_str(HAMMER2_DEC_COMP(bref->methods)),
+	       checked ? (failed ? "false" : "true") : "null");
+	if (ctx->pfs[0]) {
+		printf(",\"pfs\":");
+		show_json_string(ctx->pfs, sizeof(ctx->pfs));
+	}
+	if (ctx->inum)
+		printf(",\"owner\":\"0x%016jx\"", (uintmax_t)ctx->inum);
+
+	switch(bref->type) {
+	case HAMMER2_BREF_TYPE_INODE:
+		if (!checked || failed)
+			break;
+		meta = &media->ipdata.meta;
+		namelen = meta->name_len;
+		if (namelen > HAMMER2_INODE_MAXNAME)
+			namelen = 0;
+		printf(",\"inum\":\"0x%016jx\",\"name\":",
+		       (uintmax_t)meta->inum);
+		show_json_string((const char *)media->ipdata.filename,
+				 namelen);
+		printf(",\"objtype\":\"%s\",\"mode\":\"%o\",\"size\":%ju,"
+		       "\"nlinks\":%ju,\"iparent\":\"0x%016jx\"",
+		       hammer2_iptype_to_str(meta->type), meta->mode,
+		       (uintmax_t)meta->size, (uintmax_t)meta->nlinks,
+		       (uintmax_t)meta->iparent);
+		break;
+	case HAMMER2_BREF_TYPE_DIRENT:
+		namelen = bref->embed.dirent.namlen;
+		if (namelen <= sizeof(bref->check.buf))
+			name = (const char *)bref->check.buf;
+		else if (checked)
+			name = media->buf;
+		else
+			name = "";
+		printf(",\"inum\":\"0x%016jx\",\"name\":",
+		       (uintmax_t)bref->embed.dirent.inum);
+		show_json_string(name, namelen);
+		printf(",\"objtype\":\"%s\"",
+		       hammer2_iptype_to_str(bref->embed.dirent.type));
 		break;
 	}
+	printf("}\n");
+}
+
+static void
+show_binary(const hammer2_blockref_t *bref, int bi, const show_ctx_t *ctx,
+	    int checked, int failed)
+{
+	show_rec_t rec;
+
+	bzero(&rec, sizeof(rec));
+	rec.magic = SHOW_REC_MAGIC;
+	rec.depth = ctx->depth;
+	rec.index = bi;
+	if (checked)
+		rec.flags |= SHOW_REC_CHECKED;
+	if (failed)
+		rec.flags |= SHOW_REC_FAILED;
+	rec.inum = ctx->inum;
+	rec.bref = *bref;
+	if (fwrite(&rec, sizeof(rec), 1, stdout) != 1)
+		err(1, "show");
+}
+
+/*
+ * Print a blockref and its block as text, returns non-zero if a closing
+ * brace must follow its children.
+ */
+static int
+show_text(hammer2_blockref_t *bref, int tab, int bi,
+	  hammer2_media_data_t *media, size_t bytes, int bcount, int checked,
+	  const char *check_desc, int norecurse)
+{
+	hammer2_off_t tmp;
+	int i, namelen, obrace;
+	int type_pad;
+	const char *type_str;
+	char *str = NULL;
+	uuid_t uuid;
+
+	obrace = 1;
+
+	type_str = hammer2_breftype_to_str(bref->type);
+	type_pad = 8 - strlen(type_str);
+	if (type_pad < 0)
+		type_pad = 0;
 
 	if (QuietOpt > 0) {
 		tabprintf(tab,
@@ -556,97 +1162,27 @@ show_bref(hammer2_volume_data_t *voldata, int tab, int bi,
 	/*
 	 * Check data integrity in verbose mode, otherwise we are just doing
 	 * a quick meta-data scan.  Meta-data integrity is always checked.
-	 * (Also see the check above that ensures the media data is loaded,
+	 * (Also see show_bref() which ensures the media data is loaded,
 	 * otherwise there's no data to check!).
 	 *
 	 * WARNING! bref->check state may be used for other things when
 	 *	    bref has no data (bytes == 0).
 	 */
-	if (bytes &&
-	    (bref->type != HAMMER2_BREF_TYPE_DATA || VerboseOpt >= 1)) {
+	if (checked) {
 		if (!(QuietOpt > 0)) {
 			/*if (norecurse > 1)*/ {
 				printf("\n");
 				tabprintf(tab + 13, "");
 			}
 		}
-
-		check_algo = HAMMER2_DEC_CHECK(bref->methods);
-		strlcpy(check_str, hammer2_checkmode_to_str(check_algo),
-			sizeof(check_str));
-		comp_algo = HAMMER2_DEC_COMP(bref->methods);
-		strlcpy(comp_str, hammer2_compmode_to_str(comp_algo),
-			sizeof(comp_str));
-
-		switch(check_algo) {
-		case HAMMER2_CHECK_NONE:
-			printf("meth=%s|%s ", check_str, comp_str);
-			break;
-		case HAMMER2_CHECK_DISABLED:
-			printf("meth=%s|%s ", check_str, comp_str);
-			break;
-		case HAMMER2_CHECK_ISCSI32:
-			cv = hammer2_icrc32(&media, bytes);
-			if (bref->check.iscsi32.value != cv) {
-				printf("(icrc %s|%s %08x/%08x failed) ",
-				       check_str, comp_str,
-				       bref->check.iscsi32.value,
-				       cv);
-				failed = 1;
-			} else {
-				printf("meth=%s|%s iscsi32=%08x ",
-				       check_str, comp_str, cv);
-			}
-			break;
-		case HAMMER2_CHECK_XXHASH64:
-			cv64 = XXH64(&media, bytes, XXH_HAMMER2_SEED);
-			if (bref->check.xxhash64.value != cv64) {
-				printf("(xxhash64 %s|%s %016jx/%016jx failed) ",
-				       check_str, comp_str,
-				       bref->check.xxhash64.value,
-				       cv64);
-				failed = 1;
-			} else {
-				printf("meth=%s|%s xxh=%016jx ",
-				       check_str, comp_str, cv64);
-			}
-			break;
-		case HAMMER2_CHECK_SHA192:
-			SHA256_Init(&hash_ctx);
-			SHA256_Update(&hash_ctx, (const uint8_t*)media.buf, bytes);
-			SHA256_Final(u.digest, &hash_ctx);
-			u.digest64[2] ^= u.digest64[3];
-			if (memcmp(u.digest, bref->check.sha192.data,
-			    sizeof(bref->check.sha192.data))) {
-				printf("(sha192 %s:%s failed) ",
-				       check_str, comp_str);
-				failed = 1;
-			} else {
-				printf("meth=%s|%s ", check_str, comp_str);
-			}
-			break;
-		case HAMMER2_CHECK_FREEMAP:
-			cv = hammer2_icrc32(&media, bytes);
-			if (bref->check.freemap.icrc32 != cv) {
-				printf("(fcrc %s|%s %08x/%08x failed) ",
-					check_str, comp_str,
-					bref->check.freemap.icrc32,
-					cv);
-				failed = 1;
-			} else {
-				printf("meth=%s|%s fcrc=%08x ",
-					check_str, comp_str, cv);
-			}
-			break;
-		}
+		printf("%s", check_desc);
 	}
 
 	tab += show_tab;
 
 	if (QuietOpt > 0) {
-		obrace = 0;
 		printf("\n");
-		goto skip_data;
+		return 0;
 	}
 
 	switch(bref->type) {
@@ -666,7 +1202,7 @@ show_bref(hammer2_volume_data_t *voldata, int tab, int bi,
 			tabprintf(tab, "filename \"%*.*s\"\n",
 				bref->embed.dirent.namlen,
 				bref->embed.dirent.namlen,
-				media.buf);
+				media->buf);
 		}
 		tabprintf(tab, "inum 0x%016jx\n",
 			  (uintmax_t)bref->embed.dirent.inum);
@@ -676,95 +1212,95 @@ show_bref(hammer2_volume_data_t *voldata, int tab, int bi,
 		break;
 	case HAMMER2_BREF_TYPE_INODE:
 		printf("{\n");
-		namelen = media.ipdata.meta.name_len;
+		namelen = media->ipdata.meta.name_len;
 		if (namelen > HAMMER2_INODE_MAXNAME)
 			namelen = 0;
 		tabprintf(tab, "filename \"%*.*s\"\n",
-			  namelen, namelen, media.ipdata.filename);
-		tabprintf(tab, "version  %d\n", media.ipdata.meta.version);
-		if ((media.ipdata.meta.op_flags & HAMMER2_OPFLAG_PFSROOT) ||
-		    media.ipdata.meta.pfs_type == HAMMER2_PFSTYPE_SUPROOT) {
+			  namelen, namelen, media->ipdata.filename);
+		tabprintf(tab, "version  %d\n", media->ipdata.meta.version);
+		if ((media->ipdata.meta.op_flags & HAMMER2_OPFLAG_PFSROOT) ||
+		    media->ipdata.meta.pfs_type == HAMMER2_PFSTYPE_SUPROOT) {
 			tabprintf(tab, "pfs_st   %d (%s)\n",
-				  media.ipdata.meta.pfs_subtype,
-				  hammer2_pfssubtype_to_str(media.ipdata.meta.pfs_subtype));
+				  media->ipdata.meta.pfs_subtype,
+				  hammer2_pfssubtype_to_str(media->ipdata.meta.pfs_subtype));
 		}
 		tabprintf(tab, "uflags   0x%08x\n",
-			  media.ipdata.meta.uflags);
-		if (media.ipdata.meta.rmajor || media.ipdata.meta.rminor) {
+			  media->ipdata.meta.uflags);
+		if (media->ipdata.meta.rmajor || media->ipdata.meta.rminor) {
 			tabprintf(tab, "rmajor   %d\n",
-				  media.ipdata.meta.rmajor);
+				  media->ipdata.meta.rmajor);
 			tabprintf(tab, "rminor   %d\n",
-				  media.ipdata.meta.rminor);
+				  media->ipdata.meta.rminor);
 		}
 		tabprintf(tab, "ctime    %s\n",
-			  hammer2_time64_to_str(media.ipdata.meta.ctime, &str));
+			  hammer2_time64_to_str(media->ipdata.meta.ctime, &str));
 		tabprintf(tab, "mtime    %s\n",
-			  hammer2_time64_to_str(media.ipdata.meta.mtime, &str));
+			  hammer2_time64_to_str(media->ipdata.meta.mtime, &str));
 		tabprintf(tab, "atime    %s\n",
-			  hammer2_time64_to_str(media.ipdata.meta.atime, &str));
+			  hammer2_time64_to_str(media->ipdata.meta.atime, &str));
 		tabprintf(tab, "btime    %s\n",
-			  hammer2_time64_to_str(media.ipdata.meta.btime, &str));
-		uuid = media.ipdata.meta.uid;
+			  hammer2_time64_to_str(media->ipdata.meta.btime, &str));
+		uuid = media->ipdata.meta.uid;
 		tabprintf(tab, "uid      %s\n",
 			  hammer2_uuid_to_str(&uuid, &str));
-		uuid = media.ipdata.meta.gid;
+		uuid = media->ipdata.meta.gid;
 		tabprintf(tab, "gid      %s\n",
 			  hammer2_uuid_to_str(&uuid, &str));
 		tabprintf(tab, "type     %s\n",
-			  hammer2_iptype_to_str(media.ipdata.meta.type));
+			  hammer2_iptype_to_str(media->ipdata.meta.type));
 		tabprintf(tab, "opflgs   0x%02x\n",
-			  media.ipdata.meta.op_flags);
+			  media->ipdata.meta.op_flags);
 		tabprintf(tab, "capflgs  0x%04x\n",
-			  media.ipdata.meta.cap_flags);
+			  media->ipdata.meta.cap_flags);
 		tabprintf(tab, "mode     %-7o\n",
-			  media.ipdata.meta.mode);
+			  media->ipdata.meta.mode);
 		tabprintf(tab, "inum     0x%016jx\n",
-			  media.ipdata.meta.inum);
+			  media->ipdata.meta.inum);
 		tabprintf(tab, "size     %ju ",
-			  (uintmax_t)media.ipdata.meta.size);
-		if (media.ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA &&
-		    media.ipdata.meta.size <= HAMMER2_EMBEDDED_BYTES)
+			  (uintmax_t)media->ipdata.meta.size);
+		if (media->ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA &&
+		    media->ipdata.meta.size <= HAMMER2_EMBEDDED_BYTES)
 			printf("(embedded data)\n");
 		else
 			printf("\n");
 		tabprintf(tab, "nlinks   %ju\n",
-			  (uintmax_t)media.ipdata.meta.nlinks);
+			  (uintmax_t)media->ipdata.meta.nlinks);
 		tabprintf(tab, "iparent  0x%016jx\n",
-			  (uintmax_t)media.ipdata.meta.iparent);
+			  (uintmax_t)media->ipdata.meta.iparent);
 		tabprintf(tab, "name_key 0x%016jx\n",
-			  (uintmax_t)media.ipdata.meta.name_key);
+			  (uintmax_t)media->ipdata.meta.name_key);
 		tabprintf(tab, "name_len %u\n",
-			  media.ipdata.meta.name_len);
+			  media->ipdata.meta.name_len);
 		tabprintf(tab, "ncopies  %u\n",
-			  media.ipdata.meta.ncopies);
+			  media->ipdata.meta.ncopies);
 		tabprintf(tab, "compalg  %s\n",
-			  hammer2_compmode_to_str(media.ipdata.meta.comp_algo));
+			  hammer2_compmode_to_str(media->ipdata.meta.comp_algo));
 		tabprintf(tab, "checkalg %s\n",
-			  hammer2_checkmode_to_str(media.ipdata.meta.check_algo));
-		if ((media.ipdata.meta.op_flags & HAMMER2_OPFLAG_PFSROOT) ||
-		    media.ipdata.meta.pfs_type == HAMMER2_PFSTYPE_SUPROOT) {
+			  hammer2_checkmode_to_str(media->ipdata.meta.check_algo));
+		if ((media->ipdata.meta.op_flags & HAMMER2_OPFLAG_PFSROOT) ||
+		    media->ipdata.meta.pfs_type == HAMMER2_PFSTYPE_SUPROOT) {
 			tabprintf(tab, "pfs_nmas %u\n",
-				  media.ipdata.meta.pfs_nmasters);
+				  media->ipdata.meta.pfs_nmasters);
 			tabprintf(tab, "pfs_type %u (%s)\n",
-				  media.ipdata.meta.pfs_type,
-				  hammer2_pfstype_to_str(media.ipdata.meta.pfs_type));
+				  media->ipdata.meta.pfs_type,
+				  hammer2_pfstype_to_str(media->ipdata.meta.pfs_type));
 			tabprintf(tab, "pfs_inum 0x%016jx\n",
-				  (uintmax_t)media.ipdata.meta.pfs_inum);
-			uuid = media.ipdata.meta.pfs_clid;
+				  (uintmax_t)media->ipdata.meta.pfs_inum);
+			uuid = media->ipdata.meta.pfs_clid;
 			tabprintf(tab, "pfs_clid %s\n",
 				  hammer2_uuid_to_str(&uuid, &str));
-			uuid = media.ipdata.meta.pfs_fsid;
+			uuid = media->ipdata.meta.pfs_fsid;
 			tabprintf(tab, "pfs_fsid %s\n",
 				  hammer2_uuid_to_str(&uuid, &str));
 			tabprintf(tab, "pfs_lsnap_tid 0x%016jx\n",
-				  (uintmax_t)media.ipdata.meta.pfs_lsnap_tid);
+				  (uintmax_t)media->ipdata.meta.pfs_lsnap_tid);
 		}
 		tabprintf(tab, "data_quota  %ju\n",
-			  (uintmax_t)media.ipdata.meta.data_quota);
+			  (uintmax_t)media->ipdata.meta.data_quota);
 		tabprintf(tab, "data_count  %ju\n",
 			  (uintmax_t)bref->embed.stats.data_count);
 		tabprintf(tab, "inode_quota %ju\n",
-			  (uintmax_t)media.ipdata.meta.inode_quota);
+			  (uintmax_t)media->ipdata.meta.inode_quota);
 		tabprintf(tab, "inode_count %ju\n",
 			  (uintmax_t)bref->embed.stats.inode_count);
 		break;
@@ -777,14 +1313,14 @@ show_bref(hammer2_volume_data_t *voldata, int tab, int bi,
 		break;
 	case HAMMER2_BREF_TYPE_VOLUME:
 		printf("mirror_tid=%016jx freemap_tid=%016jx ",
-			media.voldata.mirror_tid,
-			media.voldata.freemap_tid);
+			media->voldata.mirror_tid,
+			media->voldata.freemap_tid);
 		printf("{\n");
 		break;
 	case HAMMER2_BREF_TYPE_FREEMAP:
 		printf("mirror_tid=%016jx freemap_tid=%016jx ",
-			media.voldata.mirror_tid,
-			media.voldata.freemap_tid);
+			media->voldata.mirror_tid,
+			media->voldata.freemap_tid);
 		printf("{\n");
 		break;
 	case HAMMER2_BREF_TYPE_FREEMAP_LEAF:
@@ -807,17 +1343,17 @@ show_bref(hammer2_volume_data_t *voldata, int tab, int bi,
 			tabprintf(tab + 4, "%016jx %04d.%04x linear=%06x avail=%06x "
 				  "%016jx %016jx %016jx %016jx "
 				  "%016jx %016jx %016jx %016jx\n",
-				  data_off, i, media.bmdata[i].class,
-				  media.bmdata[i].linear,
-				  media.bmdata[i].avail,
-				  media.bmdata[i].bitmapq[0],
-				  media.bmdata[i].bitmapq[1],
-				  media.bmdata[i].bitmapq[2],
-				  media.bmdata[i].bitmapq[3],
-				  media.bmdata[i].bitmapq[4],
-				  media.bmdata[i].bitmapq[5],
-				  media.bmdata[i].bitmapq[6],
-				  media.bmdata[i].bitmapq[7]);
+				  data_off, i, media->bmdata[i].class,
+				  media->bmdata[i].linear,
+				  media->bmdata[i].avail,
+				  media->bmdata[i].bitmapq[0],
+				  media->bmdata[i].bitmapq[1],
+				  media->bmdata[i].bitmapq[2],
+				  media->bmdata[i].bitmapq[3],
+				  media->bmdata[i].bitmapq[4],
+				  media->bmdata[i].bitmapq[5],
+				  media->bmdata[i].bitmapq[6],
+				  media->bmdata[i].bitmapq[7]);
 		}
 		tabprintf(tab, "}\n");
 		break;
@@ -840,7 +1376,159 @@ show_bref(hammer2_volume_data_t *voldata, int tab, int bi,
 	if (str)
 		free(str);
 
-skip_data:
+	return obrace;
+}
+
+/*
+ * Show a blockref and walk its block table.  io is the read ahead of
+ * the block queued by the caller, if any.
+ */
+static void
+show_bref(hammer2_volume_data_t *voldata, int tab, int bi,
+	  hammer2_blockref_t *bref, int norecurse, const show_ctx_t *ctx,
+	  show_io_t *io)
+{
+	hammer2_media_data_t media;
+	hammer2_blockref_t *bscan;
+	show_io_t *ring[SHOW_WINDOW];
+	show_ctx_t cctx;
+	size_t bytes;
+	size_t io_bytes;
+	size_t boff;
+	ssize_t n;
+	off_t offset;
+	int i, qi, bcount, namelen, failed, obrace, fd;
+	int checked;
+	int printed;
+	int text;
+	char check_desc[128];
+
+	if (show_skip(bref, ctx))
+		return;
+
+	text = (show_format == SHOW_FORMAT_TEXT);
+	checked = 0;
+	bytes = show_block_io(bref, &fd, &offset, &io_bytes, &boff);
+	if (bytes) {
+		if (io_bytes > sizeof(media)) {
+			if (text)
+				printf("(bad block size %zu)\n", bytes);
+			else
+				warnx("%016jx: bad block size %zu",
+				      (uintmax_t)bref->data_off, bytes);
+			return;
+		}
+		if (bref->type != HAMMER2_BREF_TYPE_DATA || VerboseOpt >= 1) {
+			if (io) {
+				n = show_io_wait(io);
+				if (n == (ssize_t)io_bytes)
+					bcopy((char *)io->buf + boff, &media,
+					      bytes);
+				show_io_free(io);
+			} else {
+				n = pread(fd, &media, io_bytes, offset);
+				if (n == (ssize_t)io_bytes && boff)
+					bcopy((char *)&media + boff, &media,
+					      bytes);
+			}
+			if (n != (ssize_t)io_bytes) {
+				if (text)
+					printf("(media read failed)\n");
+				else
+					warnx("%016jx: media read failed",
+					      (uintmax_t)bref->data_off);
+				return;
+			}
+			checked = 1;
+		}
+	}
+
+	bscan = NULL;
+	bcount = 0;
+	namelen = 0;
+	failed = 0;
+	obrace = 0;
+
+	switch(bref->type) {
+	case HAMMER2_BREF_TYPE_INODE:
+		assert(bytes);
+		if (!(media.ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA)) {
+			bscan = &media.ipdata.u.blockset.blockref[0];
+			bcount = HAMMER2_SET_COUNT;
+		}
+		break;
+	case HAMMER2_BREF_TYPE_INDIRECT:
+		assert(bytes);
+		bscan = &media.npdata[0];
+		bcount = bytes / sizeof(hammer2_blockref_t);
+		break;
+	case HAMMER2_BREF_TYPE_VOLUME:
+		bscan = &media.voldata.sroot_blockset.blockref[0];
+		bcount = HAMMER2_SET_COUNT;
+		break;
+	case HAMMER2_BREF_TYPE_FREEMAP:
+		bscan = &media.voldata.freemap_blockset.blockref[0];
+		bcount = HAMMER2_SET_COUNT;
+		break;
+	case HAMMER2_BREF_TYPE_FREEMAP_NODE:
+		assert(bytes);
+		bscan = &media.npdata[0];
+		bcount = bytes / sizeof(hammer2_blockref_t);
+		break;
+	}
+
+	/*
+	 * The table its children belong to.  The key of a PFS root is the
+	 * hash of its name, which may collide.
+	 */
+	cctx = *ctx;
+	cctx.depth = ctx->depth + 1;
+	switch(bref->type) {
+	case HAMMER2_BREF_TYPE_VOLUME:
+		cctx.space = SHOW_SPACE_SROOT;
+		break;
+	case HAMMER2_BREF_TYPE_INODE:
+		namelen = media.ipdata.meta.name_len;
+		if (namelen > HAMMER2_INODE_MAXNAME)
+			namelen = 0;
+		if (media.ipdata.meta.pfs_type == HAMMER2_PFSTYPE_SUPROOT) {
+			cctx.space = SHOW_SPACE_PFS;
+		} else if (ctx->space == SHOW_SPACE_PFS) {
+			bcopy(media.ipdata.filename, cctx.pfs, namelen);
+			cctx.pfs[namelen] = 0;
+			if (show_label && strcmp(cctx.pfs, show_label) != 0)
+				return;
+			cctx.space = SHOW_SPACE_INODES;
+			cctx.inum = media.ipdata.meta.inum;
+		} else {
+			cctx.space = SHOW_SPACE_FILE;
+			cctx.inum = media.ipdata.meta.inum;
+			if (ctx->space == SHOW_SPACE_INODES && show_inum_set)
+				cctx.selected = 1;
+		}
+		break;
+	}
+
+	if (checked)
+		failed = show_check(bref, &media, bytes, check_desc,
+				    sizeof(check_desc));
+
+	printed = show_printable(bref);
+	if (printed) {
+		switch(show_format) {
+		case SHOW_FORMAT_JSON:
+			show_json(bref, bi, ctx, &media, checked, failed);
+			break;
+		case SHOW_FORMAT_BINARY:
+			show_binary(bref, bi, ctx, checked, failed);
+			break;
+		default:
+			obrace = show_text(bref, tab, bi, &media, bytes, bcount,
+					   checked, check_desc, norecurse);
+			break;
+		}
+	}
+
 	/*
 	 * Update statistics.
 	 */
@@ -870,23 +1558,34 @@ skip_data:
 	 * That is, if an indirect or inode fails we still try to list its
 	 * direct children to help with debugging, but go no further than
 	 * that because they are probably garbage.
+	 *
+	 * With read ahead threads the blocks of the next SHOW_WINDOW
+	 * children are queued before each child is shown.
 	 */
-	if (show_depth == -1 || ((tab - init_tab) / show_tab) < show_depth) {
+	if (show_depth == -1 || cctx.depth < show_depth) {
+		qi = 0;
 		for (i = 0; norecurse == 0 && i < bcount; ++i) {
+			while (ShowPool.nthreads && qi < bcount &&
+			       qi < i + SHOW_WINDOW) {
+				ring[qi % SHOW_WINDOW] =
+				    show_io_queue(&bscan[qi], &cctx);
+				++qi;
+			}
+			io = ShowPool.nthreads ? ring[i % SHOW_WINDOW] : NULL;
 			if (bscan[i].type != HAMMER2_BREF_TYPE_EMPTY) {
-				show_bref(voldata, tab, i, &bscan[i],
-				    failed);
+				show_bref(voldata, tab + show_tab, i,
+					  &bscan[i], failed, &cctx, io);
 			}
 		}
 	}
-	tab -= show_tab;
 	if (obrace) {
 		if (bref->type == HAMMER2_BREF_TYPE_INODE)
 			tabprintf(tab, "} (%s.%d, \"%*.*s\")\n",
-				  type_str, bi, namelen, namelen,
-				  media.ipdata.filename);
+				  hammer2_breftype_to_str(bref->type), bi,
+				  namelen, namelen, media.ipdata.filename);
 		else
-			tabprintf(tab, "} (%s.%d)\n", type_str, bi);
+			tabprintf(tab, "} (%s.%d)\n",
+				  hammer2_breftype_to_str(bref->type), bi);
 	}
 }
 
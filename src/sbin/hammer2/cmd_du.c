@@ -0,0 +1,1171 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * du-report directive.
+ *
+ * Every PFS, snapshots included, is walked from the super-root down to
+ * its data blockrefs, reading only inodes and indirect blocks.  A block
+ * is entered into a table keyed by data_off the first time it is
+ * reached, along with the block it was reached through and the bytes
+ * referenced by its subtree.  Reaching a known block again marks it as
+ * shared and adds its subtree without descending, so a snapshot only
+ * costs as much as the blocks it does not share with the PFSs walked
+ * before it.  PFSs are walked before snapshots.
+ *
+ * A block is unique if it and every block above it on the path it was
+ * first reached through are referenced once, the remaining referenced
+ * bytes of a PFS being shared with other PFSs or snapshots or by
+ * deduplicated files.  All sizes are physical, i.e. allocated on media.
+ *
+ * Inodes are indexed by the PFS root inode, so the top-level directory
+ * an inode belongs to is found by following its iparent chain.  For the
+ * PFSs broken down by top-level directory, snapshots only with -v, the
+ * index is descended even where it is shared in order to find every
+ * inode, the inodes themselves still not being descended.
+ *
+ * With -j the inodes and indirect blocks about to be walked are read
+ * ahead by the given number of threads.  The accounting is done in walk
+ * order, the output does not depend on the number of threads.
+ */
+#include "hammer2.h"
+#include "libhammer2.h"
+
+#include <err.h>
+#include <pthread.h>
+
+#define DU_READAHEAD	32		/* blocks queued ahead per level */
+#define DU_MAXDEPTH	32		/* indirect block recursion limit */
+#define DU_MAXPATH	1024		/* iparent chain limit */
+#define DU_NTYPES	(HAMMER2_BREF_TYPE_DIRENT + 1)
+#define DU_NCOMP	HAMMER2_COMP_STRINGS_COUNT
+
+#define DU_LEVEL_PFS	0		/* PFS root inode */
+#define DU_LEVEL_INDEX	1		/* below the PFS root inode */
+#define DU_LEVEL_FILE	2		/* below any other inode */
+
+#define DU_SHARED	0x01		/* referenced more than once */
+#define DU_UNIQUE	0x02		/* set after the walk */
+
+/*
+ * A distinct block.  Blocks are numbered in the order they are first
+ * reached, a block always following the block it was reached through.
+ */
+typedef struct du_block {
+	hammer2_off_t	data_off;
+	hammer2_off_t	subtree;	/* referenced bytes, self included */
+	uint32_t	parent;		/* first reached through, or -1 */
+	uint32_t	aux;		/* inodes: index into DuScan.iinfo */
+	uint8_t		type;
+	uint8_t		flags;
+} du_block_t;
+
+typedef struct du_iinfo {
+	hammer2_key_t	iparent;
+	uint8_t		type;		/* HAMMER2_OBJTYPE_* */
+} du_iinfo_t;
+
+/*
+ * Inodes and root directory entries of a PFS broken down by top-level
+ * directory.
+ */
+typedef struct du_inode {
+	hammer2_key_t	inum;
+	uint32_t	block;
+	long		top;		/* index of top-level inode or -1 */
+} du_inode_t;
+
+typedef struct du_name {
+	hammer2_key_t	inum;
+	char		*name;
+} du_name_t;
+
+typedef struct du_top {
+	const char	*name;
+	hammer2_off_t	referenced;
+	hammer2_off_t	unique;
+	uint64_t	inodes;
+} du_top_t;
+
+typedef struct du_pfs {
+	char		label[HAMMER2_INODE_MAXNAME + 1];
+	hammer2_blockref_t bref;	/* of the PFS root inode */
+	uint8_t		pfs_type;
+	uint8_t		pfs_subtype;
+	hammer2_key_t	root_inum;
+	int		order;		/* in the super-root */
+	int		breakdown;
+	uint32_t	root;		/* block of the PFS root inode */
+	hammer2_off_t	fsize;		/* of the inode being descended */
+	hammer2_off_t	referenced;
+	hammer2_off_t	unique;
+	du_inode_t	*inodes;
+	long		ninodes;
+	long		ainodes;
+	du_name_t	*names;
+	long		nnames;
+	long		anames;
+} du_pfs_t;
+
+typedef struct du_count {
+	uint64_t	blocks;
+	hammer2_off_t	logical;
+	hammer2_off_t	physical;
+} du_count_t;
+
+/*
+ * Read-ahead request, see show_io_t in cmd_debug.c.
+ */
+typedef struct du_io {
+	struct du_io	*next;
+	hammer2_blockref_t bref;
+	char		*buf;		/* HAMMER2_PBUFSIZE */
+	size_t		bytes;
+	int		error;
+	int		state;
+} du_io_t;
+
+#define DU_IO_IDLE	0
+#define DU_IO_QUEUED	1
+#define DU_IO_READING	2
+#define DU_IO_DONE	3
+
+static struct {
+	hammer2_image_t	*img;
+	du_block_t	*blocks;
+	uint32_t	nblocks;
+	uint32_t	ablocks;
+	uint32_t	*hash;		/* block + 1, open addressing */
+	uint32_t	hmask;
+	du_iinfo_t	*iinfo;
+	uint32_t	niinfo;
+	uint32_t	aiinfo;
+	du_pfs_t	*pfs;
+	int		npfs;
+	hammer2_off_t	sroot_bytes;	/* super-root inode and index */
+	du_count_t	types[DU_NTYPES];
+	du_count_t	shared[DU_NTYPES];
+	du_count_t	comp[DU_NCOMP];
+	long		errors;
+} DuScan;
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		/* read queued or stopping */
+	pthread_cond_t	done_cond;	/* read done */
+	du_io_t		*qhead;
+	du_io_t		*freeq;
+	pthread_t	*threads;
+	int		nthreads;
+	int		stopping;
+} DuPool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static hammer2_off_t du_walk(du_pfs_t *pfs, const hammer2_blockref_t *bref,
+			du_io_t *io, uint32_t parent, int level, int depth);
+
+static double
+du_pct(double part, double whole)
+{
+	return whole ? part * 100.0 / whole : 0.0;
+}
+
+static double
+du_ratio(double logical, double physical)
+{
+	return physical ? logical / physical : 0.0;
+}
+
+/*
+ * Read-ahead pool
+ */
+static void *
+du_thread(void *arg __unused)
+{
+	du_io_t *io;
+
+	pthread_mutex_lock(&DuPool.lock);
+	for (;;) {
+		while (DuPool.qhead == NULL && DuPool.stopping == 0)
+			pthread_cond_wait(&DuPool.cond, &DuPool.lock);
+		if ((io = DuPool.qhead) == NULL)
+			break;
+		DuPool.qhead = io->next;
+		io->state = DU_IO_READING;
+		pthread_mutex_unlock(&DuPool.lock);
+
+		io->error = hammer2_image_read_meta(DuScan.img, &io->bref,
+						    io->buf, &io->bytes);
+
+		pthread_mutex_lock(&DuPool.lock);
+		io->state = DU_IO_DONE;
+		pthread_cond_broadcast(&DuPool.done_cond);
+	}
+	pthread_mutex_unlock(&DuPool.lock);
+
+	return NULL;
+}
+
+static void
+du_start_pool(void)
+{
+	int i;
+
+	if (NThreadsOpt <= 1)
+		return;
+	DuPool.threads = calloc(NThreadsOpt, sizeof(pthread_t));
+	if (DuPool.threads == NULL)
+		err(1, "calloc");
+	for (i = 0; i < NThreadsOpt; ++i) {
+		if (pthread_create(&DuPool.threads[i], NULL,
+				   du_thread, NULL) != 0)
+			errx(1, "pthread_create failed");
+	}
+	DuPool.nthreads = NThreadsOpt;
+}
+
+static void
+du_stop_pool(void)
+{
+	du_io_t *io;
+	int i;
+
+	if (DuPool.nthreads) {
+		pthread_mutex_lock(&DuPool.lock);
+		DuPool.stopping = 1;
+		pthread_cond_broadcast(&DuPool.cond);
+		pthread_mutex_unlock(&DuPool.lock);
+		for (i = 0; i < DuPool.nthreads; ++i)
+			pthread_join(DuPool.threads[i], NULL);
+		free(DuPool.threads);
+		DuPool.threads = NULL;
+		DuPool.nthreads = 0;
+	}
+	while ((io = DuPool.freeq) != NULL) {
+		DuPool.freeq = io->next;
+		free(io->buf);
+		free(io);
+	}
+}
+
+/*
+ * Get a read request for a block, the free list is only used by the
+ * walker.
+ */
+static du_io_t *
+du_io_get(const hammer2_blockref_t *bref)
+{
+	du_io_t *io;
+
+	if ((io = DuPool.freeq) != NULL) {
+		DuPool.freeq = io->next;
+	} else {
+		io = calloc(1, sizeof(*io));
+		if (io == NULL || (io->buf = malloc(HAMMER2_PBUFSIZE)) == NULL)
+			err(1, "malloc");
+	}
+	io->bref = *bref;
+	io->bytes = 0;
+	io->error = 0;
+	io->state = DU_IO_IDLE;
+
+	return io;
+}
+
+static void
+du_io_queue(du_io_t *io)
+{
+	pthread_mutex_lock(&DuPool.lock);
+	io->state = DU_IO_QUEUED;
+	io->next = DuPool.qhead;
+	DuPool.qhead = io;
+	pthread_cond_signal(&DuPool.cond);
+	pthread_mutex_unlock(&DuPool.lock);
+}
+
+/*
+ * Wait for a request, doing the read here if no thread has started it.
+ * Returns 0 or an errno value.
+ */
+static int
+du_io_wait(du_io_t *io)
+{
+	du_io_t **iop;
+
+	pthread_mutex_lock(&DuPool.lock);
+	if (io->state == DU_IO_QUEUED) {
+		for (iop = &DuPool.qhead; *iop != io; iop = &(*iop)->next)
+			;
+		*iop = io->next;
+		io->state = DU_IO_IDLE;
+	}
+	if (io->state == DU_IO_IDLE) {
+		io->state = DU_IO_READING;
+		pthread_mutex_unlock(&DuPool.lock);
+
+		io->error = hammer2_image_read_meta(DuScan.img, &io->bref,
+						    io->buf, &io->bytes);
+
+		pthread_mutex_lock(&DuPool.lock);
+		io->state = DU_IO_DONE;
+	}
+	while (io->state != DU_IO_DONE)
+		pthread_cond_wait(&DuPool.done_cond, &DuPool.lock);
+	pthread_mutex_unlock(&DuPool.lock);
+
+	return io->error;
+}
+
+static void
+du_io_free(du_io_t *io)
+{
+	if (io->state == DU_IO_QUEUED || io->state == DU_IO_READING)
+		du_io_wait(io);
+	io->next = DuPool.freeq;
+	DuPool.freeq = io;
+}
+
+/*
+ * Block table
+ */
+static __inline
+uint32_t
+du_hash(hammer2_off_t data_off)
+{
+	return (uint32_t)((data_off >> HAMMER2_RADIX_MIN) *
+			  0x9E3779B97F4A7C15ULL >> 32);
+}
+
+static uint32_t
+du_lookup(hammer2_off_t data_off)
+{
+	uint32_t h;
+	uint32_t n;
+
+	for (h = du_hash(data_off) & DuScan.hmask; (n = DuScan.hash[h]) != 0;
+	     h = (h + 1) & DuScan.hmask) {
+		if (DuScan.blocks[n - 1].data_off == data_off)
+			return n - 1;
+	}
+	return (uint32_t)-1;
+}
+
+static void
+du_hash_insert(uint32_t n)
+{
+	uint32_t h;
+
+	h = du_hash(DuScan.blocks[n].data_off) & DuScan.hmask;
+	while (DuScan.hash[h])
+		h = (h + 1) & DuScan.hmask;
+	DuScan.hash[h] = n + 1;
+}
+
+static uint32_t
+du_insert(const hammer2_blockref_t *bref, uint32_t parent)
+{
+	du_block_t *block;
+	uint32_t n;
+
+	if (DuScan.nblocks == DuScan.ablocks) {
+		if (DuScan.ablocks >= 0x80000000U)
+			errx(1, "du-report: too many blocks");
+		DuScan.ablocks = DuScan.ablocks ? DuScan.ablocks * 2 : 65536;
+		DuScan.blocks = reallocarray(DuScan.blocks, DuScan.ablocks,
+					     sizeof(*DuScan.blocks));
+		if (DuScan.blocks == NULL)
+			err(1, "reallocarray");
+	}
+	if (DuScan.nblocks * 2 >= DuScan.hmask + 1) {
+		free(DuScan.hash);
+		DuScan.hmask = DuScan.hmask * 2 + 1;
+		DuScan.hash = calloc(DuScan.hmask + 1, sizeof(*DuScan.hash));
+		if (DuScan.hash == NULL)
+			err(1, "calloc");
+		for (n = 0; n < DuScan.nblocks; ++n)
+			du_hash_insert(n);
+	}
+	n = DuScan.nblocks++;
+	block = &DuScan.blocks[n];
+	bzero(block, sizeof(*block));
+	block->data_off = bref->data_off;
+	block->parent = parent;
+	block->aux = (uint32_t)-1;
+	block->type = bref->type;
+	du_hash_insert(n);
+
+	return n;
+}
+
+static void
+du_add_count(du_count_t *count, hammer2_off_t logical, hammer2_off_t physical)
+{
+	++count->blocks;
+	count->logical += logical;
+	count->physical += physical;
+}
+
+static void
+du_add_inode(du_pfs_t *pfs, hammer2_key_t inum, uint32_t block)
+{
+	du_inode_t *ino;
+
+	if (pfs->ninodes == pfs->ainodes) {
+		pfs->ainodes = pfs->ainodes ? pfs->ainodes * 2 : 1024;
+		pfs->inodes = reallocarray(pfs->inodes, pfs->ainodes,
+					   sizeof(*pfs->inodes));
+		if (pfs->inodes == NULL)
+			err(1, "reallocarray");
+	}
+	ino = &pfs->inodes[pfs->ninodes++];
+	ino->inum = inum;
+	ino->block = block;
+	ino->top = -1;
+}
+
+/*
+ * Remember the names of the root directory's subdirectories.
+ */
+static void
+du_add_name(du_pfs_t *pfs, const hammer2_blockref_t *bref)
+{
+	hammer2_image_dirent_t dent;
+	du_name_t *name;
+	int error;
+
+	if (bref->embed.dirent.type != HAMMER2_OBJTYPE_DIRECTORY)
+		return;
+	error = hammer2_image_get_dirent(DuScan.img, bref, &dent);
+	if (error) {
+		warnx("%s: directory entry %016jx: %s", pfs->label,
+		      (uintmax_t)bref->key, strerror(error));
+		++DuScan.errors;
+		return;
+	}
+	if (pfs->nnames == pfs->anames) {
+		pfs->anames = pfs->anames ? pfs->anames * 2 : 64;
+		pfs->names = reallocarray(pfs->names, pfs->anames,
+					  sizeof(*pfs->names));
+		if (pfs->names == NULL)
+			err(1, "reallocarray");
+	}
+	name = &pfs->names[pfs->nnames++];
+	name->inum = dent.inum;
+	name->name = strdup(dent.name);
+	if (name->name == NULL)
+		err(1, "strdup");
+}
+
+/*
+ * Queue the read of a block about to be walked if it will have to be
+ * descended.
+ */
+static du_io_t *
+du_readahead(const du_pfs_t *pfs, const hammer2_blockref_t *bref, int level)
+{
+	du_io_t *io;
+
+	if (DuPool.nthreads == 0)
+		return NULL;
+	if (bref->type != HAMMER2_BREF_TYPE_INODE &&
+	    bref->type != HAMMER2_BREF_TYPE_INDIRECT)
+		return NULL;
+	if ((bref->data_off & HAMMER2_OFF_MASK_RADIX) == 0)
+		return NULL;
+	if (du_lookup(bref->data_off) != (uint32_t)-1 &&
+	    (pfs->breakdown == 0 || level != DU_LEVEL_INDEX ||
+	     bref->type != HAMMER2_BREF_TYPE_INDIRECT))
+		return NULL;
+	io = du_io_get(bref);
+	du_io_queue(io);
+
+	return io;
+}
+
+/*
+ * Walk an array of blockrefs, reading ahead of the walk.  Returns the
+ * referenced bytes.
+ */
+static hammer2_off_t
+du_scan(du_pfs_t *pfs, const hammer2_blockref_t *base, int count,
+	uint32_t parent, int level, int depth)
+{
+	du_io_t **ios;
+	hammer2_off_t bytes = 0;
+	int i, n;
+
+	ios = calloc(count, sizeof(*ios));
+	if (ios == NULL)
+		err(1, "calloc");
+	for (i = n = 0; i < count; ++i) {
+		while (n < count && n < i + DU_READAHEAD) {
+			if (base[n].type != HAMMER2_BREF_TYPE_EMPTY)
+				ios[n] = du_readahead(pfs, &base[n], level);
+			++n;
+		}
+		if (base[i].type != HAMMER2_BREF_TYPE_EMPTY)
+			bytes += du_walk(pfs, &base[i], ios[i], parent,
+					 level, depth);
+	}
+	free(ios);
+
+	return bytes;
+}
+
+/*
+ * Descend an inode or indirect block.
+ */
+static hammer2_off_t
+du_descend(du_pfs_t *pfs, const hammer2_blockref_t *bref, du_io_t *io,
+	   uint32_t n, int level, int depth)
+{
+	hammer2_inode_data_t *ipdata;
+	du_iinfo_t *iinfo;
+	hammer2_off_t bytes = 0;
+	int error;
+
+	error = du_io_wait(io);
+	if (error == 0 && bref->type == HAMMER2_BREF_TYPE_INODE &&
+	    io->bytes != sizeof(*ipdata))
+		error = EIO;
+	if (error) {
+		warnx("%s: %s %016jx: %s", pfs->label,
+		      hammer2_breftype_to_str(bref->type),
+		      (uintmax_t)bref->data_off, strerror(error));
+		++DuScan.errors;
+		return 0;
+	}
+
+	if (bref->type == HAMMER2_BREF_TYPE_INDIRECT) {
+		bytes = du_scan(pfs, (hammer2_blockref_t *)io->buf,
+				io->bytes / sizeof(hammer2_blockref_t),
+				n, level, depth + 1);
+		return bytes;
+	}
+
+	ipdata = (hammer2_inode_data_t *)io->buf;
+	if (DuScan.blocks[n].aux == (uint32_t)-1) {
+		if (DuScan.niinfo == DuScan.aiinfo) {
+			DuScan.aiinfo = DuScan.aiinfo ? DuScan.aiinfo * 2 :
+					16384;
+			DuScan.iinfo = reallocarray(DuScan.iinfo,
+						    DuScan.aiinfo,
+						    sizeof(*DuScan.iinfo));
+			if (DuScan.iinfo == NULL)
+				err(1, "reallocarray");
+		}
+		iinfo = &DuScan.iinfo[DuScan.niinfo];
+		iinfo->iparent = ipdata->meta.iparent;
+		iinfo->type = ipdata->meta.type;
+		DuScan.blocks[n].aux = DuScan.niinfo++;
+	}
+	pfs->fsize = ipdata->meta.size;
+	if (ipdata->meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA)
+		return 0;
+	return du_scan(pfs, ipdata->u.blockset.blockref, HAMMER2_SET_COUNT, n,
+		       (level == DU_LEVEL_PFS ? DU_LEVEL_INDEX : DU_LEVEL_FILE),
+		       depth + 1);
+}
+
+/*
+ * Account for a blockref and everything below it, (io) being the
+ * read-ahead of its block or NULL.  Returns the referenced bytes.
+ */
+static hammer2_off_t
+du_walk(du_pfs_t *pfs, const hammer2_blockref_t *bref, du_io_t *io,
+	uint32_t parent, int level, int depth)
+{
+	du_block_t *block;
+	hammer2_off_t bytes;
+	hammer2_off_t logical;
+	uint32_t n;
+	int radix;
+	int comp;
+
+	if (pfs->breakdown && level == DU_LEVEL_INDEX &&
+	    bref->type == HAMMER2_BREF_TYPE_DIRENT &&
+	    (bref->key & HAMMER2_DIRHASH_VISIBLE))
+		du_add_name(pfs, bref);
+
+	radix = bref->data_off & HAMMER2_OFF_MASK_RADIX;
+	if (depth > DU_MAXDEPTH) {
+		warnx("%s: %s %016jx: too deep", pfs->label,
+		      hammer2_breftype_to_str(bref->type),
+		      (uintmax_t)bref->data_off);
+		++DuScan.errors;
+		radix = 0;
+	}
+	if (radix == 0) {
+		if (io)
+			du_io_free(io);
+		return 0;
+	}
+	bytes = (hammer2_off_t)1 << radix;
+
+	/*
+	 * Known block, mark it shared.  The index of a PFS broken down by
+	 * top-level directory is descended anyway.
+	 */
+	if ((n = du_lookup(bref->data_off)) != (uint32_t)-1) {
+		block = &DuScan.blocks[n];
+		block->flags |= DU_SHARED;
+		if (pfs->breakdown && level == DU_LEVEL_INDEX &&
+		    bref->type == HAMMER2_BREF_TYPE_INODE)
+			du_add_inode(pfs, bref->key, n);
+		if (pfs->breakdown && level == DU_LEVEL_INDEX &&
+		    bref->type == HAMMER2_BREF_TYPE_INDIRECT) {
+			if (io == NULL)
+				io = du_io_get(bref);
+			bytes += du_descend(pfs, bref, io, n, level, depth);
+			du_io_free(io);
+			return bytes;
+		}
+		if (io)
+			du_io_free(io);
+		return block->subtree;
+	}
+
+	/*
+	 * New block
+	 */
+	n = du_insert(bref, parent);
+	if (bref->type < DU_NTYPES) {
+		logical = bytes;
+		if (bref->type == HAMMER2_BREF_TYPE_DATA) {
+			/*
+			 * A compressed block holds at most (1 << keybits)
+			 * bytes, fewer when it covers the end of the file.
+			 */
+			comp = HAMMER2_DEC_COMP(bref->methods);
+			if (comp != HAMMER2_COMP_NONE &&
+			    pfs->fsize > bref->key) {
+				logical = (hammer2_off_t)1 << bref->keybits;
+				if (logical > pfs->fsize - bref->key)
+					logical = pfs->fsize - bref->key;
+			}
+			if (comp < DU_NCOMP)
+				du_add_count(&DuScan.comp[comp], logical,
+					     bytes);
+		}
+		du_add_count(&DuScan.types[bref->type], logical, bytes);
+	}
+	if (level == DU_LEVEL_PFS)
+		pfs->root = n;
+	else if (pfs->breakdown && level == DU_LEVEL_INDEX &&
+		 bref->type == HAMMER2_BREF_TYPE_INODE)
+		du_add_inode(pfs, bref->key, n);
+
+	if (bref->type == HAMMER2_BREF_TYPE_INODE ||
+	    bref->type == HAMMER2_BREF_TYPE_INDIRECT) {
+		if (io == NULL)
+			io = du_io_get(bref);
+		bytes += du_descend(pfs, bref, io, n, level, depth);
+	}
+	if (io)
+		du_io_free(io);
+	DuScan.blocks[n].subtree = bytes;
+
+	return bytes;
+}
+
+/*
+ * Collect the PFS root inodes from the super-root's index.
+ */
+static void
+du_sroot_scan(const hammer2_blockref_t *base, int count, int depth)
+{
+	hammer2_image_inode_t ip;
+	hammer2_blockref_t *buf;
+	du_pfs_t *pfs;
+	size_t bytes;
+	int error;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (base[i].type == HAMMER2_BREF_TYPE_INDIRECT) {
+			buf = malloc(HAMMER2_PBUFSIZE);
+			if (buf == NULL)
+				err(1, "malloc");
+			error = hammer2_image_read_meta(DuScan.img, &base[i],
+							buf, &bytes);
+			if (error == 0 && depth > DU_MAXDEPTH)
+				error = EIO;
+			if (error) {
+				warnx("super-root indirect %016jx: %s",
+				      (uintmax_t)base[i].data_off,
+				      strerror(error));
+				++DuScan.errors;
+			} else {
+				DuScan.sroot_bytes += bytes;
+				du_sroot_scan(buf, bytes / sizeof(*buf),
+					      depth + 1);
+			}
+			free(buf);
+		} else if (base[i].type == HAMMER2_BREF_TYPE_INODE) {
+			error = hammer2_image_get_inode(DuScan.img, &base[i],
+							&ip);
+			if (error) {
+				warnx("PFS inode %016jx: %s",
+				      (uintmax_t)base[i].data_off,
+				      strerror(error));
+				++DuScan.errors;
+				continue;
+			}
+			DuScan.pfs = reallocarray(DuScan.pfs, DuScan.npfs + 1,
+						  sizeof(*DuScan.pfs));
+			if (DuScan.pfs == NULL)
+				err(1, "reallocarray");
+			pfs = &DuScan.pfs[DuScan.npfs];
+			bzero(pfs, sizeof(*pfs));
+			bcopy(ip.ipdata.filename, pfs->label,
+			      MIN(ip.ipdata.meta.name_len,
+				  HAMMER2_INODE_MAXNAME));
+			pfs->bref = base[i];
+			pfs->pfs_type = ip.ipdata.meta.pfs_type;
+			pfs->pfs_subtype = ip.ipdata.meta.pfs_subtype;
+			pfs->root_inum = ip.ipdata.meta.inum;
+			pfs->order = DuScan.npfs++;
+			pfs->breakdown = (VerboseOpt > 0 ||
+			    pfs->pfs_subtype != HAMMER2_PFSSUBTYPE_SNAPSHOT);
+		}
+	}
+}
+
+/*
+ * PFSs are walked before snapshots, otherwise in super-root order.
+ */
+static int
+du_pfs_cmp(const void *arg1, const void *arg2)
+{
+	const du_pfs_t *pfs1 = arg1;
+	const du_pfs_t *pfs2 = arg2;
+	int snap1 = (pfs1->pfs_subtype == HAMMER2_PFSSUBTYPE_SNAPSHOT);
+	int snap2 = (pfs2->pfs_subtype == HAMMER2_PFSSUBTYPE_SNAPSHOT);
+
+	if (snap1 != snap2)
+		return snap1 - snap2;
+	return pfs1->order - pfs2->order;
+}
+
+static int
+du_inode_cmp(const void *arg1, const void *arg2)
+{
+	const du_inode_t *ino1 = arg1;
+	const du_inode_t *ino2 = arg2;
+
+	if (ino1->inum < ino2->inum)
+		return -1;
+	if (ino1->inum > ino2->inum)
+		return 1;
+	return 0;
+}
+
+static int
+du_name_cmp(const void *arg1, const void *arg2)
+{
+	const du_name_t *name1 = arg1;
+	const du_name_t *name2 = arg2;
+
+	if (name1->inum < name2->inum)
+		return -1;
+	if (name1->inum > name2->inum)
+		return 1;
+	return 0;
+}
+
+static int
+du_top_cmp(const void *arg1, const void *arg2)
+{
+	const du_top_t *top1 = arg1;
+	const du_top_t *top2 = arg2;
+
+	if (top1->referenced > top2->referenced)
+		return -1;
+	if (top1->referenced < top2->referenced)
+		return 1;
+	return strcmp(top1->name, top2->name);
+}
+
+/*
+ * Mark the unique blocks and sum up their bytes per subtree.  A block
+ * always comes after the block it was first reached through.
+ */
+static hammer2_off_t *
+du_unique(void)
+{
+	hammer2_off_t *usub;
+	hammer2_off_t bytes;
+	du_block_t *block;
+	uint32_t n;
+
+	usub = calloc(DuScan.nblocks ? DuScan.nblocks : 1, sizeof(*usub));
+	if (usub == NULL)
+		err(1, "calloc");
+	for (n = 0; n < DuScan.nblocks; ++n) {
+		block = &DuScan.blocks[n];
+		bytes = (hammer2_off_t)1 <<
+			(block->data_off & HAMMER2_OFF_MASK_RADIX);
+		if ((block->flags & DU_SHARED) == 0 &&
+		    (block->parent == (uint32_t)-1 ||
+		     (DuScan.blocks[block->parent].flags & DU_UNIQUE))) {
+			block->flags |= DU_UNIQUE;
+			usub[n] = bytes;
+		} else if (block->type < DU_NTYPES) {
+			du_add_count(&DuScan.shared[block->type], 0, bytes);
+		}
+	}
+	n = DuScan.nblocks;
+	while (n-- > 0) {
+		block = &DuScan.blocks[n];
+		if (block->parent != (uint32_t)-1)
+			usub[block->parent] += usub[n];
+	}
+	return usub;
+}
+
+/*
+ * Find the top-level inode of every inode of a PFS by following the
+ * iparent chains, -2 if the chain does not lead to the root.
+ */
+static void
+du_resolve_tops(du_pfs_t *pfs)
+{
+	du_inode_t key;
+	du_inode_t *ino;
+	du_block_t *block;
+	long *path;
+	long top;
+	long cur;
+	long i;
+	int depth;
+
+	qsort(pfs->inodes, pfs->ninodes, sizeof(*pfs->inodes), du_inode_cmp);
+	path = calloc(DU_MAXPATH, sizeof(*path));
+	if (path == NULL)
+		err(1, "calloc");
+
+	for (i = 0; i < pfs->ninodes; ++i) {
+		cur = i;
+		depth = 0;
+		for (;;) {
+			if (pfs->inodes[cur].top != -1) {
+				top = pfs->inodes[cur].top;
+				break;
+			}
+			if (depth == DU_MAXPATH) {
+				top = -2;
+				break;
+			}
+			path[depth++] = cur;
+			block = &DuScan.blocks[pfs->inodes[cur].block];
+			if (block->aux == (uint32_t)-1) {
+				top = -2;
+				break;
+			}
+			key.inum = DuScan.iinfo[block->aux].iparent;
+			if (key.inum == pfs->root_inum) {
+				top = cur;
+				break;
+			}
+			ino = bsearch(&key, pfs->inodes, pfs->ninodes,
+				      sizeof(*pfs->inodes), du_inode_cmp);
+			if (ino == NULL) {
+				top = -2;
+				break;
+			}
+			cur = ino - pfs->inodes;
+		}
+		while (depth > 0)
+			pfs->inodes[path[--depth]].top = top;
+	}
+	free(path);
+}
+
+static void
+du_print_top(const du_top_t *top)
+{
+	printf("    %9s", sizetostr(top->referenced));
+	printf(" %9s", sizetostr(top->unique));
+	printf(" %9s", sizetostr(top->referenced - top->unique));
+	if (top->inodes)
+		printf(" %9ju", (uintmax_t)top->inodes);
+	else
+		printf(" %9s", "-");
+	printf("  %s\n", top->name);
+}
+
+/*
+ * Break a PFS down by top-level directory.  Top-level inodes which are
+ * not directories are summed up as files, inodes not reachable from the
+ * root as unlinked (e.g. still open when the PFS was flushed) and the
+ * rest, i.e. the root inode, the index and the root directory's long
+ * names, as metadata.
+ */
+static void
+du_print_tops(du_pfs_t *pfs, const hammer2_off_t *usub)
+{
+	du_name_t key;
+	du_name_t *name;
+	du_inode_t *ino;
+	du_block_t *block;
+	du_top_t *tops;
+	du_top_t files, unlinked, meta;
+	du_top_t *top;
+	long *slots;
+	long ntops = 0;
+	long i;
+
+	du_resolve_tops(pfs);
+	qsort(pfs->names, pfs->nnames, sizeof(*pfs->names), du_name_cmp);
+	tops = calloc(pfs->ninodes + 1, sizeof(*tops));
+	slots = calloc(pfs->ninodes + 1, sizeof(*slots));
+	if (tops == NULL || slots == NULL)
+		err(1, "calloc");
+	bzero(&files, sizeof(files));
+	bzero(&unlinked, sizeof(unlinked));
+	bzero(&meta, sizeof(meta));
+	files.name = "(files)";
+	unlinked.name = "(unlinked)";
+	meta.name = "(metadata)";
+	meta.referenced = pfs->referenced;
+	meta.unique = pfs->unique;
+
+	for (i = 0; i < pfs->ninodes; ++i) {
+		ino = &pfs->inodes[i];
+		if (ino->top < 0) {
+			top = &unlinked;
+		} else {
+			block = &DuScan.blocks[pfs->inodes[ino->top].block];
+			if (DuScan.iinfo[block->aux].type !=
+			    HAMMER2_OBJTYPE_DIRECTORY) {
+				top = &files;
+			} else {
+				if (slots[ino->top] == 0) {
+					top = &tops[ntops];
+					slots[ino->top] = ++ntops;
+					key.inum = pfs->inodes[ino->top].inum;
+					name = bsearch(&key, pfs->names,
+						       pfs->nnames,
+						       sizeof(*pfs->names),
+						       du_name_cmp);
+					top->name = name ? name->name : "?";
+				}
+				top = &tops[slots[ino->top] - 1];
+			}
+		}
+		block = &DuScan.blocks[ino->block];
+		top->referenced += block->subtree;
+		top->unique += usub[ino->block];
+		++top->inodes;
+		meta.referenced -= block->subtree;
+		meta.unique -= usub[ino->block];
+	}
+	qsort(tops, ntops, sizeof(*tops), du_top_cmp);
+
+	printf("\nTop-level directories of %s\n", pfs->label);
+	printf("    referenced    unique    shared    inodes  name\n");
+	for (i = 0; i < ntops; ++i)
+		du_print_top(&tops[i]);
+	if (files.inodes)
+		du_print_top(&files);
+	if (unlinked.inodes)
+		du_print_top(&unlinked);
+	du_print_top(&meta);
+	free(tops);
+	free(slots);
+}
+
+static void
+du_print_count(const char *name, const du_count_t *count)
+{
+	printf("    %-9s %12ju", name, (uintmax_t)count->blocks);
+	printf(" %9s", sizetostr(count->logical));
+	printf(" %9s", sizetostr(count->physical));
+	printf(" %7.2f\n", du_ratio(count->logical, count->physical));
+}
+
+int
+cmd_du_report(const char *special)
+{
+	static const char *comps[] = HAMMER2_COMP_STRINGS;
+	const hammer2_volume_data_t *voldata;
+	hammer2_image_inode_t sroot;
+	hammer2_off_t *usub;
+	hammer2_off_t referenced, distinct, allocated;
+	du_count_t total;
+	du_pfs_t *pfs;
+	char *devpath;
+	int nsnapshots;
+	int i;
+
+	devpath = get_hammer2_devpath(special);
+	DuScan.img = hammer2_image_open_sroot(devpath, MemOpt);
+	if (DuScan.img == NULL)
+		err(1, "%s", devpath);
+	voldata = hammer2_image_voldata(DuScan.img);
+	hammer2_image_root(DuScan.img, &sroot);
+
+	DuScan.hmask = 65535;
+	DuScan.hash = calloc(DuScan.hmask + 1, sizeof(*DuScan.hash));
+	if (DuScan.hash == NULL)
+		err(1, "calloc");
+
+	/*
+	 * The super-root and the PFS roots, then every PFS.
+	 */
+	DuScan.sroot_bytes = (hammer2_off_t)1 <<
+			     (sroot.bref.data_off & HAMMER2_OFF_MASK_RADIX);
+	if ((sroot.ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA) == 0)
+		du_sroot_scan(sroot.ipdata.u.blockset.blockref,
+			      HAMMER2_SET_COUNT, 0);
+	if (DuScan.npfs > 1)
+		qsort(DuScan.pfs, DuScan.npfs, sizeof(*DuScan.pfs),
+		      du_pfs_cmp);
+
+	du_start_pool();
+	for (i = 0; i < DuScan.npfs; ++i) {
+		pfs = &DuScan.pfs[i];
+		pfs->root = (uint32_t)-1;
+		pfs->referenced = du_walk(pfs, &pfs->bref, NULL, (uint32_t)-1,
+					  DU_LEVEL_PFS, 0);
+	}
+	du_stop_pool();
+
+	usub = du_unique();
+	referenced = DuScan.sroot_bytes;
+	nsnapshots = 0;
+	for (i = 0; i < DuScan.npfs; ++i) {
+		pfs = &DuScan.pfs[i];
+		if (pfs->root != (uint32_t)-1)
+			pfs->unique = usub[pfs->root];
+		referenced += pfs->referenced;
+		if (pfs->pfs_subtype == HAMMER2_PFSSUBTYPE_SNAPSHOT)
+			++nsnapshots;
+	}
+	bzero(&total, sizeof(total));
+	for (i = 0; i < DU_NTYPES; ++i) {
+		total.blocks += DuScan.types[i].blocks;
+		total.physical += DuScan.types[i].physical;
+	}
+	distinct = DuScan.sroot_bytes + total.physical;
+	allocated = voldata->allocator_size - voldata->allocator_free;
+
+	printf("Filesystem %s\n", devpath);
+	printf("    volume size      %9s\n",
+	       sizetostr(voldata->allocator_size));
+	printf("    allocated        %9s  (%.1f%%, as of the last flush)\n",
+	       sizetostr(allocated),
+	       du_pct(allocated, voldata->allocator_size));
+	printf("    referenced       %9s  by %d PFSs and %d snapshots\n",
+	       sizetostr(referenced), DuScan.npfs - nsnapshots, nsnapshots);
+	printf("    distinct         %9s  ", sizetostr(distinct));
+	printf("(%s saved by sharing)\n", sizetostr(referenced - distinct));
+	printf("    not referenced   %9s  "
+	       "(freemap, reserved, awaiting bulkfree)\n",
+	       sizetostr(allocated > distinct ? allocated - distinct : 0));
+
+	printf("\nPFSs\n");
+	printf("    referenced    unique    shared  type       label\n");
+	for (i = 0; i < DuScan.npfs; ++i) {
+		pfs = &DuScan.pfs[i];
+		printf("    %9s", sizetostr(pfs->referenced));
+		printf(" %9s", sizetostr(pfs->unique));
+		printf(" %9s", sizetostr(pfs->referenced - pfs->unique));
+		printf("  %-10s %s\n",
+		       (pfs->pfs_subtype == HAMMER2_PFSSUBTYPE_NONE ?
+			hammer2_pfstype_to_str(pfs->pfs_type) :
+			hammer2_pfssubtype_to_str(pfs->pfs_subtype)),
+		       pfs->label);
+	}
+	printf("    %9s", sizetostr(DuScan.sroot_bytes));
+	printf(" %9s", sizetostr(DuScan.sroot_bytes));
+	printf(" %9s  %-10s %s\n", sizetostr(0), "SUPROOT", "(super-root)");
+
+	for (i = 0; i < DuScan.npfs; ++i) {
+		pfs = &DuScan.pfs[i];
+		if (pfs->breakdown && pfs->ninodes)
+			du_print_tops(pfs, usub);
+	}
+
+	printf("\nDistinct blocks by type\n");
+	printf("    type            blocks  physical  shared blocks    "
+	       "shared\n");
+	for (i = HAMMER2_BREF_TYPE_INODE; i < DU_NTYPES; ++i) {
+		printf("    %-9s %12ju", hammer2_breftype_to_str(i),
+		       (uintmax_t)DuScan.types[i].blocks);
+		printf(" %9s", sizetostr(DuScan.types[i].physical));
+		printf(" %14ju", (uintmax_t)DuScan.shared[i].blocks);
+		printf(" %9s\n", sizetostr(DuScan.shared[i].physical));
+	}
+
+	printf("\nData compression of distinct blocks\n");
+	printf("    method          blocks   logical  physical   ratio\n");
+	bzero(&total, sizeof(total));
+	for (i = 0; i < DU_NCOMP; ++i) {
+		if (DuScan.comp[i].blocks == 0)
+			continue;
+		du_print_count(comps[i], &DuScan.comp[i]);
+		total.blocks += DuScan.comp[i].blocks;
+		total.logical += DuScan.comp[i].logical;
+		total.physical += DuScan.comp[i].physical;
+	}
+	du_print_count("total", &total);
+
+	if (DuScan.errors)
+		printf("\n%ld errors, the report is incomplete\n",
+		       DuScan.errors);
+
+	for (i = 0; i < DuScan.npfs; ++i) {
+		pfs = &DuScan.pfs[i];
+		while (pfs->nnames > 0)
+			free(pfs->names[--pfs->nnames].name);
+		free(pfs->names);
+		free(pfs->inodes);
+	}
+	free(DuScan.pfs);
+	free(usub);
+	free(DuScan.blocks);
+	free(DuScan.hash);
+	free(DuScan.iinfo);
+	hammer2_image_close(DuScan.img);
+	free(devpath);
+
+	return (DuScan.errors ? 1 : 0);
+}
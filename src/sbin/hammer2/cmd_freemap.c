@@ -0,0 +1,917 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * freemap-stats directive.
+ *
+ * Every level1 freemap leaf is read and its 4MB bmap entries are
+ * summarized: the 16KB granule states, a histogram of free runs, the
+ * naturally aligned free chunks the allocator can hand out for each
+ * block size, the occupancy of each 1GB zone and the clustering class
+ * distribution.  Zones without a leaf have never been allocated from and
+ * are accounted for as the kernel would initialize them.
+ *
+ * The allocation cost estimate replays hammer2_freemap_try_alloc() and
+ * hammer2_bmap_alloc() from every allocatable entry in turn.  The
+ * allocator scans the entries of a zone outwards from its starting
+ * entry, skipping those without available space or assigned to another
+ * class, and searches the bitmap of an entry for a free aligned slot.
+ * When a zone is exhausted it moves on to the next one.  Entries looked
+ * at and probes (entry headers plus bitmap slots tested) are averaged
+ * over all starting points, relaxed mode is not modelled.
+ *
+ * Leaves are read and summarized by NThreadsOpt threads and combined in
+ * zone order, the output does not depend on the number of threads.
+ */
+#include "hammer2.h"
+
+#include <err.h>
+#include <pthread.h>
+
+#define FM_NENTRIES	HAMMER2_FREEMAP_COUNT		/* bmaps per leaf */
+#define FM_NGRANULES	(HAMMER2_SEGSIZE / HAMMER2_FREEMAP_BLOCK_SIZE)
+#define FM_NRUNS	9		/* free run buckets, 16KB .. 4MB */
+#define FM_NSIZES	4		/* sub-16KB, 16KB, 32KB, 64KB */
+#define FM_NTYPES	4		/* allocating bref types */
+#define FM_NCLASSES	64
+
+static const int fm_radix[FM_NSIZES] = {
+	HAMMER2_RADIX_MIN, 14, 15, 16
+};
+
+static const char *fm_sizename[FM_NSIZES] = {
+	"<16KB", "16KB", "32KB", "64KB"
+};
+
+static const uint8_t fm_type[FM_NTYPES] = {
+	HAMMER2_BREF_TYPE_INODE,
+	HAMMER2_BREF_TYPE_INDIRECT,
+	HAMMER2_BREF_TYPE_DIRENT,
+	HAMMER2_BREF_TYPE_DATA
+};
+
+/*
+ * Allocation cost of one type and size within a zone.  sum_* cover the
+ * scans starting in this zone up to success or up to leaving the zone,
+ * c0_* a scan entering the zone at its first entry.
+ */
+typedef struct fm_cost {
+	int		ok;		/* zone can satisfy the allocation */
+	uint32_t	eligible;	/* entries an allocation succeeds in */
+	double		sum_entries;
+	double		sum_probes;
+	double		c0_entries;
+	double		c0_probes;
+} fm_cost_t;
+
+typedef struct fm_zone {
+	hammer2_key_t	key;		/* zone base */
+	hammer2_blockref_t bref;	/* leaf, type EMPTY if none */
+	int		error;
+	uint32_t	starts;		/* allocatable entries */
+	uint32_t	largest;	/* longest free run, granules */
+	hammer2_off_t	unusable;
+	hammer2_off_t	state[4];	/* bytes by bitmap state */
+	hammer2_off_t	free64;		/* in free aligned 64KB chunks */
+	uint32_t	nclasses;	/* distinct classes assigned */
+	fm_cost_t	cost[FM_NTYPES][FM_NSIZES];
+} fm_zone_t;
+
+typedef struct fm_class {
+	uint16_t	class;
+	uint32_t	entries;
+	hammer2_off_t	used;
+	hammer2_off_t	free;
+} fm_class_t;
+
+/*
+ * Per-entry summary, see fm_scan_entry().
+ */
+typedef struct fm_entry {
+	int		usable;
+	int		partial;	/* linear iterator mid-block */
+	uint16_t	class;
+	uint32_t	avail;
+	hammer2_off_t	free;		/* in unallocated granules */
+	uint32_t	nfree[FM_NSIZES];	/* free aligned slots */
+	int		first[FM_NSIZES];	/* first free slot or -1 */
+} fm_entry_t;
+
+static struct {
+	pthread_mutex_t	lock;
+	fm_zone_t	*zones;
+	long		nzones;
+	long		next;
+	hammer2_off_t	total_size;
+	hammer2_off_t	lokey;		/* end of the auxiliary area */
+	hammer2_off_t	hikey;		/* end of allocatable space */
+	uint64_t	runs[FM_NRUNS];
+	hammer2_off_t	runbytes[FM_NRUNS];
+	hammer2_off_t	slots[FM_NSIZES];
+	uint64_t	partials;
+	hammer2_off_t	partialbytes;
+	fm_class_t	classes[FM_NCLASSES];
+	int		nclasses;
+	uint64_t	other_classes;	/* entries not fitting classes[] */
+} FreemapScan = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char *
+fm_sizestr(hammer2_off_t size, char *buf, size_t len)
+{
+	if (size < 1024 * 1024 / 2) {
+		snprintf(buf, len, "%.2fKB", (double)size / 1024);
+	} else if (size < 1024 * 1024 * 1024LL / 2) {
+		snprintf(buf, len, "%.2fMB", (double)size / (1024 * 1024));
+	} else if (size < 1024 * 1024 * 1024LL * 1024LL / 2) {
+		snprintf(buf, len, "%.2fGB",
+			 (double)size / (1024 * 1024 * 1024LL));
+	} else {
+		snprintf(buf, len, "%.2fTB",
+			 (double)size / (1024 * 1024 * 1024LL * 1024LL));
+	}
+	return buf;
+}
+
+static double
+fm_pct(double part, double whole)
+{
+	return whole ? part * 100.0 / whole : 0.0;
+}
+
+/*
+ * Read and verify a freemap block.  Returns 0 on success.
+ */
+static int
+fm_read(const hammer2_blockref_t *bref, void *buf, size_t bytes)
+{
+	hammer2_off_t io_off;
+	size_t radix;
+	int fd;
+
+	radix = bref->data_off & HAMMER2_OFF_MASK_RADIX;
+	if (radix == 0 || ((size_t)1 << radix) != bytes)
+		return EINVAL;
+	io_off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
+	fd = hammer2_get_volume_fd(io_off);
+	if (fd < 0)
+		return EINVAL;
+	if (pread(fd, buf, bytes, io_off - hammer2_get_volume_offset(io_off)) !=
+	    (ssize_t)bytes)
+		return EIO;
+	if (HAMMER2_DEC_CHECK(bref->methods) == HAMMER2_CHECK_FREEMAP &&
+	    bref->check.freemap.icrc32 != hammer2_icrc32(buf, bytes))
+		return EINVAL;
+	return 0;
+}
+
+/*
+ * Collect the leaves below a freemap node, ordered by key.
+ */
+static void
+fm_walk(const hammer2_blockref_t *bref, char *buf)
+{
+	hammer2_blockref_t *bscan;
+	fm_zone_t *zone;
+	long z;
+	int i;
+
+	switch(bref->type) {
+	case HAMMER2_BREF_TYPE_FREEMAP_NODE:
+		if (fm_read(bref, buf, HAMMER2_FREEMAP_LEVELN_PSIZE)) {
+			fprintf(stderr, "freemap-stats: bad freemap node "
+				"%016jx\n", (uintmax_t)bref->data_off);
+			return;
+		}
+		bscan = malloc(HAMMER2_FREEMAP_LEVELN_PSIZE);
+		if (bscan == NULL)
+			err(1, "malloc");
+		bcopy(buf, bscan, HAMMER2_FREEMAP_LEVELN_PSIZE);
+		for (i = 0; i < HAMMER2_FREEMAP_LEVELN_PSIZE /
+			    (int)sizeof(*bscan); ++i) {
+			if (bscan[i].type != HAMMER2_BREF_TYPE_EMPTY)
+				fm_walk(&bscan[i], buf);
+		}
+		free(bscan);
+		break;
+	case HAMMER2_BREF_TYPE_FREEMAP_LEAF:
+		z = (long)(bref->key >> HAMMER2_FREEMAP_LEVEL1_RADIX);
+		if (z >= FreemapScan.nzones) {
+			fprintf(stderr, "freemap-stats: leaf %016jx beyond "
+				"the end of the filesystem\n",
+				(uintmax_t)bref->key);
+			return;
+		}
+		zone = &FreemapScan.zones[z];
+		zone->bref = *bref;
+		break;
+	default:
+		break;
+	}
+}
+
+
+/*
+ * Summarize one 4MB bmap entry.  The slots of each size are counted in
+ * the order hammer2_bmap_alloc() searches them.
+ */
+static void
+fm_scan_entry(const hammer2_bmap_data_t *bmap, fm_entry_t *ent,
+	      fm_zone_t *zone, uint64_t *runs, hammer2_off_t *runbytes)
+{
+	hammer2_bitmap_t bm;
+	uint8_t st[FM_NGRANULES];
+	int g, i, j, k, n, run;
+
+	for (i = 0; i < HAMMER2_BMAP_ELEMENTS; ++i) {
+		bm = bmap->bitmapq[i];
+		for (j = 0; j < HAMMER2_BMAP_BLOCKS_PER_ELEMENT; ++j) {
+			st[i * HAMMER2_BMAP_BLOCKS_PER_ELEMENT + j] = bm & 3;
+			bm >>= 2;
+		}
+	}
+
+	/*
+	 * States and free runs.  Allocations never cross an entry, so
+	 * runs don't either.
+	 */
+	ent->free = 0;
+	run = 0;
+	for (g = 0; g <= FM_NGRANULES; ++g) {
+		if (g < FM_NGRANULES) {
+			zone->state[st[g]] += HAMMER2_FREEMAP_BLOCK_SIZE;
+			if (st[g] == 0) {
+				ent->free += HAMMER2_FREEMAP_BLOCK_SIZE;
+				++run;
+				continue;
+			}
+		}
+		if (run) {
+			for (k = 0; (1 << k) < run; ++k)
+				;
+			++runs[k];
+			runbytes[k] += (hammer2_off_t)run *
+				       HAMMER2_FREEMAP_BLOCK_SIZE;
+			if (zone->largest < (uint32_t)run)
+				zone->largest = run;
+			run = 0;
+		}
+	}
+
+	/*
+	 * Naturally aligned free slots.  Sub-16KB allocations which can't
+	 * use the linear iterator take a whole 16KB slot.
+	 */
+	for (k = 0; k < FM_NSIZES; ++k) {
+		n = 1;
+		if (fm_radix[k] > HAMMER2_FREEMAP_BLOCK_RADIX)
+			n <<= fm_radix[k] - HAMMER2_FREEMAP_BLOCK_RADIX;
+		ent->nfree[k] = 0;
+		ent->first[k] = -1;
+		for (g = 0; g < FM_NGRANULES; g += n) {
+			for (j = 0; j < n; ++j) {
+				if (st[g + j])
+					break;
+			}
+			if (j == n) {
+				if (ent->first[k] < 0)
+					ent->first[k] = g / n;
+				++ent->nfree[k];
+			}
+		}
+	}
+	zone->free64 += (hammer2_off_t)ent->nfree[FM_NSIZES - 1] *
+			HAMMER2_PBUFSIZE;
+
+	ent->class = bmap->class;
+	ent->avail = bmap->avail;
+	ent->partial = (bmap->linear & HAMMER2_FREEMAP_BLOCK_MASK) &&
+		       bmap->linear >= 0 && bmap->linear < HAMMER2_SEGSIZE;
+}
+
+/*
+ * Probes needed to try an allocation of type t and size k in an entry.
+ * Returns non-zero if the allocation succeeds.
+ */
+static int
+fm_try_entry(const fm_entry_t *ent, int t, int k, double *probesp)
+{
+	uint16_t class;
+	int availchk;
+	int nslots;
+	double q;
+
+	class = (fm_type[t] << 8) | HAMMER2_PBUFRADIX;
+	availchk = ent->avail != 0 ||
+		   (fm_radix[k] < HAMMER2_FREEMAP_BLOCK_RADIX && ent->partial);
+	if (!ent->usable || !availchk ||
+	    (ent->class != 0 && ent->class != class)) {
+		*probesp = 1;
+		return 0;
+	}
+
+	/* the linear iterator packs sub-16KB allocations */
+	if (fm_radix[k] < HAMMER2_FREEMAP_BLOCK_RADIX && ent->partial) {
+		*probesp = 2;
+		return 1;
+	}
+
+	nslots = FM_NGRANULES;
+	if (fm_radix[k] > HAMMER2_FREEMAP_BLOCK_RADIX)
+		nslots >>= fm_radix[k] - HAMMER2_FREEMAP_BLOCK_RADIX;
+	*probesp = 1;
+
+	/*
+	 * Data blocks of 16KB or more first try the slot indexed by their
+	 * file offset, which is free as often as a random slot is.
+	 */
+	if (fm_type[t] == HAMMER2_BREF_TYPE_DATA &&
+	    fm_radix[k] >= HAMMER2_FREEMAP_BLOCK_RADIX) {
+		q = (double)ent->nfree[k] / nslots;
+		*probesp += 1;
+		if (ent->first[k] < 0)
+			*probesp += nslots;
+		else
+			*probesp += (1.0 - q) * (ent->first[k] + 1);
+	} else if (ent->first[k] < 0) {
+		*probesp += nslots;
+	} else {
+		*probesp += ent->first[k] + 1;
+	}
+	return (ent->first[k] >= 0);
+}
+
+/*
+ * Replay the outward scan of hammer2_freemap_try_alloc(), which tries
+ * entry e + c and then e - c for c = 0, 1, ..., from every allocatable
+ * entry of the zone and from its first entry.
+ */
+static void
+fm_cost_zone(const fm_entry_t *ents, int t, int k, uint32_t bigmask,
+	     fm_cost_t *cost)
+{
+	double fail[FM_NENTRIES + 1];	/* prefix sums of failed tries */
+	double succ[FM_NENTRIES];
+	double probes;
+	int df[FM_NENTRIES];		/* distance to next success */
+	int db[FM_NENTRIES];		/* distance to previous success */
+	int ok[FM_NENTRIES];
+	int c, e, s, fw, bw;
+
+	bzero(cost, sizeof(*cost));
+
+	/*
+	 * Leaves flagged as having no room for this size are skipped on
+	 * their blockref alone.
+	 */
+	if ((bigmask & ((uint32_t)1 << fm_radix[k])) == 0) {
+		for (s = 0; s < FM_NENTRIES; ++s) {
+			if (ents[s].usable)
+				cost->sum_probes += 1;
+		}
+		cost->c0_probes = 1;
+		return;
+	}
+
+	fail[0] = 0;
+	for (s = 0; s < FM_NENTRIES; ++s) {
+		ok[s] = fm_try_entry(&ents[s], t, k, &probes);
+		succ[s] = ok[s] ? probes : 0;
+		fail[s + 1] = fail[s] + (ok[s] ? 0 : probes);
+		if (ok[s])
+			++cost->eligible;
+	}
+	cost->ok = (cost->eligible != 0);
+
+	c = FM_NENTRIES;
+	for (s = FM_NENTRIES - 1; s >= 0; --s) {
+		c = ok[s] ? 0 : c + 1;
+		df[s] = c;
+	}
+	c = FM_NENTRIES;
+	for (s = 0; s < FM_NENTRIES; ++s) {
+		c = ok[s] ? 0 : c + 1;
+		db[s] = c;
+	}
+
+	for (s = -1; s < FM_NENTRIES; ++s) {
+		if (s >= 0 && !ents[s].usable)
+			continue;
+		e = (s < 0) ? 0 : s;
+		c = cost->ok ? MIN(df[e], db[e]) : FM_NENTRIES;
+
+		/* failed tries before round c */
+		fw = MIN(c, FM_NENTRIES - e);
+		bw = MIN(c, e + 1);
+		probes = (fail[e + fw] - fail[e]) +
+			 (fail[e + 1] - fail[e + 1 - bw]);
+
+		/* round c */
+		if (cost->ok && df[e] == c) {
+			++fw;
+			probes += succ[e + c];
+		} else if (cost->ok) {
+			if (e + c < FM_NENTRIES) {
+				++fw;
+				probes += fail[e + c + 1] - fail[e + c];
+			}
+			++bw;
+			probes += succ[e - c];
+		}
+
+		if (s < 0) {
+			cost->c0_entries = fw + bw;
+			cost->c0_probes = probes;
+		} else {
+			cost->sum_entries += fw + bw;
+			cost->sum_probes += probes;
+		}
+	}
+}
+
+static void
+fm_add_class(uint16_t class, hammer2_off_t used, hammer2_off_t free)
+{
+	fm_class_t *cl;
+	int i;
+
+	for (i = 0; i < FreemapScan.nclasses; ++i) {
+		if (FreemapScan.classes[i].class == class)
+			break;
+	}
+	if (i == FreemapScan.nclasses) {
+		if (i == FM_NCLASSES) {
+			++FreemapScan.other_classes;
+			return;
+		}
+		++FreemapScan.nclasses;
+		FreemapScan.classes[i].class = class;
+	}
+	cl = &FreemapScan.classes[i];
+	++cl->entries;
+	cl->used += used;
+	cl->free += free;
+}
+
+/*
+ * Summarize a zone.  A zone without a leaf is taken as initialized by
+ * hammer2_freemap_init(), i.e. free except for the reserved areas.
+ */
+static void
+fm_scan_zone(fm_zone_t *zone, hammer2_bmap_data_t *bmdata)
+{
+	fm_entry_t ents[FM_NENTRIES];
+	uint64_t runs[FM_NRUNS];
+	hammer2_off_t runbytes[FM_NRUNS];
+	hammer2_off_t slots[FM_NSIZES];
+	hammer2_off_t base;
+	hammer2_off_t partialbytes = 0;
+	uint64_t partials = 0;
+	uint32_t bigmask = (uint32_t)-1;
+	uint16_t classes[FM_NENTRIES];
+	int i, k, n;
+
+	if (zone->bref.type == HAMMER2_BREF_TYPE_FREEMAP_LEAF) {
+		zone->error = fm_read(&zone->bref, bmdata,
+				      HAMMER2_FREEMAP_LEVELN_PSIZE);
+		if (zone->error)
+			return;
+		bigmask = zone->bref.check.freemap.bigmask;
+	} else {
+		bzero(bmdata, HAMMER2_FREEMAP_LEVELN_PSIZE);
+		for (i = 0; i < FM_NENTRIES; ++i)
+			bmdata[i].avail = HAMMER2_FREEMAP_LEVEL0_SIZE;
+	}
+
+	bzero(ents, sizeof(ents));
+	bzero(runs, sizeof(runs));
+	bzero(runbytes, sizeof(runbytes));
+	bzero(slots, sizeof(slots));
+	n = 0;
+	for (i = 0; i < FM_NENTRIES; ++i) {
+		base = zone->key +
+		       (hammer2_off_t)i * HAMMER2_FREEMAP_LEVEL0_SIZE;
+		if (base < FreemapScan.lokey || base >= FreemapScan.hikey ||
+		    (base & HAMMER2_ZONE_MASK64) < HAMMER2_ZONE_SEG64) {
+			if (base < FreemapScan.total_size)
+				zone->unusable += HAMMER2_FREEMAP_LEVEL0_SIZE;
+			continue;
+		}
+		ents[i].usable = 1;
+		++zone->starts;
+		fm_scan_entry(&bmdata[i], &ents[i], zone, runs, runbytes);
+		for (k = 0; k < FM_NSIZES; ++k)
+			slots[k] += ents[i].nfree[k];
+		if (ents[i].partial) {
+			++partials;
+			partialbytes += HAMMER2_FREEMAP_BLOCK_SIZE -
+			    (bmdata[i].linear & HAMMER2_FREEMAP_BLOCK_MASK);
+		}
+		if (ents[i].class) {
+			for (k = 0; k < n; ++k) {
+				if (classes[k] == ents[i].class)
+					break;
+			}
+			if (k == n)
+				classes[n++] = ents[i].class;
+		}
+	}
+	zone->nclasses = n;
+
+	for (i = 0; i < FM_NTYPES; ++i) {
+		for (k = 0; k < FM_NSIZES; ++k)
+			fm_cost_zone(ents, i, k, bigmask, &zone->cost[i][k]);
+	}
+
+	pthread_mutex_lock(&FreemapScan.lock);
+	for (k = 0; k < FM_NRUNS; ++k) {
+		FreemapScan.runs[k] += runs[k];
+		FreemapScan.runbytes[k] += runbytes[k];
+	}
+	for (k = 0; k < FM_NSIZES; ++k)
+		FreemapScan.slots[k] += slots[k];
+	FreemapScan.partials += partials;
+	FreemapScan.partialbytes += partialbytes;
+	for (i = 0; i < FM_NENTRIES; ++i) {
+		if (ents[i].usable) {
+			fm_add_class(ents[i].class,
+				     HAMMER2_SEGSIZE - ents[i].free,
+				     ents[i].free);
+		}
+	}
+	pthread_mutex_unlock(&FreemapScan.lock);
+}
+
+static void *
+fm_thread(void *arg __unused)
+{
+	hammer2_bmap_data_t *bmdata;
+	long z;
+
+	bmdata = malloc(HAMMER2_FREEMAP_LEVELN_PSIZE);
+	if (bmdata == NULL)
+		err(1, "malloc");
+	for (;;) {
+		pthread_mutex_lock(&FreemapScan.lock);
+		z = FreemapScan.next++;
+		pthread_mutex_unlock(&FreemapScan.lock);
+		if (z >= FreemapScan.nzones)
+			break;
+		fm_scan_zone(&FreemapScan.zones[z], bmdata);
+	}
+	free(bmdata);
+
+	return NULL;
+}
+
+/*
+ * Combine the per-zone costs.  A scan which exhausts its zone continues
+ * at the first entry of the next one, wrapping around at the end.
+ */
+static void
+fm_print_cost(void)
+{
+	fm_zone_t *zones = FreemapScan.zones;
+	fm_cost_t *cost;
+	double *nent, *nprobes, *nzones;
+	double entries, probes, visited, starts, eligible;
+	long nz = FreemapScan.nzones;
+	long i, n, z, z0, zn;
+	int t, k;
+
+	nent = calloc(nz, sizeof(*nent));
+	nprobes = calloc(nz, sizeof(*nprobes));
+	nzones = calloc(nz, sizeof(*nzones));
+	if (nent == NULL || nprobes == NULL || nzones == NULL)
+		err(1, "calloc");
+
+	printf("\nEstimated allocation cost, averaged over all starting "
+	       "entries\n");
+	printf("    type      size  eligible   entries    probes     "
+	       "zones\n");
+	for (t = 0; t < FM_NTYPES; ++t) {
+		for (k = 0; k < FM_NSIZES; ++k) {
+			printf("    %-9s %-5s ",
+			       hammer2_breftype_to_str(fm_type[t]),
+			       fm_sizename[k]);
+			z0 = -1;
+			starts = eligible = 0;
+			for (z = 0; z < nz; ++z) {
+				cost = &zones[z].cost[t][k];
+				if (cost->ok && z0 < 0)
+					z0 = z;
+				starts += zones[z].starts;
+				eligible += cost->eligible;
+			}
+			if (z0 < 0) {
+				printf("%8.1f%%         -         -         "
+				       "-\n", 0.0);
+				continue;
+			}
+
+			/* cost of entering each zone at its first entry */
+			for (i = 0; i < nz; ++i) {
+				z = (z0 - i + nz) % nz;
+				zn = (z + 1) % nz;
+				cost = &zones[z].cost[t][k];
+				nent[z] = cost->c0_entries;
+				nprobes[z] = cost->c0_probes;
+				nzones[z] = 1;
+				if (!cost->ok) {
+					nent[z] += nent[zn];
+					nprobes[z] += nprobes[zn];
+					nzones[z] += nzones[zn];
+				}
+			}
+
+			entries = probes = visited = 0;
+			for (z = 0; z < nz; ++z) {
+				cost = &zones[z].cost[t][k];
+				n = zones[z].starts;
+				entries += cost->sum_entries;
+				probes += cost->sum_probes;
+				visited += n;
+				if (!cost->ok) {
+					zn = (z + 1) % nz;
+					entries += n * nent[zn];
+					probes += n * nprobes[zn];
+					visited += n * nzones[zn];
+				}
+			}
+			printf("%8.1f%% %9.2f %9.2f %9.2f\n",
+			       fm_pct(eligible, starts),
+			       starts ? entries / starts : 0.0,
+			       starts ? probes / starts : 0.0,
+			       starts ? visited / starts : 0.0);
+		}
+	}
+	free(nent);
+	free(nprobes);
+	free(nzones);
+}
+
+static int
+fm_class_cmp(const void *arg1, const void *arg2)
+{
+	const fm_class_t *cl1 = arg1;
+	const fm_class_t *cl2 = arg2;
+
+	if (cl1->class < cl2->class)
+		return -1;
+	if (cl1->class > cl2->class)
+		return 1;
+	return 0;
+}
+
+int
+cmd_freemap_stats(const char *special)
+{
+	hammer2_volume_data_t *voldata;
+	hammer2_volume_t *vol;
+	hammer2_off_t loff;
+	hammer2_off_t state[4];
+	hammer2_off_t usable, unusable, free64;
+	hammer2_off_t bytes;
+	fm_zone_t *zone;
+	fm_class_t *cl;
+	pthread_t *threads = NULL;
+	uint64_t occupancy[10];
+	uint64_t entries = 0;
+	char *devpath;
+	char *buf;
+	char b1[32], b2[32], b3[32];
+	long leaves, errors;
+	long z;
+	int nthreads = NThreadsOpt;
+	int nvolumes;
+	int i, k;
+
+	devpath = get_hammer2_devpath(special);
+	hammer2_init_volumes(devpath, 1);
+	voldata = hammer2_read_root_volume_header();
+
+	nvolumes = 0;
+	loff = 0;
+	while ((vol = hammer2_get_volume(loff)) != NULL) {
+		++nvolumes;
+		loff = vol->offset + vol->size;
+	}
+
+	FreemapScan.total_size = hammer2_get_total_size();
+	FreemapScan.lokey = (voldata->aux_end + HAMMER2_SEGMASK64) &
+			    ~HAMMER2_SEGMASK64;
+	FreemapScan.hikey = FreemapScan.total_size & ~HAMMER2_SEGMASK64;
+	FreemapScan.nzones = (FreemapScan.total_size +
+			      HAMMER2_FREEMAP_LEVEL1_MASK) >>
+			     HAMMER2_FREEMAP_LEVEL1_RADIX;
+	FreemapScan.zones = calloc(FreemapScan.nzones,
+				   sizeof(*FreemapScan.zones));
+	if (FreemapScan.zones == NULL)
+		err(1, "calloc");
+	for (z = 0; z < FreemapScan.nzones; ++z) {
+		FreemapScan.zones[z].key =
+		    (hammer2_key_t)z << HAMMER2_FREEMAP_LEVEL1_RADIX;
+	}
+
+	/*
+	 * The nodes above the leaves are few, walk them first.
+	 */
+	buf = malloc(HAMMER2_FREEMAP_LEVELN_PSIZE);
+	if (buf == NULL)
+		err(1, "malloc");
+	for (i = 0; i < HAMMER2_SET_COUNT; ++i) {
+		if (voldata->freemap_blockset.blockref[i].type !=
+		    HAMMER2_BREF_TYPE_EMPTY)
+			fm_walk(&voldata->freemap_blockset.blockref[i], buf);
+	}
+	free(buf);
+
+	if (nthreads > 1) {
+		threads = calloc(nthreads, sizeof(*threads));
+		if (threads == NULL)
+			err(1, "calloc");
+		for (i = 0; i < nthreads; ++i) {
+			if (pthread_create(&threads[i], NULL, fm_thread,
+					   NULL) != 0)
+				errx(1, "pthread_create failed");
+		}
+		for (i = 0; i < nthreads; ++i)
+			pthread_join(threads[i], NULL);
+		free(threads);
+	} else {
+		fm_thread(NULL);
+	}
+
+	/*
+	 * Totals
+	 */
+	bzero(state, sizeof(state));
+	bzero(occupancy, sizeof(occupancy));
+	unusable = free64 = 0;
+	leaves = errors = 0;
+	for (z = 0; z < FreemapScan.nzones; ++z) {
+		zone = &FreemapScan.zones[z];
+		if (zone->bref.type == HAMMER2_BREF_TYPE_FREEMAP_LEAF)
+			++leaves;
+		if (zone->error) {
+			++errors;
+			continue;
+		}
+		for (k = 0; k < 4; ++k)
+			state[k] += zone->state[k];
+		unusable += zone->unusable;
+		free64 += zone->free64;
+		entries += zone->starts;
+		if (zone->starts) {
+			usable = (hammer2_off_t)zone->starts *
+				 HAMMER2_FREEMAP_LEVEL0_SIZE;
+			k = (usable - zone->state[0]) * 10 / usable;
+			++occupancy[MIN(k, 9)];
+		}
+	}
+	usable = state[0] + state[1] + state[2] + state[3];
+
+	printf("Filesystem:       %s, %d volume%s, %s\n",
+	       devpath, nvolumes, nvolumes == 1 ? "" : "s",
+	       fm_sizestr(FreemapScan.total_size, b1, sizeof(b1)));
+	printf("Zones:            %ld x 1GB, %ld with a freemap leaf, "
+	       "%ld unreadable\n",
+	       FreemapScan.nzones, leaves, errors);
+	printf("Allocatable:      %s in %ju 4MB entries\n",
+	       fm_sizestr(usable, b1, sizeof(b1)), (uintmax_t)entries);
+	printf("    free          %10s %6.1f%%\n",
+	       fm_sizestr(state[0], b1, sizeof(b1)),
+	       fm_pct(state[0], usable));
+	printf("    possibly free %10s %6.1f%%\n",
+	       fm_sizestr(state[2], b1, sizeof(b1)),
+	       fm_pct(state[2], usable));
+	printf("    reserved      %10s %6.1f%%\n",
+	       fm_sizestr(state[1], b1, sizeof(b1)),
+	       fm_pct(state[1], usable));
+	printf("    allocated     %10s %6.1f%%\n",
+	       fm_sizestr(state[3], b1, sizeof(b1)),
+	       fm_pct(state[3], usable));
+	printf("Not allocatable:  %s\n",
+	       fm_sizestr(unusable, b1, sizeof(b1)));
+
+	printf("\nFree runs within 4MB entries\n");
+	printf("    length <=       runs      bytes  %%free\n");
+	for (k = 0; k < FM_NRUNS; ++k) {
+		bytes = (hammer2_off_t)HAMMER2_FREEMAP_BLOCK_SIZE << k;
+		printf("    %-9s %10ju %10s %5.1f%%\n",
+		       fm_sizestr(bytes, b1, sizeof(b1)),
+		       (uintmax_t)FreemapScan.runs[k],
+		       fm_sizestr(FreemapScan.runbytes[k], b2, sizeof(b2)),
+		       fm_pct(FreemapScan.runbytes[k], state[0]));
+	}
+
+	printf("\nFree aligned chunks\n");
+	printf("    size          chunks      bytes  %%free\n");
+	for (k = 1; k < FM_NSIZES; ++k) {
+		bytes = FreemapScan.slots[k] << fm_radix[k];
+		printf("    %-9s %10ju %10s %5.1f%%\n",
+		       fm_sizename[k], (uintmax_t)FreemapScan.slots[k],
+		       fm_sizestr(bytes, b1, sizeof(b1)),
+		       fm_pct(bytes, state[0]));
+	}
+	printf("    %-9s %10ju %10s in partially used 16KB blocks\n",
+	       fm_sizename[0], (uintmax_t)FreemapScan.partials,
+	       fm_sizestr(FreemapScan.partialbytes, b1, sizeof(b1)));
+
+	printf("\nZone occupancy, allocated share of allocatable space\n");
+	for (k = 0; k < 10; ++k) {
+		printf("    %3d-%3d%% %10ju zones\n",
+		       k * 10, k * 10 + 10,
+		       (uintmax_t)occupancy[k]);
+	}
+	if (VerboseOpt) {
+		printf("\n    zone              leaf  alloc%%       free "
+		       "   free64K  largest classes\n");
+		for (z = 0; z < FreemapScan.nzones; ++z) {
+			zone = &FreemapScan.zones[z];
+			if (zone->error) {
+				printf("    %016jx  error %s\n",
+				       (uintmax_t)zone->key,
+				       strerror(zone->error));
+				continue;
+			}
+			usable = (hammer2_off_t)zone->starts *
+				 HAMMER2_FREEMAP_LEVEL0_SIZE;
+			printf("    %016jx  %-4s %5.1f%% %10s %10s %8s %7u\n",
+			       (uintmax_t)zone->key,
+			       zone->bref.type ? "yes" : "no",
+			       fm_pct(usable - zone->state[0], usable),
+			       fm_sizestr(zone->state[0], b1, sizeof(b1)),
+			       fm_sizestr(zone->free64, b2, sizeof(b2)),
+			       fm_sizestr((hammer2_off_t)zone->largest *
+					  HAMMER2_FREEMAP_BLOCK_SIZE,
+					  b3, sizeof(b3)),
+			       zone->nclasses);
+		}
+	}
+
+	printf("\nClustering classes of 4MB entries\n");
+	printf("    class  type        entries       used       free\n");
+	qsort(FreemapScan.classes, FreemapScan.nclasses,
+	      sizeof(*FreemapScan.classes), fm_class_cmp);
+	for (i = 0; i < FreemapScan.nclasses; ++i) {
+		cl = &FreemapScan.classes[i];
+		printf("    %04x   %-9s %9u %10s %10s\n",
+		       cl->class,
+		       cl->class ? hammer2_breftype_to_str(cl->class >> 8) :
+				   "none",
+		       cl->entries,
+		       fm_sizestr(cl->used, b1, sizeof(b1)),
+		       fm_sizestr(cl->free, b2, sizeof(b2)));
+	}
+	if (FreemapScan.other_classes) {
+		printf("    (%ju entries of further classes)\n",
+		       (uintmax_t)FreemapScan.other_classes);
+	}
+
+	fm_print_cost();
+
+	free(FreemapScan.zones);
+	free(voldata);
+	free(devpath);
+	hammer2_cleanup_volumes();
+	if (fflush(stdout) != 0)
+		err(1, "freemap-stats");
+
+	return (errors ? 1 : 0);
+}
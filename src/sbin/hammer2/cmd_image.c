@@ -0,0 +1,904 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ls, cat and extract directives.  These read an unmounted filesystem
+ * through libhammer2 and work on any host, including ones without
+ * HAMMER2 kernel support.
+ */
+#include "hammer2.h"
+#include "libhammer2.h"
+
+#include <err.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Regular files are extracted in chunks which are read, verified,
+ * decompressed and written out by NThreadsOpt threads.
+ */
+#define EXTRACT_CHUNK	(4 * 1024 * 1024)
+#define EXTRACT_HSIZE	4096		/* hardlink hash */
+
+typedef struct image_dirent_list {
+	hammer2_image_dirent_t *ents;
+	int		count;
+	int		alloc;
+} image_dirent_list_t;
+
+typedef struct extract_file {
+	hammer2_image_inode_t ip;
+	char		*path;
+	int		fd;
+	int		refs;		/* jobs + dispatcher */
+	int		error;
+} extract_file_t;
+
+typedef struct extract_job {
+	struct extract_job *next;
+	extract_file_t	*file;
+	hammer2_off_t	offset;
+	size_t		bytes;
+} extract_job_t;
+
+typedef struct extract_dir {
+	struct extract_dir *next;
+	hammer2_image_inode_t ip;
+	char		*path;
+} extract_dir_t;
+
+typedef struct extract_link {
+	struct extract_link *next;
+	hammer2_key_t	inum;
+	char		*path;
+} extract_link_t;
+
+static hammer2_image_t *ExtractImage;
+static extract_dir_t *ExtractDirs;	/* most recently created first */
+static extract_link_t *ExtractLinks[EXTRACT_HSIZE];
+static struct {
+	uint64_t	files;
+	uint64_t	dirs;
+	uint64_t	other;
+	uint64_t	errors;
+} ExtractStats;
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		/* job queued or stopping */
+	pthread_cond_t	done_cond;	/* job done */
+	extract_job_t	*qhead;
+	extract_job_t	**qtailp;
+	pthread_t	*threads;
+	char		*buf;		/* nthreads == 1 */
+	int		nthreads;
+	int		inflight;
+	int		stopping;
+} ExtractPool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static hammer2_image_t *image_open(const char *special);
+static int image_list_dir(hammer2_image_t *img,
+			const hammer2_image_inode_t *dip,
+			image_dirent_list_t *list);
+static int ls_path(hammer2_image_t *img, const char *path, int header);
+static void extract_object(const hammer2_image_inode_t *ip,
+			const char *path);
+static void extract_dir_entries(const hammer2_image_inode_t *dip,
+			const char *path);
+
+static hammer2_image_t *
+image_open(const char *special)
+{
+	hammer2_image_t *img;
+
+	img = hammer2_image_open(special, MemOpt);
+	if (img == NULL)
+		err(1, "%s", special);
+	return img;
+}
+
+static int
+image_list_cb(const hammer2_image_dirent_t *dent, void *arg)
+{
+	image_dirent_list_t *list = arg;
+
+	if (list->count == list->alloc) {
+		list->alloc = list->alloc ? list->alloc * 2 : 64;
+		list->ents = realloc(list->ents,
+				     list->alloc * sizeof(*list->ents));
+		if (list->ents == NULL)
+			return ENOMEM;
+	}
+	list->ents[list->count++] = *dent;
+
+	return 0;
+}
+
+static int
+image_dirent_cmp(const void *p1, const void *p2)
+{
+	const hammer2_image_dirent_t *dent1 = p1;
+	const hammer2_image_dirent_t *dent2 = p2;
+
+	return strcmp(dent1->name, dent2->name);
+}
+
+/*
+ * Collect a directory's entries sorted by name.
+ */
+static int
+image_list_dir(hammer2_image_t *img, const hammer2_image_inode_t *dip,
+	       image_dirent_list_t *list)
+{
+	int error;
+
+	bzero(list, sizeof(*list));
+	error = hammer2_image_readdir(img, dip, image_list_cb, list);
+	if (error == 0 && list->count > 1)
+		qsort(list->ents, list->count, sizeof(*list->ents),
+		      image_dirent_cmp);
+	return error;
+}
+
+static char *
+image_join(const char *path, const char *name)
+{
+	char *res;
+
+	if (path[0] && path[strlen(path) - 1] == '/')
+		asprintf(&res, "%s%s", path, name);
+	else
+		asprintf(&res, "%s/%s", path, name);
+	if (res == NULL)
+		err(1, "asprintf");
+	return res;
+}
+
+/************************************************************************
+ *				    LS					*
+ ************************************************************************/
+
+static void
+ls_modestr(const struct stat *st, char *buf)
+{
+	mode_t mode = st->st_mode;
+
+	switch(mode & S_IFMT) {
+	case S_IFDIR:
+		buf[0] = 'd';
+		break;
+	case S_IFIFO:
+		buf[0] = 'p';
+		break;
+	case S_IFCHR:
+		buf[0] = 'c';
+		break;
+	case S_IFBLK:
+		buf[0] = 'b';
+		break;
+	case S_IFLNK:
+		buf[0] = 'l';
+		break;
+	case S_IFSOCK:
+		buf[0] = 's';
+		break;
+	default:
+		buf[0] = '-';
+		break;
+	}
+	buf[1] = (mode & S_IRUSR) ? 'r' : '-';
+	buf[2] = (mode & S_IWUSR) ? 'w' : '-';
+	buf[3] = (mode & S_ISUID) ? ((mode & S_IXUSR) ? 's' : 'S') :
+				    ((mode & S_IXUSR) ? 'x' : '-');
+	buf[4] = (mode & S_IRGRP) ? 'r' : '-';
+	buf[5] = (mode & S_IWGRP) ? 'w' : '-';
+	buf[6] = (mode & S_ISGID) ? ((mode & S_IXGRP) ? 's' : 'S') :
+				    ((mode & S_IXGRP) ? 'x' : '-');
+	buf[7] = (mode & S_IROTH) ? 'r' : '-';
+	buf[8] = (mode & S_IWOTH) ? 'w' : '-';
+	buf[9] = (mode & S_ISVTX) ? ((mode & S_IXOTH) ? 't' : 'T') :
+				    ((mode & S_IXOTH) ? 'x' : '-');
+	buf[10] = 0;
+}
+
+static void
+ls_print(hammer2_image_t *img, const hammer2_image_inode_t *ip,
+	 const char *name)
+{
+	char target[HAMMER2_INODE_MAXNAME * 4 + 1];
+	char modestr[11];
+	char timestr[32];
+	struct stat st;
+	struct tm *tp;
+	time_t t;
+	ssize_t n;
+
+	if (QuietOpt) {
+		printf("%s\n", name);
+		return;
+	}
+
+	hammer2_image_stat(ip, &st);
+	ls_modestr(&st, modestr);
+	t = st.st_mtim.tv_sec;
+	tp = localtime(&t);
+	if (tp == NULL ||
+	    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M", tp) == 0)
+		strlcpy(timestr, "-", sizeof(timestr));
+
+	if (VerboseOpt)
+		printf("%10ju ", (uintmax_t)st.st_ino);
+	printf("%s %3ju %-8u %-8u ", modestr, (uintmax_t)st.st_nlink,
+	       (u_int)st.st_uid, (u_int)st.st_gid);
+	if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode))
+		printf("%5u, %5u ", major(st.st_rdev), minor(st.st_rdev));
+	else
+		printf("%12jd ", (intmax_t)st.st_size);
+	printf("%s %s", timestr, name);
+
+	if (S_ISLNK(st.st_mode)) {
+		n = hammer2_image_pread(img, ip, target, sizeof(target) - 1, 0);
+		if (n >= 0) {
+			target[n] = 0;
+			printf(" -> %s", target);
+		}
+	}
+	printf("\n");
+}
+
+static int
+ls_path(hammer2_image_t *img, const char *path, int header)
+{
+	hammer2_image_inode_t ip;
+	hammer2_image_inode_t cip;
+	image_dirent_list_t list;
+	hammer2_image_dirent_t *dent;
+	char *cpath;
+	int ecode = 0;
+	int error;
+	int i;
+
+	error = hammer2_image_lookup(img, path, &ip);
+	if (error) {
+		warnx("%s: %s", path, strerror(error));
+		return 1;
+	}
+	if (ip.ipdata.meta.type != HAMMER2_OBJTYPE_DIRECTORY) {
+		ls_print(img, &ip, path);
+		return 0;
+	}
+
+	error = image_list_dir(img, &ip, &list);
+	if (error) {
+		warnx("%s: %s", path, strerror(error));
+		ecode = 1;
+	}
+	if (header)
+		printf("%s:\n", path);
+	for (i = 0; i < list.count; ++i) {
+		dent = &list.ents[i];
+		error = hammer2_image_inum(img, dent->inum, &cip);
+		if (error) {
+			warnx("%s: inode %016jx: %s", dent->name,
+			      (uintmax_t)dent->inum, strerror(error));
+			ecode = 1;
+			continue;
+		}
+		ls_print(img, &cip, dent->name);
+	}
+
+	if (RecurseOpt) {
+		for (i = 0; i < list.count; ++i) {
+			dent = &list.ents[i];
+			if (dent->type != HAMMER2_OBJTYPE_DIRECTORY)
+				continue;
+			cpath = image_join(path, dent->name);
+			printf("\n");
+			ecode |= ls_path(img, cpath, 1);
+			free(cpath);
+		}
+	}
+	free(list.ents);
+
+	return ecode;
+}
+
+int
+cmd_ls(const char *special, int ac, const char **av)
+{
+	hammer2_image_t *img;
+	int ecode = 0;
+	int i;
+
+	img = image_open(special);
+	if (ac == 0) {
+		ecode = ls_path(img, "/", 0);
+	} else {
+		for (i = 0; i < ac; ++i) {
+			if (ac > 1 && i)
+				printf("\n");
+			ecode |= ls_path(img, av[i], ac > 1);
+		}
+	}
+	hammer2_image_close(img);
+
+	return ecode;
+}
+
+/************************************************************************
+ *				    CAT					*
+ ************************************************************************/
+
+int
+cmd_cat(const char *special, int ac, const char **av)
+{
+	hammer2_image_t *img;
+	hammer2_image_inode_t ip;
+	hammer2_off_t off;
+	char *buf;
+	ssize_t n;
+	ssize_t w;
+	ssize_t done;
+	int ecode = 0;
+	int error;
+	int i;
+
+	img = image_open(special);
+	buf = malloc(EXTRACT_CHUNK);
+	if (buf == NULL)
+		err(1, "malloc");
+
+	for (i = 0; i < ac; ++i) {
+		error = hammer2_image_lookup(img, av[i], &ip);
+		if (error == 0 &&
+		    ip.ipdata.meta.type == HAMMER2_OBJTYPE_DIRECTORY)
+			error = EISDIR;
+		if (error) {
+			warnx("%s: %s", av[i], strerror(error));
+			ecode = 1;
+			continue;
+		}
+		for (off = 0; off < ip.ipdata.meta.size; off += n) {
+			n = hammer2_image_pread(img, &ip, buf, EXTRACT_CHUNK,
+						off);
+			if (n <= 0) {
+				warn("%s", av[i]);
+				ecode = 1;
+				break;
+			}
+			for (done = 0; done < n; done += w) {
+				w = write(STDOUT_FILENO, buf + done, n - done);
+				if (w < 0)
+					err(1, "stdout");
+			}
+		}
+	}
+	free(buf);
+	hammer2_image_close(img);
+
+	return ecode;
+}
+
+/************************************************************************
+ *				  EXTRACT				*
+ ************************************************************************/
+
+static void
+extract_error(const char *path, int error)
+{
+	warnx("%s: %s", path, strerror(error));
+	pthread_mutex_lock(&ExtractPool.lock);
+	++ExtractStats.errors;
+	pthread_mutex_unlock(&ExtractPool.lock);
+}
+
+static void
+extract_times(const hammer2_inode_meta_t *meta, struct timespec *ts)
+{
+	ts[0].tv_sec = meta->atime / 1000000;
+	ts[0].tv_nsec = meta->atime % 1000000 * 1000;
+	ts[1].tv_sec = meta->mtime / 1000000;
+	ts[1].tv_nsec = meta->mtime % 1000000 * 1000;
+}
+
+/*
+ * Set ownership (when running as root), modes, times and flags on
+ * anything but regular files, which are adjusted through their
+ * descriptor.
+ */
+static void
+extract_set_attrs(const char *path, const hammer2_image_inode_t *ip)
+{
+	const hammer2_inode_meta_t *meta = &ip->ipdata.meta;
+	struct timespec ts[2];
+	struct stat st;
+
+	hammer2_image_stat(ip, &st);
+	if (geteuid() == 0 && lchown(path, st.st_uid, st.st_gid) < 0)
+		warn("%s: chown", path);
+	if (meta->type != HAMMER2_OBJTYPE_SOFTLINK &&
+	    chmod(path, meta->mode & ALLPERMS) < 0)
+		warn("%s: chmod", path);
+	extract_times(meta, ts);
+	if (utimensat(AT_FDCWD, path, ts, AT_SYMLINK_NOFOLLOW) < 0)
+		warn("%s: utimensat", path);
+	if (meta->type != HAMMER2_OBJTYPE_SOFTLINK && meta->uflags)
+		chflags(path, meta->uflags);
+}
+
+static void
+extract_file_done(extract_file_t *file)
+{
+	const hammer2_inode_meta_t *meta = &file->ip.ipdata.meta;
+	struct timespec ts[2];
+	struct stat st;
+
+	if (file->error)
+		extract_error(file->path, file->error);
+	hammer2_image_stat(&file->ip, &st);
+	if (geteuid() == 0 && fchown(file->fd, st.st_uid, st.st_gid) < 0)
+		warn("%s: chown", file->path);
+	fchmod(file->fd, meta->mode & ALLPERMS);
+	extract_times(meta, ts);
+	if (futimens(file->fd, ts) < 0)
+		warn("%s: futimens", file->path);
+	if (meta->uflags)
+		fchflags(file->fd, meta->uflags);
+	close(file->fd);
+	free(file->path);
+	free(file);
+}
+
+static int
+extract_zero(const char *buf, size_t bytes)
+{
+	const uint64_t *p = (const void *)buf;
+	size_t i;
+
+	for (i = 0; i < bytes / sizeof(*p); ++i) {
+		if (p[i])
+			return 0;
+	}
+	for (i = i * sizeof(*p); i < bytes; ++i) {
+		if (buf[i])
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Read one chunk of a file and write it out, leaving all-zero 64KB
+ * pieces as holes (the file has already been extended to its size).
+ */
+static void
+extract_run_job(extract_job_t *job, char *buf)
+{
+	extract_file_t *file = job->file;
+	ssize_t n;
+	ssize_t w;
+	size_t done;
+	size_t piece;
+	int error = 0;
+	int last;
+
+	n = hammer2_image_pread(ExtractImage, &file->ip, buf, job->bytes,
+				job->offset);
+	if (n < 0)
+		error = errno;
+	for (done = 0; error == 0 && done < (size_t)n; done += piece) {
+		piece = n - done;
+		if (piece > HAMMER2_PBUFSIZE)
+			piece = HAMMER2_PBUFSIZE;
+		if (extract_zero(buf + done, piece))
+			continue;
+		w = pwrite(file->fd, buf + done, piece, job->offset + done);
+		if (w != (ssize_t)piece)
+			error = (w < 0) ? errno : EIO;
+	}
+
+	pthread_mutex_lock(&ExtractPool.lock);
+	if (error && file->error == 0)
+		file->error = error;
+	last = (--file->refs == 0);
+	pthread_mutex_unlock(&ExtractPool.lock);
+	if (last)
+		extract_file_done(file);
+	free(job);
+}
+
+static void *
+extract_thread(void *arg __unused)
+{
+	extract_job_t *job;
+	char *buf;
+
+	buf = malloc(EXTRACT_CHUNK);
+	if (buf == NULL)
+		err(1, "malloc");
+
+	pthread_mutex_lock(&ExtractPool.lock);
+	for (;;) {
+		while (ExtractPool.qhead == NULL && ExtractPool.stopping == 0)
+			pthread_cond_wait(&ExtractPool.cond, &ExtractPool.lock);
+		if ((job = ExtractPool.qhead) == NULL)
+			break;
+		if ((ExtractPool.qhead = job->next) == NULL)
+			ExtractPool.qtailp = &ExtractPool.qhead;
+		pthread_mutex_unlock(&ExtractPool.lock);
+
+		extract_run_job(job, buf);
+
+		pthread_mutex_lock(&ExtractPool.lock);
+		--ExtractPool.inflight;
+		pthread_cond_broadcast(&ExtractPool.done_cond);
+	}
+	pthread_mutex_unlock(&ExtractPool.lock);
+	free(buf);
+
+	return NULL;
+}
+
+static void
+extract_init_pool(int nthreads)
+{
+	int i;
+
+	ExtractPool.nthreads = nthreads;
+	ExtractPool.qhead = NULL;
+	ExtractPool.qtailp = &ExtractPool.qhead;
+	if (nthreads == 1) {
+		ExtractPool.buf = malloc(EXTRACT_CHUNK);
+		if (ExtractPool.buf == NULL)
+			err(1, "malloc");
+		return;
+	}
+	ExtractPool.threads = calloc(nthreads, sizeof(pthread_t));
+	for (i = 0; i < nthreads; ++i) {
+		if (pthread_create(&ExtractPool.threads[i], NULL,
+				   extract_thread, NULL) != 0)
+			errx(1, "pthread_create failed");
+	}
+}
+
+static void
+extract_cleanup_pool(void)
+{
+	int i;
+
+	if (ExtractPool.threads) {
+		pthread_mutex_lock(&ExtractPool.lock);
+		ExtractPool.stopping = 1;
+		pthread_cond_broadcast(&ExtractPool.cond);
+		pthread_mutex_unlock(&ExtractPool.lock);
+		for (i = 0; i < ExtractPool.nthreads; ++i)
+			pthread_join(ExtractPool.threads[i], NULL);
+		free(ExtractPool.threads);
+		ExtractPool.threads = NULL;
+	}
+	free(ExtractPool.buf);
+	ExtractPool.buf = NULL;
+}
+
+static void
+extract_dispatch(extract_job_t *job)
+{
+	if (ExtractPool.nthreads == 1) {
+		extract_run_job(job, ExtractPool.buf);
+		return;
+	}
+	pthread_mutex_lock(&ExtractPool.lock);
+	while (ExtractPool.inflight >= ExtractPool.nthreads * 4)
+		pthread_cond_wait(&ExtractPool.done_cond, &ExtractPool.lock);
+	++ExtractPool.inflight;
+	job->next = NULL;
+	*ExtractPool.qtailp = job;
+	ExtractPool.qtailp = &job->next;
+	pthread_cond_signal(&ExtractPool.cond);
+	pthread_mutex_unlock(&ExtractPool.lock);
+}
+
+/*
+ * Returns non-zero if the inode was already extracted under another
+ * name, in which case (path) is hardlinked to it.
+ */
+static int
+extract_hardlink(const hammer2_image_inode_t *ip, const char *path)
+{
+	extract_link_t *lk;
+	hammer2_key_t inum = ip->ipdata.meta.inum;
+	int hv = (int)(inum ^ (inum >> 12)) & (EXTRACT_HSIZE - 1);
+
+	if (ip->ipdata.meta.nlinks < 2)
+		return 0;
+	for (lk = ExtractLinks[hv]; lk; lk = lk->next) {
+		if (lk->inum != inum)
+			continue;
+		if (link(lk->path, path) < 0)
+			extract_error(path, errno);
+		return 1;
+	}
+	lk = malloc(sizeof(*lk));
+	lk->inum = inum;
+	lk->path = strdup(path);
+	lk->next = ExtractLinks[hv];
+	ExtractLinks[hv] = lk;
+
+	return 0;
+}
+
+static void
+extract_regfile(const hammer2_image_inode_t *ip, const char *path)
+{
+	extract_file_t *file;
+	extract_job_t *job;
+	hammer2_off_t size = ip->ipdata.meta.size;
+	hammer2_off_t off;
+	int last;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		extract_error(path, errno);
+		return;
+	}
+	if (ftruncate(fd, size) < 0) {
+		extract_error(path, errno);
+		close(fd);
+		return;
+	}
+
+	file = calloc(1, sizeof(*file));
+	file->ip = *ip;
+	file->path = strdup(path);
+	file->fd = fd;
+	file->refs = 1;
+	for (off = 0; off < size; off += EXTRACT_CHUNK) {
+		job = calloc(1, sizeof(*job));
+		job->file = file;
+		job->offset = off;
+		job->bytes = EXTRACT_CHUNK;
+		pthread_mutex_lock(&ExtractPool.lock);
+		++file->refs;
+		pthread_mutex_unlock(&ExtractPool.lock);
+		extract_dispatch(job);
+	}
+
+	pthread_mutex_lock(&ExtractPool.lock);
+	last = (--file->refs == 0);
+	pthread_mutex_unlock(&ExtractPool.lock);
+	if (last)
+		extract_file_done(file);
+}
+
+static void
+extract_object(const hammer2_image_inode_t *ip, const char *path)
+{
+	const hammer2_inode_meta_t *meta = &ip->ipdata.meta;
+	extract_dir_t *dir;
+	char target[HAMMER2_INODE_MAXNAME * 4 + 1];
+	mode_t mode;
+	ssize_t n;
+
+	if (VerboseOpt >= 2)
+		printf("%s\n", path);
+	if (meta->type != HAMMER2_OBJTYPE_DIRECTORY &&
+	    extract_hardlink(ip, path)) {
+		++ExtractStats.files;
+		return;
+	}
+
+	switch(meta->type) {
+	case HAMMER2_OBJTYPE_DIRECTORY:
+		if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+			extract_error(path, errno);
+			return;
+		}
+		dir = malloc(sizeof(*dir));
+		dir->ip = *ip;
+		dir->path = strdup(path);
+		dir->next = ExtractDirs;
+		ExtractDirs = dir;
+		++ExtractStats.dirs;
+		extract_dir_entries(ip, path);
+		return;
+	case HAMMER2_OBJTYPE_REGFILE:
+		++ExtractStats.files;
+		extract_regfile(ip, path);
+		return;
+	case HAMMER2_OBJTYPE_SOFTLINK:
+		n = hammer2_image_pread(ExtractImage, ip, target,
+					sizeof(target) - 1, 0);
+		if (n < 0) {
+			extract_error(path, errno);
+			return;
+		}
+		target[n] = 0;
+		if (symlink(target, path) < 0) {
+			extract_error(path, errno);
+			return;
+		}
+		break;
+	case HAMMER2_OBJTYPE_FIFO:
+		if (mkfifo(path, 0600) < 0) {
+			extract_error(path, errno);
+			return;
+		}
+		break;
+	case HAMMER2_OBJTYPE_CDEV:
+	case HAMMER2_OBJTYPE_BDEV:
+		mode = (meta->type == HAMMER2_OBJTYPE_CDEV) ? S_IFCHR : S_IFBLK;
+		if (mknod(path, mode | 0600,
+			  makedev(meta->rmajor, meta->rminor)) < 0) {
+			extract_error(path, errno);
+			return;
+		}
+		break;
+	default:
+		if (VerboseOpt)
+			printf("%s: skipping %s\n", path,
+			       hammer2_iptype_to_str(meta->type));
+		return;
+	}
+	++ExtractStats.other;
+	extract_set_attrs(path, ip);
+}
+
+static void
+extract_dir_entries(const hammer2_image_inode_t *dip, const char *path)
+{
+	hammer2_image_inode_t ip;
+	image_dirent_list_t list;
+	char *cpath;
+	int error;
+	int i;
+
+	error = image_list_dir(ExtractImage, dip, &list);
+	if (error)
+		extract_error(path, error);
+	for (i = 0; i < list.count; ++i) {
+		cpath = image_join(path, list.ents[i].name);
+		error = hammer2_image_inum(ExtractImage, list.ents[i].inum,
+					   &ip);
+		if (error)
+			extract_error(cpath, error);
+		else
+			extract_object(&ip, cpath);
+		free(cpath);
+	}
+	free(list.ents);
+}
+
+/*
+ * Extract a file or directory tree.  The PFS root is extracted into
+ * (destdir) itself, anything else into destdir/<last path element>.
+ */
+int
+cmd_extract(const char *special, const char *path, const char *destdir)
+{
+	hammer2_image_inode_t ip;
+	hammer2_image_inode_t root;
+	hammer2_image_stats_t stats;
+	extract_dir_t *dir;
+	extract_link_t *lk;
+	struct timespec ts0, ts1;
+	const char *name;
+	char *dpath;
+	double elapsed;
+	int error;
+	int i;
+
+	ExtractImage = image_open(special);
+	error = hammer2_image_lookup(ExtractImage, path, &ip);
+	if (error)
+		errx(1, "%s: %s", path, strerror(error));
+	if (mkdir(destdir, 0755) < 0 && errno != EEXIST)
+		err(1, "%s", destdir);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	extract_init_pool(NThreadsOpt);
+
+	hammer2_image_root(ExtractImage, &root);
+	if (ip.ipdata.meta.inum == root.ipdata.meta.inum) {
+		extract_dir_entries(&ip, destdir);
+	} else {
+		name = strrchr(path, '/');
+		name = name ? name + 1 : path;
+		if (*name == 0 || strcmp(name, ".") == 0 ||
+		    strcmp(name, "..") == 0)
+			name = (const char *)ip.ipdata.filename;
+		dpath = image_join(destdir, name);
+		extract_object(&ip, dpath);
+		free(dpath);
+	}
+
+	/*
+	 * Directory modes and times are set last, deepest first, once all
+	 * files have been written.
+	 */
+	extract_cleanup_pool();
+	while ((dir = ExtractDirs) != NULL) {
+		ExtractDirs = dir->next;
+		extract_set_attrs(dir->path, &dir->ip);
+		free(dir->path);
+		free(dir);
+	}
+	for (i = 0; i < EXTRACT_HSIZE; ++i) {
+		while ((lk = ExtractLinks[i]) != NULL) {
+			ExtractLinks[i] = lk->next;
+			free(lk->path);
+			free(lk);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+	elapsed = (ts1.tv_sec - ts0.tv_sec) +
+		  (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+	if (elapsed <= 0.0)
+		elapsed = 1e-9;
+	hammer2_image_get_stats(ExtractImage, &stats);
+	if (QuietOpt == 0) {
+		printf("extract: %ju files, %ju directories, %ju other, "
+		       "%ju errors\n",
+		       (uintmax_t)ExtractStats.files,
+		       (uintmax_t)ExtractStats.dirs,
+		       (uintmax_t)ExtractStats.other,
+		       (uintmax_t)ExtractStats.errors);
+		printf("extract: %s in %.3f sec, %.1f MB/s, %d threads\n",
+		       sizetostr(stats.data_bytes), elapsed,
+		       stats.data_bytes / elapsed / (1024 * 1024),
+		       NThreadsOpt);
+	}
+	if (VerboseOpt) {
+		printf("media: %ju reads, %s, %.1f MB/s\n",
+		       (uintmax_t)stats.media_reads,
+		       sizetostr(stats.media_bytes),
+		       stats.media_bytes / elapsed / (1024 * 1024));
+		printf("cache: %ju hits, %ju misses, "
+		       "%ju blocks decompressed, %ju check errors\n",
+		       (uintmax_t)stats.cache_hits,
+		       (uintmax_t)stats.cache_misses,
+		       (uintmax_t)stats.decompressed,
+		       (uintmax_t)stats.check_errors);
+	}
+	hammer2_image_close(ExtractImage);
+
+	return (ExtractStats.errors ? 1 : 0);
+}
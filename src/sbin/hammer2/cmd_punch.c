@@ -0,0 +1,112 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "hammer2.h"
+
+/*
+ * Parse a byte count with an optional k, m, g or t suffix.
+ */
+static int
+getbytes(const char *str, hammer2_off_t *valp)
+{
+	char *ep;
+	uint64_t val;
+
+	errno = 0;
+	val = strtoull(str, &ep, 0);
+	if (errno || ep == str)
+		return (-1);
+	switch (*ep) {
+	case 't':
+	case 'T':
+		val <<= 10;
+		/* fall through */
+	case 'g':
+	case 'G':
+		val <<= 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		val <<= 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		val <<= 10;
+		++ep;
+		break;
+	}
+	if (*ep != '\0' || val > INT64_MAX)
+		return (-1);
+	*valp = val;
+
+	return (0);
+}
+
+/*
+ * Deallocate a byte range of a regular file, the file size is unchanged.
+ */
+int
+cmd_punch(const char *path, const char *offset_str, const char *length_str)
+{
+	struct hammer2_ioc_punch punch;
+	int fd;
+
+	bzero(&punch, sizeof(punch));
+	if (getbytes(offset_str, &punch.offset) < 0) {
+		fprintf(stderr, "punch: bad offset %s\n", offset_str);
+		return 1;
+	}
+	if (getbytes(length_str, &punch.length) < 0) {
+		fprintf(stderr, "punch: bad length %s\n", length_str);
+		return 1;
+	}
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	if (ioctl(fd, HAMMER2IOC_PUNCH, &punch) < 0) {
+		fprintf(stderr, "punch %s failed: %s\n",
+			path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	return 0;
+}
@@ -66,27 +66,26 @@
  */
 #include "hammer2.h"
 
-#define HTABLE_SIZE	(4*1024*1024)
-#define HTABLE_MASK	(HTABLE_SIZE - 1)
-#define DISPMODULO	(HTABLE_SIZE / 32768)
+#define DISPMODULO	1024
 
 #include <openssl/sha.h>
+#include <pthread.h>
+#include <time.h>
 
-typedef struct dirent_entry {
-	struct dirent_entry *next;
-	char		*filename;
-	size_t		len;
-	hammer2_key_t	inum;
-	hammer2_off_t	bref_off;
-} dirent_entry_t;
+/*
+ * The media pass is split into chunks which are scanned by NThreadsOpt
+ * threads and merged into the hash tables in media order.
+ */
+#define MEDIA_CHUNK	(16 * 1024 * 1024)
+#define MEDIA_IOSIZE	(1024 * 1024)
+#define MEDIA_MEMO	4096		/* per-thread validation memo */
 
 typedef struct inode_entry {
-	struct inode_entry *next;
-	struct inode_entry *next2;	/* secondary (ino ^ data_off) hash */
 	hammer2_off_t	data_off;
 	hammer2_key_t	inum;		/* from bref or inode meta */
 	//hammer2_inode_data_t inode;	/* (removed, too expensive) */
-	char		*link_file_path;
+	uint64_t	link_file_path;	/* StrArena offset, 0 if none */
+	uint32_t	next;		/* InodePool index + 1, same inum */
 	uint32_t	inode_crc;
 	uint8_t		type;		/* from inode meta */
 	uint8_t		encountered;	/* copies limit w/REPINODEDEPTH */
@@ -95,66 +94,276 @@ typedef struct inode_entry {
 } inode_entry_t;
 
 typedef struct topology_entry {
-	struct topology_entry *next;
-	char		*path;
+	uint64_t	path;		/* StrArena offset */
 	long		iterator;
 } topology_entry_t;
 
+#define BREF_CHECK_SIZE	sizeof(((hammer2_blockref_t *)NULL)->check)
+
 typedef struct neg_entry {
-	struct neg_entry *next;
-	hammer2_blockref_t bref;
+	hammer2_off_t	data_off;
+	hammer2_key_t	key;
+	uint8_t		type;
+	uint8_t		methods;
+	char		check[BREF_CHECK_SIZE];
 } neg_entry_t;
 
 typedef struct topo_bref_entry {
-	struct topo_bref_entry *next;
 	topology_entry_t  *topo;
 	hammer2_off_t	data_off;
 } topo_bref_entry_t;
 
 typedef struct topo_inode_entry {
-	struct topo_inode_entry *next;
 	topology_entry_t  *topo;
 	inode_entry_t *iscan;
 } topo_inode_entry_t;
 
-static dirent_entry_t **DirHash;
-static inode_entry_t **InodeHash;
-static inode_entry_t **InodeHash2;	/* secondary multi-variable hash */
-static topology_entry_t **TopologyHash;
-static neg_entry_t **NegativeHash;
-static topo_bref_entry_t **TopoBRefHash;
-static topo_inode_entry_t **TopoInodeHash;
+/*
+ * Entries are allocated from pools of fixed size blocks, so they are
+ * addressed by a 32 bit index and never move.
+ */
+#define POOL_SHIFT	12
+#define POOL_COUNT	(1 << POOL_SHIFT)
+#define POOL_MASK	(POOL_COUNT - 1)
+
+typedef struct pool {
+	char		**blocks;
+	size_t		esize;
+	uint32_t	count;
+} pool_t;
+
+/*
+ * Open addressing hash tables of pool indices with linear probing.  A slot
+ * holds the 32 bit hash of its entry and the index + 1, so a table can be
+ * grown without looking at the entries.  Tables start small and double
+ * once 3/4 full, after which each insert moves RHASH_MIGRATE slots of the
+ * previous table rather than rehashing everything at once.
+ */
+#define RHASH_INIT	1024
+#define RHASH_MIGRATE	16
+#define RHASH_MOVED	((uint64_t)-1)
+#define RHASH_SLOT(hv, idx)	((uint64_t)(hv) << 32 | ((uint64_t)(idx) + 1))
+#define RHASH_HASH(slot)	((uint32_t)((slot) >> 32))
+#define RHASH_INDEX(slot)	((uint32_t)(slot) - 1)
+
+typedef struct rhash {
+	uint64_t	*slots;
+	uint64_t	mask;
+	uint64_t	count;
+	uint64_t	*oslots;	/* previous table, being migrated */
+	uint64_t	omask;
+	uint64_t	opos;
+} rhash_t;
+
+typedef struct rhash_iter {
+	const rhash_t	*rh;
+	uint32_t	hv;
+	int		old;
+	uint64_t	pos;
+} rhash_iter_t;
+
+/*
+ * Strings are stored in an arena and referenced by offset.  Offset 0 is
+ * the empty string.
+ */
+typedef struct arena {
+	char		*buf;
+	size_t		len;
+	size_t		size;
+} arena_t;
+
+/*
+ * Read cache of hammer2 block sized buffers, one per media pass thread and
+ * a much larger one for the restoration pass (-m, SDCDEFAULT if not given).
+ * Buffers are located through a chained hash and evicted with CLOCK.
+ */
+#define SDCCOUNT	16			/* media pass threads */
+#define SDCDEFAULT	(256L * 1024 * 1024)	/* restoration pass */
+
+typedef struct sdccache {
+	char		*buf;
+	hammer2_off_t	offset;
+	hammer2_volume_t *vol;
+	int		hnext;		/* next entry in hash chain or -1 */
+	int		referenced;
+} sdccache_t;
+
+typedef struct sdcset {
+	sdccache_t	*ent;
+	int		*hash;
+	int		hmask;
+	int		count;		/* entries with a buffer */
+	int		max;
+	int		hand;		/* CLOCK hand */
+	long		hits;
+	long		misses;
+} sdcset_t;
+
+/*
+ * File data brefs are batched up across indirect blocks and read in
+ * media order.  One batch per thread writing files.
+ */
+#define DUMP_BATCH	4096
+
+typedef struct dump_batch {
+	hammer2_blockref_t *brefs;
+	int		count;
+	int		wfd;
+	hammer2_off_t	fsize;
+	char		*ibuf;		/* media block */
+	char		*obuf;		/* decompressed block */
+} dump_batch_t;
+
+/*
+ * With NThreadsOpt > 1 regular files are written out by worker threads.
+ * The main thread still walks the tree, creates directories and opens
+ * each file, and retires jobs in the order they were dispatched, so a
+ * directory's attributes are only set once the files under it are done.
+ */
+#define DUMP_INFLIGHT	1024
+#define DUMP_STACK	(4 * 1024 * 1024)
+
+typedef struct dump_job {
+	struct dump_job	*next;		/* dispatch order */
+	struct dump_job	*qnext;		/* waiting for a worker */
+	inode_entry_t	*iscan;		/* NULL for directory attributes */
+	hammer2_inode_data_t inode;
+	char		*path;
+	int		wfd;
+	int		res;
+	int		done;
+} dump_job_t;
+
+/*
+ * Media pass candidates, recorded by the scanning thread in media order.
+ * Inode brefs are validated by the scanning thread, which leaves only
+ * the hash table updates to the merge.
+ */
+#define CAND_INODE	1	/* bref to a valid inode */
+#define CAND_NEG	2	/* bref failed validation */
+#define CAND_SKIP	3	/* bref rejected before I/O */
+#define CAND_ROOT	4	/* possible PFS root inode, no bref */
+
+typedef struct media_cand {
+	hammer2_blockref_t bref;	/* key and data_off for CAND_ROOT */
+	uint32_t	inode_crc;
+	uint8_t		kind;
+	uint8_t		type;		/* from inode meta */
+} media_cand_t;
+
+typedef struct media_chunk {
+	hammer2_volume_t *vol;
+	hammer2_off_t	poff;
+	hammer2_off_t	size;
+	hammer2_off_t	bytes;		/* successfully read */
+	media_cand_t	*cands;
+	int		count;
+	int		alloc;
+	int		done;
+} media_chunk_t;
+
+typedef struct media_memo {
+	hammer2_blockref_t bref;
+	uint32_t	inode_crc;
+	uint8_t		kind;
+	uint8_t		type;
+} media_memo_t;
+
+typedef struct media_thread {
+	pthread_t	td;
+	sdcset_t	*sdc;
+	char		*buf;
+	media_memo_t	*memo;
+} media_thread_t;
+
+static pool_t InodePool = { .esize = sizeof(inode_entry_t) };
+static pool_t TopologyPool = { .esize = sizeof(topology_entry_t) };
+static pool_t NegativePool = { .esize = sizeof(neg_entry_t) };
+static pool_t TopoBRefPool = { .esize = sizeof(topo_bref_entry_t) };
+static pool_t TopoInodePool = { .esize = sizeof(topo_inode_entry_t) };
+static rhash_t InodeHash;
+static rhash_t InodeHash2;	/* secondary multi-variable hash */
+static rhash_t TopologyHash;
+static rhash_t NegativeHash;
+static rhash_t TopoBRefHash;
+static rhash_t TopoInodeHash;
+static arena_t StrArena;
+static sdcset_t SDCCache;
+static pthread_mutex_t SDCLock = PTHREAD_MUTEX_INITIALIZER;
+static dump_batch_t DumpBatch;	/* main thread */
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		/* job queued or stopping */
+	pthread_cond_t	done_cond;	/* job done */
+	dump_job_t	*head;		/* dispatched, not yet retired */
+	dump_job_t	**tailp;
+	dump_job_t	*qhead;		/* waiting for a worker */
+	dump_job_t	**qtailp;
+	pthread_t	*threads;
+	int		nthreads;
+	int		inflight;
+	int		stopping;
+} DumpPool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
 
 /*static void resolve_topology(void);*/
 static int check_filename(hammer2_blockref_t *bref,
 			const char *filename, char *buf, size_t flen);
-//static void enter_dirent(hammer2_blockref_t *bref, hammer2_off_t loff,
-//			const char *filename, size_t flen);
 static topology_entry_t *enter_topology(const char *path);
 static int topology_check_duplicate_inode(topology_entry_t *topo,
 			inode_entry_t *iscan);
 static int topology_check_duplicate_indirect(topology_entry_t *topo,
 			hammer2_blockref_t *bref);
-static void enter_inode(hammer2_blockref_t *bref);
-static void enter_inode_untested(hammer2_inode_data_t *ip, hammer2_off_t loff);
+static void enter_inode(const media_cand_t *cand);
+static void enter_inode_untested(const media_cand_t *cand);
+static int validate_inode(sdcset_t *sdc, const hammer2_blockref_t *bref,
+			media_cand_t *cand);
+static void scan_media_chunk(media_thread_t *mt, media_chunk_t *chunk);
+static void merge_media_chunk(media_chunk_t *chunk);
+static void media_pass(void);
+static void link_inode(inode_entry_t *scan, uint32_t idx, uint32_t hv);
 static inode_entry_t *find_first_inode(hammer2_key_t inum);
-/*static dirent_entry_t *find_first_dirent(hammer2_key_t inum);*/
-static int find_neg(hammer2_blockref_t *bref);
-static void enter_neg(hammer2_blockref_t *bref);
+static inode_entry_t *find_next_inode(inode_entry_t *iscan);
+static int find_neg(const hammer2_blockref_t *bref);
+static void enter_neg(const hammer2_blockref_t *bref);
 static void dump_tree(inode_entry_t *iscan, const char *dest,
 			const char *remain, int depth, int path_depth,
 			int isafile);
 static int dump_inum_file(inode_entry_t *iscan, hammer2_inode_data_t *inode,
 			const char *path);
+static int write_inum_file(dump_batch_t *batch, int wfd,
+			hammer2_inode_data_t *inode, const char *path);
+static void set_dir_attrs(const char *path, hammer2_inode_data_t *inode);
+static void start_dump_threads(void);
+static void stop_dump_threads(void);
+static void dispatch_job(dump_job_t *job);
+static void retire_jobs(int limit);
 static int dump_inum_softlink(hammer2_inode_data_t *inode, const char *path);
 static int dump_dir_data(const char *dest, const char *remain,
 			hammer2_blockref_t *base, int count,
 			int depth, int path_depth, int isafile);
-static int dump_file_data(int wfd, hammer2_off_t fsize,
+static int dump_file_data(dump_batch_t *batch, int wfd, hammer2_off_t fsize,
 			hammer2_blockref_t *bref, int count);
+static int dump_file_brefs(dump_batch_t *batch,
+			hammer2_blockref_t *base, int count);
+static int flush_file_data(dump_batch_t *batch);
 static int validate_crc(hammer2_blockref_t *bref, void *data, size_t bytes);
 static uint32_t hammer2_to_unix_xid(const uuid_t *uuid);
-static void *hammer2_cache_read(hammer2_off_t data_off, size_t *bytesp);
+static void *hammer2_cache_read(hammer2_off_t data_off, void *buf,
+			size_t bufsize, size_t *bytesp);
+static void sdc_init(sdcset_t *set, size_t bytes);
+static void sdc_free(sdcset_t *set);
+static int sdc_locate(hammer2_off_t data_off, hammer2_volume_t **volp,
+			hammer2_off_t *poffp, size_t *bytesp);
+static sdccache_t *sdc_lookup(sdcset_t *set, hammer2_volume_t *vol,
+			hammer2_off_t pbase);
+static sdccache_t *sdc_enter(sdcset_t *set, hammer2_volume_t *vol,
+			hammer2_off_t pbase);
+static void *sdc_read(sdcset_t *sdc, hammer2_off_t data_off, size_t *bytesp);
 
 static long InodeCount;
 static long TopoBRefCount;
@@ -170,6 +379,207 @@ static int StrictMode = 1;
 	(sizeof(union hammer2_media_data) / sizeof(hammer2_inode_data_t))
 #define REPINODEDEPTH		256
 
+#define HASH_PRIME	0x9E3779B97F4A7C15ULL
+
+static uint32_t
+hash64(uint64_t v)
+{
+	v ^= v >> 33;
+	v *= 0xFF51AFD7ED558CCDULL;
+	v ^= v >> 33;
+	v *= 0xC4CEB9FE1A85EC53ULL;
+	v ^= v >> 33;
+
+	return (uint32_t)v;
+}
+
+static uint32_t
+pool_alloc(pool_t *pool)
+{
+	uint32_t n = pool->count >> POOL_SHIFT;
+
+	if ((pool->count & POOL_MASK) == 0) {
+		pool->blocks = realloc(pool->blocks,
+				       (n + 1) * sizeof(*pool->blocks));
+		assert(pool->blocks);
+		pool->blocks[n] = calloc(POOL_COUNT, pool->esize);
+		assert(pool->blocks[n]);
+	}
+	assert(pool->count < UINT32_MAX - 1);
+
+	return pool->count++;
+}
+
+static void *
+pool_get(const pool_t *pool, uint32_t idx)
+{
+	return pool->blocks[idx >> POOL_SHIFT] +
+	       (size_t)(idx & POOL_MASK) * pool->esize;
+}
+
+static void
+pool_free(pool_t *pool)
+{
+	uint32_t i;
+
+	for (i = 0; i < (pool->count + POOL_MASK) >> POOL_SHIFT; ++i)
+		free(pool->blocks[i]);
+	free(pool->blocks);
+	pool->blocks = NULL;
+	pool->count = 0;
+}
+
+static void
+rhash_put(uint64_t *slots, uint64_t mask, uint64_t slot)
+{
+	uint64_t pos = RHASH_HASH(slot) & mask;
+
+	while (slots[pos])
+		pos = (pos + 1) & mask;
+	slots[pos] = slot;
+}
+
+/*
+ * Move up to n slots of the previous table.  Moved slots are left as
+ * RHASH_MOVED rather than empty so that probing the rest of the previous
+ * table still works.
+ */
+static void
+rhash_migrate(rhash_t *rh, uint64_t n)
+{
+	uint64_t slot;
+
+	while (rh->oslots && n--) {
+		if (rh->opos > rh->omask) {
+			free(rh->oslots);
+			rh->oslots = NULL;
+			break;
+		}
+		slot = rh->oslots[rh->opos];
+		if (slot) {
+			rhash_put(rh->slots, rh->mask, slot);
+			rh->oslots[rh->opos] = RHASH_MOVED;
+		}
+		++rh->opos;
+	}
+}
+
+static void
+rhash_insert(rhash_t *rh, uint32_t hv, uint32_t idx)
+{
+	if (rh->slots == NULL) {
+		rh->mask = RHASH_INIT - 1;
+		rh->slots = calloc(RHASH_INIT, sizeof(*rh->slots));
+		assert(rh->slots);
+	}
+	rhash_migrate(rh, RHASH_MIGRATE);
+
+	if ((rh->count + 1) * 4 > (rh->mask + 1) * 3) {
+		/* finish the previous growth first */
+		rhash_migrate(rh, rh->omask + 2);
+		assert(rh->oslots == NULL);
+		rh->oslots = rh->slots;
+		rh->omask = rh->mask;
+		rh->opos = 0;
+		rh->mask = rh->mask * 2 + 1;
+		rh->slots = calloc(rh->mask + 1, sizeof(*rh->slots));
+		assert(rh->slots);
+	}
+	rhash_put(rh->slots, rh->mask, RHASH_SLOT(hv, idx));
+	++rh->count;
+}
+
+/*
+ * Iterate indices whose hash is hv, the caller compares the entries.
+ * The table must not be modified while iterating.
+ */
+static void
+rhash_lookup(const rhash_t *rh, uint32_t hv, rhash_iter_t *it)
+{
+	it->rh = rh;
+	it->hv = hv;
+	it->old = 0;
+	it->pos = hv & rh->mask;
+}
+
+static int
+rhash_next(rhash_iter_t *it, uint32_t *idxp)
+{
+	const rhash_t *rh = it->rh;
+	uint64_t *slots;
+	uint64_t mask;
+	uint64_t slot;
+
+	for (;;) {
+		slots = it->old ? rh->oslots : rh->slots;
+		mask = it->old ? rh->omask : rh->mask;
+		slot = slots ? slots[it->pos] : 0;
+		if (slot == 0) {
+			if (it->old || rh->oslots == NULL)
+				return 0;
+			it->old = 1;
+			it->pos = it->hv & rh->omask;
+			continue;
+		}
+		it->pos = (it->pos + 1) & mask;
+		if (slot != RHASH_MOVED && RHASH_HASH(slot) == it->hv) {
+			*idxp = RHASH_INDEX(slot);
+			return 1;
+		}
+	}
+}
+
+static void
+rhash_free(rhash_t *rh)
+{
+	free(rh->slots);
+	free(rh->oslots);
+	bzero(rh, sizeof(*rh));
+}
+
+static void
+arena_init(arena_t *arena)
+{
+	arena->size = 65536;
+	arena->buf = malloc(arena->size);
+	assert(arena->buf);
+	arena->buf[0] = 0;
+	arena->len = 1;
+}
+
+static uint64_t
+arena_add(arena_t *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	uint64_t off = arena->len;
+
+	while (arena->len + len > arena->size) {
+		arena->size *= 2;
+		arena->buf = realloc(arena->buf, arena->size);
+		assert(arena->buf);
+	}
+	bcopy(str, arena->buf + off, len);
+	arena->len += len;
+
+	return off;
+}
+
+/*
+ * The returned string moves when the arena grows.
+ */
+static const char *
+arena_str(const arena_t *arena, uint64_t off)
+{
+	return arena->buf + off;
+}
+
+static void
+arena_free(arena_t *arena)
+{
+	free(arena->buf);
+	bzero(arena, sizeof(*arena));
+}
+
 /*
  * Recover the specified file.
  *
@@ -184,21 +594,12 @@ int
 cmd_recover(const char *devpath, const char *pathname,
 	    const char *destdir, int strict, int isafile)
 {
-	hammer2_media_data_t data;
-	hammer2_volume_t *vol;
-	hammer2_off_t loff;
-	hammer2_off_t poff;
 	size_t i;
 
 	StrictMode = strict;
 	hammer2_init_volumes(devpath, 1);
-	DirHash = calloc(HTABLE_SIZE, sizeof(dirent_entry_t *));
-	InodeHash = calloc(HTABLE_SIZE, sizeof(inode_entry_t *));
-	InodeHash2 = calloc(HTABLE_SIZE, sizeof(inode_entry_t *));
-	TopologyHash = calloc(HTABLE_SIZE, sizeof(topology_entry_t *));
-	NegativeHash = calloc(HTABLE_SIZE, sizeof(neg_entry_t *));
-	TopoBRefHash = calloc(HTABLE_SIZE, sizeof(topo_bref_entry_t *));
-	TopoInodeHash = calloc(HTABLE_SIZE, sizeof(topo_inode_entry_t *));
+	arena_init(&StrArena);
+	sdc_init(&SDCCache, MemOpt ? MemOpt : SDCDEFAULT);
 
 	/*
 	 * Media Pass
@@ -218,123 +619,7 @@ cmd_recover(const char *devpath, const char *pathname,
 	 * hits
 	 */
 	printf("MEDIA PASS\n");
-
-	loff = 0;
-	while ((vol = hammer2_get_volume(loff)) != NULL) {
-		int fd;
-		int xdisp;
-		hammer2_off_t vol_size;
-
-		fd = vol->fd;
-		poff = loff - vol->offset;
-		vol_size = lseek(fd, 0L, SEEK_END);
-		xdisp = 0;
-
-		while (poff < vol->size) {
-			if (pread(fd, &data, sizeof(data), poff) !=
-			    sizeof(data))
-			{
-				/* try to skip possible I/O error */
-				poff += sizeof(data);
-				continue;
-			}
-			for (i = 0; i < HAMMER2_IND_COUNT_MAX; ++i) {
-				hammer2_blockref_t *bref;
-				// char filename_buf[1024+1];
-
-				bref = &data.npdata[i];
-
-				/*
-				 * Found a possible inode
-				 */
-				switch(bref->type) {
-				case HAMMER2_BREF_TYPE_INODE:
-					/*
-					 * Note: preliminary bref filter
-					 * is inside enter_inode().
-					 */
-					enter_inode(bref);
-					break;
-				case HAMMER2_BREF_TYPE_DIRENT:
-					/*
-					 * Go overboard and try to index
-					 * anything that looks like a
-					 * directory entry.  This might find
-					 * entries whos inodes are no longer
-					 * available, but will also generate
-					 * a lot of false files.
-					 */
-#if 0
-					if (filename &&
-					    flen != bref->embed.dirent.namlen)
-					{
-						/* single-file shortcut */
-						break;
-					}
-					if (check_filename(bref, filename,
-						   filename_buf,
-						   bref->embed.dirent.namlen))
-					{
-						enter_dirent(bref,
-						    poff + vol->offset +
-						    (i *
-						    sizeof(hammer2_blockref_t)),
-						    filename_buf,
-						    bref->embed.dirent.namlen);
-					}
-#endif
-					break;
-				default:
-					break;
-				}
-			}
-
-			/*
-			 * Look for possible root inodes.  We generally can't
-			 * find these by finding BREFs pointing to them because
-			 * the BREFs often hang off the volume header.
-			 *
-			 * These "inodes" could be seriously corrupt, but if
-			 * the bref tree is intact that is what we need to
-			 * get top-level directory entries.
-			 */
-			for (i = 0; i < INODES_PER_BLOCK; ++i) {
-				hammer2_inode_data_t *ip;
-
-				ip = (void *)(data.buf + i * sizeof(*ip));
-				if (ip->meta.inum == 1 &&
-				    ip->meta.iparent == 0 &&
-				    ip->meta.type ==
-					HAMMER2_OBJTYPE_DIRECTORY &&
-				    ip->meta.op_flags & HAMMER2_OPFLAG_PFSROOT)
-				{
-					enter_inode_untested(ip,
-						poff + vol->offset +
-						(i * sizeof(*ip)));
-				}
-			}
-			poff += sizeof(data);
-
-			MediaBytes += sizeof(data);
-
-			/*
-			 * Update progress
-			 */
-			if (QuietOpt == 0 &&
-			    (++xdisp == DISPMODULO ||
-			     poff == vol->size - sizeof(data)))
-			{
-				xdisp = 0;
-				printf("%ld inodes scanned, "
-				       "media %6.2f/%-3.2fG\r",
-					InodeCount,
-					MediaBytes / 1e9,
-					vol_size / 1e9);
-				fflush(stdout);
-			}
-		}
-		loff = vol->offset + vol->size;
-	}
+	media_pass();
 
 	/*
 	 * Restoration Pass
@@ -381,67 +666,66 @@ cmd_recover(const char *devpath, const char *pathname,
 		{
 			inode_entry_t *iscan;
 
-			for (iscan = InodeHash[1];
+			for (iscan = find_first_inode(1);
 			     iscan;
-			     iscan = iscan->next)
+			     iscan = find_next_inode(iscan))
 			{
-				if (iscan->inum == 1)
-					++root_max;
+				++root_max;
 			}
 		}
 
 		/*
-		 * Run through all directory inodes to locate validated
-		 * directory entries.  If an absolute path was specified
-		 * we start at root inodes.
+		 * Run through all directory inodes, in the order they
+		 * were found on media, to locate validated directory
+		 * entries.  If an absolute path was specified we start
+		 * at root inodes.
 		 */
-		for (i = 0; i < HTABLE_SIZE; ++i) {
+		start_dump_threads();
+		for (i = 0; i < InodePool.count; ++i) {
 			inode_entry_t *iscan;
 
-			for (iscan = InodeHash[i];
-			     iscan;
-			     iscan = iscan->next)
-			{
-				/*
-				 * Absolute paths always start at root inodes,
-				 * otherwise we can start at any directory
-				 * inode.
-				 */
-				if (abspath && iscan->inum != 1)
-					continue;
-				if (iscan->type != HAMMER2_OBJTYPE_DIRECTORY)
-					continue;
+			iscan = pool_get(&InodePool, i);
 
-				/*
-				 * Progress down root inodes can be slow,
-				 * so print progress for each root inode.
-				 */
-				if (i == 1 && iscan->inum == 1 &&
-				    QuietOpt == 0)
-				{
-					printf("scan roots %p 0x%016jx "
-					       "(count %ld/%ld)\r",
-						iscan,
-						iscan->data_off,
-						++root_count, root_max);
-					fflush(stdout);
-				}
+			/*
+			 * Absolute paths always start at root inodes,
+			 * otherwise we can start at any directory
+			 * inode.
+			 */
+			if (abspath && iscan->inum != 1)
+				continue;
+			if (iscan->type != HAMMER2_OBJTYPE_DIRECTORY)
+				continue;
 
-				/*
-				 * Primary match/recover recursion
-				 */
-				dump_tree(iscan, destdir, pathname,
-					  1, 1, isafile);
+			/*
+			 * Progress down root inodes can be slow,
+			 * so print progress for each root inode.
+			 */
+			if (iscan->inum == 1 && QuietOpt == 0) {
+				printf("scan roots %p 0x%016jx "
+				       "(count %ld/%ld)\r",
+					iscan,
+					iscan->data_off,
+					++root_count, root_max);
+				fflush(stdout);
 			}
+
+			/*
+			 * Primary match/recover recursion
+			 */
+			dump_tree(iscan, destdir, pathname,
+				  1, 1, isafile);
+
 			if (QuietOpt == 0 &&
 			    (i & (DISPMODULO - 1)) == DISPMODULO - 1)
 			{
 				if (i == DISPMODULO - 1)
 					printf("\n");
-				printf("Progress %zd/%d\r", i, HTABLE_SIZE);
+				printf("Progress %zd/%u\r", i,
+				       InodePool.count);
 				fflush(stdout);
 			}
 		}
+		stop_dump_threads();
 		printf("\n");
 	}
 
@@ -450,60 +734,28 @@ cmd_recover(const char *devpath, const char *pathname,
 	       TopoBRefCount, TopoBRefDupCount);
 	printf("TopoInode stats: count=%ld dups=%ld\n",
 	       TopoInodeCount, TopoInodeDupCount);
+	printf("Cache stats: buffers=%d/%d hits=%ld misses=%ld\n",
+	       SDCCache.count, SDCCache.max,
+	       SDCCache.hits, SDCCache.misses);
 
 	/*
 	 * Cleanup
 	 */
 	hammer2_cleanup_volumes();
 
-	for (i = 0; i < HTABLE_SIZE; ++i) {
-		dirent_entry_t *dscan;
-		inode_entry_t *iscan;
-		topology_entry_t *top_scan;
-		neg_entry_t *negscan;
-		topo_bref_entry_t *topo_bref;
-		topo_inode_entry_t *topo_inode;
-
-		while ((dscan = DirHash[i]) != NULL) {
-			DirHash[i] = dscan->next;
-			free(dscan->filename);
-			free(dscan);
-		}
-
-		while ((iscan = InodeHash[i]) != NULL) {
-			InodeHash[i] = iscan->next;
-			free(iscan);
-		}
-		/* InodeHash2[] indexes the same structures */
-
-		while ((top_scan = TopologyHash[i]) != NULL) {
-			TopologyHash[i] = top_scan->next;
-			free(top_scan->path);
-			free(top_scan);
-		}
-
-		while ((negscan = NegativeHash[i]) != NULL) {
-			NegativeHash[i] = negscan->next;
-			free(negscan);
-		}
-
-		while ((topo_bref = TopoBRefHash[i]) != NULL) {
-			TopoBRefHash[i] = topo_bref->next;
-			free(topo_bref);
-		}
-
-		while ((topo_inode = TopoInodeHash[i]) != NULL) {
-			TopoInodeHash[i] = topo_inode->next;
-			free(topo_inode);
-		}
-	}
-	free(TopoInodeHash);
-	free(TopoBRefHash);
-	free(NegativeHash);
-	free(TopologyHash);
-	free(DirHash);
-	free(InodeHash);
-	free(InodeHash2);
+	pool_free(&InodePool);
+	pool_free(&TopologyPool);
+	pool_free(&NegativePool);
+	pool_free(&TopoBRefPool);
+	pool_free(&TopoInodePool);
+	rhash_free(&InodeHash);
+	rhash_free(&InodeHash2);
+	rhash_free(&TopologyHash);
+	rhash_free(&NegativeHash);
+	rhash_free(&TopoBRefHash);
+	rhash_free(&TopoInodeHash);
+	arena_free(&StrArena);
+	sdc_free(&SDCCache);
 
 	return 0;
 }
@@ -603,36 +855,6 @@ check_filename(hammer2_blockref_t *bref, const char *filename, char *buf,
 	return 0;
 }
 
-#if 0
-static void
-enter_dirent(hammer2_blockref_t *bref, hammer2_off_t loff,
-	     const char *filename, size_t flen)
-{
-	hammer2_key_t inum = bref->embed.dirent.inum;
-	dirent_entry_t *entry;
-	uint32_t hv = (inum ^ (inum >> 16)) & HTABLE_MASK;
-
-	for (entry = DirHash[hv]; entry; entry = entry->next) {
-		if (entry->inum == inum &&
-		    entry->len == flen &&
-		    bcmp(entry->filename, filename, flen) == 0)
-		{
-			return;
-		}
-	}
-	entry = malloc(sizeof(*entry));
-	bzero(entry, sizeof(*entry));
-	entry->inum = inum;
-	entry->next = DirHash[hv];
-	entry->filename = malloc(flen + 1);
-	entry->len = flen;
-	entry->bref_off = loff;
-	bcopy(filename, entry->filename, flen);
-	entry->filename[flen] = 0;
-	DirHash[hv] = entry;
-}
-#endif
-
 /*
  * Topology duplicate scan avoidance helpers.  We associate inodes and
  * indirect block data offsets, allowing us to avoid re-scanning any
@@ -649,23 +871,26 @@ static topology_entry_t *
 enter_topology(const char *path)
 {
 	topology_entry_t *topo;
+	rhash_iter_t it;
 	uint32_t hv = 0;
+	uint32_t idx;
 	size_t i;
 
 	for (i = 0; path[i]; ++i)
 		hv = (hv << 5) ^ path[i] ^ (hv >> 24);
-	hv = (hv ^ (hv >> 16)) & HTABLE_MASK;
-	for (topo = TopologyHash[hv]; topo; topo = topo->next) {
-		if (strcmp(path, topo->path) == 0)
+	hv = hash64(hv);
+	rhash_lookup(&TopologyHash, hv, &it);
+	while (rhash_next(&it, &idx)) {
+		topo = pool_get(&TopologyPool, idx);
+		if (strcmp(path, arena_str(&StrArena, topo->path)) == 0)
 			return topo;
 	}
-	topo = malloc(sizeof(*topo));
-	bzero(topo, sizeof(*topo));
+	idx = pool_alloc(&TopologyPool);
+	topo = pool_get(&TopologyPool, idx);
 
-	topo->next = TopologyHash[hv];
-	TopologyHash[hv] = topo;
-	topo->path = strdup(path);
+	topo->path = arena_add(&StrArena, path);
 	topo->iterator = 1;
+	rhash_insert(&TopologyHash, hv, idx);
 
 	return topo;
 }
@@ -677,10 +902,14 @@ enter_topology(const char *path)
 static int
 topology_check_duplicate_inode(topology_entry_t *topo, inode_entry_t *iscan)
 {
-	int hv = (((intptr_t)topo ^ (intptr_t)iscan) >> 6) & HTABLE_MASK;
+	uint32_t hv = hash64((uintptr_t)topo * HASH_PRIME ^ (uintptr_t)iscan);
 	topo_inode_entry_t *scan;
+	rhash_iter_t it;
+	uint32_t idx;
 
-	for (scan = TopoInodeHash[hv]; scan; scan = scan->next) {
+	rhash_lookup(&TopoInodeHash, hv, &it);
+	while (rhash_next(&it, &idx)) {
+		scan = pool_get(&TopoInodePool, idx);
 		if (scan->topo == topo &&
 		    scan->iscan == iscan)
 		{
@@ -688,12 +917,11 @@ topology_check_duplicate_inode(topology_entry_t *topo, inode_entry_t *iscan)
 			return 1;
 		}
 	}
-	scan = malloc(sizeof(*scan));
-	bzero(scan, sizeof(*scan));
+	idx = pool_alloc(&TopoInodePool);
+	scan = pool_get(&TopoInodePool, idx);
 	scan->iscan = iscan;
 	scan->topo = topo;
-	scan->next = TopoInodeHash[hv];
-	TopoInodeHash[hv] = scan;
+	rhash_insert(&TopoInodeHash, hv, idx);
 	++TopoInodeCount;
 
 	return 0;
@@ -707,10 +935,14 @@ static int
 topology_check_duplicate_indirect(topology_entry_t *topo,
 				  hammer2_blockref_t *bref)
 {
-	int hv = ((intptr_t)topo ^ (bref->data_off >> 8)) & HTABLE_MASK;
+	uint32_t hv = hash64((uintptr_t)topo * HASH_PRIME ^ bref->data_off);
 	topo_bref_entry_t *scan;
+	rhash_iter_t it;
+	uint32_t idx;
 
-	for (scan = TopoBRefHash[hv]; scan; scan = scan->next) {
+	rhash_lookup(&TopoBRefHash, hv, &it);
+	while (rhash_next(&it, &idx)) {
+		scan = pool_get(&TopoBRefPool, idx);
 		if (scan->topo == topo &&
 		    scan->data_off == bref->data_off)
 		{
@@ -718,12 +950,11 @@ topology_check_duplicate_indirect(topology_entry_t *topo,
 			return 1;
 		}
 	}
-	scan = malloc(sizeof(*scan));
-	bzero(scan, sizeof(*scan));
+	idx = pool_alloc(&TopoBRefPool);
+	scan = pool_get(&TopoBRefPool, idx);
 	scan->data_off = bref->data_off;
 	scan->topo = topo;
-	scan->next = TopoBRefHash[hv];
-	TopoBRefHash[hv] = scan;
+	rhash_insert(&TopoBRefHash, hv, idx);
 	++TopoBRefCount;
 
 	return 0;
@@ -733,108 +964,140 @@ topology_check_duplicate_indirect(topology_entry_t *topo,
  * Valid and record an inode found on media.  There can be many versions
  * of the same inode number present on the media.
  */
-static void
-enter_inode(hammer2_blockref_t *bref)
+/*
+ * Validate a possible inode bref found by the media pass.  Note that this
+ * might not be a real blockref.  Don't trust anything, really.
+ *
+ * Returns 0 if the bref is not a candidate at all, otherwise fills in
+ * cand for enter_inode().
+ */
+static int
+validate_inode(sdcset_t *sdc, const hammer2_blockref_t *bref,
+	       media_cand_t *cand)
 {
-	uint32_t hv;
-	uint32_t hv2;
-	inode_entry_t *scan;
 	hammer2_inode_data_t *inode;
 	size_t psize;
 
-	hv = (bref->key ^ (bref->key >> 16)) & HTABLE_MASK;
-	hv2 = (bref->key ^ (bref->key >> 16) ^ (bref->data_off >> 10)) &
-	      HTABLE_MASK;
-
-	/*
-	 * Ignore duplicate inodes, use the secondary inode hash table's
-	 * better spread to reduce cpu consumption (there can be many
-	 * copies of the same inode so the primary hash table can have
-	 * very long chains in it).
-	 */
-	for (scan = InodeHash2[hv2]; scan; scan = scan->next2) {
-		if (bref->key == scan->inum &&
-		    bref->data_off == scan->data_off)
-		{
-			return;
-		}
-	}
-
-	/*
-	 * Ignore brefs which we have already determined to be bad
-	 */
-	if (find_neg(bref))
-		return;
-
 	/*
-	 * Validate the potential blockref.  Note that this might not be a
-	 * real blockref.  Don't trust anything, really.
-	 *
 	 * - Must be sized for an inode block
 	 * - Must be properly aligned for an inode block
 	 * - Keyspace is 1 (keybits == 0), i.e. a single inode number
+	 *
+	 * A bref failing the keybits test could still match the negative
+	 * cache, so it is passed on to keep the statistics identical to
+	 * a serial scan.
 	 */
 	if ((1 << (bref->data_off & 0x1F)) != sizeof(*inode))
-		return;
+		return 0;
 	if ((bref->data_off & ~0x1FL & (sizeof(*inode) - 1)) != 0)
-		return;
-	if (bref->keybits != 0)
-		return;
+		return 0;
 	if (bref->key == 0)
-		return;
+		return 0;
+
+	cand->bref = *bref;
+	cand->kind = CAND_SKIP;
+	if (bref->keybits != 0)
+		return 1;
 
-	inode = hammer2_cache_read(bref->data_off, &psize);
+	inode = sdc_read(sdc, bref->data_off, &psize);
 
 	/*
-	 * Failure prior to I/O being performed.
+	 * Failure prior to I/O being performed.  Such a bref can't match
+	 * the negative cache either.
 	 */
 	if (psize == 0)
-		return;
+		return 0;
 
 	/*
 	 * Any failures which occur after the I/O has been performed
 	 * should enter the bref in the negative cache to avoid unnecessary
 	 * guaranteed-to-fil reissuances of the same (bref, data_off) combo.
 	 */
-	if (inode == NULL) {
-fail:
-		enter_neg(bref);
-		return;
-	}
+	cand->kind = CAND_NEG;
+	if (inode == NULL)
+		return 1;
 
 	/*
 	 * The blockref looks ok but the real test is whether the
 	 * inode data it references passes the CRC check.  If it
 	 * does, it is highly likely that we have a valid inode.
 	 */
-	if (validate_crc(bref, inode, sizeof(*inode)) == 0)
-		goto fail;
+	if (validate_crc(&cand->bref, inode, sizeof(*inode)) == 0)
+		return 1;
 	if (inode->meta.inum != bref->key)
-		goto fail;
-
-	/*
-	 * Record the inode.  For now we do not record the actual content
-	 * of the inode because if there are more than few million of them
-	 * the memory consumption can get into the dozens of gigabytes.
-	 *
-	 * Instead, the inode will be re-read from media in the recovery
-	 * pass.
-	 */
-	scan = malloc(sizeof(*scan));
-	bzero(scan, sizeof(*scan));
-
-	scan->inum = bref->key;
-	scan->type = inode->meta.type;
-	scan->data_off = bref->data_off;
-	scan->inode_crc = hammer2_icrc32(inode, sizeof(*inode));
-	//scan->inode = *inode;		/* removed, too expensive */
+		return 1;
 
-	scan->next = InodeHash[hv];
-	InodeHash[hv] = scan;
-	scan->next2 = InodeHash2[hv2];
-	InodeHash2[hv2] = scan;
+	cand->kind = CAND_INODE;
+	cand->type = inode->meta.type;
+	cand->inode_crc = hammer2_icrc32(inode, sizeof(*inode));
 
-	++InodeCount;
+	return 1;
+}
+
+static void
+enter_inode(const media_cand_t *cand)
+{
+	const hammer2_blockref_t *bref = &cand->bref;
+	uint32_t hv;
+	uint32_t hv2;
+	uint32_t idx;
+	inode_entry_t *scan;
+	rhash_iter_t it;
+
+	hv = hash64(bref->key);
+	hv2 = hash64(bref->key * HASH_PRIME ^ bref->data_off);
+
+	/*
+	 * Ignore duplicate inodes, use the secondary inode hash table's
+	 * better spread to reduce cpu consumption (there can be many
+	 * copies of the same inode so the primary hash table can have
+	 * very long chains in it).
+	 */
+	rhash_lookup(&InodeHash2, hv2, &it);
+	while (rhash_next(&it, &idx)) {
+		scan = pool_get(&InodePool, idx);
+		if (bref->key == scan->inum &&
+		    bref->data_off == scan->data_off)
+		{
+			return;
+		}
+	}
+
+	/*
+	 * Ignore brefs which we have already determined to be bad
+	 */
+	if (find_neg(bref))
+		return;
+
+	switch (cand->kind) {
+	case CAND_SKIP:
+		return;
+	case CAND_NEG:
+		enter_neg(bref);
+		return;
+	}
+
+	/*
+	 * Record the inode.  For now we do not record the actual content
+	 * of the inode because if there are more than few million of them
+	 * the memory consumption can get into the dozens of gigabytes.
+	 *
+	 * Instead, the inode will be re-read from media in the recovery
+	 * pass.
+	 */
+	idx = pool_alloc(&InodePool);
+	scan = pool_get(&InodePool, idx);
+
+	scan->inum = bref->key;
+	scan->type = cand->type;
+	scan->data_off = bref->data_off;
+	scan->inode_crc = cand->inode_crc;
+	//scan->inode = *inode;		/* removed, too expensive */
+
+	link_inode(scan, idx, hv);
+	rhash_insert(&InodeHash2, hv2, idx);
+
+	++InodeCount;
 }
 
 /*
@@ -845,18 +1108,23 @@ fail:
  * these inodes as part of our path searches.
  */
 static void
-enter_inode_untested(hammer2_inode_data_t *ip, hammer2_off_t loff)
+enter_inode_untested(const media_cand_t *cand)
 {
+	hammer2_key_t inum = cand->bref.key;
+	hammer2_off_t loff = cand->bref.data_off;
 	uint32_t hv;
 	uint32_t hv2;
+	uint32_t idx;
 	inode_entry_t *scan;
+	rhash_iter_t it;
 
-	hv = (ip->meta.inum ^ (ip->meta.inum >> 16)) & HTABLE_MASK;
-	hv2 = (ip->meta.inum ^ (ip->meta.inum >> 16) ^ (loff >> 10)) &
-	      HTABLE_MASK;
+	hv = hash64(inum);
+	hv2 = hash64(inum * HASH_PRIME ^ loff);
 
-	for (scan = InodeHash2[hv2]; scan; scan = scan->next2) {
-		if (ip->meta.inum == scan->inum &&
+	rhash_lookup(&InodeHash2, hv2, &it);
+	while (rhash_next(&it, &idx)) {
+		scan = pool_get(&InodePool, idx);
+		if (inum == scan->inum &&
 		    loff == scan->data_off)
 		{
 			return;
@@ -871,36 +1139,441 @@ enter_inode_untested(hammer2_inode_data_t *ip, hammer2_off_t loff)
 	 * Instead, the inode will be re-read from media in the recovery
 	 * pass.
 	 */
-	scan = malloc(sizeof(*scan));
-	bzero(scan, sizeof(*scan));
+	idx = pool_alloc(&InodePool);
+	scan = pool_get(&InodePool, idx);
 
-	scan->inum = ip->meta.inum;
-	scan->type = ip->meta.type;
+	scan->inum = inum;
+	scan->type = cand->type;
 	scan->data_off = loff;
-	scan->inode_crc = hammer2_icrc32(ip, sizeof(*ip));
+	scan->inode_crc = cand->inode_crc;
 	//scan->inode = *ip;		/* removed, too expensive */
 
-	scan->next = InodeHash[hv];
-	InodeHash[hv] = scan;
-	scan->next2 = InodeHash2[hv2];
-	InodeHash2[hv2] = scan;
+	link_inode(scan, idx, hv);
+	rhash_insert(&InodeHash2, hv2, idx);
 
 	++InodeCount;
 }
 
+static media_cand_t *
+alloc_media_cand(media_chunk_t *chunk)
+{
+	if (chunk->count == chunk->alloc) {
+		chunk->alloc = chunk->alloc ? chunk->alloc * 2 : 256;
+		chunk->cands = realloc(chunk->cands,
+				       chunk->alloc * sizeof(*chunk->cands));
+		assert(chunk->cands);
+	}
+	return &chunk->cands[chunk->count];
+}
+
+/*
+ * Copies of an inode bref are usually found many times over, so remember
+ * recent validation results.  The same fields as find_neg() are compared.
+ */
+static void
+validate_inode_memo(media_thread_t *mt, const hammer2_blockref_t *bref,
+		    media_chunk_t *chunk)
+{
+	media_memo_t *memo;
+	media_cand_t *cand;
+	uint32_t hv;
+
+	hv = (bref->data_off >> 10 ^ bref->key) & (MEDIA_MEMO - 1);
+	memo = &mt->memo[hv];
+	cand = alloc_media_cand(chunk);
+
+	if (memo->kind &&
+	    bref->data_off == memo->bref.data_off &&
+	    bref->type == memo->bref.type &&
+	    bref->methods == memo->bref.methods &&
+	    bref->key == memo->bref.key &&
+	    bref->keybits == memo->bref.keybits &&
+	    bcmp(&bref->check, &memo->bref.check, sizeof(bref->check)) == 0)
+	{
+		cand->bref = *bref;
+		cand->kind = memo->kind;
+		cand->type = memo->type;
+		cand->inode_crc = memo->inode_crc;
+		++chunk->count;
+		return;
+	}
+	if (validate_inode(mt->sdc, bref, cand) == 0)
+		return;
+	memo->bref = *bref;
+	memo->kind = cand->kind;
+	memo->type = cand->type;
+	memo->inode_crc = cand->inode_crc;
+	++chunk->count;
+}
+
+static void
+scan_media_block(media_thread_t *mt, media_chunk_t *chunk,
+		 hammer2_media_data_t *data, hammer2_off_t loff)
+{
+	media_cand_t *cand;
+	size_t i;
+
+	for (i = 0; i < HAMMER2_IND_COUNT_MAX; ++i) {
+		hammer2_blockref_t *bref;
+
+		bref = &data->npdata[i];
+
+		/*
+		 * Found a possible inode.  Anything that looks like a
+		 * directory entry is not indexed, as that would generate
+		 * a lot of false files.
+		 */
+		if (bref->type == HAMMER2_BREF_TYPE_INODE)
+			validate_inode_memo(mt, bref, chunk);
+	}
+
+	/*
+	 * Look for possible root inodes.  We generally can't
+	 * find these by finding BREFs pointing to them because
+	 * the BREFs often hang off the volume header.
+	 *
+	 * These "inodes" could be seriously corrupt, but if
+	 * the bref tree is intact that is what we need to
+	 * get top-level directory entries.
+	 */
+	for (i = 0; i < INODES_PER_BLOCK; ++i) {
+		hammer2_inode_data_t *ip;
+
+		ip = (void *)(data->buf + i * sizeof(*ip));
+		if (ip->meta.inum == 1 &&
+		    ip->meta.iparent == 0 &&
+		    ip->meta.type == HAMMER2_OBJTYPE_DIRECTORY &&
+		    ip->meta.op_flags & HAMMER2_OPFLAG_PFSROOT)
+		{
+			cand = alloc_media_cand(chunk);
+			bzero(cand, sizeof(*cand));
+			cand->kind = CAND_ROOT;
+			cand->bref.key = ip->meta.inum;
+			cand->bref.data_off = (loff + i * sizeof(*ip)) |
+					      10;	/* 1KB inode radix */
+			cand->type = ip->meta.type;
+			cand->inode_crc = hammer2_icrc32(ip, sizeof(*ip));
+			++chunk->count;
+		}
+	}
+}
+
+/*
+ * Scan a chunk with large reads, falling back to hammer2 block sized
+ * reads to skip possible I/O errors.
+ */
+static void
+scan_media_chunk(media_thread_t *mt, media_chunk_t *chunk)
+{
+	hammer2_volume_t *vol = chunk->vol;
+	hammer2_off_t poff, pend;
+	ssize_t n;
+	size_t bsize = sizeof(hammer2_media_data_t);
+	size_t i;
+
+	chunk->count = 0;
+	chunk->bytes = 0;
+	pend = chunk->poff + chunk->size;
+
+	for (poff = chunk->poff; poff < pend; poff += MEDIA_IOSIZE) {
+		size_t len = MEDIA_IOSIZE;
+
+		if (len > pend - poff)
+			len = pend - poff;
+		n = pread(vol->fd, mt->buf, len, poff);
+		if (n != (ssize_t)len) {
+			n = 0;
+			for (i = 0; i < len; i += bsize) {
+				if (pread(vol->fd, mt->buf + i, bsize,
+					  poff + i) != (ssize_t)bsize)
+				{
+					continue;
+				}
+				scan_media_block(mt, chunk,
+				    (void *)(mt->buf + i),
+				    poff + i + vol->offset);
+				chunk->bytes += bsize;
+			}
+			continue;
+		}
+		for (i = 0; i + bsize <= len; i += bsize) {
+			scan_media_block(mt, chunk, (void *)(mt->buf + i),
+					 poff + i + vol->offset);
+			chunk->bytes += bsize;
+		}
+	}
+}
+
+static void
+merge_media_chunk(media_chunk_t *chunk)
+{
+	int i;
+
+	for (i = 0; i < chunk->count; ++i) {
+		if (chunk->cands[i].kind == CAND_ROOT)
+			enter_inode_untested(&chunk->cands[i]);
+		else
+			enter_inode(&chunk->cands[i]);
+	}
+	MediaBytes += chunk->bytes;
+}
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	media_chunk_t	*chunks;	/* ring of in-flight chunks */
+	int		nchunks;
+	long		next;		/* next chunk to scan */
+	long		merged;		/* chunks merged so far */
+	long		total;
+} MediaScan = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Map a chunk index to its volume and physical range.  Chunks don't
+ * straddle volumes.
+ */
+static void
+locate_media_chunk(long idx, media_chunk_t *chunk)
+{
+	hammer2_volume_t *vol;
+	hammer2_off_t loff = 0;
+	long n;
+
+	while ((vol = hammer2_get_volume(loff)) != NULL) {
+		n = (vol->size + MEDIA_CHUNK - 1) / MEDIA_CHUNK;
+		if (idx < n) {
+			chunk->vol = vol;
+			chunk->poff = (hammer2_off_t)idx * MEDIA_CHUNK;
+			chunk->size = vol->size - chunk->poff;
+			if (chunk->size > MEDIA_CHUNK)
+				chunk->size = MEDIA_CHUNK;
+			return;
+		}
+		idx -= n;
+		loff = vol->offset + vol->size;
+	}
+	assert(0);
+}
+
+static void
+init_media_thread(media_thread_t *mt)
+{
+	mt->sdc = calloc(1, sizeof(*mt->sdc));
+	mt->buf = malloc(MEDIA_IOSIZE);
+	mt->memo = calloc(MEDIA_MEMO, sizeof(*mt->memo));
+	assert(mt->sdc && mt->buf && mt->memo);
+	sdc_init(mt->sdc, SDCCOUNT * HAMMER2_PBUFSIZE);
+}
+
+static void
+cleanup_media_thread(media_thread_t *mt)
+{
+	sdc_free(mt->sdc);
+	free(mt->sdc);
+	free(mt->buf);
+	free(mt->memo);
+}
+
+static void *
+media_thread(void *arg)
+{
+	media_thread_t *mt = arg;
+	media_chunk_t *chunk;
+	long idx;
+
+	pthread_mutex_lock(&MediaScan.lock);
+	for (;;) {
+		/* stay within the ring of chunks not yet merged */
+		while (MediaScan.next < MediaScan.total &&
+		       MediaScan.next >= MediaScan.merged + MediaScan.nchunks)
+			pthread_cond_wait(&MediaScan.cond, &MediaScan.lock);
+		if (MediaScan.next >= MediaScan.total)
+			break;
+		idx = MediaScan.next++;
+		chunk = &MediaScan.chunks[idx % MediaScan.nchunks];
+		pthread_mutex_unlock(&MediaScan.lock);
+
+		locate_media_chunk(idx, chunk);
+		scan_media_chunk(mt, chunk);
+
+		pthread_mutex_lock(&MediaScan.lock);
+		chunk->done = 1;
+		pthread_cond_broadcast(&MediaScan.cond);
+	}
+	pthread_mutex_unlock(&MediaScan.lock);
+
+	return NULL;
+}
+
+/*
+ * Media Pass
+ *
+ * Look for blockrefs that point to inodes.  The blockrefs could
+ * be bogus since we aren't validating them, but the combination
+ * of a CRC that matches the inode content is fairly robust in
+ * finding actual inodes.
+ *
+ * We also enter unvalidated inodes for inode #1 (PFS roots),
+ * because there might not be any blockrefs pointing to some of
+ * them.  We need these to be able to locate directory entries
+ * under the roots.
+ *
+ * At the moment we do not try to enter unvalidated directory
+ * entries, since this will result in a massive number of false
+ * hits
+ *
+ * With NThreadsOpt > 1 chunks are scanned concurrently, but merged in
+ * media order, so the result is the same as with a single thread.
+ */
+static void
+media_pass(void)
+{
+	hammer2_volume_t *vol;
+	hammer2_off_t loff;
+	hammer2_off_t total_size = 0;
+	media_thread_t *threads = NULL;
+	media_thread_t self;
+	media_chunk_t *chunk;
+	struct timespec ts1, ts2;
+	double elapsed;
+	int nthreads = NThreadsOpt;
+	int i;
+	long idx;
+
+	loff = 0;
+	while ((vol = hammer2_get_volume(loff)) != NULL) {
+		MediaScan.total += (vol->size + MEDIA_CHUNK - 1) / MEDIA_CHUNK;
+		total_size += vol->size;
+		loff = vol->offset + vol->size;
+	}
+	MediaScan.nchunks = nthreads > 1 ? nthreads * 4 : 1;
+	MediaScan.chunks = calloc(MediaScan.nchunks,
+				  sizeof(*MediaScan.chunks));
+	assert(MediaScan.chunks);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	if (nthreads > 1) {
+		threads = calloc(nthreads, sizeof(*threads));
+		assert(threads);
+		for (i = 0; i < nthreads; ++i) {
+			init_media_thread(&threads[i]);
+			if (pthread_create(&threads[i].td, NULL,
+					   media_thread, &threads[i]) != 0)
+			{
+				fprintf(stderr, "pthread_create failed\n");
+				exit(1);
+			}
+		}
+	} else {
+		init_media_thread(&self);
+	}
+
+	for (idx = 0; idx < MediaScan.total; ++idx) {
+		chunk = &MediaScan.chunks[idx % MediaScan.nchunks];
+		if (threads) {
+			pthread_mutex_lock(&MediaScan.lock);
+			while (chunk->done == 0)
+				pthread_cond_wait(&MediaScan.cond,
+						  &MediaScan.lock);
+			pthread_mutex_unlock(&MediaScan.lock);
+		} else {
+			locate_media_chunk(idx, chunk);
+			scan_media_chunk(&self, chunk);
+		}
+		merge_media_chunk(chunk);
+		if (threads) {
+			pthread_mutex_lock(&MediaScan.lock);
+			chunk->done = 0;
+			++MediaScan.merged;
+			pthread_cond_broadcast(&MediaScan.cond);
+			pthread_mutex_unlock(&MediaScan.lock);
+		}
+
+		/*
+		 * Update progress
+		 */
+		if (QuietOpt == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &ts2);
+			elapsed = (ts2.tv_sec - ts1.tv_sec) +
+				  (ts2.tv_nsec - ts1.tv_nsec) * 1e-9;
+			printf("%ld inodes scanned, "
+			       "media %6.2f/%-3.2fG %6.1fMB/s\r",
+				InodeCount,
+				MediaBytes / 1e9,
+				total_size / 1e9,
+				elapsed > 0 ? MediaBytes / 1e6 / elapsed : 0);
+			fflush(stdout);
+		}
+	}
+
+	if (threads) {
+		for (i = 0; i < nthreads; ++i) {
+			pthread_join(threads[i].td, NULL);
+			cleanup_media_thread(&threads[i]);
+		}
+		free(threads);
+	} else {
+		cleanup_media_thread(&self);
+	}
+	for (i = 0; i < MediaScan.nchunks; ++i)
+		free(MediaScan.chunks[i].cands);
+	free(MediaScan.chunks);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	elapsed = (ts2.tv_sec - ts1.tv_sec) +
+		  (ts2.tv_nsec - ts1.tv_nsec) * 1e-9;
+	printf("\nMedia %6.2fG in %.1f sec", MediaBytes / 1e9, elapsed);
+	if (elapsed > 0)
+		printf(" (%.1fMB/s)", MediaBytes / 1e6 / elapsed);
+	printf(", %d thread%s", nthreads, nthreads > 1 ? "s" : "");
+}
+
+/*
+ * InodeHash only indexes the first inode found for each inode number,
+ * copies are chained to it.  There can be a huge number of copies of
+ * the same inode, which would otherwise all probe the same run of slots.
+ */
+static void
+link_inode(inode_entry_t *scan, uint32_t idx, uint32_t hv)
+{
+	inode_entry_t *head;
+
+	head = find_first_inode(scan->inum);
+	if (head) {
+		scan->next = head->next;
+		head->next = idx + 1;
+	} else {
+		rhash_insert(&InodeHash, hv, idx);
+	}
+}
+
 static inode_entry_t *
 find_first_inode(hammer2_key_t inum)
 {
 	inode_entry_t *entry;
-	uint32_t hv = (inum ^ (inum >> 16)) & HTABLE_MASK;
+	rhash_iter_t it;
+	uint32_t idx;
 
-	for (entry = InodeHash[hv]; entry; entry = entry->next) {
+	rhash_lookup(&InodeHash, hash64(inum), &it);
+	while (rhash_next(&it, &idx)) {
+		entry = pool_get(&InodePool, idx);
 		if (entry->inum == inum)
 			return entry;
 	}
 	return NULL;
 }
 
+static inode_entry_t *
+find_next_inode(inode_entry_t *iscan)
+{
+	if (iscan->next == 0)
+		return NULL;
+	return pool_get(&InodePool, iscan->next - 1);
+}
+
 /*
  * Negative bref cache.  A cache of brefs that we have determined
  * to be invalid.  Used to reduce unnecessary disk I/O.
@@ -912,18 +1585,21 @@ find_first_inode(hammer2_key_t inum)
  *	 Adding a few more match fields in addition won't hurt either.
  */
 static int
-find_neg(hammer2_blockref_t *bref)
+find_neg(const hammer2_blockref_t *bref)
 {
-	int hv = (bref->data_off >> 10) & HTABLE_MASK;
+	uint32_t hv = hash64(bref->data_off);
 	neg_entry_t *neg;
-
-	for (neg = NegativeHash[hv]; neg; neg = neg->next) {
-		if (bref->data_off == neg->bref.data_off &&
-		    bref->type == neg->bref.type &&
-		    bref->methods == neg->bref.methods &&
-		    bref->key == neg->bref.key &&
-		    bcmp(&bref->check, &neg->bref.check,
-			 sizeof(bref->check)) == 0)
+	rhash_iter_t it;
+	uint32_t idx;
+
+	rhash_lookup(&NegativeHash, hv, &it);
+	while (rhash_next(&it, &idx)) {
+		neg = pool_get(&NegativePool, idx);
+		if (bref->data_off == neg->data_off &&
+		    bref->type == neg->type &&
+		    bref->methods == neg->methods &&
+		    bref->key == neg->key &&
+		    bcmp(&bref->check, neg->check, BREF_CHECK_SIZE) == 0)
 		{
 			++NegativeHits;
 			return 1;
@@ -933,16 +1609,20 @@ find_neg(hammer2_blockref_t *bref)
 }
 
 static void
-enter_neg(hammer2_blockref_t *bref)
+enter_neg(const hammer2_blockref_t *bref)
 {
-	int hv = (bref->data_off >> 10) & HTABLE_MASK;
+	uint32_t hv = hash64(bref->data_off);
 	neg_entry_t *neg;
-
-	neg = malloc(sizeof(*neg));
-	bzero(neg, sizeof(*neg));
-	neg->next = NegativeHash[hv];
-	neg->bref = *bref;
-	NegativeHash[hv] = neg;
+	uint32_t idx;
+
+	idx = pool_alloc(&NegativePool);
+	neg = pool_get(&NegativePool, idx);
+	neg->data_off = bref->data_off;
+	neg->key = bref->key;
+	neg->type = bref->type;
+	neg->methods = bref->methods;
+	bcopy(&bref->check, neg->check, BREF_CHECK_SIZE);
+	rhash_insert(&NegativeHash, hv, idx);
 	++NegativeCount;
 }
 
@@ -968,15 +1648,14 @@ dump_tree(inode_entry_t *iscan, const char *dest, const char *remain,
 	 * it, the content may have changed if scanning live media, so
 	 * check against a simple crc we recorded earlier.
 	 */
-	inode = hammer2_cache_read(iscan->data_off, &psize);
+	inode = hammer2_cache_read(iscan->data_off, &inode_copy,
+				   sizeof(inode_copy), &psize);
 	if (psize == 0)
 		return;
 	if (inode == NULL || psize != sizeof(*inode))
 		return;
 	if (iscan->inode_crc != hammer2_icrc32(inode, sizeof(*inode)))
 		return;
-	inode_copy = *inode;
-	inode = &inode_copy;
 
 	/*
 	 * Try to limit potential infinite loops
@@ -1042,27 +1721,22 @@ dump_tree(inode_entry_t *iscan, const char *dest, const char *remain,
 				    isafile);
 
 		/*
-		 * Final adjustment to directory inode
+		 * Final adjustment to directory inode, deferred until
+		 * files still being written under it are done.
 		 */
 		if (depth != 1) {
-			struct timeval tvs[2];
-			uuid_t uid, gid;
-
-			tvs[0].tv_sec = inode->meta.atime / 1000000;
-			tvs[0].tv_usec = inode->meta.atime % 1000000;
-			tvs[1].tv_sec = inode->meta.mtime / 1000000;
-			tvs[1].tv_usec = inode->meta.mtime % 1000000;
-
-			if (/*XXX l*/utimes(dest, tvs) < 0)
-				perror("futimes");
-			uid = inode->meta.uid;
-			gid = inode->meta.gid;
-			lchown(dest,
-			       hammer2_to_unix_xid(&uid),
-			       hammer2_to_unix_xid(&gid));
-
-			/*XXX l*/chmod(dest, inode->meta.mode);
-			/*XXX l*/chflags(dest, inode->meta.uflags);
+			dump_job_t *job;
+
+			if (DumpPool.nthreads) {
+				job = calloc(1, sizeof(*job));
+				assert(job);
+				job->inode = *inode;
+				job->path = strdup(dest);
+				job->done = 1;
+				dispatch_job(job);
+			} else {
+				set_dir_attrs(dest, inode);
+			}
 		}
 		break;
 	case HAMMER2_OBJTYPE_REGFILE:
@@ -1111,11 +1785,15 @@ dump_tree(inode_entry_t *iscan, const char *dest, const char *remain,
  *
  * If the data block recursion fails the file will be renamed
  * .corrupted.
+ *
+ * The file is created here, but with dump threads running its content
+ * is written out by write_inum_file() on a worker.
  */
 static int
 dump_inum_file(inode_entry_t *iscan, hammer2_inode_data_t *inode,
 	       const char *path1)
 {
+	dump_job_t *job;
 	char *path2;
 	int wfd;
 	int res;
@@ -1125,13 +1803,16 @@ dump_inum_file(inode_entry_t *iscan, hammer2_inode_data_t *inode,
 	 * hardlink it instead of regenerating the same file again.
 	 */
 	if (iscan->link_file_path) {
-		if (link(iscan->link_file_path, path1) == 0)
+		const char *link_path;
+
+		link_path = arena_str(&StrArena, iscan->link_file_path);
+		if (link(link_path, path1) == 0)
 			return 1;
-		chflags(iscan->link_file_path, 0);
-		chmod(iscan->link_file_path, 0600);
-		if (link(iscan->link_file_path, path1) == 0) {
-			chmod(iscan->link_file_path, inode->meta.mode);
-			chflags(iscan->link_file_path, inode->meta.uflags);
+		chflags(link_path, 0);
+		chmod(link_path, 0600);
+		if (link(link_path, path1) == 0) {
+			chmod(link_path, inode->meta.mode);
+			chflags(link_path, inode->meta.uflags);
 			return 1;
 		}
 	}
@@ -1143,6 +1824,40 @@ dump_inum_file(inode_entry_t *iscan, hammer2_inode_data_t *inode,
 	chflags(path1, 0);
 	chmod(path1, 0600);
 	wfd = open(path1, O_RDWR|O_CREAT|O_TRUNC, 0600);
+	iscan->link_file_path = arena_add(&StrArena, path1);
+
+	if (DumpPool.nthreads) {
+		job = calloc(1, sizeof(*job));
+		assert(job);
+		job->iscan = iscan;
+		job->inode = *inode;
+		job->path = strdup(path1);
+		job->wfd = wfd;
+		dispatch_job(job);
+		return 1;
+	}
+
+	res = write_inum_file(&DumpBatch, wfd, inode, path1);
+	if (res == 0) {
+		asprintf(&path2, "%s.corrupted", path1);
+		iscan->link_file_path = arena_add(&StrArena, path2);
+		free(path2);
+	}
+
+	return res;
+}
+
+/*
+ * Write out the content and attributes of a file created by
+ * dump_inum_file() and close it.  Called from dump threads, so this
+ * must not touch the hash tables or StrArena.
+ */
+static int
+write_inum_file(dump_batch_t *batch, int wfd, hammer2_inode_data_t *inode,
+		const char *path1)
+{
+	char *path2;
+	int res;
 
 	if (inode->meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA) {
 		/*
@@ -1158,7 +1873,7 @@ dump_inum_file(inode_entry_t *iscan, hammer2_inode_data_t *inode,
 		/*
 		 * file content, indirect blockrefs
 		 */
-		res = dump_file_data(wfd, inode->meta.size,
+		res = dump_file_data(batch, wfd, inode->meta.size,
 				     &inode->u.blockset.blockref[0],
 				     HAMMER2_SET_COUNT);
 	}
@@ -1187,7 +1902,6 @@ dump_inum_file(inode_entry_t *iscan, hammer2_inode_data_t *inode,
 
 		fchmod(wfd, inode->meta.mode);
 		fchflags(wfd, inode->meta.uflags);
-		iscan->link_file_path = strdup(path1);
 	} else {
 		struct timeval tvs[2];
 		uuid_t uid, gid;
@@ -1208,7 +1922,7 @@ dump_inum_file(inode_entry_t *iscan, hammer2_inode_data_t *inode,
 
 		asprintf(&path2, "%s.corrupted", path1);
 		rename(path1, path2);
-		iscan->link_file_path = path2;
+		free(path2);
 	}
 
 	/*
@@ -1219,6 +1933,198 @@ dump_inum_file(inode_entry_t *iscan, hammer2_inode_data_t *inode,
 	return res;
 }
 
+/*
+ * Final adjustment to a directory inode
+ */
+static void
+set_dir_attrs(const char *path, hammer2_inode_data_t *inode)
+{
+	struct timeval tvs[2];
+	uuid_t uid, gid;
+
+	tvs[0].tv_sec = inode->meta.atime / 1000000;
+	tvs[0].tv_usec = inode->meta.atime % 1000000;
+	tvs[1].tv_sec = inode->meta.mtime / 1000000;
+	tvs[1].tv_usec = inode->meta.mtime % 1000000;
+
+	if (/*XXX l*/utimes(path, tvs) < 0)
+		perror("futimes");
+	uid = inode->meta.uid;
+	gid = inode->meta.gid;
+	lchown(path,
+	       hammer2_to_unix_xid(&uid),
+	       hammer2_to_unix_xid(&gid));
+
+	/*XXX l*/chmod(path, inode->meta.mode);
+	/*XXX l*/chflags(path, inode->meta.uflags);
+}
+
+static void
+init_dump_batch(dump_batch_t *batch)
+{
+	batch->brefs = malloc(DUMP_BATCH * sizeof(*batch->brefs));
+	batch->ibuf = malloc(HAMMER2_PBUFSIZE);
+	batch->obuf = malloc(HAMMER2_PBUFSIZE);
+	assert(batch->brefs && batch->ibuf && batch->obuf);
+	batch->count = 0;
+}
+
+static void
+free_dump_batch(dump_batch_t *batch)
+{
+	free(batch->brefs);
+	free(batch->ibuf);
+	free(batch->obuf);
+	bzero(batch, sizeof(*batch));
+}
+
+static void *
+dump_thread(void *arg __unused)
+{
+	dump_batch_t batch;
+	dump_job_t *job;
+	int res;
+
+	init_dump_batch(&batch);
+
+	pthread_mutex_lock(&DumpPool.lock);
+	for (;;) {
+		while (DumpPool.qhead == NULL && DumpPool.stopping == 0)
+			pthread_cond_wait(&DumpPool.cond, &DumpPool.lock);
+		if ((job = DumpPool.qhead) == NULL)
+			break;
+		DumpPool.qhead = job->qnext;
+		if (DumpPool.qhead == NULL)
+			DumpPool.qtailp = &DumpPool.qhead;
+		pthread_mutex_unlock(&DumpPool.lock);
+
+		res = write_inum_file(&batch, job->wfd, &job->inode,
+				      job->path);
+
+		pthread_mutex_lock(&DumpPool.lock);
+		job->res = res;
+		job->done = 1;
+		pthread_cond_broadcast(&DumpPool.done_cond);
+	}
+	pthread_mutex_unlock(&DumpPool.lock);
+
+	free_dump_batch(&batch);
+
+	return NULL;
+}
+
+static void
+start_dump_threads(void)
+{
+	pthread_attr_t attr;
+	int i;
+
+	init_dump_batch(&DumpBatch);
+	if (NThreadsOpt <= 1)
+		return;
+
+	DumpPool.tailp = &DumpPool.head;
+	DumpPool.qtailp = &DumpPool.qhead;
+	DumpPool.threads = calloc(NThreadsOpt, sizeof(*DumpPool.threads));
+	assert(DumpPool.threads);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, DUMP_STACK);
+	for (i = 0; i < NThreadsOpt; ++i) {
+		if (pthread_create(&DumpPool.threads[i], &attr,
+				   dump_thread, NULL) != 0)
+		{
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+	pthread_attr_destroy(&attr);
+	DumpPool.nthreads = NThreadsOpt;
+}
+
+static void
+stop_dump_threads(void)
+{
+	int i;
+
+	if (DumpPool.nthreads) {
+		retire_jobs(0);
+		pthread_mutex_lock(&DumpPool.lock);
+		DumpPool.stopping = 1;
+		pthread_cond_broadcast(&DumpPool.cond);
+		pthread_mutex_unlock(&DumpPool.lock);
+		for (i = 0; i < DumpPool.nthreads; ++i)
+			pthread_join(DumpPool.threads[i], NULL);
+		free(DumpPool.threads);
+		DumpPool.threads = NULL;
+		DumpPool.nthreads = 0;
+	}
+	free_dump_batch(&DumpBatch);
+}
+
+/*
+ * Queue a file for a dump thread, or directory attributes which are
+ * already done.  Either way the job is retired in dispatch order.
+ */
+static void
+dispatch_job(dump_job_t *job)
+{
+	pthread_mutex_lock(&DumpPool.lock);
+	*DumpPool.tailp = job;
+	DumpPool.tailp = &job->next;
+	if (job->iscan) {
+		*DumpPool.qtailp = job;
+		DumpPool.qtailp = &job->qnext;
+		pthread_cond_signal(&DumpPool.cond);
+	}
+	++DumpPool.inflight;
+	pthread_mutex_unlock(&DumpPool.lock);
+
+	retire_jobs(DUMP_INFLIGHT);
+}
+
+/*
+ * Retire finished jobs from the head of the dispatch list, waiting for
+ * more to finish while more than (limit) are in flight.  Main thread
+ * only.
+ */
+static void
+retire_jobs(int limit)
+{
+	dump_job_t *job;
+	char *path2;
+
+	pthread_mutex_lock(&DumpPool.lock);
+	while ((job = DumpPool.head) != NULL) {
+		if (job->done == 0) {
+			if (DumpPool.inflight <= limit)
+				break;
+			pthread_cond_wait(&DumpPool.done_cond,
+					  &DumpPool.lock);
+			continue;
+		}
+		DumpPool.head = job->next;
+		if (DumpPool.head == NULL)
+			DumpPool.tailp = &DumpPool.head;
+		--DumpPool.inflight;
+		pthread_mutex_unlock(&DumpPool.lock);
+
+		if (job->iscan == NULL) {
+			set_dir_attrs(job->path, &job->inode);
+		} else if (job->res == 0) {
+			asprintf(&path2, "%s.corrupted", job->path);
+			job->iscan->link_file_path =
+				arena_add(&StrArena, path2);
+			free(path2);
+		}
+		free(job->path);
+		free(job);
+
+		pthread_mutex_lock(&DumpPool.lock);
+	}
+	pthread_mutex_unlock(&DumpPool.lock);
+}
+
 /*
  * TODO XXX
  */
@@ -1242,7 +2148,7 @@ dump_dir_data(const char *dest, const char *remain,
 {
 	hammer2_media_data_t data;
 	hammer2_volume_t *vol;
-	hammer2_off_t poff;
+	void *ptr;
 	size_t psize;
 	int res = 1;
 	int rtmp;
@@ -1271,7 +2177,6 @@ dump_dir_data(const char *dest, const char *remain,
 			continue;
 
 		vol = NULL;
-		poff = 0;
 		psize = 0;
 		if (bref->data_off & 0x1F) {
 			vol = hammer2_get_volume(bref->data_off);
@@ -1279,7 +2184,6 @@ dump_dir_data(const char *dest, const char *remain,
 				res = 0;
 				continue;
 			}
-			poff = (bref->data_off - vol->offset) & ~0x1FL;
 			psize = 1 << (bref->data_off & 0x1F);
 			if (psize > sizeof(data)) {
 				res = 0;
@@ -1316,8 +2220,7 @@ dump_dir_data(const char *dest, const char *remain,
 				asprintf(&path, "%s/%s", dest, filename_buf);
 				iscan = find_first_inode(inum);
 				while (iscan) {
-					if (iscan->inum == inum &&
-					    iscan->loopcheck == 0 &&
+					if (iscan->loopcheck == 0 &&
 					    iscan->type ==
 					     bref->embed.dirent.type)
 					{
@@ -1333,7 +2236,7 @@ dump_dir_data(const char *dest, const char *remain,
 						 */
 						iscan->loopcheck = 0;
 					}
-					iscan = iscan->next;
+					iscan = find_next_inode(iscan);
 				}
 				free(path);
 			}
@@ -1354,9 +2257,9 @@ dump_dir_data(const char *dest, const char *remain,
 			if (topology_check_duplicate_indirect(topo, bref))
 				break;
 
-			if (pread(vol->fd, &data, psize, poff) !=
-			    (ssize_t)psize)
-			{
+			ptr = hammer2_cache_read(bref->data_off, &data,
+						 sizeof(data), &psize);
+			if (ptr == NULL) {
 				res = 0;
 				break;
 			}
@@ -1381,25 +2284,42 @@ dump_dir_data(const char *dest, const char *remain,
 /*
  * Dumps the data records for an inode to the target file (wfd), returns
  * TRUE on success, FALSE if corruption was detected.
+ *
+ * Indirect blocks are followed as they are found, but data blocks are
+ * collected into a batch which is sorted by media offset before being
+ * read, so a fragmented file is read (mostly) sequentially.
  */
 static int
-dump_file_data(int wfd, hammer2_off_t fsize,
+dump_file_data(dump_batch_t *batch, int wfd, hammer2_off_t fsize,
 	       hammer2_blockref_t *base, int count)
+{
+	int res;
+	int rtmp;
+
+	batch->count = 0;
+	batch->wfd = wfd;
+	batch->fsize = fsize;
+
+	res = dump_file_brefs(batch, base, count);
+	rtmp = flush_file_data(batch);
+	if (res)
+		res = rtmp;
+
+	return res;
+}
+
+static int
+dump_file_brefs(dump_batch_t *batch, hammer2_blockref_t *base, int count)
 {
 	hammer2_media_data_t data;
 	hammer2_blockref_t *bref;
-	hammer2_volume_t *vol;
-	hammer2_off_t poff;
-	hammer2_off_t psize;
-	hammer2_off_t nsize;
+	void *ptr;
+	size_t psize;
 	int res = 1;
 	int rtmp;
 	int n;
 
 	for (n = 0; n < count; ++n) {
-		char *dptr;
-		int res2;
-
 		bref = &base[n];
 
 		if (bref->type == HAMMER2_BREF_TYPE_EMPTY ||
@@ -1407,78 +2327,122 @@ dump_file_data(int wfd, hammer2_off_t fsize,
 		{
 			continue;
 		}
-		vol = hammer2_get_volume(bref->data_off);
-		if (vol == NULL)
+		if (hammer2_get_volume(bref->data_off) == NULL)
 			continue;
-		if (bref->type == HAMMER2_BREF_TYPE_EMPTY ||
-		    bref->data_off == 0)
-		{
+
+		/*
+		 * Data is read when the batch is flushed.
+		 */
+		if (bref->type == HAMMER2_BREF_TYPE_DATA) {
+			batch->brefs[batch->count++] = *bref;
+			if (batch->count == DUMP_BATCH) {
+				rtmp = flush_file_data(batch);
+				if (res)
+					res = rtmp;
+			}
 			continue;
 		}
 
-		poff = (bref->data_off - vol->offset) & ~0x1FL;
-		psize = 1 << (bref->data_off & 0x1F);
-		if (psize > sizeof(data)) {
+		ptr = hammer2_cache_read(bref->data_off, &data, sizeof(data),
+					 &psize);
+		if (ptr == NULL || validate_crc(bref, ptr, psize) == 0) {
 			res = 0;
 			continue;
 		}
+		if (bref->type == HAMMER2_BREF_TYPE_INDIRECT) {
+			rtmp = dump_file_brefs(batch, &data.npdata[0],
+					  psize / sizeof(hammer2_blockref_t));
+			if (res)
+				res = rtmp;
+		}
+	}
+	return res;
+}
+
+static int
+dump_bref_cmp(const void *arg1, const void *arg2)
+{
+	const hammer2_blockref_t *bref1 = arg1;
+	const hammer2_blockref_t *bref2 = arg2;
+
+	if (bref1->data_off < bref2->data_off)
+		return -1;
+	if (bref1->data_off > bref2->data_off)
+		return 1;
+	if (bref1->key < bref2->key)
+		return -1;
+	if (bref1->key > bref2->key)
+		return 1;
+	return 0;
+}
+
+/*
+ * Read the batched data blocks in media order and write them out at
+ * their file offsets.
+ */
+static int
+flush_file_data(dump_batch_t *batch)
+{
+	hammer2_blockref_t *bref;
+	hammer2_off_t fsize = batch->fsize;
+	size_t psize;
+	size_t nsize;
+	char *dptr;
+	int res = 1;
+	int res2;
+	int n;
+
+	qsort(batch->brefs, batch->count, sizeof(*batch->brefs),
+	      dump_bref_cmp);
 
-		if (pread(vol->fd, &data, psize, poff) != (ssize_t)psize) {
+	for (n = 0; n < batch->count; ++n) {
+		bref = &batch->brefs[n];
+
+		dptr = hammer2_cache_read(bref->data_off, batch->ibuf,
+					  HAMMER2_PBUFSIZE, &psize);
+		if (dptr == NULL) {
 			res = 0;
 			continue;
 		}
-
-		if (validate_crc(bref, &data, psize) == 0) {
+		if (validate_crc(bref, dptr, psize) == 0) {
 			res = 0;
 			continue;
 		}
 
-		switch(bref->type) {
-		case HAMMER2_BREF_TYPE_DATA:
-			dptr = (void *)&data;
-
-			nsize = 1L << bref->keybits;
-			if (nsize > sizeof(data)) {
-				res = 0;
-				break;
-			}
-
-			switch (HAMMER2_DEC_COMP(bref->methods)) {
-			case HAMMER2_COMP_LZ4:
-				dptr = hammer2_decompress_LZ4(dptr, psize,
-							      nsize, &res2);
-				if (res)
-					res = res2;
-				psize = nsize;
-				break;
-			case HAMMER2_COMP_ZLIB:
-				dptr = hammer2_decompress_ZLIB(dptr, psize,
-							       nsize, &res2);
-				if (res)
-					res = res2;
-				psize = nsize;
-				break;
-			case HAMMER2_COMP_NONE:
-			default:
-				/* leave in current form */
-				break;
-			}
+		nsize = 1L << bref->keybits;
+		if (nsize > sizeof(hammer2_media_data_t)) {
+			res = 0;
+			continue;
+		}
 
-			if (bref->key + psize > fsize)
-				pwrite(wfd, dptr, fsize - bref->key,
-				       bref->key);
-			else
-				pwrite(wfd, dptr, psize, bref->key);
+		switch (HAMMER2_DEC_COMP(bref->methods)) {
+		case HAMMER2_COMP_LZ4:
+			dptr = hammer2_decompress_LZ4(dptr, psize,
+						      batch->obuf, nsize, &res2);
+			if (res)
+				res = res2;
+			psize = nsize;
 			break;
-		case HAMMER2_BREF_TYPE_INDIRECT:
-			rtmp = dump_file_data(wfd, fsize,
-					  &data.npdata[0],
-					  psize / sizeof(hammer2_blockref_t));
+		case HAMMER2_COMP_ZLIB:
+			dptr = hammer2_decompress_ZLIB(dptr, psize,
+						       batch->obuf, nsize, &res2);
 			if (res)
-				res = rtmp;
+				res = res2;
+			psize = nsize;
+			break;
+		case HAMMER2_COMP_NONE:
+		default:
+			/* leave in current form */
 			break;
 		}
+
+		if (bref->key + psize > fsize)
+			pwrite(batch->wfd, dptr, fsize - bref->key, bref->key);
+		else
+			pwrite(batch->wfd, dptr, psize, bref->key);
 	}
+	batch->count = 0;
+
 	return res;
 }
 
@@ -1552,52 +2516,142 @@ hammer2_to_unix_xid(const uuid_t *uuid)
 /*
  * Read from disk image, with caching to improve performance.
  *
- * Use a very simple LRU algo with 16 entries, linearly checked.
+ * SDCCache is shared with the dump threads, so the data is copied out
+ * to (buf), which must be able to hold the I/O size.  Misses are read
+ * without holding the lock.
  */
-#define SDCCOUNT	16
-#define SDCMASK		(SDCCOUNT - 1)
-
-typedef struct sdccache {
-	char		buf[HAMMER2_PBUFSIZE];
-	hammer2_off_t	offset;
-	hammer2_volume_t *vol;
-	int64_t		last;
-} sdccache_t;
-
-static sdccache_t SDCCache[SDCCOUNT];
-static int64_t SDCLast;
-
 static void *
-hammer2_cache_read(hammer2_off_t data_off, size_t *bytesp)
+hammer2_cache_read(hammer2_off_t data_off, void *buf, size_t bufsize,
+		   size_t *bytesp)
 {
+	char tmp[HAMMER2_PBUFSIZE];
+	hammer2_volume_t *vol;
 	hammer2_off_t poff;
 	hammer2_off_t pbase;
-	hammer2_volume_t *vol;
 	sdccache_t *sdc;
-	sdccache_t *sdc_worst;
+
+	if (sdc_locate(data_off, &vol, &poff, bytesp) == 0)
+		return NULL;
+	if (*bytesp > bufsize)
+		return NULL;
+	pbase = poff & ~HAMMER2_PBUFMASK64;
+
+	pthread_mutex_lock(&SDCLock);
+	sdc = sdc_lookup(&SDCCache, vol, pbase);
+	if (sdc) {
+		++SDCCache.hits;
+		bcopy(&sdc->buf[poff - pbase], buf, *bytesp);
+		pthread_mutex_unlock(&SDCLock);
+		return buf;
+	}
+	++SDCCache.misses;
+	pthread_mutex_unlock(&SDCLock);
+
+	if (pread(vol->fd, tmp, HAMMER2_PBUFSIZE, pbase) != HAMMER2_PBUFSIZE)
+		return NULL;
+
+	pthread_mutex_lock(&SDCLock);
+	if (sdc_lookup(&SDCCache, vol, pbase) == NULL) {
+		sdc = sdc_enter(&SDCCache, vol, pbase);
+		bcopy(tmp, sdc->buf, HAMMER2_PBUFSIZE);
+	}
+	pthread_mutex_unlock(&SDCLock);
+	bcopy(&tmp[poff - pbase], buf, *bytesp);
+
+	return buf;
+}
+
+/*
+ * Size a read cache for (bytes) worth of hammer2 blocks.  Buffers are
+ * only allocated once the cache actually fills up to them.
+ */
+static void
+sdc_init(sdcset_t *set, size_t bytes)
+{
+	size_t max;
+	int hsize;
+	int i;
+
+	max = bytes / HAMMER2_PBUFSIZE;
+	if (max < SDCCOUNT)
+		max = SDCCOUNT;
+	if (max > INT_MAX / 4)
+		max = INT_MAX / 4;
+
+	bzero(set, sizeof(*set));
+	set->max = (int)max;
+	hsize = SDCCOUNT;
+	while (hsize < set->max)
+		hsize <<= 1;
+	set->hmask = hsize - 1;
+	set->ent = calloc(set->max, sizeof(*set->ent));
+	set->hash = malloc(hsize * sizeof(*set->hash));
+	assert(set->ent && set->hash);
+	for (i = 0; i < hsize; ++i)
+		set->hash[i] = -1;
+}
+
+static void
+sdc_free(sdcset_t *set)
+{
 	int i;
 
+	for (i = 0; i < set->count; ++i)
+		free(set->ent[i].buf);
+	free(set->ent);
+	free(set->hash);
+	bzero(set, sizeof(*set));
+}
+
+static int
+sdc_hash(sdcset_t *set, hammer2_volume_t *vol, hammer2_off_t pbase)
+{
+	return (hash64(pbase ^ (uintptr_t)vol * HASH_PRIME) & set->hmask);
+}
+
+static void
+sdc_unlink(sdcset_t *set, int idx)
+{
+	sdccache_t *sdc = &set->ent[idx];
+	int *ip;
+
+	ip = &set->hash[sdc_hash(set, sdc->vol, sdc->offset)];
+	while (*ip != idx) {
+		assert(*ip >= 0);
+		ip = &set->ent[*ip].hnext;
+	}
+	*ip = sdc->hnext;
+	sdc->hnext = -1;
+	sdc->vol = NULL;
+	sdc->offset = (hammer2_off_t)-1;
+	sdc->referenced = 0;
+}
+
+/*
+ * Translate logical offset to volume and physical offset.  Returns 0
+ * with *bytesp set to 0 to indicate pre-I/O sanity check failure.
+ */
+static int
+sdc_locate(hammer2_off_t data_off, hammer2_volume_t **volp,
+	   hammer2_off_t *poffp, size_t *bytesp)
+{
+	hammer2_volume_t *vol;
+	hammer2_off_t poff;
+
 	*bytesp = 0;
 
-	/*
-	 * Translate logical offset to volume and physical offset.
-	 * Return NULL with *bytesp set to 0 to indicate pre-I/O
-	 * sanity check failure.
-	 */
 	vol = hammer2_get_volume(data_off);
-        if (vol == NULL)
-                return NULL;
-        poff = (data_off - vol->offset) & ~0x1FL;
+	if (vol == NULL)
+		return 0;
+	poff = (data_off - vol->offset) & ~0x1FL;
 	*bytesp = 1 << (data_off & 0x1F);
 
-	pbase = poff & ~HAMMER2_PBUFMASK64;
-
 	/*
 	 * Must not straddle two full-sized hammer2 blocks
 	 */
 	if ((poff ^ (poff + *bytesp - 1)) & ~HAMMER2_PBUFMASK64) {
 		*bytesp = 0;
-		return NULL;
+		return 0;
 	}
 
 	/*
@@ -1606,40 +2660,103 @@ hammer2_cache_read(hammer2_off_t data_off, size_t *bytesp)
 	 */
 	if (poff & ~0x1FL & (*bytesp - 1)) {
 		*bytesp = 0;
-		return NULL;
+		return 0;
 	}
+	*volp = vol;
+	*poffp = poff;
 
-	/*
-	 * LRU match lookup
-	 */
-	sdc_worst = NULL;
-	for (i = 0; i < SDCCOUNT; ++i) {
-		sdc = &SDCCache[i];
+	return 1;
+}
+
+static sdccache_t *
+sdc_lookup(sdcset_t *set, hammer2_volume_t *vol, hammer2_off_t pbase)
+{
+	sdccache_t *sdc;
+	int i;
 
+	i = set->hash[sdc_hash(set, vol, pbase)];
+	while (i >= 0) {
+		sdc = &set->ent[i];
 		if (sdc->vol == vol && sdc->offset == pbase) {
-			sdc->last = ++SDCLast;
-			return (&sdc->buf[poff - pbase]);
+			sdc->referenced = 1;
+			return sdc;
 		}
-		if (sdc_worst == NULL || sdc_worst->last > sdc->last)
-			sdc_worst = sdc;
+		i = sdc->hnext;
 	}
+	return NULL;
+}
 
-	/*
-	 * Fallback to I/O if not found, using oldest entry
-	 *
-	 * On failure we leave (*bytesp) intact to indicate that an I/O
-	 * was attempted.
-	 */
-	sdc = sdc_worst;
+/*
+ * Assign a buffer to (vol, pbase), using a new buffer until the cache
+ * is full and then the first unreferenced entry under the CLOCK hand.
+ * The caller fills in the data.
+ */
+static sdccache_t *
+sdc_enter(sdcset_t *set, hammer2_volume_t *vol, hammer2_off_t pbase)
+{
+	sdccache_t *sdc;
+	int h;
+	int i;
+
+	if (set->count < set->max) {
+		i = set->count++;
+		sdc = &set->ent[i];
+		sdc->buf = malloc(HAMMER2_PBUFSIZE);
+		assert(sdc->buf);
+	} else {
+		for (;;) {
+			i = set->hand;
+			sdc = &set->ent[i];
+			if (++set->hand == set->max)
+				set->hand = 0;
+			if (sdc->referenced == 0)
+				break;
+			sdc->referenced = 0;
+		}
+		if (sdc->vol)
+			sdc_unlink(set, i);
+	}
+	h = sdc_hash(set, vol, pbase);
 	sdc->vol = vol;
 	sdc->offset = pbase;
-	sdc->last = ++SDCLast;
+	sdc->referenced = 1;
+	sdc->hnext = set->hash[h];
+	set->hash[h] = i;
+
+	return sdc;
+}
+
+/*
+ * Read through a cache private to the caller.  The returned data is
+ * only good until the next read.
+ *
+ * On I/O failure we leave (*bytesp) intact to indicate that an I/O
+ * was attempted.
+ */
+static void *
+sdc_read(sdcset_t *set, hammer2_off_t data_off, size_t *bytesp)
+{
+	hammer2_volume_t *vol;
+	hammer2_off_t poff;
+	hammer2_off_t pbase;
+	sdccache_t *sdc;
+
+	if (sdc_locate(data_off, &vol, &poff, bytesp) == 0)
+		return NULL;
+	pbase = poff & ~HAMMER2_PBUFMASK64;
+
+	sdc = sdc_lookup(set, vol, pbase);
+	if (sdc) {
+		++set->hits;
+		return (&sdc->buf[poff - pbase]);
+	}
+	++set->misses;
 
+	sdc = sdc_enter(set, vol, pbase);
 	if (pread(vol->fd, sdc->buf, HAMMER2_PBUFSIZE, pbase) !=
 	    HAMMER2_PBUFSIZE)
 	{
-		sdc->offset = (hammer2_off_t)-1;
-		sdc->last = 0;
+		sdc_unlink(set, sdc - set->ent);
 		return NULL;
 	}
 	return (&sdc->buf[poff - pbase]);
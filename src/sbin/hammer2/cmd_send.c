@@ -0,0 +1,1704 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * send, receive and diff directives.
+ *
+ * send compares two PFSs of an unmounted filesystem, normally a snapshot
+ * and a later snapshot of the same PFS, and writes the differences as a
+ * stream which receive applies to a directory tree holding a copy of the
+ * first one.  Without a base PFS everything is sent.
+ *
+ * Both PFSs are walked through hammer2_image_diff(), which skips every
+ * subtree whose blockref is shared by the two, so the cost of a send
+ * follows the size of the change set rather than the size of the PFS.
+ * File data blocks are passed through as stored on media, compressed
+ * blocks are not decompressed by the sender.
+ *
+ * The stream is a sequence of records operating on paths relative to the
+ * destination directory, each followed by its payload and covered by a
+ * crc.  Objects are identified by inode number on the sending side only.
+ * Names which go away are first moved into a stash directory, deepest
+ * first, so that renames, directory moves and hardlinks can be replayed
+ * without ordering conflicts.  New names are then linked or moved back
+ * out of the stash or created, shallowest first, followed by file data
+ * changes and finally the attributes of changed directories.
+ *
+ * diff lists the same change set as paths.  Given a mounted directory
+ * it reads the device the filesystem was mounted from, live PFSs being
+ * seen as of their last flush to media.
+ */
+#include "hammer2.h"
+#include "libhammer2.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <time.h>
+
+#define SEND_REC_MAGIC		0x48325352	/* "H2SR" */
+#define SEND_VERSION		1
+#define SEND_STASH		".hammer2-stash"
+#define SEND_HSIZE		16384		/* inode hash */
+#define SEND_MAXPATH		65536		/* receive sanity limits */
+#define SEND_MAXDATA		(sizeof(hammer2_inode_meta_t) + \
+				 HAMMER2_PBUFSIZE)
+
+#define SEND_REC_BEGIN		1	/* send_begin_t */
+#define SEND_REC_END		2
+#define SEND_REC_RENAME		3	/* path1 -> path2 */
+#define SEND_REC_LINK		4	/* new link path2 to path1 */
+#define SEND_REC_REMOVE		5	/* path1, recursively */
+#define SEND_REC_CREATE		6	/* meta [+ symlink target] */
+#define SEND_REC_WRITE		7	/* block at offset, size bytes */
+#define SEND_REC_HOLE		8	/* zero offset, size bytes */
+#define SEND_REC_TRUNCATE	9	/* to size */
+#define SEND_REC_ATTR		10	/* meta */
+
+/*
+ * Record header, in media (little-endian) byte order.  The crc covers the
+ * header with crc set to 0, followed by path1, path2 and the data.
+ */
+typedef struct send_rec {
+	uint32_t	magic;
+	uint16_t	type;
+	uint16_t	comp;		/* WRITE: HAMMER2_COMP_* of the data */
+	uint32_t	path1len;
+	uint32_t	path2len;
+	uint64_t	datalen;
+	uint64_t	offset;
+	uint64_t	size;
+	uint32_t	reserved;
+	uint32_t	crc;
+} send_rec_t;
+
+typedef struct send_begin {
+	uint32_t	version;
+	uint32_t	flags;
+	uint64_t	from_tid;	/* mirror_tid of the PFS roots */
+	uint64_t	to_tid;
+	char		from_label[HAMMER2_INODE_MAXNAME + 1];
+	char		to_label[HAMMER2_INODE_MAXNAME + 1];
+} send_begin_t;
+
+#define SEND_BEGIN_INCREMENTAL	0x0001
+
+/*
+ * Inodes whose blockref differs between the two PFSs.  Inodes which are
+ * not in the table exist unchanged on both sides.
+ */
+typedef struct send_inode {
+	struct send_inode *next;
+	hammer2_key_t	inum;
+	hammer2_blockref_t bref_a;
+	hammer2_blockref_t bref_b;
+	uint8_t		type_a;
+	uint8_t		type_b;
+	int		flags;
+	char		*path;		/* where it was created */
+} send_inode_t;
+
+#define SEND_IN_A		0x0001
+#define SEND_IN_B		0x0002
+#define SEND_STASHED		0x0004
+#define SEND_UNSTASHED		0x0008
+#define SEND_CREATED		0x0010
+#define SEND_NAME_REMOVED	0x0020
+#define SEND_DIR_CHANGED	0x0040	/* diff: entries changed */
+
+typedef struct send_dirent {
+	hammer2_key_t	parent;
+	hammer2_key_t	inum;
+	uint8_t		type;
+	int		depth;
+	char		*name;
+	char		*path;
+} send_dirent_t;
+
+typedef struct send_dirent_list {
+	send_dirent_t	*ents;
+	int		count;
+	int		alloc;
+} send_dirent_list_t;
+
+typedef struct send_diff_info {
+	hammer2_key_t	parent;
+} send_diff_info_t;
+
+typedef struct diff_line {
+	int		op;		/* '-', '+', 'M' or 'R' */
+	hammer2_key_t	inum;
+	char		*path;
+	char		*path2;		/* new name of 'R' */
+} diff_line_t;
+
+typedef struct diff_line_list {
+	diff_line_t	*lines;
+	int		count;
+	int		alloc;
+} diff_line_list_t;
+
+static hammer2_image_t *SendA;		/* base PFS or NULL */
+static hammer2_image_t *SendB;
+static hammer2_image_inode_t SendRootA;
+static hammer2_image_inode_t SendRootB;
+static send_inode_t *SendInodes[SEND_HSIZE];
+static send_dirent_list_t SendRemoved;
+static send_dirent_list_t SendAdded;
+static char *SendBuf;
+static struct {
+	uint64_t	inodes;
+	uint64_t	records;
+	uint64_t	bytes;
+	uint64_t	blocks;
+	uint64_t	compressed;
+} SendStats;
+
+static struct {
+	int		dfd;
+	char		*path;		/* open regular file */
+	int		fd;
+	hammer2_off_t	zero_from;	/* unwritten data beyond is zero */
+	uint64_t	records;
+	uint64_t	bytes;
+	uint64_t	errors;
+} Recv = {
+	.fd = -1,
+};
+
+static void send_object(send_inode_t *ino, const char *path);
+static void send_file_data(const hammer2_image_inode_t *ip_a,
+			const hammer2_image_inode_t *ip_b, const char *path);
+
+/************************************************************************
+ *				    SEND				*
+ ************************************************************************/
+
+static void
+send_record(send_rec_t *rec, const char *path1, const char *path2,
+	    const void *data, size_t datalen)
+{
+	uint32_t crc;
+
+	rec->magic = SEND_REC_MAGIC;
+	rec->path1len = path1 ? strlen(path1) : 0;
+	rec->path2len = path2 ? strlen(path2) : 0;
+	rec->datalen = datalen;
+	rec->reserved = 0;
+	rec->crc = 0;
+	crc = hammer2_icrc32(rec, sizeof(*rec));
+	crc = hammer2_icrc32c(path1, rec->path1len, crc);
+	crc = hammer2_icrc32c(path2, rec->path2len, crc);
+	crc = hammer2_icrc32c(data, datalen, crc);
+	rec->crc = crc;
+
+	if (fwrite(rec, sizeof(*rec), 1, stdout) != 1 ||
+	    fwrite(path1, 1, rec->path1len, stdout) != rec->path1len ||
+	    fwrite(path2, 1, rec->path2len, stdout) != rec->path2len ||
+	    fwrite(data, 1, datalen, stdout) != datalen)
+		err(1, "send");
+	++SendStats.records;
+	SendStats.bytes += sizeof(*rec) + rec->path1len + rec->path2len +
+			   datalen;
+}
+
+static void
+send_op(int type, const char *path1, const char *path2)
+{
+	send_rec_t rec;
+
+	bzero(&rec, sizeof(rec));
+	rec.type = type;
+	send_record(&rec, path1, path2, NULL, 0);
+}
+
+static void
+send_meta(int type, const char *path, const hammer2_image_inode_t *ip,
+	  const char *target)
+{
+	send_rec_t rec;
+	char buf[SEND_MAXDATA];
+	size_t len = 0;
+
+	bcopy(&ip->ipdata.meta, buf, sizeof(ip->ipdata.meta));
+	if (target) {
+		len = strlen(target);
+		bcopy(target, buf + sizeof(ip->ipdata.meta), len);
+	}
+	bzero(&rec, sizeof(rec));
+	rec.type = type;
+	send_record(&rec, path, NULL, buf, sizeof(ip->ipdata.meta) + len);
+}
+
+static void
+send_range(int type, const char *path, hammer2_off_t offset,
+	   hammer2_off_t size)
+{
+	send_rec_t rec;
+
+	bzero(&rec, sizeof(rec));
+	rec.type = type;
+	rec.offset = offset;
+	rec.size = size;
+	send_record(&rec, path, NULL, NULL, 0);
+}
+
+static __inline
+size_t
+send_hash(hammer2_key_t inum)
+{
+	return ((inum ^ (inum >> 14)) & (SEND_HSIZE - 1));
+}
+
+static send_inode_t *
+send_inode_find(hammer2_key_t inum)
+{
+	send_inode_t *ino;
+
+	for (ino = SendInodes[send_hash(inum)]; ino; ino = ino->next) {
+		if (ino->inum == inum)
+			return ino;
+	}
+	return NULL;
+}
+
+/*
+ * Return the entry of an object which exists on both sides, adding one
+ * for objects which did not change.
+ */
+static send_inode_t *
+send_inode_get(hammer2_key_t inum)
+{
+	send_inode_t *ino;
+	size_t i;
+
+	if ((ino = send_inode_find(inum)) != NULL)
+		return ino;
+	ino = calloc(1, sizeof(*ino));
+	ino->inum = inum;
+	ino->flags = SEND_IN_A | SEND_IN_B;
+	i = send_hash(inum);
+	ino->next = SendInodes[i];
+	SendInodes[i] = ino;
+
+	return ino;
+}
+
+/*
+ * An object survives if it exists on both sides as the same type of
+ * object, the unchanged ones not being in the table.
+ */
+static int
+send_survives(const send_inode_t *ino)
+{
+	if (ino == NULL)
+		return 1;
+	return ((ino->flags & (SEND_IN_A | SEND_IN_B)) ==
+		(SEND_IN_A | SEND_IN_B) && ino->type_a == ino->type_b);
+}
+
+static void
+send_get_inode(hammer2_image_t *img, const hammer2_blockref_t *bref,
+	       hammer2_image_inode_t *ip)
+{
+	int error;
+
+	error = hammer2_image_get_inode(img, bref, ip);
+	if (error)
+		errx(1, "inode %016jx: %s", (uintmax_t)bref->key,
+		     strerror(error));
+}
+
+static char *
+send_path(hammer2_image_t *img, hammer2_key_t inum)
+{
+	char *path;
+	int error;
+
+	error = hammer2_image_path(img, inum, &path);
+	if (error)
+		errx(1, "%s: inode %016jx: %s", hammer2_image_label(img),
+		     (uintmax_t)inum, strerror(error));
+	return path;
+}
+
+static char *
+send_join(const char *path, const char *name)
+{
+	char *res;
+
+	if (*path)
+		asprintf(&res, "%s/%s", path, name);
+	else
+		res = strdup(name);
+	if (res == NULL)
+		err(1, "asprintf");
+	return res;
+}
+
+static char *
+send_stash_path(hammer2_key_t inum)
+{
+	char *res;
+
+	asprintf(&res, "%s/%016jx", SEND_STASH, (uintmax_t)inum);
+	if (res == NULL)
+		err(1, "asprintf");
+	return res;
+}
+
+static void
+send_dirent_add(send_dirent_list_t *list, hammer2_image_t *img,
+		hammer2_key_t parent, const hammer2_blockref_t *bref)
+{
+	hammer2_image_dirent_t dent;
+	send_dirent_t *ent;
+	int error;
+
+	error = hammer2_image_get_dirent(img, bref, &dent);
+	if (error)
+		errx(1, "directory %016jx: %s", (uintmax_t)parent,
+		     strerror(error));
+	if (list->count == list->alloc) {
+		list->alloc = list->alloc ? list->alloc * 2 : 256;
+		list->ents = realloc(list->ents,
+				     list->alloc * sizeof(*list->ents));
+		if (list->ents == NULL)
+			err(1, "realloc");
+	}
+	ent = &list->ents[list->count++];
+	bzero(ent, sizeof(*ent));
+	ent->parent = parent;
+	ent->inum = dent.inum;
+	ent->type = dent.type;
+	ent->name = strdup(dent.name);
+}
+
+/*
+ * Directory entries which differ.  A changed entry (same hash key) is a
+ * removal followed by an addition unless it still names the same inode.
+ */
+static int
+send_dirent_cb(const hammer2_blockref_t *bref_a,
+	       const hammer2_blockref_t *bref_b, void *arg)
+{
+	send_diff_info_t *info = arg;
+	hammer2_image_dirent_t dent_a;
+	hammer2_image_dirent_t dent_b;
+
+	if (bref_a && bref_b &&
+	    hammer2_image_get_dirent(SendA, bref_a, &dent_a) == 0 &&
+	    hammer2_image_get_dirent(SendB, bref_b, &dent_b) == 0 &&
+	    dent_a.inum == dent_b.inum &&
+	    strcmp(dent_a.name, dent_b.name) == 0)
+		return 0;
+	if (bref_a)
+		send_dirent_add(&SendRemoved, SendA, info->parent, bref_a);
+	if (bref_b)
+		send_dirent_add(&SendAdded, SendB, info->parent, bref_b);
+	return 0;
+}
+
+/*
+ * The PFS root's block table indexes all inodes and also holds the root
+ * directory's entries.
+ */
+static int
+send_root_cb(const hammer2_blockref_t *bref_a,
+	     const hammer2_blockref_t *bref_b, void *arg)
+{
+	const hammer2_blockref_t *bref = bref_a ? bref_a : bref_b;
+	send_inode_t *ino;
+	size_t i;
+
+	if (bref->key & HAMMER2_DIRHASH_VISIBLE)
+		return send_dirent_cb(bref_a, bref_b, arg);
+	if (bref->type != HAMMER2_BREF_TYPE_INODE)
+		return 0;
+
+	ino = calloc(1, sizeof(*ino));
+	ino->inum = bref->key;
+	if (bref_a) {
+		ino->bref_a = *bref_a;
+		ino->flags |= SEND_IN_A;
+	}
+	if (bref_b) {
+		ino->bref_b = *bref_b;
+		ino->flags |= SEND_IN_B;
+	}
+	i = send_hash(ino->inum);
+	ino->next = SendInodes[i];
+	SendInodes[i] = ino;
+	++SendStats.inodes;
+
+	return 0;
+}
+
+/*
+ * Classify a changed inode and collect the entry changes of changed
+ * directories.
+ */
+static void
+send_scan_inode(send_inode_t *ino)
+{
+	hammer2_image_inode_t ip_a;
+	hammer2_image_inode_t ip_b;
+	send_diff_info_t info;
+	int error = 0;
+
+	if (ino->flags & SEND_IN_A) {
+		send_get_inode(SendA, &ino->bref_a, &ip_a);
+		ino->type_a = ip_a.ipdata.meta.type;
+	}
+	if (ino->flags & SEND_IN_B) {
+		send_get_inode(SendB, &ino->bref_b, &ip_b);
+		ino->type_b = ip_b.ipdata.meta.type;
+	}
+
+	info.parent = ino->inum;
+	if (send_survives(ino)) {
+		if (ino->type_b == HAMMER2_OBJTYPE_DIRECTORY)
+			error = hammer2_image_diff(SendB, &ip_a, &ip_b,
+						   HAMMER2_DIRHASH_VISIBLE,
+						   (hammer2_key_t)-1,
+						   send_dirent_cb, &info);
+	} else {
+		if ((ino->flags & SEND_IN_A) &&
+		    ino->type_a == HAMMER2_OBJTYPE_DIRECTORY)
+			error = hammer2_image_diff(SendA, &ip_a, NULL,
+						   HAMMER2_DIRHASH_VISIBLE,
+						   (hammer2_key_t)-1,
+						   send_dirent_cb, &info);
+		if (error == 0 && (ino->flags & SEND_IN_B) &&
+		    ino->type_b == HAMMER2_OBJTYPE_DIRECTORY)
+			error = hammer2_image_diff(SendB, NULL, &ip_b,
+						   HAMMER2_DIRHASH_VISIBLE,
+						   (hammer2_key_t)-1,
+						   send_dirent_cb, &info);
+	}
+	if (error)
+		errx(1, "directory %016jx: %s", (uintmax_t)ino->inum,
+		     strerror(error));
+}
+
+static int
+send_depth(const char *path)
+{
+	int depth = 1;
+
+	while (*path) {
+		if (*path++ == '/')
+			++depth;
+	}
+	return depth;
+}
+
+static void
+send_dirent_paths(send_dirent_list_t *list, hammer2_image_t *img)
+{
+	send_dirent_t *ent;
+	char *ppath;
+	int i;
+
+	for (i = 0; i < list->count; ++i) {
+		ent = &list->ents[i];
+		ppath = send_path(img, ent->parent);
+		ent->path = send_join(ppath, ent->name);
+		ent->depth = send_depth(ent->path);
+		free(ppath);
+	}
+}
+
+static int
+send_deepest_cmp(const void *p1, const void *p2)
+{
+	const send_dirent_t *ent1 = p1;
+	const send_dirent_t *ent2 = p2;
+
+	if (ent1->depth != ent2->depth)
+		return (ent1->depth > ent2->depth) ? -1 : 1;
+	return strcmp(ent1->path, ent2->path);
+}
+
+static int
+send_shallowest_cmp(const void *p1, const void *p2)
+{
+	return send_deepest_cmp(p2, p1);
+}
+
+/*
+ * Emit one data block.  Zero-filled blocks are not stored on media and
+ * are sent as holes.
+ */
+static void
+send_block(const hammer2_blockref_t *bref, const char *path)
+{
+	send_rec_t rec;
+	size_t bytes;
+	int error;
+
+	if (bref->keybits > HAMMER2_PBUFRADIX)
+		errx(1, "%s: bad data block at %016jx", path,
+		     (uintmax_t)bref->key);
+	error = hammer2_image_read_block(SendB, bref, SendBuf, &bytes);
+	if (error)
+		errx(1, "%s: offset %016jx: %s", path, (uintmax_t)bref->key,
+		     strerror(error));
+	if (bytes == 0) {
+		send_range(SEND_REC_HOLE, path, bref->key,
+			   (hammer2_off_t)1 << bref->keybits);
+		return;
+	}
+
+	bzero(&rec, sizeof(rec));
+	rec.type = SEND_REC_WRITE;
+	rec.offset = bref->key;
+	rec.size = (hammer2_off_t)1 << bref->keybits;
+	switch(HAMMER2_DEC_COMP(bref->methods)) {
+	case HAMMER2_COMP_LZ4:
+	case HAMMER2_COMP_ZLIB:
+		rec.comp = HAMMER2_DEC_COMP(bref->methods);
+		++SendStats.compressed;
+		break;
+	default:
+		rec.comp = HAMMER2_COMP_NONE;
+		break;
+	}
+	send_record(&rec, path, NULL, SendBuf, bytes);
+	++SendStats.blocks;
+}
+
+static int
+send_data_cb(const hammer2_blockref_t *bref_a,
+	     const hammer2_blockref_t *bref_b, void *arg)
+{
+	const char *path = arg;
+	hammer2_off_t size_a = 0;
+	hammer2_off_t size_b = 0;
+
+	if (bref_a && bref_a->type == HAMMER2_BREF_TYPE_DATA)
+		size_a = (hammer2_off_t)1 << bref_a->keybits;
+	if (bref_b && bref_b->type == HAMMER2_BREF_TYPE_DATA)
+		size_b = (hammer2_off_t)1 << bref_b->keybits;
+	if (size_a > size_b) {
+		send_range(SEND_REC_HOLE, path, bref_a->key + size_b,
+			   size_a - size_b);
+	}
+	if (size_b)
+		send_block(bref_b, path);
+
+	return 0;
+}
+
+/*
+ * Bring the contents of a regular file from (ip_a), NULL for a new file,
+ * to (ip_b).  Only the blocks which changed are sent.
+ */
+static void
+send_file_data(const hammer2_image_inode_t *ip_a,
+	       const hammer2_image_inode_t *ip_b, const char *path)
+{
+	const hammer2_inode_meta_t *meta = &ip_b->ipdata.meta;
+	send_rec_t rec;
+	int error;
+
+	if (ip_a && ((ip_a->ipdata.meta.op_flags |
+		      meta->op_flags) & HAMMER2_OPFLAG_DIRECTDATA)) {
+		send_range(SEND_REC_TRUNCATE, path, 0, 0);
+		ip_a = NULL;
+	}
+	if (meta->op_flags & HAMMER2_OPFLAG_DIRECTDATA) {
+		if (meta->size > HAMMER2_EMBEDDED_BYTES)
+			errx(1, "%s: bad embedded data size", path);
+		bzero(&rec, sizeof(rec));
+		rec.type = SEND_REC_WRITE;
+		rec.size = meta->size;
+		rec.comp = HAMMER2_COMP_NONE;
+		send_record(&rec, path, NULL, ip_b->ipdata.u.data, meta->size);
+	} else {
+		error = hammer2_image_diff(SendB, ip_a, ip_b, 0,
+					   HAMMER2_KEY_MAX, send_data_cb,
+					   (void *)(uintptr_t)path);
+		if (error)
+			errx(1, "%s: %s", path, strerror(error));
+	}
+	send_range(SEND_REC_TRUNCATE, path, 0, meta->size);
+}
+
+/*
+ * Create an object which does not exist on the receiving side.
+ * Directories get their attributes at the very end.
+ */
+static void
+send_object(send_inode_t *ino, const char *path)
+{
+	hammer2_image_inode_t ip;
+	char target[HAMMER2_PBUFSIZE];
+	ssize_t n;
+
+	send_get_inode(SendB, &ino->bref_b, &ip);
+	switch(ip.ipdata.meta.type) {
+	case HAMMER2_OBJTYPE_SOFTLINK:
+		n = hammer2_image_pread(SendB, &ip, target,
+					sizeof(target) - 1, 0);
+		if (n < 0)
+			err(1, "%s", path);
+		target[n] = 0;
+		send_meta(SEND_REC_CREATE, path, &ip, target);
+		break;
+	case HAMMER2_OBJTYPE_REGFILE:
+		send_meta(SEND_REC_CREATE, path, &ip, NULL);
+		send_file_data(NULL, &ip, path);
+		break;
+	default:
+		send_meta(SEND_REC_CREATE, path, &ip, NULL);
+		break;
+	}
+	if (ip.ipdata.meta.type != HAMMER2_OBJTYPE_DIRECTORY)
+		send_meta(SEND_REC_ATTR, path, &ip, NULL);
+	ino->flags |= SEND_CREATED;
+	ino->path = strdup(path);
+}
+
+/*
+ * A surviving non-directory object changed.  Regular files get their
+ * data updated in place, symbolic links and device nodes, which cannot
+ * be modified, are recreated if needed.
+ */
+static void
+send_update(send_inode_t *ino)
+{
+	hammer2_image_inode_t ip_a;
+	hammer2_image_inode_t ip_b;
+	char target_a[HAMMER2_PBUFSIZE];
+	char target_b[HAMMER2_PBUFSIZE];
+	ssize_t n_a, n_b;
+	char *path;
+	int recreate = 0;
+
+	send_get_inode(SendA, &ino->bref_a, &ip_a);
+	send_get_inode(SendB, &ino->bref_b, &ip_b);
+	path = send_path(SendB, ino->inum);
+
+	switch(ip_b.ipdata.meta.type) {
+	case HAMMER2_OBJTYPE_REGFILE:
+		send_file_data(&ip_a, &ip_b, path);
+		break;
+	case HAMMER2_OBJTYPE_SOFTLINK:
+		n_a = hammer2_image_pread(SendA, &ip_a, target_a,
+					  sizeof(target_a), 0);
+		n_b = hammer2_image_pread(SendB, &ip_b, target_b,
+					  sizeof(target_b), 0);
+		if (n_a < 0 || n_b < 0)
+			err(1, "%s", path);
+		recreate = (n_a != n_b || bcmp(target_a, target_b, n_b) != 0);
+		break;
+	case HAMMER2_OBJTYPE_CDEV:
+	case HAMMER2_OBJTYPE_BDEV:
+		recreate = (ip_a.ipdata.meta.rmajor !=
+			    ip_b.ipdata.meta.rmajor ||
+			    ip_a.ipdata.meta.rminor !=
+			    ip_b.ipdata.meta.rminor);
+		break;
+	}
+	if (recreate) {
+		send_op(SEND_REC_REMOVE, path, NULL);
+		send_object(ino, path);
+	} else {
+		send_meta(SEND_REC_ATTR, path, &ip_b, NULL);
+	}
+	free(path);
+}
+
+/*
+ * Set the attributes of all new and changed directories, deepest first
+ * and the root last, since populating a directory changes its times.
+ */
+static void
+send_dir_attrs(void)
+{
+	hammer2_image_inode_t ip;
+	send_dirent_list_t list;
+	send_dirent_t *ent;
+	send_inode_t *ino;
+	int i;
+
+	bzero(&list, sizeof(list));
+	for (i = 0; i < SEND_HSIZE; ++i) {
+		for (ino = SendInodes[i]; ino; ino = ino->next) {
+			if ((ino->flags & SEND_IN_B) == 0 ||
+			    ino->bref_b.type != HAMMER2_BREF_TYPE_INODE ||
+			    ino->type_b != HAMMER2_OBJTYPE_DIRECTORY)
+				continue;
+			if (list.count == list.alloc) {
+				list.alloc = list.alloc ? list.alloc * 2 : 64;
+				list.ents = realloc(list.ents, list.alloc *
+						    sizeof(*list.ents));
+				if (list.ents == NULL)
+					err(1, "realloc");
+			}
+			ent = &list.ents[list.count++];
+			bzero(ent, sizeof(*ent));
+			ent->inum = ino->inum;
+			ent->path = send_path(SendB, ino->inum);
+			ent->depth = send_depth(ent->path);
+		}
+	}
+	if (list.count > 1)
+		qsort(list.ents, list.count, sizeof(*list.ents),
+		      send_deepest_cmp);
+	for (i = 0; i < list.count; ++i) {
+		ent = &list.ents[i];
+		ino = send_inode_find(ent->inum);
+		send_get_inode(SendB, &ino->bref_b, &ip);
+		send_meta(SEND_REC_ATTR, ent->path, &ip, NULL);
+		free(ent->path);
+	}
+	free(list.ents);
+	send_meta(SEND_REC_ATTR, "", &SendRootB, NULL);
+}
+
+/*
+ * The base and target PFSs, usually two snapshots, are views of the same
+ * image sharing one block cache.
+ */
+static void
+send_open(const char *special, const char *from_label, const char *to_label)
+{
+	char *path;
+
+	asprintf(&path, "%s@%s", special, to_label);
+	if (path == NULL)
+		err(1, "asprintf");
+	SendB = hammer2_image_open(path, MemOpt);
+	if (SendB == NULL)
+		err(1, "%s", path);
+	free(path);
+	hammer2_image_root(SendB, &SendRootB);
+	if (from_label) {
+		SendA = hammer2_image_open_pfs(SendB, from_label);
+		if (SendA == NULL)
+			err(1, "%s", from_label);
+		hammer2_image_root(SendA, &SendRootA);
+	}
+}
+
+/*
+ * Collect the changed inodes and root directory entries, then the
+ * entries of every changed directory, along with their paths.
+ */
+static void
+send_collect(void)
+{
+	send_diff_info_t info;
+	send_inode_t *ino;
+	int error;
+	int i;
+
+	info.parent = SendRootB.ipdata.meta.inum;
+	error = hammer2_image_diff(SendB, SendA ? &SendRootA : NULL,
+				   &SendRootB, 0, HAMMER2_KEY_MAX,
+				   send_root_cb, &info);
+	if (error)
+		errx(1, "%s: %s", hammer2_image_label(SendB), strerror(error));
+	for (i = 0; i < SEND_HSIZE; ++i) {
+		for (ino = SendInodes[i]; ino; ino = ino->next)
+			send_scan_inode(ino);
+	}
+	if (SendA)
+		send_dirent_paths(&SendRemoved, SendA);
+	send_dirent_paths(&SendAdded, SendB);
+}
+
+static void
+send_close(void)
+{
+	send_inode_t *ino;
+	int i;
+
+	for (i = 0; i < SEND_HSIZE; ++i) {
+		while ((ino = SendInodes[i]) != NULL) {
+			SendInodes[i] = ino->next;
+			free(ino->path);
+			free(ino);
+		}
+	}
+	for (i = 0; i < SendRemoved.count; ++i) {
+		free(SendRemoved.ents[i].name);
+		free(SendRemoved.ents[i].path);
+	}
+	for (i = 0; i < SendAdded.count; ++i) {
+		free(SendAdded.ents[i].name);
+		free(SendAdded.ents[i].path);
+	}
+	free(SendRemoved.ents);
+	free(SendAdded.ents);
+	if (SendA)
+		hammer2_image_close(SendA);
+	hammer2_image_close(SendB);
+}
+
+int
+cmd_send(const char *special, const char *from_label, const char *to_label)
+{
+	hammer2_image_stats_t stats;
+	send_begin_t begin;
+	send_inode_t *ino;
+	send_dirent_t *ent;
+	send_rec_t rec;
+	struct timespec ts0, ts1;
+	double elapsed;
+	char *path;
+	char *stash;
+	int i;
+
+	if (isatty(STDOUT_FILENO))
+		errx(1, "send: refusing to write a stream to a terminal");
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+
+	send_open(special, from_label, to_label);
+	SendBuf = malloc(HAMMER2_PBUFSIZE);
+
+	bzero(&begin, sizeof(begin));
+	begin.version = SEND_VERSION;
+	begin.to_tid = SendRootB.bref.mirror_tid;
+	strlcpy(begin.to_label, to_label, sizeof(begin.to_label));
+	if (SendA) {
+		begin.flags |= SEND_BEGIN_INCREMENTAL;
+		begin.from_tid = SendRootA.bref.mirror_tid;
+		strlcpy(begin.from_label, from_label,
+			sizeof(begin.from_label));
+	}
+	bzero(&rec, sizeof(rec));
+	rec.type = SEND_REC_BEGIN;
+	send_record(&rec, NULL, NULL, &begin, sizeof(begin));
+
+	send_collect();
+
+	/*
+	 * Move or remove the names which go away, deepest first, while the
+	 * tree still looks like the base.  Objects gaining a name without
+	 * losing one are linked into the stash first.
+	 */
+	if (SendA) {
+		send_meta(SEND_REC_CREATE, SEND_STASH, &SendRootB, NULL);
+		for (i = 0; i < SendRemoved.count; ++i) {
+			ent = &SendRemoved.ents[i];
+			if (send_survives(send_inode_find(ent->inum))) {
+				ino = send_inode_get(ent->inum);
+				ino->flags |= SEND_NAME_REMOVED;
+			}
+		}
+		for (i = 0; i < SendAdded.count; ++i) {
+			ent = &SendAdded.ents[i];
+			if (ent->type == HAMMER2_OBJTYPE_DIRECTORY ||
+			    send_survives(send_inode_find(ent->inum)) == 0)
+				continue;
+			ino = send_inode_get(ent->inum);
+			if (ino->flags & (SEND_NAME_REMOVED | SEND_STASHED))
+				continue;
+			path = send_path(SendA, ent->inum);
+			stash = send_stash_path(ent->inum);
+			send_op(SEND_REC_LINK, path, stash);
+			ino->flags |= SEND_STASHED;
+			free(stash);
+			free(path);
+		}
+		if (SendRemoved.count > 1)
+			qsort(SendRemoved.ents, SendRemoved.count,
+			      sizeof(*SendRemoved.ents), send_deepest_cmp);
+		for (i = 0; i < SendRemoved.count; ++i) {
+			ent = &SendRemoved.ents[i];
+			if (send_survives(send_inode_find(ent->inum))) {
+				stash = send_stash_path(ent->inum);
+				send_op(SEND_REC_RENAME, ent->path, stash);
+				free(stash);
+				ino = send_inode_get(ent->inum);
+				ino->flags |= SEND_STASHED;
+			} else {
+				send_op(SEND_REC_REMOVE, ent->path, NULL);
+			}
+		}
+	}
+
+	/*
+	 * New names, shallowest first so that parent directories exist.
+	 */
+	if (SendAdded.count > 1)
+		qsort(SendAdded.ents, SendAdded.count,
+		      sizeof(*SendAdded.ents), send_shallowest_cmp);
+	for (i = 0; i < SendAdded.count; ++i) {
+		ent = &SendAdded.ents[i];
+		ino = send_inode_find(ent->inum);
+		if (SendA && send_survives(ino)) {
+			if (ino == NULL || (ino->flags & SEND_STASHED) == 0 ||
+			    (ino->flags & SEND_UNSTASHED)) {
+				errx(1, "%s: inode %016jx not in stash",
+				     ent->path, (uintmax_t)ent->inum);
+			}
+			stash = send_stash_path(ent->inum);
+			if (ent->type == HAMMER2_OBJTYPE_DIRECTORY) {
+				send_op(SEND_REC_RENAME, stash, ent->path);
+				ino->flags |= SEND_UNSTASHED;
+			} else {
+				send_op(SEND_REC_LINK, stash, ent->path);
+			}
+			free(stash);
+		} else if (ino == NULL || (ino->flags & SEND_IN_B) == 0) {
+			errx(1, "%s: inode %016jx missing",
+			     ent->path, (uintmax_t)ent->inum);
+		} else if (ino->flags & SEND_CREATED) {
+			send_op(SEND_REC_LINK, ino->path, ent->path);
+		} else {
+			send_object(ino, ent->path);
+		}
+	}
+
+	/*
+	 * Objects which kept a name but changed.
+	 */
+	for (i = 0; SendA && i < SEND_HSIZE; ++i) {
+		for (ino = SendInodes[i]; ino; ino = ino->next) {
+			if (send_survives(ino) == 0 ||
+			    (ino->flags & SEND_CREATED) ||
+			    ino->type_b == HAMMER2_OBJTYPE_DIRECTORY ||
+			    ino->bref_b.type != HAMMER2_BREF_TYPE_INODE)
+				continue;
+			send_update(ino);
+		}
+	}
+
+	if (SendA)
+		send_op(SEND_REC_REMOVE, SEND_STASH, NULL);
+	send_dir_attrs();
+	bzero(&rec, sizeof(rec));
+	rec.type = SEND_REC_END;
+	send_record(&rec, NULL, NULL, NULL, 0);
+	if (fflush(stdout) != 0)
+		err(1, "send");
+
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	elapsed = (ts1.tv_sec - ts0.tv_sec) +
+		  (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+	if (VerboseOpt) {
+		hammer2_image_get_stats(SendB, &stats);
+		fprintf(stderr, "send: %ju inodes, %d names removed, "
+			"%d names added\n",
+			(uintmax_t)SendStats.inodes,
+			SendRemoved.count, SendAdded.count);
+		fprintf(stderr, "send: %ju records, %ju data blocks "
+			"(%ju compressed), %s in %.3f sec\n",
+			(uintmax_t)SendStats.records,
+			(uintmax_t)SendStats.blocks,
+			(uintmax_t)SendStats.compressed,
+			sizetostr(SendStats.bytes), elapsed);
+		fprintf(stderr, "media: %ju reads, %s, "
+			"cache: %ju hits, %ju misses\n",
+			(uintmax_t)stats.media_reads,
+			sizetostr(stats.media_bytes),
+			(uintmax_t)stats.cache_hits,
+			(uintmax_t)stats.cache_misses);
+	}
+
+	free(SendBuf);
+	send_close();
+
+	return 0;
+}
+
+/************************************************************************
+ *				    DIFF				*
+ ************************************************************************/
+
+static void
+diff_add(diff_line_list_t *list, int op, hammer2_key_t inum,
+	 const char *path, const char *path2)
+{
+	diff_line_t *line;
+
+	if (list->count == list->alloc) {
+		list->alloc = list->alloc ? list->alloc * 2 : 256;
+		list->lines = realloc(list->lines,
+				      list->alloc * sizeof(*list->lines));
+		if (list->lines == NULL)
+			err(1, "realloc");
+	}
+	line = &list->lines[list->count++];
+	line->op = op;
+	line->inum = inum;
+	line->path = strdup(path);
+	line->path2 = path2 ? strdup(path2) : NULL;
+}
+
+/*
+ * An inode rewritten only because it was renamed or relinked, which
+ * updates its nominal parent, name and ctime, is not reported as
+ * modified.  Blocks are compared by their check codes, not by where
+ * they are stored, directories by their entries instead.
+ */
+static int
+diff_modified(const hammer2_image_inode_t *ip_a,
+	      const hammer2_image_inode_t *ip_b)
+{
+	hammer2_inode_meta_t meta_a = ip_a->ipdata.meta;
+	hammer2_inode_meta_t meta_b = ip_b->ipdata.meta;
+	hammer2_blockref_t bref_a;
+	hammer2_blockref_t bref_b;
+	int i;
+
+	meta_a.ctime = meta_b.ctime = 0;
+	meta_a.iparent = meta_b.iparent = 0;
+	meta_a.name_key = meta_b.name_key = 0;
+	meta_a.name_len = meta_b.name_len = 0;
+	if (bcmp(&meta_a, &meta_b, sizeof(meta_a)) != 0)
+		return 1;
+
+	if (meta_b.type == HAMMER2_OBJTYPE_DIRECTORY)
+		return 0;
+	if (meta_b.op_flags & HAMMER2_OPFLAG_DIRECTDATA) {
+		return (bcmp(ip_a->ipdata.u.data, ip_b->ipdata.u.data,
+			     sizeof(ip_b->ipdata.u.data)) != 0);
+	}
+	for (i = 0; i < HAMMER2_SET_COUNT; ++i) {
+		bref_a = ip_a->ipdata.u.blockset.blockref[i];
+		bref_b = ip_b->ipdata.u.blockset.blockref[i];
+		bref_a.data_off &= HAMMER2_OFF_MASK_RADIX;
+		bref_b.data_off &= HAMMER2_OFF_MASK_RADIX;
+		bref_a.mirror_tid = bref_b.mirror_tid = 0;
+		bref_a.modify_tid = bref_b.modify_tid = 0;
+		bref_a.update_tid = bref_b.update_tid = 0;
+		if (bcmp(&bref_a, &bref_b, sizeof(bref_a)) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+static int
+diff_inum_cmp(const void *p1, const void *p2)
+{
+	const send_dirent_t *ent1 = p1;
+	const send_dirent_t *ent2 = p2;
+
+	if (ent1->inum < ent2->inum)
+		return -1;
+	if (ent1->inum > ent2->inum)
+		return 1;
+	return strcmp(ent1->path, ent2->path);
+}
+
+static int
+diff_path_cmp(const void *p1, const void *p2)
+{
+	const diff_line_t *line1 = p1;
+	const diff_line_t *line2 = p2;
+	int r;
+
+	if ((r = strcmp(line1->path, line2->path)) != 0)
+		return r;
+	return line1->op - line2->op;
+}
+
+/*
+ * List the paths which differ between two PFSs, using the same change
+ * set as send.  Removed names are given as found in the base PFS, all
+ * other names as found in the target.  A surviving object which lost
+ * and gained a name was renamed.
+ */
+int
+cmd_diff(const char *special, const char *from_label, const char *to_label)
+{
+	hammer2_image_inode_t ip_a;
+	hammer2_image_inode_t ip_b;
+	diff_line_list_t list;
+	diff_line_t *line;
+	send_dirent_t *ra, *aa;
+	send_inode_t *ino;
+	hammer2_key_t inum;
+	char *devpath;
+	char *path;
+	int ri, ai, nr, na;
+	int survives;
+	int root_changed;
+	int i;
+
+	devpath = get_hammer2_devpath(special);
+	send_open(devpath, from_label, to_label);
+	free(devpath);
+	send_collect();
+
+	/*
+	 * Pair up the removed and added names of each object.
+	 */
+	bzero(&list, sizeof(list));
+	if (SendRemoved.count > 1)
+		qsort(SendRemoved.ents, SendRemoved.count,
+		      sizeof(*SendRemoved.ents), diff_inum_cmp);
+	if (SendAdded.count > 1)
+		qsort(SendAdded.ents, SendAdded.count,
+		      sizeof(*SendAdded.ents), diff_inum_cmp);
+	ri = ai = 0;
+	while (ri < SendRemoved.count || ai < SendAdded.count) {
+		if (ai == SendAdded.count ||
+		    (ri < SendRemoved.count &&
+		     SendRemoved.ents[ri].inum < SendAdded.ents[ai].inum))
+			inum = SendRemoved.ents[ri].inum;
+		else
+			inum = SendAdded.ents[ai].inum;
+		ra = &SendRemoved.ents[ri];
+		for (nr = 0; ri < SendRemoved.count &&
+		     SendRemoved.ents[ri].inum == inum; ++ri)
+			++nr;
+		aa = &SendAdded.ents[ai];
+		for (na = 0; ai < SendAdded.count &&
+		     SendAdded.ents[ai].inum == inum; ++ai)
+			++na;
+		survives = send_survives(send_inode_find(inum));
+		for (i = 0; i < nr || i < na; ++i) {
+			if (survives && i < nr && i < na)
+				diff_add(&list, 'R', inum, ra[i].path,
+					 aa[i].path);
+			if ((survives == 0 || i >= na) && i < nr)
+				diff_add(&list, '-', inum, ra[i].path, NULL);
+			if ((survives == 0 || i >= nr) && i < na)
+				diff_add(&list, '+', inum, aa[i].path, NULL);
+		}
+	}
+
+	/*
+	 * Surviving objects whose inode changed, directories whose entries
+	 * changed.  A snapshot gets a new root inode, so the root directory
+	 * only counts as modified in the latter case.
+	 */
+	root_changed = 0;
+	for (i = 0; i < SendRemoved.count + SendAdded.count; ++i) {
+		if (i < SendRemoved.count)
+			inum = SendRemoved.ents[i].parent;
+		else
+			inum = SendAdded.ents[i - SendRemoved.count].parent;
+		if ((ino = send_inode_find(inum)) != NULL)
+			ino->flags |= SEND_DIR_CHANGED;
+		else if (inum == SendRootB.ipdata.meta.inum)
+			root_changed = 1;
+	}
+	if (root_changed)
+		diff_add(&list, 'M', SendRootB.ipdata.meta.inum, "", NULL);
+	for (i = 0; i < SEND_HSIZE; ++i) {
+		for (ino = SendInodes[i]; ino; ino = ino->next) {
+			if ((ino->flags & (SEND_IN_A | SEND_IN_B)) !=
+			    (SEND_IN_A | SEND_IN_B) ||
+			    send_survives(ino) == 0)
+				continue;
+			if ((ino->flags & SEND_DIR_CHANGED) == 0) {
+				send_get_inode(SendA, &ino->bref_a, &ip_a);
+				send_get_inode(SendB, &ino->bref_b, &ip_b);
+				if (diff_modified(&ip_a, &ip_b) == 0)
+					continue;
+			}
+			path = send_path(SendB, ino->inum);
+			diff_add(&list, 'M', ino->inum, path, NULL);
+			free(path);
+		}
+	}
+
+	if (list.count > 1)
+		qsort(list.lines, list.count, sizeof(*list.lines),
+		      diff_path_cmp);
+	for (i = 0; i < list.count; ++i) {
+		line = &list.lines[i];
+		printf("%c %016jx /%s", line->op, (uintmax_t)line->inum,
+		       line->path);
+		if (line->path2)
+			printf(" -> /%s", line->path2);
+		printf("\n");
+		free(line->path);
+		free(line->path2);
+	}
+	free(list.lines);
+	if (fflush(stdout) != 0)
+		err(1, "diff");
+	send_close();
+
+	return 0;
+}
+
+/************************************************************************
+ *				  RECEIVE				*
+ ************************************************************************/
+
+static void
+recv_error(const char *path, const char *op)
+{
+	warn("%s: %s", *path ? path : ".", op);
+	++Recv.errors;
+}
+
+static void
+recv_read(void *buf, size_t bytes)
+{
+	if (bytes && fread(buf, bytes, 1, stdin) != 1) {
+		if (ferror(stdin))
+			err(1, "receive");
+		errx(1, "receive: truncated stream");
+	}
+	Recv.bytes += bytes;
+}
+
+/*
+ * Paths must stay below the destination directory.
+ */
+static void
+recv_check_path(const char *path)
+{
+	const char *scan = path;
+
+	if (*path == '/')
+		errx(1, "receive: absolute path %s in stream", path);
+	while (*scan) {
+		if (scan[0] == '.' && scan[1] == '.' &&
+		    (scan[2] == '/' || scan[2] == 0))
+			errx(1, "receive: bad path %s in stream", path);
+		while (*scan && *scan != '/')
+			++scan;
+		while (*scan == '/')
+			++scan;
+	}
+}
+
+static void
+recv_file_close(void)
+{
+	if (Recv.fd >= 0)
+		close(Recv.fd);
+	free(Recv.path);
+	Recv.path = NULL;
+	Recv.fd = -1;
+}
+
+static int
+recv_file_open(const char *path)
+{
+	if (Recv.fd >= 0 && strcmp(Recv.path, path) == 0)
+		return 0;
+	recv_file_close();
+	Recv.fd = openat(Recv.dfd, path, O_RDWR | O_NOFOLLOW);
+	if (Recv.fd < 0) {
+		recv_error(path, "open");
+		return -1;
+	}
+	Recv.path = strdup(path);
+	Recv.zero_from = (hammer2_off_t)-1;
+
+	return 0;
+}
+
+static void
+recv_remove(int dfd, const char *path)
+{
+	struct dirent *den;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	if (fstatat(dfd, path, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+		recv_error(path, "stat");
+		return;
+	}
+	if (S_ISDIR(st.st_mode) == 0) {
+		if (unlinkat(dfd, path, 0) < 0)
+			recv_error(path, "unlink");
+		return;
+	}
+	if (unlinkat(dfd, path, AT_REMOVEDIR) == 0)
+		return;
+
+	fd = openat(dfd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (fd < 0 || (dir = fdopendir(fd)) == NULL) {
+		recv_error(path, "open");
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	while ((den = readdir(dir)) != NULL) {
+		if (strcmp(den->d_name, ".") == 0 ||
+		    strcmp(den->d_name, "..") == 0)
+			continue;
+		recv_remove(fd, den->d_name);
+	}
+	closedir(dir);
+	if (unlinkat(dfd, path, AT_REMOVEDIR) < 0)
+		recv_error(path, "rmdir");
+}
+
+/*
+ * Renaming onto another link of the same file is a no-op, which
+ * happens when moving the second name of a hardlink into the stash.
+ */
+static void
+recv_rename(const char *from, const char *to)
+{
+	struct stat st1, st2;
+
+	if (fstatat(Recv.dfd, from, &st1, AT_SYMLINK_NOFOLLOW) == 0 &&
+	    fstatat(Recv.dfd, to, &st2, AT_SYMLINK_NOFOLLOW) == 0 &&
+	    st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino) {
+		if (unlinkat(Recv.dfd, from, 0) < 0)
+			recv_error(from, "unlink");
+		return;
+	}
+	if (renameat(Recv.dfd, from, Recv.dfd, to) < 0)
+		recv_error(to, "rename");
+}
+
+static void
+recv_create(const char *path, const hammer2_inode_meta_t *meta,
+	    const char *target)
+{
+	int fd;
+
+	switch(meta->type) {
+	case HAMMER2_OBJTYPE_DIRECTORY:
+		if (mkdirat(Recv.dfd, path, 0700) < 0)
+			recv_error(path, "mkdir");
+		break;
+	case HAMMER2_OBJTYPE_REGFILE:
+		recv_file_close();
+		fd = openat(Recv.dfd, path,
+			    O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+		if (fd < 0) {
+			recv_error(path, "create");
+			break;
+		}
+		Recv.fd = fd;
+		Recv.path = strdup(path);
+		Recv.zero_from = 0;
+		break;
+	case HAMMER2_OBJTYPE_SOFTLINK:
+		if (symlinkat(target, Recv.dfd, path) < 0)
+			recv_error(path, "symlink");
+		break;
+	case HAMMER2_OBJTYPE_FIFO:
+		if (mkfifoat(Recv.dfd, path, 0600) < 0)
+			recv_error(path, "mkfifo");
+		break;
+	case HAMMER2_OBJTYPE_CDEV:
+	case HAMMER2_OBJTYPE_BDEV:
+		if (mknodat(Recv.dfd, path,
+			    (meta->type == HAMMER2_OBJTYPE_CDEV ?
+			     S_IFCHR : S_IFBLK) | 0600,
+			    makedev(meta->rmajor, meta->rminor)) < 0)
+			recv_error(path, "mknod");
+		break;
+	default:
+		if (VerboseOpt)
+			printf("%s: skipping %s\n", path,
+			       hammer2_iptype_to_str(meta->type));
+		break;
+	}
+}
+
+/*
+ * Ownership is only restored when running as root.
+ */
+static void
+recv_attrs(const char *path, const hammer2_inode_meta_t *meta)
+{
+	hammer2_image_inode_t ip;
+	struct timespec ts[2];
+	struct stat st;
+
+	if (*path == 0)
+		path = ".";
+	bzero(&ip, sizeof(ip));
+	ip.ipdata.meta = *meta;
+	hammer2_image_stat(&ip, &st);
+
+	if (geteuid() == 0 &&
+	    fchownat(Recv.dfd, path, st.st_uid, st.st_gid,
+		     AT_SYMLINK_NOFOLLOW) < 0)
+		recv_error(path, "chown");
+	if (meta->type != HAMMER2_OBJTYPE_SOFTLINK &&
+	    fchmodat(Recv.dfd, path, meta->mode & ALLPERMS, 0) < 0)
+		recv_error(path, "chmod");
+	ts[0] = st.st_atim;
+	ts[1] = st.st_mtim;
+	if (utimensat(Recv.dfd, path, ts, AT_SYMLINK_NOFOLLOW) < 0)
+		recv_error(path, "utimensat");
+	if (meta->type != HAMMER2_OBJTYPE_SOFTLINK && meta->uflags &&
+	    chflagsat(Recv.dfd, path, meta->uflags, 0) < 0)
+		recv_error(path, "chflags");
+}
+
+static int
+recv_zero(const char *buf, size_t bytes)
+{
+	size_t i;
+
+	for (i = 0; i < bytes; ++i) {
+		if (buf[i])
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Write a block, decompressing it first if needed.  Zero blocks need
+ * not be written to a new file, leaving holes.
+ */
+static void
+recv_write(const char *path, const send_rec_t *rec, char *data,
+	   char *dbuf)
+{
+	size_t bytes = rec->datalen;
+	int status;
+
+	if (recv_file_open(path) < 0)
+		return;
+	switch(rec->comp) {
+	case HAMMER2_COMP_NONE:
+		if (bytes > rec->size)
+			bytes = rec->size;
+		break;
+	case HAMMER2_COMP_LZ4:
+	case HAMMER2_COMP_ZLIB:
+		if (rec->size > HAMMER2_PBUFSIZE)
+			errx(1, "receive: %s: bad block size", path);
+		if (rec->comp == HAMMER2_COMP_LZ4)
+			data = hammer2_decompress_LZ4(data, bytes, dbuf,
+						      rec->size, &status);
+		else
+			data = hammer2_decompress_ZLIB(data, bytes, dbuf,
+						       rec->size, &status);
+		if (status == 0) {
+			warnx("%s: offset %016jx: decompression failed",
+			      path, (uintmax_t)rec->offset);
+			++Recv.errors;
+			return;
+		}
+		bytes = rec->size;
+		break;
+	default:
+		errx(1, "receive: %s: unknown compression %d", path,
+		     rec->comp);
+	}
+	if (rec->offset >= Recv.zero_from && recv_zero(data, bytes))
+		return;
+	if (pwrite(Recv.fd, data, bytes, rec->offset) != (ssize_t)bytes)
+		recv_error(path, "write");
+}
+
+/*
+ * Zero a range which is no longer backed by data, without extending the
+ * file.
+ */
+static void
+recv_hole(const char *path, const send_rec_t *rec, char *zbuf)
+{
+	struct stat st;
+	hammer2_off_t off = rec->offset;
+	hammer2_off_t end = rec->offset + rec->size;
+	size_t n;
+
+	if (recv_file_open(path) < 0)
+		return;
+	if (fstat(Recv.fd, &st) < 0) {
+		recv_error(path, "stat");
+		return;
+	}
+	if (end > (hammer2_off_t)st.st_size)
+		end = st.st_size;
+	if (off >= Recv.zero_from)
+		return;
+	while (off < end) {
+		n = end - off;
+		if (n > HAMMER2_PBUFSIZE)
+			n = HAMMER2_PBUFSIZE;
+		if (pwrite(Recv.fd, zbuf, n, off) != (ssize_t)n) {
+			recv_error(path, "write");
+			return;
+		}
+		off += n;
+	}
+}
+
+int
+cmd_receive(const char *destdir)
+{
+	send_begin_t *begin;
+	send_rec_t rec;
+	struct timespec ts0, ts1;
+	double elapsed;
+	char *path1;
+	char *path2;
+	char *data;
+	char *dbuf;
+	char *zbuf;
+	uint32_t crc;
+	uint32_t rcrc;
+	int done = 0;
+
+	if (mkdir(destdir, 0755) < 0 && errno != EEXIST)
+		err(1, "%s", destdir);
+	Recv.dfd = open(destdir, O_RDONLY | O_DIRECTORY);
+	if (Recv.dfd < 0)
+		err(1, "%s", destdir);
+	path1 = malloc(SEND_MAXPATH + 1);
+	path2 = malloc(SEND_MAXPATH + 1);
+	data = malloc(SEND_MAXDATA + 1);
+	dbuf = malloc(HAMMER2_PBUFSIZE);
+	zbuf = calloc(1, HAMMER2_PBUFSIZE);
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+
+	while (done == 0) {
+		recv_read(&rec, sizeof(rec));
+		if (rec.magic != SEND_REC_MAGIC)
+			errx(1, "receive: bad record magic");
+		if (rec.path1len > SEND_MAXPATH ||
+		    rec.path2len > SEND_MAXPATH ||
+		    rec.datalen > SEND_MAXDATA)
+			errx(1, "receive: bad record size");
+		recv_read(path1, rec.path1len);
+		recv_read(path2, rec.path2len);
+		recv_read(data, rec.datalen);
+		path1[rec.path1len] = 0;
+		path2[rec.path2len] = 0;
+		data[rec.datalen] = 0;
+
+		rcrc = rec.crc;
+		rec.crc = 0;
+		crc = hammer2_icrc32(&rec, sizeof(rec));
+		crc = hammer2_icrc32c(path1, rec.path1len, crc);
+		crc = hammer2_icrc32c(path2, rec.path2len, crc);
+		crc = hammer2_icrc32c(data, rec.datalen, crc);
+		if (crc != rcrc)
+			errx(1, "receive: record %ju: crc mismatch",
+			     (uintmax_t)Recv.records);
+		recv_check_path(path1);
+		recv_check_path(path2);
+		if ((rec.type == SEND_REC_CREATE ||
+		     rec.type == SEND_REC_ATTR) &&
+		    rec.datalen < sizeof(hammer2_inode_meta_t))
+			errx(1, "receive: short record");
+		++Recv.records;
+
+		if (VerboseOpt >= 2 && rec.path1len)
+			printf("%s\n", path1);
+
+		switch(rec.type) {
+		case SEND_REC_BEGIN:
+			if (rec.datalen != sizeof(*begin))
+				errx(1, "receive: bad stream header");
+			begin = (void *)data;
+			if (begin->version != SEND_VERSION)
+				errx(1, "receive: unsupported stream "
+				     "version %u", begin->version);
+			if (VerboseOpt &&
+			    (begin->flags & SEND_BEGIN_INCREMENTAL)) {
+				printf("receive: %s (%016jx) -> %s (%016jx)\n",
+				       begin->from_label,
+				       (uintmax_t)begin->from_tid,
+				       begin->to_label,
+				       (uintmax_t)begin->to_tid);
+			} else if (VerboseOpt) {
+				printf("receive: %s (%016jx)\n",
+				       begin->to_label,
+				       (uintmax_t)begin->to_tid);
+			}
+			break;
+		case SEND_REC_END:
+			done = 1;
+			break;
+		case SEND_REC_RENAME:
+			recv_file_close();
+			recv_rename(path1, path2);
+			break;
+		case SEND_REC_LINK:
+			recv_file_close();
+			if (linkat(Recv.dfd, path1, Recv.dfd, path2, 0) < 0)
+				recv_error(path2, "link");
+			break;
+		case SEND_REC_REMOVE:
+			recv_file_close();
+			recv_remove(Recv.dfd, path1);
+			break;
+		case SEND_REC_CREATE:
+			recv_create(path1, (void *)data,
+				    data + sizeof(hammer2_inode_meta_t));
+			break;
+		case SEND_REC_WRITE:
+			recv_write(path1, &rec, data, dbuf);
+			break;
+		case SEND_REC_HOLE:
+			recv_hole(path1, &rec, zbuf);
+			break;
+		case SEND_REC_TRUNCATE:
+			if (recv_file_open(path1) < 0)
+				break;
+			if (ftruncate(Recv.fd, rec.size) < 0)
+				recv_error(path1, "truncate");
+			if (rec.size == 0)
+				Recv.zero_from = 0;
+			break;
+		case SEND_REC_ATTR:
+			recv_file_close();
+			recv_attrs(path1, (void *)data);
+			break;
+		default:
+			errx(1, "receive: unknown record type %d", rec.type);
+		}
+	}
+	recv_file_close();
+	close(Recv.dfd);
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+	elapsed = (ts1.tv_sec - ts0.tv_sec) +
+		  (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+	if (elapsed <= 0.0)
+		elapsed = 1e-9;
+	if (QuietOpt == 0) {
+		printf("receive: %ju records, %s in %.3f sec, %.1f MB/s, "
+		       "%ju errors\n",
+		       (uintmax_t)Recv.records, sizetostr(Recv.bytes),
+		       elapsed, Recv.bytes / elapsed / (1024 * 1024),
+		       (uintmax_t)Recv.errors);
+	}
+	free(path1);
+	free(path2);
+	free(data);
+	free(dbuf);
+	free(zbuf);
+
+	return (Recv.errors ? 1 : 0);
+}
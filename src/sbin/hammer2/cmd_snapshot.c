@@ -102,6 +102,11 @@ cmd_pfs_snapshot(const char *sel_path, const char *path, const char *label,
 	if (ioctl(fd, HAMMER2IOC_PFS_SNAPSHOT, &pfs) < 0) {
 		perror("ioctl");
 		ecode = 1;
+	} else if (VerboseOpt > 0) {
+		printf("created snapshot %s in %u.%03ums, "
+		       "PFS root held %uus\n",
+		       label, pfs.snap_usecs / 1000, pfs.snap_usecs % 1000,
+		       pfs.snap_stall_usecs);
 	} else {
 		printf("created snapshot %s\n", label);
 	}
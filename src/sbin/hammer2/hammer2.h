@@ -78,6 +78,7 @@ extern int VerboseOpt;
 extern int QuietOpt;
 extern int RecurseOpt;
 extern size_t MemOpt;
+extern int NThreadsOpt;
 
 /*
  * Hammer2 command APIs
@@ -101,13 +102,26 @@ int cmd_emergency_mode(const char *sel_path, int enable, int ac,
     const char **av);
 int cmd_growfs(const char *sel_path, int ac, const char **av);
 int cmd_show(const char *devpath, int which);
+int cmd_show_option(int ch, const char *arg);
+int cmd_freemap_stats(const char *special);
+int cmd_du_report(const char *special);
 int cmd_volume_list(int ac, char **av);
 int cmd_setcomp(const char *comp_str, char **paths);
 int cmd_setcheck(const char *comp_str, char **paths);
+int cmd_punch(const char *path, const char *offset_str,
+			const char *length_str);
 int cmd_bulkfree(const char *dir_path);
 int cmd_cleanup(const char *dir_path);
 int cmd_recover(const char *devpath, const char *filename,
 			const char *destdir, int strict, int isafile);
+int cmd_ls(const char *special, int ac, const char **av);
+int cmd_cat(const char *special, int ac, const char **av);
+int cmd_extract(const char *special, const char *path, const char *destdir);
+int cmd_send(const char *special, const char *from_label,
+			const char *to_label);
+int cmd_receive(const char *destdir);
+int cmd_diff(const char *special, const char *from_label,
+			const char *to_label);
 
 void print_inode(const char *path);
 
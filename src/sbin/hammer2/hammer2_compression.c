@@ -41,12 +41,15 @@
 
 #define DEBUFSIZE	HAMMER2_PBUFSIZE
 
-static char OutBuf[DEBUFSIZE + 128];	/* allow for some overflow */
-
+/*
+ * Decompress into the caller's (outbuf), which must be able to hold
+ * (outsize) bytes.  Returns (outbuf).
+ */
 void *
-hammer2_decompress_LZ4(void *inbuf, size_t insize, size_t outsize,
-		       int *statusp)
+hammer2_decompress_LZ4(void *inbuf, size_t insize, void *outbuf,
+		       size_t outsize, int *statusp)
 {
+	char *obuf = outbuf;
 	int result;
 	int cinsize;
 
@@ -56,29 +59,30 @@ hammer2_decompress_LZ4(void *inbuf, size_t insize, size_t outsize,
 	cinsize = *(const int *)inbuf;
 	if (cinsize > (int)insize) {
 		printf("FAIL1\n");
-		bzero(OutBuf, outsize);
-		return OutBuf;
+		bzero(obuf, outsize);
+		return obuf;
 	}
 
-	result = LZ4_decompress_safe((char *)inbuf + 4, OutBuf,
+	result = LZ4_decompress_safe((char *)inbuf + 4, obuf,
 				     cinsize, outsize);
 	if (result < 0) {
-		bzero(OutBuf, outsize);
+		bzero(obuf, outsize);
 	} else {
 		*statusp = 1;
 		if (result < (int)outsize)
-			bzero(OutBuf + result, outsize - result);
+			bzero(obuf + result, outsize - result);
 	}
 	if (result < 0)
 		printf("LZ4 decompression failure\n");
 
-	return OutBuf;
+	return obuf;
 }
 
 void *
-hammer2_decompress_ZLIB(void *inbuf, size_t insize, size_t outsize,
-			int *statusp)
+hammer2_decompress_ZLIB(void *inbuf, size_t insize, void *outbuf,
+			size_t outsize, int *statusp)
 {
+	char *obuf = outbuf;
 	z_stream strm_decompress;
 	int ret;
 
@@ -91,24 +95,24 @@ hammer2_decompress_ZLIB(void *inbuf, size_t insize, size_t outsize,
 	ret = inflateInit(&strm_decompress);
 
 	if (ret != Z_OK) {
-		bzero(OutBuf, outsize);
+		bzero(obuf, outsize);
 		printf("ZLIB1 decompression failure\n");
 	} else {
 		strm_decompress.next_in = inbuf;
-		strm_decompress.next_out = (void *)OutBuf;
+		strm_decompress.next_out = (void *)obuf;
 		strm_decompress.avail_in = insize;
 		strm_decompress.avail_out = outsize;
 		ret = inflate(&strm_decompress, Z_FINISH);
 		if (ret != Z_STREAM_END) {
-			bzero(OutBuf, outsize);
+			bzero(obuf, outsize);
 			printf("ZLIB2 decompression failure\n");
 		} else {
 			ret = outsize - strm_decompress.avail_out;
 			if (ret < (int)outsize)
-				bzero(OutBuf + ret, strm_decompress.avail_out);
+				bzero(obuf + ret, strm_decompress.avail_out);
 			*statusp = 1;
 		}
 		ret = inflateEnd(&strm_decompress);
 	}
-	return OutBuf;
+	return obuf;
 }
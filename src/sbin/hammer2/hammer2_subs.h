@@ -94,6 +94,7 @@ uint32_t calculate_crc32c(uint32_t, const void *, size_t);
 
 char **get_hammer2_mounts(int *acp);
 void put_hammer2_mounts(int ac, char **av);
+char *get_hammer2_devpath(const char *path);
 
 void hammer2_init_ondisk(hammer2_ondisk_t *fsp);
 void hammer2_install_volume(hammer2_volume_t *vol, int fd, int id,
@@ -121,8 +122,8 @@ hammer2_off_t hammer2_get_total_size(void);
 hammer2_volume_data_t* hammer2_read_root_volume_header(void);
 
 void *hammer2_decompress_LZ4(void *inbuf, size_t insize,
-			size_t outsize, int *statusp);
+			void *outbuf, size_t outsize, int *statusp);
 void *hammer2_decompress_ZLIB(void *inbuf, size_t insize,
-			size_t outsize, int *statusp);
+			void *outbuf, size_t outsize, int *statusp);
 
 #endif /* !HAMMER2_HAMMER2_SUBS_H_ */
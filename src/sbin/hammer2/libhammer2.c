@@ -0,0 +1,1621 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Read-only HAMMER2 image access, see libhammer2.h.
+ *
+ * The topology is walked the same way the kernel does it.  The volume
+ * header's sroot_blockset leads to the super-root inode whose block table
+ * holds the PFS root inodes keyed by the hash of their label.  A PFS
+ * root's block table indexes every inode of the PFS by inode number as
+ * well as the root directory's entries, which are keyed by directory
+ * hash (bit 63 set).  Other directories only hold directory entries.
+ * Regular file data is indexed by file offset below the inode, with
+ * indirect blocks covering ranges of keys in between.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <uuid.h>
+
+#include <openssl/sha.h>
+
+#include <fs/hammer2/hammer2_disk.h>
+#include <fs/hammer2/hammer2_xxhash.h>
+
+#include "hammer2_subs.h"
+#include "libhammer2.h"
+
+#define IMAGE_MAXDEPTH		32	/* indirect block recursion limit */
+#define IMAGE_SCAN_DONE		(-1)	/* callback found what it wanted */
+#define IMAGE_CHECK_SIZE	sizeof(((hammer2_blockref_t *)NULL)->check)
+
+typedef struct image_cbuf {
+	TAILQ_ENTRY(image_cbuf) entry;	/* LRU, head is oldest */
+	struct image_cbuf *next;	/* hash chain */
+	hammer2_off_t	data_off;
+	size_t		bytes;
+	uint8_t		methods;
+	char		check[IMAGE_CHECK_SIZE];
+	char		data[];
+} image_cbuf_t;
+
+TAILQ_HEAD(image_cbuf_list, image_cbuf);
+
+/*
+ * State shared by all PFS views of an image.
+ */
+typedef struct image_shared {
+	pthread_mutex_t	lock;		/* cache, stats and path memos */
+	image_cbuf_t	**hash;
+	size_t		hmask;
+	struct image_cbuf_list lru;
+	size_t		cached;		/* bytes */
+	size_t		cachesize;
+	hammer2_image_stats_t stats;
+	hammer2_volume_data_t voldata;
+	hammer2_image_inode_t sroot;
+	int		refs;
+} image_shared_t;
+
+/*
+ * Remembers the directory entry an inode was found under, for
+ * hammer2_image_path().
+ */
+typedef struct image_pmemo {
+	struct image_pmemo *next;
+	hammer2_key_t	inum;
+	hammer2_key_t	parent;
+	char		*name;
+} image_pmemo_t;
+
+#define IMAGE_PMEMO_HSIZE	4096
+#define IMAGE_PATH_MAXDEPTH	1024
+
+struct hammer2_image {
+	image_shared_t	*sh;
+	hammer2_image_inode_t iroot;
+	char		*label;
+	image_pmemo_t	**pmemo;	/* allocated on first use */
+	int		pwalked;	/* whole PFS is in pmemo */
+};
+
+typedef int (*image_scan_t)(hammer2_image_t *img,
+			const hammer2_blockref_t *bref, void *arg);
+
+typedef struct image_name_info {
+	const char	*name;
+	size_t		len;
+	hammer2_key_t	inum;
+	int		isinode;	/* found an INODE, (ip) is valid */
+	hammer2_image_inode_t *ip;
+} image_name_info_t;
+
+typedef struct image_dir_info {
+	hammer2_image_readdir_t func;
+	void		*arg;
+	hammer2_image_dirent_t dent;
+} image_dir_info_t;
+
+typedef struct image_pmemo_info {
+	hammer2_image_t	*img;
+	hammer2_key_t	parent;
+	hammer2_key_t	*subdirs;	/* NULL unless recursing */
+	int		nsubdirs;
+	int		asubdirs;
+} image_pmemo_info_t;
+
+/*
+ * hammer2_image_diff() keeps a stack of blockrefs per side, the lowest
+ * key on top.
+ */
+typedef struct image_diff_elm {
+	hammer2_blockref_t bref;
+	int		depth;
+} image_diff_elm_t;
+
+typedef struct image_diff_side {
+	image_diff_elm_t *elms;
+	int		count;
+	int		alloc;
+} image_diff_side_t;
+
+typedef struct image_data_info {
+	hammer2_blockref_t *brefs;
+	int		count;
+	int		alloc;
+} image_data_info_t;
+
+static int image_check(hammer2_image_t *img, const hammer2_blockref_t *bref,
+			const void *data, size_t bytes);
+static int image_read_media(hammer2_image_t *img, hammer2_off_t off,
+			void *buf, size_t bytes);
+static int image_read_bref(hammer2_image_t *img,
+			const hammer2_blockref_t *bref, void *buf,
+			size_t *bytesp);
+static int image_read_inode(hammer2_image_t *img,
+			const hammer2_blockref_t *bref,
+			hammer2_image_inode_t *ip);
+static int image_scan(hammer2_image_t *img, const hammer2_blockref_t *base,
+			int count, hammer2_key_t key_beg, hammer2_key_t key_end,
+			image_scan_t func, void *arg, int depth);
+static int image_scan_inode(hammer2_image_t *img,
+			const hammer2_image_inode_t *ip,
+			hammer2_key_t key_beg, hammer2_key_t key_end,
+			image_scan_t func, void *arg);
+static int image_dir_lookup(hammer2_image_t *img,
+			const hammer2_image_inode_t *dip,
+			const char *name, size_t len, hammer2_image_inode_t *ip);
+
+static __inline
+size_t
+image_hash(const hammer2_image_t *img, hammer2_off_t data_off)
+{
+	return (((data_off >> HAMMER2_RADIX_MIN) ^
+		 (data_off >> (HAMMER2_RADIX_MIN + 16))) & img->sh->hmask);
+}
+
+/*
+ * Validate the data against the check code of its blockref.  Blocks with
+ * check codes disabled are accepted.
+ */
+static int
+image_check(hammer2_image_t *img, const hammer2_blockref_t *bref,
+	    const void *data, size_t bytes)
+{
+	SHA256_CTX hash_ctx;
+	union {
+		uint8_t digest[SHA256_DIGEST_LENGTH];
+		uint64_t digest64[SHA256_DIGEST_LENGTH/8];
+	} u;
+	int success = 0;
+
+	switch(HAMMER2_DEC_CHECK(bref->methods)) {
+	case HAMMER2_CHECK_NONE:
+	case HAMMER2_CHECK_DISABLED:
+		success = 1;
+		break;
+	case HAMMER2_CHECK_ISCSI32:
+		success = (bref->check.iscsi32.value ==
+			   hammer2_icrc32(data, bytes));
+		break;
+	case HAMMER2_CHECK_XXHASH64:
+		success = (bref->check.xxhash64.value ==
+			   XXH64(data, bytes, XXH_HAMMER2_SEED));
+		break;
+	case HAMMER2_CHECK_SHA192:
+		SHA256_Init(&hash_ctx);
+		SHA256_Update(&hash_ctx, data, bytes);
+		SHA256_Final(u.digest, &hash_ctx);
+		u.digest64[2] ^= u.digest64[3];
+		success = (memcmp(u.digest, bref->check.sha192.data,
+				  sizeof(bref->check.sha192.data)) == 0);
+		break;
+	case HAMMER2_CHECK_FREEMAP:
+		success = (bref->check.freemap.icrc32 ==
+			   hammer2_icrc32(data, bytes));
+		break;
+	}
+	if (success == 0) {
+		pthread_mutex_lock(&img->sh->lock);
+		++img->sh->stats.check_errors;
+		pthread_mutex_unlock(&img->sh->lock);
+	}
+	return success;
+}
+
+/*
+ * Read (bytes) of media at (off), which must not cross a volume boundary.
+ */
+static int
+image_read_media(hammer2_image_t *img, hammer2_off_t off, void *buf,
+		 size_t bytes)
+{
+	hammer2_volume_t *vol;
+	hammer2_off_t poff;
+	size_t done = 0;
+	ssize_t n;
+
+	vol = hammer2_get_volume(off);
+	if (vol == NULL)
+		return EIO;
+	poff = off - vol->offset;
+	if (poff + bytes > vol->size)
+		return EIO;
+
+	while (done < bytes) {
+		n = pread(vol->fd, (char *)buf + done, bytes - done,
+			  poff + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return EIO;
+		done += n;
+	}
+	pthread_mutex_lock(&img->sh->lock);
+	++img->sh->stats.media_reads;
+	img->sh->stats.media_bytes += bytes;
+	pthread_mutex_unlock(&img->sh->lock);
+
+	return 0;
+}
+
+/*
+ * Read and verify the media block referenced by a metadata blockref into
+ * (buf), which must hold HAMMER2_PBUFSIZE bytes.  Blocks are cached by
+ * data_off along with the check code they were verified against, so a
+ * stale blockref pointing at a reused block still misses.
+ */
+static int
+image_read_bref(hammer2_image_t *img, const hammer2_blockref_t *bref,
+		void *buf, size_t *bytesp)
+{
+	image_cbuf_t *cbuf;
+	image_cbuf_t **cbufp;
+	hammer2_off_t off;
+	size_t bytes;
+	int radix;
+	int error;
+
+	radix = bref->data_off & HAMMER2_OFF_MASK_RADIX;
+	if (radix == 0) {
+		*bytesp = 0;
+		return 0;
+	}
+	if (radix < HAMMER2_RADIX_MIN || radix > HAMMER2_RADIX_MAX)
+		return EIO;
+	bytes = (size_t)1 << radix;
+	off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
+	*bytesp = bytes;
+
+	pthread_mutex_lock(&img->sh->lock);
+	for (cbuf = img->sh->hash[image_hash(img, off)]; cbuf;
+	     cbuf = cbuf->next) {
+		if (cbuf->data_off == bref->data_off &&
+		    cbuf->methods == bref->methods &&
+		    bcmp(cbuf->check, &bref->check, IMAGE_CHECK_SIZE) == 0) {
+			TAILQ_REMOVE(&img->sh->lru, cbuf, entry);
+			TAILQ_INSERT_TAIL(&img->sh->lru, cbuf, entry);
+			bcopy(cbuf->data, buf, bytes);
+			++img->sh->stats.cache_hits;
+			pthread_mutex_unlock(&img->sh->lock);
+			return 0;
+		}
+	}
+	++img->sh->stats.cache_misses;
+	pthread_mutex_unlock(&img->sh->lock);
+
+	error = image_read_media(img, off, buf, bytes);
+	if (error)
+		return error;
+	if (image_check(img, bref, buf, bytes) == 0)
+		return EIO;
+
+	cbuf = malloc(sizeof(*cbuf) + bytes);
+	if (cbuf == NULL)
+		return 0;
+	cbuf->data_off = bref->data_off;
+	cbuf->bytes = bytes;
+	cbuf->methods = bref->methods;
+	bcopy(&bref->check, cbuf->check, IMAGE_CHECK_SIZE);
+	bcopy(buf, cbuf->data, bytes);
+
+	pthread_mutex_lock(&img->sh->lock);
+	while (img->sh->cached + bytes > img->sh->cachesize &&
+	       !TAILQ_EMPTY(&img->sh->lru)) {
+		image_cbuf_t *scan = TAILQ_FIRST(&img->sh->lru);
+
+		cbufp = &img->sh->hash[image_hash(img, scan->data_off &
+					      ~HAMMER2_OFF_MASK_RADIX)];
+		while (*cbufp != scan)
+			cbufp = &(*cbufp)->next;
+		*cbufp = scan->next;
+		TAILQ_REMOVE(&img->sh->lru, scan, entry);
+		img->sh->cached -= scan->bytes;
+		free(scan);
+	}
+	cbufp = &img->sh->hash[image_hash(img, off)];
+	cbuf->next = *cbufp;
+	*cbufp = cbuf;
+	TAILQ_INSERT_TAIL(&img->sh->lru, cbuf, entry);
+	img->sh->cached += bytes;
+	pthread_mutex_unlock(&img->sh->lock);
+
+	return 0;
+}
+
+static int
+image_read_inode(hammer2_image_t *img, const hammer2_blockref_t *bref,
+		 hammer2_image_inode_t *ip)
+{
+	char buf[HAMMER2_PBUFSIZE];
+	size_t bytes;
+	int error;
+
+	error = image_read_bref(img, bref, buf, &bytes);
+	if (error)
+		return error;
+	if (bytes != sizeof(ip->ipdata))
+		return EIO;
+	ip->bref = *bref;
+	bcopy(buf, &ip->ipdata, sizeof(ip->ipdata));
+
+	return 0;
+}
+
+/*
+ * Call (func) for every non-indirect blockref overlapping the key range,
+ * recursing through indirect blocks.  A non-zero return from (func) ends
+ * the scan and is returned.
+ */
+static int
+image_scan(hammer2_image_t *img, const hammer2_blockref_t *base, int count,
+	   hammer2_key_t key_beg, hammer2_key_t key_end,
+	   image_scan_t func, void *arg, int depth)
+{
+	const hammer2_blockref_t *bref;
+	hammer2_blockref_t *ibuf = NULL;
+	hammer2_key_t key_last;
+	size_t bytes;
+	int error = 0;
+	int i;
+
+	if (depth > IMAGE_MAXDEPTH)
+		return EIO;
+
+	for (i = 0; i < count && error == 0; ++i) {
+		bref = &base[i];
+		if (bref->type == HAMMER2_BREF_TYPE_EMPTY)
+			continue;
+		if (bref->keybits >= 64)
+			key_last = (hammer2_key_t)-1;
+		else
+			key_last = bref->key +
+				   ((hammer2_key_t)1 << bref->keybits) - 1;
+		if (bref->key > key_end || key_last < key_beg)
+			continue;
+
+		if (bref->type == HAMMER2_BREF_TYPE_INDIRECT) {
+			if (ibuf == NULL) {
+				ibuf = malloc(HAMMER2_PBUFSIZE);
+				if (ibuf == NULL)
+					return ENOMEM;
+			}
+			error = image_read_bref(img, bref, ibuf, &bytes);
+			if (error == 0) {
+				error = image_scan(img, ibuf,
+						   bytes / sizeof(*ibuf),
+						   key_beg, key_end,
+						   func, arg, depth + 1);
+			}
+		} else {
+			error = func(img, bref, arg);
+		}
+	}
+	free(ibuf);
+
+	return error;
+}
+
+static int
+image_scan_inode(hammer2_image_t *img, const hammer2_image_inode_t *ip,
+		 hammer2_key_t key_beg, hammer2_key_t key_end,
+		 image_scan_t func, void *arg)
+{
+	if (ip->ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA)
+		return 0;
+	return image_scan(img, ip->ipdata.u.blockset.blockref,
+			  HAMMER2_SET_COUNT, key_beg, key_end, func, arg, 0);
+}
+
+/*
+ * Directory entry names longer than the blockref check area are stored
+ * in a separate data block.
+ */
+static int
+image_dirent_name(hammer2_image_t *img, const hammer2_blockref_t *bref,
+		  char *name)
+{
+	char buf[HAMMER2_PBUFSIZE];
+	size_t namlen = bref->embed.dirent.namlen;
+	size_t bytes;
+	int error;
+
+	if (namlen > HAMMER2_INODE_MAXNAME)
+		return EIO;
+	if (namlen <= sizeof(bref->check.buf)) {
+		bcopy(bref->check.buf, name, namlen);
+	} else {
+		error = image_read_bref(img, bref, buf, &bytes);
+		if (error)
+			return error;
+		if (bytes < namlen)
+			return EIO;
+		bcopy(buf, name, namlen);
+	}
+	name[namlen] = 0;
+
+	return 0;
+}
+
+static int
+image_name_cb(hammer2_image_t *img, const hammer2_blockref_t *bref, void *arg)
+{
+	image_name_info_t *info = arg;
+	char name[HAMMER2_INODE_MAXNAME + 1];
+	int error;
+
+	switch(bref->type) {
+	case HAMMER2_BREF_TYPE_DIRENT:
+		if (bref->embed.dirent.namlen != info->len)
+			break;
+		error = image_dirent_name(img, bref, name);
+		if (error)
+			return error;
+		if (bcmp(name, info->name, info->len) == 0) {
+			info->inum = bref->embed.dirent.inum;
+			return IMAGE_SCAN_DONE;
+		}
+		break;
+	case HAMMER2_BREF_TYPE_INODE:
+		/* super-root entries (and very old directories) */
+		error = image_read_inode(img, bref, info->ip);
+		if (error)
+			return error;
+		if (info->ip->ipdata.meta.name_len == info->len &&
+		    bcmp(info->ip->ipdata.filename, info->name,
+			 info->len) == 0) {
+			info->isinode = 1;
+			return IMAGE_SCAN_DONE;
+		}
+		break;
+	}
+	return 0;
+}
+
+static int
+image_dir_lookup(hammer2_image_t *img, const hammer2_image_inode_t *dip,
+		 const char *name, size_t len, hammer2_image_inode_t *ip)
+{
+	image_name_info_t info;
+	hammer2_key_t lhc;
+	int error;
+
+	if (dip->ipdata.meta.type != HAMMER2_OBJTYPE_DIRECTORY)
+		return ENOTDIR;
+	if (len > HAMMER2_INODE_MAXNAME)
+		return ENAMETOOLONG;
+
+	bzero(&info, sizeof(info));
+	info.name = name;
+	info.len = len;
+	info.ip = ip;
+	lhc = dirhash(name, len);
+	error = image_scan_inode(img, dip, lhc, lhc | HAMMER2_DIRHASH_LOMASK,
+				 image_name_cb, &info);
+	if (error == 0)
+		return ENOENT;
+	if (error != IMAGE_SCAN_DONE)
+		return error;
+	if (info.isinode)
+		return 0;
+	return hammer2_image_inum(img, info.inum, ip);
+}
+
+static int
+image_inum_cb(hammer2_image_t *img, const hammer2_blockref_t *bref, void *arg)
+{
+	hammer2_image_inode_t *ip = arg;
+	hammer2_key_t inum = ip->ipdata.meta.inum;
+	int error;
+
+	if (bref->type != HAMMER2_BREF_TYPE_INODE || bref->key != inum)
+		return 0;
+	error = image_read_inode(img, bref, ip);
+	if (error)
+		return error;
+	if (ip->ipdata.meta.inum != inum)
+		return EIO;
+	return IMAGE_SCAN_DONE;
+}
+
+static int
+image_sroot_cb(hammer2_image_t *img, const hammer2_blockref_t *bref,
+	       void *arg)
+{
+	int error;
+
+	if (bref->type != HAMMER2_BREF_TYPE_INODE)
+		return 0;
+	error = image_read_inode(img, bref, arg);
+	if (error)
+		return error;
+	return IMAGE_SCAN_DONE;
+}
+
+hammer2_image_t *
+hammer2_image_open(const char *special, size_t cachesize)
+{
+	hammer2_image_t *img;
+	hammer2_image_t *view;
+	char *devpath;
+	char *label;
+	int error;
+
+	devpath = strdup(special);
+	if ((label = strrchr(devpath, '@')) != NULL)
+		*label++ = 0;
+	if (label == NULL || *label == 0)
+		label = "DATA";
+	if (*devpath == 0) {
+		free(devpath);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	img = hammer2_image_open_sroot(devpath, cachesize);
+	if (img == NULL) {
+		error = errno;
+		free(devpath);
+		errno = error;
+		return NULL;
+	}
+	/* label may point into devpath */
+	view = hammer2_image_open_pfs(img, label);
+	error = errno;
+	free(devpath);
+	hammer2_image_close(img);
+	errno = error;
+
+	return view;
+}
+
+/*
+ * Open the super-root of an image, whose entries are the PFS root inodes.
+ * (devpath) has no label.  Other PFSs are opened from the super-root view
+ * with hammer2_image_open_pfs().
+ */
+hammer2_image_t *
+hammer2_image_open_sroot(const char *devpath, size_t cachesize)
+{
+	hammer2_image_t *img;
+	image_shared_t *sh;
+	hammer2_volume_data_t *voldata;
+	size_t nhash;
+	int error;
+
+	if (cachesize == 0)
+		cachesize = HAMMER2_IMAGE_CACHE_DEFAULT;
+	if (cachesize < HAMMER2_PBUFSIZE)
+		cachesize = HAMMER2_PBUFSIZE;
+	nhash = 1024;
+	while (nhash < cachesize / HAMMER2_LBUFSIZE)
+		nhash <<= 1;
+
+	sh = calloc(1, sizeof(*sh));
+	sh->hash = calloc(nhash, sizeof(*sh->hash));
+	sh->hmask = nhash - 1;
+	sh->cachesize = cachesize;
+	sh->refs = 1;
+	TAILQ_INIT(&sh->lru);
+	pthread_mutex_init(&sh->lock, NULL);
+	img = calloc(1, sizeof(*img));
+	img->sh = sh;
+	img->label = strdup("");
+
+	hammer2_init_volumes(devpath, 1);
+	voldata = hammer2_read_root_volume_header();
+	sh->voldata = *voldata;
+	free(voldata);
+
+	error = image_scan(img, sh->voldata.sroot_blockset.blockref,
+			   HAMMER2_SET_COUNT, 0, (hammer2_key_t)-1,
+			   image_sroot_cb, &sh->sroot, 0);
+	if (error == 0)
+		error = ENOENT;
+	if (error != IMAGE_SCAN_DONE) {
+		hammer2_image_close(img);
+		errno = error;
+		return NULL;
+	}
+	img->iroot = sh->sroot;
+
+	return img;
+}
+
+/*
+ * Open another PFS (e.g. a snapshot) of an open image.  The view shares
+ * the cache and the volumes, which are released with the last view.
+ */
+hammer2_image_t *
+hammer2_image_open_pfs(hammer2_image_t *img, const char *label)
+{
+	hammer2_image_t *view;
+	int error;
+
+	view = calloc(1, sizeof(*view));
+	view->sh = img->sh;
+	view->label = strdup(label);
+	pthread_mutex_lock(&img->sh->lock);
+	++img->sh->refs;
+	pthread_mutex_unlock(&img->sh->lock);
+
+	error = image_dir_lookup(view, &view->sh->sroot, label, strlen(label),
+				 &view->iroot);
+	if (error) {
+		hammer2_image_close(view);
+		errno = error;
+		return NULL;
+	}
+	return view;
+}
+
+void
+hammer2_image_close(hammer2_image_t *img)
+{
+	image_shared_t *sh = img->sh;
+	image_cbuf_t *cbuf;
+	image_pmemo_t *memo;
+	int last;
+	int i;
+
+	if (img->pmemo) {
+		for (i = 0; i < IMAGE_PMEMO_HSIZE; ++i) {
+			while ((memo = img->pmemo[i]) != NULL) {
+				img->pmemo[i] = memo->next;
+				free(memo->name);
+				free(memo);
+			}
+		}
+		free(img->pmemo);
+	}
+	free(img->label);
+	free(img);
+
+	pthread_mutex_lock(&sh->lock);
+	last = (--sh->refs == 0);
+	pthread_mutex_unlock(&sh->lock);
+	if (last == 0)
+		return;
+
+	while ((cbuf = TAILQ_FIRST(&sh->lru)) != NULL) {
+		TAILQ_REMOVE(&sh->lru, cbuf, entry);
+		free(cbuf);
+	}
+	hammer2_cleanup_volumes();
+	pthread_mutex_destroy(&sh->lock);
+	free(sh->hash);
+	free(sh);
+}
+
+const char *
+hammer2_image_label(const hammer2_image_t *img)
+{
+	return img->label;
+}
+
+void
+hammer2_image_root(hammer2_image_t *img, hammer2_image_inode_t *ip)
+{
+	*ip = img->iroot;
+}
+
+/*
+ * Read the inode referenced by an INODE blockref, e.g. one reported by
+ * hammer2_image_diff().
+ */
+int
+hammer2_image_get_inode(hammer2_image_t *img, const hammer2_blockref_t *bref,
+			hammer2_image_inode_t *ip)
+{
+	if (bref->type != HAMMER2_BREF_TYPE_INODE)
+		return EINVAL;
+	return image_read_inode(img, bref, ip);
+}
+
+/*
+ * Look up an inode by inode number in the PFS's inode index.
+ */
+int
+hammer2_image_inum(hammer2_image_t *img, hammer2_key_t inum,
+		   hammer2_image_inode_t *ip)
+{
+	int error;
+
+	if (inum == img->iroot.ipdata.meta.inum) {
+		*ip = img->iroot;
+		return 0;
+	}
+	ip->ipdata.meta.inum = inum;
+	error = image_scan_inode(img, &img->iroot, inum, inum,
+				 image_inum_cb, ip);
+	if (error == 0)
+		return ENOENT;
+	if (error != IMAGE_SCAN_DONE)
+		return error;
+	return 0;
+}
+
+/*
+ * Resolve a path relative to the PFS root.  Symbolic links are not
+ * followed.
+ */
+int
+hammer2_image_lookup(hammer2_image_t *img, const char *path,
+		     hammer2_image_inode_t *ip)
+{
+	hammer2_image_inode_t dip;
+	const char *name;
+	size_t len;
+	int error;
+
+	*ip = img->iroot;
+	while (*path) {
+		while (*path == '/')
+			++path;
+		name = path;
+		while (*path && *path != '/')
+			++path;
+		len = path - name;
+
+		if (len == 0 || (len == 1 && name[0] == '.'))
+			continue;
+		if (ip->ipdata.meta.type != HAMMER2_OBJTYPE_DIRECTORY)
+			return ENOTDIR;
+		if (len == 2 && name[0] == '.' && name[1] == '.') {
+			if (ip->ipdata.meta.inum == img->iroot.ipdata.meta.inum)
+				continue;
+			error = hammer2_image_inum(img,
+						   ip->ipdata.meta.iparent,
+						   ip);
+		} else {
+			dip = *ip;
+			error = image_dir_lookup(img, &dip, name, len, ip);
+		}
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+/*
+ * Convert a directory entry blockref, or an old-style directory entry
+ * embedded in an inode, to a hammer2_image_dirent_t.
+ */
+int
+hammer2_image_get_dirent(hammer2_image_t *img, const hammer2_blockref_t *bref,
+			 hammer2_image_dirent_t *dent)
+{
+	hammer2_image_inode_t ip;
+	int error;
+
+	switch(bref->type) {
+	case HAMMER2_BREF_TYPE_DIRENT:
+		error = image_dirent_name(img, bref, dent->name);
+		if (error)
+			return error;
+		dent->inum = bref->embed.dirent.inum;
+		dent->type = bref->embed.dirent.type;
+		dent->namlen = bref->embed.dirent.namlen;
+		break;
+	case HAMMER2_BREF_TYPE_INODE:
+		error = image_read_inode(img, bref, &ip);
+		if (error)
+			return error;
+		if (ip.ipdata.meta.name_len > HAMMER2_INODE_MAXNAME)
+			return EIO;
+		dent->inum = ip.ipdata.meta.inum;
+		dent->type = ip.ipdata.meta.type;
+		dent->namlen = ip.ipdata.meta.name_len;
+		bcopy(ip.ipdata.filename, dent->name, dent->namlen);
+		dent->name[dent->namlen] = 0;
+		break;
+	default:
+		return EINVAL;
+	}
+	dent->key = bref->key;
+
+	return 0;
+}
+
+static int
+image_readdir_cb(hammer2_image_t *img, const hammer2_blockref_t *bref,
+		 void *arg)
+{
+	image_dir_info_t *info = arg;
+	int error;
+
+	if (bref->type != HAMMER2_BREF_TYPE_DIRENT &&
+	    bref->type != HAMMER2_BREF_TYPE_INODE)
+		return 0;
+	error = hammer2_image_get_dirent(img, bref, &info->dent);
+	if (error)
+		return error;
+
+	return info->func(&info->dent, info->arg);
+}
+
+/*
+ * Call (func) for every entry of a directory in directory hash order.
+ * "." and ".." are not stored on media and are not reported.
+ */
+int
+hammer2_image_readdir(hammer2_image_t *img, const hammer2_image_inode_t *dip,
+		      hammer2_image_readdir_t func, void *arg)
+{
+	image_dir_info_t info;
+
+	if (dip->ipdata.meta.type != HAMMER2_OBJTYPE_DIRECTORY)
+		return ENOTDIR;
+	info.func = func;
+	info.arg = arg;
+
+	return image_scan_inode(img, dip, HAMMER2_DIRHASH_VISIBLE,
+				(hammer2_key_t)-1, image_readdir_cb, &info);
+}
+
+void
+hammer2_image_stat(const hammer2_image_inode_t *ip, struct stat *st)
+{
+	const hammer2_inode_meta_t *meta = &ip->ipdata.meta;
+	mode_t type;
+
+	switch(meta->type) {
+	case HAMMER2_OBJTYPE_DIRECTORY:
+		type = S_IFDIR;
+		break;
+	case HAMMER2_OBJTYPE_FIFO:
+		type = S_IFIFO;
+		break;
+	case HAMMER2_OBJTYPE_CDEV:
+		type = S_IFCHR;
+		break;
+	case HAMMER2_OBJTYPE_BDEV:
+		type = S_IFBLK;
+		break;
+	case HAMMER2_OBJTYPE_SOFTLINK:
+		type = S_IFLNK;
+		break;
+	case HAMMER2_OBJTYPE_SOCKET:
+		type = S_IFSOCK;
+		break;
+	case HAMMER2_OBJTYPE_REGFILE:
+	default:
+		type = S_IFREG;
+		break;
+	}
+
+	bzero(st, sizeof(*st));
+	st->st_flags = meta->uflags;
+	st->st_ino = meta->inum;
+	st->st_mode = type | (meta->mode & ALLPERMS);
+	st->st_nlink = meta->nlinks;
+	st->st_uid = *(const uint32_t *)&meta->uid.node[2];
+	st->st_gid = *(const uint32_t *)&meta->gid.node[2];
+	st->st_rdev = makedev(meta->rmajor, meta->rminor);
+	st->st_size = meta->size;
+	st->st_blksize = HAMMER2_PBUFSIZE;
+	st->st_blocks = ip->bref.embed.stats.data_count / 512;
+	st->st_atim.tv_sec = meta->atime / 1000000;
+	st->st_atim.tv_nsec = meta->atime % 1000000 * 1000;
+	st->st_mtim.tv_sec = meta->mtime / 1000000;
+	st->st_mtim.tv_nsec = meta->mtime % 1000000 * 1000;
+	st->st_ctim.tv_sec = meta->ctime / 1000000;
+	st->st_ctim.tv_nsec = meta->ctime % 1000000 * 1000;
+}
+
+static int
+image_data_cb(hammer2_image_t *img __unused, const hammer2_blockref_t *bref,
+	      void *arg)
+{
+	image_data_info_t *info = arg;
+
+	if (bref->type != HAMMER2_BREF_TYPE_DATA)
+		return 0;
+	if ((bref->data_off & HAMMER2_OFF_MASK_RADIX) == 0)
+		return 0;	/* zero-fill */
+	if (info->count == info->alloc) {
+		info->alloc = info->alloc ? info->alloc * 2 : 64;
+		info->brefs = realloc(info->brefs,
+				      info->alloc * sizeof(*info->brefs));
+		if (info->brefs == NULL)
+			return ENOMEM;
+	}
+	info->brefs[info->count++] = *bref;
+
+	return 0;
+}
+
+static int
+image_data_cmp(const void *b1, const void *b2)
+{
+	const hammer2_blockref_t *bref1 = b1;
+	const hammer2_blockref_t *bref2 = b2;
+
+	if (bref1->data_off < bref2->data_off)
+		return -1;
+	if (bref1->data_off > bref2->data_off)
+		return 1;
+	return 0;
+}
+
+/*
+ * Verify and decompress one data block out of a media run and copy the
+ * part overlapping the request into (buf).
+ */
+static int
+image_data_block(hammer2_image_t *img, const hammer2_blockref_t *bref,
+		 const char *data, char *dbuf, char *buf, size_t bytes,
+		 hammer2_off_t offset)
+{
+	size_t psize = (size_t)1 << (bref->data_off & HAMMER2_OFF_MASK_RADIX);
+	size_t lsize;
+	hammer2_off_t beg;
+	hammer2_off_t end;
+	int status;
+
+	if (image_check(img, bref, data, psize) == 0)
+		return EIO;
+
+	switch(HAMMER2_DEC_COMP(bref->methods)) {
+	case HAMMER2_COMP_LZ4:
+	case HAMMER2_COMP_ZLIB:
+		if (bref->keybits > HAMMER2_PBUFRADIX)
+			return EIO;
+		lsize = (size_t)1 << bref->keybits;
+		if (HAMMER2_DEC_COMP(bref->methods) == HAMMER2_COMP_LZ4)
+			data = hammer2_decompress_LZ4((void *)(uintptr_t)data,
+						      psize, dbuf, lsize,
+						      &status);
+		else
+			data = hammer2_decompress_ZLIB((void *)(uintptr_t)data,
+						       psize, dbuf, lsize,
+						       &status);
+		if (status == 0)
+			return EIO;
+		pthread_mutex_lock(&img->sh->lock);
+		++img->sh->stats.decompressed;
+		pthread_mutex_unlock(&img->sh->lock);
+		break;
+	default:
+		lsize = psize;
+		break;
+	}
+
+	beg = bref->key > offset ? bref->key : offset;
+	end = bref->key + lsize;
+	if (end > offset + bytes)
+		end = offset + bytes;
+	if (beg < end)
+		bcopy(data + (beg - bref->key), buf + (beg - offset), end - beg);
+
+	return 0;
+}
+
+/*
+ * Read file data like pread(2).  The data blockrefs covering the range
+ * are gathered first and read in media order, physically contiguous
+ * blocks being merged into HAMMER2_IMAGE_IOSIZE reads.  Holes read as
+ * zeros.  Returns -1 with errno set on failure.
+ */
+ssize_t
+hammer2_image_pread(hammer2_image_t *img, const hammer2_image_inode_t *ip,
+		    void *buf, size_t bytes, hammer2_off_t offset)
+{
+	const hammer2_inode_meta_t *meta = &ip->ipdata.meta;
+	image_data_info_t info;
+	hammer2_blockref_t *bref;
+	hammer2_volume_t *vol;
+	hammer2_off_t run_beg;
+	hammer2_off_t run_end;
+	hammer2_off_t off;
+	size_t psize;
+	char *rbuf = NULL;
+	char *dbuf = NULL;
+	int error = 0;
+	int i, j, k;
+
+	if (meta->type == HAMMER2_OBJTYPE_DIRECTORY) {
+		errno = EISDIR;
+		return -1;
+	}
+	if (offset >= meta->size)
+		return 0;
+	if (bytes > meta->size - offset)
+		bytes = meta->size - offset;
+	if (bytes == 0)
+		return 0;
+
+	bzero(buf, bytes);
+	if (meta->op_flags & HAMMER2_OPFLAG_DIRECTDATA) {
+		if (offset + bytes > HAMMER2_EMBEDDED_BYTES) {
+			errno = EIO;
+			return -1;
+		}
+		bcopy(ip->ipdata.u.data + offset, buf, bytes);
+		goto done;
+	}
+
+	bzero(&info, sizeof(info));
+	error = image_scan_inode(img, ip, offset, offset + bytes - 1,
+				 image_data_cb, &info);
+	if (error == 0 && info.count) {
+		qsort(info.brefs, info.count, sizeof(*info.brefs),
+		      image_data_cmp);
+		rbuf = malloc(HAMMER2_IMAGE_IOSIZE);
+		dbuf = malloc(HAMMER2_PBUFSIZE);
+		if (rbuf == NULL || dbuf == NULL)
+			error = ENOMEM;
+	}
+
+	for (i = 0; error == 0 && i < info.count; i = j) {
+		bref = &info.brefs[i];
+		psize = (size_t)1 << (bref->data_off & HAMMER2_OFF_MASK_RADIX);
+		if (psize < HAMMER2_ALLOC_MIN || psize > HAMMER2_PBUFSIZE) {
+			error = EIO;
+			break;
+		}
+		run_beg = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
+		run_end = run_beg + psize;
+		vol = hammer2_get_volume(run_beg);
+
+		for (j = i + 1; j < info.count; ++j) {
+			bref = &info.brefs[j];
+			off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
+			psize = (size_t)1 <<
+				(bref->data_off & HAMMER2_OFF_MASK_RADIX);
+			if (off != run_end || psize < HAMMER2_ALLOC_MIN ||
+			    psize > HAMMER2_PBUFSIZE ||
+			    run_end + psize - run_beg > HAMMER2_IMAGE_IOSIZE ||
+			    hammer2_get_volume(off) != vol)
+				break;
+			run_end += psize;
+		}
+
+		error = image_read_media(img, run_beg, rbuf,
+					 run_end - run_beg);
+		for (k = i; error == 0 && k < j; ++k) {
+			bref = &info.brefs[k];
+			off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
+			error = image_data_block(img, bref,
+						 rbuf + (off - run_beg),
+						 dbuf, buf, bytes, offset);
+		}
+	}
+	free(info.brefs);
+	free(rbuf);
+	free(dbuf);
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+done:
+	pthread_mutex_lock(&img->sh->lock);
+	img->sh->stats.data_bytes += bytes;
+	pthread_mutex_unlock(&img->sh->lock);
+
+	return bytes;
+}
+
+/*
+ * Read the media block of a DATA blockref as is, without decompressing
+ * it, e.g. to pass compressed blocks through to another filesystem.
+ * (buf) must hold HAMMER2_PBUFSIZE bytes.  The physical size is returned
+ * in (*bytesp), 0 for a zero-filled block.
+ */
+int
+hammer2_image_read_block(hammer2_image_t *img, const hammer2_blockref_t *bref,
+			 void *buf, size_t *bytesp)
+{
+	hammer2_off_t off;
+	size_t bytes;
+	int radix;
+	int error;
+
+	radix = bref->data_off & HAMMER2_OFF_MASK_RADIX;
+	*bytesp = 0;
+	if (radix == 0)
+		return 0;
+	if (radix < HAMMER2_RADIX_MIN || radix > HAMMER2_PBUFRADIX)
+		return EIO;
+	bytes = (size_t)1 << radix;
+	off = bref->data_off & ~HAMMER2_OFF_MASK_RADIX;
+
+	error = image_read_media(img, off, buf, bytes);
+	if (error)
+		return error;
+	if (image_check(img, bref, buf, bytes) == 0)
+		return EIO;
+	*bytesp = bytes;
+
+	return 0;
+}
+
+/*
+ * Read an inode, indirect or other metadata block through the cache.
+ * (buf) must hold HAMMER2_PBUFSIZE bytes.
+ */
+int
+hammer2_image_read_meta(hammer2_image_t *img, const hammer2_blockref_t *bref,
+			void *buf, size_t *bytesp)
+{
+	return image_read_bref(img, bref, buf, bytesp);
+}
+
+/*
+ * The volume header the image was opened with.
+ */
+const hammer2_volume_data_t *
+hammer2_image_voldata(const hammer2_image_t *img)
+{
+	return &img->sh->voldata;
+}
+
+/************************************************************************
+ *				    DIFF				*
+ ************************************************************************
+ *
+ * A snapshot starts out sharing every block with the PFS it was taken
+ * of.  Modifying either side copies the blocks on the path from the
+ * modified data up to the PFS root, giving them a new data_off, check
+ * code and mirror_tid, while everything else stays shared.  Comparing
+ * two trees blockref by blockref therefore only has to descend where
+ * the blockrefs differ and costs about as much as the changes do.
+ */
+
+static __inline
+hammer2_key_t
+image_key_last(const hammer2_blockref_t *bref)
+{
+	if (bref->keybits >= 64)
+		return (hammer2_key_t)-1;
+	return bref->key + ((hammer2_key_t)1 << bref->keybits) - 1;
+}
+
+static __inline
+int
+image_bref_same(const hammer2_blockref_t *bref1,
+		const hammer2_blockref_t *bref2)
+{
+	return (bref1->type == bref2->type &&
+		bref1->key == bref2->key &&
+		bref1->keybits == bref2->keybits &&
+		bref1->data_off == bref2->data_off &&
+		bref1->methods == bref2->methods &&
+		bcmp(&bref1->embed, &bref2->embed, sizeof(bref1->embed)) == 0 &&
+		bcmp(&bref1->check, &bref2->check, IMAGE_CHECK_SIZE) == 0);
+}
+
+static int
+image_diff_cmp(const void *p1, const void *p2)
+{
+	const image_diff_elm_t *elm1 = p1;
+	const image_diff_elm_t *elm2 = p2;
+
+	/* descending, the top of the stack holds the lowest key */
+	if (elm1->bref.key > elm2->bref.key)
+		return -1;
+	if (elm1->bref.key < elm2->bref.key)
+		return 1;
+	return 0;
+}
+
+/*
+ * Push the non-empty blockrefs of a block table overlapping the key
+ * range.
+ */
+static int
+image_diff_push(image_diff_side_t *side, const hammer2_blockref_t *base,
+		int count, int depth, hammer2_key_t key_beg,
+		hammer2_key_t key_end)
+{
+	image_diff_elm_t *elm;
+	int n = 0;
+	int i;
+
+	if (side->count + count > side->alloc) {
+		side->alloc = (side->count + count) * 2;
+		side->elms = realloc(side->elms,
+				     side->alloc * sizeof(*side->elms));
+		if (side->elms == NULL)
+			return ENOMEM;
+	}
+	elm = &side->elms[side->count];
+	for (i = 0; i < count; ++i) {
+		if (base[i].type == HAMMER2_BREF_TYPE_EMPTY)
+			continue;
+		if (base[i].key > key_end || image_key_last(&base[i]) < key_beg)
+			continue;
+		elm[n].bref = base[i];
+		elm[n].depth = depth;
+		++n;
+	}
+	if (n > 1)
+		qsort(elm, n, sizeof(*elm), image_diff_cmp);
+	side->count += n;
+
+	return 0;
+}
+
+/*
+ * Replace an indirect block on the stack with its contents.
+ */
+static int
+image_diff_expand(hammer2_image_t *img, image_diff_side_t *side,
+		  const image_diff_elm_t *elm, hammer2_key_t key_beg,
+		  hammer2_key_t key_end)
+{
+	hammer2_blockref_t *ibuf;
+	size_t bytes;
+	int error;
+
+	if (elm->depth >= IMAGE_MAXDEPTH)
+		return EIO;
+	ibuf = malloc(HAMMER2_PBUFSIZE);
+	if (ibuf == NULL)
+		return ENOMEM;
+	error = image_read_bref(img, &elm->bref, ibuf, &bytes);
+	if (error == 0)
+		error = image_diff_push(side, ibuf, bytes / sizeof(*ibuf),
+					elm->depth + 1, key_beg, key_end);
+	free(ibuf);
+
+	return error;
+}
+
+/*
+ * Compare the block tables of two inodes, typically the same inode in
+ * two snapshots, and call (func) for every blockref in the key range
+ * which was removed (bref_b NULL), added (bref_a NULL) or changed.
+ * Blockrefs are reported in key order, indirect blocks are never
+ * reported.  Either inode may be NULL, in which case everything is
+ * reported as added or removed.  Inodes with embedded data have no block
+ * table and compare as empty.  A non-zero return from (func) ends the
+ * walk and is returned.
+ *
+ * Both inodes must come from views of the same image.
+ */
+int
+hammer2_image_diff(hammer2_image_t *img, const hammer2_image_inode_t *ip_a,
+		   const hammer2_image_inode_t *ip_b,
+		   hammer2_key_t key_beg, hammer2_key_t key_end,
+		   hammer2_image_diff_t func, void *arg)
+{
+	image_diff_side_t side_a;
+	image_diff_side_t side_b;
+	image_diff_elm_t elm_a;
+	image_diff_elm_t elm_b;
+	image_diff_elm_t *a;
+	image_diff_elm_t *b;
+	int error = 0;
+
+	bzero(&side_a, sizeof(side_a));
+	bzero(&side_b, sizeof(side_b));
+	if (ip_a &&
+	    (ip_a->ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA) == 0)
+		error = image_diff_push(&side_a,
+					ip_a->ipdata.u.blockset.blockref,
+					HAMMER2_SET_COUNT, 0, key_beg, key_end);
+	if (error == 0 && ip_b &&
+	    (ip_b->ipdata.meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA) == 0)
+		error = image_diff_push(&side_b,
+					ip_b->ipdata.u.blockset.blockref,
+					HAMMER2_SET_COUNT, 0, key_beg, key_end);
+
+	while (error == 0 && (side_a.count || side_b.count)) {
+		a = side_a.count ? &side_a.elms[side_a.count - 1] : NULL;
+		b = side_b.count ? &side_b.elms[side_b.count - 1] : NULL;
+
+		/*
+		 * Shared subtree, nothing below it changed.
+		 */
+		if (a && b && image_bref_same(&a->bref, &b->bref)) {
+			--side_a.count;
+			--side_b.count;
+			continue;
+		}
+
+		/*
+		 * Only one side covers the lowest keys.
+		 */
+		if (a && (b == NULL ||
+			  image_key_last(&a->bref) < b->bref.key)) {
+			elm_a = *a;
+			--side_a.count;
+			if (elm_a.bref.type == HAMMER2_BREF_TYPE_INDIRECT)
+				error = image_diff_expand(img, &side_a, &elm_a,
+							  key_beg, key_end);
+			else
+				error = func(&elm_a.bref, NULL, arg);
+			continue;
+		}
+		if (b && (a == NULL ||
+			  image_key_last(&b->bref) < a->bref.key)) {
+			elm_b = *b;
+			--side_b.count;
+			if (elm_b.bref.type == HAMMER2_BREF_TYPE_INDIRECT)
+				error = image_diff_expand(img, &side_b, &elm_b,
+							  key_beg, key_end);
+			else
+				error = func(NULL, &elm_b.bref, arg);
+			continue;
+		}
+
+		/*
+		 * Overlapping ranges which differ, descend until both
+		 * sides are leaves.
+		 */
+		if (a->bref.type == HAMMER2_BREF_TYPE_INDIRECT) {
+			elm_a = *a;
+			--side_a.count;
+			error = image_diff_expand(img, &side_a, &elm_a,
+						  key_beg, key_end);
+			continue;
+		}
+		if (b->bref.type == HAMMER2_BREF_TYPE_INDIRECT) {
+			elm_b = *b;
+			--side_b.count;
+			error = image_diff_expand(img, &side_b, &elm_b,
+						  key_beg, key_end);
+			continue;
+		}
+		elm_a = *a;
+		elm_b = *b;
+		if (elm_a.bref.key == elm_b.bref.key) {
+			--side_a.count;
+			--side_b.count;
+			error = func(&elm_a.bref, &elm_b.bref, arg);
+		} else if (elm_a.bref.key < elm_b.bref.key) {
+			--side_a.count;
+			error = func(&elm_a.bref, NULL, arg);
+		} else {
+			--side_b.count;
+			error = func(NULL, &elm_b.bref, arg);
+		}
+	}
+	free(side_a.elms);
+	free(side_b.elms);
+
+	return error;
+}
+
+/************************************************************************
+ *				    PATHS				*
+ ************************************************************************
+ *
+ * Inodes do not record their name, only the directory they were created
+ * in or last renamed into (meta.iparent).  A path is built by scanning
+ * the parent directory for the entry, remembering all of its entries
+ * along the way so that looking up siblings and ancestors is cheap.
+ * Hardlinks whose original entry was removed can leave iparent stale,
+ * the whole PFS is walked once if that happens.
+ */
+
+static __inline
+size_t
+image_pmemo_hash(hammer2_key_t inum)
+{
+	return ((inum ^ (inum >> 12)) & (IMAGE_PMEMO_HSIZE - 1));
+}
+
+/*
+ * Find the memo for (inum) and copy its parent and name out, the lock
+ * must be held.
+ */
+static int
+image_pmemo_find(hammer2_image_t *img, hammer2_key_t inum,
+		 hammer2_key_t *parentp, char *name)
+{
+	image_pmemo_t *memo;
+
+	if (img->pmemo == NULL)
+		return 0;
+	for (memo = img->pmemo[image_pmemo_hash(inum)]; memo;
+	     memo = memo->next) {
+		if (memo->inum == inum) {
+			*parentp = memo->parent;
+			strcpy(name, memo->name);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+image_pmemo_cb(const hammer2_image_dirent_t *dent, void *arg)
+{
+	image_pmemo_info_t *info = arg;
+	hammer2_image_t *img = info->img;
+	image_pmemo_t *memo;
+	size_t i;
+
+	pthread_mutex_lock(&img->sh->lock);
+	if (img->pmemo == NULL)
+		img->pmemo = calloc(IMAGE_PMEMO_HSIZE, sizeof(*img->pmemo));
+	i = image_pmemo_hash(dent->inum);
+	for (memo = img->pmemo[i]; memo; memo = memo->next) {
+		if (memo->inum == dent->inum)
+			break;
+	}
+	if (memo == NULL) {
+		memo = malloc(sizeof(*memo));
+		memo->inum = dent->inum;
+		memo->parent = info->parent;
+		memo->name = strdup(dent->name);
+		memo->next = img->pmemo[i];
+		img->pmemo[i] = memo;
+	}
+	pthread_mutex_unlock(&img->sh->lock);
+
+	if (info->subdirs && dent->type == HAMMER2_OBJTYPE_DIRECTORY) {
+		if (info->nsubdirs == info->asubdirs) {
+			info->asubdirs *= 2;
+			info->subdirs = realloc(info->subdirs,
+				info->asubdirs * sizeof(*info->subdirs));
+			if (info->subdirs == NULL)
+				return ENOMEM;
+		}
+		info->subdirs[info->nsubdirs++] = dent->inum;
+	}
+	return 0;
+}
+
+/*
+ * Remember the entries of directory (dip), descending into
+ * subdirectories if (recurse) is set.
+ */
+static int
+image_pmemo_dir(hammer2_image_t *img, const hammer2_image_inode_t *dip,
+		int recurse)
+{
+	image_pmemo_info_t info;
+	hammer2_image_inode_t ip;
+	int error;
+	int i;
+
+	bzero(&info, sizeof(info));
+	info.img = img;
+	info.parent = dip->ipdata.meta.inum;
+	if (recurse) {
+		info.asubdirs = 16;
+		info.subdirs = malloc(info.asubdirs * sizeof(*info.subdirs));
+	}
+	error = hammer2_image_readdir(img, dip, image_pmemo_cb, &info);
+	for (i = 0; error == 0 && i < info.nsubdirs; ++i) {
+		error = hammer2_image_inum(img, info.subdirs[i], &ip);
+		if (error == 0)
+			error = image_pmemo_dir(img, &ip, 1);
+	}
+	free(info.subdirs);
+
+	return error;
+}
+
+/*
+ * Return the path of an inode relative to the PFS root in (*pathp),
+ * "" for the root itself.  Any of the names of a hardlinked inode may be
+ * returned.  The path must be freed by the caller.
+ */
+int
+hammer2_image_path(hammer2_image_t *img, hammer2_key_t inum, char **pathp)
+{
+	hammer2_image_inode_t ip;
+	hammer2_key_t parent;
+	char name[HAMMER2_INODE_MAXNAME + 1];
+	char *path = NULL;
+	char *tmp;
+	int found;
+	int depth;
+	int error;
+
+	*pathp = NULL;
+	for (depth = 0; inum != img->iroot.ipdata.meta.inum; ++depth) {
+		if (depth > IMAGE_PATH_MAXDEPTH) {
+			error = ELOOP;
+			goto fail;
+		}
+		pthread_mutex_lock(&img->sh->lock);
+		found = image_pmemo_find(img, inum, &parent, name);
+		pthread_mutex_unlock(&img->sh->lock);
+
+		if (found == 0) {
+			error = hammer2_image_inum(img, inum, &ip);
+			if (error == 0)
+				error = hammer2_image_inum(img,
+						ip.ipdata.meta.iparent, &ip);
+			if (error == 0)
+				error = image_pmemo_dir(img, &ip, 0);
+			if (error && error != ENOENT && error != ENOTDIR)
+				goto fail;
+			pthread_mutex_lock(&img->sh->lock);
+			found = image_pmemo_find(img, inum, &parent, name);
+			pthread_mutex_unlock(&img->sh->lock);
+		}
+		if (found == 0 && img->pwalked == 0) {
+			img->pwalked = 1;
+			error = image_pmemo_dir(img, &img->iroot, 1);
+			if (error)
+				goto fail;
+			pthread_mutex_lock(&img->sh->lock);
+			found = image_pmemo_find(img, inum, &parent, name);
+			pthread_mutex_unlock(&img->sh->lock);
+		}
+		if (found == 0) {
+			error = ENOENT;
+			goto fail;
+		}
+
+		if (path)
+			asprintf(&tmp, "%s/%s", name, path);
+		else
+			tmp = strdup(name);
+		free(path);
+		if ((path = tmp) == NULL) {
+			error = ENOMEM;
+			goto fail;
+		}
+		inum = parent;
+	}
+	if (path == NULL && (path = strdup("")) == NULL)
+		return ENOMEM;
+	*pathp = path;
+
+	return 0;
+fail:
+	free(path);
+	return error;
+}
+
+void
+hammer2_image_get_stats(hammer2_image_t *img, hammer2_image_stats_t *stats)
+{
+	pthread_mutex_lock(&img->sh->lock);
+	*stats = img->sh->stats;
+	pthread_mutex_unlock(&img->sh->lock);
+}
@@ -0,0 +1,157 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HAMMER2_LIBHAMMER2_H_
+#define HAMMER2_LIBHAMMER2_H_
+
+/*
+ * Read-only access to an unmounted HAMMER2 filesystem (libhammer2).
+ *
+ * The image is opened with the same special[@label] syntax as
+ * mount_hammer2(8), multiple volumes being separated by colons.  Only
+ * ondisk.c, subs.c and the decompressors are needed, no kernel support,
+ * so tools can link this in via .PATH the same way they share ondisk.c.
+ *
+ * All functions other than open and close may be called concurrently.
+ * Metadata blocks (inodes, indirect blocks, long directory entry names)
+ * are kept in a bounded LRU cache, file data is read with pread(2) in
+ * physically contiguous runs and is never cached.  Every block is
+ * verified against the check code of its blockref before it is used.
+ *
+ * Since the volume table in ondisk.c is global, only one image can be
+ * open at a time.  Further PFSs of it, e.g. snapshots, can be opened as
+ * views sharing the volumes and the cache.  The super-root view lists
+ * the PFSs of an image as its directory entries.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fs/hammer2/hammer2_disk.h>
+
+#define HAMMER2_IMAGE_CACHE_DEFAULT	(16 * 1024 * 1024)
+#define HAMMER2_IMAGE_IOSIZE		(1024 * 1024)	/* max media read */
+
+typedef struct hammer2_image hammer2_image_t;
+
+/*
+ * A copy of an inode along with the blockref it was found through.
+ */
+typedef struct hammer2_image_inode {
+	hammer2_blockref_t	bref;
+	hammer2_inode_data_t	ipdata;
+} hammer2_image_inode_t;
+
+typedef struct hammer2_image_dirent {
+	hammer2_key_t	inum;
+	hammer2_key_t	key;		/* directory hash key */
+	uint8_t		type;		/* HAMMER2_OBJTYPE_* */
+	uint16_t	namlen;
+	char		name[HAMMER2_INODE_MAXNAME + 1];
+} hammer2_image_dirent_t;
+
+typedef struct hammer2_image_stats {
+	uint64_t	cache_hits;
+	uint64_t	cache_misses;
+	uint64_t	media_reads;	/* pread(2) calls */
+	uint64_t	media_bytes;
+	uint64_t	data_bytes;	/* file bytes returned */
+	uint64_t	decompressed;	/* blocks */
+	uint64_t	check_errors;
+} hammer2_image_stats_t;
+
+/*
+ * Return non-zero from the readdir callback to stop the scan, the value
+ * is then returned by hammer2_image_readdir().
+ */
+typedef int (*hammer2_image_readdir_t)(const hammer2_image_dirent_t *dent,
+			void *arg);
+
+/*
+ * Called by hammer2_image_diff() for every removed (bref_b NULL), added
+ * (bref_a NULL) or changed blockref.  Return non-zero to stop the walk.
+ */
+typedef int (*hammer2_image_diff_t)(const hammer2_blockref_t *bref_a,
+			const hammer2_blockref_t *bref_b, void *arg);
+
+/*
+ * Functions returning int return 0 or an errno value.
+ */
+hammer2_image_t *hammer2_image_open(const char *special, size_t cachesize);
+hammer2_image_t *hammer2_image_open_sroot(const char *devpath,
+			size_t cachesize);
+hammer2_image_t *hammer2_image_open_pfs(hammer2_image_t *img,
+			const char *label);
+void hammer2_image_close(hammer2_image_t *img);
+const char *hammer2_image_label(const hammer2_image_t *img);
+void hammer2_image_root(hammer2_image_t *img, hammer2_image_inode_t *ip);
+int hammer2_image_lookup(hammer2_image_t *img, const char *path,
+			hammer2_image_inode_t *ip);
+int hammer2_image_inum(hammer2_image_t *img, hammer2_key_t inum,
+			hammer2_image_inode_t *ip);
+int hammer2_image_readdir(hammer2_image_t *img,
+			const hammer2_image_inode_t *dip,
+			hammer2_image_readdir_t func, void *arg);
+void hammer2_image_stat(const hammer2_image_inode_t *ip, struct stat *st);
+ssize_t hammer2_image_pread(hammer2_image_t *img,
+			const hammer2_image_inode_t *ip,
+			void *buf, size_t bytes, hammer2_off_t offset);
+int hammer2_image_get_inode(hammer2_image_t *img,
+			const hammer2_blockref_t *bref,
+			hammer2_image_inode_t *ip);
+int hammer2_image_get_dirent(hammer2_image_t *img,
+			const hammer2_blockref_t *bref,
+			hammer2_image_dirent_t *dent);
+int hammer2_image_read_block(hammer2_image_t *img,
+			const hammer2_blockref_t *bref,
+			void *buf, size_t *bytesp);
+int hammer2_image_read_meta(hammer2_image_t *img,
+			const hammer2_blockref_t *bref,
+			void *buf, size_t *bytesp);
+const hammer2_volume_data_t *hammer2_image_voldata(
+			const hammer2_image_t *img);
+int hammer2_image_diff(hammer2_image_t *img,
+			const hammer2_image_inode_t *ip_a,
+			const hammer2_image_inode_t *ip_b,
+			hammer2_key_t key_beg, hammer2_key_t key_end,
+			hammer2_image_diff_t func, void *arg);
+int hammer2_image_path(hammer2_image_t *img, hammer2_key_t inum,
+			char **pathp);
+void hammer2_image_get_stats(hammer2_image_t *img,
+			hammer2_image_stats_t *stats);
+
+#endif /* !HAMMER2_LIBHAMMER2_H_ */
@@ -48,6 +48,7 @@ int VerboseOpt;
 int QuietOpt;
 int RecurseOpt;
 size_t MemOpt;
+int NThreadsOpt = 1;
 
 static void usage(int code);
 
@@ -64,8 +65,15 @@ main(int ac, char **av)
 	/*
 	 * Core options
 	 */
-	while ((ch = getopt(ac, av, "m:rs:t:u:vq")) != -1) {
+	while ((ch = getopt(ac, av, "j:m:rs:t:u:vq")) != -1) {
 		switch(ch) {
+		case 'j':
+			NThreadsOpt = strtol(optarg, NULL, 0);
+			if (NThreadsOpt < 1 || NThreadsOpt > 256) {
+				fprintf(stderr, "-j: Invalid thread count\n");
+				usage(1);
+			}
+			break;
 		case 'm':
 			MemOpt = strtoul(optarg, &opt, 0);
 			switch(*opt) {
@@ -285,13 +293,22 @@ main(int ac, char **av)
 	} else if (strcmp(av[0], "show") == 0) {
 		/*
 		 * Raw dump of filesystem.  Use -v to check all crc's, and
-		 * -vv to dump bulk file data.
+		 * -vv to dump bulk file data.  Options of its own restrict
+		 * the dump and select the output format.
 		 */
-		if (ac != 2) {
+		optind = 1;
+		optreset = 1;
+		while ((ch = getopt(ac, av, "d:f:i:k:l:M:T:t:")) != -1) {
+			if (cmd_show_option(ch, optarg) < 0)
+				usage(1);
+		}
+		ac -= optind;
+		av += optind;
+		if (ac != 1) {
 			fprintf(stderr, "show: requires device path\n");
 			usage(1);
 		} else {
-			cmd_show(av[1], 0);
+			cmd_show(av[0], 0);
 		}
 	} else if (strcmp(av[0], "freemap") == 0) {
 		/*
@@ -304,6 +321,29 @@ main(int ac, char **av)
 		} else {
 			cmd_show(av[1], 1);
 		}
+	} else if (strcmp(av[0], "freemap-stats") == 0) {
+		/*
+		 * Freemap fragmentation report.
+		 */
+		if (ac != 2) {
+			fprintf(stderr, "freemap-stats: requires device path "
+				"or mount point\n");
+			usage(1);
+		} else {
+			ecode = cmd_freemap_stats(av[1]);
+		}
+	} else if (strcmp(av[0], "du-report") == 0) {
+		/*
+		 * Space accounting by PFS, top-level directory and
+		 * compression method.
+		 */
+		if (ac != 2) {
+			fprintf(stderr, "du-report: requires device path "
+				"or mount point\n");
+			usage(1);
+		} else {
+			ecode = cmd_du_report(av[1]);
+		}
 	} else if (strcmp(av[0], "volhdr") == 0) {
 		/*
 		 * Dump the volume header.
@@ -314,6 +354,74 @@ main(int ac, char **av)
 		} else {
 			cmd_show(av[1], 2);
 		}
+	} else if (strcmp(av[0], "ls") == 0) {
+		/*
+		 * List directories of an unmounted filesystem.
+		 */
+		if (ac < 2) {
+			fprintf(stderr, "ls: requires device path\n");
+			usage(1);
+		} else {
+			ecode = cmd_ls(av[1], ac - 2,
+				       (const char **)(void *)&av[2]);
+		}
+	} else if (strcmp(av[0], "cat") == 0) {
+		/*
+		 * Copy files of an unmounted filesystem to stdout.
+		 */
+		if (ac < 3) {
+			fprintf(stderr, "cat: requires device path and file\n");
+			usage(1);
+		} else {
+			ecode = cmd_cat(av[1], ac - 2,
+					(const char **)(void *)&av[2]);
+		}
+	} else if (strcmp(av[0], "extract") == 0) {
+		/*
+		 * Copy a file or tree out of an unmounted filesystem.
+		 */
+		if (ac != 4) {
+			fprintf(stderr, "extract devpath path destdir\n");
+			usage(1);
+		} else {
+			ecode = cmd_extract(av[1], av[2], av[3]);
+		}
+	} else if (strcmp(av[0], "send") == 0) {
+		/*
+		 * Write the differences between two PFSs (snapshots) of an
+		 * unmounted filesystem, or all of one PFS, to stdout.
+		 */
+		if (ac == 3) {
+			ecode = cmd_send(av[1], NULL, av[2]);
+		} else if (ac == 4) {
+			ecode = cmd_send(av[1], av[2], av[3]);
+		} else {
+			fprintf(stderr,
+				"send devpath [from-label] to-label\n");
+			usage(1);
+		}
+	} else if (strcmp(av[0], "receive") == 0) {
+		/*
+		 * Apply a send stream from stdin to a directory tree.
+		 */
+		if (ac != 2) {
+			fprintf(stderr, "receive: requires destination "
+					"directory\n");
+			usage(1);
+		} else {
+			ecode = cmd_receive(av[1]);
+		}
+	} else if (strcmp(av[0], "diff") == 0) {
+		/*
+		 * List the paths which differ between two PFSs.
+		 */
+		if (ac != 4) {
+			fprintf(stderr,
+				"diff devpath|mount from-label to-label\n");
+			usage(1);
+		} else {
+			ecode = cmd_diff(av[1], av[2], av[3]);
+		}
 	} else if (strcmp(av[0], "volume-list") == 0) {
 		/*
 		 * List all volumes
@@ -356,6 +464,15 @@ main(int ac, char **av)
 			 */
 			ecode = cmd_setcheck(av[1], &av[2]);
 		}
+	} else if (strcmp(av[0], "punch") == 0) {
+		if (ac != 4) {
+			fprintf(stderr,
+				"punch: requires file path, offset and "
+				"length\n");
+			usage(1);
+		} else {
+			ecode = cmd_punch(av[1], av[2], av[3]);
+		}
 	} else if (strcmp(av[0], "clrcheck") == 0) {
 		ecode = cmd_setcheck("none", &av[1]);
 	} else if (strcmp(av[0], "setcrc32") == 0) {
@@ -398,7 +515,10 @@ usage(int code)
 		"    -s path            Select filesystem\n"
 		"    -t type            PFS type for pfs-create\n"
 		"    -u uuid            uuid for pfs-create\n"
-		"    -m mem[k,m,g]      buffer memory (bulkfree)\n"
+		"    -m mem[k,m,g]      buffer memory "
+			"(bulkfree, recover, extract, send, du-report)\n"
+		"    -j nthreads        number of threads "
+			"(recover, extract, show, freemap-stats, du-report)\n"
 		"\n"
 		"    cleanup [<path>]                  "
 			"Run cleanup passes\n"
@@ -440,12 +560,28 @@ usage(int code)
 			"Return inode quota & config\n"
 		"    growfs [<path...]                 "
 			"Grow a filesystem into resized partition\n"
-		"    show <devpath>                    "
+		"    show [<filters>] <devpath>        "
 			"Raw hammer2 media dump for topology\n"
 		"    freemap <devpath>                 "
 			"Raw hammer2 media dump for freemap\n"
+		"    freemap-stats <devpath|mount>     "
+			"Report freemap fragmentation\n"
+		"    du-report <devpath|mount>         "
+			"Report space used by PFS, directory and compression\n"
 		"    volhdr <devpath>                  "
 			"Raw hammer2 media dump for the volume header(s)\n"
+		"    ls <devpath[@label]> [<path>...]  "
+			"List directories without mounting\n"
+		"    cat <devpath[@label]> <path>...   "
+			"Copy files to stdout without mounting\n"
+		"    extract <devpath[@label]> <path> <destdir> "
+			"Copy a file or tree without mounting\n"
+		"    send <devpath> [<from-label>] <to-label> "
+			"Write a PFS or its changes to stdout\n"
+		"    receive <destdir>                 "
+			"Apply a send stream from stdin\n"
+		"    diff <devpath|mount> <from-label> <to-label> "
+			"List paths changed between PFSs\n"
 		"    volume-list [<path>...]           "
 			"List volumes\n"
 		"    setcomp <comp[:level]> <path>...  "
@@ -460,6 +596,8 @@ usage(int code)
 			"Set check algo to xxhash64\n"
 		"    setsha192 [<path>...]             "
 			"Set check algo to sha192\n"
+		"    punch <path> <offset> <length>    "
+			"Deallocate a byte range of a file\n"
 		"    bulkfree <path>                   "
 			"Run bulkfree pass\n"
 		"    printinode <path>                 "
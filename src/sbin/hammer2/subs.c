@@ -446,3 +446,28 @@ put_hammer2_mounts(int ac, char **av)
 		free(av[ac]);
 	free(av);
 }
+
+/*
+ * Resolve a mounted hammer2 directory to the device it was mounted
+ * from, without the PFS label.  Anything else is taken as a device
+ * path.  The result must be freed by the caller.
+ */
+char *
+get_hammer2_devpath(const char *path)
+{
+	struct statfs sfs;
+	struct stat st;
+	char *res;
+	char *ptr;
+
+	if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+		return strdup(path);
+	if (statfs(path, &sfs) < 0)
+		err(1, "%s", path);
+	if (strcmp(sfs.f_fstypename, "hammer2") != 0)
+		errx(1, "%s: not a hammer2 filesystem", path);
+	res = strdup(sfs.f_mntfromname);
+	if ((ptr = strchr(res, '@')) != NULL)
+		*ptr = 0;
+	return res;
+}
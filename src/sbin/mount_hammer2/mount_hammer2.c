@@ -45,14 +45,29 @@
 
 #include <fs/hammer2/hammer2_mount.h>
 
+static int getmnthflags(const char *options, int hflags);
 static void usage(const char *ctl, ...);
 
+/*
+ * The HAMMER2 specific options don't map to mount flags, they are only
+ * listed here so that getmntopts() accepts them, see getmnthflags().
+ */
 static struct mntopt mopts[] = {
 	MOPT_STDOPTS,
 	MOPT_UPDATE,
+	{ "lazytime", 0, 0 },
+	{ "relatime", 0, 0 },
 	{ NULL },
 };
 
+static const struct {
+	const char	*name;
+	int		hflag;
+} hopts[] = {
+	{ "lazytime",	HMNT2_LAZYTIME },
+	{ "relatime",	HMNT2_RELATIME },
+};
+
 int
 main(int argc, char **argv)
 {
@@ -70,6 +85,7 @@ main(int argc, char **argv)
 		switch (ch) {
 		case 'o':
 			getmntopts(optarg, mopts, &mntflags);
+			args.hflags = getmnthflags(optarg, args.hflags);
 			break;
 		case 'u':
 			initflags |= MNT_UPDATE;
@@ -152,6 +168,38 @@ ignore_special:
 	return (0);
 }
 
+/*
+ * Apply the HAMMER2 specific options in options to hflags, "no" clears.
+ * HMNT2_PFSUPDATE tells an update mount that they are to be changed.
+ */
+static int
+getmnthflags(const char *options, int hflags)
+{
+	char *optbuf, *opt, *p;
+	size_t i;
+	int negative;
+
+	if ((optbuf = strdup(options)) == NULL)
+		err(1, "strdup");
+	for (opt = optbuf; (p = strsep(&opt, ",")) != NULL;) {
+		negative = strncasecmp(p, "no", 2) == 0;
+		if (negative)
+			p += 2;
+		for (i = 0; i < sizeof(hopts) / sizeof(hopts[0]); i++) {
+			if (strcasecmp(p, hopts[i].name) != 0)
+				continue;
+			if (negative)
+				hflags &= ~hopts[i].hflag;
+			else
+				hflags |= hopts[i].hflag;
+			hflags |= HMNT2_PFSUPDATE;
+		}
+	}
+	free(optbuf);
+
+	return (hflags);
+}
+
 static void
 usage(const char *ctl, ...)
 {
@@ -168,6 +216,8 @@ usage(const char *ctl, ...)
 	fprintf(stderr, "\n");
 	fprintf(stderr, "options:\n"
 			" <standard_mount_options>\n"
+			" lazytime\n"
+			" relatime\n"
 	);
 	exit(1);
 }
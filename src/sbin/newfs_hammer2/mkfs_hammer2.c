@@ -37,8 +37,14 @@
 
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <sys/sysctl.h>
 #include <sys/mount.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -47,6 +53,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <assert.h>
 #include <err.h>
 #include <uuid.h>
@@ -59,6 +66,10 @@
 #include "hammer2_subs.h"
 
 static uint64_t nowtime(void);
+static void phase_mark(const char *name);
+static void zero_volume(hammer2_volume_t *vol, hammer2_off_t off,
+			hammer2_off_t bytes, hammer2_off_t zero_base,
+			const char *what);
 static int blkrefary_cmp(const void *b1, const void *b2);
 static void alloc_direct(hammer2_off_t *basep, hammer2_blockref_t *bref,
 				size_t bytes);
@@ -146,6 +157,11 @@ hammer2_mkfs_init(hammer2_mkfs_options_t *opt)
 	opt->CompType = HAMMER2_COMP_DEFAULT; /* LZ4 */
 	opt->CheckType = HAMMER2_CHECK_DEFAULT; /* xxhash64 */
 	opt->DefaultLabelType = HAMMER2_LABEL_NONE;
+	opt->NThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (opt->NThreads < 1)
+		opt->NThreads = 1;
+	else if (opt->NThreads > 256)
+		opt->NThreads = 256;
 
 	/*
 	 * Generate a filesystem id and lookup the filesystem type
@@ -194,6 +210,8 @@ adjust_options(hammer2_ondisk_t *fso, hammer2_mkfs_options_t *opt)
 		assert(0);
 		break;
 	}
+	if (opt->SourceDir && opt->NLabels == 1)
+		errx(1, "-D requires a label to populate");
 
 	/*
 	 * Calculate defaults for the boot area size and round to the
@@ -306,29 +324,129 @@ nowtime(void)
 	return(xtime);
 }
 
+/*
+ * Per-phase wall clock time, reported with --timing.  phase_mark()
+ * charges the time since the previous mark to (name), summed over
+ * all volumes.
+ */
+static struct {
+	const char *name;
+	uint64_t usec;
+} Phases[16];
+static int NPhases;
+static uint64_t PhaseMark;
+
+static void
+phase_mark(const char *name)
+{
+	uint64_t now = nowtime();
+	int i;
+
+	for (i = 0; i < NPhases; ++i) {
+		if (strcmp(Phases[i].name, name) == 0)
+			break;
+	}
+	if (i == NPhases) {
+		assert(NPhases < (int)(sizeof(Phases) / sizeof(Phases[0])));
+		Phases[NPhases++].name = name;
+	}
+	Phases[i].usec += now - PhaseMark;
+	PhaseMark = now;
+}
+
+/*
+ * Returns the offset from which the volume is known to read back as
+ * zeros, which is the original end of a regular file.
+ */
+static hammer2_off_t
+volume_zero_base(hammer2_volume_t *vol)
+{
+	struct stat st;
+
+	if (fstat(vol->fd, &st) == 0 && S_ISREG(st.st_mode))
+		return(st.st_size);
+	return((hammer2_off_t)-1);
+}
+
+/*
+ * Zero (bytes) at (off).  Nothing needs to be written at or beyond
+ * (zero_base).  Otherwise punch a hole in a regular file or zero-out
+ * the range of a device where supported, falling back to large vectored
+ * writes.
+ */
+#define ZERO_BUFSIZE	(1024 * 1024)
+#define ZERO_IOVS	8
+
+static void
+zero_volume(hammer2_volume_t *vol, hammer2_off_t off, hammer2_off_t bytes,
+	    hammer2_off_t zero_base, const char *what)
+{
+	struct iovec iov[ZERO_IOVS];
+	struct stat st;
+	hammer2_off_t n;
+	ssize_t ret;
+	char *buf;
+	int cnt;
+
+	if (off >= zero_base)
+		return;
+	if (off + bytes > zero_base)
+		bytes = zero_base - off;
+	if (bytes == 0)
+		return;
+
+	if (fstat(vol->fd, &st) == 0) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+		if (S_ISREG(st.st_mode) &&
+		    fallocate(vol->fd, FALLOC_FL_PUNCH_HOLE |
+			      FALLOC_FL_KEEP_SIZE, off, bytes) == 0)
+			return;
+#endif
+#ifdef BLKZEROOUT
+		if (S_ISBLK(st.st_mode)) {
+			uint64_t range[2] = { off, bytes };
+
+			if (ioctl(vol->fd, BLKZEROOUT, range) == 0)
+				return;
+		}
+#endif
+	}
+
+	buf = calloc(1, ZERO_BUFSIZE);
+	assert(buf);
+	while (bytes) {
+		n = 0;
+		for (cnt = 0; cnt < ZERO_IOVS && n < bytes; ++cnt) {
+			iov[cnt].iov_base = buf;
+			iov[cnt].iov_len = ZERO_BUFSIZE;
+			if (iov[cnt].iov_len > bytes - n)
+				iov[cnt].iov_len = bytes - n;
+			n += iov[cnt].iov_len;
+		}
+		ret = pwritev(vol->fd, iov, cnt, off);
+		if (ret <= 0) {
+			fprintf(stderr, "write (%s): %s\n", what,
+				ret < 0 ? strerror(errno) : "short write");
+			exit(1);
+		}
+		off += ret;
+		bytes -= ret;
+	}
+	free(buf);
+}
+
 static hammer2_off_t
 format_hammer2_misc(hammer2_volume_t *vol, hammer2_mkfs_options_t *opt,
-		    hammer2_off_t boot_base, hammer2_off_t aux_base)
+		    hammer2_off_t boot_base, hammer2_off_t aux_base,
+		    hammer2_off_t zero_base)
 {
-	char *buf = malloc(HAMMER2_PBUFSIZE);
 	hammer2_off_t alloc_base = aux_base + opt->AuxAreaSize;
-	hammer2_off_t tmp_base;
-	size_t n;
-	int i;
 
 	/*
 	 * Clear the entire 4MB reserve for the first 2G zone.
 	 */
-	bzero(buf, HAMMER2_PBUFSIZE);
-	tmp_base = 0;
-	for (i = 0; i < HAMMER2_ZONE_BLOCKS_SEG; ++i) {
-		n = pwrite(vol->fd, buf, HAMMER2_PBUFSIZE, tmp_base);
-		if (n != HAMMER2_PBUFSIZE) {
-			perror("write");
-			exit(1);
-		}
-		tmp_base += HAMMER2_PBUFSIZE;
-	}
+	zero_volume(vol, 0, HAMMER2_ZONE_SEG64, zero_base, "reserve");
+	phase_mark("clear reserve");
 
 	/*
 	 * Make sure alloc_base won't cross the reserved area at the
@@ -343,28 +461,24 @@ format_hammer2_misc(hammer2_volume_t *vol, hammer2_mkfs_options_t *opt,
 	/*
 	 * Clear the boot/aux area.
 	 */
-	for (tmp_base = boot_base; tmp_base < alloc_base;
-	     tmp_base += HAMMER2_PBUFSIZE) {
-		n = pwrite(vol->fd, buf, HAMMER2_PBUFSIZE, tmp_base);
-		if (n != HAMMER2_PBUFSIZE) {
-			perror("write (boot/aux)");
-			exit(1);
-		}
-	}
+	zero_volume(vol, boot_base, alloc_base - boot_base, zero_base,
+		    "boot/aux");
+	phase_mark("clear boot/aux");
 
-	free(buf);
 	return(alloc_base);
 }
 
 static hammer2_off_t
-format_hammer2_inode(hammer2_volume_t *vol, hammer2_mkfs_options_t *opt,
+format_hammer2_inode(hammer2_ondisk_t *fso, hammer2_volume_t *vol,
+		     hammer2_mkfs_options_t *opt,
 		     hammer2_blockref_t *sroot_blockrefp,
-		     hammer2_off_t alloc_base)
+		     hammer2_off_t alloc_base, hammer2_off_t *pop_endp)
 {
 	char *buf = malloc(HAMMER2_PBUFSIZE);
 	hammer2_inode_data_t *rawip;
 	hammer2_blockref_t sroot_blockref;
 	hammer2_blockref_t root_blockref[MAXLABELS];
+	hammer2_off_t pop_base;
 	uint64_t now;
 	size_t n;
 	int i;
@@ -376,6 +490,16 @@ format_hammer2_inode(hammer2_volume_t *vol, hammer2_mkfs_options_t *opt,
 	alloc_base &= ~HAMMER2_PBUFMASK64;
 	alloc_direct(&alloc_base, &sroot_blockref, HAMMER2_INODE_BYTES);
 
+	/*
+	 * The kernel treats the whole 4MB segment containing allocator_beg
+	 * as static, so populated data (-D) starts at the next segment
+	 * where the freemap and bulkfree manage it like any other data.
+	 */
+	pop_base = (alloc_base + HAMMER2_SEGMASK64) & ~HAMMER2_SEGMASK64;
+	if ((pop_base & HAMMER2_FREEMAP_LEVEL1_MASK) < HAMMER2_ZONE_SEG64)
+		pop_base += HAMMER2_ZONE_SEG64;
+	*pop_endp = pop_base;
+
 	for (i = 0; i < opt->NLabels; ++i) {
 		uuid_create(&opt->Hammer2_PfsCLID[i], NULL);
 		uuid_create(&opt->Hammer2_PfsFSID[i], NULL);
@@ -436,7 +560,18 @@ format_hammer2_inode(hammer2_volume_t *vol, hammer2_mkfs_options_t *opt,
 		/* first allocatable inode number */
 		rawip->meta.pfs_inum = 16;
 
-		/* rawip->u.blockset is left empty */
+		/*
+		 * rawip->u.blockset is left empty, unless the last PFS is
+		 * populated from a directory (-D), in which case its
+		 * contents are laid out from the segment following the
+		 * block holding the super-root and PFS root inodes.
+		 */
+		if (opt->SourceDir && i == opt->NLabels - 1) {
+			phase_mark("root inodes");
+			hammer2_populate(fso, opt, rawip, &root_blockref[i],
+					 pop_endp);
+			phase_mark("populate");
+		}
 
 		/*
 		 * The root blockref will be stored in the super-root inode as
@@ -512,6 +647,11 @@ format_hammer2_inode(hammer2_volume_t *vol, hammer2_mkfs_options_t *opt,
 	qsort(root_blockref, opt->NLabels, sizeof(root_blockref[0]), blkrefary_cmp);
 	for (i = 0; i < opt->NLabels; ++i)
 		rawip->u.blockset.blockref[i] = root_blockref[i];
+	if (opt->SourceDir) {
+		for (i = 0; i < opt->NLabels; ++i)
+			hammer2_populate_addstats(&sroot_blockref,
+						  &root_blockref[i]);
+	}
 
 	/*
 	 * The sroot blockref will be stored in the volume header.
@@ -538,6 +678,7 @@ format_hammer2_inode(hammer2_volume_t *vol, hammer2_mkfs_options_t *opt,
 		exit(1);
 	}
 	*sroot_blockrefp = sroot_blockref;
+	phase_mark("root inodes");
 
 	free(buf);
 	return(alloc_base);
@@ -547,7 +688,10 @@ format_hammer2_inode(hammer2_volume_t *vol, hammer2_mkfs_options_t *opt,
  * Create the volume header, the super-root directory inode, and
  * the writable snapshot subdirectory (named via the label) which
  * is to be the initial mount point, or at least the first mount point.
- * newfs_hammer2 doesn't format the freemap bitmaps for these.
+ * newfs_hammer2 doesn't format the freemap bitmaps for these, except
+ * when populating from a directory (-D), in which case the populated
+ * data starts at the segment following the root inodes and the freemap
+ * marks it allocated.
  *
  * 0                      4MB
  * [----reserved_area----][boot_area][aux_area]
@@ -566,13 +710,20 @@ format_hammer2(hammer2_ondisk_t *fso, hammer2_mkfs_options_t *opt, int index)
 	hammer2_blockset_t sroot_blockset;
 	hammer2_off_t boot_base = HAMMER2_ZONE_SEG;
 	hammer2_off_t aux_base = boot_base + opt->BootAreaSize;
+	hammer2_blockset_t freemap_blockset;
 	hammer2_off_t alloc_base;
+	hammer2_off_t pop_end;
+	hammer2_off_t zero_base;
+	hammer2_off_t used;
 	size_t n;
 	int i;
 
 	/*
-	 * Make sure we can write to the last usable block.
+	 * Make sure we can write to the last usable block.  Whatever
+	 * lies past the original end of a regular file reads back as
+	 * zeros and need not be cleared.
 	 */
+	zero_base = volume_zero_base(vol);
 	bzero(buf, HAMMER2_PBUFSIZE);
 	n = pwrite(vol->fd, buf, HAMMER2_PBUFSIZE,
 		   vol->size - HAMMER2_PBUFSIZE);
@@ -580,16 +731,29 @@ format_hammer2(hammer2_ondisk_t *fso, hammer2_mkfs_options_t *opt, int index)
 		perror("write (at-end-of-volume)");
 		exit(1);
 	}
+	phase_mark("end-of-volume test");
 
 	/*
 	 * Format misc area and sroot/root inodes for the root volume.
 	 */
 	bzero(&sroot_blockset, sizeof(sroot_blockset));
+	bzero(&freemap_blockset, sizeof(freemap_blockset));
+	used = 0;
 	if (vol->id == HAMMER2_ROOT_VOLUME) {
-		alloc_base = format_hammer2_misc(vol, opt, boot_base, aux_base);
-		alloc_base = format_hammer2_inode(vol, opt,
+		alloc_base = format_hammer2_misc(vol, opt, boot_base, aux_base,
+						 zero_base);
+		alloc_base = format_hammer2_inode(fso, vol, opt,
 						  &sroot_blockset.blockref[0],
-						  alloc_base);
+						  alloc_base, &pop_end);
+		/*
+		 * Everything below alloc_base is static, the populated
+		 * data up to pop_end is marked allocated in the freemap.
+		 */
+		if (opt->SourceDir) {
+			used = hammer2_populate_freemap(fso, alloc_base,
+						pop_end, &freemap_blockset);
+			phase_mark("freemap");
+		}
 	} else {
 		alloc_base = 0;
 		for (i = 0; i < HAMMER2_SET_COUNT; ++i)
@@ -638,11 +802,12 @@ format_hammer2(hammer2_ondisk_t *fso, hammer2_mkfs_options_t *opt, int index)
 	assert(vol->id == HAMMER2_ROOT_VOLUME || alloc_base == 0);
 	voldata->allocator_size = fso->free_size;
 	if (vol->id == HAMMER2_ROOT_VOLUME) {
-		voldata->allocator_free = fso->free_size;
+		voldata->allocator_free = fso->free_size - used;
 		voldata->allocator_beg = alloc_base;
 	}
 
 	voldata->sroot_blockset = sroot_blockset;
+	voldata->freemap_blockset = freemap_blockset;
 	voldata->mirror_tid = 16;	/* all blockref mirror TIDs set to 16 */
 	voldata->freemap_tid = 16;	/* all blockref mirror TIDs set to 16 */
 	voldata->icrc_sects[HAMMER2_VOL_ICRC_SECT1] =
@@ -674,7 +839,9 @@ format_hammer2(hammer2_ondisk_t *fso, hammer2_mkfs_options_t *opt, int index)
 			exit(1);
 		}
 	}
+	phase_mark("volume headers");
 	fsync(vol->fd);
+	phase_mark("sync");
 
 	/*
 	 * Cleanup
@@ -736,6 +903,7 @@ hammer2_mkfs(int ac, char **av, hammer2_mkfs_options_t *opt)
 	assert(sizeof(hammer2_volume_data_t) == HAMMER2_VOLUME_BYTES);
 	assert(sizeof(hammer2_inode_data_t) == HAMMER2_INODE_BYTES);
 	assert(sizeof(hammer2_blockref_t) == HAMMER2_BLOCKREF_BYTES);
+	PhaseMark = nowtime();
 
 	/*
 	 * Construct volumes information.
@@ -801,6 +969,7 @@ hammer2_mkfs(int ac, char **av, hammer2_mkfs_options_t *opt)
 		       sizetostr(vol->size));
 	}
 	hammer2_verify_volumes(&fso, NULL);
+	phase_mark("open volumes");
 
 	/*
 	 * Adjust options.
@@ -838,9 +1007,10 @@ hammer2_mkfs(int ac, char **av, hammer2_mkfs_options_t *opt)
 	}
 
 	/*
-	 * Format HAMMER2 volumes.
+	 * Format HAMMER2 volumes.  The root volume goes last, as it may
+	 * populate (-D) the others, which must not be formatted after.
 	 */
-	for (i = 0; i < fso.nvolumes; ++i)
+	for (i = fso.nvolumes - 1; i >= 0; --i)
 		format_hammer2(&fso, opt, i);
 
 	printf("---------------------------------------------\n");
@@ -874,6 +1044,17 @@ hammer2_mkfs(int ac, char **av, hammer2_mkfs_options_t *opt)
 		printf("---------------------------------------------\n");
 		hammer2_print_volumes(&fso);
 	}
+	if (opt->Timing) {
+		uint64_t total = 0;
+
+		printf("---------------------------------------------\n");
+		for (i = 0; i < NPhases; ++i) {
+			printf("%-18s%8.3f sec\n", Phases[i].name,
+			       Phases[i].usec / 1000000.0);
+			total += Phases[i].usec;
+		}
+		printf("%-18s%8.3f sec\n", "total", total / 1000000.0);
+	}
 
 	free(vol_fsid);
 	free(sup_clid_name);
@@ -69,6 +69,9 @@ typedef struct {
 	int CheckType; /* default XXHASH64 */
 	int DefaultLabelType;
 	int DebugOpt;
+	char *SourceDir; /* populate the last label from this directory */
+	int NThreads; /* threads compressing file data */
+	int Timing; /* report per-phase durations */
 } hammer2_mkfs_options_t;
 
 void hammer2_mkfs_init(hammer2_mkfs_options_t *opt);
@@ -78,4 +81,13 @@ int64_t getsize(const char *str, int64_t minval, int64_t maxval, int pw);
 
 void hammer2_mkfs(int ac, char **av, hammer2_mkfs_options_t *opt);
 
+void hammer2_populate(hammer2_ondisk_t *fso, hammer2_mkfs_options_t *opt,
+		      hammer2_inode_data_t *rootip,
+		      hammer2_blockref_t *root_bref, hammer2_off_t *allocp);
+hammer2_off_t hammer2_populate_freemap(hammer2_ondisk_t *fso,
+		      hammer2_off_t alloc_beg, hammer2_off_t pop_end,
+		      hammer2_blockset_t *bset);
+void hammer2_populate_addstats(hammer2_blockref_t *parent,
+		      const hammer2_blockref_t *elm);
+
 #endif /* !NEWFS_HAMMER2_H_ */
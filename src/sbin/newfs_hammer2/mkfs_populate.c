@@ -0,0 +1,1634 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2022-2023 Tomohiro Kusumi <tkusumi@netbsd.org>
+ * Copyright (c) 2011-2022 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Matthew Dillon <dillon@dragonflybsd.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Populate the PFS being created from a directory tree (newfs_hammer2 -D).
+ *
+ * The source tree is scanned first and every object is given an inode
+ * number, starting at HAMMER2_INODE_START in depth-first order.  Objects
+ * are then laid out in inode number order, each one as its file data,
+ * its indirect blocks and finally its inode, using a bump allocator which
+ * hands out storage contiguously from the 4MB segment following the
+ * super-root block.  Reading and compressing file data is farmed out to
+ * worker threads, but blocks are allocated and written by the main thread
+ * in dispatch order so the image does not depend on the number of threads.
+ * The PFS root's block table, which indexes all inodes and the top-level
+ * directory entries, is built last.
+ *
+ * Only the segment holding the super-root block is static (allocator_beg).
+ * hammer2_populate_freemap() builds freemap leaves marking the populated
+ * blocks allocated, so they are reclaimed by bulkfree like any other data
+ * once they are no longer referenced.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <uuid.h>
+
+#include <fs/hammer2/hammer2_disk.h>
+#include <fs/hammer2/hammer2_xxhash.h>
+#include <fs/hammer2/hammer2_lz4.h>
+
+#include "mkfs_hammer2.h"
+#include "hammer2_subs.h"
+
+#define POP_JOB_BLOCKS	16			/* 64KB blocks per job */
+#define POP_WBUFSIZE	(4 * 1024 * 1024)	/* write combining */
+#define POP_STACK	(1024 * 1024)
+
+/*
+ * File block tables use the kernel's nominal indirect block size, each
+ * level of the tree covering a fixed key range.
+ */
+#define POP_FILE_RADIX	7			/* 128 blockrefs */
+#define POP_FILE_LEVELS	7			/* 2^23 ... 2^63 */
+
+#define POP_MTID	16	/* matches the mirror_tid newfs uses */
+
+#define POP_FMBASE(key, radix)	((key) & ~(((hammer2_off_t)1 << (radix)) - 1))
+
+typedef struct pop_inode pop_inode_t;
+
+typedef struct pop_dirent {
+	char		*name;
+	size_t		namlen;
+	hammer2_key_t	key;
+	pop_inode_t	*ip;
+} pop_dirent_t;
+
+struct pop_inode {
+	char		*path;		/* source path (files, softlinks) */
+	char		*data;		/* softlink target */
+	struct stat	st;
+	hammer2_key_t	inum;
+	hammer2_key_t	iparent;
+	uint8_t		type;
+	int		nlinks;
+	pop_dirent_t	*dirents;	/* directories */
+	int		ndirents;
+	hammer2_blockref_t bref;	/* inode blockref, once written */
+};
+
+typedef struct pop_job {
+	struct pop_job	*next;		/* dispatch order / free list */
+	struct pop_job	*qnext;		/* work queue */
+	pop_inode_t	*ip;
+	hammer2_key_t	lbase;
+	int		nblocks;
+	int		work;		/* needs a worker */
+	int		last;		/* last job for this inode */
+	int		done;
+	int		error;		/* errno, or -1 for a short read */
+	char		*ibuf;
+	char		*obuf;
+	char		*pdata[POP_JOB_BLOCKS];
+	int		psize[POP_JOB_BLOCKS];	/* 0 for a hole */
+	hammer2_blockref_t bref[POP_JOB_BLOCKS];
+} pop_job_t;
+
+typedef struct pop_level {
+	hammer2_blockref_t bref[1 << POP_FILE_RADIX];
+	int		count;
+} pop_level_t;
+
+typedef struct {
+	hammer2_ondisk_t *fso;
+	hammer2_mkfs_options_t *opt;
+	const char	*srcdir;
+	uint8_t		comp_algo;	/* inherited from the PFS root */
+	uint8_t		check_algo;
+	pop_inode_t	**inodes;	/* by inum - HAMMER2_INODE_START */
+	size_t		ninodes;
+	size_t		maxinodes;
+	pop_inode_t	**links;	/* (st_dev, st_ino) of hardlinks */
+	size_t		linksize;
+	size_t		linkcount;
+	pop_dirent_t	*rootdirents;
+	int		nrootdirents;
+	pop_level_t	level[POP_FILE_LEVELS];	/* current file */
+	pop_job_t	*freejobs;
+	hammer2_off_t	alloc;		/* next allocation */
+	hammer2_off_t	wbase;		/* media offset of wbuf */
+	size_t		wlen;
+	char		*wbuf;
+	char		*ibuf;		/* indirect block scratch */
+	uint64_t	nfiles;
+	uint64_t	ndirs;
+	uint64_t	nother;
+	hammer2_off_t	file_bytes;	/* logical */
+	hammer2_off_t	stored_bytes;	/* physical data blocks */
+} pop_t;
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		/* job queued or stopping */
+	pthread_cond_t	done_cond;	/* job done */
+	pop_job_t	*head;		/* dispatched, not yet retired */
+	pop_job_t	**tailp;
+	pop_job_t	*qhead;		/* waiting for a worker */
+	pop_job_t	**qtailp;
+	pthread_t	*threads;
+	int		nthreads;
+	int		inflight;
+	int		stopping;
+} PopPool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Freemap blocks (16KB) holding populated data, for
+ * hammer2_populate_freemap().  Alignment leaves some blocks unused.
+ */
+static struct {
+	hammer2_off_t	base;		/* of bit 0 */
+	uint8_t		*bits;
+	size_t		nbytes;
+} PopUsed;
+
+static pop_inode_t *pop_scan_object(pop_t *pop, const char *path,
+			struct stat *st, hammer2_key_t iparent);
+static void pop_scan_dir(pop_t *pop, const char *path, pop_inode_t *dip);
+static void pop_retire_jobs(pop_t *pop, int limit);
+static void pop_retire_job(pop_t *pop, pop_job_t *job);
+static void pop_indirect(pop_t *pop, hammer2_blockref_t *brefs, int count,
+			hammer2_key_t key, int keybits,
+			hammer2_blockref_t *out);
+
+static uint64_t
+pop_time(const struct timespec *ts)
+{
+	return((uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000);
+}
+
+static double
+pop_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return(tv.tv_sec + tv.tv_usec / 1000000.0);
+}
+
+static void
+pop_guid_to_uuid(uuid_t *uuid, uint32_t guid)
+{
+	bzero(uuid, sizeof(*uuid));
+	*(uint32_t *)&uuid->node[2] = guid;
+}
+
+static uint8_t
+pop_obj_type(mode_t mode)
+{
+	switch (mode & S_IFMT) {
+	case S_IFDIR:
+		return(HAMMER2_OBJTYPE_DIRECTORY);
+	case S_IFREG:
+		return(HAMMER2_OBJTYPE_REGFILE);
+	case S_IFIFO:
+		return(HAMMER2_OBJTYPE_FIFO);
+	case S_IFCHR:
+		return(HAMMER2_OBJTYPE_CDEV);
+	case S_IFBLK:
+		return(HAMMER2_OBJTYPE_BDEV);
+	case S_IFLNK:
+		return(HAMMER2_OBJTYPE_SOFTLINK);
+	case S_IFSOCK:
+		return(HAMMER2_OBJTYPE_SOCKET);
+	}
+	return(HAMMER2_OBJTYPE_UNKNOWN);
+}
+
+static int
+pop_radix(size_t bytes)
+{
+	int radix = HAMMER2_RADIX_MIN;
+
+	while (((size_t)1 << radix) < bytes)
+		++radix;
+	assert(((size_t)1 << radix) == bytes);
+	return(radix);
+}
+
+static int
+pop_highbit(hammer2_key_t key)
+{
+	int bit = 63;
+
+	assert(key);
+	while ((key & ((hammer2_key_t)1 << bit)) == 0)
+		--bit;
+	return(bit);
+}
+
+/*
+ * Physical size of the block at (lbase), which is smaller than 64KB only
+ * for the block containing the EOF.  Same as hammer2_calc_physical().
+ */
+static int
+pop_physical(off_t size, hammer2_key_t lbase)
+{
+	int pblksize, eofbytes;
+
+	if (lbase + HAMMER2_PBUFSIZE <= (hammer2_key_t)size)
+		return(HAMMER2_PBUFSIZE);
+	eofbytes = (int)(size - lbase);
+	pblksize = HAMMER2_PBUFSIZE;
+	while (pblksize >= eofbytes && pblksize >= HAMMER2_ALLOC_MIN)
+		pblksize >>= 1;
+	pblksize <<= 1;
+
+	return(pblksize);
+}
+
+static int
+pop_zero_block(const char *data, int bytes)
+{
+	const uint64_t *p = (const uint64_t *)data;
+	int i;
+
+	for (i = 0; i < bytes / (int)sizeof(*p); ++i) {
+		if (p[i])
+			return(0);
+	}
+	return(1);
+}
+
+static void
+pop_setcheck(hammer2_blockref_t *bref, const void *data, size_t bytes)
+{
+	switch (HAMMER2_DEC_CHECK(bref->methods)) {
+	case HAMMER2_CHECK_NONE:
+	case HAMMER2_CHECK_DISABLED:
+		break;
+	case HAMMER2_CHECK_ISCSI32:
+		bref->check.iscsi32.value = hammer2_icrc32(data, bytes);
+		break;
+	case HAMMER2_CHECK_XXHASH64:
+		bref->check.xxhash64.value =
+			XXH64(data, bytes, XXH_HAMMER2_SEED);
+		break;
+	default:
+		errx(1, "Unsupported check mode %d",
+		     HAMMER2_DEC_CHECK(bref->methods));
+		/* not reached */
+	}
+}
+
+/*
+ * Account (elm) in the statistics of the blockref of the block table it
+ * is stored in, the same way hammer2_base_insert() does.
+ */
+void
+hammer2_populate_addstats(hammer2_blockref_t *parent,
+			  const hammer2_blockref_t *elm)
+{
+	if ((int)(elm->data_off & HAMMER2_OFF_MASK_RADIX))
+		parent->embed.stats.data_count += (hammer2_off_t)1 <<
+			(int)(elm->data_off & HAMMER2_OFF_MASK_RADIX);
+
+	switch (elm->type) {
+	case HAMMER2_BREF_TYPE_INODE:
+		++parent->embed.stats.inode_count;
+		/* fall through */
+	case HAMMER2_BREF_TYPE_DATA:
+		if (parent->leaf_count != HAMMER2_BLOCKREF_LEAF_MAX)
+			++parent->leaf_count;
+		/* fall through */
+	case HAMMER2_BREF_TYPE_INDIRECT:
+		if (elm->type != HAMMER2_BREF_TYPE_DATA) {
+			parent->embed.stats.data_count +=
+				elm->embed.stats.data_count;
+			parent->embed.stats.inode_count +=
+				elm->embed.stats.inode_count;
+		}
+		if (elm->type == HAMMER2_BREF_TYPE_INODE)
+			break;
+		if (parent->leaf_count + elm->leaf_count <
+		    HAMMER2_BLOCKREF_LEAF_MAX)
+			parent->leaf_count += elm->leaf_count;
+		else
+			parent->leaf_count = HAMMER2_BLOCKREF_LEAF_MAX;
+		break;
+	case HAMMER2_BREF_TYPE_DIRENT:
+		if (parent->leaf_count != HAMMER2_BLOCKREF_LEAF_MAX)
+			++parent->leaf_count;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Write (bytes) at logical media offset (off), which must not cross
+ * a volume boundary.
+ */
+static void
+pop_pwrite(hammer2_ondisk_t *fso, const void *buf, size_t bytes,
+	   hammer2_off_t off)
+{
+	hammer2_volume_t *vol;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < fso->nvolumes; ++i) {
+		vol = &fso->volumes[i];
+		if (off >= vol->offset && off < vol->offset + vol->size)
+			break;
+	}
+	assert(i < fso->nvolumes);
+	assert(off + bytes <= vol->offset + vol->size);
+
+	n = pwrite(vol->fd, buf, bytes, off - vol->offset);
+	if (n != (ssize_t)bytes) {
+		perror("write (populate)");
+		exit(1);
+	}
+}
+
+static void
+pop_flush(pop_t *pop)
+{
+	if (pop->wlen) {
+		pop_pwrite(pop->fso, pop->wbuf, pop->wlen, pop->wbase);
+		pop->wlen = 0;
+	}
+}
+
+static void
+pop_mark_used(hammer2_off_t off, size_t bytes)
+{
+	size_t n, last, nbytes;
+
+	n = (off - PopUsed.base) >> HAMMER2_FREEMAP_BLOCK_RADIX;
+	last = (off + bytes - 1 - PopUsed.base) >> HAMMER2_FREEMAP_BLOCK_RADIX;
+	if (last / 8 >= PopUsed.nbytes) {
+		nbytes = PopUsed.nbytes ? PopUsed.nbytes * 2 : 4096;
+		while (last / 8 >= nbytes)
+			nbytes *= 2;
+		PopUsed.bits = realloc(PopUsed.bits, nbytes);
+		assert(PopUsed.bits);
+		bzero(PopUsed.bits + PopUsed.nbytes, nbytes - PopUsed.nbytes);
+		PopUsed.nbytes = nbytes;
+	}
+	for (; n <= last; ++n)
+		PopUsed.bits[n / 8] |= 1 << (n % 8);
+}
+
+static int
+pop_is_used(hammer2_off_t off)
+{
+	size_t n;
+
+	if (off < PopUsed.base)
+		return(0);
+	n = (off - PopUsed.base) >> HAMMER2_FREEMAP_BLOCK_RADIX;
+	return(n / 8 < PopUsed.nbytes &&
+	       (PopUsed.bits[n / 8] & (1 << (n % 8))));
+}
+
+/*
+ * Allocate storage for (bytes) of (data) and queue the write.  Storage is
+ * handed out sequentially, each block aligned to its size like the kernel
+ * allocator does, and the reserved segment at the beginning of every 1GB
+ * is skipped.  Alignment gaps are zero-filled so media writes stay
+ * contiguous.
+ *
+ * Returns the data_off for a blockref, including the size radix.
+ */
+static hammer2_off_t
+pop_alloc(pop_t *pop, const void *data, size_t bytes)
+{
+	hammer2_off_t off = pop->alloc;
+	hammer2_off_t gap;
+
+	off = (off + bytes - 1) & ~(hammer2_off_t)(bytes - 1);
+	if ((off & HAMMER2_FREEMAP_LEVEL1_MASK) < HAMMER2_ZONE_SEG64)
+		off = H2FMZONEBASE(off) + HAMMER2_ZONE_SEG64;
+	if (off + bytes > pop->fso->total_size)
+		errx(1, "Not enough space to populate from %s", pop->srcdir);
+
+	gap = off - (pop->wbase + pop->wlen);
+	if (pop->wlen == 0 || gap >= HAMMER2_PBUFSIZE ||
+	    pop->wlen + gap + bytes > POP_WBUFSIZE) {
+		pop_flush(pop);
+		pop->wbase = off;
+	} else if (gap) {
+		bzero(pop->wbuf + pop->wlen, gap);
+		pop->wlen += gap;
+	}
+	bcopy(data, pop->wbuf + pop->wlen, bytes);
+	pop->wlen += bytes;
+	pop->alloc = off + bytes;
+	pop_mark_used(off, bytes);
+
+	return(off | pop_radix(bytes));
+}
+
+/*
+ * Write an indirect block holding (count) sorted blockrefs and covering
+ * (key, keybits), returning its blockref in (out).  (out) may point into
+ * (brefs).
+ */
+static void
+pop_indirect(pop_t *pop, hammer2_blockref_t *brefs, int count,
+	     hammer2_key_t key, int keybits, hammer2_blockref_t *out)
+{
+	hammer2_blockref_t bref;
+	size_t bytes;
+	int i;
+
+	assert(count > 0 && count <= HAMMER2_IND_COUNT_MAX);
+	bytes = HAMMER2_IND_BYTES_MIN;
+	while (bytes < count * sizeof(hammer2_blockref_t))
+		bytes <<= 1;
+
+	bzero(pop->ibuf, bytes);
+	bcopy(brefs, pop->ibuf, count * sizeof(hammer2_blockref_t));
+
+	bzero(&bref, sizeof(bref));
+	bref.type = HAMMER2_BREF_TYPE_INDIRECT;
+	bref.methods = HAMMER2_ENC_CHECK(HAMMER2_CHECK_XXHASH64) |
+		       HAMMER2_ENC_COMP(HAMMER2_COMP_NONE);
+	bref.keybits = keybits;
+	bref.key = key;
+	bref.mirror_tid = POP_MTID;
+	bref.modify_tid = POP_MTID;
+	for (i = 0; i < count; ++i)
+		hammer2_populate_addstats(&bref, &brefs[i]);
+	pop_setcheck(&bref, pop->ibuf, bytes);
+	bref.data_off = pop_alloc(pop, pop->ibuf, bytes);
+	*out = bref;
+}
+
+/*
+ * Group brefs[lo, hi) under indirect blocks, storing the resulting
+ * blockrefs at brefs[*noutp] onwards.  A range which does not fit in one
+ * indirect block is split on the highest key bit that differs, so every
+ * indirect block covers an aligned key range which does not overlap its
+ * siblings.  The range must not span bit 63, the kernel cannot handle
+ * an indirect block with keybits 64.
+ */
+static void
+pop_group(pop_t *pop, hammer2_blockref_t *brefs, int lo, int hi, int *noutp)
+{
+	hammer2_key_t key, end;
+	int bit, mid, n;
+
+	if (hi - lo == 1) {
+		brefs[(*noutp)++] = brefs[lo];
+		return;
+	}
+	if (hi - lo <= HAMMER2_IND_COUNT_MAX) {
+		key = brefs[lo].key;
+		end = brefs[hi - 1].key;
+		assert(brefs[hi - 1].keybits < 64);
+		end += ((hammer2_key_t)1 << brefs[hi - 1].keybits) - 1;
+		bit = pop_highbit(key ^ end) + 1;
+		assert(bit < 64);
+		n = (*noutp)++;
+		pop_indirect(pop, &brefs[lo], hi - lo,
+			     key & ~(((hammer2_key_t)1 << bit) - 1), bit,
+			     &brefs[n]);
+		return;
+	}
+
+	bit = pop_highbit(brefs[lo].key ^ brefs[hi - 1].key);
+	mid = lo + 1;
+	n = hi - 1;
+	while (mid < n) {
+		int i = (mid + n) / 2;
+
+		if (brefs[i].key & ((hammer2_key_t)1 << bit))
+			n = i;
+		else
+			mid = i + 1;
+	}
+	pop_group(pop, brefs, lo, mid, noutp);
+	pop_group(pop, brefs, mid, hi, noutp);
+}
+
+/*
+ * Reduce (count) sorted blockrefs to a set which fits in an inode,
+ * in place.  Returns the new count.  A PFS root holds both inodes and
+ * directory entries, whose keys have bit 63 set, so the two halves are
+ * reduced separately and end up side by side in the inode's blockset.
+ */
+static int
+pop_tree(pop_t *pop, hammer2_blockref_t *brefs, int count)
+{
+	int n, mid;
+
+	while (count > HAMMER2_SET_COUNT) {
+		for (mid = 0; mid < count; ++mid) {
+			if (brefs[mid].key & HAMMER2_DIRHASH_VISIBLE)
+				break;
+		}
+		n = 0;
+		if (mid)
+			pop_group(pop, brefs, 0, mid, &n);
+		if (mid < count)
+			pop_group(pop, brefs, mid, count, &n);
+		assert(n < count);
+		count = n;
+	}
+	return(count);
+}
+
+/*
+ * File data is streamed in key order, so the file's block table is built
+ * bottom-up as data blockrefs arrive.  level[n] collects the children of
+ * the indirect block covering 2^(16 + 7 * (n + 1)) bytes of the file.
+ * A group with a single child is passed up as is.  File offsets are below
+ * 2^63, so the top level covers 2^63 rather than 2^65.
+ */
+static int
+pop_level_radix(int level)
+{
+	int radix = HAMMER2_PBUFRADIX + POP_FILE_RADIX * (level + 1);
+
+	return(radix < 63 ? radix : 63);
+}
+
+static void pop_level_insert(pop_t *pop, int level,
+			const hammer2_blockref_t *bref);
+
+static void
+pop_level_flush(pop_t *pop, int level)
+{
+	pop_level_t *lv = &pop->level[level];
+	hammer2_blockref_t bref;
+	hammer2_key_t mask;
+	int radix;
+
+	if (lv->count == 0)
+		return;
+	if (lv->count == 1) {
+		bref = lv->bref[0];
+	} else {
+		radix = pop_level_radix(level);
+		mask = ((hammer2_key_t)1 << radix) - 1;
+		pop_indirect(pop, lv->bref, lv->count, lv->bref[0].key & ~mask,
+			     radix, &bref);
+	}
+	lv->count = 0;
+	pop_level_insert(pop, level + 1, &bref);
+}
+
+static void
+pop_level_insert(pop_t *pop, int level, const hammer2_blockref_t *bref)
+{
+	pop_level_t *lv;
+	int radix;
+
+	assert(level < POP_FILE_LEVELS);
+	lv = &pop->level[level];
+	radix = pop_level_radix(level);
+	if (lv->count && (lv->bref[0].key >> radix) != (bref->key >> radix))
+		pop_level_flush(pop, level);
+	assert(lv->count < (int)(sizeof(lv->bref) / sizeof(lv->bref[0])));
+	lv->bref[lv->count++] = *bref;
+}
+
+/*
+ * Finish the current file's block table, leaving at most
+ * HAMMER2_SET_COUNT blockrefs for the inode in (top).
+ */
+static int
+pop_level_finish(pop_t *pop, hammer2_blockref_t *top)
+{
+	pop_level_t *lv;
+	int i, j, count;
+
+	for (i = 0; i < POP_FILE_LEVELS; ++i) {
+		lv = &pop->level[i];
+		if (lv->count == 0)
+			continue;
+		for (j = i + 1; j < POP_FILE_LEVELS; ++j) {
+			if (pop->level[j].count)
+				break;
+		}
+		if (j == POP_FILE_LEVELS && lv->count <= HAMMER2_SET_COUNT)
+			break;
+		pop_level_flush(pop, i);
+	}
+	if (i == POP_FILE_LEVELS)
+		return(0);
+	count = lv->count;
+	bcopy(lv->bref, top, count * sizeof(*top));
+	lv->count = 0;
+
+	return(count);
+}
+
+/*
+ * Fill in the parts of an inode derived from the source object.
+ */
+static void
+pop_set_meta(pop_t *pop, hammer2_inode_meta_t *meta, const struct stat *st)
+{
+	meta->version = HAMMER2_INODE_VERSION_ONE;
+	meta->uflags = st->st_flags;
+	meta->ctime = pop_time(&st->st_ctim);
+	meta->mtime = pop_time(&st->st_mtim);
+	/* meta->atime NOT IMPL MUST BE ZERO */
+	meta->mode = st->st_mode & ALLPERMS;
+	pop_guid_to_uuid(&meta->uid, st->st_uid);
+	pop_guid_to_uuid(&meta->gid, st->st_gid);
+	meta->comp_algo = pop->comp_algo;
+	meta->check_algo = pop->check_algo;
+}
+
+/*
+ * Write the inode for (ip).  (top) is its block table, or (data) its
+ * embedded data.
+ */
+static void
+pop_write_inode(pop_t *pop, pop_inode_t *ip, const hammer2_blockref_t *top,
+		int count, const char *data, size_t bytes)
+{
+	hammer2_inode_data_t ipdata;
+	hammer2_blockref_t *bref = &ip->bref;
+	int i;
+
+	bzero(&ipdata, sizeof(ipdata));
+	pop_set_meta(pop, &ipdata.meta, &ip->st);
+	ipdata.meta.type = ip->type;
+	ipdata.meta.inum = ip->inum;
+	ipdata.meta.iparent = ip->iparent;
+	ipdata.meta.nlinks = ip->nlinks;
+	if (ip->type == HAMMER2_OBJTYPE_REGFILE ||
+	    ip->type == HAMMER2_OBJTYPE_SOFTLINK)
+		ipdata.meta.size = ip->st.st_size;
+	if (ip->type == HAMMER2_OBJTYPE_CDEV ||
+	    ip->type == HAMMER2_OBJTYPE_BDEV) {
+		ipdata.meta.rmajor = major(ip->st.st_rdev);
+		ipdata.meta.rminor = minor(ip->st.st_rdev);
+	}
+	ipdata.meta.name_len = snprintf((char *)ipdata.filename,
+					sizeof(ipdata.filename), "0x%016jx",
+					(uintmax_t)ip->inum);
+	ipdata.meta.name_key = ip->inum;
+
+	bzero(bref, sizeof(*bref));
+	if (data) {
+		assert(bytes <= HAMMER2_EMBEDDED_BYTES);
+		ipdata.meta.op_flags |= HAMMER2_OPFLAG_DIRECTDATA;
+		bcopy(data, ipdata.u.data, bytes);
+	} else {
+		for (i = 0; i < count; ++i) {
+			ipdata.u.blockset.blockref[i] = top[i];
+			hammer2_populate_addstats(bref, &top[i]);
+		}
+	}
+
+	bref->type = HAMMER2_BREF_TYPE_INODE;
+	bref->methods = HAMMER2_ENC_CHECK(HAMMER2_CHECK_XXHASH64) |
+			HAMMER2_ENC_COMP(HAMMER2_COMP_NONE);
+	bref->key = ip->inum;
+	bref->mirror_tid = POP_MTID;
+	bref->modify_tid = POP_MTID;
+	pop_setcheck(bref, &ipdata, sizeof(ipdata));
+	bref->data_off = pop_alloc(pop, &ipdata, sizeof(ipdata));
+}
+
+static int
+pop_dirent_cmp(const void *p1, const void *p2)
+{
+	const pop_dirent_t *d1 = p1;
+	const pop_dirent_t *d2 = p2;
+
+	if (d1->key < d2->key)
+		return(-1);
+	if (d1->key > d2->key)
+		return(1);
+	return(strcmp(d1->name, d2->name));
+}
+
+/*
+ * Hash the directory entries and sort them by key.  On a collision the
+ * key is bumped within the collision space, like hammer2_dirent_create().
+ */
+static void
+pop_dirent_keys(pop_dirent_t *dirents, int count)
+{
+	hammer2_key_t lhc;
+	int i;
+
+	for (i = 0; i < count; ++i)
+		dirents[i].key = dirhash(dirents[i].name, dirents[i].namlen);
+	qsort(dirents, count, sizeof(*dirents), pop_dirent_cmp);
+
+	for (i = 1; i < count; ++i) {
+		if (dirents[i].key > dirents[i - 1].key)
+			continue;
+		lhc = dirents[i - 1].key + 1;
+		if ((lhc ^ dirents[i].key) & ~HAMMER2_DIRHASH_LOMASK)
+			errx(1, "Too many hash collisions for %s",
+			     dirents[i].name);
+		dirents[i].key = lhc;
+	}
+}
+
+/*
+ * Build the directory entry blockref for (d).  Names which do not fit
+ * in the blockref go in a data block, like hammer2_xop_inode_mkdirent().
+ */
+static void
+pop_dirent_bref(pop_t *pop, const pop_dirent_t *d, hammer2_blockref_t *bref)
+{
+	char buf[HAMMER2_ALLOC_MIN];
+
+	bzero(bref, sizeof(*bref));
+	bref->type = HAMMER2_BREF_TYPE_DIRENT;
+	bref->methods = HAMMER2_ENC_CHECK(HAMMER2_CHECK_XXHASH64) |
+			HAMMER2_ENC_COMP(HAMMER2_COMP_NONE);
+	bref->key = d->key;
+	bref->mirror_tid = POP_MTID;
+	bref->modify_tid = POP_MTID;
+	bref->embed.dirent.inum = d->ip->inum;
+	bref->embed.dirent.namlen = d->namlen;
+	bref->embed.dirent.type = d->ip->type;
+
+	if (d->namlen <= sizeof(bref->check.buf)) {
+		bcopy(d->name, bref->check.buf, d->namlen);
+	} else {
+		bzero(buf, sizeof(buf));
+		bcopy(d->name, buf, d->namlen);
+		pop_setcheck(bref, buf, sizeof(buf));
+		bref->data_off = pop_alloc(pop, buf, sizeof(buf));
+	}
+}
+
+/*
+ * Lay out a directory: its entries, the indirect blocks above them and
+ * then its inode.
+ */
+static void
+pop_write_dir(pop_t *pop, pop_inode_t *dip)
+{
+	hammer2_blockref_t *brefs;
+	int i, count;
+
+	pop_dirent_keys(dip->dirents, dip->ndirents);
+	brefs = calloc(dip->ndirents + 1, sizeof(*brefs));
+	assert(brefs);
+	for (i = 0; i < dip->ndirents; ++i)
+		pop_dirent_bref(pop, &dip->dirents[i], &brefs[i]);
+	count = pop_tree(pop, brefs, dip->ndirents);
+	pop_write_inode(pop, dip, brefs, count, NULL, 0);
+	free(brefs);
+}
+
+/*
+ * Worker side of a job: read the job's part of the file, then detect
+ * holes and compress each block the way hammer2_write_file_core() would.
+ */
+static void
+pop_run_job(pop_t *pop, pop_job_t *job)
+{
+	pop_inode_t *ip = job->ip;
+	hammer2_blockref_t *bref;
+	hammer2_key_t lbase;
+	size_t bytes, got;
+	ssize_t n;
+	char *data, *cbuf;
+	int i, fd, pblksize, comp_size, comp_block_size;
+	int comp = HAMMER2_DEC_ALGO(pop->comp_algo);
+	int check = HAMMER2_DEC_ALGO(pop->check_algo);
+
+	if (job->nblocks) {
+		bytes = ip->st.st_size - job->lbase;
+		if (bytes > (size_t)job->nblocks * HAMMER2_PBUFSIZE)
+			bytes = (size_t)job->nblocks * HAMMER2_PBUFSIZE;
+	} else {
+		bytes = ip->st.st_size;
+	}
+
+	got = 0;
+	if (ip->data) {
+		bcopy(ip->data + job->lbase, job->ibuf, bytes);
+		got = bytes;
+	} else if ((fd = open(ip->path, O_RDONLY)) < 0) {
+		job->error = errno;
+	} else {
+		while (got < bytes) {
+			n = pread(fd, job->ibuf + got, bytes - got,
+				  job->lbase + got);
+			if (n <= 0) {
+				job->error = (n < 0) ? errno : -1;
+				break;
+			}
+			got += n;
+		}
+		close(fd);
+	}
+	bzero(job->ibuf + got, (size_t)POP_JOB_BLOCKS * HAMMER2_PBUFSIZE - got);
+
+	for (i = 0; i < job->nblocks; ++i) {
+		lbase = job->lbase + (hammer2_key_t)i * HAMMER2_PBUFSIZE;
+		pblksize = pop_physical(ip->st.st_size, lbase);
+		data = job->ibuf + i * HAMMER2_PBUFSIZE;
+		bref = &job->bref[i];
+		job->psize[i] = 0;
+
+		if (comp != HAMMER2_COMP_NONE &&
+		    check != HAMMER2_CHECK_NONE &&
+		    pop_zero_block(data, pblksize))
+			continue;
+
+		bzero(bref, sizeof(*bref));
+		bref->type = HAMMER2_BREF_TYPE_DATA;
+		bref->methods = HAMMER2_ENC_COMP(HAMMER2_COMP_NONE) |
+				HAMMER2_ENC_CHECK(check);
+		bref->key = lbase;
+		bref->keybits = HAMMER2_PBUFRADIX;
+		bref->mirror_tid = POP_MTID;
+		bref->modify_tid = POP_MTID;
+		job->pdata[i] = data;
+		job->psize[i] = pblksize;
+
+		if (comp != HAMMER2_COMP_LZ4)
+			goto done;
+
+		/*
+		 * The compressed size is stored in front of the LZ4 data,
+		 * see hammer2_compress_and_write().
+		 */
+		cbuf = job->obuf + i * HAMMER2_PBUFSIZE;
+		comp_size = LZ4_compress_limitedOutput(data,
+				&cbuf[sizeof(int)], pblksize,
+				pblksize / 2 - sizeof(int64_t));
+		if (comp_size == 0)
+			goto done;
+		*(int *)cbuf = comp_size;
+		comp_size += sizeof(int);
+		comp_block_size = HAMMER2_ALLOC_MIN;
+		while (comp_block_size < comp_size)
+			comp_block_size <<= 1;
+		bzero(cbuf + comp_size, comp_block_size - comp_size);
+
+		bref->methods = HAMMER2_ENC_COMP(pop->comp_algo) |
+				HAMMER2_ENC_CHECK(check);
+		job->pdata[i] = cbuf;
+		job->psize[i] = comp_block_size;
+done:
+		pop_setcheck(bref, job->pdata[i], job->psize[i]);
+	}
+}
+
+static void *
+pop_thread(void *arg)
+{
+	pop_t *pop = arg;
+	pop_job_t *job;
+
+	pthread_mutex_lock(&PopPool.lock);
+	for (;;) {
+		while (PopPool.qhead == NULL && PopPool.stopping == 0)
+			pthread_cond_wait(&PopPool.cond, &PopPool.lock);
+		if ((job = PopPool.qhead) == NULL)
+			break;
+		PopPool.qhead = job->qnext;
+		if (PopPool.qhead == NULL)
+			PopPool.qtailp = &PopPool.qhead;
+		pthread_mutex_unlock(&PopPool.lock);
+
+		pop_run_job(pop, job);
+
+		pthread_mutex_lock(&PopPool.lock);
+		job->done = 1;
+		pthread_cond_broadcast(&PopPool.done_cond);
+	}
+	pthread_mutex_unlock(&PopPool.lock);
+
+	return NULL;
+}
+
+static void
+pop_start_threads(pop_t *pop)
+{
+	pthread_attr_t attr;
+	int i;
+
+	PopPool.tailp = &PopPool.head;
+	PopPool.qtailp = &PopPool.qhead;
+	if (pop->opt->NThreads <= 1)
+		return;
+
+	PopPool.threads = calloc(pop->opt->NThreads,
+				 sizeof(*PopPool.threads));
+	assert(PopPool.threads);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, POP_STACK);
+	for (i = 0; i < pop->opt->NThreads; ++i) {
+		if (pthread_create(&PopPool.threads[i], &attr,
+				   pop_thread, pop) != 0)
+		{
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+	pthread_attr_destroy(&attr);
+	PopPool.nthreads = pop->opt->NThreads;
+}
+
+static void
+pop_stop_threads(pop_t *pop)
+{
+	int i;
+
+	pop_retire_jobs(pop, 0);
+	if (PopPool.nthreads) {
+		pthread_mutex_lock(&PopPool.lock);
+		PopPool.stopping = 1;
+		pthread_cond_broadcast(&PopPool.cond);
+		pthread_mutex_unlock(&PopPool.lock);
+		for (i = 0; i < PopPool.nthreads; ++i)
+			pthread_join(PopPool.threads[i], NULL);
+		free(PopPool.threads);
+		PopPool.threads = NULL;
+		PopPool.nthreads = 0;
+	}
+}
+
+static pop_job_t *
+pop_get_job(pop_t *pop, pop_inode_t *ip)
+{
+	pop_job_t *job;
+
+	if ((job = pop->freejobs) != NULL) {
+		pop->freejobs = job->next;
+	} else {
+		job = malloc(sizeof(*job));
+		assert(job);
+		job->ibuf = malloc((size_t)POP_JOB_BLOCKS * HAMMER2_PBUFSIZE);
+		job->obuf = malloc((size_t)POP_JOB_BLOCKS * HAMMER2_PBUFSIZE);
+		assert(job->ibuf && job->obuf);
+	}
+	job->next = NULL;
+	job->qnext = NULL;
+	job->ip = ip;
+	job->lbase = 0;
+	job->nblocks = 0;
+	job->work = 0;
+	job->last = 1;
+	job->done = 0;
+	job->error = 0;
+
+	return(job);
+}
+
+/*
+ * Queue a job for a worker, or run it here when there are no workers.
+ * Either way jobs are retired in dispatch order.
+ */
+static void
+pop_dispatch_job(pop_t *pop, pop_job_t *job)
+{
+	if (PopPool.nthreads == 0) {
+		if (job->work)
+			pop_run_job(pop, job);
+		pop_retire_job(pop, job);
+		return;
+	}
+
+	pthread_mutex_lock(&PopPool.lock);
+	*PopPool.tailp = job;
+	PopPool.tailp = &job->next;
+	if (job->work) {
+		*PopPool.qtailp = job;
+		PopPool.qtailp = &job->qnext;
+		pthread_cond_signal(&PopPool.cond);
+	} else {
+		job->done = 1;
+	}
+	++PopPool.inflight;
+	pthread_mutex_unlock(&PopPool.lock);
+
+	pop_retire_jobs(pop, PopPool.nthreads * 4);
+}
+
+/*
+ * Retire finished jobs from the head of the dispatch list, waiting for
+ * more to finish while more than (limit) are in flight.
+ */
+static void
+pop_retire_jobs(pop_t *pop, int limit)
+{
+	pop_job_t *job;
+
+	pthread_mutex_lock(&PopPool.lock);
+	while ((job = PopPool.head) != NULL) {
+		if (job->done == 0) {
+			if (PopPool.inflight <= limit)
+				break;
+			pthread_cond_wait(&PopPool.done_cond, &PopPool.lock);
+			continue;
+		}
+		PopPool.head = job->next;
+		if (PopPool.head == NULL)
+			PopPool.tailp = &PopPool.head;
+		--PopPool.inflight;
+		pthread_mutex_unlock(&PopPool.lock);
+
+		pop_retire_job(pop, job);
+
+		pthread_mutex_lock(&PopPool.lock);
+	}
+	pthread_mutex_unlock(&PopPool.lock);
+}
+
+/*
+ * Main thread side of a job: allocate and write the job's blocks and,
+ * after the last job of an object, its block table and inode.
+ */
+static void
+pop_retire_job(pop_t *pop, pop_job_t *job)
+{
+	pop_inode_t *ip = job->ip;
+	hammer2_blockref_t top[HAMMER2_SET_COUNT];
+	int i, count;
+
+	if (job->error > 0) {
+		warnx("%s: %s", ip->path, strerror(job->error));
+	} else if (job->error) {
+		warnx("%s: file shrank while reading, zero-filled",
+		      ip->path);
+	}
+
+	for (i = 0; i < job->nblocks; ++i) {
+		if (job->psize[i] == 0)
+			continue;
+		job->bref[i].data_off = pop_alloc(pop, job->pdata[i],
+						  job->psize[i]);
+		pop->stored_bytes += job->psize[i];
+		pop_level_insert(pop, 0, &job->bref[i]);
+	}
+
+	if (job->last) {
+		switch (ip->type) {
+		case HAMMER2_OBJTYPE_DIRECTORY:
+			pop_write_dir(pop, ip);
+			break;
+		case HAMMER2_OBJTYPE_REGFILE:
+		case HAMMER2_OBJTYPE_SOFTLINK:
+			if (ip->st.st_size > HAMMER2_EMBEDDED_BYTES) {
+				count = pop_level_finish(pop, top);
+				pop_write_inode(pop, ip, top, count, NULL, 0);
+			} else if (ip->data) {
+				pop_write_inode(pop, ip, NULL, 0, ip->data,
+						ip->st.st_size);
+			} else {
+				pop_write_inode(pop, ip, NULL, 0, job->ibuf,
+						ip->st.st_size);
+			}
+			break;
+		default:
+			pop_write_inode(pop, ip, NULL, 0, NULL, 0);
+			break;
+		}
+	}
+
+	job->next = pop->freejobs;
+	pop->freejobs = job;
+}
+
+/*
+ * Queue everything in inode number order.
+ */
+static void
+pop_write_inodes(pop_t *pop)
+{
+	pop_inode_t *ip;
+	pop_job_t *job;
+	hammer2_key_t lbase, size;
+	size_t n;
+	int nblocks;
+
+	pop_start_threads(pop);
+	for (n = 0; n < pop->ninodes; ++n) {
+		ip = pop->inodes[n];
+		size = ip->st.st_size;
+		if ((ip->type == HAMMER2_OBJTYPE_REGFILE ||
+		     ip->type == HAMMER2_OBJTYPE_SOFTLINK) &&
+		    size > HAMMER2_EMBEDDED_BYTES) {
+			nblocks = 0;
+			for (lbase = 0; lbase < size;
+			     lbase += (hammer2_key_t)nblocks *
+				      HAMMER2_PBUFSIZE) {
+				nblocks = (size - lbase + HAMMER2_PBUFMASK64) /
+					  HAMMER2_PBUFSIZE;
+				if (nblocks > POP_JOB_BLOCKS)
+					nblocks = POP_JOB_BLOCKS;
+				job = pop_get_job(pop, ip);
+				job->lbase = lbase;
+				job->nblocks = nblocks;
+				job->work = 1;
+				job->last = (lbase + (hammer2_key_t)nblocks *
+					     HAMMER2_PBUFSIZE >= size);
+				pop_dispatch_job(pop, job);
+			}
+		} else {
+			job = pop_get_job(pop, ip);
+			job->work = (ip->type == HAMMER2_OBJTYPE_REGFILE &&
+				     ip->data == NULL && size > 0);
+			pop_dispatch_job(pop, job);
+		}
+	}
+	pop_stop_threads(pop);
+
+	while (pop->freejobs) {
+		job = pop->freejobs;
+		pop->freejobs = job->next;
+		free(job->ibuf);
+		free(job->obuf);
+		free(job);
+	}
+}
+
+/*
+ * Hardlinked objects are looked up by (st_dev, st_ino).
+ */
+static size_t
+pop_link_hash(const struct stat *st, size_t mask)
+{
+	uint64_t key[2];
+
+	key[0] = st->st_dev;
+	key[1] = st->st_ino;
+	return((size_t)XXH64(key, sizeof(key), 0) & mask);
+}
+
+static pop_inode_t **
+pop_link_lookup(pop_t *pop, const struct stat *st)
+{
+	pop_inode_t **old, *ip;
+	size_t i, j, n, mask;
+
+	if (pop->linkcount * 2 >= pop->linksize) {
+		old = pop->links;
+		n = pop->linksize;
+		pop->linksize = n ? n * 2 : 1024;
+		pop->links = calloc(pop->linksize, sizeof(*pop->links));
+		assert(pop->links);
+		mask = pop->linksize - 1;
+		for (i = 0; i < n; ++i) {
+			if ((ip = old[i]) == NULL)
+				continue;
+			j = pop_link_hash(&ip->st, mask);
+			while (pop->links[j])
+				j = (j + 1) & mask;
+			pop->links[j] = ip;
+		}
+		free(old);
+	}
+
+	mask = pop->linksize - 1;
+	i = pop_link_hash(st, mask);
+	while ((ip = pop->links[i]) != NULL) {
+		if (ip->st.st_dev == st->st_dev && ip->st.st_ino == st->st_ino)
+			break;
+		i = (i + 1) & mask;
+	}
+	return(&pop->links[i]);
+}
+
+static int
+pop_name_cmp(const struct dirent **d1, const struct dirent **d2)
+{
+	return(strcmp((*d1)->d_name, (*d2)->d_name));
+}
+
+static pop_inode_t *
+pop_scan_object(pop_t *pop, const char *path, struct stat *st,
+		hammer2_key_t iparent)
+{
+	pop_inode_t *ip, **linkp = NULL;
+	char buf[PATH_MAX];
+	ssize_t n;
+
+	if (S_ISDIR(st->st_mode) == 0 && st->st_nlink > 1) {
+		linkp = pop_link_lookup(pop, st);
+		if ((ip = *linkp) != NULL) {
+			++ip->nlinks;
+			return(ip);
+		}
+	}
+
+	ip = calloc(1, sizeof(*ip));
+	assert(ip);
+	ip->st = *st;
+	ip->type = pop_obj_type(st->st_mode);
+	ip->iparent = iparent;
+	ip->nlinks = 1;
+
+	switch (ip->type) {
+	case HAMMER2_OBJTYPE_UNKNOWN:
+		warnx("%s: unsupported file type, skipped", path);
+		free(ip);
+		return(NULL);
+	case HAMMER2_OBJTYPE_REGFILE:
+		ip->path = strdup(path);
+		++pop->nfiles;
+		pop->file_bytes += st->st_size;
+		break;
+	case HAMMER2_OBJTYPE_SOFTLINK:
+		n = readlink(path, buf, sizeof(buf));
+		if (n < 0) {
+			warn("%s", path);
+			free(ip);
+			return(NULL);
+		}
+		ip->path = strdup(path);
+		ip->data = malloc(n + 1);
+		assert(ip->data);
+		bcopy(buf, ip->data, n);
+		ip->data[n] = 0;
+		ip->st.st_size = n;
+		++pop->nother;
+		break;
+	case HAMMER2_OBJTYPE_DIRECTORY:
+		++pop->ndirs;
+		break;
+	default:
+		++pop->nother;
+		break;
+	}
+
+	if (pop->ninodes == pop->maxinodes) {
+		pop->maxinodes = pop->maxinodes ? pop->maxinodes * 2 : 1024;
+		pop->inodes = realloc(pop->inodes,
+				      pop->maxinodes * sizeof(*pop->inodes));
+		assert(pop->inodes);
+	}
+	ip->inum = HAMMER2_INODE_START + pop->ninodes;
+	pop->inodes[pop->ninodes++] = ip;
+	if (linkp) {
+		*linkp = ip;
+		++pop->linkcount;
+	}
+
+	if (ip->type == HAMMER2_OBJTYPE_DIRECTORY)
+		pop_scan_dir(pop, path, ip);
+
+	return(ip);
+}
+
+/*
+ * Scan directory (path) into (dip), recursing depth-first.  Entries are
+ * visited in name order so the image is reproducible.
+ */
+static void
+pop_scan_dir(pop_t *pop, const char *path, pop_inode_t *dip)
+{
+	struct dirent **list;
+	struct stat st;
+	pop_inode_t *ip;
+	pop_dirent_t *d;
+	char *cpath;
+	size_t len;
+	int i, n;
+
+	n = scandir(path, &list, NULL, pop_name_cmp);
+	if (n < 0) {
+		warn("%s", path);
+		return;
+	}
+	dip->dirents = calloc(n + 1, sizeof(*dip->dirents));
+	assert(dip->dirents);
+
+	for (i = 0; i < n; ++i) {
+		if (strcmp(list[i]->d_name, ".") == 0 ||
+		    strcmp(list[i]->d_name, "..") == 0)
+			goto next;
+		len = strlen(list[i]->d_name);
+		if (len >= HAMMER2_INODE_MAXNAME) {
+			warnx("%s/%s: name too long, skipped", path,
+			      list[i]->d_name);
+			goto next;
+		}
+		if (asprintf(&cpath, "%s/%s", path, list[i]->d_name) < 0)
+			err(1, "asprintf");
+		if (lstat(cpath, &st) < 0) {
+			warn("%s", cpath);
+		} else if ((ip = pop_scan_object(pop, cpath, &st,
+						 dip->inum)) != NULL) {
+			d = &dip->dirents[dip->ndirents++];
+			d->name = strdup(list[i]->d_name);
+			d->namlen = len;
+			d->ip = ip;
+		}
+		free(cpath);
+next:
+		free(list[i]);
+	}
+	free(list);
+}
+
+static void
+pop_free(pop_t *pop)
+{
+	pop_inode_t *ip;
+	size_t n;
+	int i;
+
+	for (n = 0; n < pop->ninodes; ++n) {
+		ip = pop->inodes[n];
+		for (i = 0; i < ip->ndirents; ++i)
+			free(ip->dirents[i].name);
+		free(ip->dirents);
+		free(ip->path);
+		free(ip->data);
+		free(ip);
+	}
+	for (i = 0; i < pop->nrootdirents; ++i)
+		free(pop->rootdirents[i].name);
+	free(pop->rootdirents);
+	free(pop->inodes);
+	free(pop->links);
+	free(pop->wbuf);
+	free(pop->ibuf);
+}
+
+/*
+ * Populate the PFS root inode (rootip) from the source directory, laying
+ * out data starting at *allocp, which is advanced past the populated
+ * area.  The root's blockref (root_bref) picks up the new statistics.
+ */
+void
+hammer2_populate(hammer2_ondisk_t *fso, hammer2_mkfs_options_t *opt,
+		 hammer2_inode_data_t *rootip, hammer2_blockref_t *root_bref,
+		 hammer2_off_t *allocp)
+{
+	pop_inode_t root;
+	hammer2_blockref_t *brefs;
+	struct stat st;
+	hammer2_off_t base = *allocp;
+	double t0;
+	size_t n;
+	int i, count;
+	pop_t pop;
+
+	t0 = pop_now();
+	bzero(&pop, sizeof(pop));
+	pop.fso = fso;
+	pop.opt = opt;
+	pop.srcdir = opt->SourceDir;
+	pop.comp_algo = rootip->meta.comp_algo;
+	pop.check_algo = rootip->meta.check_algo;
+	pop.alloc = base;
+	PopUsed.base = base & ~(hammer2_off_t)HAMMER2_FREEMAP_BLOCK_MASK;
+	pop.wbuf = malloc(POP_WBUFSIZE);
+	pop.ibuf = malloc(HAMMER2_IND_BYTES_MAX);
+	assert(pop.wbuf && pop.ibuf);
+
+	if (stat(opt->SourceDir, &st) < 0)
+		err(1, "%s", opt->SourceDir);
+	if (S_ISDIR(st.st_mode) == 0)
+		errx(1, "%s: not a directory", opt->SourceDir);
+
+	/*
+	 * Scan the source tree.  The PFS root is inode 1, its entries
+	 * are stored in the PFS root's own block table.
+	 */
+	bzero(&root, sizeof(root));
+	root.inum = 1;
+	root.type = HAMMER2_OBJTYPE_DIRECTORY;
+	pop_scan_dir(&pop, opt->SourceDir, &root);
+	pop.rootdirents = root.dirents;
+	pop.nrootdirents = root.ndirents;
+
+	/*
+	 * Lay out all objects, then the PFS root's block table holding
+	 * the inodes followed by the root directory's entries.
+	 */
+	pop_write_inodes(&pop);
+
+	pop_dirent_keys(pop.rootdirents, pop.nrootdirents);
+	brefs = calloc(pop.ninodes + pop.nrootdirents + 1, sizeof(*brefs));
+	assert(brefs);
+	for (n = 0; n < pop.ninodes; ++n)
+		brefs[n] = pop.inodes[n]->bref;
+	for (i = 0; i < pop.nrootdirents; ++i)
+		pop_dirent_bref(&pop, &pop.rootdirents[i], &brefs[n + i]);
+	count = pop_tree(&pop, brefs, (int)(n + pop.nrootdirents));
+	pop_flush(&pop);
+
+	for (i = 0; i < count; ++i) {
+		rootip->u.blockset.blockref[i] = brefs[i];
+		hammer2_populate_addstats(root_bref, &brefs[i]);
+	}
+	free(brefs);
+
+	pop_set_meta(&pop, &rootip->meta, &st);
+	if (pop.ninodes)
+		rootip->meta.pfs_inum = HAMMER2_INODE_START + pop.ninodes - 1;
+
+	*allocp = (pop.alloc + HAMMER2_PBUFMASK64) & ~HAMMER2_PBUFMASK64;
+
+	printf("Populated from %s: %ju files, %ju directories, "
+	       "%ju other, %s",
+	       opt->SourceDir, (uintmax_t)pop.nfiles, (uintmax_t)pop.ndirs,
+	       (uintmax_t)pop.nother, sizetostr(pop.file_bytes));
+	printf(" stored in %s, %s allocated, %.2f sec\n",
+	       sizetostr(pop.stored_bytes), sizetostr(*allocp - base),
+	       pop_now() - t0);
+
+	pop_free(&pop);
+}
+
+/*
+ * Write freemap block (buf) covering (key, radix) to its first rotation
+ * slot and fill in its blockref (bref).
+ */
+static void
+pop_freemap_block(hammer2_ondisk_t *fso, const char *buf, uint8_t type,
+		  hammer2_off_t key, int radix, int zone,
+		  hammer2_off_t avail, hammer2_blockref_t *bref)
+{
+	hammer2_off_t off;
+
+	off = POP_FMBASE(key, radix) +
+	      (HAMMER2_ZONE_FREEMAP_00 + zone) * HAMMER2_PBUFSIZE64;
+	pop_pwrite(fso, buf, HAMMER2_FREEMAP_LEVELN_PSIZE, off);
+
+	bzero(bref, sizeof(*bref));
+	bref->type = type;
+	bref->methods = HAMMER2_ENC_CHECK(HAMMER2_CHECK_FREEMAP) |
+			HAMMER2_ENC_COMP(HAMMER2_COMP_NONE);
+	bref->key = POP_FMBASE(key, radix);
+	bref->keybits = radix;
+	bref->data_off = off | pop_radix(HAMMER2_FREEMAP_LEVELN_PSIZE);
+	bref->mirror_tid = POP_MTID;
+	bref->check.freemap.icrc32 =
+		hammer2_icrc32(buf, HAMMER2_FREEMAP_LEVELN_PSIZE);
+	bref->check.freemap.bigmask = (uint32_t)-1;
+	bref->check.freemap.avail = avail;
+}
+
+/*
+ * Build the freemap for the static area below (alloc_beg) and the
+ * populated data below (pop_end) in the freemap blockset (bset).  A leaf
+ * is created for each 1GB holding part of either, in the FREEMAP_00 slot
+ * of that 1GB's reserved segment.  Static segments are initialized like
+ * hammer2_freemap_init() does, in populated ones the blocks holding data
+ * are marked allocated.  Further leaves are created by the kernel as it
+ * needs them.
+ *
+ * Returns the number of bytes marked allocated for the populated data.
+ */
+hammer2_off_t
+hammer2_populate_freemap(hammer2_ondisk_t *fso, hammer2_off_t alloc_beg,
+			 hammer2_off_t pop_end, hammer2_blockset_t *bset)
+{
+	static const int radixes[] = {
+		HAMMER2_FREEMAP_LEVEL1_RADIX, HAMMER2_FREEMAP_LEVEL2_RADIX,
+		HAMMER2_FREEMAP_LEVEL3_RADIX, HAMMER2_FREEMAP_LEVEL4_RADIX,
+		HAMMER2_FREEMAP_LEVEL5_RADIX,
+	};
+	hammer2_bmap_data_t *bmap;
+	hammer2_blockref_t *brefs;
+	hammer2_off_t key, seg, hikey, lokey, avail, used;
+	char *buf;
+	int count, level, i, j, k, n, nblocks;
+
+	buf = malloc(HAMMER2_FREEMAP_LEVELN_PSIZE);
+	count = (pop_end + HAMMER2_FREEMAP_LEVEL1_MASK) >>
+		HAMMER2_FREEMAP_LEVEL1_RADIX;
+	brefs = calloc(count + 1, sizeof(*brefs));
+	assert(buf && brefs);
+
+	lokey = (alloc_beg + HAMMER2_SEGMASK64) & ~HAMMER2_SEGMASK64;
+	hikey = fso->total_size & ~HAMMER2_SEGMASK64;
+	used = 0;
+
+	for (i = 0; i < count; ++i) {
+		key = (hammer2_off_t)i << HAMMER2_FREEMAP_LEVEL1_RADIX;
+		bzero(buf, HAMMER2_FREEMAP_LEVELN_PSIZE);
+		bmap = (void *)buf;
+		avail = 0;
+		for (j = 0; j < HAMMER2_FREEMAP_COUNT; ++j, ++bmap) {
+			seg = key + ((hammer2_off_t)j <<
+				     HAMMER2_FREEMAP_LEVEL0_RADIX);
+			if (seg >= hikey || seg < lokey ||
+			    seg < H2FMZONEBASE(seg) + HAMMER2_ZONE_SEG64) {
+				memset(bmap->bitmapq, -1,
+				       sizeof(bmap->bitmapq));
+				bmap->linear = HAMMER2_SEGSIZE;
+				continue;
+			}
+			bmap->avail = HAMMER2_FREEMAP_LEVEL0_SIZE;
+			nblocks = 0;
+			if (seg < pop_end)
+				nblocks = HAMMER2_FREEMAP_LEVEL0_SIZE >>
+					  HAMMER2_FREEMAP_BLOCK_RADIX;
+			for (n = 0; n < nblocks; ++n) {
+				if (!pop_is_used(seg + ((hammer2_off_t)n <<
+				    HAMMER2_FREEMAP_BLOCK_RADIX)))
+					continue;
+				k = n / HAMMER2_BMAP_BLOCKS_PER_ELEMENT;
+				bmap->bitmapq[k] |= (hammer2_bitmap_t)3 <<
+				    (n * 2 % HAMMER2_BMAP_BITS_PER_ELEMENT);
+				bmap->linear = (n + 1) <<
+					       HAMMER2_FREEMAP_BLOCK_RADIX;
+				bmap->avail -= HAMMER2_FREEMAP_BLOCK_SIZE;
+				used += HAMMER2_FREEMAP_BLOCK_SIZE;
+			}
+			avail += bmap->avail;
+		}
+
+		pop_freemap_block(fso, buf, HAMMER2_BREF_TYPE_FREEMAP_LEAF,
+				  key, HAMMER2_FREEMAP_LEVEL1_RADIX,
+				  HAMMER2_ZONEFM_LEVEL1, avail, &brefs[i]);
+	}
+
+	/*
+	 * Add FREEMAP_NODE levels until the top fits in the volume header.
+	 */
+	for (level = 1; count > HAMMER2_SET_COUNT; ++level) {
+		assert(level < (int)(sizeof(radixes) / sizeof(radixes[0])));
+		n = 0;
+		for (i = 0; i < count; i = j) {
+			key = POP_FMBASE(brefs[i].key, radixes[level]);
+			for (j = i; j < count; ++j) {
+				if (POP_FMBASE(brefs[j].key, radixes[level]) !=
+				    key)
+					break;
+			}
+			bzero(buf, HAMMER2_FREEMAP_LEVELN_PSIZE);
+			bcopy(&brefs[i], buf, (j - i) * sizeof(*brefs));
+			avail = 0;
+			while (i < j)
+				avail += brefs[i++].check.freemap.avail;
+
+			pop_freemap_block(fso, buf,
+					  HAMMER2_BREF_TYPE_FREEMAP_NODE,
+					  key, radixes[level],
+					  HAMMER2_ZONEFM_LEVEL1 + level,
+					  avail, &brefs[n++]);
+		}
+		count = n;
+	}
+
+	bzero(bset, sizeof(*bset));
+	for (i = 0; i < count; ++i)
+		bset->blockref[i] = brefs[i];
+
+	free(brefs);
+	free(buf);
+	free(PopUsed.bits);
+	bzero(&PopUsed, sizeof(PopUsed));
+
+	return(used);
+}
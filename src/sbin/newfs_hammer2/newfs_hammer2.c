@@ -44,12 +44,18 @@
 #include <string.h>
 #include <assert.h>
 #include <err.h>
+#include <getopt.h>
 
 #include "mkfs_hammer2.h"
 
 static void parse_fs_size(hammer2_mkfs_options_t *, const char *);
 static void usage(void);
 
+static const struct option LongOpts[] = {
+	{ "timing",	no_argument,	NULL,	'T' },
+	{ NULL,		0,		NULL,	0 }
+};
+
 int
 main(int ac, char **av)
 {
@@ -65,7 +71,8 @@ main(int ac, char **av)
 	/*
 	 * Parse arguments.
 	 */
-	while ((ch = getopt(ac, av, "L:b:r:V:s:d")) != -1) {
+	while ((ch = getopt_long(ac, av, "D:L:b:j:r:V:s:d", LongOpts,
+				 NULL)) != -1) {
 		switch(ch) {
 		case 'b':
 			opt.BootAreaSize = getsize(optarg,
@@ -110,9 +117,20 @@ main(int ac, char **av)
 		case 's':
 			parse_fs_size(&opt, optarg);
 			break;
+		case 'D':
+			opt.SourceDir = optarg;
+			break;
+		case 'j':
+			opt.NThreads = strtol(optarg, NULL, 0);
+			if (opt.NThreads < 1 || opt.NThreads > 256)
+				errx(1, "Invalid thread count %s", optarg);
+			break;
 		case 'd':
 			opt.DebugOpt = 1;
 			break;
+		case 'T':
+			opt.Timing = 1;
+			break;
 		default:
 			usage();
 			break;
@@ -176,8 +194,11 @@ void
 usage(void)
 {
 	fprintf(stderr,
-		"usage: newfs_hammer2 [-b bootsize] [-r auxsize] "
-		"[-V version] [-L label ...] [-s size] special ...\n"
+		"usage: newfs_hammer2 [--timing] [-b bootsize] [-D srcdir] "
+		"[-j nthreads]\n"
+		"                     [-r auxsize] [-V version] [-L label ...] "
+		"[-s size]\n"
+		"                     special ...\n"
 	);
 	exit(1);
 }
@@ -344,6 +344,11 @@ struct hammer2_chain {
  *
  *		      (Cannot be used for remote or cluster ops).
  *
+ *	ENCLOSED    - Returns an indirect block instead of recursing into
+ *		      it when its key range lies entirely within the passed
+ *		      key range.  With NODATA the indirect block itself is
+ *		      not read either.  Used by range deletion.
+ *
  *	ALWAYS	    - Always resolve the data.  If ALWAYS and NODATA are both
  *		      missing, bulk file data is not resolved but inodes and
  *		      other meta-data will.
@@ -352,6 +357,7 @@ struct hammer2_chain {
 #define HAMMER2_LOOKUP_NODIRECT		0x00000004	/* no offset=0 DD */
 #define HAMMER2_LOOKUP_SHARED		0x00000100
 #define HAMMER2_LOOKUP_MATCHIND		0x00000200	/* return all chains */
+#define HAMMER2_LOOKUP_ENCLOSED		0x00000400	/* enclosed indirect */
 #define HAMMER2_LOOKUP_ALWAYS		0x00000800	/* resolve data */
 
 /*
@@ -395,6 +401,8 @@ struct hammer2_chain {
  */
 #define HAMMER2_FREEMAP_DORECOVER	1
 
+#define HAMMER2_FREEMAP_BATCH		64	/* max brefs per adjust_batch */
+
 /*
  * HAMMER2 cluster - A set of chains representing the same entity.
  *
@@ -453,6 +461,7 @@ struct hammer2_inode {
 	hammer2_cluster_item_t	ccache[HAMMER2_MAXCLUSTER];
 	int			ccache_nchains;
 	hammer2_inode_meta_t	meta;		/* copy of meta-data */
+	unsigned int		meta_seq;	/* odd while meta changes */
 	hammer2_pfs_t		*pmp;		/* PFS mount */
 	hammer2_off_t		osize;
 	struct vnode		*vp;
@@ -468,6 +477,9 @@ struct hammer2_inode {
  * RESIZED	- Inode truncated (any) or inode extended beyond
  *		  EMBEDDED_BYTES.
  *
+ * LAZYTIME	- Timestamps in ip->meta were updated on a lazytime mount
+ *		  without modifying the inode, see hammer2_inode_touch().
+ *
  * SYNCQ	- Inode is included in the current filesystem sync.  The
  *		  DELETING and CREATING flags will be acted upon.
  *
@@ -497,6 +509,7 @@ struct hammer2_inode {
  * flush-in-progress, then blocks until the flush has gotten past it.
  */
 #define HAMMER2_INODE_MODIFIED		0x0001
+#define HAMMER2_INODE_LAZYTIME		0x0002	/* in-core timestamps only */
 #define HAMMER2_INODE_ONHASH		0x0008
 #define HAMMER2_INODE_RESIZED		0x0010	/* requires inode_chain_sync */
 #define HAMMER2_INODE_ISUNLINKED	0x0040
@@ -509,6 +522,11 @@ struct hammer2_inode {
 #define HAMMER2_INODE_SYNCQ_WAKEUP	0x4000	/* sync interlock wakeup */
 #define HAMMER2_INODE_SYNCQ_PASS2	0x8000	/* force retry delay */
 
+/*
+ * relatime mounts update an otherwise current atime once a day (usecs).
+ */
+#define HAMMER2_RELATIME_INTERVAL	(24ULL * 60 * 60 * 1000000)
+
 /*
  * Transaction management sub-structure under hammer2_pfs.
  */
@@ -681,6 +699,12 @@ struct hammer2_xop_unlinkall {
 	hammer2_key_t		key_end;
 };
 
+struct hammer2_xop_punch {
+	hammer2_xop_head_t	head;
+	hammer2_key_t		key_beg;	/* inclusive */
+	hammer2_key_t		key_end;	/* inclusive */
+};
+
 struct hammer2_xop_connect {
 	hammer2_xop_head_t	head;
 	hammer2_key_t		lhc;
@@ -717,6 +741,7 @@ typedef struct hammer2_xop_create hammer2_xop_create_t;
 typedef struct hammer2_xop_destroy hammer2_xop_destroy_t;
 typedef struct hammer2_xop_fsync hammer2_xop_fsync_t;
 typedef struct hammer2_xop_unlinkall hammer2_xop_unlinkall_t;
+typedef struct hammer2_xop_punch hammer2_xop_punch_t;
 typedef struct hammer2_xop_connect hammer2_xop_connect_t;
 typedef struct hammer2_xop_flush hammer2_xop_flush_t;
 typedef struct hammer2_xop_strategy hammer2_xop_strategy_t;
@@ -737,6 +762,7 @@ union hammer2_xop {
 	hammer2_xop_destroy_t	xop_destroy;
 	hammer2_xop_fsync_t	xop_fsync;
 	hammer2_xop_unlinkall_t	xop_unlinkall;
+	hammer2_xop_punch_t	xop_punch;
 	hammer2_xop_connect_t	xop_connect;
 	hammer2_xop_flush_t	xop_flush;
 	hammer2_xop_strategy_t	xop_strategy;
@@ -865,6 +891,9 @@ struct hammer2_dev {
  */
 #define HAMMER2_IHASH_SIZE	32
 
+/* xop_waiting has one bit per xop_cv[]. */
+CTASSERT(HAMMER2_IHASH_SIZE <= 32);
+
 struct hammer2_pfs {
 	TAILQ_ENTRY(hammer2_pfs) mntentry;	/* hammer2_pfslist */
 	hammer2_ipdep_list_t	*ipdep_lists;	/* inode dependencies for XOP */
@@ -872,6 +901,7 @@ struct hammer2_pfs {
 	hammer2_spin_t		list_spin;
 	hammer2_lk_t		xop_lock[HAMMER2_IHASH_SIZE];
 	hammer2_lkc_t		xop_cv[HAMMER2_IHASH_SIZE];
+	uint32_t		xop_waiting;	/* xop_cv[] with waiters */
 	hammer2_lk_t		trans_lock;	/* XXX temporary */
 	hammer2_lkc_t		trans_cv;
 	struct mount		*mp;
@@ -886,6 +916,7 @@ struct hammer2_pfs {
 	hammer2_blockset_t	pfs_iroot_blocksets[HAMMER2_MAXCLUSTER];
 	int			flags;		/* for HAMMER2_PMPF_xxx */
 	int			rdonly;		/* read-only mount */
+	int			hflags;		/* HMNT2_PFSFLAGS */
 	int			free_ticks;	/* free_* calculations */
 	unsigned long		ipdep_mask;
 	hammer2_off_t		free_reserved;
@@ -903,7 +934,6 @@ struct hammer2_pfs {
 
 #define HAMMER2_PMPF_SPMP	0x00000001
 #define HAMMER2_PMPF_EMERG	0x00000002
-#define HAMMER2_PMPF_WAITING	0x10000000
 
 #define HAMMER2_CHECK_NULL	0x00000001
 
@@ -941,6 +971,7 @@ extern hammer2_xop_desc_t hammer2_inode_create_ins_desc;
 extern hammer2_xop_desc_t hammer2_inode_destroy_desc;
 extern hammer2_xop_desc_t hammer2_inode_chain_sync_desc;
 extern hammer2_xop_desc_t hammer2_inode_unlinkall_desc;
+extern hammer2_xop_desc_t hammer2_inode_punch_desc;
 extern hammer2_xop_desc_t hammer2_inode_connect_desc;
 extern hammer2_xop_desc_t hammer2_inode_flush_desc;
 extern hammer2_xop_desc_t hammer2_strategy_read_desc;
@@ -1036,6 +1067,8 @@ void hammer2_xop_inode_flush(hammer2_xop_t *, void *, int);
 /* hammer2_freemap.c */
 int hammer2_freemap_alloc(hammer2_chain_t *, size_t);
 void hammer2_freemap_adjust(hammer2_dev_t *, hammer2_blockref_t *, int);
+int hammer2_freemap_adjust_batch(hammer2_dev_t *, hammer2_blockref_t *, int,
+    int);
 
 /* hammer2_inode.c */
 void hammer2_inum_hash_init(hammer2_pfs_t *);
@@ -1061,10 +1094,13 @@ hammer2_inode_t *hammer2_inode_create_normal(hammer2_inode_t *, struct vattr *,
     struct ucred *, hammer2_key_t, int *);
 int hammer2_dirent_create(hammer2_inode_t *, const char *, size_t,
     hammer2_key_t, uint8_t);
+void hammer2_inode_meta_copy(const hammer2_inode_t *, hammer2_inode_meta_t *);
 hammer2_key_t hammer2_inode_data_count(const hammer2_inode_t *);
 hammer2_key_t hammer2_inode_inode_count(const hammer2_inode_t *);
 int hammer2_inode_unlink_finisher(hammer2_inode_t *, struct vnode **);
 void hammer2_inode_modify(hammer2_inode_t *);
+void hammer2_inode_touch(hammer2_inode_t *);
+void hammer2_inode_lazytime_sync(hammer2_inode_t *);
 void hammer2_inode_vhold(hammer2_inode_t *);
 void hammer2_inode_vdrop(hammer2_inode_t *, int);
 int hammer2_inode_chain_sync(hammer2_inode_t *);
@@ -1083,6 +1119,7 @@ int hammer2_io_new(hammer2_dev_t *, int, hammer2_off_t, int, hammer2_io_t **);
 int hammer2_io_newnz(hammer2_dev_t *, int, hammer2_off_t, int, hammer2_io_t **);
 int hammer2_io_bread(hammer2_dev_t *, int, hammer2_off_t, int, hammer2_io_t **);
 hammer2_io_t *hammer2_io_getquick(hammer2_dev_t *, off_t, int);
+int hammer2_io_prefetch(hammer2_dev_t *, hammer2_off_t);
 void hammer2_io_bawrite(hammer2_io_t **);
 void hammer2_io_bdwrite(hammer2_io_t **);
 int hammer2_io_bwrite(hammer2_io_t **);
@@ -1143,6 +1180,7 @@ hammer2_pfs_t *hammer2_pfsalloc(hammer2_chain_t *, const hammer2_inode_data_t *,
 void hammer2_pfsdealloc(hammer2_pfs_t *, int, int);
 int hammer2_sync(struct mount *, int, int, struct ucred *, struct proc *);
 int hammer2_vfs_sync_pmp(hammer2_pfs_t *, int);
+int hammer2_flush_pmp(hammer2_pfs_t *, int);
 void hammer2_voldata_lock(hammer2_dev_t *);
 void hammer2_voldata_unlock(hammer2_dev_t *);
 void hammer2_voldata_modify(hammer2_dev_t *);
@@ -1150,6 +1188,7 @@ int hammer2_vfs_enospace(hammer2_inode_t *, off_t, struct ucred *);
 
 /* hammer2_vnops.c */
 int hammer2_vinit(struct mount *, struct vnode **);
+int hammer2_punch_file(hammer2_inode_t *, hammer2_key_t, hammer2_key_t);
 
 /* hammer2_xops.c */
 void hammer2_xop_ipcluster(hammer2_xop_t *, void *, int);
@@ -1168,6 +1207,7 @@ void hammer2_xop_inode_create_ins(hammer2_xop_t *, void *, int);
 void hammer2_xop_inode_destroy(hammer2_xop_t *, void *, int);
 void hammer2_xop_inode_chain_sync(hammer2_xop_t *, void *, int);
 void hammer2_xop_inode_unlinkall(hammer2_xop_t *, void *, int);
+void hammer2_xop_inode_punch(hammer2_xop_t *, void *, int);
 void hammer2_xop_inode_connect(hammer2_xop_t *, void *, int);
 void hammer2_xop_bmap(hammer2_xop_t *, void *, int);
 
@@ -1290,6 +1330,28 @@ hammer2_assert_inode_meta(const hammer2_inode_t *ip)
 	KASSERTMSG(ip->meta.type, "type 0");
 }
 
+/*
+ * Writers of ip->meta bracket their changes with these so that
+ * hammer2_inode_meta_copy() can take a consistent snapshot without the
+ * inode lock.  meta_seq is odd inside the bracket, cluster_spin orders
+ * writers holding the inode shared.  Nothing inside may block.
+ */
+static __inline void
+hammer2_inode_meta_begin(hammer2_inode_t *ip)
+{
+	hammer2_spin_ex(&ip->cluster_spin);
+	++ip->meta_seq;
+	membar_producer();
+}
+
+static __inline void
+hammer2_inode_meta_end(hammer2_inode_t *ip)
+{
+	membar_producer();
+	++ip->meta_seq;
+	hammer2_spin_unex(&ip->cluster_spin);
+}
+
 uint32_t iscsi_crc32(const void *, size_t);
 uint32_t iscsi_crc32_ext(const void *, size_t, uint32_t);
 
@@ -59,6 +59,7 @@ H2XOPDESCRIPTOR(inode_create_ins);
 H2XOPDESCRIPTOR(inode_destroy);
 H2XOPDESCRIPTOR(inode_chain_sync);
 H2XOPDESCRIPTOR(inode_unlinkall);
+H2XOPDESCRIPTOR(inode_punch);
 H2XOPDESCRIPTOR(inode_connect);
 H2XOPDESCRIPTOR(inode_flush);
 H2XOPDESCRIPTOR(strategy_read);
@@ -261,7 +262,7 @@ hammer2_xop_testset_ipdep(hammer2_inode_t *ip)
 	hammer2_lk_ex(mtx);
 again:
 	if (xop_testset_ipdep(ip, ip->ipdep_idx)) {
-		pmp->flags |= HAMMER2_PMPF_WAITING;
+		atomic_set_int(&pmp->xop_waiting, 1U << ip->ipdep_idx);
 		hammer2_lkc_sleep(cv, mtx, "h2pmp_xop");
 		goto again;
 	}
@@ -280,8 +281,8 @@ hammer2_xop_unset_ipdep(hammer2_inode_t *ip)
 
 	hammer2_lk_ex(mtx);
 	xop_unset_ipdep(ip, ip->ipdep_idx);
-	if (pmp->flags & HAMMER2_PMPF_WAITING) {
-		pmp->flags &= ~HAMMER2_PMPF_WAITING;
+	if (pmp->xop_waiting & (1U << ip->ipdep_idx)) {
+		atomic_clear_int(&pmp->xop_waiting, 1U << ip->ipdep_idx);
 		hammer2_lkc_wakeup(cv);
 	}
 	hammer2_lk_unlock(mtx);
@@ -613,6 +613,8 @@ hammer2_bulkfree_pass(hammer2_dev_t *hmp, hammer2_chain_t *vchain,
 	cbinfo.dedup = NULL;
 
 	bfi->sstop = cbinfo.sbase;
+	bfi->count_freed = (hammer2_off_t)cbinfo.count_10_00 *
+	    HAMMER2_FREEMAP_BLOCK_SIZE;
 
 	incr = bfi->sstop / (hmp->total_size / 10000);
 	if (incr > 10000)
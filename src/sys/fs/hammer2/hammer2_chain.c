@@ -2083,7 +2083,7 @@ hammer2_chain_lookup(hammer2_chain_t **parentp, hammer2_key_t *key_nextp,
 	hammer2_key_t scan_beg, scan_end;
 	int how_always = HAMMER2_RESOLVE_ALWAYS;
 	int how_maybe = HAMMER2_RESOLVE_MAYBE;
-	int how, generation, count = 0, maxloops = 300000;
+	int how, generation, enclosed, count = 0, maxloops = 300000;
 
 	if (flags & HAMMER2_LOOKUP_ALWAYS) {
 		how_maybe = how_always;
@@ -2263,11 +2263,27 @@ again:
 		goto again;
 	}
 
-	/* Selected from blockref or in-memory chain. */
+	/*
+	 * Selected from blockref or in-memory chain.
+	 *
+	 * An indirect block enclosed by the key range is returned as-is
+	 * for HAMMER2_LOOKUP_ENCLOSED and does not need its data.
+	 */
 	bsave = *bref;
+	enclosed = 0;
+	if ((flags & HAMMER2_LOOKUP_ENCLOSED) &&
+	    bsave.type == HAMMER2_BREF_TYPE_INDIRECT) {
+		scan_beg = bsave.key;
+		scan_end = scan_beg + ((hammer2_key_t)1 << bsave.keybits) - 1;
+		if (scan_beg >= key_beg && scan_end <= key_end)
+			enclosed = 1;
+	}
 	if (chain == NULL) {
 		hammer2_spin_unex(&parent->core.spin);
-		if (bsave.type == HAMMER2_BREF_TYPE_INDIRECT ||
+		if (enclosed)
+			chain = hammer2_chain_get(parent, generation, &bsave,
+			    how);
+		else if (bsave.type == HAMMER2_BREF_TYPE_INDIRECT ||
 		    bsave.type == HAMMER2_BREF_TYPE_FREEMAP_NODE)
 			chain = hammer2_chain_get(parent, generation, &bsave,
 			    how_maybe);
@@ -2283,7 +2299,9 @@ again:
 		 * chain is referenced but not locked.  We must lock the
 		 * chain to obtain definitive state.
 		 */
-		if (bsave.type == HAMMER2_BREF_TYPE_INDIRECT ||
+		if (enclosed)
+			hammer2_chain_lock(chain, how);
+		else if (bsave.type == HAMMER2_BREF_TYPE_INDIRECT ||
 		    bsave.type == HAMMER2_BREF_TYPE_FREEMAP_NODE)
 			hammer2_chain_lock(chain, how_maybe);
 		else
@@ -2335,10 +2353,12 @@ again:
 	 * If HAMMER2_LOOKUP_MATCHIND is set and the indirect block's key
 	 * range is within the requested key range we return the indirect
 	 * block and do NOT loop.  This is usually only used to acquire
-	 * freemap nodes.
+	 * freemap nodes.  HAMMER2_LOOKUP_ENCLOSED does the same for
+	 * indirect blocks entirely within the requested key range.
 	 */
-	if (chain->bref.type == HAMMER2_BREF_TYPE_INDIRECT ||
-	    chain->bref.type == HAMMER2_BREF_TYPE_FREEMAP_NODE) {
+	if ((chain->bref.type == HAMMER2_BREF_TYPE_INDIRECT ||
+	    chain->bref.type == HAMMER2_BREF_TYPE_FREEMAP_NODE) &&
+	    enclosed == 0) {
 		hammer2_chain_unlock(parent);
 		hammer2_chain_drop(parent);
 		*parentp = parent = chain;
@@ -54,6 +54,8 @@ static int hammer2_bmap_alloc(hammer2_dev_t *, hammer2_bmap_data_t *, uint16_t,
     int, int, int, hammer2_key_t *);
 static int hammer2_freemap_iterate(hammer2_chain_t **, hammer2_chain_t **,
     hammer2_fiterate_t *);
+static size_t hammer2_freemap_adjust_leaf(hammer2_chain_t *,
+    hammer2_blockref_t *, hammer2_tid_t, int, int *);
 
 /*
  * Calculate the device offset for the specified FREEMAP_NODE or FREEMAP_LEAF
@@ -788,94 +790,196 @@ hammer2_freemap_iterate(hammer2_chain_t **parentp, hammer2_chain_t **chainp,
 void
 hammer2_freemap_adjust(hammer2_dev_t *hmp, hammer2_blockref_t *bref, int how)
 {
-	hammer2_off_t data_off = bref->data_off;
+	hammer2_freemap_adjust_batch(hmp, bref, 1, how);
+}
+
+/*
+ * Same as hammer2_freemap_adjust() for an array of brefs.  Brefs falling
+ * into the same level1 freemap leaf are adjusted under a single lookup
+ * and a single modification of the leaf, the recovery scan feeds the
+ * leaf brefs of each parent through here.  The batch stops at the first
+ * leaf which could not be created and its error is returned.
+ */
+int
+hammer2_freemap_adjust_batch(hammer2_dev_t *hmp, hammer2_blockref_t *brefs,
+    int nbrefs, int how)
+{
 	hammer2_chain_t *chain, *parent;
-	hammer2_bmap_data_t *bmap;
 	hammer2_key_t key, key_dummy;
-	hammer2_off_t l1size, l1mask;
+	hammer2_off_t data_off, l1size, l1mask;
 	hammer2_tid_t mtid;
-	hammer2_bitmap_t *bitmap;
-	const hammer2_bitmap_t bmmask00 = 0;
-	//hammer2_bitmap_t bmmask01;
-	//hammer2_bitmap_t bmmask10;
-	hammer2_bitmap_t bmmask11;
-	uint16_t class;
-	int error, radix, start, count, modified = 0;
+	uint64_t done;
+	int error, i, j, modified;
+	int rerror = 0;
 	size_t bgsize = 0;
 
 	KKASSERT(how == HAMMER2_FREEMAP_DORECOVER);
+	KKASSERT(nbrefs <= HAMMER2_FREEMAP_BATCH);
 
 	KKASSERT(hmp->spmp);
 	mtid = hammer2_trans_sub(hmp->spmp);
 
-	radix = (int)data_off & HAMMER2_OFF_MASK_RADIX;
-	KKASSERT(radix != 0);
-	KKASSERT(radix <= HAMMER2_RADIX_MAX);
+	l1size = HAMMER2_FREEMAP_LEVEL1_SIZE;
+	l1mask = l1size - 1;
+	done = 0;
 
-	data_off &= ~HAMMER2_OFF_MASK_RADIX;
+	for (i = 0; i < nbrefs; ++i) {
+		if (done & ((uint64_t)1 << i))
+			continue;
+		data_off = brefs[i].data_off & ~HAMMER2_OFF_MASK_RADIX;
 
-	class = (bref->type << 8) | HAMMER2_PBUFRADIX;
+		/*
+		 * We can't adjust the freemap for data allocations made by
+		 * newfs_hammer2.
+		 */
+		if (data_off < hmp->voldata.allocator_beg)
+			continue;
 
-	/*
-	 * We can't adjust the freemap for data allocations made by
-	 * newfs_hammer2.
-	 */
-	if (data_off < hmp->voldata.allocator_beg)
-		return;
+		KKASSERT((data_off & HAMMER2_ZONE_MASK64) >= HAMMER2_ZONE_SEG);
 
-	KKASSERT((data_off & HAMMER2_ZONE_MASK64) >= HAMMER2_ZONE_SEG);
+		/*
+		 * Lookup the level1 freemap chain.  The chain must exist.
+		 */
+		key = H2FMBASE(data_off, HAMMER2_FREEMAP_LEVEL1_RADIX);
 
-	/* Lookup the level1 freemap chain.  The chain must exist. */
-	key = H2FMBASE(data_off, HAMMER2_FREEMAP_LEVEL1_RADIX);
-	l1size = HAMMER2_FREEMAP_LEVEL1_SIZE;
-	l1mask = l1size - 1;
+		parent = &hmp->fchain;
+		hammer2_chain_ref(parent);
+		hammer2_chain_lock(parent, HAMMER2_RESOLVE_ALWAYS);
 
-	parent = &hmp->fchain;
-	hammer2_chain_ref(parent);
-	hammer2_chain_lock(parent, HAMMER2_RESOLVE_ALWAYS);
+		chain = hammer2_chain_lookup(&parent, &key_dummy, key,
+		    key + l1mask, &error,
+		    HAMMER2_LOOKUP_ALWAYS | HAMMER2_LOOKUP_MATCHIND);
 
-	chain = hammer2_chain_lookup(&parent, &key_dummy, key, key + l1mask,
-	    &error, HAMMER2_LOOKUP_ALWAYS | HAMMER2_LOOKUP_MATCHIND);
+		/*
+		 * Stop early if we are trying to free something but no
+		 * leaf exists.
+		 */
+		if (chain == NULL && how != HAMMER2_FREEMAP_DORECOVER) {
+			hprintf("no chain at data_off %016llx\n",
+			    (long long)brefs[i].data_off);
+			goto next;
+		}
+		if (chain && chain->error) {
+			hprintf("error %d at data_off %016llx\n",
+			    chain->error, (long long)brefs[i].data_off);
+			hammer2_chain_unlock(chain);
+			hammer2_chain_drop(chain);
+			chain = NULL;
+			goto next;
+		}
+
+		/*
+		 * Create any missing leaf(s) if we are doing a recovery
+		 * (marking the block(s) as being allocated instead of being
+		 * freed).  Be sure to initialize the auxillary freemap
+		 * tracking info in the bref.check.freemap structure.
+		 */
+		if (chain == NULL && how == HAMMER2_FREEMAP_DORECOVER) {
+			error = hammer2_chain_create(&parent, &chain, NULL,
+			    hmp->spmp, HAMMER2_METH_DEFAULT, key,
+			    HAMMER2_FREEMAP_LEVEL1_RADIX,
+			    HAMMER2_BREF_TYPE_FREEMAP_LEAF,
+			    HAMMER2_FREEMAP_LEVELN_PSIZE, mtid, 0, 0);
+			if (error == 0) {
+				error = hammer2_chain_modify(chain, mtid, 0, 0);
+				KKASSERT(error == 0);
+				bzero(&chain->data->bmdata[0],
+				    HAMMER2_FREEMAP_LEVELN_PSIZE);
+				chain->bref.check.freemap.bigmask = (uint32_t)-1;
+				chain->bref.check.freemap.avail = l1size;
+				/* bref.methods should already be inherited. */
+				hammer2_freemap_init(hmp, key, chain);
+			} else {
+				hprintf("error %d creating leaf at data_off "
+				    "%016llx\n", error,
+				    (long long)brefs[i].data_off);
+				hammer2_chain_unlock(parent);
+				hammer2_chain_drop(parent);
+				rerror = error;
+				break;
+			}
+		}
+
+		/*
+		 * Adjust this and all remaining brefs of the same leaf.
+		 */
+		modified = 0;
+		for (j = i; j < nbrefs; ++j) {
+			if (done & ((uint64_t)1 << j))
+				continue;
+			data_off = brefs[j].data_off & ~HAMMER2_OFF_MASK_RADIX;
+			if (data_off < hmp->voldata.allocator_beg ||
+			    H2FMBASE(data_off,
+			    HAMMER2_FREEMAP_LEVEL1_RADIX) != key)
+				continue;
+			done |= (uint64_t)1 << j;
+			bgsize += hammer2_freemap_adjust_leaf(chain, &brefs[j],
+			    mtid, how, &modified);
+		}
+
+		/*
+		 * chain->bref.check.freemap.bigmask (XXX)
+		 *
+		 * Setting bigmask is a hint to the allocation code that
+		 * there might be something allocatable.  We also set this
+		 * in recovery... it doesn't hurt and we might want to use
+		 * the hint for other validation operations later on.
+		 *
+		 * We could calculate the largest possible allocation and
+		 * set the radixes that could fit, but its easier just to
+		 * set bigmask to -1.
+		 */
+		if (modified) {
+			chain->bref.check.freemap.bigmask = -1;
+			hmp->freemap_relaxed = 0; /* reset heuristic */
+		}
 
-	/* Stop early if we are trying to free something but no leaf exists. */
-	if (chain == NULL && how != HAMMER2_FREEMAP_DORECOVER) {
-		hprintf("no chain at data_off %016llx\n",
-		    (long long)bref->data_off);
-		goto done;
-	}
-	if (chain->error) {
-		hprintf("error %d at data_off %016llx\n",
-		    chain->error, (long long)bref->data_off);
 		hammer2_chain_unlock(chain);
 		hammer2_chain_drop(chain);
-		chain = NULL;
-		goto done;
+next:
+		hammer2_chain_unlock(parent);
+		hammer2_chain_drop(parent);
 	}
 
-	/*
-	 * Create any missing leaf(s) if we are doing a recovery (marking
-	 * the block(s) as being allocated instead of being freed).  Be sure
-	 * to initialize the auxillary freemap tracking info in the
-	 * bref.check.freemap structure.
-	 */
-	if (chain == NULL && how == HAMMER2_FREEMAP_DORECOVER) {
-		error = hammer2_chain_create(&parent, &chain, NULL, hmp->spmp,
-		    HAMMER2_METH_DEFAULT, key, HAMMER2_FREEMAP_LEVEL1_RADIX,
-		    HAMMER2_BREF_TYPE_FREEMAP_LEAF,
-		    HAMMER2_FREEMAP_LEVELN_PSIZE, mtid, 0, 0);
-		if (error == 0) {
-			error = hammer2_chain_modify(chain, mtid, 0, 0);
-			KKASSERT(error == 0);
-			bzero(&chain->data->bmdata[0],
-			    HAMMER2_FREEMAP_LEVELN_PSIZE);
-			chain->bref.check.freemap.bigmask = (uint32_t)-1;
-			chain->bref.check.freemap.avail = l1size;
-			/* bref.methods should already be inherited. */
-			hammer2_freemap_init(hmp, key, chain);
-		}
-		/* XXX handle error */
+	if (bgsize) {
+		hammer2_voldata_lock(hmp);
+		hammer2_voldata_modify(hmp);
+		hmp->voldata.allocator_free -= bgsize;
+		hammer2_voldata_unlock(hmp);
 	}
 
+	return (rerror);
+}
+
+/*
+ * Adjust the bitmap of the locked level1 leaf chain for a single bref.
+ * The leaf is modified on the first actual change, *modifiedp tracks
+ * this across the brefs of a batch.  Returns the number of bytes which
+ * transitioned from free to allocated.
+ */
+static size_t
+hammer2_freemap_adjust_leaf(hammer2_chain_t *chain, hammer2_blockref_t *bref,
+    hammer2_tid_t mtid, int how, int *modifiedp)
+{
+	hammer2_off_t data_off = bref->data_off;
+	hammer2_bmap_data_t *bmap;
+	hammer2_bitmap_t *bitmap;
+	const hammer2_bitmap_t bmmask00 = 0;
+	//hammer2_bitmap_t bmmask01;
+	//hammer2_bitmap_t bmmask10;
+	hammer2_bitmap_t bmmask11;
+	uint16_t class;
+	int radix, start, count, changed = 0;
+	size_t bgsize = 0;
+
+	radix = (int)data_off & HAMMER2_OFF_MASK_RADIX;
+	KKASSERT(radix != 0);
+	KKASSERT(radix <= HAMMER2_RADIX_MAX);
+
+	data_off &= ~HAMMER2_OFF_MASK_RADIX;
+
+	class = (bref->type << 8) | HAMMER2_PBUFRADIX;
+
 	/* Calculate the bitmask (runs in 2-bit pairs). */
 	start = ((int)(data_off >> HAMMER2_FREEMAP_BLOCK_RADIX) & 15) * 2;
 	//bmmask01 = (hammer2_bitmap_t)1 << start;
@@ -903,7 +1007,7 @@ again:
 	    (HAMMER2_FREEMAP_COUNT - 1)];
 	bitmap = &bmap->bitmapq[(int)(data_off >> (HAMMER2_SEGRADIX - 3)) & 7];
 
-	if (modified)
+	if (changed)
 		bmap->linear = 0;
 
 	while (count) {
@@ -911,9 +1015,13 @@ again:
 		if (how == HAMMER2_FREEMAP_DORECOVER) {
 			/* Recovery request, mark as allocated. */
 			if ((*bitmap & bmmask11) != bmmask11) {
-				if (modified == 0) {
-					hammer2_chain_modify(chain, mtid, 0, 0);
-					modified = 1;
+				if (changed == 0) {
+					if (*modifiedp == 0) {
+						hammer2_chain_modify(chain,
+						    mtid, 0, 0);
+						*modifiedp = 1;
+					}
+					changed = 1;
 					goto again;
 				}
 				if ((*bitmap & bmmask11) == bmmask00) {
@@ -932,34 +1040,7 @@ again:
 		bmmask11 <<= 2;
 	}
 
-	/*
-	 * chain->bref.check.freemap.bigmask (XXX)
-	 *
-	 * Setting bigmask is a hint to the allocation code that there might
-	 * be something allocatable.  We also set this in recovery... it
-	 * doesn't hurt and we might want to use the hint for other validation
-	 * operations later on.
-	 *
-	 * We could calculate the largest possible allocation and set the
-	 * radixes that could fit, but its easier just to set bigmask to -1.
-	 */
-	if (modified) {
-		chain->bref.check.freemap.bigmask = -1;
-		hmp->freemap_relaxed = 0; /* reset heuristic */
-	}
-
-	hammer2_chain_unlock(chain);
-	hammer2_chain_drop(chain);
-done:
-	hammer2_chain_unlock(parent);
-	hammer2_chain_drop(parent);
-
-	if (bgsize) {
-		hammer2_voldata_lock(hmp);
-		hammer2_voldata_modify(hmp);
-		hmp->voldata.allocator_free -= bgsize;
-		hammer2_voldata_unlock(hmp);
-	}
+	return (bgsize);
 }
 
 /*
@@ -36,6 +36,7 @@
  */
 
 #include "hammer2.h"
+#include "hammer2_mount.h"
 
 static void hammer2_inode_repoint(hammer2_inode_t *, hammer2_cluster_t *);
 static void hammer2_inode_repoint_one(hammer2_inode_t *, hammer2_cluster_t *,
@@ -1257,6 +1258,28 @@ hammer2_inode_repoint_one(hammer2_inode_t *ip, hammer2_cluster_t *cluster,
 	}
 }
 
+/*
+ * Copy a consistent snapshot of ip->meta without the inode lock, retrying
+ * if a writer was inside hammer2_inode_meta_begin()/end() meanwhile.
+ */
+void
+hammer2_inode_meta_copy(const hammer2_inode_t *ip, hammer2_inode_meta_t *meta)
+{
+	unsigned int seq;
+
+	for (;;) {
+		seq = ip->meta_seq;
+		membar_consumer();
+		if ((seq & 1) == 0) {
+			*meta = ip->meta;
+			membar_consumer();
+			if (ip->meta_seq == seq)
+				break;
+		}
+		CPU_BUSY_CYCLE();
+	}
+}
+
 hammer2_key_t
 hammer2_inode_data_count(const hammer2_inode_t *ip)
 {
@@ -1354,10 +1377,12 @@ hammer2_inode_unlink_finisher(hammer2_inode_t *ip, struct vnode **vprecyclep)
 
 	/* Adjust nlinks and retain the inode on the media for now. */
 	hammer2_inode_modify(ip);
+	hammer2_inode_meta_begin(ip);
 	if ((int64_t)ip->meta.nlinks > 1)
 		--ip->meta.nlinks;
 	else
 		ip->meta.nlinks = 0;
+	hammer2_inode_meta_end(ip);
 
 	return (0);
 }
@@ -1392,6 +1417,37 @@ hammer2_inode_modify(hammer2_inode_t *ip)
 		hammer2_inode_delayed_sideq(ip);
 }
 
+/*
+ * Called after updating timestamps in ip->meta.  On lazytime mounts the
+ * inode is only flagged LAZYTIME instead of being modified, so that the
+ * syncer does not write it out for the timestamps alone.  They are folded
+ * in by the next real modification of the inode, or by
+ * hammer2_inode_lazytime_sync() on fsync and sync(2).  Inactivation
+ * queues the inode for the next sync instead.
+ *
+ * The inode must be locked exclusively.
+ */
+void
+hammer2_inode_touch(hammer2_inode_t *ip)
+{
+	if (ip->pmp && (ip->pmp->hflags & HMNT2_LAZYTIME))
+		atomic_set_int(&ip->flags, HAMMER2_INODE_LAZYTIME);
+	else
+		hammer2_inode_modify(ip);
+}
+
+/*
+ * Turn deferred timestamp updates into an inode modification.
+ *
+ * The inode must be locked exclusively.
+ */
+void
+hammer2_inode_lazytime_sync(hammer2_inode_t *ip)
+{
+	if (ip->flags & HAMMER2_INODE_LAZYTIME)
+		hammer2_inode_modify(ip);
+}
+
 /*
  * This function was originally required by NetBSD VFS sync.
  * This doesn't exist in DragonFly HAMMER2.
@@ -1459,7 +1515,9 @@ hammer2_inode_chain_sync(hammer2_inode_t *ip)
 		if (ip->flags & HAMMER2_INODE_RESIZED) {
 			if ((ip->meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA) &&
 			    ip->meta.size > HAMMER2_EMBEDDED_BYTES) {
+				hammer2_inode_meta_begin(ip);
 				ip->meta.op_flags &= ~HAMMER2_OPFLAG_DIRECTDATA;
+				hammer2_inode_meta_end(ip);
 				xop->clear_directdata = 1;
 			}
 			xop->osize = ip->osize;
@@ -1468,8 +1526,8 @@ hammer2_inode_chain_sync(hammer2_inode_t *ip)
 		}
 		xop->ipflags = ip->flags;
 		xop->meta = ip->meta;
-		atomic_clear_int(&ip->flags,
-		    HAMMER2_INODE_RESIZED | HAMMER2_INODE_MODIFIED);
+		atomic_clear_int(&ip->flags, HAMMER2_INODE_RESIZED |
+		    HAMMER2_INODE_MODIFIED | HAMMER2_INODE_LAZYTIME);
 		hammer2_xop_start(&xop->head, &hammer2_inode_chain_sync_desc);
 		error = hammer2_xop_collect(&xop->head, 0);
 		hammer2_xop_retire(&xop->head, HAMMER2_XOPMASK_VOP);
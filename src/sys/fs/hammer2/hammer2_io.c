@@ -186,8 +186,10 @@ hammer2_io_getblk(hammer2_dev_t *hmp, int btype, hammer2_off_t lbase, int lsize,
 	hammer2_mtx_ex(&hmp->iohash_lock);
 	if (op == HAMMER2_DOP_READQ) {
 		dio = hammer2_io_alloc(hmp, lbase, btype, 0);
-		if (dio == NULL)
+		if (dio == NULL) {
+			hammer2_mtx_unlock(&hmp->iohash_lock);
 			return (NULL);
+		}
 		op = HAMMER2_DOP_READ;
 	} else {
 		dio = hammer2_io_alloc(hmp, lbase, btype, 1);
@@ -413,6 +415,56 @@ hammer2_io_getquick(hammer2_dev_t *hmp, off_t lbase, int lsize)
 	return (hammer2_io_getblk(hmp, 0, lbase, lsize, HAMMER2_DOP_READQ));
 }
 
+/*
+ * Start an asynchronous read of the physical buffer backing data_off
+ * unless it is already cached or in flight, so that a later
+ * hammer2_io_bread() finds it without waiting for the media.  This is
+ * the read-ahead half of breadn(9) for callers which know the blocks
+ * they are about to need but will not consume them right away.
+ * The read is accounted in the iostats once the buffer is consumed, the
+ * buffer cache statistics are kept the way bio_doread() keeps them.
+ * Returns non-zero if a read was started.
+ */
+int
+hammer2_io_prefetch(hammer2_dev_t *hmp, hammer2_off_t data_off)
+{
+	hammer2_volume_t *vol;
+	hammer2_off_t pbase;
+	struct vnode *devvp;
+	struct mount *mp;
+	struct buf *bp;
+	daddr_t lblkno;
+
+	if ((data_off & HAMMER2_OFF_MASK_RADIX) == 0)
+		return (0);
+	pbase = (data_off & ~HAMMER2_OFF_MASK_RADIX) &
+	    ~(hammer2_off_t)(HAMMER2_PBUFSIZE - 1);
+	if (pbase == 0)
+		return (0);
+
+	vol = hammer2_get_volume(hmp, pbase);
+	devvp = vol->dev->devvp;
+	lblkno = (pbase - vol->offset) / DEV_BSIZE;
+	if (incore(devvp, lblkno))
+		return (0);
+
+	bp = getblk(devvp, lblkno, HAMMER2_PBUFSIZE, 0, INFSLP);
+	if (bp->b_flags & (B_DONE | B_DELWRI)) {
+		brelse(bp);
+		return (0);
+	}
+	bp->b_flags |= B_READ | B_ASYNC;
+	bcstats.pendingreads++;
+	bcstats.numreads++;
+	VOP_STRATEGY(bp->b_vp, bp);
+
+	mp = devvp->v_specmountpoint;
+	if (mp != NULL)
+		mp->mnt_stat.f_asyncreads++;
+
+	return (1);
+}
+
 void
 hammer2_io_bawrite(hammer2_io_t **diop)
 {
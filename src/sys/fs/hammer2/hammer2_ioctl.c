@@ -444,6 +444,22 @@ _uuidgen(struct uuid *u)
 	u->time_hi_and_version &= ~(1 << 15);
 }
 
+/*
+ * Create a snapshot of the PFS ip belongs to.
+ *
+ * pfs_lsnap_tid is set on the PFS root first, so that nocrc/nocomp file
+ * data modified from then on is copied-on-write rather than overwritten
+ * under the snapshot.  The PFS is then flushed like hammer2_sync() does,
+ * its dirty inodes one at a time followed by the volume header, so the
+ * blocks the snapshot references are durable before it is created.  The
+ * flush runs under the snapshot's own flush transaction instead of a
+ * separate one.
+ *
+ * The PFS root is only locked briefly to set pfs_lsnap_tid and to copy
+ * the flushed blockset, not across the flush or while the new snapshot
+ * inode is created and flushed.  The total time and the time the PFS
+ * root was held are returned in microseconds.
+ */
 static int
 hammer2_ioctl_pfs_snapshot(hammer2_inode_t *ip, void *data)
 {
@@ -453,8 +469,11 @@ hammer2_ioctl_pfs_snapshot(hammer2_inode_t *ip, void *data)
 	hammer2_chain_t *chain, *nchain;
 	hammer2_inode_t *nip;
 	hammer2_inode_data_t *wipdata;
+	hammer2_blockset_t blockset;
+	hammer2_blockref_t bref;
 	hammer2_tid_t mtid, starting_inum;
-	int error;
+	uint64_t start, locked, stall;
+	int error, nosync;
 
 	pmp = ip->pmp;
 	ip = pmp->iroot;
@@ -470,28 +489,48 @@ hammer2_ioctl_pfs_snapshot(hammer2_inode_t *ip, void *data)
 	if (hammer2_is_rdonly(ip->pmp->mp))
 		return (EROFS);
 
+	start = getnsecuptime();
 	hammer2_lk_ex(&hmp->bulklk);
 
 	/*
-	 * NOSYNC is for debugging.  We skip the filesystem sync and use
-	 * a normal transaction (which is less likely to stall).  used for
-	 * testing filesystem consistency.
-	 *
-	 * In normal mode we sync the filesystem and use a flush transaction.
+	 * NOSYNC is for debugging.  We skip the flush and use a normal
+	 * transaction (which is less likely to stall), snapshotting the
+	 * PFS as of the last sync.  Used for testing filesystem
+	 * consistency.
 	 */
-	if (pfs->pfs_flags & HAMMER2_PFSFLAGS_NOSYNC) {
-		hammer2_trans_init(pmp, 0);
-	} else {
-		hammer2_sync(pmp->mp, MNT_WAIT, 0, NULL, NULL);
-		hammer2_trans_init(pmp, HAMMER2_TRANS_ISFLUSH);
-	}
+	nosync = (pfs->pfs_flags & HAMMER2_PFSFLAGS_NOSYNC) != 0;
+	hammer2_trans_init(pmp, nosync ? 0 : HAMMER2_TRANS_ISFLUSH);
 	mtid = hammer2_trans_sub(pmp);
+
+	locked = getnsecuptime();
 	hammer2_inode_lock(ip, 0);
 	hammer2_inode_modify(ip);
+	hammer2_inode_meta_begin(ip);
 	ip->meta.pfs_lsnap_tid = mtid;
+	hammer2_inode_meta_end(ip);
+	hammer2_inode_unlock(ip);
+	stall = getnsecuptime() - locked;
 
-	chain = hammer2_inode_chain(ip, 0, HAMMER2_RESOLVE_ALWAYS);
-	hmp = chain->hmp;
+	if (!nosync)
+		hammer2_flush_pmp(pmp, HAMMER2_XOP_VOLHDR);
+
+	/*
+	 * No other flush can run while we hold the flush transaction, so
+	 * the blockset and the statistics in the root chain's bref match.
+	 */
+	locked = getnsecuptime();
+	hammer2_inode_lock(ip, HAMMER2_RESOLVE_SHARED);
+	chain = hammer2_inode_chain(ip, 0,
+	    HAMMER2_RESOLVE_ALWAYS | HAMMER2_RESOLVE_SHARED);
+	bref = chain->bref;
+	hammer2_spin_ex(&pmp->blockset_spin);
+	blockset = pmp->pfs_iroot_blocksets[0];
+	hammer2_spin_unex(&pmp->blockset_spin);
+	starting_inum = pmp->inode_tid + 1;
+	hammer2_chain_unlock(chain);
+	hammer2_chain_drop(chain);
+	hammer2_inode_unlock(ip);
+	stall += getnsecuptime() - locked;
 
 	/*
 	 * Create the snapshot directory under the super-root.
@@ -509,10 +548,8 @@ hammer2_ioctl_pfs_snapshot(hammer2_inode_t *ip, void *data)
 	 * chain_duplicate() but it becomes difficult to disentangle
 	 * the shared core so for now just brute-force it.
 	 */
-	hammer2_chain_unlock(chain);
 	nip = hammer2_inode_create_pfs(hmp->spmp, pfs->name, strlen(pfs->name),
 	    &error);
-	hammer2_chain_lock(chain, HAMMER2_RESOLVE_ALWAYS);
 
 	if (nip) {
 		atomic_set_int(&nip->flags, HAMMER2_INODE_NOSIDEQ);
@@ -522,13 +559,12 @@ hammer2_ioctl_pfs_snapshot(hammer2_inode_t *ip, void *data)
 		KKASSERT(error == 0);
 		wipdata = &nchain->data->ipdata;
 
-		starting_inum = ip->pmp->inode_tid + 1;
 		nip->meta.pfs_inum = starting_inum;
 		nip->meta.pfs_type = HAMMER2_PFSTYPE_MASTER;
 		nip->meta.pfs_subtype = HAMMER2_PFSSUBTYPE_SNAPSHOT;
 		nip->meta.op_flags |= HAMMER2_OPFLAG_PFSROOT;
 		nip->meta.pfs_lsnap_tid = mtid;
-		nchain->bref.embed.stats = chain->bref.embed.stats;
+		nchain->bref.embed.stats = bref.embed.stats;
 
 		_uuidgen(&nip->meta.pfs_fsid);
 		_uuidgen(&nip->meta.pfs_clid);
@@ -537,9 +573,7 @@ hammer2_ioctl_pfs_snapshot(hammer2_inode_t *ip, void *data)
 		/* XXX hack blockset copy */
 		/* XXX doesn't work with real cluster */
 		wipdata->meta = nip->meta;
-		hammer2_spin_ex(&pmp->blockset_spin);
-		wipdata->u.blockset = pmp->pfs_iroot_blocksets[0];
-		hammer2_spin_unex(&pmp->blockset_spin);
+		wipdata->u.blockset = blockset;
 
 		KKASSERT(wipdata == &nchain->data->ipdata);
 
@@ -566,11 +600,7 @@ hammer2_ioctl_pfs_snapshot(hammer2_inode_t *ip, void *data)
 		hammer2_chain_drop(nchain);
 	}
 
-	hammer2_chain_unlock(chain);
-	hammer2_chain_drop(chain);
-
-	hammer2_inode_unlock(ip);
-	if (pfs->pfs_flags & HAMMER2_PFSFLAGS_NOSYNC)
+	if (nosync)
 		hammer2_trans_done(pmp, 0);
 	else
 		hammer2_trans_done(pmp,
@@ -578,6 +608,9 @@ hammer2_ioctl_pfs_snapshot(hammer2_inode_t *ip, void *data)
 
 	hammer2_lk_unlock(&hmp->bulklk);
 
+	pfs->snap_usecs = MIN((getnsecuptime() - start) / 1000, UINT32_MAX);
+	pfs->snap_stall_usecs = MIN(stall / 1000, UINT32_MAX);
+
 	return (hammer2_error_to_errno(error));
 }
 
@@ -619,29 +652,39 @@ hammer2_ioctl_inode_set(hammer2_inode_t *ip, void *data)
 	if ((ino->flags & HAMMER2IOC_INODE_FLAG_CHECK) &&
 	    ip->meta.check_algo != ino->ip_data.meta.check_algo) {
 		hammer2_inode_modify(ip);
+		hammer2_inode_meta_begin(ip);
 		ip->meta.check_algo = ino->ip_data.meta.check_algo;
+		hammer2_inode_meta_end(ip);
 	}
 	if ((ino->flags & HAMMER2IOC_INODE_FLAG_COMP) &&
 	    ip->meta.comp_algo != ino->ip_data.meta.comp_algo) {
 		hammer2_inode_modify(ip);
+		hammer2_inode_meta_begin(ip);
 		ip->meta.comp_algo = ino->ip_data.meta.comp_algo;
+		hammer2_inode_meta_end(ip);
 	}
 
 	/* Ignore these flags for now... */
 	if ((ino->flags & HAMMER2IOC_INODE_FLAG_IQUOTA) &&
 	    ip->meta.inode_quota != ino->ip_data.meta.inode_quota) {
 		hammer2_inode_modify(ip);
+		hammer2_inode_meta_begin(ip);
 		ip->meta.inode_quota = ino->ip_data.meta.inode_quota;
+		hammer2_inode_meta_end(ip);
 	}
 	if ((ino->flags & HAMMER2IOC_INODE_FLAG_DQUOTA) &&
 	    ip->meta.data_quota != ino->ip_data.meta.data_quota) {
 		hammer2_inode_modify(ip);
+		hammer2_inode_meta_begin(ip);
 		ip->meta.data_quota = ino->ip_data.meta.data_quota;
+		hammer2_inode_meta_end(ip);
 	}
 	if ((ino->flags & HAMMER2IOC_INODE_FLAG_COPIES) &&
 	    ip->meta.ncopies != ino->ip_data.meta.ncopies) {
 		hammer2_inode_modify(ip);
+		hammer2_inode_meta_begin(ip);
 		ip->meta.ncopies = ino->ip_data.meta.ncopies;
+		hammer2_inode_meta_end(ip);
 	}
 
 	hammer2_inode_unlock(ip);
@@ -1052,6 +1095,34 @@ hammer2_ioctl_volume_list(hammer2_inode_t *ip, void *data)
 	return (error);
 }
 
+/*
+ * Deallocate a byte range of a regular file.
+ */
+static int
+hammer2_ioctl_punch(hammer2_inode_t *ip, void *data, int fflag)
+{
+	hammer2_ioc_punch_t *punch = data;
+	struct vnode *vp = ip->vp;
+	int error;
+
+	if (ip->pmp->rdonly || (ip->pmp->flags & HAMMER2_PMPF_EMERG))
+		return (EROFS);
+	if ((fflag & FWRITE) == 0)
+		return (EBADF);
+	if (vp == NULL || vp->v_type != VREG)
+		return (EINVAL);
+	if ((off_t)punch->offset < 0 || (off_t)punch->length < 0)
+		return (EINVAL);
+
+	vn_lock(vp, LK_EXCLUSIVE | LK_RETRY);
+	hammer2_trans_init(ip->pmp, 0);
+	error = hammer2_punch_file(ip, punch->offset, punch->length);
+	hammer2_trans_done(ip->pmp, HAMMER2_TRANS_SIDEQ);
+	VOP_UNLOCK(vp);
+
+	return (error);
+}
+
 int
 hammer2_ioctl_impl(hammer2_inode_t *ip, unsigned long com, void *data,
     int fflag, struct ucred *cred)
@@ -1101,6 +1172,9 @@ hammer2_ioctl_impl(hammer2_inode_t *ip, unsigned long com, void *data,
 	case HAMMER2IOC_VOLUME_LIST:
 		error = hammer2_ioctl_volume_list(ip, data);
 		break;
+	case HAMMER2IOC_PUNCH:
+		error = hammer2_ioctl_punch(ip, data, fflag);
+		break;
 	default:
 		error = EOPNOTSUPP;
 		break;
@@ -69,7 +69,8 @@ struct hammer2_ioc_pfs {
 	uint8_t			reserved0012;
 	uint8_t			reserved0013;
 	uint32_t		pfs_flags;
-	uint64_t		reserved0018;
+	uint32_t		snap_usecs;	/* (SNAPSHOT only) total time */
+	uint32_t		snap_stall_usecs; /* (SNAPSHOT only) root held */
 	struct uuid		pfs_fsid;	/* identifies PFS instance */
 	struct uuid		pfs_clid;	/* identifies PFS cluster */
 	char			name[NAME_MAX+1]; /* PFS label */
@@ -162,6 +163,17 @@ struct hammer2_ioc_volume_list {
 
 typedef struct hammer2_ioc_volume_list hammer2_ioc_volume_list_t;
 
+/*
+ * Deallocate a byte range of a regular file (hole punch).  The file size
+ * is not changed and the range reads back as zeros.
+ */
+struct hammer2_ioc_punch {
+	hammer2_off_t		offset;
+	hammer2_off_t		length;
+};
+
+typedef struct hammer2_ioc_punch hammer2_ioc_punch_t;
+
 /*
  * Ioctl list.
  */
@@ -179,5 +191,6 @@ typedef struct hammer2_ioc_volume_list hammer2_ioc_volume_list_t;
 #define HAMMER2IOC_EMERG_MODE		_IOWR('h', 95, int)
 #define HAMMER2IOC_GROWFS		_IOWR('h', 96, struct hammer2_ioc_growfs)
 #define HAMMER2IOC_VOLUME_LIST		_IOWR('h', 97, struct hammer2_ioc_volume_list)
+#define HAMMER2IOC_PUNCH		_IOWR('h', 98, struct hammer2_ioc_punch)
 
 #endif /* !_FS_HAMMER2_IOCTL_H_ */
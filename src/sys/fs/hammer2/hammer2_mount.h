@@ -64,8 +64,12 @@ struct hammer2_mount_info {
 
 #define HMNT2_LOCAL		0x00000002
 #define HMNT2_EMERG		0x00000004
+#define HMNT2_LAZYTIME		0x00000008	/* defer timestamp updates */
+#define HMNT2_RELATIME		0x00000010	/* maintain atime, relatime */
+#define HMNT2_PFSUPDATE		0x00000020	/* update sets HMNT2_PFSFLAGS */
 
 #define HMNT2_DEVFLAGS		(HMNT2_LOCAL)
+#define HMNT2_PFSFLAGS		(HMNT2_LAZYTIME | HMNT2_RELATIME)
 
 /* for sbin/sysctl/sysctl.c */
 #define HAMMER2CTL_SUPPORTED_VERSION	1
@@ -301,7 +301,10 @@ hammer2_calc_physical(hammer2_inode_t *ip, hammer2_key_t lbase)
 void
 hammer2_update_time(uint64_t *timep)
 {
-	*timep = (uint64_t)gettime();
+	struct timespec ts;
+
+	getnanotime(&ts);
+	*timep = hammer2_timespec_to_time(&ts);
 }
 
 /*
@@ -50,6 +50,7 @@ static void hammer2_update_pmps(hammer2_dev_t *);
 static void hammer2_mount_helper(struct mount *, hammer2_pfs_t *);
 static void hammer2_unmount_helper(struct mount *, hammer2_pfs_t *,
     hammer2_dev_t *);
+static int hammer2_sync_lazytime(struct vnode *, void *);
 
 struct pool hammer2_pool_inode;
 struct pool hammer2_pool_xops;
@@ -356,7 +357,7 @@ hammer2_pfsfree(hammer2_pfs_t *pmp)
 	hammer2_chain_t *chain;
 	int i, chains_still_present = 0;
 
-	KKASSERT(!(pmp->flags & HAMMER2_PMPF_WAITING));
+	KKASSERT(pmp->xop_waiting == 0);
 
 	/* Cleanup our reference on iroot. */
 	if (pmp->flags & HAMMER2_PMPF_SPMP)
@@ -544,8 +545,10 @@ hammer2_mount(struct mount *mp, const char *path, void *data,
 		}
 		if (error)
 			return (error);
+		if (args->hflags & HMNT2_PFSUPDATE)
+			pmp->hflags = args->hflags & HMNT2_PFSFLAGS;
 
-		if (args && args->fspec == NULL) {
+		if (args->fspec == NULL) {
 			/* Process export requests. */
 			return (vfs_export(mp, &pmp->pm_export,
 			    &args->export_info));
@@ -979,6 +982,8 @@ next_hmp:
 	mp->mnt_stat.f_iosize = HAMMER2_PBUFSIZE;
 	mp->mnt_stat.f_bsize = HAMMER2_PBUFSIZE;
 
+	pmp->hflags = args->hflags & HMNT2_PFSFLAGS;
+
 	/* Connect up mount pointers. */
 	hammer2_mount_helper(mp, pmp);
 	hammer2_lk_unlock(&hammer2_mntlk);
@@ -1316,6 +1321,16 @@ again:
  * transaction.  In case of a crash, then on a fresh mount we must do an
  * incremental scan of the last committed transaction id and make sure that
  * all related blocks have been marked allocated.
+ *
+ * The scan is bound by media latency, not by cpu.  Before descending into
+ * a node the blocks of all of its children which are going to be scanned
+ * are read ahead asynchronously, so that the depth-first recursion mostly
+ * finds them cached.  Leaf brefs of a node are collected and handed to
+ * the freemap in batches, which then looks up and modifies each freemap
+ * leaf once per batch instead of once per bref.
+ *
+ * The walk itself runs on a single thread before the mount completes, a
+ * read-only mount defers it to hammer2_do_recovery() on the upgrade.
  */
 struct hammer2_recovery_elm {
 	TAILQ_ENTRY(hammer2_recovery_elm) entry;
@@ -1329,6 +1344,9 @@ struct hammer2_recovery_info {
 	struct hammer2_recovery_list list;
 	hammer2_tid_t mtid;
 	int depth;
+	uint64_t chains;	/* recursive nodes visited */
+	uint64_t leaves;	/* leaf brefs adjusted */
+	uint64_t prefetched;	/* child blocks read ahead */
 };
 
 static int hammer2_recovery_scan(hammer2_dev_t *, hammer2_chain_t *,
@@ -1343,21 +1361,27 @@ hammer2_recovery(hammer2_dev_t *hmp)
 	struct hammer2_recovery_elm *elm;
 	hammer2_chain_t *parent;
 	hammer2_tid_t sync_tid, mirror_tid;
-	int error;
+	uint64_t start;
+	int error, needed;
 
 	hammer2_trans_init(hmp->spmp, 0);
 
 	sync_tid = hmp->voldata.freemap_tid;
 	mirror_tid = hmp->voldata.mirror_tid;
+	needed = sync_tid < mirror_tid;
 
-	if (sync_tid >= mirror_tid)
+	if (!needed)
 		debug_hprintf("no recovery needed\n");
 	else
 		hprintf("freemap recovery %016llx-%016llx\n",
 		    (long long)sync_tid + 1, (long long)mirror_tid);
 
+	start = getnsecuptime();
 	TAILQ_INIT(&info.list);
 	info.depth = 0;
+	info.chains = 0;
+	info.leaves = 0;
+	info.prefetched = 0;
 	parent = hammer2_chain_lookup_init(&hmp->vchain, 0);
 	error = hammer2_recovery_scan(hmp, parent, &info, sync_tid);
 	hammer2_chain_lookup_done(parent);
@@ -1377,18 +1401,74 @@ hammer2_recovery(hammer2_dev_t *hmp)
 
 	hammer2_trans_done(hmp->spmp, 0);
 
+	if (needed)
+		hprintf("freemap recovery %llu chains %llu leaves "
+		    "%llu prefetched in %llu ms, error %d\n",
+		    (unsigned long long)info.chains,
+		    (unsigned long long)info.leaves,
+		    (unsigned long long)info.prefetched,
+		    (unsigned long long)(getnsecuptime() - start) / 1000000,
+		    error);
+
 	return (error);
 }
 
+/*
+ * Start read-ahead on the blocks of the children of parent which
+ * hammer2_recovery_scan() is going to recurse into.  Leaves are never
+ * read by the scan.  The parent must be locked with its data resolved.
+ */
+static void
+hammer2_recovery_prefetch(hammer2_dev_t *hmp, hammer2_chain_t *parent,
+    struct hammer2_recovery_info *info, hammer2_tid_t sync_tid)
+{
+	hammer2_blockref_t *base, *bref;
+	int i, count;
+
+	switch (parent->bref.type) {
+	case HAMMER2_BREF_TYPE_VOLUME:
+		base = &parent->data->voldata.sroot_blockset.blockref[0];
+		count = HAMMER2_SET_COUNT;
+		break;
+	case HAMMER2_BREF_TYPE_INODE:
+		if (parent->data->ipdata.meta.op_flags &
+		    HAMMER2_OPFLAG_DIRECTDATA)
+			return;
+		base = &parent->data->ipdata.u.blockset.blockref[0];
+		count = HAMMER2_SET_COUNT;
+		break;
+	case HAMMER2_BREF_TYPE_INDIRECT:
+		if (parent->flags & HAMMER2_CHAIN_INITIAL)
+			return;
+		base = &parent->data->npdata[0];
+		count = parent->bytes / sizeof(hammer2_blockref_t);
+		break;
+	default:
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		bref = &base[i];
+		if (bref->mirror_tid <= sync_tid)
+			continue;
+		if (bref->type != HAMMER2_BREF_TYPE_INODE &&
+		    bref->type != HAMMER2_BREF_TYPE_INDIRECT)
+			continue;
+		if (hammer2_io_prefetch(hmp, bref->data_off))
+			++info->prefetched;
+	}
+}
+
 static int
 hammer2_recovery_scan(hammer2_dev_t *hmp, hammer2_chain_t *parent,
     struct hammer2_recovery_info *info, hammer2_tid_t sync_tid)
 {
 	hammer2_chain_t *chain;
 	hammer2_blockref_t bref;
+	hammer2_blockref_t *batch;
 	struct hammer2_recovery_elm *elm;
 	const hammer2_inode_data_t *ripdata;
-	int tmp_error, rup_error, error, first;
+	int tmp_error, rup_error, error, first, nbatch;
 
 	/* Adjust freemap to ensure that the block(s) are marked allocated. */
 	if (parent->bref.type != HAMMER2_BREF_TYPE_VOLUME)
@@ -1410,6 +1490,7 @@ hammer2_recovery_scan(hammer2_dev_t *hmp, hammer2_chain_t *parent,
 		if (ripdata->meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA) {
 			/* not applicable to recovery scan */
 			hammer2_chain_unlock(parent);
+			++info->chains;
 			return (0);
 		}
 		hammer2_chain_unlock(parent);
@@ -1441,6 +1522,10 @@ hammer2_recovery_scan(hammer2_dev_t *hmp, hammer2_chain_t *parent,
 		/* unlocked by caller */
 		return (0);
 	}
+	++info->chains;
+
+	/* The caller's lock keeps the data resolved above around. */
+	hammer2_recovery_prefetch(hmp, parent, info, sync_tid);
 
 	/*
 	 * Recursive scan of the last flushed transaction only.  We are
@@ -1451,6 +1536,9 @@ hammer2_recovery_scan(hammer2_dev_t *hmp, hammer2_chain_t *parent,
 	 * rup_error	Cumulative error for recursion
 	 * tmp_error	Specific non-cumulative recursion error
 	 */
+	batch = hmalloc(sizeof(*batch) * HAMMER2_FREEMAP_BATCH, M_HAMMER2,
+	    M_WAITOK);
+	nbatch = 0;
 	chain = NULL;
 	first = 1;
 	rup_error = 0;
@@ -1463,11 +1551,25 @@ hammer2_recovery_scan(hammer2_dev_t *hmp, hammer2_chain_t *parent,
 		if (error)
 			break;
 
-		/* If this is a leaf. */
+		/*
+		 * If this is a leaf, batch it.  Leaves without media
+		 * (e.g. directory entries with embedded names) are not
+		 * in the freemap.
+		 */
 		if (chain == NULL) {
-			if (bref.mirror_tid > sync_tid)
-				hammer2_freemap_adjust(hmp, &bref,
-				    HAMMER2_FREEMAP_DORECOVER);
+			if (bref.mirror_tid > sync_tid &&
+			    (bref.data_off & HAMMER2_OFF_MASK_RADIX)) {
+				batch[nbatch++] = bref;
+				++info->leaves;
+				if (nbatch == HAMMER2_FREEMAP_BATCH) {
+					tmp_error =
+					    hammer2_freemap_adjust_batch(hmp,
+					    batch, nbatch,
+					    HAMMER2_FREEMAP_DORECOVER);
+					rup_error |= tmp_error;
+					nbatch = 0;
+				}
+			}
 			continue;
 		}
 
@@ -1493,6 +1595,11 @@ hammer2_recovery_scan(hammer2_dev_t *hmp, hammer2_chain_t *parent,
 			    HAMMER2_FLUSH_TOP | HAMMER2_FLUSH_ALL);
 		rup_error |= tmp_error;
 	}
+	if (nbatch)
+		rup_error |= hammer2_freemap_adjust_batch(hmp, batch, nbatch,
+		    HAMMER2_FREEMAP_DORECOVER);
+	hfree(batch, M_HAMMER2, sizeof(*batch) * HAMMER2_FREEMAP_BATCH);
+
 	return ((error | rup_error) & ~HAMMER2_ERROR_EOF);
 }
 
@@ -1614,17 +1721,66 @@ int
 hammer2_sync(struct mount *mp, int waitfor, int stall, struct ucred *cred,
     struct proc *p)
 {
+	/*
+	 * Timestamps deferred by lazytime are left alone by the periodic
+	 * syncer, but written out by sync(2) and unmount, waiting for
+	 * vnodes that are locked.
+	 */
+	if (waitfor != MNT_LAZY)
+		vfs_mount_foreach_vnode(mp, hammer2_sync_lazytime, NULL);
+
 	return (hammer2_vfs_sync_pmp(MPTOPMP(mp), waitfor));
 }
 
+static int
+hammer2_sync_lazytime(struct vnode *vp, void *arg)
+{
+	hammer2_inode_t *ip = VTOI(vp);
+
+	if (vp->v_type == VNON || ip == NULL ||
+	    (ip->flags & HAMMER2_INODE_LAZYTIME) == 0)
+		return (0);
+	if (vget(vp, LK_EXCLUSIVE))
+		return (0);
+
+	hammer2_inode_lock(ip, 0);
+	hammer2_inode_lazytime_sync(ip);
+	hammer2_inode_unlock(ip);
+	vput(vp);
+
+	return (0);
+}
+
 int
 hammer2_vfs_sync_pmp(hammer2_pfs_t *pmp, int waitfor __unused)
+{
+	int error;
+
+	hammer2_trans_init(pmp, HAMMER2_TRANS_ISFLUSH);
+	debug_hprintf("FILESYSTEM SYNC BOUNDARY\n");
+	error = hammer2_flush_pmp(pmp, HAMMER2_XOP_VOLHDR);
+	hammer2_trans_done(pmp, HAMMER2_TRANS_ISFLUSH);
+
+	return (error);
+}
+
+/*
+ * Flush all dirty inodes of a PFS and then its root, which updates
+ * pmp->pfs_iroot_blocksets.  The caller holds a flush transaction.
+ *
+ * Only the inode being flushed is locked at any time, so the frontend
+ * keeps running against all the others.  xflags is added to the final
+ * flush of the PFS root, HAMMER2_XOP_VOLHDR also flushes the super-root
+ * and the volume header.
+ */
+int
+hammer2_flush_pmp(hammer2_pfs_t *pmp, int xflags)
 {
 	hammer2_inode_t *ip;
 	hammer2_depend_t *depend, *depend_next;
 	struct vnode *vp;
 	uint32_t pass2;
-	int error, dorestart, ndrop;
+	int dorestart, ndrop;
 
 	/*
 	 * Move all inodes on sideq to syncq.  This will clear sideq.
@@ -1644,8 +1800,6 @@ hammer2_vfs_sync_pmp(hammer2_pfs_t *pmp, int waitfor __unused)
 	 * SIDEQ to SYNCQ.  PASS2 propagation by inode_lock4() and
 	 * inode_depend() are atomic with the spin-lock.
 	 */
-	hammer2_trans_init(pmp, HAMMER2_TRANS_ISFLUSH);
-	debug_hprintf("FILESYSTEM SYNC BOUNDARY\n");
 	dorestart = 0;
 
 	/*
@@ -1908,18 +2062,14 @@ restart:
 		hammer2_mtx_ex(&ip->lock);
 		hammer2_inode_chain_sync(ip);
 		hammer2_inode_chain_flush(ip,
-		    HAMMER2_XOP_INODE_STOP | HAMMER2_XOP_FSSYNC |
-		    HAMMER2_XOP_VOLHDR);
+		    HAMMER2_XOP_INODE_STOP | HAMMER2_XOP_FSSYNC | xflags);
 		hammer2_inode_unlock(ip); /* unlock+drop */
 	}
 	debug_hprintf("FILESYSTEM SYNC STAGE 2 DONE\n");
 
 	hammer2_bioq_sync(pmp);
 
-	error = 0; /* XXX */
-	hammer2_trans_done(pmp, HAMMER2_TRANS_ISFLUSH);
-
-	return (error);
+	return (0); /* XXX */
 }
 
 static int
@@ -1986,7 +2136,9 @@ hammer2_root(struct mount *mp, struct vnode **vpp)
 
 		if (error == 0) {
 			meta = &hammer2_xop_gdata(&xop->head)->ipdata.meta;
+			hammer2_inode_meta_begin(pmp->iroot);
 			pmp->iroot->meta = *meta;
+			hammer2_inode_meta_end(pmp->iroot);
 			pmp->inode_tid = meta->pfs_inum + 1;
 			hammer2_xop_pdata(&xop->head);
 
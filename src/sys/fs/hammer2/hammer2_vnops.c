@@ -36,6 +36,7 @@
  */
 
 #include "hammer2.h"
+#include "hammer2_mount.h"
 
 #include <sys/limits.h>
 #include <sys/dirent.h>
@@ -108,6 +109,16 @@ hammer2_inactive(void *v)
 		VOP_UNLOCK(vp);
 		vrecycle(vp, ap->a_p);
 	} else {
+		/*
+		 * Don't keep deferred timestamps past the last reference.
+		 * The vnode can't be held from here, so queue the inode
+		 * for the next sync the way reclaim does.
+		 */
+		if ((ip->flags & HAMMER2_INODE_LAZYTIME) &&
+		    (ip->flags & HAMMER2_INODE_NOSIDEQ) == 0) {
+			atomic_set_int(&ip->flags, HAMMER2_INODE_MODIFIED);
+			hammer2_inode_delayed_sideq(ip);
+		}
 		hammer2_inode_unlock(ip);
 
 		VOP_UNLOCK(vp);
@@ -216,8 +227,9 @@ hammer2_fsync(void *v)
 	 */
 	vflushbuf(vp, ap->a_waitfor == MNT_WAIT);
 
-	/* Flush any inode changes. */
+	/* Flush any inode changes, including deferred timestamps. */
 	hammer2_inode_lock(ip, 0);
+	hammer2_inode_lazytime_sync(ip);
 	if (ip->flags & (HAMMER2_INODE_RESIZED|HAMMER2_INODE_MODIFIED))
 		error1 = hammer2_inode_chain_sync(ip);
 
@@ -249,10 +261,12 @@ hammer2_access(void *v)
 	} */ *ap = v;
 	struct vnode *vp = ap->a_vp;
 	hammer2_inode_t *ip = VTOI(vp);
+	hammer2_inode_meta_t meta;
+
+	hammer2_inode_meta_copy(ip, &meta);
 
-	return (vaccess(vp->v_type, ip->meta.mode & ALLPERMS,
-	    hammer2_to_unix_xid(&ip->meta.uid),
-	    hammer2_to_unix_xid(&ip->meta.gid),
+	return (vaccess(vp->v_type, meta.mode & ALLPERMS,
+	    hammer2_to_unix_xid(&meta.uid), hammer2_to_unix_xid(&meta.gid),
 	    ap->a_mode, ap->a_cred));
 }
 
@@ -269,23 +283,29 @@ hammer2_getattr(void *v)
 	struct vattr *vap = ap->a_vap;
 	hammer2_inode_t *ip = VTOI(vp);
 	hammer2_pfs_t *pmp = ip->pmp;
+	hammer2_inode_meta_t meta;
+
+	/* Lock-free, see hammer2_inode_meta_begin(). */
+	hammer2_inode_meta_copy(ip, &meta);
 
 	vap->va_fsid = pmp->mp->mnt_stat.f_fsid.val[0];
-	vap->va_fileid = ip->meta.inum;
-	vap->va_mode = ip->meta.mode;
-	vap->va_nlink = ip->meta.nlinks;
-	vap->va_uid = hammer2_to_unix_xid(&ip->meta.uid);
-	vap->va_gid = hammer2_to_unix_xid(&ip->meta.gid);
+	vap->va_fileid = meta.inum;
+	vap->va_mode = meta.mode;
+	vap->va_nlink = meta.nlinks;
+	vap->va_uid = hammer2_to_unix_xid(&meta.uid);
+	vap->va_gid = hammer2_to_unix_xid(&meta.gid);
 	vap->va_rdev = NODEV;
-	vap->va_size = ip->meta.size;
-	vap->va_flags = ip->meta.uflags;
-	hammer2_time_to_timespec(ip->meta.ctime, &vap->va_ctime);
-	hammer2_time_to_timespec(ip->meta.mtime, &vap->va_mtime);
-	hammer2_time_to_timespec(ip->meta.mtime, &vap->va_atime);
+	vap->va_size = meta.size;
+	vap->va_flags = meta.uflags;
+	hammer2_time_to_timespec(meta.ctime, &vap->va_ctime);
+	hammer2_time_to_timespec(meta.mtime, &vap->va_mtime);
+	/* atime is only maintained by relatime mounts and setattr. */
+	hammer2_time_to_timespec(meta.atime ? meta.atime : meta.mtime,
+	    &vap->va_atime);
 	//bzero(&vap->va_birthtime, sizeof(vap->va_birthtime));
 	vap->va_gen = 1;
 	vap->va_blocksize = vp->v_mount->mnt_stat.f_iosize;
-	if (ip->meta.type == HAMMER2_OBJTYPE_DIRECTORY) {
+	if (meta.type == HAMMER2_OBJTYPE_DIRECTORY) {
 		/*
 		 * Can't really calculate directory use sans the files under
 		 * it, just assume one block for now.
@@ -294,7 +314,7 @@ hammer2_getattr(void *v)
 	} else {
 		vap->va_bytes = hammer2_inode_data_count(ip);
 	}
-	vap->va_type = hammer2_get_vtype(ip->meta.type);
+	vap->va_type = hammer2_get_vtype(meta.type);
 	vap->va_filerev = 0;
 
 	return (0);
@@ -359,10 +379,10 @@ hammer2_setattr(void *v)
 
 		if (ip->meta.uflags != vap->va_flags) {
 			hammer2_inode_modify(ip);
-			hammer2_spin_ex(&ip->cluster_spin);
+			hammer2_inode_meta_begin(ip);
 			ip->meta.uflags = vap->va_flags;
 			ip->meta.ctime = ctime;
-			hammer2_spin_unex(&ip->cluster_spin);
+			hammer2_inode_meta_end(ip);
 		}
 		if (ip->meta.uflags & (IMMUTABLE | APPEND))
 			goto done;
@@ -393,12 +413,12 @@ hammer2_setattr(void *v)
 		    bcmp(&uuid_gid, &ip->meta.gid, sizeof(uuid_gid)) ||
 		    ip->meta.mode != mode) {
 			hammer2_inode_modify(ip);
-			hammer2_spin_ex(&ip->cluster_spin);
+			hammer2_inode_meta_begin(ip);
 			ip->meta.uid = uuid_uid;
 			ip->meta.gid = uuid_gid;
 			ip->meta.mode = mode;
 			ip->meta.ctime = ctime;
-			hammer2_spin_unex(&ip->cluster_spin);
+			hammer2_inode_meta_end(ip);
 		}
 	}
 
@@ -416,7 +436,9 @@ hammer2_setattr(void *v)
 				hammer2_extend_file(ip, vap->va_size);
 			}
 			hammer2_inode_modify(ip);
+			hammer2_inode_meta_begin(ip);
 			ip->meta.mtime = ctime;
+			hammer2_inode_meta_end(ip);
 			break;
 		case VDIR:
 			error = EISDIR;
@@ -455,22 +477,29 @@ hammer2_setattr(void *v)
 		mode |= vap->va_mode & ALLPERMS;
 		if (ip->meta.mode != mode) {
 			hammer2_inode_modify(ip);
-			hammer2_spin_ex(&ip->cluster_spin);
+			hammer2_inode_meta_begin(ip);
 			ip->meta.mode = mode;
 			ip->meta.ctime = ctime;
-			hammer2_spin_unex(&ip->cluster_spin);
+			hammer2_inode_meta_end(ip);
 		}
 	}
 
-	/* DragonFly HAMMER2 doesn't support atime either. */
-	if (vap->va_mtime.tv_sec != (time_t)VNOVAL) {
+	if (vap->va_atime.tv_sec != (time_t)VNOVAL ||
+	    vap->va_mtime.tv_sec != (time_t)VNOVAL) {
 		if (cred->cr_uid != uid && (error = suser_ucred(cred)) &&
 		    ((vap->va_vaflags & VA_UTIMES_NULL) == 0 ||
 		    (error = VOP_ACCESS(vp, VWRITE, cred, ap->a_p))))
 			goto done;
 
 		hammer2_inode_modify(ip);
-		ip->meta.mtime = hammer2_timespec_to_time(&vap->va_mtime);
+		hammer2_inode_meta_begin(ip);
+		if (vap->va_atime.tv_sec != (time_t)VNOVAL)
+			ip->meta.atime =
+			    hammer2_timespec_to_time(&vap->va_atime);
+		if (vap->va_mtime.tv_sec != (time_t)VNOVAL)
+			ip->meta.mtime =
+			    hammer2_timespec_to_time(&vap->va_mtime);
+		hammer2_inode_meta_end(ip);
 	}
 done:
 	/*
@@ -698,6 +727,41 @@ hammer2_read_file(hammer2_inode_t *ip, struct uio *uio, int ioflag)
 	return (error);
 }
 
+/*
+ * Update atime after a read on relatime mounts.  As with Linux relatime
+ * the update is skipped unless the previous atime is older than mtime or
+ * ctime, or more than a day old, so a file that is read repeatedly is
+ * only dirtied once per modification.  On lazytime mounts the update
+ * stays in-core until the inode is written out for another reason.
+ *
+ * The inode must not be locked.
+ */
+static void
+hammer2_update_atime(hammer2_inode_t *ip)
+{
+	hammer2_pfs_t *pmp = ip->pmp;
+	uint64_t atime;
+
+	if ((pmp->hflags & HMNT2_RELATIME) == 0 || pmp->rdonly ||
+	    (pmp->mp->mnt_flag & MNT_NOATIME))
+		return;
+
+	hammer2_update_time(&atime);
+	if (ip->meta.atime > ip->meta.mtime &&
+	    ip->meta.atime > ip->meta.ctime &&
+	    atime - ip->meta.atime < HAMMER2_RELATIME_INTERVAL)
+		return;
+
+	hammer2_trans_init(pmp, 0);
+	hammer2_mtx_ex(&ip->lock);
+	hammer2_inode_meta_begin(ip);
+	ip->meta.atime = atime;
+	hammer2_inode_meta_end(ip);
+	hammer2_inode_touch(ip);
+	hammer2_mtx_unlock(&ip->lock);
+	hammer2_trans_done(pmp, HAMMER2_TRANS_SIDEQ);
+}
+
 static int
 hammer2_readlink(void *v)
 {
@@ -727,12 +791,18 @@ hammer2_read(void *v)
 	struct vnode *vp = ap->a_vp;
 	hammer2_inode_t *ip = VTOI(vp);
 
+	int error;
+
 	if (vp->v_type == VDIR)
 		return (EISDIR);
 	if (vp->v_type != VREG)
 		return (EINVAL);
 
-	return (hammer2_read_file(ip, ap->a_uio, ap->a_ioflag));
+	error = hammer2_read_file(ip, ap->a_uio, ap->a_ioflag);
+	if (error == 0)
+		hammer2_update_atime(ip);
+
+	return (error);
 }
 
 /*
@@ -780,7 +850,8 @@ hammer2_write_file(hammer2_inode_t *ip, struct uio *uio, int ioflag)
 	 * to write.
 	 *
 	 * Doing this now makes it easier to calculate buffer sizes in
-	 * the loop.
+	 * the loop.  The size change always modifies the inode, lazytime
+	 * only defers the timestamps, so appends gain nothing from it.
 	 */
 	if (uio->uio_offset + uio->uio_resid > old_eof) {
 		new_eof = uio->uio_offset + uio->uio_resid;
@@ -899,8 +970,10 @@ hammer2_write_file(hammer2_inode_t *ip, struct uio *uio, int ioflag)
 		hammer2_mtx_unlock(&ip->lock);
 	} else if (modified) {
 		hammer2_mtx_ex(&ip->lock);
-		hammer2_inode_modify(ip);
+		hammer2_inode_meta_begin(ip);
 		hammer2_update_time(&ip->meta.mtime);
+		hammer2_inode_meta_end(ip);
+		hammer2_inode_touch(ip);
 		hammer2_mtx_unlock(&ip->lock);
 	}
 	hammer2_trans_assert_strategy(ip->pmp);
@@ -992,7 +1065,9 @@ hammer2_truncate_file(hammer2_inode_t *ip, hammer2_key_t nsize)
 	hammer2_mtx_ex(&ip->lock);
 	KKASSERT((ip->flags & HAMMER2_INODE_RESIZED) == 0);
 	ip->osize = ip->meta.size;
+	hammer2_inode_meta_begin(ip);
 	ip->meta.size = nsize;
+	hammer2_inode_meta_end(ip);
 	atomic_set_int(&ip->flags, HAMMER2_INODE_RESIZED);
 	hammer2_inode_modify(ip);
 }
@@ -1026,7 +1101,9 @@ hammer2_extend_file(hammer2_inode_t *ip, hammer2_key_t nsize)
 
 	hammer2_inode_modify(ip);
 	ip->osize = osize;
+	hammer2_inode_meta_begin(ip);
 	ip->meta.size = nsize;
+	hammer2_inode_meta_end(ip);
 
 	/*
 	 * We must issue a chain_sync() when the DIRECTDATA state changes
@@ -1062,6 +1139,98 @@ hammer2_extend_file(hammer2_inode_t *ip, hammer2_key_t nsize)
 	hammer2_mtx_ex(&ip->lock);
 }
 
+/*
+ * Deallocate the byte range [off, off + len) of a regular file without
+ * changing its size (hole punch).  The range is clipped to the EOF.
+ *
+ * Logical buffers only partially within the range are zeroed and left
+ * for the strategy code, which deletes the block if it ends up all zero.
+ * Cached buffers of whole blocks are discarded so they cannot write the
+ * data back, then the backend deletes the chains covering those blocks.
+ *
+ * The transaction must be held and the vnode locked.
+ */
+int
+hammer2_punch_file(hammer2_inode_t *ip, hammer2_key_t off, hammer2_key_t len)
+{
+	struct vnode *vp = ip->vp;
+	hammer2_xop_punch_t *xop;
+	hammer2_key_t size, pend, lbase, key_beg, key_end;
+	struct buf *bp;
+	daddr_t lbn;
+	int lblksize, loff, n, directdata, error = 0;
+
+	hammer2_mtx_ex(&ip->lock);
+	hammer2_mtx_ex(&ip->truncate_lock);
+	size = ip->meta.size;
+	directdata = ip->meta.op_flags & HAMMER2_OPFLAG_DIRECTDATA;
+	if (off >= size || len == 0) {
+		hammer2_mtx_unlock(&ip->lock);
+		goto done;
+	}
+	pend = (len > size - off) ? size : off + len;
+	hammer2_mtx_unlock(&ip->lock);
+
+	key_beg = HAMMER2_KEY_MAX;
+	key_end = 0;
+	while (off < pend) {
+		lblksize = hammer2_calc_logical(ip, off, &lbase, NULL);
+		lbn = lbase / lblksize;
+		loff = (int)(off - lbase);
+		n = lblksize - loff;
+		if (n > pend - off)
+			n = pend - off;
+
+		if (loff == 0 && (n == lblksize || off + n == size) &&
+		    directdata == 0) {
+			if (incore(vp, lbn) != NULL) {
+				bp = getblk(vp, lbn, lblksize, 0, 0);
+				bp->b_flags |= B_INVAL;
+				brelse(bp);
+			}
+			if (key_beg == HAMMER2_KEY_MAX)
+				key_beg = lbase;
+			key_end = lbase + lblksize - 1;
+		} else {
+			error = bread(vp, lbn, lblksize, &bp);
+			if (error) {
+				brelse(bp);
+				break;
+			}
+			memset(bp->b_data + loff, 0, n);
+			bdwrite(bp);
+		}
+		off += n;
+	}
+
+	hammer2_mtx_ex(&ip->lock);
+	if (error == 0 && key_beg <= key_end) {
+		xop = hammer2_xop_alloc(ip, HAMMER2_XOP_MODIFYING);
+		xop->key_beg = key_beg;
+		xop->key_end = key_end;
+		hammer2_xop_start(&xop->head, &hammer2_inode_punch_desc);
+		error = hammer2_xop_collect(&xop->head, 0);
+		hammer2_xop_retire(&xop->head, HAMMER2_XOPMASK_VOP);
+		if (error == HAMMER2_ERROR_ENOENT)
+			error = 0;
+		error = hammer2_error_to_errno(error);
+	}
+	hammer2_inode_modify(ip);
+	hammer2_inode_meta_begin(ip);
+	hammer2_update_time(&ip->meta.mtime);
+	ip->meta.ctime = ip->meta.mtime;
+	hammer2_inode_meta_end(ip);
+	hammer2_mtx_unlock(&ip->lock);
+
+	/* Drop cached pages so that mmap cannot see the punched data. */
+	uvm_vnp_uncache(vp);
+done:
+	hammer2_trans_assert_strategy(ip->pmp);
+	hammer2_mtx_unlock(&ip->truncate_lock);
+
+	return (error);
+}
+
 /*
  * While bmap implementation itself works, HAMMER2 needs to force VFS to invoke
  * logical vnode strategy (rather than device vnode strategy) unless compression
@@ -1379,7 +1548,9 @@ hammer2_mknod(void *v)
 		/*hammer2_inode_lock(dip, HAMMER2_RESOLVE_SHARED);*/
 		hammer2_update_time(&mtime);
 		hammer2_inode_modify(dip);
+		hammer2_inode_meta_begin(dip);
 		dip->meta.mtime = mtime;
+		hammer2_inode_meta_end(dip);
 		/*hammer2_inode_unlock(dip);*/
 	}
 	hammer2_inode_unlock(dip);
@@ -1478,7 +1649,9 @@ hammer2_mkdir(void *v)
 		/*hammer2_inode_lock(dip, HAMMER2_RESOLVE_SHARED);*/
 		hammer2_update_time(&mtime);
 		hammer2_inode_modify(dip);
+		hammer2_inode_meta_begin(dip);
 		dip->meta.mtime = mtime;
+		hammer2_inode_meta_end(dip);
 		/*hammer2_inode_unlock(dip);*/
 	}
 	hammer2_inode_unlock(dip);
@@ -1570,7 +1743,9 @@ hammer2_create(void *v)
 		/*hammer2_inode_lock(dip, HAMMER2_RESOLVE_SHARED);*/
 		hammer2_update_time(&mtime);
 		hammer2_inode_modify(dip);
+		hammer2_inode_meta_begin(dip);
 		dip->meta.mtime = mtime;
+		hammer2_inode_meta_end(dip);
 		/*hammer2_inode_unlock(dip);*/
 	}
 	hammer2_inode_unlock(dip);
@@ -1662,7 +1837,9 @@ hammer2_rmdir(void *v)
 		/*hammer2_inode_lock(dip, HAMMER2_RESOLVE_SHARED);*/
 		hammer2_update_time(&mtime);
 		hammer2_inode_modify(dip);
+		hammer2_inode_meta_begin(dip);
 		dip->meta.mtime = mtime;
+		hammer2_inode_meta_end(dip);
 		/*hammer2_inode_unlock(dip);*/
 	}
 	hammer2_inode_unlock(dip);
@@ -1747,7 +1924,9 @@ hammer2_remove(void *v)
 		/*hammer2_inode_lock(dip, HAMMER2_RESOLVE_SHARED);*/
 		hammer2_update_time(&mtime);
 		hammer2_inode_modify(dip);
+		hammer2_inode_meta_begin(dip);
 		dip->meta.mtime = mtime;
+		hammer2_inode_meta_end(dip);
 		/*hammer2_inode_unlock(dip);*/
 	}
 	hammer2_inode_unlock(dip);
@@ -1919,12 +2098,16 @@ hammer2_rename(void *v)
 		if (error == 0 &&
 		    (fip->meta.name_key & HAMMER2_DIRHASH_VISIBLE)) {
 			hammer2_inode_modify(fip);
+			hammer2_inode_meta_begin(fip);
 			fip->meta.name_len = tcnp->cn_namelen;
 			fip->meta.name_key = tlhc;
+			hammer2_inode_meta_end(fip);
 		}
 		if (error == 0) {
 			hammer2_inode_modify(fip);
+			hammer2_inode_meta_begin(fip);
 			fip->meta.iparent = tdip->meta.inum;
+			hammer2_inode_meta_end(fip);
 		}
 		update_fdip = 1;
 		update_tdip = 1;
@@ -1943,11 +2126,15 @@ done2:
 		hammer2_update_time(&mtime);
 		if (update_fdip) {
 			hammer2_inode_modify(fdip);
+			hammer2_inode_meta_begin(fdip);
 			fdip->meta.mtime = mtime;
+			hammer2_inode_meta_end(fdip);
 		}
 		if (update_tdip) {
 			hammer2_inode_modify(tdip);
+			hammer2_inode_meta_begin(tdip);
 			tdip->meta.mtime = mtime;
+			hammer2_inode_meta_end(tdip);
 		}
 	}
 	if (tip) {
@@ -2052,14 +2239,18 @@ hammer2_link(void *v)
 	error = hammer2_dirent_create(tdip, cnp->cn_nameptr, cnp->cn_namelen,
 	    ip->meta.inum, ip->meta.type);
 	hammer2_inode_modify(ip);
+	hammer2_inode_meta_begin(ip);
 	++ip->meta.nlinks;
 	ip->meta.ctime = cmtime;
+	hammer2_inode_meta_end(ip);
 
 	if (error == 0) {
 		/* Update dip's [cm]time. */
 		hammer2_inode_modify(tdip);
+		hammer2_inode_meta_begin(tdip);
 		tdip->meta.mtime = cmtime;
 		tdip->meta.ctime = cmtime;
+		hammer2_inode_meta_end(tdip);
 	}
 	hammer2_inode_unlock(ip);
 	hammer2_inode_unlock(tdip);
@@ -2172,7 +2363,9 @@ hammer2_symlink(void *v)
 		/*hammer2_inode_lock(dip, HAMMER2_RESOLVE_SHARED);*/
 		hammer2_update_time(&mtime);
 		hammer2_inode_modify(dip);
+		hammer2_inode_meta_begin(dip);
 		dip->meta.mtime = mtime;
+		hammer2_inode_meta_end(dip);
 		/*hammer2_inode_unlock(dip);*/
 	}
 	hammer2_inode_unlock(dip);
@@ -1238,6 +1238,68 @@ done:
 	}
 }
 
+/*
+ * Delete the data chains covering [key_beg, key_end] of a regular file
+ * (hole punch).  Indirect blocks entirely within the range are deleted
+ * without resolving them, the chains below are never instantiated and
+ * their storage is reclaimed by bulkfree.  Data chains straddling the
+ * range are left alone, the frontend zeroes those through the buffer
+ * cache.
+ */
+void
+hammer2_xop_inode_punch(hammer2_xop_t *arg, void *scratch, int clindex)
+{
+	hammer2_xop_punch_t *xop = &arg->xop_punch;
+	hammer2_chain_t *parent, *chain = NULL;
+	hammer2_key_t key_next, key_lim;
+	int error = 0;
+
+	parent = hammer2_inode_chain(xop->head.ip1, clindex,
+	    HAMMER2_RESOLVE_ALWAYS);
+	if (parent == NULL) {
+		error = HAMMER2_ERROR_EIO;
+		goto done;
+	}
+	if (parent->error) {
+		error = parent->error;
+		goto done;
+	}
+
+	chain = hammer2_chain_lookup(&parent, &key_next, xop->key_beg,
+	    xop->key_end, &error, HAMMER2_LOOKUP_NODATA |
+	    HAMMER2_LOOKUP_NODIRECT | HAMMER2_LOOKUP_ENCLOSED);
+	while (chain) {
+		key_lim = chain->bref.key +
+		    ((hammer2_key_t)1 << chain->bref.keybits) - 1;
+		switch (chain->bref.type) {
+		case HAMMER2_BREF_TYPE_DIRENT:
+		case HAMMER2_BREF_TYPE_INODE:
+			KKASSERT(0);
+			break;
+		case HAMMER2_BREF_TYPE_DATA:
+		case HAMMER2_BREF_TYPE_INDIRECT:
+			if (chain->bref.key >= xop->key_beg &&
+			    key_lim <= xop->key_end)
+				hammer2_chain_delete(parent, chain,
+				    xop->head.mtid, HAMMER2_DELETE_PERMANENT);
+			break;
+		}
+		chain = hammer2_chain_next(&parent, chain, &key_next,
+		    key_next, xop->key_end, &error, HAMMER2_LOOKUP_NODATA |
+		    HAMMER2_LOOKUP_NODIRECT | HAMMER2_LOOKUP_ENCLOSED);
+	}
+done:
+	if (chain) {
+		hammer2_chain_unlock(chain);
+		hammer2_chain_drop(chain);
+	}
+	if (parent) {
+		hammer2_chain_unlock(parent);
+		hammer2_chain_drop(parent);
+	}
+	hammer2_xop_feed(&xop->head, NULL, clindex, error);
+}
+
 void
 hammer2_xop_inode_connect(hammer2_xop_t *arg, void *scratch, int clindex)
 {